@@ -0,0 +1,399 @@
+//
+// Shared recall-vs-QPS harness of dann_bench and faiss_bench: both read the same
+// ann-benchmarks HDF5 file (train / test / neighbors), sweep the same grid of
+// nlist x nprobe x threads x batch, and write one CSV or JSON row per point, so
+// the two engines can be compared line by line.
+//
+// Options come as --key=value on the command line or as key=value lines of a
+// --config file (command line wins); list-valued keys take comma separated values:
+//   --dataset=data/nytimes-256-angular.hdf5   --metric=angular|euclidean (from the file name by default)
+//   --k=10  --queries=10000  --nlist=4096  --nprobe=1,8,32,64,128
+//   --threads=1  --batch=1  --shards=4 (dann only)
+//   --format=csv|json  --output=<file> (stdout by default)
+//
+
+#ifndef DANN_BENCH_HARNESS_H
+#define DANN_BENCH_HARNESS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <unistd.h>
+
+#include <H5Cpp.h>
+
+namespace bench {
+
+struct Options {
+    std::string dataset = "data/nytimes-256-angular.hdf5";
+    std::string metric; // angular or euclidean; empty infers it from the dataset name
+    int k = 10;
+    int queries = 10000; // 0 runs every test query
+    std::vector<int> nlist{4096};
+    std::vector<int> nprobe{1, 8, 32, 64, 128};
+    std::vector<int> threads{1};
+    std::vector<int> batch{1};
+    int shards = 4;
+    std::string format = "csv";
+    std::string output;
+
+    bool angular() const { return metric == "angular"; }
+};
+
+struct Dataset {
+    int dimension = 0;
+    int train_rows = 0;
+    int test_rows = 0;
+    std::vector<float> train;
+    std::vector<float> test;
+    // gt_k neighbor ids per test row, empty when the file has no ground truth
+    std::vector<int64_t> neighbors;
+    int gt_k = 0;
+};
+
+// one measured point of the sweep
+struct Point {
+    std::string engine;
+    int nlist = 0;
+    int nprobe = 0;
+    int threads = 0;
+    int batch = 0;
+    int queries = 0;
+    double recall = -1.0; // -1 without ground truth
+    double qps = 0.0;
+    double p50_ms = 0.0;
+    double p95_ms = 0.0;
+    double p99_ms = 0.0;
+    double build_ms = 0.0;
+    double memory_mb = 0.0; // resident set growth over the build
+};
+
+// searches n queries (dimension floats each) and writes k labels per query to labels,
+// which arrive filled with -1
+using SearchFn = std::function<void(const float* queries, int n, int k, int nprobe, int64_t* labels)>;
+
+inline std::vector<int> parse_int_list(const std::string& value) {
+    std::vector<int> values;
+    std::stringstream in(value);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(std::stoi(item));
+        }
+    }
+    if (values.empty()) {
+        throw std::invalid_argument("empty list: " + value);
+    }
+    return values;
+}
+
+inline void apply_option(Options* options, const std::string& key, const std::string& value) {
+    if (key == "dataset") {
+        options->dataset = value;
+    } else if (key == "metric") {
+        options->metric = value;
+    } else if (key == "k") {
+        options->k = std::stoi(value);
+    } else if (key == "queries") {
+        options->queries = std::stoi(value);
+    } else if (key == "nlist") {
+        options->nlist = parse_int_list(value);
+    } else if (key == "nprobe") {
+        options->nprobe = parse_int_list(value);
+    } else if (key == "threads") {
+        options->threads = parse_int_list(value);
+    } else if (key == "batch") {
+        options->batch = parse_int_list(value);
+    } else if (key == "shards") {
+        options->shards = std::stoi(value);
+    } else if (key == "format") {
+        options->format = value;
+    } else if (key == "output") {
+        options->output = value;
+    } else {
+        throw std::invalid_argument("unknown option: " + key);
+    }
+}
+
+inline Options parse_options(int argc, char** argv) {
+    Options options;
+    std::map<std::string, std::string> cli;
+    std::string config;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            throw std::invalid_argument("expected --key=value, got " + arg);
+        }
+        const std::string key = arg.substr(2, eq - 2);
+        if (key == "config") {
+            config = arg.substr(eq + 1);
+        } else {
+            cli[key] = arg.substr(eq + 1);
+        }
+    }
+    if (!config.empty()) {
+        std::ifstream in(config);
+        if (!in) {
+            throw std::runtime_error("cannot read config " + config);
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            const size_t eq = line.find('=');
+            if (line.empty() || line[0] == '#' || eq == std::string::npos) {
+                continue;
+            }
+            apply_option(&options, line.substr(0, eq), line.substr(eq + 1));
+        }
+    }
+    for (const auto& [key, value]: cli) {
+        apply_option(&options, key, value);
+    }
+    if (options.metric.empty()) {
+        options.metric = options.dataset.find("angular") != std::string::npos ? "angular" : "euclidean";
+    }
+    if (options.format != "csv" && options.format != "json") {
+        throw std::invalid_argument("format must be csv or json");
+    }
+    return options;
+}
+
+// a 2-D dataset converted to T on read; false if the file has no such dataset
+template<typename T>
+bool read_matrix(H5::H5File& file, const std::string& name, const H5::PredType& type, std::vector<T>* data,
+                 int* rows, int* cols) {
+    if (!file.nameExists(name)) {
+        return false;
+    }
+    H5::DataSet dataset = file.openDataSet(name);
+    H5::DataSpace space = dataset.getSpace();
+    if (space.getSimpleExtentNdims() != 2) {
+        throw std::runtime_error("expected a 2-D dataset: " + name);
+    }
+    hsize_t dims[2];
+    space.getSimpleExtentDims(dims, nullptr);
+    *rows = static_cast<int>(dims[0]);
+    *cols = static_cast<int>(dims[1]);
+    data->resize(static_cast<size_t>(dims[0]) * dims[1]);
+    dataset.read(data->data(), type, space);
+    return true;
+}
+
+inline Dataset load_dataset(const Options& options) {
+    H5::Exception::dontPrint();
+    H5::H5File file(options.dataset, H5F_ACC_RDONLY);
+    Dataset data;
+    int test_cols = 0;
+    if (!read_matrix(file, "train", H5::PredType::NATIVE_FLOAT, &data.train, &data.train_rows, &data.dimension) ||
+        !read_matrix(file, "test", H5::PredType::NATIVE_FLOAT, &data.test, &data.test_rows, &test_cols)) {
+        throw std::runtime_error(options.dataset + " lacks the train or test dataset");
+    }
+    if (test_cols != data.dimension) {
+        throw std::runtime_error("train and test dimensions differ");
+    }
+    int gt_rows = 0;
+    if (!read_matrix(file, "neighbors", H5::PredType::NATIVE_INT64, &data.neighbors, &gt_rows, &data.gt_k)) {
+        std::cerr << "warning: " << options.dataset << " has no neighbors dataset, recall is not reported" << std::endl;
+    } else if (gt_rows != data.test_rows || data.gt_k < options.k) {
+        std::cerr << "warning: neighbors do not cover k=" << options.k << ", recall is not reported" << std::endl;
+        data.neighbors.clear();
+    }
+    if (options.queries > 0 && options.queries < data.test_rows) {
+        data.test_rows = options.queries;
+        data.test.resize(static_cast<size_t>(data.test_rows) * data.dimension);
+    }
+    return data;
+}
+
+// resident set size of this process
+inline double resident_mb() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    if (!(statm >> pages >> resident)) {
+        return 0.0;
+    }
+    return static_cast<double>(resident) * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+}
+
+// fraction of the true k nearest neighbors found in the first k labels, over all queries
+inline double recall_at_k(const Dataset& data, const std::vector<int64_t>& labels, int k) {
+    if (data.neighbors.empty()) {
+        return -1.0;
+    }
+    size_t hits = 0;
+    for (int q = 0; q < data.test_rows; ++q) {
+        const int64_t* truth = data.neighbors.data() + static_cast<size_t>(q) * data.gt_k;
+        std::unordered_set<int64_t> expected(truth, truth + k);
+        for (int i = 0; i < k; ++i) {
+            hits += expected.count(labels[static_cast<size_t>(q) * k + i]);
+        }
+    }
+    return static_cast<double>(hits) / (static_cast<double>(data.test_rows) * k);
+}
+
+inline double percentile(std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    const size_t rank = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size()))) - 1;
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+// runs every test query through search with nprobe, split into batches shared out to
+// threads workers. Each query's latency is that of the call that answered it
+inline Point measure(const Dataset& data, const Options& options, const SearchFn& search, int nprobe, int threads,
+                     int batch) {
+    using Clock = std::chrono::steady_clock;
+    const int k = options.k;
+    const int nq = data.test_rows;
+    std::vector<int64_t> labels(static_cast<size_t>(nq) * k, -1);
+    std::vector<double> latencies(nq);
+    std::atomic<int> next{0};
+    auto worker = [&] {
+        for (int begin = next.fetch_add(batch); begin < nq; begin = next.fetch_add(batch)) {
+            const int n = std::min(batch, nq - begin);
+            const Clock::time_point start = Clock::now();
+            search(data.test.data() + static_cast<size_t>(begin) * data.dimension, n, k, nprobe,
+                   labels.data() + static_cast<size_t>(begin) * k);
+            const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            std::fill(latencies.begin() + begin, latencies.begin() + begin + n, ms);
+        }
+    };
+    const Clock::time_point start = Clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread: pool) {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Point point;
+    point.nprobe = nprobe;
+    point.threads = threads;
+    point.batch = batch;
+    point.queries = nq;
+    point.recall = recall_at_k(data, labels, k);
+    point.qps = seconds > 0.0 ? nq / seconds : 0.0;
+    std::sort(latencies.begin(), latencies.end());
+    point.p50_ms = percentile(latencies, 0.50);
+    point.p95_ms = percentile(latencies, 0.95);
+    point.p99_ms = percentile(latencies, 0.99);
+    return point;
+}
+
+class Report {
+public:
+    explicit Report(const Options& options): options_(options) {
+        if (!options.output.empty()) {
+            file_.open(options.output);
+            if (!file_) {
+                throw std::runtime_error("cannot write " + options.output);
+            }
+        }
+        if (options_.format == "csv") {
+            out() << "engine,dataset,metric,k,nlist,nprobe,threads,batch,queries,recall,qps,p50_ms,p95_ms,p99_ms,"
+                     "build_ms,memory_mb\n";
+        } else {
+            out() << "[";
+        }
+        out().flush();
+    }
+    ~Report() {
+        if (options_.format == "json") {
+            out() << (rows_ > 0 ? "\n]\n" : "]\n");
+        }
+        out().flush();
+    }
+
+    void add(const Point& p) {
+        if (options_.format == "csv") {
+            out() << p.engine << ',' << options_.dataset << ',' << options_.metric << ',' << options_.k << ','
+                  << p.nlist << ',' << p.nprobe << ',' << p.threads << ',' << p.batch << ',' << p.queries << ','
+                  << p.recall << ',' << p.qps << ',' << p.p50_ms << ',' << p.p95_ms << ',' << p.p99_ms << ','
+                  << p.build_ms << ',' << p.memory_mb << '\n';
+        } else {
+            out() << (rows_ > 0 ? ",\n" : "\n") << "  {\"engine\": \"" << p.engine << "\", \"dataset\": \""
+                  << options_.dataset << "\", \"metric\": \"" << options_.metric << "\", \"k\": " << options_.k
+                  << ", \"nlist\": " << p.nlist << ", \"nprobe\": " << p.nprobe << ", \"threads\": " << p.threads
+                  << ", \"batch\": " << p.batch << ", \"queries\": " << p.queries << ", \"recall\": " << p.recall
+                  << ", \"qps\": " << p.qps << ", \"p50_ms\": " << p.p50_ms << ", \"p95_ms\": " << p.p95_ms
+                  << ", \"p99_ms\": " << p.p99_ms << ", \"build_ms\": " << p.build_ms
+                  << ", \"memory_mb\": " << p.memory_mb << "}";
+        }
+        out().flush();
+        ++rows_;
+    }
+
+private:
+    std::ostream& out() { return file_.is_open() ? file_ : std::cout; }
+
+    const Options& options_;
+    std::ofstream file_;
+    size_t rows_ = 0;
+};
+
+// builds an index over data.train and returns its search, which owns the index: it is
+// released before the next build so the memory figure covers one index only
+using BuildFn = std::function<SearchFn(const Dataset& data, const Options& options, int nlist)>;
+
+inline int run(const std::string& engine, int argc, char** argv, const BuildFn& build) {
+    try {
+        const Options options = parse_options(argc, argv);
+        std::cerr << "loading " << options.dataset << std::endl;
+        const Dataset data = load_dataset(options);
+        std::cerr << "train " << data.train_rows << " x " << data.dimension << ", " << data.test_rows
+                  << " queries, metric " << options.metric << std::endl;
+        Report report(options);
+        SearchFn search;
+        for (int nlist: options.nlist) {
+            search = nullptr;
+            const double rss_before = resident_mb();
+            const auto start = std::chrono::steady_clock::now();
+            search = build(data, options, nlist);
+            const double build_ms =
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            const double memory_mb = resident_mb() - rss_before;
+            std::cerr << engine << ": nlist " << nlist << " built in " << build_ms << " ms" << std::endl;
+            for (int nprobe: options.nprobe) {
+                for (int threads: options.threads) {
+                    for (int batch: options.batch) {
+                        Point point = measure(data, options, search, std::min(nprobe, nlist), threads, batch);
+                        point.engine = engine;
+                        point.nlist = nlist;
+                        point.build_ms = build_ms;
+                        point.memory_mb = memory_mb;
+                        report.add(point);
+                    }
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << engine << ": " << e.what() << std::endl;
+        return 1;
+    } catch (const H5::Exception& e) {
+        std::cerr << engine << ": " << e.getDetailMsg() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace bench
+
+#endif // DANN_BENCH_HARNESS_H
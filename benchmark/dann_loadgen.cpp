@@ -0,0 +1,364 @@
+//
+// Concurrent load generator: drives DistributedIndexIVF in process or a running
+// dann_server over gRPC and reports one latency-vs-throughput point per load level.
+//
+//   closed loop: --mode=closed --clients=1,4,16,64
+//     N clients each send the next query as soon as the previous one returned;
+//     throughput is whatever the system sustains at that concurrency.
+//   open loop:   --mode=open --rate=500,1000,2000 [--workers=256]
+//     queries are scheduled at a fixed rate whether or not earlier ones returned,
+//     and latency is measured from the scheduled start, so time spent queued behind
+//     a stall counts against the queries that waited (no coordinated omission).
+//     workers bounds the queries in flight; beyond it the schedule slips and the
+//     slip shows up as latency.
+//
+// Other options, all --key=value:
+//   --target=inproc|grpc  --server=localhost:50051 (grpc)  --dataset  --metric
+//   --nlist=4096  --shards=4 (inproc build)  --k=10  --nprobe=0 (index default)
+//   --duration=10  --warmup=2 (seconds per point, warmup not recorded)
+//   --format=csv|json  --output=<file>
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_harness.h"
+#include "dann/distributed_index_ivf.h"
+#include "dann/histogram.h"
+
+#ifdef DANN_LOADGEN_GRPC
+#include <grpcpp/grpcpp.h>
+#include "vector_service.grpc.pb.h"
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadOptions {
+    std::string target = "inproc";
+    std::string server = "localhost:50051";
+    std::string dataset = "data/nytimes-256-angular.hdf5";
+    std::string metric;
+    int nlist = 4096;
+    int shards = 4;
+    int k = 10;
+    int nprobe = 0;
+    std::string mode = "closed";
+    std::vector<int> clients{1, 2, 4, 8, 16, 32};
+    std::vector<int> rates{100, 500, 1000, 2000};
+    int workers = 256;
+    double duration_s = 10.0;
+    double warmup_s = 2.0;
+    std::string format = "csv";
+    std::string output;
+};
+
+LoadOptions parse_load_options(int argc, char** argv) {
+    LoadOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            throw std::invalid_argument("expected --key=value, got " + arg);
+        }
+        const std::string key = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+        if (key == "target") {
+            options.target = value;
+        } else if (key == "server") {
+            options.server = value;
+        } else if (key == "dataset") {
+            options.dataset = value;
+        } else if (key == "metric") {
+            options.metric = value;
+        } else if (key == "nlist") {
+            options.nlist = std::stoi(value);
+        } else if (key == "shards") {
+            options.shards = std::stoi(value);
+        } else if (key == "k") {
+            options.k = std::stoi(value);
+        } else if (key == "nprobe") {
+            options.nprobe = std::stoi(value);
+        } else if (key == "mode") {
+            options.mode = value;
+        } else if (key == "clients") {
+            options.clients = bench::parse_int_list(value);
+        } else if (key == "rate") {
+            options.rates = bench::parse_int_list(value);
+        } else if (key == "workers") {
+            options.workers = std::stoi(value);
+        } else if (key == "duration") {
+            options.duration_s = std::stod(value);
+        } else if (key == "warmup") {
+            options.warmup_s = std::stod(value);
+        } else if (key == "format") {
+            options.format = value;
+        } else if (key == "output") {
+            options.output = value;
+        } else {
+            throw std::invalid_argument("unknown option: " + key);
+        }
+    }
+    if (options.metric.empty()) {
+        options.metric = options.dataset.find("angular") != std::string::npos ? "angular" : "euclidean";
+    }
+    if (options.mode != "closed" && options.mode != "open") {
+        throw std::invalid_argument("mode must be closed or open");
+    }
+    if (options.target != "inproc" && options.target != "grpc") {
+        throw std::invalid_argument("target must be inproc or grpc");
+    }
+    return options;
+}
+
+// one search against the system under test; false when it failed
+using QueryFn = std::function<bool(const float* query)>;
+
+struct Queries {
+    int dimension = 0;
+    int count = 0;
+    std::vector<float> data;
+
+    const float* at(uint64_t i) const { return data.data() + (i % count) * dimension; }
+};
+
+QueryFn inproc_target(const LoadOptions& options, const Queries& queries, H5::H5File& file) {
+    std::vector<float> train;
+    int rows = 0;
+    int dimension = 0;
+    if (!bench::read_matrix(file, "train", H5::PredType::NATIVE_FLOAT, &train, &rows, &dimension)) {
+        throw std::runtime_error(options.dataset + " has no train dataset");
+    }
+    auto index = std::make_shared<dann::DistributedIndexIVF>("dann_loadgen", dimension, options.shards,
+                                                             options.nlist, 0,
+                                                             std::vector<std::string>{"node_0", "node_1"});
+    if (options.metric == "angular") {
+        index->set_metric(dann::DistanceType::COSINE);
+    }
+    std::vector<int64_t> ids(rows);
+    std::iota(ids.begin(), ids.end(), 0);
+    const auto start = Clock::now();
+    index->build_index(train.data(), ids.data(), rows);
+    std::cerr << "built " << rows << " x " << dimension << " in "
+              << std::chrono::duration<double>(Clock::now() - start).count() << " s" << std::endl;
+
+    dann::InternalSearchParameters params;
+    params.include_vectors = false;
+    params.nprobe = options.nprobe;
+    const int k = options.k;
+    const int d = queries.dimension;
+    return [index, params, k, d](const float* query) {
+        try {
+            index->search(std::vector<float>(query, query + d), k, params);
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    };
+}
+
+#ifdef DANN_LOADGEN_GRPC
+QueryFn grpc_target(const LoadOptions& options, const Queries& queries) {
+    // stubs are thread-safe and share the channel's connections
+    std::shared_ptr<dann::VectorSearchService::Stub> stub = dann::VectorSearchService::NewStub(
+        grpc::CreateChannel(options.server, grpc::InsecureChannelCredentials()));
+    const int k = options.k;
+    const int nprobe = options.nprobe;
+    const int d = queries.dimension;
+    return [stub, k, nprobe, d](const float* query) {
+        dann::SearchRequest request;
+        request.mutable_query_vector()->Add(query, query + d);
+        request.set_k(k);
+        request.set_nprobe(nprobe);
+        request.set_timeout_ms(5000);
+        dann::SearchResponse response;
+        grpc::ClientContext context;
+        context.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(5));
+        return stub->Search(&context, request, &response).ok();
+    };
+}
+#endif
+
+struct LoadPoint {
+    int clients = 0;           // closed loop
+    double offered_qps = 0.0;  // open loop
+    double achieved_qps = 0.0;
+    uint64_t completed = 0;
+    uint64_t errors = 0;
+    dann::HistogramSnapshot latency; // ms
+};
+
+// N clients back to back for warmup + duration
+LoadPoint run_closed(const QueryFn& query, const Queries& queries, const LoadOptions& options, int clients) {
+    dann::LatencyHistogram latency;
+    std::atomic<uint64_t> next{0};
+    std::atomic<uint64_t> errors{0};
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point measured = start + std::chrono::duration_cast<Clock::duration>(
+                                                   std::chrono::duration<double>(options.warmup_s));
+    const Clock::time_point end = measured + std::chrono::duration_cast<Clock::duration>(
+                                                 std::chrono::duration<double>(options.duration_s));
+    std::vector<std::thread> pool;
+    for (int c = 0; c < clients; ++c) {
+        pool.emplace_back([&] {
+            for (Clock::time_point sent = Clock::now(); sent < end; sent = Clock::now()) {
+                const bool ok = query(queries.at(next.fetch_add(1, std::memory_order_relaxed)));
+                if (sent < measured) {
+                    continue;
+                }
+                if (!ok) {
+                    errors.fetch_add(1, std::memory_order_relaxed);
+                }
+                latency.record(std::chrono::duration<double, std::milli>(Clock::now() - sent).count());
+            }
+        });
+    }
+    for (auto& thread: pool) {
+        thread.join();
+    }
+    LoadPoint point;
+    point.clients = clients;
+    point.latency = latency.snapshot();
+    point.errors = errors.load();
+    point.completed = point.latency.count;
+    point.achieved_qps = static_cast<double>(point.completed) / options.duration_s;
+    return point;
+}
+
+// queries scheduled every 1 / rate seconds, latency taken from the scheduled start
+LoadPoint run_open(const QueryFn& query, const Queries& queries, const LoadOptions& options, int rate) {
+    dann::LatencyHistogram latency;
+    std::atomic<uint64_t> next{0};
+    std::atomic<uint64_t> errors{0};
+    const std::chrono::duration<double> interval(1.0 / rate);
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point measured = start + std::chrono::duration_cast<Clock::duration>(
+                                                   std::chrono::duration<double>(options.warmup_s));
+    const Clock::time_point end = measured + std::chrono::duration_cast<Clock::duration>(
+                                                 std::chrono::duration<double>(options.duration_s));
+    std::atomic<int64_t> last_done{0};
+    std::vector<std::thread> pool;
+    for (int w = 0; w < options.workers; ++w) {
+        pool.emplace_back([&] {
+            for (;;) {
+                const uint64_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+                const Clock::time_point intended =
+                    start + std::chrono::duration_cast<Clock::duration>(interval * static_cast<double>(ticket));
+                if (intended >= end) {
+                    return;
+                }
+                std::this_thread::sleep_until(intended);
+                const bool ok = query(queries.at(ticket));
+                const Clock::time_point done = Clock::now();
+                if (intended < measured) {
+                    continue;
+                }
+                if (!ok) {
+                    errors.fetch_add(1, std::memory_order_relaxed);
+                }
+                latency.record(std::chrono::duration<double, std::milli>(done - intended).count());
+                const int64_t done_ns = (done - start).count();
+                int64_t seen = last_done.load(std::memory_order_relaxed);
+                while (seen < done_ns && !last_done.compare_exchange_weak(seen, done_ns)) {
+                }
+            }
+        });
+    }
+    for (auto& thread: pool) {
+        thread.join();
+    }
+    LoadPoint point;
+    point.offered_qps = rate;
+    point.latency = latency.snapshot();
+    point.errors = errors.load();
+    point.completed = point.latency.count;
+    // a saturated system finishes the scheduled queries late: rate over the time it took
+    const double window = std::max(options.duration_s,
+                                   std::chrono::duration<double>(Clock::duration(last_done.load()) -
+                                                                 (measured - start)).count());
+    point.achieved_qps = static_cast<double>(point.completed) / window;
+    return point;
+}
+
+void write_point(std::ostream& out, const LoadOptions& options, const LoadPoint& p, bool first) {
+    const auto& h = p.latency;
+    if (options.format == "csv") {
+        out << options.target << ',' << options.mode << ',' << p.clients << ',' << p.offered_qps << ','
+            << p.achieved_qps << ',' << p.completed << ',' << p.errors << ',' << h.mean() << ','
+            << h.percentile(50) << ',' << h.percentile(90) << ',' << h.percentile(99) << ','
+            << h.percentile(99.9) << ',' << h.max << '\n';
+    } else {
+        out << (first ? "\n" : ",\n") << "  {\"target\": \"" << options.target << "\", \"mode\": \""
+            << options.mode << "\", \"clients\": " << p.clients << ", \"offered_qps\": " << p.offered_qps
+            << ", \"achieved_qps\": " << p.achieved_qps << ", \"completed\": " << p.completed
+            << ", \"errors\": " << p.errors << ", \"mean_ms\": " << h.mean() << ", \"p50_ms\": "
+            << h.percentile(50) << ", \"p90_ms\": " << h.percentile(90) << ", \"p99_ms\": " << h.percentile(99)
+            << ", \"p999_ms\": " << h.percentile(99.9) << ", \"max_ms\": " << h.max << "}";
+    }
+    out.flush();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        const LoadOptions options = parse_load_options(argc, argv);
+        H5::Exception::dontPrint();
+        H5::H5File file(options.dataset, H5F_ACC_RDONLY);
+        Queries queries;
+        if (!bench::read_matrix(file, "test", H5::PredType::NATIVE_FLOAT, &queries.data, &queries.count,
+                                &queries.dimension) || queries.count == 0) {
+            throw std::runtime_error(options.dataset + " has no test queries");
+        }
+
+        QueryFn query;
+        if (options.target == "inproc") {
+            query = inproc_target(options, queries, file);
+        } else {
+#ifdef DANN_LOADGEN_GRPC
+            query = grpc_target(options, queries);
+#else
+            throw std::runtime_error("built without gRPC, only --target=inproc is available");
+#endif
+        }
+
+        std::ofstream file_out;
+        if (!options.output.empty()) {
+            file_out.open(options.output);
+        }
+        std::ostream& out = file_out.is_open() ? file_out : std::cout;
+        if (options.format == "csv") {
+            out << "target,mode,clients,offered_qps,achieved_qps,completed,errors,mean_ms,p50_ms,p90_ms,p99_ms,"
+                   "p999_ms,max_ms\n";
+        } else {
+            out << "[";
+        }
+        const std::vector<int>& levels = options.mode == "closed" ? options.clients : options.rates;
+        for (size_t i = 0; i < levels.size(); ++i) {
+            std::cerr << options.mode << " loop at " << levels[i]
+                      << (options.mode == "closed" ? " clients" : " qps") << std::endl;
+            const LoadPoint point = options.mode == "closed" ? run_closed(query, queries, options, levels[i])
+                                                             : run_open(query, queries, options, levels[i]);
+            write_point(out, options, point, i == 0);
+        }
+        if (options.format == "json") {
+            out << "\n]\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "dann_loadgen: " << e.what() << std::endl;
+        return 1;
+    } catch (const H5::Exception& e) {
+        std::cerr << "dann_loadgen: " << e.getDetailMsg() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,192 @@
+//
+// Microbenchmarks of the hot loops: distance kernels, top-k centroid search,
+// shard scans, k-means iterations and IO pool dispatch. Inputs come from fixed
+// seeds, so runs differ only by machine noise; for regression checks use
+//   dann_microbench --benchmark_repetitions=5 --benchmark_report_aggregates_only=true
+//                   --benchmark_format=json
+// and compare the medians. Kernel benchmarks run once per SIMD level this CPU
+// supports (the level is the last argument: 0 scalar, 1 AVX2, 2 AVX-512, 3 NEON).
+//
+
+#include <future>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "dann/clustering.h"
+#include "dann/distance_kernels.h"
+#include "dann/io_thread_pool.h"
+#include "dann/ivf_shard.h"
+#include "dann/logger.h"
+#include "dann/utils.h"
+
+namespace {
+
+std::vector<float> random_vectors(size_t n, int d, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    std::vector<float> x(n * d);
+    for (auto& v: x) {
+        v = dist(rng);
+    }
+    return x;
+}
+
+// levels supported here, scalar first
+std::vector<int> simd_levels() {
+    std::vector<int> levels{static_cast<int>(dann::SimdLevel::SCALAR)};
+    if (dann::detected_simd_level() != dann::SimdLevel::SCALAR) {
+        if (dann::detected_simd_level() == dann::SimdLevel::AVX512) {
+            levels.push_back(static_cast<int>(dann::SimdLevel::AVX2));
+        }
+        levels.push_back(static_cast<int>(dann::detected_simd_level()));
+    }
+    return levels;
+}
+
+// restores dispatch to the detected level once a kernel benchmark is done
+struct ScopedSimdLevel {
+    explicit ScopedSimdLevel(int level) { dann::set_simd_level(static_cast<dann::SimdLevel>(level)); }
+    ~ScopedSimdLevel() { dann::set_simd_level(dann::detected_simd_level()); }
+};
+
+// args: d, level
+void BM_L2Distance(benchmark::State& state) {
+    const int d = static_cast<int>(state.range(0));
+    ScopedSimdLevel level(static_cast<int>(state.range(1)));
+    const auto x = random_vectors(1, d, 1);
+    const auto y = random_vectors(1, d, 2);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(dann::L2_distance(x.data(), y.data(), d));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * 2 * d * sizeof(float));
+}
+
+// one query against a block of rows through the batch kernel; args: d, level
+void BM_L2SqrBatch(benchmark::State& state) {
+    const int d = static_cast<int>(state.range(0));
+    ScopedSimdLevel level(static_cast<int>(state.range(1)));
+    constexpr size_t kRows = 1024;
+    const auto rows = random_vectors(kRows, d, 1);
+    const auto query = random_vectors(1, d, 2);
+    std::vector<float> out(kRows);
+    const dann::DistanceBatchKernel kernel = dann::distance_batch_kernel(dann::DistanceType::L2, d);
+    for (auto _: state) {
+        kernel(rows.data(), query.data(), d, kRows, out.data());
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * kRows);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * kRows * d * sizeof(float));
+}
+
+// one query against n = 4096 centroids; args: d, k
+void BM_FindClosestKWithDistance(benchmark::State& state) {
+    const int d = static_cast<int>(state.range(0));
+    const int k = static_cast<int>(state.range(1));
+    constexpr int kCentroids = 4096;
+    const auto centroids = random_vectors(kCentroids, d, 1);
+    const auto query = random_vectors(1, d, 2);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(dann::find_closest_k_with_distance(query.data(), centroids.data(), d, kCentroids, k));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * kCentroids);
+}
+
+// one probed list of the given length; args: rows, d, k
+void BM_ShardSearch(benchmark::State& state) {
+    const size_t rows = static_cast<size_t>(state.range(0));
+    const int d = static_cast<int>(state.range(1));
+    const int k = static_cast<int>(state.range(2));
+    dann::IndexIVFShard shard(d, 0, "node_0");
+    // serial scan, so the figure is the kernel and top-k, not the executor
+    shard.set_parallel_scan(0);
+    dann::InvertedList list;
+    list.vectors = random_vectors(rows, d, 1);
+    list.vector_ids.resize(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        list.vector_ids[i] = static_cast<int64_t>(i);
+    }
+    shard.add_posting(0, list);
+    const auto query = random_vectors(1, d, 2);
+    const std::vector<int64_t> probes{0};
+    for (auto _: state) {
+        benchmark::DoNotOptimize(shard.search(probes, query, k, false));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * rows));
+}
+
+// a single k-means iteration (assignment and update) over 64 * k points; args: d, k
+void BM_ClusteringIteration(benchmark::State& state) {
+    const int d = static_cast<int>(state.range(0));
+    const int k = static_cast<int>(state.range(1));
+    const size_t n = static_cast<size_t>(64) * k;
+    const auto x = random_vectors(n, d, 1);
+    dann::ClusteringParameters params;
+    params.niter = 1;
+    params.nredo = 1;
+    for (auto _: state) {
+        dann::Clustering clustering(d, k, params);
+        clustering.train(x.data(), n);
+        benchmark::DoNotOptimize(clustering.centroids.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * n));
+}
+
+// dispatch cost of one trivial task: enqueue plus waiting on its future
+void BM_IOThreadPoolEnqueue(benchmark::State& state) {
+    dann::IOThreadPool pool(static_cast<size_t>(state.range(0)));
+    for (auto _: state) {
+        pool.enqueue([] { return 1; }).get();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+// enqueue throughput: a burst of 1024 trivial tasks, then waiting for all of them
+void BM_IOThreadPoolBurst(benchmark::State& state) {
+    dann::IOThreadPool pool(static_cast<size_t>(state.range(0)));
+    constexpr int kTasks = 1024;
+    std::vector<std::future<int>> futures;
+    futures.reserve(kTasks);
+    for (auto _: state) {
+        for (int i = 0; i < kTasks; ++i) {
+            futures.push_back(pool.enqueue([i] { return i; }));
+        }
+        for (auto& f: futures) {
+            benchmark::DoNotOptimize(f.get());
+        }
+        futures.clear();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * kTasks);
+}
+
+void kernel_args(benchmark::internal::Benchmark* b) {
+    for (int d: {8, 64, 128, 256, 768}) {
+        for (int level: simd_levels()) {
+            b->Args({d, level});
+        }
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_L2Distance)->Apply(kernel_args);
+BENCHMARK(BM_L2SqrBatch)->Apply(kernel_args);
+BENCHMARK(BM_FindClosestKWithDistance)->ArgsProduct({{64, 128, 256}, {1, 10, 100}});
+BENCHMARK(BM_ShardSearch)->ArgsProduct({{1000, 10000, 100000}, {64, 128, 256}, {10, 100}});
+BENCHMARK(BM_ClusteringIteration)->ArgsProduct({{32, 128}, {64, 256}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_IOThreadPoolEnqueue)->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK(BM_IOThreadPoolBurst)->Arg(1)->Arg(4)->UseRealTime();
+
+int main(int argc, char** argv) {
+    // clustering logs every iteration
+    dann::Logger::instance().set_level(dann::LogLevel::WARN);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,72 @@
+//
+// Per-vector attributes stored by column. Each key is a dictionary-encoded
+// column (id -> value code) with, per distinct value, the roaring bitmap of
+// the ids carrying it. A filter resolves to the intersection of one bitmap per
+// term, and scans test candidate ids against that set before scoring them.
+//
+
+#ifndef DANN_ATTRIBUTE_STORE_H
+#define DANN_ATTRIBUTE_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dann/roaring_bitmap.h"
+#include "dann/types.h"
+
+namespace dann {
+
+constexpr const char* kAttributesFileName = "attributes.bin";
+
+class AttributeStore {
+public:
+    // replaces the attributes of id; an empty map drops them
+    void set(int64_t id, const Attributes& attributes);
+    // false if id had no attributes
+    bool remove(int64_t id);
+    void clear();
+
+    // ids whose attributes match every term of filter. A single term shares the
+    // stored set, cached until the next write to that value, so repeated queries
+    // cost no copy. Safe while other threads write; the set stays valid while held
+    std::shared_ptr<const RoaringBitmap> match(const AttributeFilter& filter) const;
+    // ids with any attribute
+    size_t size() const;
+    size_t memory_bytes() const;
+
+    // the columns as written by save; a missing file loads as an empty store
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+private:
+    struct Column {
+        std::unordered_map<std::string, uint32_t> codes; // value -> code
+        std::vector<std::string> values;                 // code -> value
+        std::vector<RoaringBitmap> ids;                  // code -> ids with that value
+        std::unordered_map<int64_t, uint32_t> rows;      // id -> code
+    };
+    // drops id from column; caller holds mutex_ exclusively
+    void erase_row(const std::string& key, Column& column, int64_t id);
+    // read-only view of (key, code)'s ids, built on first use after a write
+    std::shared_ptr<const RoaringBitmap> snapshot(const std::string& key, uint32_t code,
+                                                  const RoaringBitmap& ids) const;
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, Column> columns_;
+    // ids with attributes -> how many keys they carry
+    std::unordered_map<int64_t, uint32_t> keys_per_id_;
+    // snapshots handed out by match(), dropped by writes to their value
+    mutable std::mutex snapshot_mutex_;
+    mutable std::unordered_map<std::string, std::unordered_map<uint32_t, std::shared_ptr<const RoaringBitmap>>>
+            snapshots_;
+};
+
+} // namespace dann
+
+#endif // DANN_ATTRIBUTE_STORE_H
@@ -0,0 +1,69 @@
+//
+// Chunked block compression for persisted data. A frame splits its input into
+// fixed-size blocks, each compressed on its own (LZ4 for speed, Zstd for ratio)
+// behind a small header, followed by a table of block offsets. A reader can
+// therefore decompress any single block without touching the others.
+//
+// frame:  "DANNBLK\0" | u8 codec | 3 reserved | u32 block_size | u64 raw_size |
+//         blocks... | u64 offset per block | u32 block count | "DANNBLKE"
+// block:  u32 raw_size | u32 stored_size | u8 codec | 3 reserved | u32 checksum | payload
+//
+// A block that does not shrink is stored raw (codec NONE) whatever the frame codec.
+//
+
+#ifndef DANN_BLOCK_COMPRESSION_H
+#define DANN_BLOCK_COMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dann {
+
+enum class CompressionCodec : uint8_t {
+    NONE = 0,
+    LZ4 = 1,  // fast path: cheap to decode on cold start
+    ZSTD = 2  // dense path: better ratio for data read rarely
+};
+
+struct BlockCompressionOptions {
+    CompressionCodec codec = CompressionCodec::LZ4;
+    size_t block_size = 64 * 1024;
+    // zstd level; LZ4 uses its default fast mode
+    int level = 3;
+};
+
+// "lz4", "zstd" or "none"; false for anything else
+bool parse_compression_codec(const std::string& name, CompressionCodec* codec);
+const char* compression_codec_name(CompressionCodec codec);
+
+// true when data starts with a frame header
+bool is_compressed_frame(const char* data, size_t size);
+std::string compress_blocks(const char* data, size_t size, const BlockCompressionOptions& options = {});
+// false on a malformed frame or a block failing its checksum
+bool decompress_blocks(const char* frame, size_t size, std::string* out);
+
+// random access into a frame held in memory (or mapped); the frame must outlive it
+class BlockReader {
+public:
+    bool open(const char* frame, size_t size);
+    size_t block_count() const { return offsets_.size(); }
+    size_t block_size() const { return block_size_; }
+    uint64_t raw_size() const { return raw_size_; }
+    // appends the uncompressed bytes of block i to out
+    bool read_block(size_t i, std::string* out) const;
+    // the uncompressed bytes [offset, offset + length), decoding only the blocks they span
+    bool read_range(uint64_t offset, size_t length, std::string* out) const;
+
+private:
+    const char* frame_{nullptr};
+    size_t size_{0};
+    size_t block_size_{0};
+    uint64_t raw_size_{0};
+    std::vector<uint64_t> offsets_;
+};
+
+} // namespace dann
+
+#endif // DANN_BLOCK_COMPRESSION_H
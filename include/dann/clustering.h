@@ -4,20 +4,41 @@
 
 #ifndef DANN_CLUSTERING_H
 #define DANN_CLUSTERING_H
+#include "dann/gpu_knn.h"
 #include "dann/types.h"
 #include <faiss/Index.h>
 #include <faiss/MetricType.h>
 
 namespace dann {
 
+enum class ClusteringInit {
+    RANDOM,          // k distinct training points
+    KMEANS_PARALLEL  // k-means||: D^2-sampled candidates reduced by weighted k-means++
+};
+
 struct ClusteringParameters {
     int niter = 25; // inner iteration counts
     bool int_centroids = false;
+    // training set bounds per centroid: larger inputs are subsampled to
+    // max_points_per_centroids * k (seeded), smaller than min * k are reported
     int min_points_per_centroids = 39;
     int max_points_per_centroids = 256;
     float max_sample_ratio = 0.22;
     int seed = 1234;
-    int nredo = 1; // outer iteration counts
+    int nredo = 1; // outer iteration counts, the run with the best objective is kept
+    // > 0 runs mini-batch k-means: each of the niter steps assigns batch_size points
+    // sampled with replacement and moves their centroids with a per-centroid rate
+    int batch_size = 0;
+    // every draw derives from seed (restart r uses seed + r), so equal inputs give equal centroids
+    ClusteringInit init = ClusteringInit::RANDOM;
+    int init_rounds = 5;          // k-means|| passes over the data
+    float init_oversampling = 2;  // expected candidates per pass, as a multiple of k
+    // L2 is plain k-means; DOT assigns by max inner product, COSINE additionally
+    // keeps centroids on the unit sphere (spherical k-means, input assumed normalized)
+    DistanceType metric = DistanceType::L2;
+    // the seeding and assignment passes run on this GPU when enabled (see gpu_knn.h);
+    // the centroid updates stay on the CPU
+    GpuOptions gpu;
 };
 
 struct Clustering:ClusteringParameters {
@@ -31,6 +52,8 @@ struct Clustering:ClusteringParameters {
 
     void train(const std::vector<float>& vectors, const std::vector<faiss::idx_t>& ids);
     void train(const std::vector<float>& vectors, size_t n);
+    // x is n * d floats, read in place
+    void train(const float* x, size_t n);
 
     virtual ~Clustering() = default;
 
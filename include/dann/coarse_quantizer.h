@@ -0,0 +1,55 @@
+//
+// Two-level coarse quantizer: the IVF centroids are themselves clustered into
+// groups, and a query scans only the members of its nearest groups, so picking
+// nprobe lists costs O(groups + probed members) instead of O(nlist).
+//
+
+#ifndef DANN_COARSE_QUANTIZER_H
+#define DANN_COARSE_QUANTIZER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "dann/distance_kernels.h"
+#include "dann/types.h"
+
+namespace dann {
+
+struct CoarseQuantizerParameters {
+    bool enabled = false;
+    int ngroups = 0;     // 0 picks sqrt(nlist)
+    int group_probe = 0; // groups scanned per query, 0 picks max(8, ngroups / 16)
+};
+
+class CoarseQuantizer {
+public:
+    CoarseQuantizer(int d, DistanceType metric, const CoarseQuantizerParameters& params);
+
+    // centroids is nlist * d; results index into it
+    bool train(const float* centroids, int64_t nlist);
+    bool is_trained() const { return !group_centroids_.empty(); }
+
+    // the k centroids closest to query among the members of the probed groups,
+    // near to far, scored like distance_batch_kernel(metric)
+    std::vector<DistanceWithIndex> search(const float* query, int k) const;
+
+    int ngroups() const { return ngroups_; }
+    int group_probe() const { return group_probe_; }
+
+private:
+    int dimension_;
+    DistanceType metric_;
+    CoarseQuantizerParameters params_;
+    DistanceBatchKernel kernel_;
+    int ngroups_{0};
+    int group_probe_{0};
+    std::vector<float> group_centroids_;
+    // members of group g are rows [member_offsets_[g], member_offsets_[g + 1])
+    std::vector<int64_t> member_offsets_;
+    std::vector<int64_t> member_ids_;
+    std::vector<float> member_vectors_;
+};
+
+}
+
+#endif //DANN_COARSE_QUANTIZER_H
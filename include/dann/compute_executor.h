@@ -0,0 +1,176 @@
+//
+// Work-stealing executor for CPU-bound work: shard scans, centroid assignment
+// and clustering. One worker per core, each owning a lock-free deque; idle
+// workers steal from the others. Blocking I/O stays on the IOThreadPool.
+//
+
+#ifndef DANN_COMPUTE_EXECUTOR_H
+#define DANN_COMPUTE_EXECUTOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace dann {
+
+class WorkStealingDeque;
+
+class ComputeExecutor {
+public:
+    // intrusive task; run executes it and owns its lifetime from then on
+    struct Job {
+        void (*run)(Job*);
+    };
+
+    // numa_node >= 0 pins every worker to that node's CPUs; threads = 0 then
+    // means one worker per CPU of the node
+    explicit ComputeExecutor(size_t threads = 0, int numa_node = -1);
+    ~ComputeExecutor();
+
+    ComputeExecutor(const ComputeExecutor&) = delete;
+    ComputeExecutor& operator=(const ComputeExecutor&) = delete;
+    ComputeExecutor(ComputeExecutor&&) = delete;
+    ComputeExecutor& operator=(ComputeExecutor&&) = delete;
+
+    template <typename F>
+    auto submit(F&& f) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using R = std::invoke_result_t<std::decay_t<F>>;
+        struct TaskJob: Job {
+            std::packaged_task<R()> task;
+            explicit TaskJob(F&& f): task(std::forward<F>(f)) { run = &TaskJob::invoke; }
+            static void invoke(Job* job) {
+                auto* self = static_cast<TaskJob*>(job);
+                self->task();
+                delete self;
+            }
+        };
+        auto* job = new TaskJob(std::forward<F>(f));
+        auto result = job->task.get_future();
+        schedule(job);
+        return result;
+    }
+
+    // calls body(lo, hi) over [begin, end) in chunks of at most grain rows, the
+    // calling thread working alongside the pool. Returns once every chunk ran and
+    // rethrows the first exception a chunk threw. Safe to nest from a worker
+    template <typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F&& body) {
+        if (begin >= end) {
+            return;
+        }
+        grain = std::max<size_t>(grain, 1);
+        const size_t nchunks = (end - begin + grain - 1) / grain;
+        if (nchunks == 1) {
+            body(begin, end);
+            return;
+        }
+        using Body = std::remove_reference_t<F>;
+        struct ForState {
+            std::atomic<size_t> remaining;
+            std::atomic<bool> failed{false};
+            std::exception_ptr error;
+        };
+        struct ChunkJob: Job {
+            Body* body;
+            ForState* state;
+            size_t lo;
+            size_t hi;
+            static void invoke(Job* job) {
+                auto* self = static_cast<ChunkJob*>(job);
+                ForState* state = self->state;
+                try {
+                    (*self->body)(self->lo, self->hi);
+                } catch (...) {
+                    if (!state->failed.exchange(true)) {
+                        state->error = std::current_exception();
+                    }
+                }
+                state->remaining.fetch_sub(1, std::memory_order_acq_rel);
+            }
+        };
+
+        ForState state;
+        state.remaining.store(nchunks - 1, std::memory_order_relaxed);
+        // chunk 0 runs inline, the rest are queued
+        std::vector<ChunkJob> jobs(nchunks - 1);
+        std::vector<Job*> queued(nchunks - 1);
+        for (size_t c = 1; c < nchunks; ++c) {
+            ChunkJob& job = jobs[c - 1];
+            job.run = &ChunkJob::invoke;
+            job.body = &body;
+            job.state = &state;
+            job.lo = begin + c * grain;
+            job.hi = std::min(end, job.lo + grain);
+            queued[c - 1] = &job;
+        }
+        schedule(queued.data(), queued.size());
+
+        std::exception_ptr inline_error;
+        try {
+            body(begin, std::min(end, begin + grain));
+        } catch (...) {
+            inline_error = std::current_exception();
+        }
+        // help with queued work (ours or anyone's) until our chunks are done
+        while (state.remaining.load(std::memory_order_acquire) > 0) {
+            if (!run_one()) {
+                std::this_thread::yield();
+            }
+        }
+        if (inline_error) {
+            std::rethrow_exception(inline_error);
+        }
+        if (state.error) {
+            std::rethrow_exception(state.error);
+        }
+    }
+
+    size_t size() const { return workers_.size(); }
+    int numa_node() const { return numa_node_; }
+    // true when called from one of this executor's workers
+    bool in_worker() const;
+
+    void schedule(Job* job);
+    void schedule(Job* const* jobs, size_t n);
+
+private:
+    // runs one queued job on the calling thread; false when none was found
+    bool run_one();
+    Job* find_work(int self);
+    void worker_loop(int index);
+    void wake(size_t n);
+
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<WorkStealingDeque>> deques_;
+    // submissions from outside the pool, and overflow of a full deque
+    std::deque<Job*> injected_;
+    std::mutex injected_mutex_;
+    std::atomic<size_t> injected_size_{0};
+
+    // eventcount: pushers bump epoch_, workers sleep only if it did not move
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+    std::atomic<uint64_t> epoch_{0};
+    std::atomic<int> sleepers_{0};
+    std::atomic<bool> stop_{false};
+    int numa_node_;
+};
+
+// Global compute executor getter (lazy initialization, one worker per core)
+ComputeExecutor& get_compute_executor(size_t threads = 0);
+// executor whose workers are pinned to node, one per CPU of the node, created on first use
+ComputeExecutor& get_numa_executor(int node);
+
+}
+
+#endif //DANN_COMPUTE_EXECUTOR_H
@@ -73,6 +73,8 @@ public:
         std::string local_storage_path;
         size_t local_cache_size;
         bool compression_enabled;
+        std::string compression_codec; // "lz4" (fast) or "zstd" (dense)
+        int compression_level;         // zstd only
         bool encryption_enabled;
         std::string encryption_key;
     };
@@ -166,6 +168,10 @@ private:
     // Configuration parsing helpers
     std::string get_nested_value(const std::vector<std::string>& keys, const std::string& default_value = "") const;
     void set_nested_value(const std::vector<std::string>& keys, const std::string& value);
+    // a value read under config_mutex_ as a number or flag; get_int and get_bool
+    // would look it up as a key and take the mutex again
+    static int parse_int(const std::string& value, int default_value = 0);
+    static bool parse_bool(std::string value);
     
     // Environment variable helpers
     std::string expand_env_var(const std::string& value) const;
@@ -0,0 +1,135 @@
+//
+// SIMD distance kernels, picked once at startup from what the CPU supports.
+//
+
+#ifndef DANN_DISTANCE_KERNELS_H
+#define DANN_DISTANCE_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "dann/types.h"
+
+namespace dann {
+
+enum class SimdLevel {
+    SCALAR,
+    AVX2,   // AVX2 + FMA
+    AVX512, // AVX-512F
+    NEON
+};
+
+// best level supported by this CPU and binary
+SimdLevel detected_simd_level();
+// level the kernels currently dispatch to
+SimdLevel simd_level();
+const char* simd_level_name(SimdLevel level);
+// restricts dispatch to level (clamped to detected_simd_level()), mainly for tests and benchmarks
+void set_simd_level(SimdLevel level);
+
+float l2_sqr(const float* x, const float* y, int d);
+float inner_product(const float* x, const float* y, int d);
+// out[i] = ||x_i - y||^2 for the n rows of x (n * d floats); rows are scored four
+// at a time so every query register load is reused across them
+void l2_sqr_batch(const float* x, const float* y, int d, size_t n, float* out);
+// out[i] = -<x_i, y>, negated so that smaller is closer as for L2
+void neg_inner_product_batch(const float* x, const float* y, int d, size_t n, float* out);
+
+// batch kernel for one metric and dimension at the current level: L2 scores
+// ||x - y||^2, COSINE and DOT score -<x, y> (COSINE expects unit vectors).
+// d = 128, 256, 768 and 1024 get kernels compiled for that dimension, anything
+// else the runtime-d kernel. Resolve once per index or scan; fixed kernels ignore d
+using DistanceBatchKernel = void (*)(const float* x, const float* y, int d, size_t n, float* out);
+DistanceBatchKernel distance_batch_kernel(DistanceType metric, int d);
+DistanceBatchKernel l2_sqr_batch_kernel(int d);
+bool has_specialized_kernel(int d);
+
+// scales each of the n rows of x to unit length; zero rows are left as is
+void normalize_vectors(float* x, size_t n, int d);
+
+// k smallest entries by operator<, kept sorted in a flat array. The common case,
+// an entry worse than the current k-th, costs one compare against a cached bound.
+// T needs a float distance member
+template <typename T>
+class TopKBuffer {
+public:
+    explicit TopKBuffer(size_t k = 0) { reset(k); }
+
+    void reset(size_t k) {
+        k_ = k;
+        entries_.clear();
+        entries_.reserve(k);
+        bound_ = std::numeric_limits<float>::infinity();
+    }
+
+    // false when an entry at this distance cannot enter the buffer
+    bool accepts(float distance) const { return distance <= bound_; }
+
+    void push(const T& entry) {
+        if (k_ == 0 || !accepts(entry.distance)) {
+            return;
+        }
+        if (entries_.size() == k_) {
+            if (!(entry < entries_.back())) {
+                return;
+            }
+            entries_.pop_back();
+        }
+        size_t pos = entries_.size();
+        entries_.push_back(entry);
+        while (pos > 0 && entry < entries_[pos - 1]) {
+            entries_[pos] = entries_[pos - 1];
+            --pos;
+        }
+        entries_[pos] = entry;
+        if (entries_.size() == k_) {
+            bound_ = entries_.back().distance;
+        }
+    }
+
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+    size_t capacity() const { return k_; }
+    // ascending
+    const std::vector<T>& entries() const { return entries_; }
+    std::vector<T> take() {
+        std::vector<T> out;
+        out.swap(entries_);
+        reset(k_);
+        return out;
+    }
+
+private:
+    size_t k_{0};
+    float bound_{std::numeric_limits<float>::infinity()};
+    std::vector<T> entries_;
+};
+
+// scans the n rows of x against y with kernel and pushes (distance, row) for the
+// closest k; make(distance, row) builds the T stored in the buffer
+template <typename T, typename Make>
+void distance_scan(DistanceBatchKernel kernel, const float* x, const float* y, int d, size_t n, TopKBuffer<T>& topk,
+                   Make make) {
+    constexpr size_t kBlock = 64;
+    float distances[kBlock];
+    for (size_t begin = 0; begin < n; begin += kBlock) {
+        const size_t count = n - begin < kBlock ? n - begin : kBlock;
+        kernel(x + begin * d, y, d, count, distances);
+        for (size_t i = 0; i < count; ++i) {
+            if (topk.accepts(distances[i])) {
+                topk.push(make(distances[i], begin + i));
+            }
+        }
+    }
+}
+
+template <typename T, typename Make>
+void l2_sqr_scan(const float* x, const float* y, int d, size_t n, TopKBuffer<T>& topk, Make make) {
+    distance_scan(l2_sqr_batch_kernel(d), x, y, d, n, topk, make);
+}
+
+}
+
+#endif //DANN_DISTANCE_KERNELS_H
@@ -5,52 +5,535 @@
 #ifndef DANN_DISTRIBUTED_INDEX_IVF_H
 #define DANN_DISTRIBUTED_INDEX_IVF_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
 #include <unordered_map>
 
+#include "dann/attribute_store.h"
 #include "dann/clustering.h"
+#include "dann/coarse_quantizer.h"
+#include "dann/distance_kernels.h"
+#include "dann/gpu_knn.h"
+#include "dann/ivf_index_io.h"
 #include "dann/ivf_shard.h"
+#include "dann/numa.h"
+#include "dann/quantizer.h"
+#include "dann/query_stats.h"
+#include "dann/shard_client.h"
 #include "dann/types.h"
 #include "dann/index_shard.h"
+#include "dann/vector_chunk_reader.h"
+#include "dann/vector_source.h"
 
 namespace dann
 {
 
+struct StreamingBuildOptions {
+    // rows read, assigned and spilled per step
+    size_t chunk_rows = 64 * 1024;
+    // training sample kept while the input is first read when nlist is not fixed;
+    // with a fixed nlist the sample is 64 * nlist rows as in build_index
+    int64_t max_train_rows = 1 << 20;
+    // bound on the rows regrouped into partition order at once, which sets how many
+    // spill buckets are used. The sample, a chunk and the centroids come on top
+    size_t memory_budget_bytes = size_t{1} << 30;
+};
+
+// what one shard holds, for spotting overloaded shards and skewed partitions
+struct IvfShardStats {
+    int shard_id = -1; // -1 for the totals over all local shards
+    std::string node;
+    bool remote = false; // held by another node, nothing is counted here
+    size_t vectors = 0;
+    size_t memory_bytes = 0;
+    // live rows per non-empty posting list
+    size_t lists = 0;
+    size_t min_list = 0;
+    size_t median_list = 0;
+    size_t max_list = 0;
+    // longest list over the mean list; 1 when all lists are equally long
+    double imbalance = 0.0;
+};
+
+// fills the list figures of stats from the given list lengths, which it reorders
+void summarize_list_lengths(std::vector<size_t>* lengths, IvfShardStats* stats);
+
+struct RebalanceOptions {
+    // a shard is overloaded once its load exceeds max_imbalance * the mean shard load
+    double max_imbalance = 1.2;
+    // lists moved per rebalance at most
+    size_t max_moves = 16;
+    // weigh each list by its rows times the probes it received since the last
+    // rebalance (see set_probe_tracking) rather than by its rows alone
+    bool use_probe_load = true;
+};
+
+struct MaintenanceOptions {
+    // lists longer than split_factor * the mean local list are split in two by 2-means
+    double split_factor = 2.0;
+    // lists shorter than merge_factor * the mean are merged into the nearest list
+    double merge_factor = 0.2;
+    // a list whose added rows lie further from the centroid, in mean squared L2, than
+    // drift_factor * the rows it was trained on is moved to the mean of its rows
+    double drift_factor = 1.5;
+    // lists split, merged or re-centred per pass at most
+    size_t max_lists = 8;
+};
+
+struct MaintenanceReport {
+    size_t split = 0;
+    size_t merged = 0;
+    size_t recentred = 0;
+    // rows that changed lists
+    size_t rows_moved = 0;
+};
+
+// growth and quantization error of one local posting list since it was last trained
+struct ListHealth {
+    int64_t centroid = -1;
+    int shard = -1;
+    size_t rows = 0;         // live rows now
+    size_t trained_rows = 0; // live rows when the centroid was last trained
+    // mean squared L2 distance to the centroid of the rows it was trained on, and of
+    // the rows added since; -1 while unknown (after a load the first rows added set it)
+    double trained_error = -1.0;
+    size_t added_rows = 0;
+    double added_error = -1.0;
+};
+
+// the background partition load of a warm start (see set_warm_start)
+struct WarmStartProgress {
+    // non-empty local partitions to read, and their bytes in auxiliary.idx
+    size_t partitions = 0;
+    uint64_t bytes = 0;
+    size_t loaded_partitions = 0;
+    uint64_t loaded_bytes = 0;
+    // no load running: finished, stopped, or no warm start since the last load_index
+    bool done = true;
+};
+
+// one posting list changing shards
+struct ListMove {
+    int64_t centroid = -1;
+    int from_shard = -1;
+    int to_shard = -1;
+};
+
 class DistributedIndexIVF: public IndexShard {
 public:
     DistributedIndexIVF(std::string name, int d, int shards, std::vector<std::string> nodes);
     DistributedIndexIVF(std::string name, int d, int shards, int nlist, int nprobe, std::vector<std::string> nodes);
+    // the first call builds the index; later ones assign the rows to the existing
+    // centroids and append them to the shards, safe while other threads search.
+    // With remote shards nothing is built, and a batch with rows falling in lists of
+    // a remote shard is rejected whole: writes are not forwarded to other nodes
     bool add_vectors(const std::vector<float>& vectors, const std::vector<int64_t>& ids) override;
+    // true once trained: chunks are then assigned to centroids outside the write lock
+    // is_trained_ is only set once the centroids are published, so it alone is read
+    // here without write_mutex_
+    bool accepts_prepared_insert() override { return is_trained_; }
+    std::unique_ptr<PreparedInsert> prepare_insert(std::vector<float> vectors, std::vector<int64_t> ids) override;
+    bool commit_insert(PreparedInsert& prepared) override;
+    // tombstones the row in its shard; searches stop returning it at once and the
+    // storage is reclaimed by compaction. false if the id is not indexed
+    bool remove_vector(int64_t id) override;
+    // remove followed by an online insert of the new vector under the same id; false,
+    // with the old row kept, when the new vector falls in a list of a remote shard
+    bool update_vector(int64_t id, const std::vector<float>& vector) override;
+    // stored by column beside the shards and saved with the index as attributes.bin.
+    // Searches with a filter resolve it to a bitmap of matching ids that the shard
+    // scans test before scoring a row
+    bool set_attributes(const std::vector<int64_t>& ids, const std::vector<Attributes>& attributes) override;
+    // a filter admitting a fraction s of the vectors multiplies nprobe by 1 / s, at most
+    // by max_factor, so selective filters still find k matches. 1 disables widening
+    void set_filter_widening(float max_factor) { filter_widening_ = std::max(1.0f, max_factor); }
+    // rewrites the lists whose deleted share exceeds max_deleted_ratio; returns the lists rewritten
+    size_t compact(float max_deleted_ratio);
+    // compacts in a background thread, woken every interval and after deletes
+    void start_compaction(float max_deleted_ratio = 0.2f,
+                          std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+    void stop_compaction();
+    // trains from scratch and replaces everything indexed so far
     void build_index(const std::vector<float>& vectors, const std::vector<int64_t>& ids);
+    // n rows of dimension floats read in place, e.g. straight out of a ParquetVectorStore
+    void build_index(const float* vectors, const int64_t* ids, int64_t n);
+    // out-of-core build: trains on a seeded reservoir sample taken in a first pass over
+    // reader, then assigns the input chunk by chunk in a second pass and spills the rows
+    // to disk grouped by partition. The result is written to index_path (which becomes
+    // the save directory) and loaded from there, mapped in MMAP mode. Memory stays
+    // bounded by the options, not by the input. Partition balancing and quantization
+    // need all rows in memory and are not applied
+    bool build_index_streaming(VectorChunkReader& reader, const std::string& index_path,
+                               const StreamingBuildOptions& options = {});
     std::vector<InternalSearchResult> search(const std::vector<float>& query, int k) override;
+    std::vector<InternalSearchResult> search(const std::vector<float>& query, int k,
+                                             const InternalSearchParameters& params) override;
+    // queries is nq * dimension floats; returns one top-k list per query
+    std::vector<std::vector<InternalSearchResult>> search_batch(const float* queries, size_t nq, int k,
+                                                                const InternalSearchParameters& params = {}) override;
     std::string index_type() const override;
-    size_t size() override { return 0; }
+    uint64_t version() const override { return version_.load(std::memory_order_acquire); }
+    // live vectors of the local shards
+    size_t size() override;
     int dimension() const override;
+    // index_path is a directory holding manifest.json, index.idx and auxiliary.idx
     bool load_index(const std::string &index_path) override;
-    ~DistributedIndexIVF() = default;
+    bool save_index(const std::string &index_path) const;
+    // when set, build_index persists the index to this directory
+    void set_index_path(const std::string &index_path) { index_path_ = index_path; }
+    // MMAP makes load_index map auxiliary.idx instead of reading it into memory
+    void set_posting_storage_mode(PostingStorageMode mode);
+    // madvise(WILLNEED) the probed partitions before scanning them in MMAP mode
+    void set_mmap_prefetch(bool enabled);
+    // two-phase load for restarting a node: load_index reads only index.idx (centroids
+    // and partition table) and maps auxiliary.idx, so the index routes and answers as
+    // soon as it returns, reading a cold list from disk on its first probe. A
+    // background pass then reads the local partitions into the page cache, hottest
+    // first by the heat map saved with the index (see probe_heat), with up to
+    // parallel_reads preads at once on the IO pool. Puts the shards in MMAP mode.
+    // Call before load_index
+    void set_warm_start(bool enabled, size_t parallel_reads = 4);
+    WarmStartProgress warm_progress() const;
+    // waits for the background load; true when it read every partition
+    bool wait_warm();
+    // abandons the background load; the partitions not read yet fault in when probed
+    void stop_warm();
+    // takes effect on the next build_index, which trains the quantizer on the
+    // training sample (residuals to their coarse centroid for PQ)
+    void set_quantization(const QuantizationParameters& params) { quantization_ = params; }
+    // takes effect on the next build_index; load_index restores the metric of the files.
+    // COSINE stores unit-normalized rows and reports 1 - cos, DOT reports -<q, x>.
+    // With include_vectors a COSINE search returns those normalized rows, not the
+    // vectors as added, unless a vector source (set_vector_source) holds the originals.
+    // Quantization is L2 only and is skipped for the other metrics
+    void set_metric(DistanceType metric);
+    DistanceType metric() const { return metric_; }
+    // picks the probed lists through a second-level IVF over the centroids instead of
+    // scanning all of them; rebuilt from the centroids by build_index and load_index
+    void set_coarse_quantizer(const CoarseQuantizerParameters& params);
+    // k-means settings for the next build_index (metric is taken from set_metric);
+    // seed also drives the training sample, so equal inputs build equal indexes
+    void set_clustering_parameters(const ClusteringParameters& params) { clustering_params_ = params; }
+    // posting lists longer than max_list_factor * n / nlist are split by k-means over
+    // their own rows into extra centroids, bounding the rows scanned per probe.
+    // 0 (the default) keeps the lists as clustered. Takes effect on the next build_index
+    void set_partition_balance(float max_list_factor) { max_list_factor_ = max_list_factor; }
+    // lists probed by searches that do not pass their own nprobe. A value set here or
+    // through the constructor survives rebuilds; otherwise each build derives it from nlist
+    void set_nprobe(int nprobe);
+    int nprobe() const { return nprobe_; }
+    // lets a single query's scan on one shard use several cores: probed rows beyond
+    // 2 * min_chunk_rows are split into chunks scored in parallel. 0 scans serially
+    void set_parallel_scan(size_t min_chunk_rows);
+    // NUMA mode for multi-socket hosts: local shard i belongs to node
+    // numa_nodes()[i % nodes], the way shards are spread over cluster nodes. Its
+    // ARENA postings are allocated on that node and its scans run only on workers
+    // pinned there; the centroids are copied to every node and each search probes
+    // the copy of the node it runs on. Call before serving
+    void set_numa(bool enabled);
+    bool numa() const { return numa_; }
+    int numa_node_of(int shard_id) const;
+    // runs k-means, the build-time assignment of vectors to centroids and the
+    // centroid probe of large search batches on a GPU (see gpu_knn.h). Shard scans
+    // stay on the CPU. Without a GPU backend every pass keeps running on the CPU
+    void set_gpu(const GpuOptions &options);
+    const GpuOptions &gpu() const { return gpu_; }
+    // traces every nth search (a batch counts once) and records its stages into the
+    // search_stage_ms{stage=...} histograms of Metrics, with the lists probed and rows
+    // scanned per query. 0, the default, traces only searches passing params.stats.
+    // Call before serving
+    void set_stage_sampling(uint32_t every);
+    // searches with include_vectors fill the result vectors from source after the merge
+    // instead of copying them out of every shard's candidates; quantized postings then
+    // return the original vectors rather than none. nullptr restores the shard copies
+    void set_vector_source(std::shared_ptr<const VectorSource> source) { vector_source_ = std::move(source); }
+    // two-stage search of a quantized index: the shards return their best k * factor
+    // candidates by code distance, and those are re-ranked by exact distance to the
+    // vector source's rows (e.g. an AuxiliaryVectorSource or a ParquetVectorStore),
+    // read in storage order. The shards can then drop their raw rows (refine_factor 0)
+    // and still reach close to float recall. 0 or 1 disables; searches without a
+    // quantizer or a source of the index dimension stay single stage
+    void set_rerank(int factor) { rerank_factor_ = std::max(0, factor); }
+    // shards placed on a node other than local_node are searched through client: the
+    // coordinator probes the centroids and each remote shard returns its partial top-k.
+    // Every request is bounded by the query's timeout_ms, else by the node's own timeout
+    // (set_node_timeout) or this one. A shard failing or missing it makes the search
+    // throw ShardUnavailableError unless the query allows partial results, in which case
+    // it is left out of the merge. load_index skips the partitions of remote shards;
+    // build_index refuses to run and inserts or updates landing in remote lists fail.
+    // Call before serving
+    void set_remote_shards(std::string local_node, std::shared_ptr<ShardClient> client,
+                           std::chrono::milliseconds timeout = std::chrono::milliseconds(100));
+    void set_node_timeout(const std::string& node, std::chrono::milliseconds timeout);
+    // one entry per shard in shard id order; total, when given, receives the same
+    // figures over the lists of all local shards, and list_lengths the length of
+    // each of those lists (see summarize_list_lengths). Safe while other threads search
+    std::vector<IvfShardStats> shard_stats(IvfShardStats* total = nullptr,
+                                           std::vector<size_t>* list_lengths = nullptr) const;
+    // shard currently serving centroid's posting list. Lists start out on
+    // centroid % shards and keep a moved placement across save_index / load_index
+    // as long as the shard count is unchanged
+    int shard_of(int64_t centroid) const;
+    // counts the probes every list receives, the query load rebalancing weighs
+    // lists by. Costs one relaxed atomic add per probed list
+    void set_probe_tracking(bool enabled) { track_probes_.store(enabled, std::memory_order_relaxed); }
+    // probes per list since the index was built, by centroid id, counted while probe
+    // tracking is on. Unlike the rebalancing load it is never reset: save_index
+    // stores it in heat.idx and load_index carries it on from there
+    std::vector<uint64_t> probe_heat() const;
+    // writes probe_heat() to index_path alone, e.g. before a restart of a node whose
+    // index files are otherwise unchanged
+    bool save_probe_heat(const std::string& index_path) const;
+    // Rebalancing evens out the shards served by this node: it spreads the probe and
+    // scan load over their threads and memory, but never moves load between nodes.
+    // The shard -> node assignment stays as constructed, because a list on another
+    // node could only be moved with a posting transfer RPC the shard service lacks,
+    // and every peer coordinator would have to switch its placement at once.
+    //
+    // the moves that would bring the local shards within options.max_imbalance,
+    // heaviest shard first. Empty when quantized postings kept no raw rows to move
+    std::vector<ListMove> plan_rebalance(const RebalanceOptions& options = {}) const;
+    // applies plan_rebalance and restarts the probe counts; returns the lists moved.
+    // Safe while other threads search
+    size_t rebalance(const RebalanceOptions& options = {});
+    // migrates one posting list, appended rows and tombstones included, to to_shard:
+    // the rows are copied in, searches are switched to the new shard with one
+    // placement swap, and the old copy is dropped once no search still routes by the
+    // previous placement. Searches and size() see every row exactly once throughout.
+    // Both shards must be local; false otherwise or if the list is already there
+    bool move_list(int64_t centroid, int to_shard);
+    // rebalances in a background thread every interval
+    void start_rebalancing(const RebalanceOptions& options = {},
+                           std::chrono::milliseconds interval = std::chrono::milliseconds(60000));
+    void stop_rebalancing();
+    // per-list growth and quantization error of the live local lists, by centroid
+    std::vector<ListHealth> list_health() const;
+    // incremental retraining for drifting data, one bounded pass: overgrown lists are
+    // split by 2-means over their rows, undersized ones merged into their nearest list
+    // and drifted ones re-centred, without a full build_index. Only the rows of the
+    // lists changed are reassigned. Searches keep running: a new list is published
+    // empty, filled together with the trimming of its source in one shard publish,
+    // and only then do the centroids move; a merge empties its list in the same
+    // publish that fills the target. Writes wait for the pass. Merged ids are not
+    // probed again until a later split reuses them; after save_index / load_index
+    // they come back as empty lists. Not applied to quantized postings, and not run
+    // at all once some shard is remote (set_remote_shards): the centroids change on
+    // this node alone, so peer coordinators would route by stale ones. A node that
+    // only serves shards to other coordinators must not be maintained either
+    MaintenanceReport maintain(const MaintenanceOptions& options = {});
+    // maintains in a background thread every interval
+    void start_maintenance(const MaintenanceOptions& options = {},
+                           std::chrono::milliseconds interval = std::chrono::milliseconds(600000));
+    void stop_maintenance();
+    // the serving side of a remote shard search: one local shard's top-k over the given lists
+    bool search_shard(const InternalShardSearchRequest& request, InternalShardSearchResponse* response);
+    ~DistributedIndexIVF() override;
 
 private:
-    std::vector<float> sample_training_vectors(const std::vector<float>& vectors, int64_t n_train) const;
-    int64_t find_closest_optimized(const float* x, const float* y, int d, int n) const;
+    // sorted rows of a seeded uniform sample, empty when every vector is used
+    std::vector<int64_t> sample_training_rows(int64_t total_vectors, int64_t n_train) const;
+    // rows already assigned to their centroids, grouped by shard
+    struct AssignedRows: PreparedInsert {
+        std::vector<std::unordered_map<int64_t, InvertedList>> shard_postings;
+        int64_t rows{0};
+        // placement the rows were grouped by; regrouped on commit if a list moved since
+        uint64_t placement_version{0};
+        // centroids the rows were assigned to; reassigned on commit if maintenance ran since
+        uint64_t centroid_version{0};
+        // rows and their summed squared distance to the centroid, per list
+        std::unordered_map<int64_t, std::pair<int64_t, double>> drift;
+    };
+    // centroid -> shard routing, read under an epoch guard and replaced copy-on-write
+    struct ShardPlacement;
+    // the centroids searches and inserts probe, published like the placement
+    struct CentroidTable;
+    // per list, what list_health reports; guarded by write_mutex_
+    struct ListDrift {
+        int64_t trained_rows{0};
+        double trained_error{-1.0};
+        int64_t added_rows{0};
+        double added_error{0.0};
+    };
+    // replies of the remote shard requests of one search, see send_remote
+    struct RemoteGather;
+
+    // true when the shard lives on another node and is searched through shard_client_
+    bool is_remote(int shard_id) const;
+    // sends each request to the node of its shard and returns at once; nullptr when empty
+    std::shared_ptr<RemoteGather> send_remote(std::vector<InternalShardSearchRequest> requests,
+                                              const InternalSearchParameters& params) const;
+    // waits until every reply arrived or the latest deadline passed; replies come back
+    // in request order, unsuccessful for the shards that failed or are still missing.
+    // Throws ShardUnavailableError for such shards unless params allow partial results
+    std::vector<InternalShardSearchResponse> collect_remote(RemoteGather& gather,
+                                                            const InternalSearchParameters& params) const;
+
+    // build_index with write_mutex_ held; false, leaving the index as it was, when a
+    // shard is remote
+    bool build_index_locked(const float* vectors, const int64_t* ids, int64_t n);
+    // online insert of n rows into the trained index; caller holds write_mutex_.
+    // False, with nothing inserted, when any row falls in a list of a remote shard
+    bool insert_vectors(const float* x, const int64_t* ids, int64_t n);
+    // the lock-free half of an insert: normalize, assign and group by shard
+    void assign_rows(const float* x, const int64_t* ids, int64_t n, AssignedRows* out) const;
+    // the locked half; caller holds write_mutex_. False as insert_vectors
+    bool append_rows(AssignedRows& rows);
+    // true when every row of rows goes to a local shard; logs the first that does not
+    bool local_rows(const AssignedRows& rows) const;
+    // routes centroid by placement, or by centroid % shards when it lies outside it
+    int placement_shard(const ShardPlacement* placement, int64_t centroid) const;
+    // publishes centroid_shard as the placement and retires the previous one,
+    // carrying its probe counts over when keep_probes; caller holds write_mutex_
+    void publish_placement(std::vector<int32_t> centroid_shard, bool keep_probes);
+    // move_list with write_mutex_ held
+    bool move_list_locked(int64_t centroid, int to_shard);
+    // nearest live centroid of each of the n rows of x under metric_; errors, when
+    // given, receives each row's squared L2 distance to it
+    std::vector<int64_t> assign_vectors(const CentroidTable& table, const float* x, int64_t n,
+                                        std::vector<float>* errors = nullptr) const;
+    // the k nearest live centroids of each of the n rows of x, through the coarse
+    // quantizer when the table has one unless exact; labels are -1 padded
+    void nearest_centroids(const CentroidTable& table, const float* x, size_t n, int k, float* distances,
+                           faiss::idx_t* labels, bool exact = false) const;
+    // restarts the drift figures of every list from the rows of a build
+    void reset_list_drift(const float* x, const std::vector<int64_t>& assignments);
+    // the drift figures of one list right after its centroid was (re)trained on rows
+    ListDrift trained_drift(int64_t centroid, const InvertedList& rows) const;
+    // mean of the rows, on the unit sphere for COSINE
+    std::vector<float> rows_mean(const InvertedList& rows) const;
+    // splits every list over the balance cap, appending the new centroids and
+    // rewriting the assignments of the moved rows
+    void split_oversized_lists(const float* x, std::vector<int64_t>* assignments);
+    // buckets rows into one posting per centroid; counts receives the list lengths
+    std::vector<InvertedList> scatter_postings(const float* x, const int64_t* ids,
+                                               const std::vector<int64_t>& assignments, int64_t num_centroids,
+                                               std::vector<int64_t>* counts) const;
+    // rows in the form the shards score: a normalized copy for COSINE, else the input itself
+    const float* normalize_for_metric(const float* queries, size_t nq, std::vector<float>* normalized) const;
+    void finish_load(const IvfIndexManifest& manifest, IvfRuntimeLayout layout);
+    // reads the given partitions of aux_path in order on the warm thread
+    void start_warm(std::string aux_path, std::vector<PartitionDescriptor> order);
+    void train_quantizer(const float* train_vectors, int64_t n_train);
+    // the nprobe live centroids to scan for one query
+    std::vector<DistanceWithIndex> probe_centroids(const CentroidTable& table, const float* query, int nprobe) const;
+    // publishes global_centroids_ to searches, with the per-node replicas in NUMA mode
+    // and a freshly trained coarse quantizer when enabled; caller holds write_mutex_
+    // or runs before serving
+    void publish_centroids();
+    // scan(i) for every probe: fork-join on the compute executor, or in NUMA mode
+    // one task per probe on the pinned executor of probe_shards[i]'s node
+    void run_shard_scans(const std::vector<int>& probe_shards, const std::function<void(size_t)>& scan);
+    // params.nprobe, else the index default, capped at the live lists; widened for a
+    // filter admitting only a selectivity share of the vectors
+    int effective_nprobe(const CentroidTable& table, const InternalSearchParameters& params,
+                         double selectivity = 1.0) const;
+    // share of the local vectors filter admits; 1 without a filter
+    double filter_selectivity(const RoaringBitmap* filter);
+    // the ids params.filter admits; null without a filter
+    std::shared_ptr<const RoaringBitmap> resolve_filter(const InternalSearchParameters& params) const;
+    // whether shards should copy vectors into their candidates for params
+    bool shard_vectors(const InternalSearchParameters& params) const;
+    // candidates gathered from the shards for a top-k: k * rerank_factor_ when re-ranking
+    int candidate_depth(int k) const;
+    // replaces the distances of results by exact ones to vector_source_ under the
+    // index metric and keeps the best k; candidates the source lacks keep their code
+    // distance and rank after all rescored ones
+    void rerank(const float* query, std::vector<InternalSearchResult>* results, int k) const;
+    // fills the vector of every result from vector_source_; ids it lacks keep an empty vector
+    void fetch_vectors(std::vector<InternalSearchResult>* results) const;
+    // whether this search is one of the sampled ones, see set_stage_sampling
+    bool sample_search();
+    void record_stages(const QueryStats& stats) const;
 
     std::string name_;
     int dimension_;
-    bool is_trained_;
+    // written under write_mutex_, read without it by accepts_prepared_insert
+    std::atomic<bool> is_trained_;
     // number of vectors initially
     int64_t ntotal_;
     int shard_counts_;
     int nlist_{-1};
-    int nprobe_;
+    int nprobe_{-1};
+    bool nprobe_pinned_{false};
+    PostingStorageMode storage_mode_{PostingStorageMode::HASH_MAP};
+    bool mmap_prefetch_{true};
+    QuantizationParameters quantization_;
+    std::shared_ptr<Quantizer> quantizer_;
+    DistanceType metric_{DistanceType::L2};
+    ClusteringParameters clustering_params_;
+    CoarseQuantizerParameters coarse_params_;
+    float max_list_factor_{0.0f};
+    AttributeStore attributes_;
+    float filter_widening_{16.0f};
+    std::shared_ptr<const VectorSource> vector_source_;
+    int rerank_factor_{0};
+    struct StageMetrics;
+    uint32_t stage_sample_every_{0};
+    std::atomic<uint64_t> stage_sample_count_{0};
+    std::unique_ptr<StageMetrics> stage_metrics_;
+    // serializes online inserts, deletes and compaction; searches never take it
+    mutable std::mutex write_mutex_;
+    // bumped once a write is visible to searches
+    std::atomic<uint64_t> version_{0};
+    std::thread compaction_thread_;
+    std::mutex compaction_mutex_;
+    std::condition_variable compaction_cv_;
+    bool compaction_stop_{false};
+    bool compaction_wanted_{false};
+    std::atomic<const ShardPlacement*> placement_{nullptr};
+    // rows of the list move_list holds in both shards, which size() leaves out.
+    // move_seq_ is odd while either figure is changing
+    std::atomic<uint64_t> move_seq_{0};
+    std::atomic<size_t> moving_rows_{0};
+    std::atomic<bool> track_probes_{false};
+    std::thread rebalance_thread_;
+    std::mutex rebalance_mutex_;
+    std::condition_variable rebalance_cv_;
+    bool rebalance_stop_{false};
+    std::thread maintenance_thread_;
+    std::mutex maintenance_mutex_;
+    std::condition_variable maintenance_cv_;
+    bool maintenance_stop_{false};
+    bool warm_start_{false};
+    size_t warm_parallel_reads_{4};
+    std::thread warm_thread_;
+    mutable std::mutex warm_mutex_;
+    std::atomic<bool> warm_stop_{false};
+    std::atomic<bool> warm_running_{false};
+    std::atomic<size_t> warm_partitions_{0};
+    std::atomic<uint64_t> warm_bytes_{0};
+    std::atomic<size_t> warm_loaded_partitions_{0};
+    std::atomic<uint64_t> warm_loaded_bytes_{0};
+
+    std::string index_path_;
 
     std::unique_ptr<Clustering> clustering_;
+    // the writers' copy of the centroids; searches read centroid_table_
     std::vector<float> global_centroids_;
+    bool numa_{false};
+    GpuOptions gpu_;
     std::vector<int> global_centroid_ids_;
+    std::atomic<const CentroidTable*> centroid_table_{nullptr};
+    // ids emptied by a merge, and the drift figures, both indexed by centroid
+    std::vector<uint8_t> retired_lists_;
+    std::vector<ListDrift> list_drift_;
 
     std::unordered_map<int, std::unique_ptr<IndexIVFShard>> shards_;
     // cluster nodes
     std::vector<std::string> nodes_;
     std::set<int> shard_ids_;
+    std::string local_node_;
+    std::shared_ptr<ShardClient> shard_client_;
+    std::chrono::milliseconds remote_timeout_{100};
+    std::unordered_map<std::string, std::chrono::milliseconds> node_timeouts_;
 
 };
 
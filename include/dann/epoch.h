@@ -0,0 +1,83 @@
+//
+// Epoch-based reclamation for read-mostly structures. Readers pin the current
+// epoch for the duration of a lookup (two atomic stores, no lock); writers
+// publish a new version, retire the old one, and it is freed once every reader
+// that could still see it has unpinned.
+//
+
+#ifndef DANN_EPOCH_H
+#define DANN_EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace dann {
+
+class EpochDomain {
+public:
+    struct ReaderRecord;
+
+    // keeps everything retired after pinning alive until it goes out of scope; nests
+    class Guard {
+    public:
+        explicit Guard(ReaderRecord* record): record_(record) {}
+        Guard(Guard&& other) noexcept: record_(other.record_) { other.record_ = nullptr; }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        Guard& operator=(Guard&&) = delete;
+        ~Guard();
+
+    private:
+        ReaderRecord* record_;
+    };
+
+    ~EpochDomain();
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    Guard pin();
+
+    // p was unpublished by the caller; deleter(p) runs once no pinned reader can hold it
+    void retire(void* p, void (*deleter)(void*));
+    template<typename T>
+    void retire(const T* p) {
+        retire(const_cast<T*>(p), [](void* q) { delete static_cast<T*>(q); });
+    }
+
+    // frees every retired object no reader can still see; returns how many
+    size_t reclaim();
+    // blocks until every reader pinned before the call has unpinned. Must not be
+    // called while the calling thread is pinned
+    void synchronize();
+    size_t pending() const;
+
+private:
+    // one domain per process, so each thread keeps a single cached reader record
+    EpochDomain() = default;
+    friend EpochDomain& get_epoch_domain();
+
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    ReaderRecord* acquire_record();
+
+    std::atomic<uint64_t> epoch_{1};
+    // append-only list of reader records, reused once their thread exits
+    std::atomic<ReaderRecord*> records_{nullptr};
+
+    mutable std::mutex retired_mutex_;
+    std::vector<Retired> retired_;
+};
+
+// Global epoch domain shared by the index structures (lazy initialization)
+EpochDomain& get_epoch_domain();
+
+}
+
+#endif //DANN_EPOCH_H
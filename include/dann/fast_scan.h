@@ -0,0 +1,57 @@
+//
+// Fast-scan kernels for 4-bit PQ codes: rows are packed in blocks of 32 and
+// scored with byte shuffles against a lookup table quantized to 8 bits.
+//
+
+#ifndef DANN_FAST_SCAN_H
+#define DANN_FAST_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dann {
+
+constexpr size_t kFastScanBlockRows = 32;
+// the uint16 accumulators hold up to this many 8-bit table entries
+constexpr int kFastScanMaxSubQuantizers = 256;
+
+// sub-quantizers are padded to an even count so the AVX2 kernel reads two at a time
+inline int fast_scan_padded_m(int m) {
+    return (m + 1) & ~1;
+}
+
+// a block holds, for each sub-quantizer, 16 bytes whose low nibble is the code
+// of row i and high nibble the code of row i + 16
+inline size_t fast_scan_block_bytes(int m) {
+    return static_cast<size_t>(fast_scan_padded_m(m)) * 16;
+}
+
+// writes the n row-major codes (m bytes each, values below 16) as rows
+// first_row.. of packed, growing it to whole zero-padded blocks
+void pack_fast_scan_codes(const uint8_t* codes, size_t n, int m, size_t first_row, std::vector<uint8_t>* packed);
+
+// float ADC table quantized to one byte per entry: each sub-quantizer's entries
+// are shifted by their minimum and all share one scale, so
+//   sum_j table[j][c_j] ~= bias + (sum_j lut[j][c_j]) / scale
+// to within error
+struct FastScanTable {
+    int m = 0; // padded
+    std::vector<uint8_t> lut; // m * 16, zero rows for the padding
+    float bias = 0.0f;
+    float scale = 1.0f;
+    float error = 0.0f;
+
+    float estimate(uint16_t sum) const { return bias + static_cast<float>(sum) / scale; }
+};
+
+// table holds m * 16 floats, as ProductQuantizer::compute_distance_table with nbits = 4
+void build_fast_scan_table(const float* table, int m, FastScanTable* out);
+
+// out[b * 32 + i] = table entries summed over row i of block b, for nblocks
+// blocks laid out as pack_fast_scan_codes writes them. Dispatches on simd_level()
+void fast_scan_accumulate(const uint8_t* blocks, size_t nblocks, const FastScanTable& table, uint16_t* out);
+
+}
+
+#endif //DANN_FAST_SCAN_H
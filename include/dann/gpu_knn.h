@@ -0,0 +1,41 @@
+//
+// Exact nearest-centroid search for the dense, GEMM-shaped passes: k-means
+// assignment, vector-to-centroid assignment at build time and batched
+// query-to-centroid probing. Built with -DDANN_GPU=ON (faiss compiled with
+// CUDA) these can run on a GPU through faiss::gpu::bfKnn; otherwise, or when no
+// device is visible, every call runs the CPU faiss kernels.
+//
+
+#ifndef DANN_GPU_KNN_H
+#define DANN_GPU_KNN_H
+
+#include <cstddef>
+
+#include <faiss/MetricType.h>
+
+#include "dann/types.h"
+
+namespace dann {
+
+struct GpuOptions {
+    bool enabled = false;
+    int device = 0;
+    // smaller batches stay on the CPU, where they finish before the transfers would
+    size_t min_rows = 1024;
+};
+
+// true when built with the GPU backend and at least one CUDA device is visible
+bool gpu_available();
+int gpu_device_count();
+
+// the k nearest of nc centroids for each of the n rows of x: squared L2
+// distances ascending for L2, inner products descending otherwise, exactly as
+// faiss::knn_L2sqr / knn_inner_product. Runs on gpu.device when gpu.enabled, a
+// device is available and n >= gpu.min_rows; falls back to the CPU if the
+// device call fails. Calls on one device are serialized
+void knn_centroids(const float* x, size_t n, const float* centroids, size_t nc, int d, DistanceType metric, int k,
+                   float* distances, faiss::idx_t* labels, const GpuOptions& gpu = {});
+
+}
+
+#endif //DANN_GPU_KNN_H
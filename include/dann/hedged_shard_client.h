@@ -0,0 +1,106 @@
+//
+// Replica-aware ShardClient decorator for tail latency. Each logical node can be
+// served by several endpoints holding the same shards. A request goes to one of
+// them (round robin); when it has not answered within that endpoint's observed
+// p95 a duplicate goes to the next replica, and a failed attempt fails over at
+// once. The first successful reply wins, the others are dropped.
+//
+
+#ifndef DANN_HEDGED_SHARD_CLIENT_H
+#define DANN_HEDGED_SHARD_CLIENT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "dann/shard_client.h"
+
+namespace dann {
+
+struct HedgingOptions {
+    // latency quantile of the first endpoint after which a duplicate is sent
+    double quantile = 0.95;
+    // hedge delay used until an endpoint has min_samples latencies
+    size_t min_samples = 20;
+    std::chrono::microseconds initial_delay{10000};
+    // never hedge sooner than this, however fast the endpoint looks
+    std::chrono::microseconds min_delay{500};
+    // duplicates per request on top of the first attempt
+    int max_hedges = 1;
+    // latencies kept per endpoint
+    size_t window = 256;
+};
+
+class HedgedShardClient: public ShardClient {
+public:
+    explicit HedgedShardClient(std::shared_ptr<ShardClient> inner, HedgingOptions options = {});
+    ~HedgedShardClient() override;
+    HedgedShardClient(const HedgedShardClient&) = delete;
+    HedgedShardClient& operator=(const HedgedShardClient&) = delete;
+
+    // endpoints of the inner client serving the shards placed on node; a node without
+    // replicas is passed through as its own endpoint. Call before serving
+    void set_replicas(const std::string& node, std::vector<std::string> endpoints);
+
+    void search_shard(const std::string& node, const InternalShardSearchRequest& request,
+                      std::chrono::steady_clock::time_point deadline, ShardSearchCallback done) override;
+
+    // how long a request to endpoint waits before it is hedged
+    std::chrono::microseconds hedge_delay(const std::string& endpoint);
+
+private:
+    struct HedgedRequest;
+    struct EndpointStats {
+        std::mutex mutex;
+        std::vector<int64_t> latencies_us;
+        size_t next{0};
+        size_t count{0};
+        bool dirty{false};
+        int64_t quantile_us{0};
+    };
+    struct Timer {
+        std::chrono::steady_clock::time_point when;
+        std::function<void()> fire;
+        bool operator>(const Timer& other) const { return when > other.when; }
+    };
+
+    // sends to the next untried endpoint of the request, if any
+    void send(const std::shared_ptr<HedgedRequest>& hedged);
+    void on_reply(const std::shared_ptr<HedgedRequest>& hedged, size_t attempt, const std::string& endpoint,
+                  std::chrono::steady_clock::time_point start, InternalShardSearchResponse reply);
+    void hedge(const std::shared_ptr<HedgedRequest>& hedged);
+    void schedule_hedge(const std::shared_ptr<HedgedRequest>& hedged);
+    void record_latency(const std::string& endpoint, std::chrono::steady_clock::duration latency);
+    EndpointStats& stats(const std::string& endpoint);
+    void timer_loop();
+
+    std::shared_ptr<ShardClient> inner_;
+    HedgingOptions options_;
+    std::unordered_map<std::string, std::vector<std::string>> replicas_;
+    std::atomic<size_t> round_robin_{0};
+
+    std::mutex stats_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<EndpointStats>> stats_;
+
+    std::mutex timer_mutex_;
+    std::condition_variable timer_cv_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+    bool stop_{false};
+    std::thread timer_thread_;
+
+    // inner calls whose callback has not finished; the destructor waits for them
+    std::mutex inflight_mutex_;
+    std::condition_variable inflight_cv_;
+    int inflight_{0};
+};
+
+}
+
+#endif //DANN_HEDGED_SHARD_CLIENT_H
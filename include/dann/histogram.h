@@ -0,0 +1,90 @@
+//
+// Lock-free metric primitives. Recording only touches the calling thread's
+// shard with relaxed atomic adds, so threads never share a cache line while
+// recording; shards are merged when the metric is read or exported.
+//
+
+#ifndef DANN_HISTOGRAM_H
+#define DANN_HISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace dann {
+
+constexpr size_t kMetricShards = 8;
+
+// the calling thread's shard, fixed for the thread's lifetime
+size_t metric_shard_index();
+
+class ShardedCounter {
+public:
+    void add(double value) {
+        shards_[metric_shard_index()].value.fetch_add(value, std::memory_order_relaxed);
+    }
+    double value() const;
+    // not atomic with respect to concurrent adds
+    void reset(double value = 0.0);
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<double> value{0.0};
+    };
+    Shard shards_[kMetricShards];
+};
+
+// a merged, immutable view of a histogram
+struct HistogramSnapshot {
+    std::vector<uint64_t> counts; // per bucket
+    uint64_t count = 0;
+    double sum = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+
+    double mean() const { return count == 0 ? 0.0 : sum / static_cast<double>(count); }
+    // p in [0, 100]; the midpoint of the bucket holding that rank, clamped to [min, max]
+    double percentile(double p) const;
+    // samples <= bound, interpolated inside the bucket that straddles it
+    uint64_t count_at_most(double bound) const;
+};
+
+// Log-linear buckets in the style of HdrHistogram: each power of two is split
+// into kSubBuckets equal buckets, so a bucket is at most 1/16 of its values
+// wide. Bucket 0 takes everything below 2^kMinExponent (zero, negatives);
+// the last bucket everything from 2^kMaxExponent up
+class LatencyHistogram {
+public:
+    static constexpr int kSubBucketBits = 4;
+    static constexpr int kSubBuckets = 1 << kSubBucketBits;
+    static constexpr int kMinExponent = -10;
+    static constexpr int kMaxExponent = 40;
+    static constexpr size_t kBuckets = static_cast<size_t>(kMaxExponent - kMinExponent) * kSubBuckets + 2;
+
+    LatencyHistogram();
+
+    void record(double value);
+    HistogramSnapshot snapshot() const;
+    // not atomic with respect to concurrent records
+    void reset();
+
+    static size_t bucket_index(double value);
+    static double bucket_lower_bound(size_t index);
+    static double bucket_upper_bound(size_t index);
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counts[kBuckets];
+        std::atomic<uint64_t> count;
+        std::atomic<double> sum;
+        std::atomic<double> min;
+        std::atomic<double> max;
+    };
+    std::unique_ptr<Shard[]> shards_;
+};
+
+} // namespace dann
+
+#endif // DANN_HISTOGRAM_H
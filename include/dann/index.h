@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 
+#include "dann/result_cache.h"
 #include "dann/types.h"
 #include "dann/vector_index.h"
 
@@ -11,18 +12,47 @@ namespace dann {
 
 class Index {
 public:
+    // one chunk routed to the shards, each part prepared by its shard
+    struct PreparedIngest {
+        std::vector<std::unique_ptr<IndexShard::PreparedInsert>> shards;
+    };
+
     Index(std::string name,
           int dimension,
           int shard_count = 1,
           const std::string& index_type = "IVF",
           int hnsw_m = 16,
           int hnsw_ef_construction = 100,
-          std::vector<std::string> nodes = {});
+          std::vector<std::string> nodes = {},
+          DistanceType metric = DistanceType::L2);
 
     const std::string& name() const;
 
     bool add_vectors(const std::vector<float>& vectors, const std::vector<int64_t>& ids);
     std::vector<InternalSearchResult> search(const std::vector<float>& query, int k = 10);
+    std::vector<InternalSearchResult> search(const std::vector<float>& query, int k,
+                                             const InternalSearchParameters& params);
+    // queries is nq * dimension floats laid end to end; one top-k list per query
+    std::vector<std::vector<InternalSearchResult>> search_batch(const float* queries, size_t nq, int k,
+                                                                const InternalSearchParameters& params = {});
+    // pipelined ingest, see IndexShard::prepare_insert. prepare_ingest returns
+    // nullptr when the chunk is malformed
+    bool accepts_prepared_ingest() const;
+    std::unique_ptr<PreparedIngest> prepare_ingest(std::vector<float> vectors, std::vector<int64_t> ids);
+    bool commit_ingest(PreparedIngest& prepared);
+    bool remove_vector(int64_t id);
+    bool update_vector(int64_t id, const std::vector<float>& vector);
+    // attributes[i] for ids[i], routed like the ids; see IndexShard::set_attributes
+    bool set_attributes(const std::vector<int64_t>& ids, const std::vector<Attributes>& attributes);
+
+    // sum of the shard versions: changes with every write that can change results
+    uint64_t version() const;
+    // searches are answered from a result cache first; entries from before the last
+    // write are never served, and results of searches allowing partial results are
+    // not stored. Call before serving
+    void enable_result_cache(const ResultCacheOptions& options);
+    // nullptr unless enabled
+    ResultCache* result_cache() const { return cache_.get(); }
 
     size_t size() const;
     int dimension() const;
@@ -35,8 +65,18 @@ private:
     std::string name_;
     int dimension_;
     std::vector<std::shared_ptr<IndexShard>> shards_;
+    std::unique_ptr<ResultCache> cache_;
 
     int shard_id_for_document(int64_t id) const;
+    // splits n rows into one buffer pair per shard, keeping their relative order
+    void partition_rows(const float* vectors, const int64_t* ids, size_t n,
+                        std::vector<std::vector<float>>* shard_vectors,
+                        std::vector<std::vector<int64_t>>* shard_ids) const;
+    // the uncached searches
+    std::vector<InternalSearchResult> search_shards(const std::vector<float>& query, int k,
+                                                    const InternalSearchParameters& params);
+    std::vector<std::vector<InternalSearchResult>> search_batch_shards(const float* queries, size_t nq, int k,
+                                                                       const InternalSearchParameters& params);
 };
 
 } // namespace dann
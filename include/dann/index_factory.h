@@ -15,8 +15,9 @@ class IndexShard;
 class IndexShardFactory {
 
 public:
+  // IVF supports every metric; HNSW is L2 only and is not created for another
   std::shared_ptr<IndexShard> create(std::string name, std::string index_type, int dim, int shards, int ef, int ef_construction,
-    faiss::MetricType metric = faiss::METRIC_L2, std::vector<std::string> nodes_ = {});
+    DistanceType metric = DistanceType::L2, std::vector<std::string> nodes_ = {});
   std::shared_ptr<IndexShard> get_index(std::string index_type);
 
 private:
@@ -0,0 +1,65 @@
+//
+// Versioned handle on the serving index, so a rebuilt or reloaded index can be
+// swapped in under live traffic. Requests take current() once and run on that
+// version to the end; publish() swaps the next one in with one atomic store and
+// never waits for them. The replaced version is destroyed when the last request
+// holding it lets go.
+//
+
+#ifndef DANN_INDEX_HANDLE_H
+#define DANN_INDEX_HANDLE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "dann/index.h"
+
+namespace dann {
+
+class IndexHandle {
+public:
+    // index must not be null; its dimension is the handle's for good
+    explicit IndexHandle(std::shared_ptr<Index> index);
+    // waits for a reload in progress
+    ~IndexHandle();
+
+    IndexHandle(const IndexHandle&) = delete;
+    IndexHandle& operator=(const IndexHandle&) = delete;
+
+    std::shared_ptr<Index> current() const { return index_.load(std::memory_order_acquire); }
+    int dimension() const { return dimension_; }
+    // bumped by every publish; 0 for the index the handle was created with
+    uint64_t generation() const { return generation_.load(std::memory_order_acquire); }
+
+    // swaps index in and returns the version it replaced, which requests already
+    // running keep using. nullptr (and nothing swapped) when index is null or of
+    // another dimension
+    std::shared_ptr<Index> publish(std::shared_ptr<Index> index);
+
+    // runs build on a background thread and publishes the index it returns, then
+    // destroys the replaced version there too once the last request is done with
+    // it, so no query thread pays for freeing it. Writes reaching the current index
+    // while build runs are not carried over. false when a reload is already running
+    bool reload_async(std::function<std::shared_ptr<Index>()> build);
+    // waits for the last reload_async; true when it published an index
+    bool wait_reload();
+    bool reloading() const { return reloading_.load(std::memory_order_acquire); }
+
+private:
+    int dimension_;
+    std::atomic<std::shared_ptr<Index>> index_;
+    std::atomic<uint64_t> generation_{0};
+
+    std::mutex reload_mutex_;
+    std::thread reload_thread_;
+    std::atomic<bool> reloading_{false};
+    bool reload_published_{false};
+};
+
+} // namespace dann
+
+#endif //DANN_INDEX_HANDLE_H
@@ -6,13 +6,72 @@
 #define DANN_INDEX_SHARD_H
 #include "dann/types.h"
 
+#include <memory>
+
 namespace dann {
 
 class IndexShard {
 public:
+    // a chunk of rows on its way in; shards that can split the insert keep their
+    // precomputed state in a subclass
+    struct PreparedInsert {
+        virtual ~PreparedInsert() = default;
+        std::vector<float> vectors;
+        std::vector<int64_t> ids;
+    };
+
     // Core operations
     virtual bool add_vectors(const std::vector<float>& vectors, const std::vector<int64_t>& ids) = 0;
     virtual std::vector<InternalSearchResult> search(const std::vector<float>& query, int k = 10) = 0;
+    virtual std::vector<InternalSearchResult> search(const std::vector<float>& query, int k,
+                                                     const InternalSearchParameters& params) {
+        (void)params;
+        return search(query, k);
+    }
+    // queries is nq * dimension() floats; one top-k list per query
+    virtual std::vector<std::vector<InternalSearchResult>> search_batch(const float* queries, size_t nq, int k,
+                                                                        const InternalSearchParameters& params) {
+        std::vector<std::vector<InternalSearchResult>> results(nq);
+        const size_t d = static_cast<size_t>(dimension());
+        for (size_t i = 0; i < nq; ++i) {
+            results[i] = search(std::vector<float>(queries + i * d, queries + (i + 1) * d), k, params);
+        }
+        return results;
+    }
+    // false when the id is not stored in this shard or the shard does not support it
+    virtual bool remove_vector(int64_t id) {
+        (void)id;
+        return false;
+    }
+    virtual bool update_vector(int64_t id, const std::vector<float>& vector) {
+        (void)id;
+        (void)vector;
+        return false;
+    }
+    // replaces the attributes searches filter on (InternalSearchParameters::filter),
+    // one map per id; an empty map drops the id's attributes. false when the shard
+    // does not support filtering
+    virtual bool set_attributes(const std::vector<int64_t>& ids, const std::vector<Attributes>& attributes) {
+        (void)ids;
+        (void)attributes;
+        return false;
+    }
+    // online insert in two halves so ingest can prepare one chunk (decode, assign)
+    // while the previous one is committed. prepare_insert may run concurrently with
+    // commit_insert of earlier chunks once accepts_prepared_insert() is true; before
+    // that (e.g. an IVF index that still has to be trained) chunks must be committed
+    // one at a time
+    virtual bool accepts_prepared_insert() { return true; }
+    virtual std::unique_ptr<PreparedInsert> prepare_insert(std::vector<float> vectors, std::vector<int64_t> ids) {
+        auto prepared = std::make_unique<PreparedInsert>();
+        prepared->vectors = std::move(vectors);
+        prepared->ids = std::move(ids);
+        return prepared;
+    }
+    virtual bool commit_insert(PreparedInsert& prepared) { return add_vectors(prepared.vectors, prepared.ids); }
+    // bumped after every write that can change search results, so anything derived
+    // from a search at version v is stale once version() != v
+    virtual uint64_t version() const = 0;
     virtual size_t size() = 0;
     virtual int dimension() const = 0;
     virtual std::string index_type() const = 0;
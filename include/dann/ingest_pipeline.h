@@ -0,0 +1,73 @@
+//
+// Pipelined bulk ingest: while the caller decodes chunk i + 1 (typically off the
+// network), chunk i is assigned to centroids on the compute executor and chunk
+// i - 1 is appended to the shards, in arrival order.
+//
+
+#ifndef DANN_INGEST_PIPELINE_H
+#define DANN_INGEST_PIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dann/index.h"
+
+namespace dann {
+
+class IngestPipeline {
+public:
+    // max_inflight bounds the chunks held between add and their commit, which
+    // bounds memory and pushes back on a fast producer
+    explicit IngestPipeline(std::shared_ptr<Index> index, size_t max_inflight = 4);
+    // waits for every chunk added so far
+    ~IngestPipeline();
+
+    IngestPipeline(const IngestPipeline&) = delete;
+    IngestPipeline& operator=(const IngestPipeline&) = delete;
+
+    // vectors holds ids.size() rows; blocks while max_inflight chunks are pending.
+    // false once any chunk failed, the remaining chunks are then dropped
+    bool add(std::vector<float> vectors, std::vector<int64_t> ids);
+
+    struct Result {
+        bool success;
+        size_t added;
+        std::string error_message;
+    };
+    // waits for the pending chunks; the pipeline takes no chunks afterwards
+    Result finish();
+
+private:
+    struct Chunk {
+        std::future<std::unique_ptr<Index::PreparedIngest>> prepared;
+        size_t rows;
+    };
+
+    void commit_loop();
+
+    std::shared_ptr<Index> index_;
+    size_t max_inflight_;
+    // the index takes prepared chunks concurrently; until then chunks go in one by one
+    bool pipelined_{false};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Chunk> chunks_;
+    size_t inflight_{0};
+    size_t added_{0};
+    bool failed_{false};
+    bool finished_{false};
+    std::string error_message_;
+    std::thread committer_;
+};
+
+}
+
+#endif //DANN_INGEST_PIPELINE_H
@@ -1,6 +1,7 @@
 //
 // IO Thread Pool for I/O-bound tasks
-// Supports task submission with std::future return
+// Supports task submission with std::future return, and fork-join
+// parallel_for / run_all that wait on a latch without per-task futures
 //
 
 #ifndef DANN_IO_THREAD_POOL_H
@@ -14,11 +15,128 @@
 #include <condition_variable>
 #include <future>
 #include <functional>
+#include <algorithm>
+#include <tuple>
 #include <stdexcept>
 #include <atomic>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace dann {
 
+// Move-only void() callable with inline storage: callables up to kInlineSize
+// bytes (a lambda capturing a few pointers) are stored without allocating
+class SmallTask {
+public:
+    static constexpr size_t kInlineSize = 48;
+
+    SmallTask() = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, SmallTask>>>
+    SmallTask(F&& f) {
+        using Fn = std::decay_t<F>;
+        if constexpr (sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible_v<Fn>) {
+            new (&storage_) Fn(std::forward<F>(f));
+            ops_ = &inline_ops<Fn>;
+        } else {
+            *reinterpret_cast<Fn**>(&storage_) = new Fn(std::forward<F>(f));
+            ops_ = &heap_ops<Fn>;
+        }
+    }
+
+    SmallTask(SmallTask&& other) noexcept { move_from(other); }
+    SmallTask& operator=(SmallTask&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+    SmallTask(const SmallTask&) = delete;
+    SmallTask& operator=(const SmallTask&) = delete;
+    ~SmallTask() { reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    void operator()() { ops_->invoke(&storage_); }
+
+private:
+    struct Ops {
+        void (*invoke)(void*);
+        // move-constructs into dst and destroys src
+        void (*relocate)(void* dst, void* src);
+        void (*destroy)(void*);
+    };
+
+    template<typename Fn>
+    static constexpr Ops inline_ops{
+        [](void* p) { (*static_cast<Fn*>(p))(); },
+        [](void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        },
+        [](void* p) { static_cast<Fn*>(p)->~Fn(); }};
+
+    template<typename Fn>
+    static constexpr Ops heap_ops{
+        [](void* p) { (**static_cast<Fn**>(p))(); },
+        [](void* dst, void* src) { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); },
+        [](void* p) { delete *static_cast<Fn**>(p); }};
+
+    void move_from(SmallTask& other) {
+        ops_ = other.ops_;
+        if (ops_) {
+            ops_->relocate(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    void reset() {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops* ops_{nullptr};
+};
+
+// Counts down once per finished task; wait() blocks until it reaches zero
+// and keeps the first exception a task reported
+class TaskLatch {
+public:
+    explicit TaskLatch(size_t count) : count_(count) {}
+
+    void count_down(std::exception_ptr error = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error && !error_) {
+            error_ = std::move(error);
+        }
+        if (--count_ == 0) {
+            cv_.notify_all();
+        }
+    }
+
+    bool done() const { return count_.load(std::memory_order_acquire) == 0; }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return count_.load() == 0; });
+    }
+
+    std::exception_ptr error() const { return error_; }
+
+private:
+    std::atomic<size_t> count_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::exception_ptr error_;
+};
+
 class IOThreadPool {
 public:
     explicit IOThreadPool(size_t threads = 0);
@@ -35,20 +153,81 @@ public:
     auto enqueue(F&& f, Args&&... args) -> std::future<typename std::invoke_result<F, Args...>::type> {
         using return_type = typename std::invoke_result<F, Args...>::type;
 
-        auto task = std::make_shared<std::packaged_task<return_type()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
+        // the future's shared state is the only allocation left; the task
+        // itself moves into the queue's inline storage
+        std::packaged_task<return_type()> task(
+            [f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                return std::apply(std::move(f), std::move(args));
+            });
+        std::future<return_type> res = task.get_future();
+        push(SmallTask([task = std::move(task)]() mutable { task(); }));
+        return res;
+    }
 
-        std::future<return_type> res = task->get_future();
+    // Calls body(lo, hi) over [begin, end) in chunks of at most grain items and
+    // returns once all ran, rethrowing the first exception. The calling thread
+    // runs the first chunk and then helps drain the queue, so nesting inside a
+    // pool task cannot deadlock
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F&& body) {
+        if (begin >= end) {
+            return;
+        }
+        grain = std::max<size_t>(grain, 1);
+        const size_t nchunks = (end - begin + grain - 1) / grain;
+        if (nchunks == 1) {
+            body(begin, end);
+            return;
+        }
+        TaskLatch latch(nchunks - 1);
+        auto* fn = &body;
         {
             std::unique_lock<std::mutex> lock(queue_mutex_);
             if (stop_) {
-                throw std::runtime_error("enqueue on stopped thread pool");
+                throw std::runtime_error("parallel_for on stopped thread pool");
+            }
+            for (size_t c = 1; c < nchunks; ++c) {
+                const size_t lo = begin + c * grain;
+                const size_t hi = std::min(end, lo + grain);
+                tasks_.emplace([fn, &latch, lo, hi]() {
+                    std::exception_ptr error;
+                    try {
+                        (*fn)(lo, hi);
+                    } catch (...) {
+                        error = std::current_exception();
+                    }
+                    latch.count_down(std::move(error));
+                });
             }
-            tasks_.emplace([task]() { (*task)(); });
+            pending_count_ += nchunks - 1;
         }
-        condition_.notify_one();
-        return res;
+        condition_.notify_all();
+
+        std::exception_ptr inline_error;
+        try {
+            body(begin, std::min(end, begin + grain));
+        } catch (...) {
+            inline_error = std::current_exception();
+        }
+        while (!latch.done() && run_pending_task()) {
+        }
+        latch.wait();
+        if (inline_error) {
+            std::rethrow_exception(inline_error);
+        }
+        if (latch.error()) {
+            std::rethrow_exception(latch.error());
+        }
+    }
+
+    // Calls fn(i) for every i in [0, count), one task each (e.g. one per shard)
+    template<typename F>
+    void run_all(size_t count, F&& fn) {
+        parallel_for(0, count, 1, [&fn](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; ++i) {
+                fn(i);
+            }
+        });
     }
 
     // Batch submit multiple tasks and wait for all
@@ -78,8 +257,12 @@ public:
     }
 
 private:
+    void push(SmallTask task);
+    // pops and runs one queued task on the calling thread; false if none
+    bool run_pending_task();
+
     std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> tasks_;
+    std::queue<SmallTask> tasks_;
     std::mutex queue_mutex_;
     std::condition_variable condition_;
     std::atomic<bool> stop_;
@@ -0,0 +1,201 @@
+//
+// On-disk layout of a DistributedIndexIVF, see DESIGN_DISTRIBUTED_IVF_STORAGE.md
+//
+// <dir>/manifest.json  readable metadata for version/compat checks
+// <dir>/index.idx      header + centroids + one PartitionDescriptor per centroid
+// <dir>/auxiliary.idx  header + (row ids, raw float32 vectors) in partition order
+// <dir>/heat.idx       optional probe count per partition, the order a warm start reads them in
+//
+
+#ifndef DANN_IVF_INDEX_IO_H
+#define DANN_IVF_INDEX_IO_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dann/types.h"
+#include "dann/vector_source.h"
+
+namespace dann {
+
+// 2: the index.idx checksum covers the shard ids too
+constexpr uint32_t kIvfFormatVersion = 2;
+constexpr char kIvfIndexMagic[8] = {'D', 'A', 'N', 'N', 'I', 'V', 'F', '\0'};
+constexpr char kIvfAuxMagic[8] = {'D', 'A', 'N', 'N', 'A', 'U', 'X', '\0'};
+constexpr char kIvfHeatMagic[8] = {'D', 'A', 'N', 'N', 'H', 'O', 'T', '\0'};
+constexpr size_t kIvfAuxHeaderBytes = 24;
+
+constexpr const char* kManifestFileName = "manifest.json";
+constexpr const char* kIndexFileName = "index.idx";
+constexpr const char* kAuxiliaryFileName = "auxiliary.idx";
+constexpr const char* kHeatFileName = "heat.idx";
+
+struct IvfIndexManifest {
+    uint32_t format_version = kIvfFormatVersion;
+    std::string index_name;
+    int32_t dimension = 0;
+    int32_t nlist = 0;
+    int32_t nprobe_default = 0;
+    DistanceType distance_type = DistanceType::L2;
+    int32_t shard_count = 0;
+    int64_t ntotal = 0;
+    bool trained = false;
+};
+
+struct PartitionDescriptor {
+    int32_t partition_id = 0;    // centroid id
+    int32_t shard_id = 0;        // owning shard when the index was written
+    uint64_t aux_row_offset = 0; // row offset of the partition in auxiliary.idx
+    uint32_t length = 0;         // vectors in the partition
+};
+
+struct IvfRuntimeLayout {
+    std::vector<float> centroids;                // nlist * dimension
+    std::vector<PartitionDescriptor> partitions; // nlist entries, ordered by partition_id
+};
+
+bool save_manifest(const std::string& dir, const IvfIndexManifest& m);
+bool load_manifest(const std::string& dir, IvfIndexManifest* m);
+
+bool save_index_structure(const std::string& dir, const IvfIndexManifest& m, const IvfRuntimeLayout& layout);
+bool load_index_structure(const std::string& dir, IvfIndexManifest* m, IvfRuntimeLayout* layout);
+
+// heat[i] is the probe count of partition i
+bool save_probe_heat(const std::string& dir, const std::vector<uint64_t>& heat);
+// false when dir holds no heat map (indexes saved before it existed) or a damaged one
+bool load_probe_heat(const std::string& dir, std::vector<uint64_t>* heat);
+
+// byte offset of a partition's row id block in auxiliary.idx
+inline uint64_t aux_partition_offset(const PartitionDescriptor& desc, int dimension) {
+    return kIvfAuxHeaderBytes + desc.aux_row_offset * (sizeof(int64_t) + sizeof(float) * dimension);
+}
+
+// bytes of a partition in auxiliary.idx: its row ids followed by its vectors
+inline uint64_t aux_partition_bytes(const PartitionDescriptor& desc, int dimension) {
+    return static_cast<uint64_t>(desc.length) * (sizeof(int64_t) + sizeof(float) * dimension);
+}
+
+// streams partitions into auxiliary.idx in partition order
+class AuxiliaryFileWriter {
+public:
+    bool open(const std::string& path, int dimension, uint64_t total_rows);
+    bool write_partition(const int64_t* ids, const float* vectors, size_t n);
+    bool close();
+
+private:
+    std::ofstream out_;
+    int dimension_{0};
+    uint64_t expected_rows_{0};
+    uint64_t written_rows_{0};
+};
+
+class AuxiliaryFileReader {
+public:
+    bool open(const std::string& path, int dimension);
+    // reads the partition described by desc into ids (length) and vectors (length * dimension)
+    bool read_partition(const PartitionDescriptor& desc, std::vector<int64_t>* ids, std::vector<float>* vectors);
+    uint64_t total_rows() const { return total_rows_; }
+
+private:
+    std::ifstream in_;
+    int dimension_{0};
+    uint64_t total_rows_{0};
+};
+
+// rows grouped by partition on disk during an out-of-core build. Rows are appended
+// to one of several bucket files, each covering a consecutive range of partitions;
+// finish() regroups one bucket at a time, so memory is bounded by the largest bucket
+// rather than by the dataset
+class PartitionSpill {
+public:
+    PartitionSpill() = default;
+    ~PartitionSpill();
+    PartitionSpill(const PartitionSpill&) = delete;
+    PartitionSpill& operator=(const PartitionSpill&) = delete;
+
+    // bucket files are created in dir, which must exist
+    bool open(const std::string& dir, int dimension, int nlist, size_t buckets);
+    // partitions[i] is the partition of row i
+    bool append(const int64_t* ids, const float* vectors, const int64_t* partitions, size_t n);
+    uint64_t rows() const { return rows_; }
+    // writes every row to an auxiliary.idx at aux_path in partition order, fills one
+    // descriptor per partition (shard = partition % shard_count) and removes the buckets
+    bool finish(const std::string& aux_path, int shard_count, std::vector<PartitionDescriptor>* partitions);
+
+private:
+    void remove_buckets();
+
+    int dimension_{0};
+    int nlist_{0};
+    std::vector<std::string> paths_;
+    std::vector<std::ofstream> buckets_;
+    // first partition of each bucket, plus nlist at the end
+    std::vector<int32_t> bounds_;
+    std::vector<uint64_t> partition_rows_;
+    uint64_t rows_{0};
+};
+
+// read-only mmap of a whole file; pages fault in on first touch
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    // madvise(WILLNEED) on [offset, offset + length), rounded out to pages
+    void prefetch(uint64_t offset, uint64_t length) const;
+
+    const char* data() const { return static_cast<const char*>(data_); }
+    size_t size() const { return size_; }
+    bool is_open() const { return data_ != nullptr; }
+
+private:
+    void* data_{nullptr};
+    size_t size_{0};
+};
+
+// pulls partitions of auxiliary.idx into the page cache with pread, so a mapping
+// of the file finds them resident. load() may be called from several threads at
+// once; each call returns when the partition has been read
+class PartitionPreloader {
+public:
+    PartitionPreloader() = default;
+    ~PartitionPreloader();
+    PartitionPreloader(const PartitionPreloader&) = delete;
+    PartitionPreloader& operator=(const PartitionPreloader&) = delete;
+
+    bool open(const std::string& path, int dimension);
+    // bytes read, 0 when the read failed or the partition is empty
+    uint64_t load(const PartitionDescriptor& desc) const;
+
+private:
+    int fd_{-1};
+    int dimension_{0};
+};
+
+// the full-precision rows of a saved index, served from its mapped auxiliary.idx,
+// e.g. to re-rank a quantized index that keeps no raw rows in memory. open() reads
+// only the row id blocks; a vector faults in when it is first asked for
+class AuxiliaryVectorSource: public VectorSource {
+public:
+    // dir as written by DistributedIndexIVF::save_index
+    bool open(const std::string& dir);
+    size_t size() const { return rows_.size(); }
+    int dimension() const override { return dimension_; }
+    const float* vector_data(int64_t id) const override;
+
+private:
+    MappedFile file_;
+    int dimension_{0};
+    std::unordered_map<int64_t, const float*> rows_;
+};
+
+}
+
+#endif //DANN_IVF_INDEX_IO_H
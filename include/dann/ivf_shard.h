@@ -4,30 +4,277 @@
 
 #ifndef DANN_INF_SHARD_H
 #define DANN_INF_SHARD_H
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include "dann/distance_kernels.h"
+#include "dann/ivf_index_io.h"
+#include "dann/posting_arena.h"
+#include "dann/quantizer.h"
+#include "dann/query_stats.h"
+#include "dann/roaring_bitmap.h"
 #include "dann/types.h"
 
 namespace dann
 {
 
+class ComputeExecutor;
+
 struct InvertedList
 {
     std::vector<int64_t> vector_ids;
     std::vector<float> vectors;
 };
 
+// encoded form of a posting list, code_size bytes per row in vector_ids order
+struct CodeList
+{
+    std::vector<int64_t> vector_ids;
+    std::vector<uint8_t> codes;
+    // fast-scan quantizers only: the same codes in blocks of 32 rows (see fast_scan.h)
+    std::vector<uint8_t> packed;
+};
+
+// deleted rows of one run of postings. Bits are only ever set, with atomic ors,
+// so scans test them without synchronizing with the deleting thread
+class TombstoneBitmap
+{
+public:
+    explicit TombstoneBitmap(size_t rows);
+    // false if the row was already deleted or lies past the bitmap
+    bool set(size_t row);
+    bool test(size_t row) const {
+        return row < rows_ && ((words_[row >> 6].load(std::memory_order_relaxed) >> (row & 63)) & 1) != 0;
+    }
+    size_t rows() const { return rows_; }
+    size_t count() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+    size_t rows_;
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+    std::atomic<size_t> count_{0};
+};
+
+// rows appended online to one list; the rows are immutable once published to
+// readers, only their tombstones change
+struct PostingSegment
+{
+    std::vector<int64_t> vector_ids;
+    std::vector<float> vectors; // empty on quantized shards that keep no raw rows
+    std::vector<uint8_t> codes; // quantized shards only
+    std::vector<uint8_t> packed; // fast-scan quantizers only, as in CodeList
+    std::shared_ptr<TombstoneBitmap> deleted;
+};
+
+// one run of rows a scan walks, with the tombstones that apply to it
+struct ScanRun
+{
+    PostingView rows;
+    const TombstoneBitmap* deleted = nullptr;
+    // ids the query admits; null admits every row
+    const RoaringBitmap* filter = nullptr;
+};
+
+enum class PostingStorageMode {
+    HASH_MAP, // one InvertedList per centroid
+    ARENA,    // all postings in one cache-line aligned PostingArena
+    MMAP      // postings served from a mapped auxiliary.idx, faulted in on first probe;
+              // lists written after attach are copied out into a HASH_MAP overlay
+};
+
 class IndexIVFShard {
 public:
-    IndexIVFShard(int d, int shard_id, std::string node_id);
-    std::vector<InternalSearchResult> search(const std::vector<int64_t>& centroid_ids, const std::vector<float>& queries, int k);
+    IndexIVFShard(int d, int shard_id, std::string node_id, PostingStorageMode mode = PostingStorageMode::HASH_MAP);
+    ~IndexIVFShard();
+    IndexIVFShard(const IndexIVFShard&) = delete;
+    IndexIVFShard& operator=(const IndexIVFShard&) = delete;
+    const std::string& node_id() const { return node_id_; }
+    // the scan keeps only (distance, id, row pointer); raw vectors are copied
+    // for the final top-k when include_vectors is set. stats, when given, receives
+    // the lists probed and rows scored. With a filter only rows whose id it holds
+    // are scored; the rest are skipped before their distance is computed
+    std::vector<InternalSearchResult> search(const std::vector<int64_t>& centroid_ids, const std::vector<float>& queries, int k,
+                                             bool include_vectors = true, ScanStats* stats = nullptr,
+                                             const RoaringBitmap* filter = nullptr);
+    // centroid_queries maps a posting list to the indices of the queries probing it;
+    // every list is read once and scored against all of those queries.
+    // returns nq result lists, empty for queries that probe nothing on this shard.
+    // stats sums (list, query) probes and rows scored over all queries; filter,
+    // when given, applies to every query as in search
+    std::vector<std::vector<InternalSearchResult>> search_batch(
+        const std::unordered_map<int64_t, std::vector<int64_t>>& centroid_queries,
+        const float* queries, size_t nq, int k, bool include_vectors = true, ScanStats* stats = nullptr,
+        const RoaringBitmap* filter = nullptr);
+    // add_postings, add_posting, clear and the setters below rebuild the shard and
+    // must not run while other threads search it
     void add_postings(const std::unordered_map<int64_t, InvertedList>& postings);
     void add_posting(int64_t centroid, const InvertedList& posting);
+    void reserve(size_t rows);
+    void clear();
+
+    // online insert: the rows of each list become a new segment beside the built
+    // postings, and the whole batch is published to readers with one pointer swap.
+    // Safe while other threads search; searches never lock and see either none or
+    // all of a batch. Concurrent appends are serialized. Lists that pile up more
+    // than a few segments have them merged into one on the next append
+    void append_postings(const std::unordered_map<int64_t, InvertedList>& postings);
+    size_t appended_rows() const;
+
+    // O(1) delete: sets the row's tombstone bit and scans skip it from then on.
+    // Safe while other threads search, serialized with appends. false if the id
+    // is not stored in this shard
+    bool remove_id(int64_t id);
+    size_t deleted_rows() const { return deleted_rows_.load(std::memory_order_relaxed); }
+    // rewrites every list whose deleted share exceeds max_deleted_ratio into one
+    // segment of its live rows, published like an append; returns the lists
+    // rewritten. The built storage of a rewritten list is released by the next rebuild
+    size_t compact(float max_deleted_ratio);
+    // built posting followed by the appended rows; scratch backs the view once
+    // the list has segments
+    bool read_posting(int64_t centroid, InvertedList* scratch, PostingView* view) const;
+
+    // switching mode migrates the postings already stored
+    void set_storage_mode(PostingStorageMode mode);
+    PostingStorageMode storage_mode() const { return storage_mode_; }
+
+    // switches to MMAP and serves the given partitions straight from file;
+    // fails if a partition falls outside the file or its row ids are not 8-byte aligned
+    bool attach_mapped_partitions(std::shared_ptr<const MappedFile> file,
+                                  const std::vector<PartitionDescriptor>& partitions);
+    // in MMAP mode, asks the kernel to start reading the listed postings
+    void set_prefetch(bool enabled) { prefetch_ = enabled; }
+    void prefetch_postings(const std::vector<int64_t>& centroid_ids) const;
+
+    // postings added from now on, and those already stored, are kept as codes and
+    // scanned through the quantizer. Fast-scan quantizers also get the codes packed
+    // in blocks of 32; the scan bounds every row from the byte table first and only
+    // computes the float distance of rows that may still enter the top k. coarse_centroids (nlist * d) are needed by
+    // residual quantizers. refine_factor > 0 keeps the raw rows as well and rescores
+    // the best k * refine_factor candidates exactly; otherwise the raw rows are dropped.
+    // nullptr drops the codes and serves whatever raw rows are left
+    void set_quantizer(std::shared_ptr<const Quantizer> quantizer,
+                       std::shared_ptr<const std::vector<float>> coarse_centroids, int refine_factor);
+    bool is_quantized() const { return quantizer_ != nullptr; }
+    const CodeList* find_code_list(int64_t centroid) const;
+
+    // metric for the raw-row scan; COSINE expects rows and queries already normalized
+    // and reports 1 - cos. Quantized postings are always scored as L2
+    void set_metric(DistanceType metric);
+    DistanceType metric() const { return metric_; }
+
+    // search() splits the raw-row scan into chunks of at least min_chunk_rows rows,
+    // scored in parallel on the compute executor with one top-k each and merged.
+    // Chunks grow with the probed row count so there are about two per worker;
+    // scans shorter than two chunks stay serial. 0 disables the split
+    void set_parallel_scan(size_t min_chunk_rows) { parallel_scan_rows_ = min_chunk_rows; }
+    size_t parallel_scan_rows() const { return parallel_scan_rows_; }
+
+    // moves the ARENA storage onto NUMA node, and runs the chunks of a split scan on
+    // that node's pinned executor instead of the shared one. -1, the default, lifts
+    // both. Postings in the other storage modes stay where they were allocated
+    void set_numa_node(int node);
+    int numa_node() const { return numa_node_; }
+
+    bool find_posting(int64_t centroid, PostingView* view) const;
+    size_t size() const;
+    size_t memory_bytes() const;
+    // live rows of every non-empty list, built and appended together, in no order
+    std::vector<size_t> list_lengths() const;
+    // the same keyed by centroid
+    std::unordered_map<int64_t, size_t> list_rows() const;
+    // unpublishes every row of centroid's list, built and appended, e.g. once the list
+    // has moved to another shard; published like an append. Returns the live rows dropped
+    size_t remove_list(int64_t centroid);
+    // every listed centroid's rows, built and appended, become exactly the given
+    // rows (an empty list drops them), all in one publish like an append. Used to
+    // split and merge lists without a search ever seeing a row twice or not at all
+    void replace_lists(const std::unordered_map<int64_t, InvertedList>& lists);
 private:
+    struct CodeCandidate;
+    struct SegmentSnapshot;
+    // one contiguous run of encoded rows; raw is null when the raw rows were dropped
+    struct CodeRows {
+        const int64_t* vector_ids;
+        const uint8_t* codes;
+        const float* raw;
+        size_t length;
+        const TombstoneBitmap* deleted;
+        const RoaringBitmap* filter = nullptr;
+        const uint8_t* packed = nullptr; // blocks of 32 rows, fast-scan quantizers only
+    };
+    // where a live id is stored; segment is null for the built posting
+    struct RowLocation {
+        int64_t centroid;
+        const PostingSegment* segment;
+        size_t row;
+    };
+
     int shard_id_;
     std::string node_id_;
     int dimension_;
+    PostingStorageMode storage_mode_;
     std::unordered_map<int64_t, InvertedList> postings_;
+    PostingArena arena_;
+    std::shared_ptr<const MappedFile> mapped_file_;
+    std::vector<PartitionDescriptor> mapped_partitions_; // indexed by centroid, length 0 when absent
+    size_t mapped_rows_{0};
+    bool prefetch_{true};
+
+    std::shared_ptr<const Quantizer> quantizer_;
+    std::shared_ptr<const std::vector<float>> coarse_centroids_;
+    int refine_factor_{0};
+    std::unordered_map<int64_t, CodeList> code_lists_;
+    DistanceType metric_{DistanceType::L2};
+    // resolved once from metric_ and dimension_, specialized for the common dimensions
+    DistanceBatchKernel distance_batch_;
+    size_t parallel_scan_rows_{16384};
+    int numa_node_{-1};
+    ComputeExecutor* numa_executor_{nullptr};
+
+    // appended segments, read under an epoch guard and replaced copy-on-write
+    std::atomic<const SegmentSnapshot*> segments_{nullptr};
+    std::mutex append_mutex_;
+    // id -> row, built on the first delete and kept up to date by appends and
+    // compaction; the offline mutators invalidate it. Guarded by append_mutex_
+    std::unordered_map<int64_t, RowLocation> locations_;
+    bool locations_valid_{false};
+    std::atomic<size_t> deleted_rows_{0};
+
+    bool find_mapped_posting(int64_t centroid, PostingView* view) const;
+    void release_mapped_partitions();
+    std::vector<int64_t> posting_centroids() const;
+    void encode_posting(int64_t centroid, const int64_t* ids, const float* vectors, size_t n);
+    void encode_rows(int64_t centroid, const float* vectors, size_t n, uint8_t* codes) const;
+    // packs n codes as rows first_row.. of packed when the quantizer is a fast-scan one
+    void pack_codes(const uint8_t* codes, size_t n, size_t first_row, std::vector<uint8_t>* packed) const;
+    // query, or its residual to centroid for residual quantizers
+    const float* quantized_query(const float* query, int64_t centroid, float* residual) const;
+    // the runs scanned for one list: the built posting, then its appended segments
+    void collect_lists(int64_t centroid, const SegmentSnapshot* appended, std::vector<ScanRun>* lists) const;
+    void collect_code_lists(int64_t centroid, const SegmentSnapshot* appended, std::vector<CodeRows>* lists) const;
+    void scan_codes(const CodeRows& rows, const QuantizedDistanceComputer& computer, int64_t centroid,
+                    TopKBuffer<CodeCandidate>& queue) const;
+    // unpublishes the appended segments (retired to the epoch domain) and returns them
+    std::unique_ptr<const SegmentSnapshot> take_segments();
+    // folds appended rows and tombstones back into the built postings (offline)
+    void fold_segments();
+    // swaps in next and retires current; caller holds append_mutex_
+    void publish(std::unique_ptr<SegmentSnapshot> next, const SegmentSnapshot* current);
+    // centroids with a built posting, and that posting's ids (codes when the raw rows were dropped)
+    std::vector<int64_t> base_centroids() const;
+    size_t base_ids(int64_t centroid, const int64_t** ids) const;
+    // live rows of centroid's segments in snapshot, plus its built posting when with_base
+    std::shared_ptr<PostingSegment> live_rows(int64_t centroid, const SegmentSnapshot& snapshot, bool with_base,
+                                              size_t* dropped) const;
+    void build_locations(const SegmentSnapshot* snapshot);
+    void index_segment(int64_t centroid, const PostingSegment& segment);
+    // replaces centroid's segments in next by rows (and hides its built posting when with_base)
+    void replace_list(SegmentSnapshot* next, int64_t centroid, std::shared_ptr<PostingSegment> rows, bool with_base);
+    std::vector<InternalSearchResult> finish_quantized(std::vector<CodeCandidate>& candidates,
+                                                       const float* query, int k, bool include_vectors) const;
 
 };
 }
-#endif //DANN_INF_SHARD_H
\ No newline at end of file
+#endif //DANN_INF_SHARD_H
@@ -2,17 +2,33 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <memory>
 #include <unordered_map>
 #include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include "dann/types.h"
+#include "dann/block_compression.h"
+#include "dann/config.h"
 
 namespace dann {
 
+// Key-value values live in an append-only log split into segments under
+// <data_dir>/log. Each record is
+//   u32 checksum | u32 key_len | u32 value_len | key | value
+// with value_len 0xFFFFFFFF marking a delete. An in-memory key -> (segment,
+// offset) index serves lookups; it is snapshotted to <data_dir>/log/index on
+// flush, and on startup the log is replayed from the snapshot's position on.
+// compact() rewrites the live records of the sealed segments into one.
 class LocalStorage {
 public:
     LocalStorage(const std::string& data_dir = "./data");
+    // path, cache size, compression (codec and level included) and encryption
+    // from the storage section of the configuration
+    explicit LocalStorage(const Config::StorageConfig& config);
     ~LocalStorage();
     
     // Storage management
@@ -54,7 +70,13 @@ public:
     
     // Configuration
     void set_cache_size(size_t cache_size);
+    // a segment is sealed and a new one started once it reaches this size
+    void set_segment_size(size_t bytes);
+    // fsync the active segment after this many appended bytes (0: every write)
+    void set_sync_bytes(size_t bytes);
     void set_compression_enabled(bool enabled);
+    // codec and zstd level used once compression is enabled (LZ4 by default)
+    void set_compression_codec(CompressionCodec codec, int level = 3);
     void set_encryption_enabled(bool enabled, const std::string& key = "");
     
     // Statistics
@@ -73,7 +95,14 @@ public:
     void reset_stats();
     
     // Maintenance
+    // merges the live records of every sealed segment into one and drops the rest
     bool compact();
+    // share of the sealed segments' bytes no longer referenced by the index
+    double garbage_ratio() const;
+    // compacts in the background whenever garbage_ratio() reaches min_garbage_ratio
+    void start_compaction(double min_garbage_ratio = 0.5,
+                          std::chrono::milliseconds interval = std::chrono::seconds(30));
+    void stop_compaction();
     bool verify_integrity();
     bool cleanup_expired();
     
@@ -81,6 +110,7 @@ private:
     std::string data_dir_;
     size_t cache_size_;
     bool compression_enabled_;
+    BlockCompressionOptions compression_options_;
     bool encryption_enabled_;
     std::string encryption_key_;
     
@@ -88,11 +118,58 @@ private:
     std::unordered_map<std::string, std::string> memory_cache_;
     std::unordered_map<std::string, std::vector<float>> vector_cache_;
     
+    // Log-structured engine, guarded by storage_mutex_. Readers copy the
+    // segment pointer and read outside the lock; a compacted segment's file
+    // stays readable until its last reader drops it
+    struct Segment {
+        uint32_t id = 0;
+        int fd = -1;
+        uint64_t size = 0;
+        uint64_t live_bytes = 0;
+        ~Segment();
+    };
+    struct RecordLocation {
+        uint32_t segment;
+        uint64_t offset; // of the value
+        uint32_t length;
+    };
+    std::map<uint32_t, std::shared_ptr<Segment>> segments_;
+    std::shared_ptr<Segment> active_segment_;
+    std::unordered_map<std::string, RecordLocation> index_;
+    size_t segment_size_;
+    size_t sync_bytes_;
+    uint64_t unsynced_bytes_;
+    
+    // one compaction at a time, plus the background thread
+    std::mutex compaction_mutex_;
+    std::thread compaction_thread_;
+    std::mutex compaction_thread_mutex_;
+    std::condition_variable compaction_cv_;
+    bool compaction_stop_;
+    
     mutable std::mutex stats_mutex_;
     StorageStats stats_;
     
+    // Log operations (storage_mutex_ held unless noted)
+    bool open_log();
+    void close_log();
+    std::string log_dir() const;
+    std::string segment_path(uint32_t id) const;
+    std::shared_ptr<Segment> open_segment(uint32_t id, bool create);
+    bool roll_segment();
+    bool append_record(const std::string& key, const std::string* value);
+    // key still maps to the record at location: nothing wrote, deleted or moved it since
+    bool is_current(const std::string& key, const RecordLocation& location) const;
+    // applies the records of segment from offset on; returns the end of the last whole record
+    uint64_t replay_segment(Segment& segment, const std::string& data, uint64_t offset);
+    void apply_record(const std::string& key, const RecordLocation* location, uint64_t record_bytes);
+    bool write_index_snapshot();
+    bool load_index_snapshot(uint32_t* replay_segment, uint64_t* replay_offset);
+    // no lock needed
+    static bool read_segment(const Segment& segment, uint64_t size, std::string* data);
+    static bool read_value(const Segment& segment, const RecordLocation& location, std::string* value);
+    
     // File operations
-    std::string get_file_path(const std::string& key);
     bool write_file(const std::string& path, const std::string& data);
     std::string read_file(const std::string& path);
     bool delete_file(const std::string& path);
@@ -101,12 +178,19 @@ private:
     bool create_directory(const std::string& path);
     std::vector<std::string> list_files(const std::string& path);
     
+    // set and set_vector (with the vector to cache, or nullptr); no lock held
+    bool write_value(const std::string& key, const std::string& value, const std::vector<float>* vector);
+    // the value of key from the cache or the log, with the index entry it was found
+    // under; fills the cache only if that entry is still current. No lock held
+    bool read_current(const std::string& key, std::string* value, RecordLocation* location);
+    
     // Cache management
     void evict_from_cache();
     bool is_in_cache(const std::string& key);
     void add_to_cache(const std::string& key, const std::string& value);
     
-    // Compression
+    // Compression: block frames (see block_compression.h); data written without
+    // compression has no frame header and is returned as is
     std::string compress_data(const std::string& data);
     std::string decompress_data(const std::string& compressed_data);
     
@@ -122,7 +206,6 @@ private:
     void update_stats(bool cache_hit, bool disk_operation);
     
     // Utilities
-    std::string generate_hash(const std::string& key);
     bool validate_key(const std::string& key);
 };
 
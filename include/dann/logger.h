@@ -7,6 +7,10 @@
 #include <atomic>
 #include <sstream>
 #include <chrono>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <cstdio>
 
 namespace dann {
 
@@ -30,6 +34,12 @@ public:
     void set_max_file_size(size_t max_size_mb);
     void set_max_files(int max_files);
     void set_pattern(const std::string& pattern);
+    // Async mode: each thread appends its records to its own lock-free ring,
+    // drained in batches by a writer thread. A record is dropped (and counted)
+    // when its ring is full, so logging never blocks; FATAL still waits
+    // for the writer
+    void set_async(bool enabled, size_t ring_capacity = 8192);
+    bool is_async() const { return async_.load(std::memory_order_relaxed); }
     
     // Logging methods
     void trace(const std::string& message);
@@ -68,6 +78,7 @@ public:
         uint64_t messages_by_level[6]; // TRACE to FATAL
         uint64_t bytes_written;
         uint64_t file_rotations;
+        uint64_t dropped_messages; // async rings that were full
     };
     
     LogStats get_stats() const;
@@ -95,12 +106,58 @@ private:
     mutable std::mutex stats_mutex_;
     LogStats stats_;
     
+    // Async mode. A ring has one producer (its thread) and one consumer (the
+    // drain, serialized by drain_mutex_); head and tail only ever grow
+    static constexpr size_t kAsyncRecordText = 480;
+    struct AsyncRecord {
+        LogLevel level;
+        uint32_t length;
+        std::chrono::system_clock::time_point time;
+        char text[kAsyncRecordText];
+    };
+    struct ThreadRing {
+        explicit ThreadRing(size_t capacity);
+        std::vector<AsyncRecord> records;
+        size_t mask;
+        std::string thread_id;
+        alignas(64) std::atomic<uint64_t> head{0}; // next slot the thread writes
+        alignas(64) std::atomic<uint64_t> tail{0}; // next slot the drain reads
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> retired{false};          // the thread has exited
+    };
+    // thread_local owner of a thread's ring; retires it when the thread exits
+    struct RingOwner {
+        std::shared_ptr<ThreadRing> ring;
+        ~RingOwner();
+    };
+    std::atomic<bool> async_{false};
+    std::atomic<size_t> ring_capacity_{8192};
+    std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<ThreadRing>> rings_;
+    std::mutex drain_mutex_;
+    std::thread writer_thread_;
+    std::mutex writer_mutex_;
+    std::condition_variable writer_cv_;
+    bool writer_stop_{false};
+    
     // Internal methods
     void log(LogLevel level, const std::string& message);
+    template<typename... Args>
+    void logf(LogLevel level, const std::string& format, Args... args);
+    // a free slot of the calling thread's ring, or nullptr (counted as dropped)
+    AsyncRecord* reserve_record(LogLevel level);
+    void commit_record(AsyncRecord* record, int length);
+    ThreadRing& thread_ring();
+    // writes out every committed record; returns how many
+    size_t drain();
+    void start_writer();
+    void stop_writer();
     void write_to_file(LogLevel level, const std::string& formatted_message);
     void write_to_console(LogLevel level, const std::string& formatted_message);
     void rotate_file_if_needed();
     std::string format_message(LogLevel level, const std::string& message);
+    std::string format_message(LogLevel level, const std::string& message,
+                               std::chrono::system_clock::time_point time, const std::string& thread_id);
     std::string level_to_string(LogLevel level);
     std::string get_timestamp();
     std::string get_thread_id();
@@ -139,42 +196,55 @@ private:
 template<typename... Args>
 void Logger::tracef(const std::string& format, Args... args) {
     if (level_ <= LogLevel::TRACE) {
-        log(LogLevel::TRACE, format_string(format, args...));
+        logf(LogLevel::TRACE, format, args...);
     }
 }
 
 template<typename... Args>
 void Logger::debugf(const std::string& format, Args... args) {
     if (level_ <= LogLevel::DEBUG) {
-        log(LogLevel::DEBUG, format_string(format, args...));
+        logf(LogLevel::DEBUG, format, args...);
     }
 }
 
 template<typename... Args>
 void Logger::infof(const std::string& format, Args... args) {
     if (level_ <= LogLevel::INFO) {
-        log(LogLevel::INFO, format_string(format, args...));
+        logf(LogLevel::INFO, format, args...);
     }
 }
 
 template<typename... Args>
 void Logger::warnf(const std::string& format, Args... args) {
     if (level_ <= LogLevel::WARN) {
-        log(LogLevel::WARN, format_string(format, args...));
+        logf(LogLevel::WARN, format, args...);
     }
 }
 
 template<typename... Args>
 void Logger::errorf(const std::string& format, Args... args) {
     if (level_ <= LogLevel::ERROR) {
-        log(LogLevel::ERROR, format_string(format, args...));
+        logf(LogLevel::ERROR, format, args...);
     }
 }
 
 template<typename... Args>
 void Logger::fatalf(const std::string& format, Args... args) {
     if (level_ <= LogLevel::FATAL) {
-        log(LogLevel::FATAL, format_string(format, args...));
+        logf(LogLevel::FATAL, format, args...);
+    }
+}
+
+template<typename... Args>
+void Logger::logf(LogLevel level, const std::string& format, Args... args) {
+    if (!async_.load(std::memory_order_relaxed)) {
+        log(level, format_string(format, args...));
+        return;
+    }
+    // formatted straight into the ring slot: no heap, no lock
+    AsyncRecord* record = reserve_record(level);
+    if (record) {
+        commit_record(record, snprintf(record->text, sizeof(record->text), format.c_str(), args...));
     }
 }
 
@@ -5,10 +5,12 @@
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <atomic>
 #include <chrono>
 #include <functional>
 #include <thread>
+#include "dann/histogram.h"
 
 namespace dann {
 
@@ -26,13 +28,22 @@ public:
     void set_gauge(const std::string& name, double value);
     double get_gauge(const std::string& name) const;
     
-    // Histogram metrics
+    // Histogram metrics. Counters and histograms are recorded lock-free into
+    // per-thread shards (see histogram.h) and merged only when read or exported
     void record_histogram(const std::string& name, double value);
+    // approximate: one value per sample at its bucket's midpoint, at most
+    // max_histogram_samples of them
     std::vector<double> get_histogram_values(const std::string& name) const;
     double get_histogram_percentile(const std::string& name, double percentile) const;
     double get_histogram_mean(const std::string& name) const;
     double get_histogram_sum(const std::string& name) const;
     uint64_t get_histogram_count(const std::string& name) const;
+    HistogramSnapshot get_histogram_snapshot(const std::string& name) const;
+    
+    // Handles for hot paths, recorded into without any name lookup. A handle
+    // stays usable after remove_metric but is no longer exported
+    std::shared_ptr<ShardedCounter> counter(const std::string& name);
+    std::shared_ptr<LatencyHistogram> histogram(const std::string& name);
     
     // Timer metrics
     class Timer {
@@ -74,7 +85,9 @@ public:
     
     // Configuration
     void set_default_labels(const std::unordered_map<std::string, std::string>& labels);
+    // the le bounds of the exported Prometheus buckets
     void set_histogram_buckets(const std::vector<double>& buckets);
+    // caps get_histogram_values; recording keeps no samples
     void set_max_histogram_samples(size_t max_samples);
     
     // Aggregation
@@ -119,10 +132,10 @@ private:
         HISTOGRAM
     };
     
+    // gauges; counters and histograms live in their own registries
     struct MetricData {
         MetricType type;
         double value;
-        std::vector<double> histogram_values;
         std::unordered_map<std::string, std::string> labels;
         uint64_t last_updated;
         uint64_t timestamp_ms;
@@ -137,6 +150,14 @@ private:
     std::vector<double> histogram_buckets_;
     size_t max_histogram_samples_;
     
+    // Counter and histogram registries. Recording threads keep their own
+    // name -> handle caches, dropped whenever registry_generation_ moves
+    mutable std::shared_mutex registry_mutex_;
+    std::unordered_map<std::string, std::shared_ptr<ShardedCounter>> counters_;
+    std::unordered_map<std::string, std::shared_ptr<LatencyHistogram>> histograms_;
+    std::atomic<uint64_t> registry_generation_;
+    std::atomic<bool> has_alerts_;
+    
     mutable std::mutex alerts_mutex_;
     std::unordered_map<std::string, std::pair<double, AlertCallback>> alert_thresholds_;
     
@@ -146,14 +167,14 @@ private:
     // Internal methods
     void update_metric(const std::string& name, MetricType type, double value,
                      const std::unordered_map<std::string, std::string>& labels = {});
+    ShardedCounter& cached_counter(const std::string& name);
+    LatencyHistogram& cached_histogram(const std::string& name);
+    std::shared_ptr<ShardedCounter> find_counter(const std::string& name) const;
+    std::shared_ptr<LatencyHistogram> find_histogram(const std::string& name) const;
     void check_alerts(const std::string& name, double value);
     std::string format_labels(const std::unordered_map<std::string, std::string>& labels) const;
     std::string escape_prometheus_label(const std::string& label) const;
     
-    // Histogram helpers
-    void add_histogram_sample(MetricData& data, double value);
-    std::vector<double> calculate_percentiles(const std::vector<double>& values) const;
-    double calculate_percentile(const std::vector<double>& values, double percentile) const;
     
     // Statistics
     void update_stats(double update_time_us);
@@ -0,0 +1,73 @@
+//
+// NUMA topology, memory placement and thread pinning. The topology is read from
+// sysfs and placement goes through the mbind/sched_setaffinity syscalls, so no
+// libnuma is needed; off Linux the machine reports a single node and placement
+// requests are ignored.
+//
+
+#ifndef DANN_NUMA_H
+#define DANN_NUMA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace dann {
+
+// ids of the nodes that have CPUs, ascending; {0} when the topology is unknown
+const std::vector<int>& numa_nodes();
+// CPUs of node; every online CPU when the node is unknown
+const std::vector<int>& numa_node_cpus(int node);
+// node of the CPU the calling thread runs on, numa_nodes()[0] when unknown
+int current_numa_node();
+// restricts the calling thread to node's CPUs; false if the kernel refused
+bool pin_thread_to_numa_node(int node);
+
+// page-granular allocations placed on node (preferred, so a full node spills
+// over instead of failing); node < 0 or small sizes fall back to operator new
+void* numa_allocate(size_t bytes, size_t alignment, int node);
+void numa_free(void* p, size_t bytes, size_t alignment, int node);
+
+// cache-line aligned allocator placing its memory on one node. Containers carry
+// the node along when they are copied, moved or swapped
+template <typename T, size_t Alignment = 64>
+struct NumaAllocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template <typename U>
+    struct rebind {
+        using other = NumaAllocator<U, Alignment>;
+    };
+
+    NumaAllocator() noexcept = default;
+    explicit NumaAllocator(int numa_node) noexcept: node(numa_node) {}
+    template <typename U>
+    NumaAllocator(const NumaAllocator<U, Alignment>& other) noexcept: node(other.node) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(numa_allocate(n * sizeof(T), Alignment, node));
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        numa_free(p, n * sizeof(T), Alignment, node);
+    }
+
+    template <typename U>
+    bool operator==(const NumaAllocator<U, Alignment>& other) const noexcept { return node == other.node; }
+    template <typename U>
+    bool operator!=(const NumaAllocator<U, Alignment>& other) const noexcept { return node != other.node; }
+
+    int node = -1; // -1: wherever the allocating thread's policy puts it
+};
+
+template <typename T>
+using NumaVector = std::vector<T, NumaAllocator<T>>;
+
+}
+
+#endif //DANN_NUMA_H
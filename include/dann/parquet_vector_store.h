@@ -0,0 +1,168 @@
+//
+// Vectors read from a Parquet file (an id INT64 column and a vector column of
+// FixedSizeList<float32> or equal-length List<float32>) and served as views into
+// the Arrow buffers: no row is copied after the file is decoded.
+// See docs/parquet_vector_storage_design.md. Only built with HAVE_ARROW_PARQUET.
+//
+
+#ifndef DANN_PARQUET_VECTOR_STORE_H
+#define DANN_PARQUET_VECTOR_STORE_H
+
+#ifdef HAVE_ARROW_PARQUET
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dann/vector_chunk_reader.h"
+#include "dann/vector_source.h"
+
+namespace arrow {
+class Table;
+}
+
+namespace parquet::arrow {
+class FileReader;
+}
+
+namespace dann {
+
+class DistributedIndexIVF;
+
+// a vector stored elsewhere, read like a const std::vector<float>
+class VectorView {
+public:
+    VectorView() = default;
+    VectorView(const float* data, size_t size, int64_t id): data_(data), size_(size), id_(id) {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const float& operator[](size_t i) const { return data_[i]; }
+    const float& at(size_t i) const {
+        if (i >= size_) {
+            throw std::out_of_range("VectorView index out of range");
+        }
+        return data_[i];
+    }
+    const float& front() const { return data_[0]; }
+    const float& back() const { return data_[size_ - 1]; }
+    const float* begin() const { return data_; }
+    const float* end() const { return data_ + size_; }
+    const float* data() const { return data_; }
+    // -1 for the view of an unknown id
+    int64_t id() const { return id_; }
+
+    float dot_product(const VectorView& other) const;
+    float l2_distance_square(const VectorView& other) const;
+
+private:
+    const float* data_ = nullptr;
+    size_t size_ = 0;
+    int64_t id_ = -1;
+};
+
+class ParquetVectorStore: public VectorSource {
+public:
+    // rows laid out back to back in Arrow memory, one per decoded chunk
+    struct Block {
+        const int64_t* ids;
+        const float* vectors;
+        size_t rows;
+    };
+
+    class Iterator {
+    public:
+        Iterator(const ParquetVectorStore* store, size_t block, size_t row): store_(store), block_(block), row_(row) {}
+        VectorView operator*() const;
+        Iterator& operator++();
+        bool operator==(const Iterator& other) const { return block_ == other.block_ && row_ == other.row_; }
+        bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+    private:
+        const ParquetVectorStore* store_;
+        size_t block_;
+        size_t row_;
+    };
+
+    ParquetVectorStore() = default;
+    ~ParquetVectorStore() override;
+    ParquetVectorStore(const ParquetVectorStore&) = delete;
+    ParquetVectorStore& operator=(const ParquetVectorStore&) = delete;
+
+    // maps the file and decodes the two columns; false (and an empty store) when the
+    // file cannot be read, a column is missing or has nulls, or rows differ in length
+    bool load(const std::string& path, const std::string& id_column = "id",
+              const std::string& vector_column = "vector");
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    int dimension() const override { return dimension_; }
+    const float* vector_data(int64_t id) const override;
+    const float* get_vector_data(int64_t id, size_t* dimension) const;
+    // an empty view for an unknown id; at() throws std::out_of_range instead
+    VectorView operator[](int64_t id) const;
+    VectorView at(int64_t id) const;
+    std::vector<VectorView> batch_get(const std::vector<int64_t>& ids) const;
+    const std::vector<Block>& blocks() const { return blocks_; }
+
+    // file order
+    Iterator begin() const { return Iterator(this, 0, 0); }
+    Iterator end() const { return Iterator(this, blocks_.size(), 0); }
+
+private:
+    void clear();
+
+    std::shared_ptr<arrow::Table> table_;
+    std::vector<Block> blocks_;
+    std::unordered_map<int64_t, const float*> rows_by_id_;
+    size_t size_ = 0;
+    int dimension_ = 0;
+};
+
+// streams a Parquet file one row group at a time, for builds larger than memory.
+// Only the current row group is decoded; its rows are handed out in place
+class ParquetChunkReader: public VectorChunkReader {
+public:
+    ParquetChunkReader();
+    ~ParquetChunkReader() override;
+    ParquetChunkReader(const ParquetChunkReader&) = delete;
+    ParquetChunkReader& operator=(const ParquetChunkReader&) = delete;
+
+    bool open(const std::string& path, const std::string& id_column = "id",
+              const std::string& vector_column = "vector");
+    int64_t rows() const { return rows_; }
+
+    int dimension() const override { return dimension_; }
+    bool rewind() override;
+    // one row group per call, whatever max_rows is
+    bool next(size_t max_rows, VectorChunk* chunk) override;
+    bool failed() const override { return failed_; }
+
+private:
+    std::unique_ptr<parquet::arrow::FileReader> reader_;
+    std::shared_ptr<arrow::Table> row_group_;
+    std::vector<int> columns_;
+    int row_groups_{0};
+    int next_group_{0};
+    int64_t rows_{0};
+    int dimension_{0};
+    bool failed_{false};
+};
+
+// writes rows as FixedSizeList<float32>, one row group per row_group_rows rows
+bool write_vectors_to_parquet(const std::string& path, const float* vectors, const int64_t* ids, size_t n, int d,
+                              size_t row_group_rows = 64 * 1024);
+
+// builds index over every row of store. A single-block store is trained on in
+// place; several blocks are gathered into one buffer first
+void build_index_from_store(DistributedIndexIVF& index, const ParquetVectorStore& store);
+
+} // namespace dann
+
+#endif // HAVE_ARROW_PARQUET
+
+#endif // DANN_PARQUET_VECTOR_STORE_H
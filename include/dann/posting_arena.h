@@ -0,0 +1,106 @@
+//
+// Contiguous storage for IVF posting lists.
+//
+
+#ifndef DANN_POSTING_ARENA_H
+#define DANN_POSTING_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include "dann/numa.h"
+
+namespace dann {
+
+constexpr size_t kCacheLineSize = 64;
+
+template <typename T, size_t Alignment = kCacheLineSize>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// read-only view of one posting list, independent of how the shard stores it
+struct PostingView {
+    const int64_t* vector_ids = nullptr;
+    const float* vectors = nullptr;
+    size_t length = 0;
+};
+
+// partition boundary of one centroid inside the arena
+struct PostingSlice {
+    size_t id_offset = 0;     // row offset into the id block
+    size_t vector_offset = 0; // float offset into the vector block, cache-line aligned
+    size_t length = 0;        // number of vectors, 0 when the centroid has no posting
+};
+
+/**
+ * All postings of a shard packed in two large blocks (row ids and raw vectors)
+ * plus an offset/length table indexed by centroid id. Every list starts on a
+ * cache-line boundary so probing nprobe lists walks sequential memory.
+ *
+ * Appending to a list that is not the last one relocates it to the tail; the
+ * old rows become dead space which is reclaimed by compact().
+ *
+ * With a NUMA node set, both blocks are allocated on that node.
+ */
+class PostingArena {
+public:
+    explicit PostingArena(int d);
+
+    void reserve(size_t rows);
+    void append(int64_t centroid, const int64_t* ids, const float* vectors, size_t n);
+    bool find(int64_t centroid, PostingView* view) const;
+    void compact();
+    void clear();
+    // moves the stored rows to node and allocates there from now on; -1 drops the placement
+    void set_numa_node(int node);
+    int numa_node() const { return vectors_.get_allocator().node; }
+
+    // centroids that own a non-empty posting, in increasing order
+    std::vector<int64_t> centroids() const;
+
+    size_t size() const { return live_rows_; }
+    size_t dead_rows() const { return dead_rows_; }
+    size_t memory_bytes() const;
+
+private:
+    size_t aligned_vector_tail();
+
+    int dimension_;
+    NumaVector<int64_t> ids_;
+    NumaVector<float> vectors_;
+    std::vector<PostingSlice> slices_;
+    size_t live_rows_{0};
+    size_t dead_rows_{0};
+};
+
+}
+
+#endif //DANN_POSTING_ARENA_H
@@ -0,0 +1,55 @@
+//
+// Product quantizer: d is split into m sub-vectors, each replaced by the id
+// of its nearest sub-centroid (one byte per sub-vector).
+//
+
+#ifndef DANN_PRODUCT_QUANTIZER_H
+#define DANN_PRODUCT_QUANTIZER_H
+
+#include <vector>
+
+#include "dann/quantizer.h"
+
+namespace dann {
+
+class ProductQuantizer: public Quantizer {
+public:
+    // fast_scan needs nbits = 4: the distance computer then also builds the
+    // byte table that IndexIVFShard scans packed postings with
+    ProductQuantizer(int d, int m, int nbits = 8, bool fast_scan = false);
+
+    bool train(const float* x, size_t n) override;
+    bool is_trained() const override { return trained_; }
+    size_t code_size() const override { return static_cast<size_t>(m_); }
+    void encode(const float* x, uint8_t* codes, size_t n) const override;
+    void decode(const uint8_t* codes, float* x, size_t n) const override;
+    bool by_residual() const override { return true; }
+    std::unique_ptr<QuantizedDistanceComputer> distance_computer() const override;
+    bool fast_scan() const override { return fast_scan_; }
+
+    // m * ksub squared distances between x's sub-vectors and every sub-centroid,
+    // the ADC lookup table
+    void compute_distance_table(const float* x, float* table) const;
+
+    int m() const { return m_; }
+    int dsub() const { return dsub_; }
+    int ksub() const { return ksub_; }
+    // m * ksub * dsub floats
+    const std::vector<float>& centroids() const { return centroids_; }
+
+private:
+    const float* sub_centroid(int m, int code) const {
+        return centroids_.data() + (static_cast<size_t>(m) * ksub_ + code) * dsub_;
+    }
+
+    int m_;
+    int dsub_;
+    int ksub_;
+    bool fast_scan_;
+    bool trained_{false};
+    std::vector<float> centroids_;
+};
+
+}
+
+#endif //DANN_PRODUCT_QUANTIZER_H
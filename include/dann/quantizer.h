@@ -0,0 +1,71 @@
+//
+// Compressed posting codecs for IndexIVFShard.
+//
+
+#ifndef DANN_QUANTIZER_H
+#define DANN_QUANTIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace dann {
+
+struct FastScanTable;
+
+enum class QuantizerType {
+    NONE, // raw float32 postings
+    PQ,   // product quantization of the residual to the coarse centroid
+    SQ8,  // one byte per component, per-dimension min/max range
+    FP16, // IEEE half precision per component
+    PQ_FASTSCAN // 4-bit PQ, postings packed in blocks of 32 and scanned with SIMD table lookups
+};
+
+struct QuantizationParameters {
+    QuantizerType type = QuantizerType::NONE;
+    int pq_m = 8;      // sub-quantizers, must divide the dimension
+    int pq_nbits = 8;  // bits per sub-quantizer code, at most 8; PQ_FASTSCAN always uses 4
+    // > 0 keeps raw vectors next to the codes and rescores the best
+    // k * refine_factor candidates with exact distances
+    int refine_factor = 0;
+};
+
+// scores codes against one query; set_query is called once per probed list
+class QuantizedDistanceComputer {
+public:
+    virtual ~QuantizedDistanceComputer() = default;
+    virtual void set_query(const float* x) = 0;
+    virtual float distance(const uint8_t* code) const = 0;
+    // byte table for the packed blocks, refreshed by set_query; fast-scan quantizers only
+    virtual const FastScanTable* fast_scan_table() const { return nullptr; }
+};
+
+class Quantizer {
+public:
+    virtual ~Quantizer() = default;
+
+    virtual bool train(const float* x, size_t n) = 0;
+    virtual bool is_trained() const = 0;
+    // bytes per encoded vector
+    virtual size_t code_size() const = 0;
+    virtual void encode(const float* x, uint8_t* codes, size_t n) const = 0;
+    virtual void decode(const uint8_t* codes, float* x, size_t n) const = 0;
+    // true when vectors are encoded relative to their coarse centroid
+    virtual bool by_residual() const = 0;
+    virtual std::unique_ptr<QuantizedDistanceComputer> distance_computer() const = 0;
+    // true when postings should also be kept packed for fast_scan_accumulate
+    virtual bool fast_scan() const { return false; }
+
+    int dimension() const { return d_; }
+
+protected:
+    explicit Quantizer(int d): d_(d) {}
+    int d_;
+};
+
+// nullptr for QuantizerType::NONE or parameters that do not fit d
+std::unique_ptr<Quantizer> make_quantizer(int d, const QuantizationParameters& params);
+
+}
+
+#endif //DANN_QUANTIZER_H
@@ -0,0 +1,76 @@
+//
+// Per-stage latency breakdown of a search. Filled only for traced searches
+// (InternalSearchParameters::stats, or the sampled ones of an index with stage
+// sampling on); an untraced search pays one branch per stage.
+//
+
+#ifndef DANN_QUERY_STATS_H
+#define DANN_QUERY_STATS_H
+
+#include <chrono>
+#include <cstdint>
+
+namespace dann {
+
+// milliseconds; for a batch the stages cover the whole batch and the counts
+// are summed over its queries
+struct QueryStats {
+    double centroid_ms = 0.0;   // choosing the probed lists
+    double routing_ms = 0.0;    // grouping the probes by shard, sending remote requests
+    double queue_wait_ms = 0.0; // longest wait of a shard scan for a compute worker
+    double scan_ms = 0.0;       // slowest local shard scan
+    double remote_ms = 0.0;     // waiting for remote shards once the local scans are done
+    double merge_ms = 0.0;      // top-k merge and vector fetch
+    double rerank_ms = 0.0;     // exact re-ranking of quantized candidates
+    double serialize_ms = 0.0;  // filled by the RPC layer
+    double total_ms = 0.0;
+    uint64_t queries = 0;
+    uint64_t lists_probed = 0;    // local and remote
+    uint64_t vectors_scanned = 0; // local shards only
+    uint64_t vectors_reranked = 0;
+};
+
+// what one shard scan touched, filled by IndexIVFShard
+struct ScanStats {
+    uint64_t lists_probed = 0;
+    uint64_t vectors_scanned = 0;
+};
+
+// laps of a traced search; every call is a no-op when tracing is off
+class StageClock {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit StageClock(bool enabled): enabled_(enabled) {
+        if (enabled_) {
+            start_ = last_ = Clock::now();
+        }
+    }
+    bool enabled() const { return enabled_; }
+    // milliseconds since the previous lap (or the start)
+    double lap() {
+        if (!enabled_) {
+            return 0.0;
+        }
+        const Clock::time_point now = Clock::now();
+        const double ms = std::chrono::duration<double, std::milli>(now - last_).count();
+        last_ = now;
+        return ms;
+    }
+    double total() const {
+        return enabled_ ? std::chrono::duration<double, std::milli>(Clock::now() - start_).count() : 0.0;
+    }
+    Clock::time_point last() const { return last_; }
+    static double ms(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+private:
+    bool enabled_;
+    Clock::time_point start_;
+    Clock::time_point last_;
+};
+
+} // namespace dann
+
+#endif // DANN_QUERY_STATS_H
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include "dann/types.h"
+
+struct redisContext;
+struct redisReply;
+
+namespace dann {
+
+// Redis access over a pool of hiredis connections. Every command is sent as
+// an argument vector, so keys and values are binary safe (vectors are stored
+// as raw float bytes). The batch calls pipeline their commands: all of them
+// are written before the first reply is read, so a batch costs one round trip.
+class RedisClient {
+public:
+    using Command = std::vector<std::string>;
+
+    // one reply of a pipeline; nil and error replies are not ok
+    struct Reply {
+        bool ok = false;
+        bool nil = false;
+        long long integer = 0;
+        std::string str;
+        std::vector<std::string> elements; // array replies, "" for nil elements
+    };
+
+    RedisClient(const std::string& host = "localhost", int port = 6379, int db = 0);
+    ~RedisClient();
+
+    // Connection management
+    bool connect();
+    bool disconnect();
+    bool is_connected() const;
+
+    // Basic key-value operations
+    bool set(const std::string& key, const std::string& value);
+    std::string get(const std::string& key);
+    bool del(const std::string& key);
+    bool exists(const std::string& key);
+
+    // Vector storage
+    bool set_vector(const std::string& key, const std::vector<float>& vector);
+    std::vector<float> get_vector(const std::string& key);
+    bool del_vector(const std::string& key);
+
+    // Batch operations, one round trip each; missing keys come back empty
+    bool mset(const std::vector<std::pair<std::string, std::string>>& key_values);
+    std::vector<std::string> mget(const std::vector<std::string>& keys);
+    bool mset_vectors(const std::vector<std::pair<std::string, std::vector<float>>>& key_vectors);
+    std::vector<std::vector<float>> mget_vectors(const std::vector<std::string>& keys);
+    // the same fields of many hashes (e.g. the metadata of a result set)
+    std::vector<std::vector<std::string>> hmget_batch(const std::vector<std::string>& keys,
+                                                      const std::vector<std::string>& fields);
+
+    // Any commands, written together and answered in order
+    std::vector<Reply> pipeline(const std::vector<Command>& commands);
+
+    // List operations
+    bool lpush(const std::string& key, const std::string& value);
+    bool rpush(const std::string& key, const std::string& value);
+    std::string lpop(const std::string& key);
+    std::string rpop(const std::string& key);
+    std::vector<std::string> lrange(const std::string& key, int start, int stop);
+    size_t llen(const std::string& key);
+
+    // Hash operations
+    bool hset(const std::string& key, const std::string& field, const std::string& value);
+    std::string hget(const std::string& key, const std::string& field);
+    std::vector<std::string> hmget(const std::string& key, const std::vector<std::string>& fields);
+    bool hdel(const std::string& key, const std::string& field);
+    std::vector<std::string> hkeys(const std::string& key);
+    std::vector<std::string> hvals(const std::string& key);
+
+    // Set operations
+    bool sadd(const std::string& key, const std::string& member);
+    bool srem(const std::string& key, const std::string& member);
+    std::vector<std::string> smembers(const std::string& key);
+    bool sismember(const std::string& key, const std::string& member);
+
+    // Pub/Sub
+    bool publish(const std::string& channel, const std::string& message);
+    bool subscribe(const std::string& channel, std::function<void(const std::string&, const std::string&)> callback);
+    bool unsubscribe(const std::string& channel);
+
+    // Transactions: between multi() and exec()/discard() the calling thread
+    // keeps one connection of the pool to itself. If that connection breaks the
+    // transaction fails outright: later commands are not retried elsewhere and
+    // exec() returns false
+    void multi();
+    bool exec();
+    void discard();
+
+    // Expiration
+    bool expire(const std::string& key, int seconds);
+    bool persist(const std::string& key);
+    int ttl(const std::string& key);
+
+    // Cluster operations
+    std::vector<std::string> cluster_nodes();
+    std::string cluster_info();
+    bool cluster_save();
+
+    // Configuration
+    void set_timeout_ms(int timeout_ms);
+    void set_max_retries(int max_retries);
+    // most connections open at once; callers beyond it wait for a free one
+    void set_pool_size(size_t pool_size);
+
+    // Health check
+    bool ping();
+    std::string info();
+
+    // Metrics
+    struct RedisMetrics {
+        uint64_t commands_sent;
+        uint64_t commands_succeeded;
+        uint64_t commands_failed;
+        uint64_t connection_errors;
+        uint64_t timeout_errors;
+        double avg_response_time_ms;
+        uint64_t bytes_sent;
+        uint64_t bytes_received;
+    };
+
+    RedisMetrics get_metrics() const;
+    void reset_metrics();
+
+private:
+    std::string host_;
+    int port_;
+    int db_;
+    std::atomic<bool> connected_;
+    int timeout_ms_;
+    int max_retries_;
+    size_t pool_size_;
+
+    // Connection pool
+    std::mutex pool_mutex_;
+    std::condition_variable pool_cv_;
+    std::vector<redisContext*> idle_connections_;
+    size_t open_connections_;
+    // nullptr once the transaction's connection broke: the rest of it fails
+    std::unordered_map<std::thread::id, redisContext*> pinned_connections_;
+
+    mutable std::mutex metrics_mutex_;
+    RedisMetrics metrics_;
+
+    // Connection operations
+    redisContext* create_connection();
+    void close_connection(redisContext* context);
+    // an idle connection, a new one while below pool_size_, else waits;
+    // nullptr when no connection can be made
+    redisContext* acquire_connection();
+    // a broken connection is closed instead of going back to the pool
+    void release_connection(redisContext* context, bool broken);
+
+    // Command execution
+    bool execute_command(const Command& args);
+    std::string execute_command_with_reply(const Command& args);
+    Reply execute(const Command& args);
+    // writes every command, then reads the replies; false on a connection error.
+    // *sent is false when the failure came before anything reached the socket
+    bool run_pipeline(redisContext* context, const std::vector<Command>& commands, std::vector<Reply>* replies,
+                      bool* sent);
+    static Reply to_reply(const redisReply* reply);
+
+    // Metrics
+    void update_metrics(bool success, double response_time, size_t bytes_sent, size_t bytes_received);
+
+    // Serialization
+    std::string serialize_vector(const std::vector<float>& vector);
+    std::vector<float> deserialize_vector(const std::string& data);
+
+    static size_t command_bytes(const Command& args);
+};
+
+} // namespace dann
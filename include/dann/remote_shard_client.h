@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dann/rpc_client.h"
+#include "dann/shard_client.h"
+
+namespace dann {
+
+// ShardClient over gRPC. Nodes are named "host:port", as in --seed-nodes; each
+// gets a small pool of channels opened on first use and picked round robin, so
+// one busy HTTP/2 connection does not serialize a node's shard requests
+class RemoteShardClient: public ShardClient {
+public:
+    explicit RemoteShardClient(int channels_per_node = 2);
+
+    void search_shard(const std::string& node, const InternalShardSearchRequest& request,
+                      std::chrono::steady_clock::time_point deadline, ShardSearchCallback done) override;
+
+private:
+    struct NodeChannels {
+        std::vector<std::unique_ptr<RPCClient>> clients;
+        std::atomic<size_t> next{0};
+    };
+
+    // nullptr when node is not a "host:port" that could be connected
+    NodeChannels* channels(const std::string& node);
+
+    int channels_per_node_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::unique_ptr<NodeChannels>> nodes_;
+};
+
+} // namespace dann
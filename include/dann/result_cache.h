@@ -0,0 +1,100 @@
+//
+// Bounded cache of final search results, keyed by the (quantized) query vector,
+// k and the search parameters. Entries carry the index version they were
+// computed at and are dropped on the first lookup after a write bumped it.
+//
+
+#ifndef DANN_RESULT_CACHE_H
+#define DANN_RESULT_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "dann/types.h"
+
+namespace dann {
+
+struct ResultCacheOptions {
+    // entries over all shards
+    size_t capacity = 10000;
+    // independently locked LRU lists; a key always maps to the same one
+    size_t shards = 16;
+    // components are rounded to multiples of this before keying, so copies of one
+    // embedding that went through different encoders share an entry. 0 keys on the
+    // exact bits
+    float quantization_step = 1e-6f;
+    // admit a query on its second miss only (the TinyLFU doorkeeper), so a stream of
+    // one-off queries does not flush the popular ones
+    bool admit_on_second_miss = true;
+};
+
+class ResultCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t insertions;
+        uint64_t evictions;
+    };
+
+    ResultCache(int dimension, ResultCacheOptions options = {});
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // true and fills results when the query was cached at version
+    bool lookup(const float* query, int k, const InternalSearchParameters& params, uint64_t version,
+                std::vector<InternalSearchResult>* results);
+    // results must have been computed with the index at version
+    void insert(const float* query, int k, const InternalSearchParameters& params, uint64_t version,
+                const std::vector<InternalSearchResult>& results);
+    void clear();
+    size_t size() const;
+    Stats stats() const;
+
+private:
+    struct Key {
+        std::vector<float> query;
+        int k;
+        InternalSearchParameters params;
+        uint64_t hash;
+    };
+    struct Entry {
+        Key key;
+        uint64_t version;
+        std::vector<InternalSearchResult> results;
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        // most recently used first
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+        // one bit per hash slot, cleared after four capacities' worth of first misses
+        std::vector<uint64_t> doorkeeper;
+        size_t doorkeeper_inserts{0};
+    };
+
+    Key make_key(const float* query, int k, const InternalSearchParameters& params) const;
+    static bool same_key(const Key& a, const Key& b);
+    Shard& shard_for(uint64_t hash);
+    // true when the doorkeeper saw this hash before; marks it otherwise
+    bool admit(Shard& shard, uint64_t hash);
+
+    int dimension_;
+    ResultCacheOptions options_;
+    size_t shard_capacity_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> insertions_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+
+}
+
+#endif //DANN_RESULT_CACHE_H
@@ -0,0 +1,96 @@
+//
+// Compressed set of 64-bit ids in the roaring layout: ids are grouped by their
+// high 48 bits, and the low 16 bits of a group are kept as a sorted array while
+// it holds at most 4096 of them, as an 8 KiB bitset beyond that. Sparse and
+// dense sets both stay small, and contains() is a binary search over the groups
+// followed by an array search or a single bit test.
+//
+
+#ifndef DANN_ROARING_BITMAP_H
+#define DANN_ROARING_BITMAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dann {
+
+class RoaringBitmap {
+public:
+    // false if id was already present
+    bool add(int64_t id);
+    // false if id was not present
+    bool remove(int64_t id);
+    bool contains(int64_t id) const {
+        const Container* c = find(static_cast<uint64_t>(id) >> 16);
+        return c && c->contains(static_cast<uint16_t>(id));
+    }
+    size_t cardinality() const { return cardinality_; }
+    bool empty() const { return cardinality_ == 0; }
+    void clear();
+
+    // keeps only the ids also in other
+    void intersect(const RoaringBitmap& other);
+    size_t memory_bytes() const;
+
+    // calls f(id) for every id in ascending unsigned order
+    template <typename F>
+    void for_each(F f) const {
+        for (const auto& c: containers_) {
+            const uint64_t high = c.key << 16;
+            if (c.bits.empty()) {
+                for (uint16_t low: c.array) {
+                    f(static_cast<int64_t>(high | low));
+                }
+                continue;
+            }
+            for (size_t w = 0; w < c.bits.size(); ++w) {
+                for (uint64_t word = c.bits[w]; word != 0; word &= word - 1) {
+                    f(static_cast<int64_t>(high | (w * 64 + static_cast<uint64_t>(__builtin_ctzll(word)))));
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr size_t kArrayMax = 4096;
+    static constexpr size_t kBitsetWords = 1024;
+
+    struct Container {
+        uint64_t key = 0;
+        uint32_t cardinality = 0;
+        std::vector<uint16_t> array; // sorted, while a bitset is not used
+        std::vector<uint64_t> bits;  // kBitsetWords words once the array outgrew kArrayMax
+
+        bool contains(uint16_t low) const {
+            if (!bits.empty()) {
+                return (bits[low >> 6] >> (low & 63)) & 1;
+            }
+            return std::binary_search(array.begin(), array.end(), low);
+        }
+        bool add(uint16_t low);
+        bool remove(uint16_t low);
+        void to_bitset();
+        void to_array();
+    };
+
+    const Container* find(uint64_t key) const {
+        // ids tend to come from one or a few groups
+        if (containers_.size() == 1) {
+            return containers_[0].key == key ? &containers_[0] : nullptr;
+        }
+        auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                                   [](const Container& c, uint64_t k) { return c.key < k; });
+        return it != containers_.end() && it->key == key ? &*it : nullptr;
+    }
+    // index of the container for key, inserted empty when missing
+    size_t find_or_insert(uint64_t key);
+
+    std::vector<Container> containers_; // sorted by key, none empty
+    size_t cardinality_ = 0;
+};
+
+} // namespace dann
+
+#endif // DANN_ROARING_BITMAP_H
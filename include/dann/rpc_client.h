@@ -1,47 +1,60 @@
 #pragma once
 
-#include <grpc++/grpc++.h>
+#include <grpcpp/grpcpp.h>
 #include <memory>
 #include <string>
 #include <future>
 #include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include "vector_service.grpc.pb.h"
+#include "dann/shard_client.h"
 #include "dann/types.h"
 
 namespace dann {
 
+// Client of one node's VectorSearchService. Calls are safe from any thread; the
+// async ones use the gRPC callback API, so no thread is held while they are in flight
 class RPCClient {
 public:
     RPCClient(const std::string& address, int port);
     ~RPCClient();
-    
+
     // Connection management
     bool connect();
     bool disconnect();
     bool is_connected() const;
-    
+
     // RPC operations
-    std::future<QueryResponse> search_async(const QueryRequest& request);
-    QueryResponse search_sync(const QueryRequest& request);
-    
-    std::future<bool> add_vectors_async(const BulkLoadRequest& request);
-    bool add_vectors_sync(const BulkLoadRequest& request);
-    
+    std::future<InternalQueryResponse> search_async(const InternalQueryRequest& request);
+    InternalQueryResponse search_sync(const InternalQueryRequest& request);
+
+    // one shard's partial top-k, bounded by deadline; done runs on a gRPC thread
+    void search_shard_async(const InternalShardSearchRequest& request,
+                            std::chrono::steady_clock::time_point deadline, ShardSearchCallback done);
+
+    std::future<bool> add_vectors_async(const InternalBulkLoadRequest& request);
+    bool add_vectors_sync(const InternalBulkLoadRequest& request);
+
     std::future<bool> remove_vector_async(int64_t id);
     bool remove_vector_sync(int64_t id);
-    
+
     std::future<bool> update_vector_async(int64_t id, const std::vector<float>& vector);
     bool update_vector_sync(int64_t id, const std::vector<float>& vector);
-    
+
     // Configuration
     void set_timeout_ms(int timeout_ms);
     void set_max_retries(int max_retries);
     void enable_compression(bool enable);
-    
+
     // Health check
     bool health_check();
     std::string get_server_info();
-    
+
+    // Admin: the server's trace spans over the next duration_ms as Chrome trace
+    // JSON; empty on failure
+    std::string capture_trace(int64_t duration_ms);
+
     // Metrics
     struct ClientMetrics {
         uint64_t total_requests;
@@ -52,10 +65,10 @@ public:
         uint64_t bytes_sent;
         uint64_t bytes_received;
     };
-    
+
     ClientMetrics get_metrics() const;
     void reset_metrics();
-    
+
 private:
     std::string address_;
     int port_;
@@ -63,36 +76,37 @@ private:
     int timeout_ms_;
     int max_retries_;
     bool compression_enabled_;
-    
-    std::unique_ptr<grpc::Channel> channel_;
-    std::unique_ptr<grpc::ClientContext> context_;
-    
+
+    // guards channel_ and stub_ against connect / disconnect; calls copy the stub pointer
+    mutable std::mutex channel_mutex_;
+    std::shared_ptr<grpc::Channel> channel_;
+    std::shared_ptr<VectorSearchService::Stub> stub_;
+
     mutable std::mutex metrics_mutex_;
     ClientMetrics metrics_;
-    
+
+    // async calls still in flight; the destructor waits for their callbacks
+    std::mutex inflight_mutex_;
+    std::condition_variable inflight_cv_;
+    int inflight_{0};
+
     // Connection management
     bool create_channel();
     void close_channel();
-    
-    // RPC implementation
-    template<typename Request, typename Response>
-    std::future<Response> send_request_async(const std::string& method, const Request& request);
-    
-    template<typename Request, typename Response>
-    Response send_request_sync(const std::string& method, const Request& request);
-    
-    // Retry logic
-    template<typename Request, typename Response>
-    Response send_with_retry(const std::string& method, const Request& request);
-    
+    std::shared_ptr<VectorSearchService::Stub> stub() const;
+    void prepare_context(grpc::ClientContext* context, std::chrono::steady_clock::time_point deadline) const;
+    std::chrono::steady_clock::time_point default_deadline() const;
+
+    // unary call with retries on UNAVAILABLE and exponential backoff
+    template<typename Request, typename Response, typename Method>
+    grpc::Status call_with_retry(Method method, const Request& request, Response* response);
+    // invoke(stub, context, request, response, on_done) starts a callback-API call;
+    // done(status, response) runs once it completes. No retries
+    template<typename Request, typename Response, typename Invoke, typename Done>
+    void start_async(Request request, std::chrono::steady_clock::time_point deadline, Invoke invoke, Done done);
+
     // Metrics
     void update_metrics(bool success, double response_time, size_t bytes_sent, size_t bytes_received);
-    
-    // Serialization helpers
-    std::string serialize_request(const QueryRequest& request);
-    std::string serialize_request(const BulkLoadRequest& request);
-    QueryResponse deserialize_query_response(const std::string& response_data);
-    bool deserialize_bool_response(const std::string& response_data);
 };
 
 } // namespace dann
@@ -1,11 +1,13 @@
 #pragma once
 
 #include <grpcpp/grpcpp.h>
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <functional>
 #include <thread>
 #include <atomic>
+#include <condition_variable>
 #include <mutex>
 #include "dann/types.h"
 #include "vector_service.pb.h"
@@ -16,6 +18,11 @@ namespace dann {
 // Forward declaration
 class VectorSearchServiceImpl;
 
+enum class RPCServerMode {
+    SYNC,  // gRPC's thread pool runs every handler to completion
+    ASYNC  // completion queues; handlers run on the executors and finish from there
+};
+
 class RPCServer {
 public:
     RPCServer(const std::string& address, int port);
@@ -32,6 +39,10 @@ public:
     // Configuration
     void set_max_threads(int max_threads);
     void set_timeout_ms(int timeout_ms);
+    // takes effect on the next start()
+    void set_mode(RPCServerMode mode) { mode_ = mode; }
+    // completion queues (one polling thread each) of the async mode; 0 means one per core
+    void set_completion_queues(int count) { completion_queue_count_ = std::max(0, count); }
     
     // Metrics
     struct ServerMetrics {
@@ -46,14 +57,31 @@ public:
     void reset_metrics();
     
 private:
+    class AsyncCallBase;
+    template<typename Request, typename Response>
+    class AsyncCall;
+    class AsyncIngestCall;
+
     std::string address_;
     int port_;
     std::atomic<bool> running_;
     int max_threads_;
     int timeout_ms_;
+    RPCServerMode mode_{RPCServerMode::SYNC};
+    int completion_queue_count_{0};
     
     std::unique_ptr<grpc::Server> server_;
     std::unique_ptr<VectorSearchServiceImpl> search_service_;
+
+    // async mode: the service only receives requests, search_service_ still handles them
+    std::unique_ptr<VectorSearchService::AsyncService> async_service_;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> completion_queues_;
+    std::vector<std::thread> queue_threads_;
+    std::atomic<bool> accepting_{false};
+    // handlers started but not yet finished; stop() waits for them before the queues close
+    std::mutex inflight_mutex_;
+    std::condition_variable inflight_cv_;
+    int64_t inflight_{0};
     
     mutable std::mutex metrics_mutex_;
     ServerMetrics metrics_;
@@ -65,6 +93,13 @@ private:
     void handle_request(const std::string& method, const std::string& request_data);
     void update_metrics(bool success, double response_time);
     
+    // Async mode
+    void request_async_calls(grpc::ServerCompletionQueue* cq);
+    void poll_queue(grpc::ServerCompletionQueue* cq);
+    void begin_call();
+    void end_call();
+    void stop_async();
+
     // Worker threads
     void worker_loop();
     void start_worker_threads();
@@ -0,0 +1,46 @@
+//
+// Scalar quantizers: every component stored on its own as int8 (per-dimension
+// min/max range) or fp16. Distances are computed on the codes directly.
+//
+
+#ifndef DANN_SCALAR_QUANTIZER_H
+#define DANN_SCALAR_QUANTIZER_H
+
+#include <vector>
+
+#include "dann/quantizer.h"
+
+namespace dann {
+
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+class ScalarQuantizer: public Quantizer {
+public:
+    // type is QuantizerType::SQ8 or QuantizerType::FP16
+    ScalarQuantizer(int d, QuantizerType type);
+
+    // SQ8 records per-dimension min/max of x; FP16 needs no training
+    bool train(const float* x, size_t n) override;
+    bool is_trained() const override { return trained_; }
+    size_t code_size() const override;
+    void encode(const float* x, uint8_t* codes, size_t n) const override;
+    void decode(const uint8_t* codes, float* x, size_t n) const override;
+    bool by_residual() const override { return false; }
+    std::unique_ptr<QuantizedDistanceComputer> distance_computer() const override;
+
+    QuantizerType type() const { return type_; }
+    // SQ8 decodes component j as vmin[j] + code * vscale[j]
+    const std::vector<float>& vmin() const { return vmin_; }
+    const std::vector<float>& vscale() const { return vscale_; }
+
+private:
+    QuantizerType type_;
+    bool trained_{false};
+    std::vector<float> vmin_;
+    std::vector<float> vscale_;
+};
+
+}
+
+#endif //DANN_SCALAR_QUANTIZER_H
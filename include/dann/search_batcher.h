@@ -0,0 +1,82 @@
+//
+// Micro-batching of concurrent single-query searches: queries arriving within a
+// short window are scored as one batch through the index's batched path (one
+// coarse GEMM, shared posting scans) and each caller gets its own top-k back.
+//
+
+#ifndef DANN_SEARCH_BATCHER_H
+#define DANN_SEARCH_BATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dann/types.h"
+
+namespace dann {
+
+struct SearchBatcherOptions {
+    // a batch is dispatched once its oldest query waited this long...
+    std::chrono::microseconds window{200};
+    // ...or once this many queries are queued, whichever comes first
+    size_t max_batch = 32;
+    // prefix of the Metrics names: <prefix>_batch_size and <prefix>_queue_depth histograms
+    std::string metrics_prefix = "search_batcher";
+};
+
+class SearchBatcher {
+public:
+    // queries is nq * dimension floats; returns one top-k list per query
+    using BatchSearch = std::function<std::vector<std::vector<InternalSearchResult>>(
+            const float* queries, size_t nq, int k, const InternalSearchParameters& params)>;
+
+    SearchBatcher(int dimension, BatchSearch search, SearchBatcherOptions options = {});
+    ~SearchBatcher();
+
+    SearchBatcher(const SearchBatcher&) = delete;
+    SearchBatcher& operator=(const SearchBatcher&) = delete;
+
+    // query must hold dimension floats and stay alive until the future is ready;
+    // queries with different k or parameters are batched separately
+    std::future<std::vector<InternalSearchResult>> submit(const float* query, int k,
+                                                          const InternalSearchParameters& params = {});
+    // submit and wait
+    std::vector<InternalSearchResult> search(const float* query, int k, const InternalSearchParameters& params = {});
+
+    size_t queue_depth() const;
+
+private:
+    struct Pending {
+        const float* query;
+        int k;
+        InternalSearchParameters params;
+        std::chrono::steady_clock::time_point arrival;
+        std::promise<std::vector<InternalSearchResult>> result;
+    };
+
+    void dispatch_loop();
+    void run_batch(std::vector<Pending>& batch);
+
+    int dimension_;
+    BatchSearch search_;
+    SearchBatcherOptions options_;
+    std::string batch_size_metric_;
+    std::string queue_depth_metric_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Pending> pending_;
+    bool stop_{false};
+    std::thread dispatcher_;
+};
+
+}
+
+#endif //DANN_SEARCH_BATCHER_H
@@ -0,0 +1,59 @@
+//
+// Transport for shards served by another node. The coordinator probes the
+// centroids itself and asks each remote shard for its partial top-k over the
+// probed lists only; the replies are merged like local shard results.
+//
+
+#ifndef DANN_SHARD_CLIENT_H
+#define DANN_SHARD_CLIENT_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dann/types.h"
+
+namespace dann {
+
+struct InternalShardSearchRequest {
+    int shard_id = 0;
+    std::vector<int64_t> centroid_ids;
+    // already in the form the shards score (normalized for COSINE)
+    std::vector<float> query;
+    int k = 0;
+    bool include_vectors = false;
+    // resolved against the attributes of the serving node; empty = no filter
+    AttributeFilter filter;
+};
+
+struct InternalShardSearchResponse {
+    bool success = false;
+    std::string error_message;
+    // sorted by distance, at most k entries
+    std::vector<InternalSearchResult> results;
+};
+
+// thrown by a search that lost a shard and was not allowed to return partial results
+class ShardUnavailableError: public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+using ShardSearchCallback = std::function<void(InternalShardSearchResponse)>;
+
+class ShardClient {
+public:
+    virtual ~ShardClient() = default;
+
+    // sends request to node and returns at once. done runs exactly once, on any thread,
+    // with success false when the node failed or did not answer before deadline
+    virtual void search_shard(const std::string& node, const InternalShardSearchRequest& request,
+                              std::chrono::steady_clock::time_point deadline, ShardSearchCallback done) = 0;
+};
+
+}
+
+#endif //DANN_SHARD_CLIENT_H
@@ -0,0 +1,142 @@
+//
+// In-process trace spans. Hot paths mark their stages with DANN_TRACE_SPAN;
+// while a capture runs (Tracer::start .. Tracer::stop) every finished span is
+// appended to its thread's buffer and stop() returns them as Chrome trace
+// JSON, which chrome://tracing and ui.perfetto.dev open directly. With no
+// capture running a span costs one relaxed load.
+//
+// Built with DANN_USDT, spans also fire the USDT probes dann:span_begin and
+// dann:span_end (args: name, category), captured or not, for perf and
+// bpftrace:
+//   perf probe -x dann_server sdt_dann:span_begin
+//   bpftrace -e 'usdt:./dann_server:dann:span_begin { @[str(arg0)] = count(); }'
+//
+
+#ifndef DANN_TRACE_H
+#define DANN_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(DANN_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define DANN_USDT_PROBE2(probe, a, b) DTRACE_PROBE2(dann, probe, a, b)
+#else
+#define DANN_USDT_PROBE2(probe, a, b) ((void) 0)
+#endif
+
+namespace dann {
+
+struct TraceCaptureStats {
+    uint64_t events = 0;
+    uint64_t dropped = 0; // spans lost to full thread buffers
+    uint32_t threads = 0;
+};
+
+class Tracer {
+public:
+    static Tracer& instance();
+
+    static bool active() { return active_.load(std::memory_order_relaxed); }
+    static uint64_t now_ns() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // Begins a capture keeping up to max_events_per_thread spans per thread;
+    // false if one is already running
+    bool start(size_t max_events_per_thread = 1 << 16);
+    // Ends the running capture and returns its spans as Chrome trace JSON
+    // (with an empty traceEvents array if none was running)
+    std::string stop(TraceCaptureStats* stats = nullptr);
+
+    // Appends a finished span to the calling thread's buffer. name and
+    // category must outlive the capture (string literals)
+    void record(const char* name, const char* category, uint64_t start_ns, uint64_t end_ns);
+
+private:
+    Tracer() = default;
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    struct Event {
+        const char* name;
+        const char* category;
+        uint64_t start_ns;
+        uint64_t end_ns;
+    };
+    // One producer (its thread). The thread resets the buffer itself when it
+    // first records in a new capture, and publishes each event through count,
+    // so stop() reads [0, count) without a lock
+    struct ThreadBuffer {
+        std::vector<Event> events;
+        uint32_t tid = 0;
+        std::atomic<uint64_t> generation{0}; // capture the buffer holds
+        std::atomic<size_t> count{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> retired{false}; // the thread has exited
+    };
+    // thread_local owner of a thread's buffer; retires it when the thread exits
+    struct BufferOwner {
+        std::shared_ptr<ThreadBuffer> buffer;
+        ~BufferOwner();
+    };
+    ThreadBuffer& thread_buffer();
+
+    static inline std::atomic<bool> active_{false};
+    std::atomic<uint64_t> generation_{0};
+    std::atomic<uint64_t> capture_start_ns_{0};
+    std::atomic<size_t> capacity_{0};
+    std::mutex capture_mutex_; // serializes start and stop
+    std::mutex buffers_mutex_;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+    uint32_t next_tid_ = 1;
+};
+
+// Times its scope, or [construction, end()) when ended early
+class TraceSpan {
+public:
+    TraceSpan(const char* category, const char* name) : name_(name), category_(category) {
+        DANN_USDT_PROBE2(span_begin, name_, category_);
+        if (Tracer::active()) {
+            start_ns_ = Tracer::now_ns();
+        }
+    }
+    ~TraceSpan() { end(); }
+
+    void end() {
+        if (ended_) {
+            return;
+        }
+        ended_ = true;
+        DANN_USDT_PROBE2(span_end, name_, category_);
+        if (start_ns_ != 0 && Tracer::active()) {
+            Tracer::instance().record(name_, category_, start_ns_, Tracer::now_ns());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name_;
+    const char* category_;
+    uint64_t start_ns_ = 0;
+    bool ended_ = false;
+};
+
+} // namespace dann
+
+#define DANN_TRACE_CONCAT_INNER(a, b) a##b
+#define DANN_TRACE_CONCAT(a, b) DANN_TRACE_CONCAT_INNER(a, b)
+// a span over the rest of the enclosing scope
+#define DANN_TRACE_SPAN(category, name) \
+    ::dann::TraceSpan DANN_TRACE_CONCAT(dann_trace_span_, __LINE__)(category, name)
+
+#endif // DANN_TRACE_H
@@ -4,10 +4,20 @@
 #include <string>
 #include <cstdint>
 #include <chrono>
+#include <map>
 #include <queue>
 
 namespace dann {
 
+// metric of an index. Every search result carries a distance where smaller is
+// closer, so shard results merge the same way for all metrics:
+// L2 squared euclidean, COSINE 1 - cos(q, x), DOT -<q, x>
+enum class DistanceType : uint8_t {
+    L2 = 0,
+    COSINE = 1,
+    DOT = 2
+};
+
 struct DistanceWithIndex
 {
     float distance;
@@ -42,6 +52,34 @@ struct InternalSearchResult {
 
 using InternalSearchResultQueue = std::priority_queue<InternalSearchResult>;
 
+struct QueryStats;
+
+// attributes of one vector, key -> value (see attribute_store.h)
+using Attributes = std::map<std::string, std::string>;
+// equality terms a search result's attributes must all match
+using AttributeFilter = std::map<std::string, std::string>;
+
+// per query options carried from the request down to the shards
+struct InternalSearchParameters {
+    // copy raw vectors into the final top-k; the scan itself only tracks (id, distance).
+    // On by default so search(query, k) keeps returning vectors; callers that only
+    // need ids and distances turn it off
+    bool include_vectors = true;
+    // deadline of the remote shard requests, 0 keeps the per-node defaults
+    uint64_t timeout_ms = 0;
+    // merge the shards that answered when others fail or miss the deadline;
+    // otherwise such a search throws
+    bool allow_partial = false;
+    // IVF lists to probe and HNSW candidate list size for this query; 0 keeps the
+    // index defaults. Larger values trade latency for recall
+    int nprobe = 0;
+    int ef_search = 0;
+    // when set, the search fills in its per-stage latency breakdown (query_stats.h)
+    QueryStats* stats = nullptr;
+    // only vectors whose attributes match every term are returned; empty = no filter
+    AttributeFilter filter;
+};
+
 struct InternalIndexOperation {
     enum Type { ADD, DELETE, UPDATE };
     
@@ -76,9 +114,13 @@ struct InternalQueryRequest {
     int k;
     std::string consistency_level;
     uint64_t timeout_ms;
+    bool allow_partial;
+    int nprobe;
+    int ef_search;
     
     InternalQueryRequest(const std::vector<float>& vec, int k_val = 10)
-        : query_vector(vec), k(k_val), consistency_level("eventual"), timeout_ms(5000) {}
+        : query_vector(vec), k(k_val), consistency_level("eventual"), timeout_ms(5000), allow_partial(false),
+          nprobe(0), ef_search(0) {}
 };
 
 struct InternalQueryResponse {
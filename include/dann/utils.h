@@ -17,6 +17,14 @@ namespace dann {
 
   std::vector<DistanceWithIndex> find_closest_k_with_distance(const float* x, const float* y, int d, int n, int k);
   std::vector<DistanceWithIndex> find_closest_k_with_distance(const std::vector<float>& x, const std::vector<float>& y, int d, int n, int k);
+  // distances as scored by the metric kernel: ||x - y||^2 for L2, -<x, y> otherwise
+  std::vector<DistanceWithIndex> find_closest_k_with_distance(const float* x, const float* y, int d, int n, int k,
+                                                              DistanceType metric);
+
+  // the k nearest of several lists, each sorted by ascending distance, through a
+  // heap over the list heads. Entries are moved out of lists; fewer than k
+  // come back when the lists hold fewer
+  std::vector<InternalSearchResult> merge_top_k(std::vector<std::vector<InternalSearchResult>>& lists, int k);
 
 }
 #endif //DANN_UTILS_H
\ No newline at end of file
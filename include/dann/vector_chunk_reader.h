@@ -0,0 +1,91 @@
+//
+// Sequential sources of (id, vector) rows for builds that do not hold the whole
+// dataset in memory. A reader hands out one chunk at a time and can be rewound,
+// since an out-of-core build reads its input twice (sample, then assign).
+//
+
+#ifndef DANN_VECTOR_CHUNK_READER_H
+#define DANN_VECTOR_CHUNK_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dann {
+
+// rows * dimension floats and rows ids, valid until the reader's next call
+struct VectorChunk {
+    const float* vectors = nullptr;
+    const int64_t* ids = nullptr;
+    size_t rows = 0;
+};
+
+class VectorChunkReader {
+public:
+    virtual ~VectorChunkReader() = default;
+
+    virtual int dimension() const = 0;
+    // back to the first row
+    virtual bool rewind() = 0;
+    // the next chunk of at most about max_rows rows (readers with a natural chunk,
+    // such as a Parquet row group, may return that instead); false once the input is
+    // exhausted or a read failed, which failed() tells apart
+    virtual bool next(size_t max_rows, VectorChunk* chunk) = 0;
+    virtual bool failed() const { return false; }
+};
+
+// rows already in memory, handed out without copying
+class ArrayChunkReader: public VectorChunkReader {
+public:
+    ArrayChunkReader(const float* vectors, const int64_t* ids, size_t rows, int dimension)
+        : vectors_(vectors), ids_(ids), rows_(rows), dimension_(dimension) {}
+
+    int dimension() const override { return dimension_; }
+    bool rewind() override {
+        position_ = 0;
+        return true;
+    }
+    bool next(size_t max_rows, VectorChunk* chunk) override;
+
+private:
+    const float* vectors_;
+    const int64_t* ids_;
+    size_t rows_;
+    int dimension_;
+    size_t position_{0};
+};
+
+// a 2-D float dataset of an HDF5 file (e.g. "train" of the ann-benchmarks files),
+// read one hyperslab of rows at a time. Row r gets id first_id + r
+class Hdf5ChunkReader: public VectorChunkReader {
+public:
+    Hdf5ChunkReader();
+    ~Hdf5ChunkReader() override;
+    Hdf5ChunkReader(const Hdf5ChunkReader&) = delete;
+    Hdf5ChunkReader& operator=(const Hdf5ChunkReader&) = delete;
+
+    bool open(const std::string& path, const std::string& dataset, int64_t first_id = 0);
+    int64_t rows() const { return rows_; }
+
+    int dimension() const override { return dimension_; }
+    bool rewind() override;
+    bool next(size_t max_rows, VectorChunk* chunk) override;
+    bool failed() const override { return failed_; }
+
+private:
+    struct Handle;
+    std::unique_ptr<Handle> handle_;
+    int64_t rows_{0};
+    int dimension_{0};
+    int64_t first_id_{0};
+    int64_t position_{0};
+    bool failed_{false};
+    std::vector<float> vectors_;
+    std::vector<int64_t> ids_;
+};
+
+} // namespace dann
+
+#endif // DANN_VECTOR_CHUNK_READER_H
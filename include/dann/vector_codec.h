@@ -0,0 +1,35 @@
+//
+// Packed vector payloads: rows of little-endian float32 or fp16 carried as raw
+// bytes, so the RPC layer hands them to the index without per-float parsing.
+//
+
+#ifndef DANN_VECTOR_CODEC_H
+#define DANN_VECTOR_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dann {
+
+enum class PackedEncoding {
+    FLOAT32, // 4 bytes per component
+    FLOAT16  // IEEE half precision, 2 bytes per component
+};
+
+size_t packed_bytes_per_component(PackedEncoding encoding);
+
+// rows of d components packed in bytes. float32 payloads that are suitably
+// aligned are returned in place; anything else is decoded into scratch. The
+// result stays valid while bytes and scratch are alive. nullptr when size is not
+// a whole number of rows
+const float* unpack_vectors(const void* bytes, size_t size, PackedEncoding encoding, int d, size_t* rows,
+                            std::vector<float>* scratch);
+
+// appends n * d components of x to out in the given encoding
+void pack_vectors(const float* x, size_t n, int d, PackedEncoding encoding, std::string* out);
+
+}
+
+#endif //DANN_VECTOR_CODEC_H
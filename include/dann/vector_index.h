@@ -5,9 +5,11 @@
 #include <string>
 #include <unordered_map>
 #include <mutex>
+#include <shared_mutex>
 #include <atomic>
 #include <faiss/Index.h>
 #include <faiss/index_io.h>
+#include "dann/attribute_store.h"
 #include "dann/types.h"
 #include "dann/index_shard.h"
 namespace dann {
@@ -24,13 +26,32 @@ public:
     bool add_vectors(const std::vector<float>& vectors, const std::vector<int64_t>& ids) override;
     bool add_vectors_bulk(const std::vector<float>& vectors, const std::vector<int64_t>& ids, int batch_size = 1000);
     
+    // searches run concurrently with each other; inserts, removes and loads wait for
+    // the searches in flight and hold new ones off while they run
+    using IndexShard::search;
     std::vector<InternalSearchResult> search(const std::vector<float>& query, int k = 10) override;
+    // params.ef_search sizes the HNSW candidate list of this search only; params.filter
+    // is handed to faiss as an id selector, so rows it rejects are never returned
+    std::vector<InternalSearchResult> search(const std::vector<float>& query, int k,
+                                             const InternalSearchParameters& params) override;
     std::vector<InternalSearchResult> search_batch(const std::vector<float>& queries, int k = 10);
+    // one faiss search over all nq queries, which faiss spreads over its OpenMP threads
+    std::vector<std::vector<InternalSearchResult>> search_batch(const float* queries, size_t nq, int k,
+                                                                const InternalSearchParameters& params) override;
     
-    bool remove_vector(int64_t id);
-    bool update_vector(int64_t id, const std::vector<float>& new_vector);
+    bool remove_vector(int64_t id) override;
+    bool update_vector(int64_t id, const std::vector<float>& new_vector) override;
+    bool set_attributes(const std::vector<int64_t>& ids, const std::vector<Attributes>& attributes) override;
+
+    // inserts are buffered until rows of them are pending and then added in one
+    // add_with_ids, so HNSW links them in parallel and searches are held off once per
+    // batch instead of once per insert. Searches scan the buffered rows exactly, so
+    // they are found at once. 0 (the default) adds every insert right away
+    void set_write_batch(size_t rows);
+    // adds the buffered rows to the index
+    void flush();
     
-    // Index management
+    // Index management; the attributes go to file_path + ".attributes"
     bool save_index(const std::string& file_path);
     bool load_index(const std::string& file_path) override;
     void reset_index();
@@ -43,6 +64,7 @@ public:
     // Consistency support
     uint64_t get_version() const;
     void set_version(uint64_t version);
+    uint64_t version() const override { return get_version(); }
     
 private:
     std::unique_ptr<faiss::Index> index_;
@@ -50,13 +72,35 @@ private:
     std::string index_type_;
     int hnsw_m_;
     int hnsw_ef_construction_;
-    mutable std::mutex mutex_;
+    // shared by searches, exclusive for everything that changes index_ or the buffer;
+    // taken through read_lock / write_lock only
+    mutable std::shared_mutex mutex_;
+    mutable std::mutex write_gate_;
     std::atomic<uint64_t> version_;
     std::vector<InternalIndexOperation> pending_operations_;
+    AttributeStore attributes_;
+    size_t write_batch_ = 0;
+    // inserts not yet in index_, in arrival order
+    std::vector<float> buffered_vectors_;
+    std::vector<int64_t> buffered_ids_;
     
     void create_index();
     bool validate_vectors(const std::vector<float>& vectors);
     InternalSearchResult create_search_result(int64_t id, float distance) const;
+    // faiss per-search parameters for params and the filter selector, nullptr when
+    // the index defaults apply
+    std::unique_ptr<faiss::SearchParameters> search_parameters(const InternalSearchParameters& params,
+                                                               faiss::IDSelector* filter) const;
+    // remove_vector without touching the attributes; caller holds mutex_
+    bool remove_locked(int64_t id);
+    std::shared_lock<std::shared_mutex> read_lock() const;
+    std::unique_lock<std::shared_mutex> write_lock() const;
+    // callers hold mutex_, exclusively for flush_locked
+    size_t size_locked() const;
+    void flush_locked();
+    // merges the buffered rows closest to each of the nq queries into its results
+    void search_buffered(const float* queries, size_t nq, int k, const RoaringBitmap* filter,
+                         std::vector<std::vector<InternalSearchResult>>* results) const;
 };
 
 } // namespace dann
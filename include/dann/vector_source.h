@@ -0,0 +1,25 @@
+//
+// Read-only access to full-precision vectors by id, kept outside the index
+// (a Parquet export, a mapped raw file). Indexes use it to fill result vectors.
+//
+
+#ifndef DANN_VECTOR_SOURCE_H
+#define DANN_VECTOR_SOURCE_H
+
+#include <cstdint>
+
+namespace dann {
+
+class VectorSource {
+public:
+    virtual ~VectorSource() = default;
+
+    virtual int dimension() const = 0;
+    // dimension() floats owned by the source, nullptr for an unknown id.
+    // Safe to call from several threads at once
+    virtual const float* vector_data(int64_t id) const = 0;
+};
+
+} // namespace dann
+
+#endif // DANN_VECTOR_SOURCE_H
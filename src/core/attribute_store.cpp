@@ -0,0 +1,271 @@
+//
+// Columnar attribute store and its filter bitmaps.
+//
+
+#include "dann/attribute_store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "dann/logger.h"
+
+namespace dann {
+
+namespace {
+constexpr char kAttributesMagic[8] = {'D', 'A', 'N', 'N', 'A', 'T', 'T', 'R'};
+constexpr uint32_t kAttributesFormatVersion = 1;
+
+template <typename T>
+void write_pod(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool read_pod(std::istream& in, T* value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(value), sizeof(T)));
+}
+
+void write_string(std::ostream& out, const std::string& s) {
+    write_pod(out, static_cast<uint32_t>(s.size()));
+    out.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
+
+bool read_string(std::istream& in, std::string* s) {
+    uint32_t size = 0;
+    if (!read_pod(in, &size)) {
+        return false;
+    }
+    s->resize(size);
+    return static_cast<bool>(in.read(s->data(), size));
+}
+
+const std::shared_ptr<const RoaringBitmap>& empty_set() {
+    static const auto empty = std::make_shared<const RoaringBitmap>();
+    return empty;
+}
+}
+
+void AttributeStore::erase_row(const std::string& key, Column& column, int64_t id) {
+    auto row = column.rows.find(id);
+    if (row == column.rows.end()) {
+        return;
+    }
+    const uint32_t code = row->second;
+    column.ids[code].remove(id);
+    column.rows.erase(row);
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    snapshots_[key].erase(code);
+}
+
+void AttributeStore::set(int64_t id, const Attributes& attributes) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (keys_per_id_.count(id) != 0) {
+        for (auto& [key, column]: columns_) {
+            erase_row(key, column, id);
+        }
+        keys_per_id_.erase(id);
+    }
+    if (attributes.empty()) {
+        return;
+    }
+    for (const auto& [key, value]: attributes) {
+        Column& column = columns_[key];
+        auto [it, inserted] = column.codes.emplace(value, static_cast<uint32_t>(column.values.size()));
+        if (inserted) {
+            column.values.push_back(value);
+            column.ids.emplace_back();
+        }
+        const uint32_t code = it->second;
+        column.ids[code].add(id);
+        column.rows[id] = code;
+        std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+        snapshots_[key].erase(code);
+    }
+    keys_per_id_[id] = static_cast<uint32_t>(attributes.size());
+}
+
+bool AttributeStore::remove(int64_t id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (keys_per_id_.erase(id) == 0) {
+        return false;
+    }
+    for (auto& [key, column]: columns_) {
+        erase_row(key, column, id);
+    }
+    return true;
+}
+
+void AttributeStore::clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    columns_.clear();
+    keys_per_id_.clear();
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    snapshots_.clear();
+}
+
+std::shared_ptr<const RoaringBitmap> AttributeStore::snapshot(const std::string& key, uint32_t code,
+                                                              const RoaringBitmap& ids) const {
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex_);
+        auto& cached = snapshots_[key][code];
+        if (cached) {
+            return cached;
+        }
+    }
+    // copied outside the lock; racing readers may both copy, one copy is kept
+    auto copy = std::make_shared<const RoaringBitmap>(ids);
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    auto& cached = snapshots_[key][code];
+    if (!cached) {
+        cached = std::move(copy);
+    }
+    return cached;
+}
+
+std::shared_ptr<const RoaringBitmap> AttributeStore::match(const AttributeFilter& filter) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<std::shared_ptr<const RoaringBitmap>> sets;
+    sets.reserve(filter.size());
+    for (const auto& [key, value]: filter) {
+        auto column = columns_.find(key);
+        if (column == columns_.end()) {
+            return empty_set();
+        }
+        auto code = column->second.codes.find(value);
+        if (code == column->second.codes.end() || column->second.ids[code->second].empty()) {
+            return empty_set();
+        }
+        sets.push_back(snapshot(key, code->second, column->second.ids[code->second]));
+    }
+    if (sets.empty()) {
+        return empty_set();
+    }
+    // smallest set first, so the intersection only ever shrinks it
+    std::sort(sets.begin(), sets.end(), [](const auto& a, const auto& b) {
+        return a->cardinality() < b->cardinality();
+    });
+    if (sets.size() == 1) {
+        return sets[0];
+    }
+    auto result = std::make_shared<RoaringBitmap>(*sets[0]);
+    for (size_t i = 1; i < sets.size() && !result->empty(); ++i) {
+        result->intersect(*sets[i]);
+    }
+    return result;
+}
+
+size_t AttributeStore::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return keys_per_id_.size();
+}
+
+size_t AttributeStore::memory_bytes() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    size_t bytes = keys_per_id_.size() * (sizeof(int64_t) + sizeof(uint32_t));
+    for (const auto& [key, column]: columns_) {
+        bytes += column.rows.size() * (sizeof(int64_t) + sizeof(uint32_t));
+        for (size_t code = 0; code < column.values.size(); ++code) {
+            bytes += 2 * column.values[code].size() + column.ids[code].memory_bytes();
+        }
+    }
+    return bytes;
+}
+
+bool AttributeStore::save(const std::string& path) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            LOG_ERRORF("failed to open %s", tmp_path.c_str());
+            return false;
+        }
+        out.write(kAttributesMagic, sizeof(kAttributesMagic));
+        write_pod(out, kAttributesFormatVersion);
+        write_pod(out, static_cast<uint32_t>(columns_.size()));
+        for (const auto& [key, column]: columns_) {
+            write_string(out, key);
+            write_pod(out, static_cast<uint32_t>(column.values.size()));
+            for (const auto& value: column.values) {
+                write_string(out, value);
+            }
+            write_pod(out, static_cast<uint64_t>(column.rows.size()));
+            for (const auto& [id, code]: column.rows) {
+                write_pod(out, id);
+                write_pod(out, code);
+            }
+        }
+        if (!out) {
+            LOG_ERRORF("failed to write %s", tmp_path.c_str());
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        LOG_ERRORF("failed to move %s into place: %s", tmp_path.c_str(), ec.message().c_str());
+        return false;
+    }
+    return true;
+}
+
+bool AttributeStore::load(const std::string& path) {
+    std::unordered_map<std::string, Column> columns;
+    std::unordered_map<int64_t, uint32_t> keys_per_id;
+    std::ifstream in(path, std::ios::binary);
+    if (in) {
+        char magic[sizeof(kAttributesMagic)];
+        uint32_t version = 0;
+        uint32_t ncolumns = 0;
+        if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), kAttributesMagic) ||
+            !read_pod(in, &version) || version != kAttributesFormatVersion || !read_pod(in, &ncolumns)) {
+            LOG_ERRORF("%s is not an attribute file of version %u", path.c_str(), kAttributesFormatVersion);
+            return false;
+        }
+        for (uint32_t c = 0; c < ncolumns; ++c) {
+            std::string key;
+            uint32_t nvalues = 0;
+            if (!read_string(in, &key) || !read_pod(in, &nvalues)) {
+                LOG_ERRORF("truncated attribute file %s", path.c_str());
+                return false;
+            }
+            Column& column = columns[key];
+            column.values.resize(nvalues);
+            column.ids.resize(nvalues);
+            for (uint32_t code = 0; code < nvalues; ++code) {
+                if (!read_string(in, &column.values[code])) {
+                    LOG_ERRORF("truncated attribute file %s", path.c_str());
+                    return false;
+                }
+                column.codes.emplace(column.values[code], code);
+            }
+            uint64_t nrows = 0;
+            if (!read_pod(in, &nrows)) {
+                LOG_ERRORF("truncated attribute file %s", path.c_str());
+                return false;
+            }
+            column.rows.reserve(nrows);
+            for (uint64_t r = 0; r < nrows; ++r) {
+                int64_t id = 0;
+                uint32_t code = 0;
+                if (!read_pod(in, &id) || !read_pod(in, &code) || code >= nvalues) {
+                    LOG_ERRORF("corrupt attribute file %s", path.c_str());
+                    return false;
+                }
+                column.rows[id] = code;
+                column.ids[code].add(id);
+                ++keys_per_id[id];
+            }
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    columns_ = std::move(columns);
+    keys_per_id_ = std::move(keys_per_id);
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    snapshots_.clear();
+    return true;
+}
+
+} // namespace dann
@@ -3,8 +3,12 @@
 //
 
 #include "dann/clustering.h"
+#include "dann/compute_executor.h"
+#include "dann/distance_kernels.h"
+#include "dann/gpu_knn.h"
 #include "dann/utils.h"
 #include "dann/logger.h"
+#include "dann/trace.h"
 
 #include <algorithm>
 #include <cmath>
@@ -14,7 +18,7 @@
 #include <memory>
 #include <cassert>
 #include <chrono>
-#include <faiss/utils/distances.h>
+#include <queue>
 
 namespace dann {
 
@@ -23,16 +27,21 @@ namespace {
 #define EPS (1 / 1024.)
 
 size_t split_clusters(std::vector<float>& centroids, std::vector<faiss::idx_t>& hassign, int k, int d) {
-    // 选取最大cluster / 2
+    // 选取最大cluster / 2, via a max-heap on (size, -id) so ties go to the lowest id;
+    // entries whose size changed since they were pushed are skipped when popped
+    using Entry = std::pair<faiss::idx_t, int>;
+    std::priority_queue<Entry> largest;
+    for (int j = 0; j < k; j++) {
+        largest.emplace(hassign[j], -j);
+    }
     size_t nsplit = 0;
     for (int i = 0; i < k; i++) {
         if (hassign[i] == 0) {
-            int cj = -1;
-            for (int j = 0; j < k; j++) {
-                if (cj == -1 || hassign[j] > hassign[cj]) {
-                    cj = j;
-                }
+            while (largest.top().first != hassign[-largest.top().second]) {
+                largest.pop();
             }
+            const int cj = -largest.top().second;
+            largest.pop();
             assert(cj >= 0);
             std::copy(centroids.begin() + cj * d, centroids.begin() + cj * d + d, centroids.begin() + i * d);
             /* small symmetric pertubation */
@@ -48,11 +57,258 @@ size_t split_clusters(std::vector<float>& centroids, std::vector<faiss::idx_t>&
 
             hassign[i] = hassign[cj] / 2;
             hassign[cj] -= hassign[i];
+            largest.emplace(hassign[cj], -cj);
+            largest.emplace(hassign[i], -i);
             nsplit++;
         }
     }
     return nsplit;
 }
+
+// rows per chunk when a loop over n rows is spread over the compute executor
+size_t grain_for(size_t n) {
+    return std::max<size_t>(1024, n / (4 * get_compute_executor().size() + 1));
+}
+
+// runs body(c0, c1) once per contiguous centroid range, one range per worker
+template <typename F>
+void for_each_centroid_range(int k, F&& body) {
+    ComputeExecutor& executor = get_compute_executor();
+    const size_t ranges = std::max<size_t>(1, std::min<size_t>(k, executor.size()));
+    executor.parallel_for(0, ranges, 1, [&](size_t lo, size_t hi) {
+        for (size_t r = lo; r < hi; r++) {
+            body(static_cast<int>(static_cast<int64_t>(k) * r / ranges),
+                 static_cast<int>(static_cast<int64_t>(k) * (r + 1) / ranges));
+        }
+    });
+}
+
+// the points of each centroid, in row order: order[offsets[c], offsets[c + 1]) are
+// the rows assigned to c. One counting-sort pass, so the per-range tasks below
+// visit each point once in total instead of scanning all n each
+struct CentroidBuckets {
+    std::vector<size_t> offsets;
+    std::vector<size_t> order;
+
+    CentroidBuckets(const faiss::idx_t* assign, size_t n, int k): offsets(static_cast<size_t>(k) + 1, 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (assign[i] >= 0 && assign[i] < k) {
+                offsets[assign[i] + 1]++;
+            }
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        order.resize(offsets.back());
+        std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < n; i++) {
+            if (assign[i] >= 0 && assign[i] < k) {
+                order[next[assign[i]]++] = i;
+            }
+        }
+    }
+};
+
+// each task owns a contiguous range of centroids and sums only the points
+// assigned to it, so the partial sums need no reduction and scratch stays O(k * d)
+void compute_centroids(const float* x, size_t n, const faiss::idx_t* assign, int k, int d, float* centroids,
+                       faiss::idx_t* counts) {
+    const CentroidBuckets buckets(assign, n, k);
+    for_each_centroid_range(k, [&](int c0, int c1) {
+        for (int c = c0; c < c1; c++) {
+            float* dst = centroids + static_cast<size_t>(c) * d;
+            std::fill(dst, dst + d, 0.0f);
+            counts[c] = static_cast<faiss::idx_t>(buckets.offsets[c + 1] - buckets.offsets[c]);
+            if (counts[c] == 0) {
+                continue;
+            }
+            for (size_t p = buckets.offsets[c]; p < buckets.offsets[c + 1]; p++) {
+                const float* src = x + buckets.order[p] * d;
+                for (int j = 0; j < d; j++) {
+                    dst[j] += src[j];
+                }
+            }
+            const float inv = 1.0f / static_cast<float>(counts[c]);
+            for (int j = 0; j < d; j++) {
+                dst[j] *= inv;
+            }
+        }
+    });
+}
+
+// mini-batch step: every centroid moves toward its batch points with rate
+// 1 / (points it has seen so far), counts accumulating across iterations
+void update_centroids_minibatch(const float* x, size_t n, const faiss::idx_t* assign, int k, int d,
+                                float* centroids, faiss::idx_t* counts) {
+    const CentroidBuckets buckets(assign, n, k);
+    for_each_centroid_range(k, [&](int c0, int c1) {
+        for (int c = c0; c < c1; c++) {
+            float* dst = centroids + static_cast<size_t>(c) * d;
+            for (size_t p = buckets.offsets[c]; p < buckets.offsets[c + 1]; p++) {
+                counts[c] += 1;
+                const float eta = 1.0f / static_cast<float>(counts[c]);
+                const float* src = x + buckets.order[p] * d;
+                for (int j = 0; j < d; j++) {
+                    dst[j] += eta * (src[j] - dst[j]);
+                }
+            }
+        }
+    });
+}
+
+// uniform in [0, 1) from (seed, stream, i) alone, so parallel sampling draws the
+// same points whatever the thread count (splitmix64 finalizer)
+double hashed_uniform(uint64_t seed, uint64_t stream, uint64_t i) {
+    uint64_t z = seed * 0x9E3779B97F4A7C15ull ^ (stream + 1) * 0xBF58476D1CE4E5B9ull ^ (i + 1) * 0x94D049BB133111EBull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return static_cast<double>(z >> 11) * 0x1.0p-53;
+}
+
+void gather_rows(const float* x, int d, const std::vector<int64_t>& rows, std::vector<float>* out) {
+    out->resize(rows.size() * d);
+    for (size_t i = 0; i < rows.size(); i++) {
+        std::copy(x + rows[i] * d, x + rows[i] * d + d, out->begin() + i * d);
+    }
+}
+
+// min_dis[i] = min(min_dis[i], squared distance from x_i to its nearest center);
+// nearest receives that center's index when it improved
+void update_min_distances(const float* x, size_t n, int d, const std::vector<float>& centers, float* min_dis,
+                          faiss::idx_t* nearest, faiss::idx_t base, const GpuOptions& gpu) {
+    const size_t ncenters = centers.size() / d;
+    std::vector<float> dis(n);
+    std::vector<faiss::idx_t> label(n);
+    knn_centroids(x, n, centers.data(), ncenters, d, DistanceType::L2, 1, dis.data(), label.data(), gpu);
+    get_compute_executor().parallel_for(0, n, grain_for(n), [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++) {
+            if (dis[i] < min_dis[i]) {
+                min_dis[i] = dis[i];
+                if (nearest) {
+                    nearest[i] = base + label[i];
+                }
+            }
+        }
+    });
+}
+
+// k-means|| (Bahmani et al., 2012): a few rounds each keep every point with
+// probability oversampling * k * D(x)^2 / phi, giving O(rounds * oversampling * k)
+// candidates in as many passes over x; the candidates, weighted by how many points
+// they attract, are reduced to k seeds with k-means++. Seeding is by squared L2,
+// which ranks like cosine on the unit vectors the COSINE metric trains on
+void kmeans_parallel_init(const float* x, size_t n, int d, int k, const ClusteringParameters& cp, uint64_t seed,
+                          float* centroids) {
+    std::mt19937_64 rng(seed);
+    std::vector<int64_t> candidates{static_cast<int64_t>(std::uniform_int_distribution<size_t>(0, n - 1)(rng))};
+    std::vector<float> min_dis(n, std::numeric_limits<float>::max());
+    std::vector<faiss::idx_t> nearest(n, 0);
+    std::vector<float> batch;
+    gather_rows(x, d, candidates, &batch);
+    update_min_distances(x, n, d, batch, min_dis.data(), nearest.data(), 0, cp.gpu);
+
+    ComputeExecutor& executor = get_compute_executor();
+    const size_t grain = grain_for(n);
+    const size_t nchunks = (n + grain - 1) / grain;
+    const double expected = static_cast<double>(cp.init_oversampling) * k;
+    std::vector<double> partial(nchunks);
+    std::vector<std::vector<int64_t>> chunk_picks(nchunks);
+    for (int round = 0; round < cp.init_rounds; round++) {
+        // per-chunk partial sums, added in chunk order so phi does not depend on scheduling
+        executor.parallel_for(0, n, grain, [&](size_t lo, size_t hi) {
+            double sum = 0.0;
+            for (size_t i = lo; i < hi; i++) {
+                sum += min_dis[i];
+            }
+            partial[lo / grain] = sum;
+        });
+        double phi = 0.0;
+        for (double sum: partial) {
+            phi += sum;
+        }
+        if (phi <= 0.0) {
+            break;
+        }
+        executor.parallel_for(0, n, grain, [&](size_t lo, size_t hi) {
+            auto& local = chunk_picks[lo / grain];
+            local.clear();
+            for (size_t i = lo; i < hi; i++) {
+                if (hashed_uniform(seed, round, i) < expected * min_dis[i] / phi) {
+                    local.push_back(static_cast<int64_t>(i));
+                }
+            }
+        });
+        // chunks are in row order, so picked comes out sorted
+        std::vector<int64_t> picked;
+        for (const auto& local: chunk_picks) {
+            picked.insert(picked.end(), local.begin(), local.end());
+        }
+        if (picked.empty()) {
+            continue;
+        }
+        gather_rows(x, d, picked, &batch);
+        update_min_distances(x, n, d, batch, min_dis.data(), nearest.data(),
+                             static_cast<faiss::idx_t>(candidates.size()), cp.gpu);
+        candidates.insert(candidates.end(), picked.begin(), picked.end());
+    }
+
+    if (candidates.size() <= static_cast<size_t>(k)) {
+        // too few candidates: keep them all and top up with distinct random points
+        std::vector<char> used(n, 0);
+        for (auto row: candidates) {
+            used[row] = 1;
+        }
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
+        while (candidates.size() < static_cast<size_t>(k)) {
+            const size_t row = pick(rng);
+            if (!used[row] || n < static_cast<size_t>(k)) {
+                used[row] = 1;
+                candidates.push_back(static_cast<int64_t>(row));
+            }
+        }
+        for (int c = 0; c < k; c++) {
+            std::copy(x + candidates[c] * d, x + candidates[c] * d + d, centroids + static_cast<size_t>(c) * d);
+        }
+        return;
+    }
+
+    std::vector<double> weight(candidates.size(), 0.0);
+    for (size_t i = 0; i < n; i++) {
+        weight[nearest[i]] += 1.0;
+    }
+    std::vector<float> points;
+    gather_rows(x, d, candidates, &points);
+    const size_t m = candidates.size();
+    std::vector<float> cand_dis(m, std::numeric_limits<float>::max());
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    size_t chosen = std::discrete_distribution<size_t>(weight.begin(), weight.end())(rng);
+    for (int c = 0; c < k; c++) {
+        const float* center = points.data() + chosen * d;
+        std::copy(center, center + d, centroids + static_cast<size_t>(c) * d);
+        executor.parallel_for(0, m, grain_for(m), [&](size_t lo, size_t hi) {
+            for (size_t j = lo; j < hi; j++) {
+                cand_dis[j] = std::min(cand_dis[j], L2_distance(points.data() + j * d, center, d));
+            }
+        });
+        double total = 0.0;
+        for (size_t j = 0; j < m; j++) {
+            total += weight[j] * cand_dis[j];
+        }
+        if (total <= 0.0) {
+            // every candidate coincides with a seed already; reuse them in order
+            chosen = (chosen + 1) % m;
+            continue;
+        }
+        double r = unit(rng) * total;
+        chosen = m - 1;
+        for (size_t j = 0; j < m; j++) {
+            r -= weight[j] * cand_dis[j];
+            if (r < 0.0) {
+                chosen = j;
+                break;
+            }
+        }
+    }
+}
 }
 
 Clustering::Clustering(int d, int k): d(d), k(k) {}
@@ -65,65 +321,117 @@ void Clustering::train(const std::vector<float>& vectors, const std::vector<fais
 
 void Clustering::train(const std::vector<float>& vectors, size_t n) {
     assert(vectors.size() / d == n);
-    std::vector<faiss::idx_t> local_indices(n);
-    std::iota(local_indices.begin(), local_indices.end(), static_cast<faiss::idx_t>(0));
+    train(vectors.data(), n);
+}
 
-    for (int redo = 0; redo < nredo; redo++) {
+void Clustering::train(const float* x, size_t n) {
+    // the per-centroid sample bounds: more than max_points_per_centroids * k points
+    // add cost without moving the centroids, fewer than min_points_per_centroids * k
+    // leave them noisy
+    const size_t max_points = static_cast<size_t>(std::max(max_points_per_centroids, 0)) * k;
+    if (max_points > 0 && n > max_points) {
+        LOG_INFOF("Clustering: sampling %zu of %zu training points for %d centroids", max_points, n, k);
+        std::vector<int64_t> rows(n);
+        std::iota(rows.begin(), rows.end(), 0);
         std::mt19937_64 rng(static_cast<uint64_t>(seed));
-        std::shuffle(local_indices.begin(), local_indices.end(), rng);
+        std::shuffle(rows.begin(), rows.end(), rng);
+        rows.resize(max_points);
+        std::sort(rows.begin(), rows.end());
+        std::vector<float> sample;
+        gather_rows(x, d, rows, &sample);
+        train(sample.data(), max_points);
+        return;
+    }
+    if (n < static_cast<size_t>(std::max(min_points_per_centroids, 0)) * k) {
+        LOG_INFOF("Clustering: %zu training points for %d centroids, below the %d per centroid advised", n, k,
+                  min_points_per_centroids);
+    }
+
+    DANN_TRACE_SPAN("build", "clustering.train");
+    std::vector<faiss::idx_t> local_indices;
+    if (init == ClusteringInit::RANDOM) {
+        local_indices.resize(n);
+        std::iota(local_indices.begin(), local_indices.end(), static_cast<faiss::idx_t>(0));
+    }
+
+    const bool minibatch = batch_size > 0 && static_cast<size_t>(batch_size) < n;
+    const size_t nbatch = minibatch ? static_cast<size_t>(batch_size) : n;
+    std::vector<float> batch(minibatch ? nbatch * d : 0);
+
+    // the restart with the best objective wins: lowest total distance for L2,
+    // highest total similarity for inner-product metrics
+    std::vector<float> best_centroids;
+    double best_objective = 0.0;
+    // mini-batch runs end on different random batches, so their restarts are
+    // compared on one fixed sample instead of on each run's last batch
+    std::vector<float> eval_sample;
+    if (minibatch && nredo > 1) {
+        std::mt19937_64 eval_rng(static_cast<uint64_t>(seed) ^ 0x5DEECE66Dull);
+        std::vector<int64_t> rows(nbatch);
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
+        for (auto& row: rows) {
+            row = static_cast<int64_t>(pick(eval_rng));
+        }
+        gather_rows(x, d, rows, &eval_sample);
+    }
+
+    for (int redo = 0; redo < nredo; redo++) {
+        // every restart draws from its own seed, otherwise nredo repeats one run
+        const uint64_t redo_seed = static_cast<uint64_t>(seed) + static_cast<uint64_t>(redo);
+        std::mt19937_64 rng(redo_seed);
         centroids.resize(d * k);
-        // 1. 随机设置k个质心
-        for (int i = 0; i < k; i++) {
-            std::copy(vectors.begin() +  local_indices[i] * d, vectors.begin() + d * local_indices[i] + d,
-                centroids.begin() + i * d);
+        TraceSpan init_span("build", "clustering.init");
+        if (init == ClusteringInit::KMEANS_PARALLEL) {
+            kmeans_parallel_init(x, n, d, k, *this, redo_seed, centroids.data());
+        } else {
+            // 1. 随机设置k个质心
+            std::shuffle(local_indices.begin(), local_indices.end(), rng);
+            for (int i = 0; i < k; i++) {
+                std::copy(x + local_indices[i] * d, x + local_indices[i] * d + d, centroids.begin() + i * d);
+            }
         }
+        init_span.end();
 
-        std::unique_ptr<float[]> dis(new float[n]);
-        std::unique_ptr<faiss::idx_t[]> assign(new faiss::idx_t[n]);
+        std::unique_ptr<float[]> dis(new float[nbatch]);
+        std::unique_ptr<faiss::idx_t[]> assign(new faiss::idx_t[nbatch]);
         std::vector<float> prev_centroids(d * k);
-        std::vector<faiss::idx_t> counts(k);
+        std::vector<faiss::idx_t> counts(k, 0);
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
         float convergence_threshold = 1e-6f;
+        double objective = 0.0;
         for (int t = 0; t < niter; t++) {
+            DANN_TRACE_SPAN("build", "clustering.iteration");
             auto iter_start = std::chrono::high_resolution_clock::now();
             
             prev_centroids = centroids;
-            // 2.1 计算每个向量到最近的质心
-/*
-            for (int i = 0; i < n; i++) {
-                float min_dis = std::numeric_limits<float>::max();
-                int centroid_j = 0;
-                for (int j = 0; j < k; j++) {
-                    float dist = L2_distance(&vectors[i * d], &centroids[j * d], d);
-                    if (dist < min_dis) {
-                        centroid_j = j;
-                        min_dis = dist;
-                    }
+            const float* points = x;
+            if (minibatch) {
+                for (size_t i = 0; i < nbatch; i++) {
+                    const size_t row = pick(rng);
+                    std::copy(x + row * d, x + row * d + d, batch.begin() + i * d);
                 }
-                dis[i] = min_dis;
-                assign[i] = centroid_j;
+                points = batch.data();
+            }
+            // 2.1 计算每个向量到最近的质心
+            TraceSpan assign_span("build", "clustering.assign");
+            knn_centroids(points, nbatch, centroids.data(), k, d, metric, 1, &dis[0], &assign[0], gpu);
+            assign_span.end();
+            objective = 0.0;
+            for (size_t i = 0; i < nbatch; i++) {
+                objective += dis[i];
             }
-*/
-			faiss::knn_L2sqr(vectors.data(), centroids.data(), d, n, k, 1, &dis[0], &assign[0]);
 
-            std::fill(centroids.begin(), centroids.end(), 0);
             // 2.2 重新计算质心
-            std::fill(counts.begin(), counts.end(), 0);
-            for (int i = 0; i < n; i++) {
-                counts[assign[i]] += 1;
-                for (int j = 0; j < d; j++) {
-                    centroids[d * assign[i] + j] += vectors[d * i + j];
-                }
-            }
-            for (int i = 0; i < k; i++) {
-                if (counts[i] == 0) {
-                    continue;
-                }
-                for (int j = 0; j < d; j++) {
-                    centroids[i * d + j] /= counts[i];
-                }
+            if (minibatch) {
+                update_centroids_minibatch(points, nbatch, &assign[0], k, d, centroids.data(), counts.data());
+            } else {
+                compute_centroids(points, nbatch, &assign[0], k, d, centroids.data(), counts.data());
             }
             // 2.3 split clusters
             int nsplit = split_clusters(centroids, counts, k, d);
+            if (metric == DistanceType::COSINE) {
+                normalize_vectors(centroids.data(), k, d);
+            }
             // 2.4 判断误差
             if (t > 0) {
                 float max_change = 0.0f;
@@ -136,7 +444,8 @@ void Clustering::train(const std::vector<float>& vectors, size_t n) {
                 auto iter_duration = std::chrono::duration_cast<std::chrono::milliseconds>(iter_end - iter_start);
                 LOG_INFOF("Clustering iteration %d: max_change=%.6f, duration=%ld ms, npslit=%d", t, max_change, iter_duration.count(), nsplit);
                 
-                if (max_change < convergence_threshold) {
+                // a mini-batch step always moves the centroids, so it runs all niter steps
+                if (!minibatch && max_change < convergence_threshold) {
                     break;
                 }
             } else {
@@ -145,7 +454,21 @@ void Clustering::train(const std::vector<float>& vectors, size_t n) {
                 LOG_INFOF("Clustering iteration %d: duration=%ld ms", t, iter_duration.count());
             }
         }
+
+        if (!eval_sample.empty()) {
+            knn_centroids(eval_sample.data(), nbatch, centroids.data(), k, d, metric, 1, &dis[0], &assign[0], gpu);
+            objective = 0.0;
+            for (size_t i = 0; i < nbatch; i++) {
+                objective += dis[i];
+            }
+        }
+        const bool better = metric == DistanceType::L2 ? objective < best_objective : objective > best_objective;
+        if (redo == 0 || better) {
+            best_objective = objective;
+            best_centroids.swap(centroids);
+        }
     }
+    centroids.swap(best_centroids);
 }
 
 }
@@ -0,0 +1,92 @@
+//
+// Two-level coarse quantizer: the IVF centroids are themselves clustered into
+// groups, and a query scans only the members of its nearest groups.
+//
+#include "dann/coarse_quantizer.h"
+
+#include "dann/clustering.h"
+#include "dann/logger.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <faiss/utils/distances.h>
+
+namespace dann {
+
+CoarseQuantizer::CoarseQuantizer(int d, DistanceType metric, const CoarseQuantizerParameters& params)
+    : dimension_(d), metric_(metric), params_(params), kernel_(distance_batch_kernel(metric, d)) {}
+
+bool CoarseQuantizer::train(const float* centroids, int64_t nlist) {
+    group_centroids_.clear();
+    if (nlist <= 0) {
+        return false;
+    }
+    const int64_t requested = params_.ngroups > 0 ? params_.ngroups
+                                                  : static_cast<int64_t>(std::sqrt(static_cast<double>(nlist)));
+    ngroups_ = static_cast<int>(std::clamp<int64_t>(requested, 1, nlist));
+    group_probe_ = params_.group_probe > 0 ? params_.group_probe : std::max(8, ngroups_ / 16);
+    group_probe_ = std::min(group_probe_, ngroups_);
+
+    const size_t d = static_cast<size_t>(dimension_);
+    std::vector<float> points(centroids, centroids + nlist * d);
+    ClusteringParameters cp;
+    cp.niter = 10;
+    cp.metric = metric_;
+    // sqrt(nlist) points per group by construction
+    cp.min_points_per_centroids = 1;
+    Clustering clustering(dimension_, ngroups_, cp);
+    clustering.train(points, static_cast<size_t>(nlist));
+
+    // every centroid belongs to exactly one group, its nearest
+    std::vector<float> distances(nlist);
+    std::vector<faiss::idx_t> labels(nlist);
+    if (metric_ == DistanceType::L2) {
+        faiss::knn_L2sqr(centroids, clustering.centroids.data(), d, nlist, ngroups_, 1, distances.data(),
+                         labels.data());
+    } else {
+        faiss::knn_inner_product(centroids, clustering.centroids.data(), d, nlist, ngroups_, 1, distances.data(),
+                                 labels.data());
+    }
+
+    member_offsets_.assign(ngroups_ + 1, 0);
+    for (int64_t i = 0; i < nlist; ++i) {
+        ++member_offsets_[std::max<faiss::idx_t>(labels[i], 0) + 1];
+    }
+    for (int g = 0; g < ngroups_; ++g) {
+        member_offsets_[g + 1] += member_offsets_[g];
+    }
+    std::vector<int64_t> cursor(member_offsets_.begin(), member_offsets_.end() - 1);
+    member_ids_.resize(nlist);
+    member_vectors_.resize(nlist * d);
+    for (int64_t i = 0; i < nlist; ++i) {
+        const int64_t pos = cursor[std::max<faiss::idx_t>(labels[i], 0)]++;
+        member_ids_[pos] = i;
+        std::copy(centroids + i * d, centroids + (i + 1) * d, member_vectors_.begin() + pos * d);
+    }
+    group_centroids_ = std::move(clustering.centroids);
+    LOG_INFOF("coarse quantizer: %ld centroids in %d groups, probing %d", nlist, ngroups_, group_probe_);
+    return true;
+}
+
+std::vector<DistanceWithIndex> CoarseQuantizer::search(const float* query, int k) const {
+    if (!is_trained() || k <= 0) {
+        return {};
+    }
+    const size_t d = static_cast<size_t>(dimension_);
+    TopKBuffer<DistanceWithIndex> groups(static_cast<size_t>(group_probe_));
+    distance_scan(kernel_, group_centroids_.data(), query, dimension_, static_cast<size_t>(ngroups_), groups,
+                  [](float dis, size_t g) { return DistanceWithIndex(dis, static_cast<int64_t>(g)); });
+
+    TopKBuffer<DistanceWithIndex> closest(static_cast<size_t>(k));
+    for (const auto& group: groups.entries()) {
+        const int64_t begin = member_offsets_[group.index];
+        const int64_t end = member_offsets_[group.index + 1];
+        const int64_t* ids = member_ids_.data() + begin;
+        distance_scan(kernel_, member_vectors_.data() + begin * d, query, dimension_, static_cast<size_t>(end - begin),
+                      closest, [ids](float dis, size_t row) { return DistanceWithIndex(dis, ids[row]); });
+    }
+    return closest.take();
+}
+
+}
@@ -0,0 +1,258 @@
+//
+// Work-stealing executor for CPU-bound work.
+//
+
+#include "dann/compute_executor.h"
+
+#include "dann/numa.h"
+
+#include <map>
+
+namespace dann {
+
+// Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for Weak
+// Memory Models"): the owner pushes and pops at the bottom without locks,
+// thieves take from the top with one CAS. Fixed capacity; a full deque makes
+// schedule fall back to the injection queue
+class WorkStealingDeque {
+public:
+    static constexpr int64_t kCapacity = 4096;
+
+    bool push(ComputeExecutor::Job* job) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        const int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t >= kCapacity) {
+            return false;
+        }
+        slots_[b & (kCapacity - 1)].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    ComputeExecutor::Job* pop() {
+        const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        ComputeExecutor::Job* job = slots_[b & (kCapacity - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // last element: race the thieves for it
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                job = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    ComputeExecutor::Job* steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        ComputeExecutor::Job* job = slots_[t & (kCapacity - 1)].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return job;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    std::unique_ptr<std::atomic<ComputeExecutor::Job*>[]> slots_{new std::atomic<ComputeExecutor::Job*>[kCapacity]};
+};
+
+namespace {
+thread_local const ComputeExecutor* tls_executor = nullptr;
+thread_local int tls_worker = -1;
+thread_local uint32_t tls_rng = 0x9E3779B9u;
+
+uint32_t next_random() {
+    // xorshift32, only used to spread steal attempts
+    tls_rng ^= tls_rng << 13;
+    tls_rng ^= tls_rng >> 17;
+    tls_rng ^= tls_rng << 5;
+    return tls_rng;
+}
+}
+
+ComputeExecutor::ComputeExecutor(size_t threads, int numa_node): numa_node_(numa_node) {
+    // CPU-bound: one worker per core, the caller of parallel_for helps as well
+    if (threads == 0 && numa_node >= 0) {
+        threads = numa_node_cpus(numa_node).size();
+    }
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+        if (threads == 0) {
+            threads = 4; // fallback
+        }
+    }
+    deques_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        deques_.push_back(std::make_unique<WorkStealingDeque>());
+    }
+    workers_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back([this, i] { worker_loop(static_cast<int>(i)); });
+    }
+}
+
+ComputeExecutor::~ComputeExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    sleep_cv_.notify_all();
+    for (auto& worker: workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+bool ComputeExecutor::in_worker() const {
+    return tls_executor == this && tls_worker >= 0;
+}
+
+void ComputeExecutor::schedule(Job* job) {
+    schedule(&job, 1);
+}
+
+void ComputeExecutor::schedule(Job* const* jobs, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    size_t pushed = 0;
+    if (in_worker()) {
+        WorkStealingDeque& own = *deques_[tls_worker];
+        while (pushed < n && own.push(jobs[pushed])) {
+            ++pushed;
+        }
+    }
+    if (pushed < n) {
+        std::lock_guard<std::mutex> lock(injected_mutex_);
+        injected_.insert(injected_.end(), jobs + pushed, jobs + n);
+        injected_size_.fetch_add(n - pushed, std::memory_order_release);
+    }
+    wake(n);
+}
+
+void ComputeExecutor::wake(size_t n) {
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_seq_cst) == 0) {
+        return;
+    }
+    {
+        // pairs with the predicate check of a worker about to sleep
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+    }
+    if (n == 1) {
+        sleep_cv_.notify_one();
+    } else {
+        sleep_cv_.notify_all();
+    }
+}
+
+ComputeExecutor::Job* ComputeExecutor::find_work(int self) {
+    if (self >= 0) {
+        if (Job* job = deques_[self]->pop()) {
+            return job;
+        }
+    }
+    if (injected_size_.load(std::memory_order_acquire) > 0) {
+        std::lock_guard<std::mutex> lock(injected_mutex_);
+        if (!injected_.empty()) {
+            Job* job = injected_.front();
+            injected_.pop_front();
+            injected_size_.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    const size_t n = deques_.size();
+    const size_t start = next_random() % n;
+    for (size_t i = 0; i < n; ++i) {
+        const size_t victim = (start + i) % n;
+        if (static_cast<int>(victim) == self) {
+            continue;
+        }
+        if (Job* job = deques_[victim]->steal()) {
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+bool ComputeExecutor::run_one() {
+    Job* job = find_work(in_worker() ? tls_worker : -1);
+    if (!job) {
+        return false;
+    }
+    job->run(job);
+    return true;
+}
+
+void ComputeExecutor::worker_loop(int index) {
+    if (numa_node_ >= 0) {
+        pin_thread_to_numa_node(numa_node_);
+    }
+    tls_executor = this;
+    tls_worker = index;
+    tls_rng = 0x9E3779B9u * static_cast<uint32_t>(index + 1);
+    while (true) {
+        if (run_one()) {
+            continue;
+        }
+        // a short spin catches the next fan-out without a futex round trip
+        bool found = false;
+        for (int spin = 0; spin < 64 && !found; ++spin) {
+            std::this_thread::yield();
+            found = run_one();
+        }
+        if (found) {
+            continue;
+        }
+        const uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+        if (run_one()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        sleepers_.fetch_add(1, std::memory_order_seq_cst);
+        sleep_cv_.wait(lock, [this, epoch] {
+            return stop_.load() || epoch_.load(std::memory_order_seq_cst) != epoch;
+        });
+        sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+        if (stop_) {
+            lock.unlock();
+            while (run_one()) {
+            }
+            return;
+        }
+    }
+}
+
+// Global compute executor (lazy initialization, one worker per core)
+ComputeExecutor& get_compute_executor(size_t threads) {
+    static ComputeExecutor executor(threads);
+    return executor;
+}
+
+ComputeExecutor& get_numa_executor(int node) {
+    static std::mutex mutex;
+    static std::map<int, std::unique_ptr<ComputeExecutor>> executors;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& executor = executors[node];
+    if (!executor) {
+        executor = std::make_unique<ComputeExecutor>(0, node);
+    }
+    return *executor;
+}
+
+}
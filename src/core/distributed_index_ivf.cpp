@@ -6,16 +6,59 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <filesystem>
+#include <map>
 #include <numeric>
+#include <queue>
 #include <random>
 
 #include "dann/distributed_index_ivf.h"
 
 #include "dann/logger.h"
 #include "dann/utils.h"
+#include "dann/compute_executor.h"
+#include "dann/epoch.h"
 #include "dann/io_thread_pool.h"
+#include "dann/metrics.h"
+#include "dann/trace.h"
 
 namespace dann {
+    namespace {
+        // rows per centroid assignment block in build_index
+        constexpr int64_t kAssignBlockRows = 65536;
+        // rows a list gains before its drift is judged, or its baseline is taken after a load
+        constexpr int64_t kDriftMinRows = 64;
+    }
+
+    struct DistributedIndexIVF::CentroidTable {
+        // nlist * d, indexed by centroid id
+        std::vector<float> centroids;
+        size_t nlist{0};
+        // ids a merge emptied: skipped by probes and assignment, by asking for that many more
+        std::vector<uint8_t> retired;
+        size_t nretired{0};
+        // copies on every NUMA node in NUMA mode
+        std::map<int, NumaVector<float>> replicas;
+        std::unique_ptr<CoarseQuantizer> coarse;
+        uint64_t version{0};
+
+        bool is_retired(int64_t centroid) const {
+            return nretired > 0 && centroid >= 0 && static_cast<size_t>(centroid) < retired.size() &&
+                   retired[centroid] != 0;
+        }
+
+        // the centroids as seen from the calling thread: its node's replica in NUMA mode
+        const float *local() const {
+            if (!replicas.empty()) {
+                auto it = replicas.find(current_numa_node());
+                if (it != replicas.end()) {
+                    return it->second.data();
+                }
+            }
+            return centroids.data();
+        }
+    };
+
     int64_t get_nlist(int64_t N) {
         int64_t nlist = N;
         if (N < 1000000) {
@@ -32,15 +75,33 @@ namespace dann {
 
     // 推荐的nprobe设置策略
     int determine_nprobe(int nlist, float recall_target) {
+        // a small nlist must still probe its nearest list
         if (recall_target >= 0.95) {
-            return std::min(nlist / 4, 256); // 高召回率
+            return std::max(1, std::min(nlist / 4, 256)); // 高召回率
         } else if (recall_target >= 0.90) {
-            return std::min(nlist / 8, 128); // 中等召回率
+            return std::max(1, std::min(nlist / 8, 128)); // 中等召回率
         } else {
-            return std::min(nlist / 16, 64); // 平衡性能
+            return std::max(1, std::min(nlist / 16, 64)); // 平衡性能
         }
     }
 
+    struct DistributedIndexIVF::ShardPlacement {
+        // owning shard of each centroid, indexed by centroid id
+        std::vector<int32_t> centroid_shard;
+        uint64_t version{0};
+        // probes per list since the last rebalance, counted while probe tracking is on
+        std::unique_ptr<std::atomic<uint64_t>[]> probes;
+        // the same counts without the rebalance resets, see probe_heat
+        std::unique_ptr<std::atomic<uint64_t>[]> heat;
+
+        void count_probe(int64_t centroid) const {
+            if (centroid >= 0 && static_cast<size_t>(centroid) < centroid_shard.size()) {
+                probes[centroid].fetch_add(1, std::memory_order_relaxed);
+                heat[centroid].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    };
+
     DistributedIndexIVF::DistributedIndexIVF(std::string name, int d, int shards,
                                              std::vector<std::string> nodes): name_(std::move(name)), dimension_(d),
                                                                               shard_counts_(shards),
@@ -50,7 +111,7 @@ namespace dann {
         // 将shards均分到nodes上
         int node_size = nodes_.size();
         for (int i = 0; i < shard_counts_; i++) {
-            shards_[i] = std::make_unique<IndexIVFShard>(d, i, nodes_[i % node_size]);
+            shards_[i] = std::make_unique<IndexIVFShard>(d, i, nodes_[i % node_size], storage_mode_);
         }
     }
 
@@ -59,13 +120,14 @@ namespace dann {
                                                                           shard_counts_(shards),
                                                                           nlist_(nlist),
                                                                           nprobe_(nprobe),
+                                                                          nprobe_pinned_(nprobe > 0),
                                                                           nodes_(std::move(nodes)),
                                                                           is_trained_(false) {
         assert(shard_counts_ >= nodes.size() && shard_counts_ > 0);
         // 将shards均分到nodes上
         int node_size = nodes_.size();
         for (int i = 0; i < shard_counts_; i++) {
-            shards_[i] = std::make_unique<IndexIVFShard>(d, i, nodes_[i % node_size]);
+            shards_[i] = std::make_unique<IndexIVFShard>(d, i, nodes_[i % node_size], storage_mode_);
         }
     }
 
@@ -78,226 +140,2523 @@ namespace dann {
     }
 
     bool DistributedIndexIVF::load_index(const std::string &index_path) {
-        return false;
-    };
+        stop_warm();
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        IvfIndexManifest manifest;
+        IvfRuntimeLayout layout;
+        if (!load_manifest(index_path, &manifest) || !load_index_structure(index_path, &manifest, &layout)) {
+            LOG_ERRORF("failed to load ivf index from %s", index_path.c_str());
+            return false;
+        }
+        if (manifest.dimension != dimension_) {
+            LOG_ERRORF("ivf index dimension %d does not match %d", manifest.dimension, dimension_);
+            return false;
+        }
 
+        AuxiliaryFileReader aux;
+        if (!aux.open((std::filesystem::path(index_path) / kAuxiliaryFileName).string(), dimension_)) {
+            LOG_ERRORF("failed to open auxiliary file in %s", index_path.c_str());
+            return false;
+        }
+        if (!attributes_.load((std::filesystem::path(index_path) / kAttributesFileName).string())) {
+            LOG_ERRORF("failed to load attributes from %s", index_path.c_str());
+            return false;
+        }
+        // lists keep the shard they were saved on; with another shard count they are
+        // re-homed to centroid % shard_count
+        const bool same_shards = manifest.shard_count == shard_counts_;
+        if (!same_shards) {
+            LOG_INFOF("ivf index written with %d shards, loading into %d", manifest.shard_count, shard_counts_);
+        }
+        std::vector<int32_t> centroid_shard(layout.partitions.size());
+        for (const auto &desc: layout.partitions) {
+            const bool kept = same_shards && desc.shard_id >= 0 && desc.shard_id < shard_counts_;
+            centroid_shard[desc.partition_id] = kept ? desc.shard_id : desc.partition_id % shard_counts_;
+        }
 
-    void DistributedIndexIVF::build_index(const std::vector<float> &vectors,
-                                          const std::vector<int64_t> &ids) {
-        assert(dimension_ != 0);
-        assert(vectors.size() / dimension_ == ids.size());
+        // the files hold raw vectors only; a quantized index is re-quantized on the next build
+        quantizer_.reset();
+        for (auto &[shard_id, shard]: shards_) {
+            shard->set_quantizer(nullptr, nullptr, 0);
+            shard->clear();
+        }
+        publish_placement(centroid_shard, false);
+        std::vector<uint64_t> heat;
+        if (load_probe_heat(index_path, &heat) && heat.size() == layout.partitions.size()) {
+            const ShardPlacement *placement = placement_.load(std::memory_order_acquire);
+            for (size_t c = 0; c < heat.size(); ++c) {
+                placement->heat[c].store(heat[c], std::memory_order_relaxed);
+            }
+        } else {
+            heat.assign(layout.partitions.size(), 0);
+        }
+        version_.fetch_add(1, std::memory_order_release);
+        std::vector<size_t> shard_rows(shard_counts_, 0);
+        for (const auto &desc: layout.partitions) {
+            shard_rows[centroid_shard[desc.partition_id]] += desc.length;
+        }
+        for (int shard_id = 0; shard_id < shard_counts_; ++shard_id) {
+            shards_[shard_id]->reserve(shard_rows[shard_id]);
+        }
 
-        const int64_t num_vectors = static_cast<int64_t>(ids.size());
-        if (nlist_ < 0) {
-            nlist_ = get_nlist(num_vectors);
+        if (storage_mode_ == PostingStorageMode::MMAP || warm_start_) {
+            // shards share one read-only mapping; nothing is read until a list is probed
+            const std::string aux_path = (std::filesystem::path(index_path) / kAuxiliaryFileName).string();
+            auto mapped = std::make_shared<MappedFile>();
+            bool attached = mapped->open(aux_path);
+            std::vector<std::vector<PartitionDescriptor>> shard_partitions(shard_counts_);
+            for (const auto &desc: layout.partitions) {
+                shard_partitions[centroid_shard[desc.partition_id]].push_back(desc);
+            }
+            for (int shard_id = 0; attached && shard_id < shard_counts_; ++shard_id) {
+                attached = shards_[shard_id]->attach_mapped_partitions(mapped, shard_partitions[shard_id]);
+                shards_[shard_id]->set_prefetch(mmap_prefetch_);
+            }
+            if (attached) {
+                std::vector<PartitionDescriptor> warm_order;
+                if (warm_start_) {
+                    for (const auto &desc: layout.partitions) {
+                        if (desc.length > 0 && !is_remote(centroid_shard[desc.partition_id])) {
+                            warm_order.push_back(desc);
+                        }
+                    }
+                    std::stable_sort(warm_order.begin(), warm_order.end(),
+                                     [&heat](const PartitionDescriptor &a, const PartitionDescriptor &b) {
+                                         return heat[a.partition_id] > heat[b.partition_id];
+                                     });
+                }
+                finish_load(manifest, std::move(layout));
+                if (warm_start_) {
+                    start_warm(aux_path, std::move(warm_order));
+                }
+                return true;
+            }
+            // shards stay in MMAP mode and hold the partitions in their heap overlay
+            LOG_INFOF("mmap of %s unavailable, reading partitions into memory", index_path.c_str());
+            for (auto &[shard_id, shard]: shards_) {
+                shard->clear();
+            }
         }
-        clustering_ = std::make_unique<Clustering>(dimension_, nlist_);
-        nprobe_ = determine_nprobe(nlist_, 0.90f);
-        LOG_INFOF("clustering->k=%d, nprobe=%d", clustering_->k, nprobe_);
 
-        if (num_vectors == 0) {
-            global_centroids_.clear();
-            global_centroid_ids_.clear();
-            is_trained_ = false;
-            return;
+        InvertedList posting;
+        for (const auto &desc: layout.partitions) {
+            // remote shards hold their partitions on their own node
+            if (desc.length == 0 || is_remote(centroid_shard[desc.partition_id])) {
+                continue;
+            }
+            if (!aux.read_partition(desc, &posting.vector_ids, &posting.vectors)) {
+                LOG_ERRORF("failed to read partition %d from %s", desc.partition_id, index_path.c_str());
+                return false;
+            }
+            shards_[centroid_shard[desc.partition_id]]->add_posting(desc.partition_id, posting);
         }
+        finish_load(manifest, std::move(layout));
+        return true;
+    }
 
-        // 1) Sampling + clustering training
-        const int64_t n_train = std::min(static_cast<int64_t>(clustering_->k) * 64, num_vectors);
-        std::vector<float> train_vectors = sample_training_vectors(vectors, n_train);
-        const int64_t actual_n_train = static_cast<int64_t>(train_vectors.size() / dimension_);
-        LOG_INFOF("clustering->k=%d, nprobe=%d, ntrain=%ld, actual_n_train=%ld", clustering_->k, nprobe_, n_train, actual_n_train);
+    void DistributedIndexIVF::finish_load(const IvfIndexManifest &manifest, IvfRuntimeLayout layout) {
+        nlist_ = manifest.nlist;
+        if (manifest.nprobe_default > 0) {
+            nprobe_ = manifest.nprobe_default;
+        }
+        ntotal_ = manifest.ntotal;
+        global_centroids_ = std::move(layout.centroids);
+        global_centroid_ids_.resize(manifest.nlist);
+        std::iota(global_centroid_ids_.begin(), global_centroid_ids_.end(), 0);
+        is_trained_ = manifest.trained;
+        set_metric(manifest.distance_type);
+        retired_lists_.assign(global_centroid_ids_.size(), 0);
+        // the training rows are gone: growth counts from here, the error baselines
+        // come from the first rows added
+        list_drift_.assign(global_centroid_ids_.size(), ListDrift{});
+        for (auto &[shard_id, shard]: shards_) {
+            for (const auto &[centroid, rows]: shard->list_rows()) {
+                if (centroid >= 0 && static_cast<size_t>(centroid) < list_drift_.size()) {
+                    list_drift_[centroid].trained_rows += static_cast<int64_t>(rows);
+                }
+            }
+        }
+        publish_centroids();
+        version_.fetch_add(1, std::memory_order_release);
+    }
 
-        clustering_->train(train_vectors, actual_n_train);
-        global_centroids_ = clustering_->centroids;
-        const int64_t num_centroids = static_cast<int64_t>(global_centroids_.size() / dimension_);
+    void DistributedIndexIVF::set_coarse_quantizer(const CoarseQuantizerParameters &params) {
+        coarse_params_ = params;
+        if (!global_centroid_ids_.empty()) {
+            publish_centroids();
+        }
+    }
 
-        global_centroid_ids_.resize(num_centroids);
-        std::iota(global_centroid_ids_.begin(), global_centroid_ids_.end(), 0);
+    void DistributedIndexIVF::publish_centroids() {
+        auto next = std::make_unique<CentroidTable>();
+        next->centroids = global_centroids_;
+        next->nlist = global_centroid_ids_.size();
+        next->retired = retired_lists_;
+        next->retired.resize(next->nlist, 0);
+        next->nretired = static_cast<size_t>(std::count(next->retired.begin(), next->retired.end(), 1));
+        if (numa_ && next->nlist > 0) {
+            for (int node: numa_nodes()) {
+                next->replicas.emplace(node, NumaVector<float>(next->centroids.begin(), next->centroids.end(),
+                                                               NumaAllocator<float>(node)));
+            }
+        }
+        if (coarse_params_.enabled && next->nlist > 0) {
+            next->coarse = std::make_unique<CoarseQuantizer>(dimension_, metric_, coarse_params_);
+            if (!next->coarse->train(next->centroids.data(), static_cast<int64_t>(next->nlist))) {
+                LOG_ERRORF("%s: coarse quantizer training failed, scanning all centroids", name_.c_str());
+                next->coarse.reset();
+            }
+        }
+        const CentroidTable *current = centroid_table_.load(std::memory_order_acquire);
+        next->version = current ? current->version + 1 : 1;
+        centroid_table_.store(next.release(), std::memory_order_seq_cst);
+        if (current) {
+            get_epoch_domain().retire(current);
+        }
+    }
+
+    void DistributedIndexIVF::set_nprobe(int nprobe) {
+        nprobe_ = std::max(1, nprobe);
+        nprobe_pinned_ = true;
+    }
 
-        // 2) First pass: count vectors per centroid to reserve exact capacity
-        std::vector<int64_t> centroid_counts(num_centroids, 0);
-        std::vector<int64_t> assignments(num_vectors, 0);
-        for (int64_t i = 0; i < num_vectors; ++i) {
-            const int64_t centroid = find_closest_optimized(
-                global_centroids_.data(),
-                vectors.data() + i * dimension_,
-                dimension_,
-                static_cast<int>(num_centroids));
-            assignments[i] = centroid;
-            ++centroid_counts[centroid];
+    int DistributedIndexIVF::effective_nprobe(const CentroidTable &table, const InternalSearchParameters &params,
+                                              double selectivity) const {
+        const int live = static_cast<int>(table.nlist - table.nretired);
+        int nprobe = params.nprobe > 0 ? params.nprobe : nprobe_;
+        if (selectivity > 0.0 && selectivity < 1.0) {
+            // the probed lists hold about nprobe / nlist of the vectors but only a
+            // selectivity share of those pass, so probe that much wider
+            const double widen = std::min(static_cast<double>(filter_widening_), 1.0 / selectivity);
+            nprobe = static_cast<int>(std::min(std::ceil(nprobe * widen), static_cast<double>(live)));
         }
+        return std::max(0, std::min(nprobe, live));
+    }
 
-        // 3) Build postings using pre-sized vectors to reduce reallocation/copies
-        std::vector<InvertedList> postings(num_centroids);
-        for (int64_t centroid = 0; centroid < num_centroids; ++centroid) {
-            const size_t c = static_cast<size_t>(centroid_counts[centroid]);
-            postings[centroid].vectors.resize(c * static_cast<size_t>(dimension_));
-            postings[centroid].vector_ids.resize(c);
+    double DistributedIndexIVF::filter_selectivity(const RoaringBitmap *filter) {
+        if (!filter) {
+            return 1.0;
+        }
+        const size_t total = size();
+        return total == 0 ? 1.0 : static_cast<double>(filter->cardinality()) / static_cast<double>(total);
+    }
+
+    std::shared_ptr<const RoaringBitmap> DistributedIndexIVF::resolve_filter(
+        const InternalSearchParameters &params) const {
+        if (params.filter.empty()) {
+            return nullptr;
         }
+        return attributes_.match(params.filter);
+    }
 
-        std::vector<int64_t> cursor(num_centroids, 0);
-        for (int64_t i = 0; i < num_vectors; ++i) {
-            const int64_t centroid = assignments[i];
-            const int64_t pos = cursor[centroid]++;
+    bool DistributedIndexIVF::set_attributes(const std::vector<int64_t> &ids,
+                                             const std::vector<Attributes> &attributes) {
+        if (ids.size() != attributes.size()) {
+            LOG_ERRORF("set_attributes got %zu attribute maps for %zu ids", attributes.size(), ids.size());
+            return false;
+        }
+        for (size_t i = 0; i < ids.size(); ++i) {
+            attributes_.set(ids[i], attributes[i]);
+        }
+        version_.fetch_add(1, std::memory_order_release);
+        return true;
+    }
 
-            float *dst = postings[centroid].vectors.data() + pos * dimension_;
-            const float *src = vectors.data() + i * dimension_;
-            std::copy(src, src + dimension_, dst);
-            postings[centroid].vector_ids[static_cast<size_t>(pos)] = ids[static_cast<size_t>(i)];
+    bool DistributedIndexIVF::shard_vectors(const InternalSearchParameters &params) const {
+        return params.include_vectors && !vector_source_;
+    }
+
+    int DistributedIndexIVF::candidate_depth(int k) const {
+        if (rerank_factor_ <= 1 || !quantizer_ || !vector_source_ || vector_source_->dimension() != dimension_) {
+            return k;
         }
+        return k * rerank_factor_;
+    }
 
-        // 4) Distribute postings to shards
-        for (int64_t centroid = 0; centroid < num_centroids; ++centroid) {
-            if (postings[centroid].vector_ids.empty()) {
+    void DistributedIndexIVF::rerank(const float *query, std::vector<InternalSearchResult> *results, int k) const {
+        DANN_TRACE_SPAN("search", "search.rerank");
+        // resolve every row first and score them in address order, so a mapped source
+        // is read front to back and a Parquet source block by block
+        std::vector<std::pair<const float *, size_t> > rows;
+        rows.reserve(results->size());
+        for (size_t i = 0; i < results->size(); ++i) {
+            if (const float *row = vector_source_->vector_data((*results)[i].id)) {
+                rows.emplace_back(row, i);
+            }
+        }
+        std::sort(rows.begin(), rows.end());
+        // scored as the shards score: the query is already normalized for COSINE,
+        // the source rows are as added and get normalized here
+        std::vector<char> rescored(results->size(), 0);
+        for (const auto &[row, i]: rows) {
+            float distance;
+            if (metric_ == DistanceType::L2) {
+                distance = L2_distance(row, query, dimension_);
+            } else if (metric_ == DistanceType::COSINE) {
+                const float norm = std::sqrt(inner_product(row, row, dimension_));
+                distance = 1.0f - (norm > 0.0f ? inner_product(row, query, dimension_) / norm : 0.0f);
+            } else {
+                distance = -inner_product(row, query, dimension_);
+            }
+            (*results)[i].distance = distance;
+            rescored[i] = 1;
+        }
+        // code distances do not compare with exact ones: rows the source lacks rank
+        // after every rescored row, among themselves by code distance
+        std::vector<std::pair<InternalSearchResult, bool> > ranked;
+        ranked.reserve(results->size());
+        for (size_t i = 0; i < results->size(); ++i) {
+            ranked.emplace_back(std::move((*results)[i]), rescored[i] != 0);
+        }
+        const size_t keep = std::min(ranked.size(), static_cast<size_t>(k));
+        std::partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end(),
+                          [](const auto &a, const auto &b) {
+                              if (a.second != b.second) {
+                                  return a.second;
+                              }
+                              return a.first.distance < b.first.distance ||
+                                     (a.first.distance == b.first.distance && a.first.id < b.first.id);
+                          });
+        results->clear();
+        for (size_t i = 0; i < keep; ++i) {
+            results->push_back(std::move(ranked[i].first));
+        }
+    }
+
+    void DistributedIndexIVF::fetch_vectors(std::vector<InternalSearchResult> *results) const {
+        const size_t d = static_cast<size_t>(vector_source_->dimension());
+        for (auto &result: *results) {
+            const float *row = vector_source_->vector_data(result.id);
+            if (row) {
+                result.vector.assign(row, row + d);
+            }
+        }
+    }
+
+    std::vector<DistanceWithIndex> DistributedIndexIVF::probe_centroids(const CentroidTable &table,
+                                                                        const float *query, int nprobe) const {
+        const int wanted = static_cast<int>(std::min(table.nlist, static_cast<size_t>(nprobe) + table.nretired));
+        std::vector<DistanceWithIndex> closest =
+            table.coarse ? table.coarse->search(query, wanted)
+                         : find_closest_k_with_distance(table.local(), query, dimension_,
+                                                        static_cast<int>(table.nlist), wanted, metric_);
+        if (table.nretired > 0) {
+            closest.erase(std::remove_if(closest.begin(), closest.end(),
+                                         [&table](const DistanceWithIndex &c) { return table.is_retired(c.index); }),
+                          closest.end());
+            closest.resize(std::min(closest.size(), static_cast<size_t>(nprobe)));
+        }
+        return closest;
+    }
+
+    void DistributedIndexIVF::nearest_centroids(const CentroidTable &table, const float *x, size_t n, int k,
+                                                float *distances, faiss::idx_t *labels, bool exact) const {
+        const int wanted = static_cast<int>(std::min(table.nlist, static_cast<size_t>(k) + table.nretired));
+        std::fill(labels, labels + n * k, -1);
+        if (wanted <= 0 || n == 0) {
+            return;
+        }
+        // with merged ids around, the wider lists are gathered aside and filtered down to k
+        std::vector<float> wide_distances(wanted == k ? 0 : n * wanted);
+        std::vector<faiss::idx_t> wide_labels(wide_distances.size(), -1);
+        float *dis = wanted == k ? distances : wide_distances.data();
+        faiss::idx_t *ids = wanted == k ? labels : wide_labels.data();
+        if (table.coarse && !exact) {
+            get_compute_executor().parallel_for(0, n, 16, [&](size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; ++i) {
+                    auto closest = table.coarse->search(x + i * dimension_, wanted);
+                    for (size_t p = 0; p < closest.size(); ++p) {
+                        dis[i * wanted + p] = closest[p].distance;
+                        ids[i * wanted + p] = closest[p].index;
+                    }
+                }
+            });
+        } else {
+            knn_centroids(x, n, table.local(), table.nlist, dimension_, metric_, wanted, dis, ids, gpu_);
+        }
+        if (wanted == k) {
+            return;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            int kept = 0;
+            for (int p = 0; p < wanted && kept < k; ++p) {
+                const faiss::idx_t label = ids[i * wanted + p];
+                if (label >= 0 && !table.is_retired(label)) {
+                    distances[i * k + kept] = dis[i * wanted + p];
+                    labels[i * k + kept] = label;
+                    ++kept;
+                }
+            }
+        }
+    }
+
+    void DistributedIndexIVF::set_numa(bool enabled) {
+        numa_ = enabled;
+        for (auto &[shard_id, shard]: shards_) {
+            shard->set_numa_node(enabled ? numa_node_of(shard_id) : -1);
+        }
+        if (!global_centroid_ids_.empty()) {
+            publish_centroids();
+        }
+    }
+
+    void DistributedIndexIVF::set_gpu(const GpuOptions &options) {
+        if (options.enabled && !gpu_available()) {
+            LOG_WARNF("%s: no gpu backend available, clustering and centroid assignment stay on the cpu",
+                      name_.c_str());
+        }
+        gpu_ = options;
+    }
+
+    int DistributedIndexIVF::numa_node_of(int shard_id) const {
+        // spread like the shards over the cluster nodes
+        const std::vector<int> &nodes = numa_nodes();
+        return nodes[static_cast<size_t>(shard_id) % nodes.size()];
+    }
+
+    void DistributedIndexIVF::run_shard_scans(const std::vector<int> &probe_shards,
+                                              const std::function<void(size_t)> &scan) {
+        if (!numa_) {
+            get_compute_executor().parallel_for(0, probe_shards.size(), 1, [&](size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; ++i) {
+                    scan(i);
+                }
+            });
+            return;
+        }
+        // each scan goes to the workers of its shard's node; the caller only waits
+        std::vector<std::future<void>> pending;
+        pending.reserve(probe_shards.size());
+        std::exception_ptr error;
+        for (size_t i = 0; i < probe_shards.size(); ++i) {
+            ComputeExecutor &executor = get_numa_executor(numa_node_of(probe_shards[i]));
+            if (!executor.in_worker()) {
+                pending.push_back(executor.submit([&scan, i] { scan(i); }));
                 continue;
             }
-            const int shard_id = static_cast<int>(centroid % shard_counts_);
-            shards_[shard_id]->add_posting(static_cast<int>(centroid), std::move(postings[centroid]));
+            // already on that node: waiting here could tie up the pool
+            try {
+                scan(i);
+            } catch (...) {
+                error = error ? error : std::current_exception();
+            }
+        }
+        // every scan must finish before scan goes out of scope, even after a failure
+        for (auto &f: pending) {
+            try {
+                f.get();
+            } catch (...) {
+                error = error ? error : std::current_exception();
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
         }
-        // TODO: 这里需要生成postings文件 作为shard数据
-        // 需要生成global_centroids的文件 作为main index
+    }
 
-        is_trained_ = true;
+    void DistributedIndexIVF::set_metric(DistanceType metric) {
+        metric_ = metric;
+        for (auto &[shard_id, shard]: shards_) {
+            shard->set_metric(metric);
+        }
     }
 
-    bool DistributedIndexIVF::add_vectors(const std::vector<float> &vectors, const std::vector<int64_t> &ids) {
-        build_index(vectors, ids);
-        return true;
+    const float *DistributedIndexIVF::normalize_for_metric(const float *queries, size_t nq,
+                                                      std::vector<float> *normalized) const {
+        if (metric_ != DistanceType::COSINE) {
+            return queries;
+        }
+        normalized->assign(queries, queries + nq * dimension_);
+        normalize_vectors(normalized->data(), nq, dimension_);
+        return normalized->data();
     }
 
-    std::vector<InternalSearchResult> DistributedIndexIVF::search(const std::vector<float> &query, int k) {
-        int nprobe = nprobe_;
+    bool DistributedIndexIVF::save_index(const std::string &index_path) const {
+        if (quantizer_ && quantization_.refine_factor <= 0) {
+            LOG_ERRORF("cannot save %s: quantized postings were built without raw vectors", name_.c_str());
+            return false;
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(index_path, ec);
+        if (ec) {
+            LOG_ERRORF("failed to create %s: %s", index_path.c_str(), ec.message().c_str());
+            return false;
+        }
+
+        // the centroids searches see, consistent with the lists even while maintenance runs
+        auto guard = get_epoch_domain().pin();
+        const CentroidTable *table = centroid_table_.load(std::memory_order_seq_cst);
+        const int64_t num_centroids = table ? static_cast<int64_t>(table->nlist) : 0;
+        IvfIndexManifest manifest;
+        manifest.index_name = name_;
+        manifest.dimension = dimension_;
+        manifest.nlist = static_cast<int32_t>(num_centroids);
+        manifest.nprobe_default = nprobe_;
+        manifest.distance_type = metric_;
+        manifest.shard_count = shard_counts_;
+        manifest.trained = is_trained_;
 
-        if (nprobe > global_centroid_ids_.size()) {
-            nprobe = global_centroid_ids_.size();
+        // partition boundaries: prefix sum of the posting lengths in centroid order
+        IvfRuntimeLayout layout;
+        if (table) {
+            layout.centroids = table->centroids;
         }
-        // 从global_vectors中找到nprobe和query最近的向量
-        std::vector<DistanceWithIndex> closest_centroids =
-                find_closest_k_with_distance(&global_centroids_[0], &query[0], dimension_, global_centroid_ids_.size(),
-                                             nprobe);
+        layout.partitions.resize(num_centroids);
+        uint64_t total_rows = 0;
+        PostingView posting;
+        InvertedList scratch;
+        const ShardPlacement *placement = placement_.load(std::memory_order_seq_cst);
+        for (int64_t centroid = 0; centroid < num_centroids; ++centroid) {
+            auto &desc = layout.partitions[centroid];
+            desc.partition_id = static_cast<int32_t>(centroid);
+            desc.shard_id = static_cast<int32_t>(placement_shard(placement, centroid));
+            desc.aux_row_offset = total_rows;
+            desc.length = shards_.at(desc.shard_id)->read_posting(centroid, &scratch, &posting)
+                              ? static_cast<uint32_t>(posting.length)
+                              : 0;
+            total_rows += desc.length;
+        }
+        manifest.ntotal = static_cast<int64_t>(total_rows);
 
-        std::vector<InternalSearchResult> results;
-        std::unordered_map<int, std::vector<int64_t> > query_centroids_map;
-        for (const auto &centroid: closest_centroids) {
-            int shard_id = global_centroid_ids_[centroid.index] % shard_counts_;
-            query_centroids_map[shard_id].push_back(global_centroid_ids_[centroid.index]);
+        // written beside the old file and renamed over it, so a mapping of the
+        // previous auxiliary.idx (MMAP mode) stays valid while we read from it
+        const std::string aux_path = (std::filesystem::path(index_path) / kAuxiliaryFileName).string();
+        const std::string aux_tmp_path = aux_path + ".tmp";
+        AuxiliaryFileWriter aux;
+        if (!aux.open(aux_tmp_path, dimension_, total_rows)) {
+            return false;
+        }
+        for (const auto &desc: layout.partitions) {
+            if (desc.length == 0) {
+                continue;
+            }
+            shards_.at(desc.shard_id)->read_posting(desc.partition_id, &scratch, &posting);
+            if (!aux.write_partition(posting.vector_ids, posting.vectors, posting.length)) {
+                LOG_ERRORF("failed to write partition %d to %s", desc.partition_id, index_path.c_str());
+                return false;
+            }
+        }
+        if (!aux.close()) {
+            return false;
         }
+        std::filesystem::rename(aux_tmp_path, aux_path, ec);
+        if (ec) {
+            LOG_ERRORF("failed to move %s into place: %s", aux_tmp_path.c_str(), ec.message().c_str());
+            return false;
+        }
+        if (!attributes_.save((std::filesystem::path(index_path) / kAttributesFileName).string())) {
+            return false;
+        }
+        return save_probe_heat(index_path) && save_index_structure(index_path, manifest, layout) &&
+               save_manifest(index_path, manifest);
+    }
+
+    std::vector<uint64_t> DistributedIndexIVF::probe_heat() const {
+        auto guard = get_epoch_domain().pin();
+        const ShardPlacement *placement = placement_.load(std::memory_order_seq_cst);
+        std::vector<uint64_t> heat(placement ? placement->centroid_shard.size() : 0);
+        for (size_t c = 0; c < heat.size(); ++c) {
+            heat[c] = placement->heat[c].load(std::memory_order_relaxed);
+        }
+        return heat;
+    }
 
-        // Parallel search using IO thread pool
-        auto& thread_pool = get_io_thread_pool();
-        std::vector<std::future<std::vector<InternalSearchResult>>> futures;
-        futures.reserve(query_centroids_map.size());
+    bool DistributedIndexIVF::save_probe_heat(const std::string &index_path) const {
+        return dann::save_probe_heat(index_path, probe_heat());
+    }
 
-        for (const auto &[shard_id, centroids]: query_centroids_map) {
-            futures.push_back(thread_pool.enqueue([this, shard_id, &centroids, &query, k]() {
-                return shards_[shard_id]->search(centroids, query, k);
-            }));
+    void DistributedIndexIVF::set_mmap_prefetch(bool enabled) {
+        mmap_prefetch_ = enabled;
+        for (auto &[shard_id, shard]: shards_) {
+            shard->set_prefetch(enabled);
         }
+    }
+
+    void DistributedIndexIVF::set_warm_start(bool enabled, size_t parallel_reads) {
+        warm_start_ = enabled;
+        warm_parallel_reads_ = std::max<size_t>(parallel_reads, 1);
+    }
 
-        // Collect results from all futures
-        for (auto& fut : futures) {
-            auto shard_result = fut.get();
-            results.insert(results.end(), shard_result.begin(), shard_result.end());
+    void DistributedIndexIVF::start_warm(std::string aux_path, std::vector<PartitionDescriptor> order) {
+        uint64_t bytes = 0;
+        for (const auto &desc: order) {
+            bytes += aux_partition_bytes(desc, dimension_);
         }
+        std::lock_guard<std::mutex> lock(warm_mutex_);
+        warm_partitions_.store(order.size(), std::memory_order_relaxed);
+        warm_bytes_.store(bytes, std::memory_order_relaxed);
+        warm_loaded_partitions_.store(0, std::memory_order_relaxed);
+        warm_loaded_bytes_.store(0, std::memory_order_relaxed);
+        warm_stop_.store(false, std::memory_order_relaxed);
+        warm_running_.store(true, std::memory_order_release);
+        LOG_INFOF("%s: ready for routing, loading %zu partitions (%llu bytes) in the background", name_.c_str(),
+                  order.size(), static_cast<unsigned long long>(bytes));
+        warm_thread_ = std::thread([this, aux_path = std::move(aux_path), order = std::move(order)] {
+            const auto start = std::chrono::steady_clock::now();
+            PartitionPreloader preloader;
+            if (preloader.open(aux_path, dimension_)) {
+                // a few readers share one cursor over the heat order, so the hottest
+                // partitions are read first without flooding the IO pool's queue
+                std::atomic<size_t> next{0};
+                get_io_thread_pool().run_all(std::min(warm_parallel_reads_, order.size()), [&](size_t) {
+                    for (size_t i = next.fetch_add(1); i < order.size(); i = next.fetch_add(1)) {
+                        if (warm_stop_.load(std::memory_order_relaxed)) {
+                            break;
+                        }
+                        if (const uint64_t read = preloader.load(order[i])) {
+                            warm_loaded_bytes_.fetch_add(read, std::memory_order_relaxed);
+                            warm_loaded_partitions_.fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                });
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            LOG_INFOF("%s: loaded %zu of %zu partitions in %.1f s", name_.c_str(),
+                      warm_loaded_partitions_.load(std::memory_order_relaxed), order.size(), seconds);
+            warm_running_.store(false, std::memory_order_release);
+        });
+    }
 
-        std::sort(results.begin(), results.end());
-        results.resize(k);
-        return results;
+    WarmStartProgress DistributedIndexIVF::warm_progress() const {
+        WarmStartProgress progress;
+        progress.done = !warm_running_.load(std::memory_order_acquire);
+        progress.partitions = warm_partitions_.load(std::memory_order_relaxed);
+        progress.bytes = warm_bytes_.load(std::memory_order_relaxed);
+        progress.loaded_partitions = warm_loaded_partitions_.load(std::memory_order_relaxed);
+        progress.loaded_bytes = warm_loaded_bytes_.load(std::memory_order_relaxed);
+        return progress;
     }
 
-    std::vector<float> DistributedIndexIVF::sample_training_vectors(const std::vector<float> &vectors,
-                                                                    int64_t n_train) const {
-        const int64_t total_vectors = vectors.size() / dimension_;
-        const int64_t actual_n_train = std::min(n_train, total_vectors);
+    bool DistributedIndexIVF::wait_warm() {
+        std::lock_guard<std::mutex> lock(warm_mutex_);
+        if (warm_thread_.joinable()) {
+            warm_thread_.join();
+        }
+        return warm_loaded_partitions_.load(std::memory_order_relaxed) ==
+               warm_partitions_.load(std::memory_order_relaxed);
+    }
 
-        // Pre-allocate result vector
-        std::vector<float> train_vectors;
-        train_vectors.reserve(actual_n_train * dimension_);
+    void DistributedIndexIVF::stop_warm() {
+        warm_stop_.store(true, std::memory_order_relaxed);
+        wait_warm();
+    }
 
-        // Use reservoir sampling for better performance on large datasets
-        std::random_device rd;
-        std::mt19937 gen(rd());
+    void DistributedIndexIVF::set_parallel_scan(size_t min_chunk_rows) {
+        for (auto &[shard_id, shard]: shards_) {
+            shard->set_parallel_scan(min_chunk_rows);
+        }
+    }
 
-        if (actual_n_train >= total_vectors) {
-            // If we need all vectors, just copy them
-            train_vectors = vectors;
-        } else {
-            // Reservoir sampling algorithm - O(N) time, O(K) space
-            std::vector<int64_t> reservoir(actual_n_train);
+    void summarize_list_lengths(std::vector<size_t> *lengths, IvfShardStats *stats) {
+        stats->lists = lengths->size();
+        if (lengths->empty()) {
+            return;
+        }
+        auto middle = lengths->begin() + lengths->size() / 2;
+        std::nth_element(lengths->begin(), middle, lengths->end());
+        stats->median_list = *middle;
+        const auto [min, max] = std::minmax_element(lengths->begin(), lengths->end());
+        stats->min_list = *min;
+        stats->max_list = *max;
+        const double mean = static_cast<double>(std::accumulate(lengths->begin(), lengths->end(), size_t{0})) /
+                            static_cast<double>(lengths->size());
+        stats->imbalance = mean > 0.0 ? static_cast<double>(stats->max_list) / mean : 0.0;
+    }
 
-            // Initialize reservoir with first K elements
-            for (int64_t i = 0; i < actual_n_train; ++i) {
-                reservoir[i] = i;
+    size_t DistributedIndexIVF::size() {
+        // read again if move_list copied or dropped a list meanwhile
+        while (true) {
+            const uint64_t seq = move_seq_.load();
+            if (seq & 1) {
+                std::this_thread::yield();
+                continue;
             }
+            size_t total = 0;
+            for (const auto &[shard_id, shard]: shards_) {
+                total += shard->size();
+            }
+            const size_t moving = moving_rows_.load();
+            if (move_seq_.load() == seq) {
+                return total - std::min(total, moving);
+            }
+        }
+    }
 
-            // Replace elements with decreasing probability
-            for (int64_t i = actual_n_train; i < total_vectors; ++i) {
-                std::uniform_int_distribution<int64_t> dist(0, i);
-                int64_t j = dist(gen);
-                if (j < actual_n_train) {
-                    reservoir[j] = i;
+    std::vector<IvfShardStats> DistributedIndexIVF::shard_stats(IvfShardStats *total,
+                                                                std::vector<size_t> *list_lengths) const {
+        std::vector<int> ids;
+        ids.reserve(shards_.size());
+        for (const auto &[shard_id, shard]: shards_) {
+            ids.push_back(shard_id);
+        }
+        std::sort(ids.begin(), ids.end());
+        std::vector<IvfShardStats> stats;
+        std::vector<size_t> all_lengths;
+        for (int shard_id: ids) {
+            const IndexIVFShard &shard = *shards_.at(shard_id);
+            IvfShardStats entry;
+            entry.shard_id = shard_id;
+            entry.node = shard.node_id();
+            entry.remote = is_remote(shard_id);
+            if (!entry.remote) {
+                entry.vectors = shard.size();
+                entry.memory_bytes = shard.memory_bytes();
+                std::vector<size_t> lengths = shard.list_lengths();
+                if (total || list_lengths) {
+                    all_lengths.insert(all_lengths.end(), lengths.begin(), lengths.end());
+                }
+                if (total) {
+                    total->vectors += entry.vectors;
+                    total->memory_bytes += entry.memory_bytes;
                 }
+                summarize_list_lengths(&lengths, &entry);
             }
+            stats.push_back(std::move(entry));
+        }
+        if (list_lengths) {
+            list_lengths->insert(list_lengths->end(), all_lengths.begin(), all_lengths.end());
+        }
+        if (total) {
+            summarize_list_lengths(&all_lengths, total);
+        }
+        return stats;
+    }
+
+    int DistributedIndexIVF::placement_shard(const ShardPlacement *placement, int64_t centroid) const {
+        if (placement && centroid >= 0 && static_cast<size_t>(centroid) < placement->centroid_shard.size()) {
+            return placement->centroid_shard[centroid];
+        }
+        return static_cast<int>(centroid % shard_counts_);
+    }
+
+    void DistributedIndexIVF::publish_placement(std::vector<int32_t> centroid_shard, bool keep_probes) {
+        const ShardPlacement *current = placement_.load(std::memory_order_acquire);
+        auto next = std::make_unique<ShardPlacement>();
+        next->centroid_shard = std::move(centroid_shard);
+        next->version = current ? current->version + 1 : 1;
+        next->probes = std::make_unique<std::atomic<uint64_t>[]>(next->centroid_shard.size());
+        next->heat = std::make_unique<std::atomic<uint64_t>[]>(next->centroid_shard.size());
+        for (size_t c = 0; c < next->centroid_shard.size(); ++c) {
+            const bool carried = keep_probes && current && c < current->centroid_shard.size();
+            next->probes[c].store(carried ? current->probes[c].load(std::memory_order_relaxed) : 0,
+                                  std::memory_order_relaxed);
+            next->heat[c].store(carried ? current->heat[c].load(std::memory_order_relaxed) : 0,
+                                std::memory_order_relaxed);
+        }
+        // seq_cst so a search pinned after a later synchronize() routes by next
+        placement_.store(next.release(), std::memory_order_seq_cst);
+        if (current) {
+            get_epoch_domain().retire(current);
+        }
+    }
+
+    int DistributedIndexIVF::shard_of(int64_t centroid) const {
+        auto guard = get_epoch_domain().pin();
+        return placement_shard(placement_.load(std::memory_order_seq_cst), centroid);
+    }
 
-            // Extract selected vectors
-            for (int64_t idx: reservoir) {
-                train_vectors.insert(train_vectors.end(),
-                                     vectors.begin() + idx * dimension_,
-                                     vectors.begin() + (idx + 1) * dimension_);
+    std::vector<ListMove> DistributedIndexIVF::plan_rebalance(const RebalanceOptions &options) const {
+        std::vector<ListMove> moves;
+        if (quantizer_ && quantization_.refine_factor <= 0) {
+            return moves;
+        }
+        auto guard = get_epoch_domain().pin();
+        const ShardPlacement *placement = placement_.load(std::memory_order_seq_cst);
+        struct ListLoad {
+            int64_t centroid;
+            double load;
+        };
+        std::map<int, std::vector<ListLoad>> shard_lists;
+        std::map<int, double> shard_load;
+        for (const auto &[shard_id, shard]: shards_) {
+            if (is_remote(shard_id)) {
+                continue;
+            }
+            double &total = shard_load[shard_id];
+            auto &lists = shard_lists[shard_id];
+            for (const auto &[centroid, rows]: shard->list_rows()) {
+                double load = static_cast<double>(rows);
+                if (options.use_probe_load && placement && static_cast<size_t>(centroid) < placement->centroid_shard.size()) {
+                    load *= 1.0 + static_cast<double>(placement->probes[centroid].load(std::memory_order_relaxed));
+                }
+                lists.push_back({centroid, load});
+                total += load;
+            }
+        }
+        if (shard_load.size() < 2) {
+            return moves;
+        }
+        double sum = 0.0;
+        for (const auto &[shard_id, load]: shard_load) {
+            sum += load;
+        }
+        const double mean = sum / static_cast<double>(shard_load.size());
+        while (moves.size() < options.max_moves) {
+            auto [lightest, heaviest] = std::minmax_element(
+                shard_load.begin(), shard_load.end(),
+                [](const auto &a, const auto &b) { return a.second < b.second; });
+            if (heaviest->second <= options.max_imbalance * mean) {
+                break;
+            }
+            // the list closest to half the gap evens the pair out best; one as large as
+            // the gap would only swap their roles
+            const double gap = heaviest->second - lightest->second;
+            auto &lists = shard_lists[heaviest->first];
+            auto best = lists.end();
+            for (auto it = lists.begin(); it != lists.end(); ++it) {
+                if (it->load < gap && (best == lists.end() ||
+                                       std::abs(it->load - gap / 2) < std::abs(best->load - gap / 2))) {
+                    best = it;
+                }
+            }
+            if (best == lists.end()) {
+                break;
             }
+            moves.push_back({best->centroid, heaviest->first, lightest->first});
+            heaviest->second -= best->load;
+            lightest->second += best->load;
+            shard_lists[lightest->first].push_back(*best);
+            *best = lists.back();
+            lists.pop_back();
         }
+        return moves;
+    }
 
-        return train_vectors;
+    size_t DistributedIndexIVF::rebalance(const RebalanceOptions &options) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        size_t moved = 0;
+        for (const auto &move: plan_rebalance(options)) {
+            moved += move_list_locked(move.centroid, move.to_shard) ? 1 : 0;
+        }
+        // the next plan weighs the lists by the queries served from here on
+        if (const ShardPlacement *placement = placement_.load(std::memory_order_acquire)) {
+            for (size_t c = 0; c < placement->centroid_shard.size(); ++c) {
+                placement->probes[c].store(0, std::memory_order_relaxed);
+            }
+        }
+        if (moved > 0) {
+            LOG_INFOF("%s: rebalanced %zu posting lists", name_.c_str(), moved);
+        }
+        return moved;
     }
 
-    int64_t DistributedIndexIVF::find_closest_optimized(const float *x, const float *y, int d, int n) const {
-        float min_dis = std::numeric_limits<float>::max();
-        int64_t r = 0;
+    bool DistributedIndexIVF::move_list(int64_t centroid, int to_shard) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        return move_list_locked(centroid, to_shard);
+    }
 
-        // Unroll loop for better performance when d is small and known
-        if (d == 4) {
-            for (int64_t i = 0; i < n; i++) {
-                const float *centroid = x + i * d;
-                float dx = centroid[0] - y[0];
-                float dy = centroid[1] - y[1];
-                float dz = centroid[2] - y[2];
-                float dw = centroid[3] - y[3];
-                float dis = dx * dx + dy * dy + dz * dz + dw * dw;
+    bool DistributedIndexIVF::move_list_locked(int64_t centroid, int to_shard) {
+        if (centroid < 0 || static_cast<size_t>(centroid) >= global_centroid_ids_.size() ||
+            !shards_.count(to_shard) || (quantizer_ && quantization_.refine_factor <= 0)) {
+            return false;
+        }
+        const ShardPlacement *current = placement_.load(std::memory_order_acquire);
+        const int from_shard = placement_shard(current, centroid);
+        if (from_shard == to_shard || is_remote(from_shard) || is_remote(to_shard)) {
+            return false;
+        }
+        // 1) copy the live rows in; searches still route to the source and skip them
+        InvertedList scratch;
+        PostingView view;
+        if (shards_[from_shard]->read_posting(centroid, &scratch, &view)) {
+            InvertedList rows;
+            rows.vector_ids.assign(view.vector_ids, view.vector_ids + view.length);
+            rows.vectors.assign(view.vectors, view.vectors + view.length * dimension_);
+            move_seq_.fetch_add(1);
+            moving_rows_.store(view.length);
+            shards_[to_shard]->append_postings({{centroid, std::move(rows)}});
+            move_seq_.fetch_add(1);
+        }
+        // 2) switch the routing
+        std::vector<int32_t> centroid_shard(global_centroid_ids_.size());
+        for (size_t c = 0; c < centroid_shard.size(); ++c) {
+            centroid_shard[c] = placement_shard(current, static_cast<int64_t>(c));
+        }
+        centroid_shard[centroid] = to_shard;
+        publish_placement(std::move(centroid_shard), true);
+        // 3) searches that may have routed by the old placement drain, then the source copy goes
+        get_epoch_domain().synchronize();
+        move_seq_.fetch_add(1);
+        shards_[from_shard]->remove_list(centroid);
+        moving_rows_.store(0);
+        move_seq_.fetch_add(1);
+        version_.fetch_add(1, std::memory_order_release);
+        get_epoch_domain().reclaim();
+        return true;
+    }
 
-                if (dis < min_dis) {
-                    min_dis = dis;
-                    r = i;
+    void DistributedIndexIVF::start_rebalancing(const RebalanceOptions &options, std::chrono::milliseconds interval) {
+        stop_rebalancing();
+        rebalance_stop_ = false;
+        rebalance_thread_ = std::thread([this, options, interval] {
+            std::unique_lock<std::mutex> lock(rebalance_mutex_);
+            while (!rebalance_stop_) {
+                rebalance_cv_.wait_for(lock, interval, [this] { return rebalance_stop_; });
+                if (rebalance_stop_) {
+                    break;
                 }
+                lock.unlock();
+                rebalance(options);
+                lock.lock();
             }
-        } else if (d == 8) {
-            for (int64_t i = 0; i < n; i++) {
-                const float *centroid = x + i * d;
-                float dis = 0.0f;
-                for (int j = 0; j < 8; j += 4) {
-                    float dx = centroid[j] - y[j];
-                    float dy = centroid[j + 1] - y[j + 1];
-                    float dz = centroid[j + 2] - y[j + 2];
-                    float dw = centroid[j + 3] - y[j + 3];
-                    dis += dx * dx + dy * dy + dz * dz + dw * dw;
-                }
+        });
+    }
+
+    void DistributedIndexIVF::stop_rebalancing() {
+        if (!rebalance_thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(rebalance_mutex_);
+            rebalance_stop_ = true;
+        }
+        rebalance_cv_.notify_one();
+        rebalance_thread_.join();
+    }
 
-                if (dis < min_dis) {
-                    min_dis = dis;
-                    r = i;
+    void DistributedIndexIVF::reset_list_drift(const float *x, const std::vector<int64_t> &assignments) {
+        const size_t nlist = global_centroid_ids_.size();
+        const size_t n = assignments.size();
+        // per-chunk sums, added in chunk order so the figures do not depend on scheduling
+        const size_t grain = std::max<size_t>(4096, n / 64 + 1);
+        const size_t nchunks = (n + grain - 1) / grain;
+        std::vector<std::vector<double>> errors(nchunks);
+        get_compute_executor().parallel_for(0, nchunks, 1, [&](size_t lo, size_t hi) {
+            for (size_t chunk = lo; chunk < hi; ++chunk) {
+                errors[chunk].assign(nlist, 0.0);
+                for (size_t i = chunk * grain; i < std::min(n, (chunk + 1) * grain); ++i) {
+                    const int64_t c = assignments[i];
+                    errors[chunk][c] += l2_sqr(x + i * dimension_, global_centroids_.data() + c * dimension_,
+                                               dimension_);
                 }
             }
-        } else {
-            // General case - use original implementation
-            for (int64_t i = 0; i < n; i++) {
-                float dis = L2_distance(x + i * d, y, d);
-                if (dis < min_dis) {
-                    min_dis = dis;
-                    r = i;
+        });
+        list_drift_.assign(nlist, ListDrift{});
+        for (size_t i = 0; i < n; ++i) {
+            ++list_drift_[assignments[i]].trained_rows;
+        }
+        for (size_t c = 0; c < nlist; ++c) {
+            double error = 0.0;
+            for (const auto &chunk: errors) {
+                error += chunk[c];
+            }
+            ListDrift &list = list_drift_[c];
+            list.trained_error = list.trained_rows > 0 ? error / static_cast<double>(list.trained_rows) : -1.0;
+        }
+    }
+
+    DistributedIndexIVF::ListDrift DistributedIndexIVF::trained_drift(int64_t centroid,
+                                                                      const InvertedList &rows) const {
+        ListDrift drift;
+        drift.trained_rows = static_cast<int64_t>(rows.vector_ids.size());
+        if (drift.trained_rows > 0) {
+            const float *c = global_centroids_.data() + centroid * dimension_;
+            double error = 0.0;
+            for (int64_t i = 0; i < drift.trained_rows; ++i) {
+                error += l2_sqr(rows.vectors.data() + i * dimension_, c, dimension_);
+            }
+            drift.trained_error = error / static_cast<double>(drift.trained_rows);
+        }
+        return drift;
+    }
+
+    std::vector<float> DistributedIndexIVF::rows_mean(const InvertedList &rows) const {
+        const size_t n = rows.vector_ids.size();
+        std::vector<double> sum(dimension_, 0.0);
+        for (size_t i = 0; i < n; ++i) {
+            for (int j = 0; j < dimension_; ++j) {
+                sum[j] += rows.vectors[i * dimension_ + j];
+            }
+        }
+        std::vector<float> mean(dimension_);
+        for (int j = 0; j < dimension_; ++j) {
+            mean[j] = n > 0 ? static_cast<float>(sum[j] / static_cast<double>(n)) : 0.0f;
+        }
+        std::vector<float> normalized;
+        normalize_for_metric(mean.data(), 1, &normalized);
+        return normalized.empty() ? mean : normalized;
+    }
+
+    std::vector<ListHealth> DistributedIndexIVF::list_health() const {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        std::vector<ListHealth> health;
+        const ShardPlacement *placement = placement_.load(std::memory_order_acquire);
+        std::vector<int64_t> rows(list_drift_.size(), -1);
+        for (const auto &[shard_id, shard]: shards_) {
+            if (is_remote(shard_id)) {
+                continue;
+            }
+            for (const auto &[centroid, n]: shard->list_rows()) {
+                if (centroid >= 0 && static_cast<size_t>(centroid) < rows.size() &&
+                    placement_shard(placement, centroid) == shard_id) {
+                    rows[centroid] = static_cast<int64_t>(n);
                 }
             }
         }
+        for (size_t c = 0; c < list_drift_.size(); ++c) {
+            const int shard = placement_shard(placement, static_cast<int64_t>(c));
+            if ((c < retired_lists_.size() && retired_lists_[c]) || is_remote(shard)) {
+                continue;
+            }
+            const ListDrift &drift = list_drift_[c];
+            ListHealth list;
+            list.centroid = static_cast<int64_t>(c);
+            list.shard = shard;
+            list.rows = rows[c] < 0 ? 0 : static_cast<size_t>(rows[c]);
+            list.trained_rows = static_cast<size_t>(std::max<int64_t>(0, drift.trained_rows));
+            list.trained_error = drift.trained_error;
+            list.added_rows = static_cast<size_t>(drift.added_rows);
+            list.added_error = drift.added_rows > 0 ? drift.added_error / static_cast<double>(drift.added_rows) : -1.0;
+            health.push_back(list);
+        }
+        return health;
+    }
+
+    MaintenanceReport DistributedIndexIVF::maintain(const MaintenanceOptions &options) {
+        DANN_TRACE_SPAN("build", "maintain");
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        MaintenanceReport report;
+        // residual codes are relative to the centroids, and code-only rows cannot be reassigned
+        if (!is_trained_ || global_centroid_ids_.empty() || quantizer_ || options.max_lists == 0) {
+            return report;
+        }
+        // the coordinators of other nodes probe their own copy of the centroids and
+        // would keep routing split-off or merged rows to lists that no longer hold them
+        for (const auto &[shard_id, shard]: shards_) {
+            if (is_remote(shard_id)) {
+                LOG_WARNF("%s: not maintaining with shard %d on node %s; peer coordinators would route by stale centroids",
+                          name_.c_str(), shard_id, shard->node_id().c_str());
+                return report;
+            }
+        }
+        int64_t nlist = static_cast<int64_t>(global_centroid_ids_.size());
+        retired_lists_.resize(nlist, 0);
+        list_drift_.resize(nlist);
 
-        return r;
+        // live rows of every live local list; -1 for merged and remote lists
+        const ShardPlacement *placement = placement_.load(std::memory_order_acquire);
+        std::vector<int64_t> rows(nlist, -1);
+        int64_t lists = 0;
+        for (int64_t c = 0; c < nlist; ++c) {
+            const int shard = placement_shard(placement, c);
+            if (!retired_lists_[c] && shards_.count(shard) && !is_remote(shard)) {
+                rows[c] = 0;
+                ++lists;
+            }
+        }
+        int64_t total = 0;
+        for (const auto &[shard_id, shard]: shards_) {
+            if (is_remote(shard_id)) {
+                continue;
+            }
+            for (const auto &[centroid, n]: shard->list_rows()) {
+                if (centroid >= 0 && centroid < nlist && rows[centroid] >= 0 &&
+                    placement_shard(placement, centroid) == shard_id) {
+                    rows[centroid] = static_cast<int64_t>(n);
+                    total += static_cast<int64_t>(n);
+                }
+            }
+        }
+        if (lists == 0 || total == 0) {
+            return report;
+        }
+        const double mean = static_cast<double>(total) / static_cast<double>(lists);
+
+        // 1) plan: every list takes part in one change at most
+        std::vector<uint8_t> touched(nlist, 0);
+        size_t budget = options.max_lists;
+        std::vector<int64_t> split_candidates;
+        std::vector<int64_t> merge_candidates;
+        std::vector<std::pair<double, int64_t>> drifted;
+        for (int64_t c = 0; c < nlist; ++c) {
+            if (rows[c] < 0) {
+                continue;
+            }
+            if (rows[c] >= 2 && static_cast<double>(rows[c]) > options.split_factor * mean) {
+                split_candidates.push_back(c);
+            } else if (lists > 1 && static_cast<double>(rows[c]) < options.merge_factor * mean) {
+                merge_candidates.push_back(c);
+            }
+            const ListDrift &drift = list_drift_[c];
+            if (drift.trained_error > 0.0 && drift.added_rows >= kDriftMinRows) {
+                const double ratio = drift.added_error / static_cast<double>(drift.added_rows) / drift.trained_error;
+                if (ratio > options.drift_factor) {
+                    drifted.emplace_back(ratio, c);
+                }
+            }
+        }
+        std::sort(split_candidates.begin(), split_candidates.end(),
+                  [&rows](int64_t a, int64_t b) { return rows[a] > rows[b] || (rows[a] == rows[b] && a < b); });
+        std::sort(merge_candidates.begin(), merge_candidates.end(),
+                  [&rows](int64_t a, int64_t b) { return rows[a] < rows[b] || (rows[a] == rows[b] && a < b); });
+        std::sort(drifted.begin(), drifted.end(),
+                  [](const auto &a, const auto &b) { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+
+        struct Split {
+            int64_t centroid;
+            int64_t added;
+            int shard;
+            std::vector<float> centroids; // the two halves
+            InvertedList stay;
+            InvertedList moved;
+        };
+        struct Merge {
+            int64_t from;
+            int64_t into;
+        };
+        std::vector<Split> splits;
+        std::vector<Merge> merges;
+        std::vector<int64_t> recentres;
+
+        ClusteringParameters cp = clustering_params_;
+        cp.metric = metric_;
+        if (gpu_.enabled) {
+            cp.gpu = gpu_;
+        }
+        cp.niter = 10;
+        cp.nredo = 1;
+        cp.batch_size = 0;
+        cp.min_points_per_centroids = 1;
+        InvertedList scratch;
+        PostingView view;
+        for (int64_t c: split_candidates) {
+            if (budget == 0) {
+                break;
+            }
+            const int shard = placement_shard(placement, c);
+            if (!shards_[shard]->read_posting(c, &scratch, &view) || view.length < 2) {
+                continue;
+            }
+            // 2-means over the list's rows; Clustering re-splits a half that comes out empty
+            Clustering halves(dimension_, 2, cp);
+            halves.train(view.vectors, view.length);
+            std::vector<float> distances(view.length);
+            std::vector<faiss::idx_t> labels(view.length);
+            knn_centroids(view.vectors, view.length, halves.centroids.data(), 2, dimension_, metric_, 1,
+                          distances.data(), labels.data(), gpu_);
+            Split split{c, -1, shard, halves.centroids, {}, {}};
+            for (size_t i = 0; i < view.length; ++i) {
+                InvertedList &half = labels[i] == 1 ? split.moved : split.stay;
+                half.vector_ids.push_back(view.vector_ids[i]);
+                half.vectors.insert(half.vectors.end(), view.vectors + i * dimension_,
+                                    view.vectors + (i + 1) * dimension_);
+            }
+            if (split.stay.vector_ids.empty() || split.moved.vector_ids.empty()) {
+                continue;
+            }
+            touched[c] = 1;
+            splits.push_back(std::move(split));
+            --budget;
+        }
+        for (int64_t c: merge_candidates) {
+            if (budget == 0) {
+                break;
+            }
+            if (touched[c]) {
+                continue;
+            }
+            // the nearest live local list that stays below the split threshold once merged
+            const int want = static_cast<int>(std::min<int64_t>(nlist, 16));
+            for (const auto &near: find_closest_k_with_distance(global_centroids_.data(),
+                                                                global_centroids_.data() + c * dimension_, dimension_,
+                                                                static_cast<int>(nlist), want, metric_)) {
+                const int64_t t = near.index;
+                if (t == c || rows[t] < 0 || touched[t] ||
+                    static_cast<double>(rows[t] + rows[c]) > options.split_factor * mean) {
+                    continue;
+                }
+                touched[c] = 1;
+                touched[t] = 1;
+                merges.push_back({c, t});
+                --budget;
+                break;
+            }
+        }
+        for (const auto &[ratio, c]: drifted) {
+            if (budget == 0) {
+                break;
+            }
+            if (!touched[c]) {
+                touched[c] = 1;
+                recentres.push_back(c);
+                --budget;
+            }
+        }
+        if (splits.empty() && merges.empty() && recentres.empty()) {
+            return report;
+        }
+
+        // 2) new ids for the split-off halves: merged ids first, then fresh ones, each
+        // placed on the shard of the list it comes from
+        for (auto &split: splits) {
+            int64_t id = -1;
+            for (int64_t c = 0; c < nlist; ++c) {
+                if (retired_lists_[c] && !touched[c]) {
+                    id = c;
+                    break;
+                }
+            }
+            if (id < 0) {
+                id = nlist++;
+                global_centroids_.resize(nlist * dimension_);
+                global_centroid_ids_.push_back(static_cast<int>(id));
+                retired_lists_.push_back(0);
+                list_drift_.emplace_back();
+                touched.push_back(0);
+            }
+            touched[id] = 1;
+            split.added = id;
+        }
+        if (!splits.empty()) {
+            std::vector<int32_t> centroid_shard(nlist);
+            for (int64_t c = 0; c < nlist; ++c) {
+                centroid_shard[c] = placement_shard(placement, c);
+            }
+            for (const auto &split: splits) {
+                centroid_shard[split.added] = split.shard;
+            }
+            publish_placement(std::move(centroid_shard), true);
+        }
+
+        // 3) the new lists are published empty, their sources keep all rows and their place
+        for (const auto &split: splits) {
+            std::copy(split.centroids.begin() + dimension_, split.centroids.end(),
+                      global_centroids_.begin() + split.added * dimension_);
+            retired_lists_[split.added] = 0;
+        }
+        if (!splits.empty()) {
+            publish_centroids();
+        }
+
+        // 4) rows change lists with one shard publish per change, so no search sees a row
+        // twice or misses it
+        for (const auto &split: splits) {
+            shards_[split.shard]->replace_lists({{split.centroid, split.stay}, {split.added, split.moved}});
+            report.rows_moved += split.moved.vector_ids.size();
+        }
+        std::vector<std::pair<int64_t, InvertedList>> merged_rows;
+        for (const auto &merge: merges) {
+            int shard = placement_shard(placement_.load(std::memory_order_acquire), merge.into);
+            if (placement_shard(placement_.load(std::memory_order_acquire), merge.from) != shard &&
+                !move_list_locked(merge.from, shard)) {
+                continue;
+            }
+            InvertedList combined;
+            if (shards_[shard]->read_posting(merge.into, &scratch, &view)) {
+                combined.vector_ids.assign(view.vector_ids, view.vector_ids + view.length);
+                combined.vectors.assign(view.vectors, view.vectors + view.length * dimension_);
+            }
+            if (shards_[shard]->read_posting(merge.from, &scratch, &view)) {
+                combined.vector_ids.insert(combined.vector_ids.end(), view.vector_ids, view.vector_ids + view.length);
+                combined.vectors.insert(combined.vectors.end(), view.vectors, view.vectors + view.length * dimension_);
+                report.rows_moved += view.length;
+            }
+            shards_[shard]->replace_lists({{merge.from, InvertedList{}}, {merge.into, combined}});
+            retired_lists_[merge.from] = 1;
+            list_drift_[merge.from] = ListDrift{};
+            merged_rows.emplace_back(merge.into, std::move(combined));
+            ++report.merged;
+        }
+        std::vector<std::pair<int64_t, InvertedList>> recentred_rows;
+        for (int64_t c: recentres) {
+            InvertedList list;
+            if (shards_[placement_shard(placement_.load(std::memory_order_acquire), c)]->read_posting(c, &scratch,
+                                                                                                    &view)) {
+                list.vector_ids.assign(view.vector_ids, view.vector_ids + view.length);
+                list.vectors.assign(view.vectors, view.vectors + view.length * dimension_);
+                recentred_rows.emplace_back(c, std::move(list));
+            }
+        }
+
+        // 5) the centroids move onto their rows
+        for (const auto &split: splits) {
+            std::copy(split.centroids.begin(), split.centroids.begin() + dimension_,
+                      global_centroids_.begin() + split.centroid * dimension_);
+            list_drift_[split.centroid] = trained_drift(split.centroid, split.stay);
+            list_drift_[split.added] = trained_drift(split.added, split.moved);
+            ++report.split;
+        }
+        for (auto *changed: {&merged_rows, &recentred_rows}) {
+            for (const auto &[c, list]: *changed) {
+                const std::vector<float> mean_row = rows_mean(list);
+                std::copy(mean_row.begin(), mean_row.end(), global_centroids_.begin() + c * dimension_);
+                list_drift_[c] = trained_drift(c, list);
+            }
+        }
+        report.recentred = recentred_rows.size();
+        publish_centroids();
+        version_.fetch_add(1, std::memory_order_release);
+        get_epoch_domain().reclaim();
+        LOG_INFOF("%s: maintenance split %zu, merged %zu and re-centred %zu lists, %zu rows moved", name_.c_str(),
+                  report.split, report.merged, report.recentred, report.rows_moved);
+        return report;
+    }
+
+    void DistributedIndexIVF::start_maintenance(const MaintenanceOptions &options, std::chrono::milliseconds interval) {
+        stop_maintenance();
+        maintenance_stop_ = false;
+        maintenance_thread_ = std::thread([this, options, interval] {
+            std::unique_lock<std::mutex> lock(maintenance_mutex_);
+            while (!maintenance_stop_) {
+                maintenance_cv_.wait_for(lock, interval, [this] { return maintenance_stop_; });
+                if (maintenance_stop_) {
+                    break;
+                }
+                lock.unlock();
+                maintain(options);
+                lock.lock();
+            }
+        });
+    }
+
+    void DistributedIndexIVF::stop_maintenance() {
+        if (!maintenance_thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(maintenance_mutex_);
+            maintenance_stop_ = true;
+        }
+        maintenance_cv_.notify_one();
+        maintenance_thread_.join();
+    }
+
+    struct DistributedIndexIVF::StageMetrics {
+        std::shared_ptr<LatencyHistogram> centroid;
+        std::shared_ptr<LatencyHistogram> routing;
+        std::shared_ptr<LatencyHistogram> queue_wait;
+        std::shared_ptr<LatencyHistogram> scan;
+        std::shared_ptr<LatencyHistogram> remote;
+        std::shared_ptr<LatencyHistogram> merge;
+        std::shared_ptr<LatencyHistogram> rerank;
+        std::shared_ptr<LatencyHistogram> total;
+        std::shared_ptr<LatencyHistogram> lists_probed;
+        std::shared_ptr<LatencyHistogram> vectors_scanned;
+    };
+
+    void DistributedIndexIVF::set_stage_sampling(uint32_t every) {
+        stage_sample_every_ = every;
+        if (every == 0 || stage_metrics_) {
+            return;
+        }
+        Metrics &metrics = Metrics::instance();
+        auto stage = [&metrics](const char *name) {
+            return metrics.histogram(std::string("search_stage_ms{stage=\"") + name + "\"}");
+        };
+        stage_metrics_ = std::make_unique<StageMetrics>(StageMetrics{
+            stage("centroid"), stage("routing"), stage("queue_wait"), stage("scan"), stage("remote"),
+            stage("merge"), stage("rerank"), stage("total"), metrics.histogram("search_lists_probed"),
+            metrics.histogram("search_vectors_scanned")});
+    }
+
+    bool DistributedIndexIVF::sample_search() {
+        return stage_sample_every_ != 0 &&
+               stage_sample_count_.fetch_add(1, std::memory_order_relaxed) % stage_sample_every_ == 0;
+    }
+
+    void DistributedIndexIVF::record_stages(const QueryStats &stats) const {
+        const StageMetrics &m = *stage_metrics_;
+        m.centroid->record(stats.centroid_ms);
+        m.routing->record(stats.routing_ms);
+        m.queue_wait->record(stats.queue_wait_ms);
+        m.scan->record(stats.scan_ms);
+        m.remote->record(stats.remote_ms);
+        m.merge->record(stats.merge_ms);
+        m.rerank->record(stats.rerank_ms);
+        m.total->record(stats.total_ms);
+        const double queries = static_cast<double>(std::max<uint64_t>(1, stats.queries));
+        m.lists_probed->record(static_cast<double>(stats.lists_probed) / queries);
+        m.vectors_scanned->record(static_cast<double>(stats.vectors_scanned) / queries);
+    }
+
+    void DistributedIndexIVF::set_remote_shards(std::string local_node, std::shared_ptr<ShardClient> client,
+                                                std::chrono::milliseconds timeout) {
+        local_node_ = std::move(local_node);
+        shard_client_ = std::move(client);
+        remote_timeout_ = timeout;
+    }
+
+    void DistributedIndexIVF::set_node_timeout(const std::string &node, std::chrono::milliseconds timeout) {
+        node_timeouts_[node] = timeout;
+    }
+
+    bool DistributedIndexIVF::is_remote(int shard_id) const {
+        return shard_client_ && shards_.at(shard_id)->node_id() != local_node_;
+    }
+
+    bool DistributedIndexIVF::search_shard(const InternalShardSearchRequest &request,
+                                           InternalShardSearchResponse *response) {
+        auto it = shards_.find(request.shard_id);
+        if (it == shards_.end() || is_remote(request.shard_id)) {
+            response->success = false;
+            response->error_message = "shard " + std::to_string(request.shard_id) + " is not served by this node";
+            return false;
+        }
+        if (request.query.size() != static_cast<size_t>(dimension_) || request.k <= 0) {
+            response->success = false;
+            response->error_message = "query must have the index dimension and k be positive";
+            return false;
+        }
+        std::shared_ptr<const RoaringBitmap> filter;
+        if (!request.filter.empty()) {
+            filter = attributes_.match(request.filter);
+            if (filter->empty()) {
+                response->success = true;
+                return true;
+            }
+        }
+        response->results = it->second->search(request.centroid_ids, request.query, request.k,
+                                               request.include_vectors, nullptr, filter.get());
+        response->success = true;
+        return true;
+    }
+
+    struct DistributedIndexIVF::RemoteGather {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<InternalShardSearchResponse> replies;
+        std::vector<std::string> nodes;
+        std::vector<int> shard_ids;
+        size_t pending{0};
+        // set by collect_remote; replies arriving later are dropped
+        bool closed{false};
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    std::shared_ptr<DistributedIndexIVF::RemoteGather> DistributedIndexIVF::send_remote(
+        std::vector<InternalShardSearchRequest> requests, const InternalSearchParameters &params) const {
+        if (requests.empty()) {
+            return nullptr;
+        }
+        // callbacks hold the gather, so it outlives a search that gave up on a node
+        auto gather = std::make_shared<RemoteGather>();
+        gather->replies.resize(requests.size());
+        gather->nodes.reserve(requests.size());
+        gather->pending = requests.size();
+        const auto now = std::chrono::steady_clock::now();
+        std::vector<std::chrono::steady_clock::time_point> deadlines;
+        deadlines.reserve(requests.size());
+        for (const auto &request: requests) {
+            const std::string &node = shards_.at(request.shard_id)->node_id();
+            auto timeout = node_timeouts_.find(node);
+            if (params.timeout_ms > 0) {
+                deadlines.push_back(now + std::chrono::milliseconds(params.timeout_ms));
+            } else {
+                deadlines.push_back(now + (timeout == node_timeouts_.end() ? remote_timeout_ : timeout->second));
+            }
+            gather->deadline = std::max(gather->deadline, deadlines.back());
+            gather->nodes.push_back(node);
+            gather->shard_ids.push_back(request.shard_id);
+        }
+        for (size_t slot = 0; slot < requests.size(); ++slot) {
+            shard_client_->search_shard(gather->nodes[slot], requests[slot], deadlines[slot],
+                                        [gather, slot](InternalShardSearchResponse reply) {
+                                            std::lock_guard<std::mutex> lock(gather->mutex);
+                                            if (gather->closed) {
+                                                return;
+                                            }
+                                            gather->replies[slot] = std::move(reply);
+                                            if (--gather->pending == 0) {
+                                                gather->cv.notify_all();
+                                            }
+                                        });
+        }
+        return gather;
+    }
+
+    std::vector<InternalShardSearchResponse> DistributedIndexIVF::collect_remote(RemoteGather &gather,
+                                                                                const InternalSearchParameters &params) const {
+        std::unique_lock<std::mutex> lock(gather.mutex);
+        gather.cv.wait_until(lock, gather.deadline, [&gather] { return gather.pending == 0; });
+        gather.closed = true;
+        std::vector<InternalShardSearchResponse> replies = std::move(gather.replies);
+        lock.unlock();
+
+        size_t failed = 0;
+        std::string first_error;
+        for (size_t slot = 0; slot < replies.size(); ++slot) {
+            if (!replies[slot].success) {
+                METRIC_COUNTER_INC("ivf_remote_shard_failures");
+                const std::string error = "shard " + std::to_string(gather.shard_ids[slot]) + " on " +
+                                          gather.nodes[slot] + ": " +
+                                          (replies[slot].error_message.empty() ? "deadline exceeded"
+                                                                               : replies[slot].error_message);
+                LOG_ERRORF("%s: remote %s", name_.c_str(), error.c_str());
+                if (failed++ == 0) {
+                    first_error = error;
+                }
+            }
+        }
+        if (failed > 0) {
+            if (!params.allow_partial) {
+                throw ShardUnavailableError(name_ + ": " + first_error);
+            }
+            METRIC_COUNTER_INC("ivf_partial_results");
+        }
+        return replies;
+    }
+
+    void DistributedIndexIVF::set_posting_storage_mode(PostingStorageMode mode) {
+        storage_mode_ = mode;
+        for (auto &[shard_id, shard]: shards_) {
+            shard->set_storage_mode(mode);
+        }
+    }
+
+
+    void DistributedIndexIVF::build_index(const std::vector<float> &vectors,
+                                          const std::vector<int64_t> &ids) {
+        assert(dimension_ != 0);
+        assert(vectors.size() / dimension_ == ids.size());
+        build_index(vectors.data(), ids.data(), static_cast<int64_t>(ids.size()));
+    }
+
+    void DistributedIndexIVF::build_index(const float *vectors, const int64_t *ids, int64_t n) {
+        assert(dimension_ != 0);
+        // a rebuild replaces the shards' contents: no insert, delete or compaction may interleave
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        build_index_locked(vectors, ids, n);
+    }
+
+    bool DistributedIndexIVF::build_index_locked(const float *vectors, const int64_t *ids, int64_t n) {
+        // the lists of remote shards would only fill local stand-ins no search reads;
+        // such an index is built where its shards live and loaded with load_index
+        for (const auto &[shard_id, shard]: shards_) {
+            if (is_remote(shard_id)) {
+                LOG_ERRORF("%s: cannot build with shard %d on node %s; build on each node and load_index",
+                           name_.c_str(), shard_id, shard->node_id().c_str());
+                return false;
+            }
+        }
+        DANN_TRACE_SPAN("build", "build_index");
+
+        const int64_t num_vectors = n;
+        if (nlist_ < 0) {
+            nlist_ = get_nlist(num_vectors);
+        }
+        ClusteringParameters cp = clustering_params_;
+        cp.metric = metric_;
+        if (gpu_.enabled) {
+            cp.gpu = gpu_;
+        }
+        clustering_ = std::make_unique<Clustering>(dimension_, nlist_, cp);
+        if (!nprobe_pinned_) {
+            nprobe_ = determine_nprobe(nlist_, 0.90f);
+        }
+        LOG_INFOF("clustering->k=%d, nprobe=%d", clustering_->k, nprobe_);
+
+        // a rebuild replaces whatever the shards held
+        for (auto &[shard_id, shard]: shards_) {
+            shard->clear();
+        }
+        if (num_vectors == 0) {
+            global_centroids_.clear();
+            global_centroid_ids_.clear();
+            retired_lists_.clear();
+            list_drift_.clear();
+            publish_centroids();
+            is_trained_ = false;
+            version_.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+
+        // cosine is inner product over unit vectors, so rows are normalized once on ingest
+        std::vector<float> normalized;
+        const float *input = normalize_for_metric(vectors, static_cast<size_t>(n), &normalized);
+
+        // 1) Sampling + clustering training; with every vector in the sample the input is trained on in place
+        TraceSpan train_span("build", "build.train");
+        const int64_t n_train = std::min(static_cast<int64_t>(clustering_->k) * 64, num_vectors);
+        const std::vector<int64_t> train_rows = sample_training_rows(num_vectors, n_train);
+        std::vector<float> sampled;
+        sampled.reserve(train_rows.size() * dimension_);
+        for (int64_t row: train_rows) {
+            sampled.insert(sampled.end(), input + row * dimension_, input + (row + 1) * dimension_);
+        }
+        const float *train_vectors = train_rows.empty() ? input : sampled.data();
+        const int64_t actual_n_train = train_rows.empty() ? num_vectors : n_train;
+        LOG_INFOF("clustering->k=%d, nprobe=%d, ntrain=%ld, actual_n_train=%ld", clustering_->k, nprobe_, n_train, actual_n_train);
+
+        clustering_->train(train_vectors, static_cast<size_t>(actual_n_train));
+        global_centroids_ = clustering_->centroids;
+        global_centroid_ids_.resize(global_centroids_.size() / dimension_);
+        std::iota(global_centroid_ids_.begin(), global_centroid_ids_.end(), 0);
+        train_span.end();
+
+        // 2) assign every vector in blocks, split lists over the size cap, then bucket
+        // them into postings in parallel
+        TraceSpan assign_span("build", "build.assign");
+        std::vector<int64_t> assignments =
+            assign_vectors(CentroidTable{global_centroids_, global_centroid_ids_.size()}, input, num_vectors);
+        if (max_list_factor_ > 0.0f) {
+            split_oversized_lists(input, &assignments);
+        }
+        assign_span.end();
+        const int64_t num_centroids = static_cast<int64_t>(global_centroid_ids_.size());
+        retired_lists_.assign(num_centroids, 0);
+        reset_list_drift(input, assignments);
+        TraceSpan quantizer_span("build", "build.train_quantizer");
+        train_quantizer(train_vectors, actual_n_train);
+        publish_centroids();
+        quantizer_span.end();
+        TraceSpan scatter_span("build", "build.scatter");
+        std::vector<int64_t> centroid_counts;
+        std::vector<InvertedList> postings = scatter_postings(input, ids, assignments,
+                                                              num_centroids, &centroid_counts);
+        scatter_span.end();
+
+        // 3) Distribute postings to shards, undoing any earlier rebalancing
+        TraceSpan distribute_span("build", "build.distribute");
+        std::vector<int32_t> centroid_shard(num_centroids);
+        for (int64_t centroid = 0; centroid < num_centroids; ++centroid) {
+            centroid_shard[centroid] = static_cast<int32_t>(centroid % shard_counts_);
+        }
+        publish_placement(centroid_shard, false);
+        std::vector<size_t> shard_rows(shard_counts_, 0);
+        for (int64_t centroid = 0; centroid < num_centroids; ++centroid) {
+            shard_rows[centroid_shard[centroid]] += static_cast<size_t>(centroid_counts[centroid]);
+        }
+        for (int shard_id = 0; shard_id < shard_counts_; ++shard_id) {
+            shards_[shard_id]->reserve(shard_rows[shard_id]);
+        }
+        for (int64_t centroid = 0; centroid < num_centroids; ++centroid) {
+            if (postings[centroid].vector_ids.empty()) {
+                continue;
+            }
+            shards_[centroid_shard[centroid]]->add_posting(static_cast<int>(centroid), std::move(postings[centroid]));
+        }
+        distribute_span.end();
+        ntotal_ = num_vectors;
+        is_trained_ = true;
+        version_.fetch_add(1, std::memory_order_release);
+
+        if (!index_path_.empty() && !save_index(index_path_)) {
+            LOG_ERRORF("failed to persist ivf index to %s", index_path_.c_str());
+        }
+        return true;
+    }
+
+    bool DistributedIndexIVF::build_index_streaming(VectorChunkReader &reader, const std::string &index_path,
+                                                    const StreamingBuildOptions &options) {
+        if (reader.dimension() != dimension_) {
+            LOG_ERRORF("%s: input dimension %d does not match %d", name_.c_str(), reader.dimension(), dimension_);
+            return false;
+        }
+        if (max_list_factor_ > 0.0f || quantization_.type != QuantizerType::NONE) {
+            LOG_INFOF("%s: streaming build keeps raw, unsplit partitions", name_.c_str());
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(index_path, ec);
+        if (ec || !reader.rewind()) {
+            LOG_ERRORF("%s: cannot build into %s", name_.c_str(), index_path.c_str());
+            return false;
+        }
+        const size_t chunk_rows = std::max<size_t>(1, options.chunk_rows);
+        const size_t d = static_cast<size_t>(dimension_);
+
+        // 1) first pass: count the rows and keep a seeded reservoir sample of them
+        const int64_t capacity = nlist_ > 0 ? static_cast<int64_t>(nlist_) * 64
+                                            : std::max<int64_t>(1, options.max_train_rows);
+        std::mt19937_64 gen(static_cast<uint64_t>(clustering_params_.seed));
+        std::vector<float> sample;
+        int64_t num_vectors = 0;
+        VectorChunk chunk;
+        std::vector<float> normalized;
+        while (reader.next(chunk_rows, &chunk)) {
+            const float *rows = normalize_for_metric(chunk.vectors, chunk.rows, &normalized);
+            for (size_t i = 0; i < chunk.rows; ++i, ++num_vectors) {
+                int64_t slot = num_vectors;
+                if (num_vectors >= capacity) {
+                    slot = std::uniform_int_distribution<int64_t>(0, num_vectors)(gen);
+                    if (slot >= capacity) {
+                        continue;
+                    }
+                } else {
+                    sample.resize(sample.size() + d);
+                }
+                std::copy(rows + i * d, rows + (i + 1) * d, sample.begin() + slot * d);
+            }
+        }
+        if (reader.failed() || num_vectors == 0) {
+            LOG_ERRORF("%s: streaming build read %ld rows%s", name_.c_str(), num_vectors,
+                       reader.failed() ? " before a read error" : "");
+            return false;
+        }
+
+        // 2) train on the sample, trimmed to the 64 rows per centroid build_index uses
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            if (nlist_ < 0) {
+                nlist_ = get_nlist(num_vectors);
+            }
+            ClusteringParameters cp = clustering_params_;
+            cp.metric = metric_;
+            if (gpu_.enabled) {
+                cp.gpu = gpu_;
+            }
+            clustering_ = std::make_unique<Clustering>(dimension_, nlist_, cp);
+            if (!nprobe_pinned_) {
+                nprobe_ = determine_nprobe(nlist_, 0.90f);
+            }
+            int64_t n_train = static_cast<int64_t>(sample.size() / d);
+            const int64_t wanted = std::min<int64_t>(static_cast<int64_t>(clustering_->k) * 64, n_train);
+            for (int64_t i = 0; i < wanted && wanted < n_train; ++i) {
+                const int64_t j = std::uniform_int_distribution<int64_t>(i, n_train - 1)(gen);
+                std::swap_ranges(sample.begin() + i * d, sample.begin() + (i + 1) * d, sample.begin() + j * d);
+            }
+            n_train = wanted;
+            sample.resize(static_cast<size_t>(n_train) * d);
+            LOG_INFOF("%s: streaming build of %ld rows, k=%d, nprobe=%d, ntrain=%ld", name_.c_str(), num_vectors,
+                      clustering_->k, nprobe_, n_train);
+            clustering_->train(sample.data(), static_cast<size_t>(n_train));
+            global_centroids_ = clustering_->centroids;
+            global_centroid_ids_.resize(global_centroids_.size() / d);
+            std::iota(global_centroid_ids_.begin(), global_centroid_ids_.end(), 0);
+            std::vector<float>().swap(sample);
+        }
+
+        // 3) second pass: assign each chunk and spill it grouped by partition
+        const int num_centroids = static_cast<int>(global_centroid_ids_.size());
+        const CentroidTable trained{global_centroids_, global_centroid_ids_.size()};
+        const uint64_t total_bytes = static_cast<uint64_t>(num_vectors) * (sizeof(int64_t) + d * sizeof(float));
+        // regrouping holds a bucket twice (records and sorted rows)
+        const size_t buckets = static_cast<size_t>(
+            2 * total_bytes / std::max<size_t>(1, options.memory_budget_bytes) + 1);
+        PartitionSpill spill;
+        if (!spill.open(index_path, dimension_, num_centroids, buckets) || !reader.rewind()) {
+            return false;
+        }
+        while (reader.next(chunk_rows, &chunk)) {
+            const float *rows = normalize_for_metric(chunk.vectors, chunk.rows, &normalized);
+            const std::vector<int64_t> assignments = assign_vectors(trained, rows, static_cast<int64_t>(chunk.rows));
+            if (!spill.append(chunk.ids, rows, assignments.data(), chunk.rows)) {
+                return false;
+            }
+        }
+        if (reader.failed() || spill.rows() != static_cast<uint64_t>(num_vectors)) {
+            LOG_ERRORF("%s: input changed or failed between the two passes", name_.c_str());
+            return false;
+        }
+
+        // 4) partition-ordered auxiliary.idx, then the structure and manifest
+        IvfIndexManifest manifest;
+        manifest.index_name = name_;
+        manifest.dimension = dimension_;
+        manifest.nlist = num_centroids;
+        manifest.nprobe_default = nprobe_;
+        manifest.distance_type = metric_;
+        manifest.shard_count = shard_counts_;
+        manifest.ntotal = num_vectors;
+        manifest.trained = true;
+        IvfRuntimeLayout layout;
+        layout.centroids = global_centroids_;
+        const std::string aux_path = (std::filesystem::path(index_path) / kAuxiliaryFileName).string();
+        if (!spill.finish(aux_path + ".tmp", shard_counts_, &layout.partitions)) {
+            LOG_ERRORF("%s: failed to write partitions to %s", name_.c_str(), index_path.c_str());
+            return false;
+        }
+        std::filesystem::rename(aux_path + ".tmp", aux_path, ec);
+        if (ec || !save_index_structure(index_path, manifest, layout) || !save_manifest(index_path, manifest)) {
+            LOG_ERRORF("%s: failed to write %s", name_.c_str(), index_path.c_str());
+            return false;
+        }
+        index_path_ = index_path;
+        return load_index(index_path);
+    }
+
+    bool DistributedIndexIVF::add_vectors(const std::vector<float> &vectors, const std::vector<int64_t> &ids) {
+        if (vectors.size() != ids.size() * dimension_) {
+            LOG_ERRORF("add_vectors got %zu floats for %zu ids (d=%d)", vectors.size(), ids.size(), dimension_);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        // decided under the lock, so of two first calls only one trains and the
+        // other inserts into its lists
+        if (!is_trained_ || global_centroid_ids_.empty()) {
+            return build_index_locked(vectors.data(), ids.data(), static_cast<int64_t>(ids.size()));
+        }
+        return insert_vectors(vectors.data(), ids.data(), static_cast<int64_t>(ids.size()));
+    }
+
+    bool DistributedIndexIVF::remove_vector(int64_t id) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        // ids are not routed by value, so every shard is asked; each lookup is a hash probe
+        for (auto &[shard_id, shard]: shards_) {
+            if (shard->remove_id(id)) {
+                attributes_.remove(id);
+                --ntotal_;
+                version_.fetch_add(1, std::memory_order_release);
+                {
+                    std::lock_guard<std::mutex> wake(compaction_mutex_);
+                    compaction_wanted_ = true;
+                }
+                compaction_cv_.notify_one();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool DistributedIndexIVF::update_vector(int64_t id, const std::vector<float> &vector) {
+        if (vector.size() != static_cast<size_t>(dimension_)) {
+            LOG_ERRORF("update_vector got %zu floats (d=%d)", vector.size(), dimension_);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        // assigned first, so a row that would move to a remote shard is left in place
+        AssignedRows rows;
+        assign_rows(vector.data(), &id, 1, &rows);
+        if (!local_rows(rows)) {
+            return false;
+        }
+        bool removed = false;
+        for (auto &[shard_id, shard]: shards_) {
+            if (shard->remove_id(id)) {
+                removed = true;
+                break;
+            }
+        }
+        if (!removed) {
+            return false;
+        }
+        // ntotal_ is unchanged: append_rows counts the row back in
+        --ntotal_;
+        return append_rows(rows);
+    }
+
+    size_t DistributedIndexIVF::compact(float max_deleted_ratio) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        size_t rewritten = 0;
+        for (auto &[shard_id, shard]: shards_) {
+            rewritten += shard->compact(max_deleted_ratio);
+        }
+        // the lists rewritten are unpublished now; free them once no search holds them
+        get_epoch_domain().reclaim();
+        return rewritten;
+    }
+
+    void DistributedIndexIVF::start_compaction(float max_deleted_ratio, std::chrono::milliseconds interval) {
+        stop_compaction();
+        compaction_stop_ = false;
+        compaction_thread_ = std::thread([this, max_deleted_ratio, interval] {
+            std::unique_lock<std::mutex> lock(compaction_mutex_);
+            while (!compaction_stop_) {
+                compaction_cv_.wait_for(lock, interval, [this] { return compaction_stop_ || compaction_wanted_; });
+                if (compaction_stop_) {
+                    break;
+                }
+                compaction_wanted_ = false;
+                lock.unlock();
+                compact(max_deleted_ratio);
+                lock.lock();
+            }
+        });
+    }
+
+    void DistributedIndexIVF::stop_compaction() {
+        if (!compaction_thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(compaction_mutex_);
+            compaction_stop_ = true;
+        }
+        compaction_cv_.notify_one();
+        compaction_thread_.join();
+    }
+
+    DistributedIndexIVF::~DistributedIndexIVF() {
+        stop_warm();
+        stop_maintenance();
+        stop_rebalancing();
+        stop_compaction();
+        delete placement_.load();
+        delete centroid_table_.load();
+    }
+
+    bool DistributedIndexIVF::insert_vectors(const float *x, const int64_t *ids, int64_t n) {
+        if (n == 0) {
+            return true;
+        }
+        AssignedRows rows;
+        assign_rows(x, ids, n, &rows);
+        return append_rows(rows);
+    }
+
+    bool DistributedIndexIVF::local_rows(const AssignedRows &rows) const {
+        for (int shard_id = 0; shard_id < shard_counts_; ++shard_id) {
+            if (!rows.shard_postings[shard_id].empty() && is_remote(shard_id)) {
+                // ShardClient carries searches only, so there is no way to forward them
+                LOG_ERRORF("%s: rows fall in lists of shard %d on node %s; insert them there", name_.c_str(),
+                           shard_id, shards_.at(shard_id)->node_id().c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void DistributedIndexIVF::assign_rows(const float *x, const int64_t *ids, int64_t n, AssignedRows *out) const {
+        std::vector<float> normalized;
+        const float *input = normalize_for_metric(x, static_cast<size_t>(n), &normalized);
+
+        auto guard = get_epoch_domain().pin();
+        const CentroidTable *table = centroid_table_.load(std::memory_order_seq_cst);
+        std::vector<float> errors;
+        const std::vector<int64_t> assignments =
+            table ? assign_vectors(*table, input, n, &errors) : std::vector<int64_t>(n, 0);
+        const ShardPlacement *placement = placement_.load(std::memory_order_seq_cst);
+        out->shard_postings.assign(shard_counts_, {});
+        out->rows = n;
+        out->placement_version = placement ? placement->version : 0;
+        out->centroid_version = table ? table->version : 0;
+        out->drift.clear();
+        for (int64_t i = 0; i < n; ++i) {
+            const int64_t centroid = assignments[i];
+            auto &inv = out->shard_postings[placement_shard(placement, centroid)][centroid];
+            inv.vector_ids.push_back(ids[i]);
+            inv.vectors.insert(inv.vectors.end(), input + i * dimension_, input + (i + 1) * dimension_);
+            if (!errors.empty()) {
+                auto &[rows, error] = out->drift[centroid];
+                rows += 1;
+                error += errors[i];
+            }
+        }
+    }
+
+    bool DistributedIndexIVF::append_rows(AssignedRows &rows) {
+        // centroids and placements only change under write_mutex_, which the caller holds
+        const CentroidTable *table = centroid_table_.load(std::memory_order_acquire);
+        if (table && table->version != rows.centroid_version) {
+            // a maintenance pass may have merged away the lists the rows were assigned to
+            InvertedList all;
+            for (auto &postings: rows.shard_postings) {
+                for (auto &[centroid, inv]: postings) {
+                    all.vector_ids.insert(all.vector_ids.end(), inv.vector_ids.begin(), inv.vector_ids.end());
+                    all.vectors.insert(all.vectors.end(), inv.vectors.begin(), inv.vectors.end());
+                }
+            }
+            assign_rows(all.vectors.data(), all.vector_ids.data(), static_cast<int64_t>(all.vector_ids.size()),
+                        &rows);
+        }
+        const ShardPlacement *placement = placement_.load(std::memory_order_acquire);
+        if (placement && placement->version != rows.placement_version) {
+            std::vector<std::unordered_map<int64_t, InvertedList>> regrouped(shard_counts_);
+            for (auto &postings: rows.shard_postings) {
+                for (auto &[centroid, inv]: postings) {
+                    regrouped[placement_shard(placement, centroid)][centroid] = std::move(inv);
+                }
+            }
+            rows.shard_postings = std::move(regrouped);
+            rows.placement_version = placement->version;
+        }
+        // nothing is applied unless every row stays on this node
+        if (!local_rows(rows)) {
+            return false;
+        }
+        for (const auto &[centroid, drift]: rows.drift) {
+            if (centroid < 0 || static_cast<size_t>(centroid) >= list_drift_.size()) {
+                continue;
+            }
+            ListDrift &list = list_drift_[centroid];
+            list.added_rows += drift.first;
+            list.added_error += drift.second;
+            if (list.trained_error < 0.0 && list.added_rows >= kDriftMinRows) {
+                // no baseline since a load: the first rows added set it
+                list.trained_error = list.added_error / static_cast<double>(list.added_rows);
+                list.trained_rows += list.added_rows;
+                list.added_rows = 0;
+                list.added_error = 0.0;
+            }
+        }
+        for (int shard_id = 0; shard_id < shard_counts_; ++shard_id) {
+            if (!rows.shard_postings[shard_id].empty()) {
+                shards_[shard_id]->append_postings(rows.shard_postings[shard_id]);
+            }
+        }
+        ntotal_ += rows.rows;
+        version_.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    std::unique_ptr<IndexShard::PreparedInsert> DistributedIndexIVF::prepare_insert(std::vector<float> vectors,
+                                                                                   std::vector<int64_t> ids) {
+        if (!accepts_prepared_insert() || vectors.size() != ids.size() * dimension_) {
+            // committed through add_vectors, which trains or reports the size mismatch
+            return IndexShard::prepare_insert(std::move(vectors), std::move(ids));
+        }
+        auto rows = std::make_unique<AssignedRows>();
+        assign_rows(vectors.data(), ids.data(), static_cast<int64_t>(ids.size()), rows.get());
+        return rows;
+    }
+
+    bool DistributedIndexIVF::commit_insert(PreparedInsert &prepared) {
+        auto *rows = dynamic_cast<AssignedRows *>(&prepared);
+        if (!rows) {
+            return add_vectors(prepared.vectors, prepared.ids);
+        }
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        return append_rows(*rows);
+    }
+
+    std::vector<InternalSearchResult> DistributedIndexIVF::search(const std::vector<float> &query, int k) {
+        return search(query, k, InternalSearchParameters{});
+    }
+
+    std::vector<InternalSearchResult> DistributedIndexIVF::search(const std::vector<float> &query, int k,
+                                                                  const InternalSearchParameters &params) {
+        DANN_TRACE_SPAN("search", "search");
+        const bool sampled = sample_search();
+        QueryStats sampled_stats;
+        QueryStats *stats = params.stats ? params.stats : sampled ? &sampled_stats : nullptr;
+        StageClock clock(stats != nullptr);
+        // a filter nothing matches leaves nothing to scan
+        const std::shared_ptr<const RoaringBitmap> filter = resolve_filter(params);
+        if (filter && filter->empty()) {
+            return {};
+        }
+        // the centroids and the placement stay valid, and the lists where they route, until the guard drops
+        auto guard = get_epoch_domain().pin();
+        const CentroidTable *table = centroid_table_.load(std::memory_order_seq_cst);
+        if (!table || table->nlist == 0) {
+            return {};
+        }
+        const int nprobe = effective_nprobe(*table, params, filter_selectivity(filter.get()));
+        const int depth = candidate_depth(k);
+        TraceSpan centroid_span("search", "search.centroid");
+        std::vector<float> normalized;
+        const float *q = normalize_for_metric(query.data(), 1, &normalized);
+        const std::vector<float> &shard_query = normalized.empty() ? query : normalized;
+        // 从global_vectors中找到nprobe和query最近的向量
+        std::vector<DistanceWithIndex> closest_centroids = probe_centroids(*table, q, nprobe);
+        centroid_span.end();
+        if (stats) {
+            stats->centroid_ms = clock.lap();
+        }
+
+        TraceSpan route_span("search", "search.route");
+        const ShardPlacement *placement = placement_.load(std::memory_order_seq_cst);
+        const bool count_probes = placement && track_probes_.load(std::memory_order_relaxed);
+        std::unordered_map<int, std::vector<int64_t> > query_centroids_map;
+        for (const auto &centroid: closest_centroids) {
+            const int64_t centroid_id = centroid.index;
+            if (count_probes) {
+                placement->count_probe(centroid_id);
+            }
+            query_centroids_map[placement_shard(placement, centroid_id)].push_back(centroid_id);
+        }
+
+        // remote shards are asked first so their round trips overlap the local scans
+        std::vector<InternalShardSearchRequest> remote_requests;
+        // shard scans are CPU bound: fork-join on the compute executor, one task per shard
+        std::vector<std::pair<int, const std::vector<int64_t> *>> probes;
+        probes.reserve(query_centroids_map.size());
+        for (const auto &[shard_id, centroids]: query_centroids_map) {
+            if (!is_remote(shard_id)) {
+                probes.emplace_back(shard_id, &centroids);
+                continue;
+            }
+            InternalShardSearchRequest request;
+            request.shard_id = shard_id;
+            request.centroid_ids = centroids;
+            request.query = shard_query;
+            request.k = depth;
+            request.include_vectors = shard_vectors(params);
+            request.filter = params.filter;
+            remote_requests.push_back(std::move(request));
+        }
+        auto remote = send_remote(std::move(remote_requests), params);
+        route_span.end();
+        if (stats) {
+            stats->routing_ms = clock.lap();
+        }
+        std::vector<std::vector<InternalSearchResult>> shard_results(probes.size());
+        std::vector<int> probe_shards;
+        probe_shards.reserve(probes.size());
+        for (const auto &probe: probes) {
+            probe_shards.push_back(probe.first);
+        }
+        // per probe: time waiting for a worker, scan time and what the scan touched
+        std::vector<double> waits(stats ? probes.size() : 0);
+        std::vector<double> scans(stats ? probes.size() : 0);
+        std::vector<ScanStats> scanned(stats ? probes.size() : 0);
+        const StageClock::Clock::time_point dispatched = clock.last();
+        run_shard_scans(probe_shards, [&](size_t i) {
+            StageClock::Clock::time_point begin;
+            if (stats) {
+                begin = StageClock::Clock::now();
+                waits[i] = StageClock::ms(dispatched, begin);
+            }
+            shard_results[i] = shards_[probes[i].first]->search(*probes[i].second, shard_query, depth,
+                                                                 shard_vectors(params),
+                                                                 stats ? &scanned[i] : nullptr, filter.get());
+            if (stats) {
+                scans[i] = StageClock::ms(begin, StageClock::Clock::now());
+            }
+        });
+        if (stats) {
+            clock.lap();
+        }
+        if (remote) {
+            DANN_TRACE_SPAN("search", "search.remote_wait");
+            for (auto &reply: collect_remote(*remote, params)) {
+                shard_results.push_back(std::move(reply.results));
+            }
+        }
+        if (stats) {
+            stats->remote_ms = clock.lap();
+        }
+        // every shard list is sorted already: a k-way merge, not a sort of the union
+        TraceSpan merge_span("search", "search.merge");
+        std::vector<InternalSearchResult> results = merge_top_k(shard_results, depth);
+        merge_span.end();
+        if (depth > k) {
+            if (stats) {
+                stats->merge_ms = clock.lap();
+                stats->vectors_reranked = results.size();
+            }
+            rerank(q, &results, k);
+            if (stats) {
+                stats->rerank_ms = clock.lap();
+            }
+        }
+        if (params.include_vectors && vector_source_) {
+            fetch_vectors(&results);
+        }
+        if (stats) {
+            stats->merge_ms += clock.lap();
+            stats->total_ms = clock.total();
+            stats->queries = 1;
+            stats->lists_probed = closest_centroids.size();
+            for (size_t i = 0; i < scanned.size(); ++i) {
+                stats->queue_wait_ms = std::max(stats->queue_wait_ms, waits[i]);
+                stats->scan_ms = std::max(stats->scan_ms, scans[i]);
+                stats->vectors_scanned += scanned[i].vectors_scanned;
+            }
+            if (sampled) {
+                record_stages(*stats);
+            }
+        }
+        return results;
+    }
+
+    std::vector<std::vector<InternalSearchResult>> DistributedIndexIVF::search_batch(const float *queries, size_t nq,
+                                                                                    int k,
+                                                                                    const InternalSearchParameters &params) {
+        std::vector<std::vector<InternalSearchResult>> results(nq);
+        if (nq == 0 || k <= 0) {
+            return results;
+        }
+        // the centroids and the placement stay valid, and the lists where they route, until the guard drops
+        auto guard = get_epoch_domain().pin();
+        const CentroidTable *table = centroid_table_.load(std::memory_order_seq_cst);
+        if (!table || table->nlist == 0) {
+            return results;
+        }
+        DANN_TRACE_SPAN("search", "search_batch");
+        const std::shared_ptr<const RoaringBitmap> filter = resolve_filter(params);
+        if (filter && filter->empty()) {
+            return results;
+        }
+        const size_t nprobe = static_cast<size_t>(effective_nprobe(*table, params, filter_selectivity(filter.get())));
+        const int depth = candidate_depth(k);
+        const bool sampled = sample_search();
+        QueryStats sampled_stats;
+        QueryStats *stats = params.stats ? params.stats : sampled ? &sampled_stats : nullptr;
+        StageClock clock(stats != nullptr);
+
+        TraceSpan centroid_span("search", "search_batch.centroid");
+        std::vector<float> normalized;
+        queries = normalize_for_metric(queries, nq, &normalized);
+
+        // 1) assign all queries to their nprobe nearest centroids, in one blocked (BLAS) pass
+        // or through the coarse quantizer
+        std::vector<float> centroid_distances(nq * nprobe);
+        std::vector<faiss::idx_t> centroid_labels(nq * nprobe, -1);
+        ComputeExecutor &executor = get_compute_executor();
+        nearest_centroids(*table, queries, nq, static_cast<int>(nprobe), centroid_distances.data(),
+                          centroid_labels.data());
+        centroid_span.end();
+
+        if (stats) {
+            stats->centroid_ms = clock.lap();
+        }
+
+        // 2) group (query, posting) pairs per shard so that each posting is read once
+        TraceSpan route_span("search", "search_batch.route");
+        const ShardPlacement *placement = placement_.load(std::memory_order_seq_cst);
+        const bool count_probes = placement && track_probes_.load(std::memory_order_relaxed);
+        std::unordered_map<int, std::unordered_map<int64_t, std::vector<int64_t> > > shard_postings;
+        for (size_t qi = 0; qi < nq; ++qi) {
+            for (size_t p = 0; p < nprobe; ++p) {
+                const faiss::idx_t label = centroid_labels[qi * nprobe + p];
+                if (label < 0) {
+                    continue;
+                }
+                const int64_t centroid = label;
+                if (count_probes) {
+                    placement->count_probe(centroid);
+                }
+                shard_postings[placement_shard(placement, centroid)][centroid].push_back(static_cast<int64_t>(qi));
+            }
+        }
+
+        // 3) one task per shard scores every query that probes it
+        // remote shards get one request per query probing them, sent before the local scans
+        std::vector<InternalShardSearchRequest> remote_requests;
+        std::vector<size_t> remote_queries;
+        std::vector<std::pair<int, const std::unordered_map<int64_t, std::vector<int64_t> > *> > probes;
+        probes.reserve(shard_postings.size());
+        for (const auto &[shard_id, centroid_queries]: shard_postings) {
+            if (!is_remote(shard_id)) {
+                probes.emplace_back(shard_id, &centroid_queries);
+                continue;
+            }
+            std::map<size_t, std::vector<int64_t> > query_centroids;
+            for (const auto &[centroid, query_ids]: centroid_queries) {
+                for (int64_t qi: query_ids) {
+                    query_centroids[static_cast<size_t>(qi)].push_back(centroid);
+                }
+            }
+            for (auto &[qi, centroids]: query_centroids) {
+                InternalShardSearchRequest request;
+                request.shard_id = shard_id;
+                request.centroid_ids = std::move(centroids);
+                request.query.assign(queries + qi * dimension_, queries + (qi + 1) * dimension_);
+                request.k = depth;
+                request.include_vectors = shard_vectors(params);
+                request.filter = params.filter;
+                remote_requests.push_back(std::move(request));
+                remote_queries.push_back(qi);
+            }
+        }
+        auto remote = send_remote(std::move(remote_requests), params);
+        route_span.end();
+        if (stats) {
+            stats->routing_ms = clock.lap();
+        }
+        std::vector<std::vector<std::vector<InternalSearchResult> > > per_shard(probes.size());
+        std::vector<int> probe_shards;
+        probe_shards.reserve(probes.size());
+        for (const auto &probe: probes) {
+            probe_shards.push_back(probe.first);
+        }
+        std::vector<double> waits(stats ? probes.size() : 0);
+        std::vector<double> scans(stats ? probes.size() : 0);
+        std::vector<ScanStats> scanned(stats ? probes.size() : 0);
+        const StageClock::Clock::time_point dispatched = clock.last();
+        run_shard_scans(probe_shards, [&](size_t i) {
+            StageClock::Clock::time_point begin;
+            if (stats) {
+                begin = StageClock::Clock::now();
+                waits[i] = StageClock::ms(dispatched, begin);
+            }
+            per_shard[i] = shards_[probes[i].first]->search_batch(*probes[i].second, queries, nq, depth,
+                                                                   shard_vectors(params),
+                                                                   stats ? &scanned[i] : nullptr, filter.get());
+            if (stats) {
+                scans[i] = StageClock::ms(begin, StageClock::Clock::now());
+            }
+        });
+        if (stats) {
+            clock.lap();
+        }
+
+        // 4) per query k-way merge of the sorted shard top-k lists
+        TraceSpan merge_span("search", "search_batch.merge");
+        std::vector<std::vector<std::vector<InternalSearchResult> > > lists(nq);
+        for (auto &shard_results: per_shard) {
+            for (size_t qi = 0; qi < nq; ++qi) {
+                lists[qi].push_back(std::move(shard_results[qi]));
+            }
+        }
+        if (remote) {
+            if (stats) {
+                stats->merge_ms = clock.lap();
+            }
+            DANN_TRACE_SPAN("search", "search_batch.remote_wait");
+            auto replies = collect_remote(*remote, params);
+            for (size_t slot = 0; slot < replies.size(); ++slot) {
+                lists[remote_queries[slot]].push_back(std::move(replies[slot].results));
+            }
+            if (stats) {
+                stats->remote_ms = clock.lap();
+            }
+        }
+        // re-ranking runs inside the merge here and is counted as merge time
+        std::vector<size_t> reranked(stats && depth > k ? nq : 0);
+        executor.parallel_for(0, nq, 64, [&](size_t lo, size_t hi) {
+            for (size_t qi = lo; qi < hi; ++qi) {
+                results[qi] = merge_top_k(lists[qi], depth);
+                if (depth > k) {
+                    if (!reranked.empty()) {
+                        reranked[qi] = results[qi].size();
+                    }
+                    rerank(queries + qi * dimension_, &results[qi], k);
+                }
+                if (params.include_vectors && vector_source_) {
+                    fetch_vectors(&results[qi]);
+                }
+            }
+        });
+        merge_span.end();
+        if (stats) {
+            stats->merge_ms += clock.lap();
+            stats->total_ms = clock.total();
+            stats->queries = nq;
+            for (size_t qi = 0; qi < nq * nprobe; ++qi) {
+                stats->lists_probed += centroid_labels[qi] >= 0 ? 1 : 0;
+            }
+            for (size_t n: reranked) {
+                stats->vectors_reranked += n;
+            }
+            for (size_t i = 0; i < scanned.size(); ++i) {
+                stats->queue_wait_ms = std::max(stats->queue_wait_ms, waits[i]);
+                stats->scan_ms = std::max(stats->scan_ms, scans[i]);
+                stats->vectors_scanned += scanned[i].vectors_scanned;
+            }
+            if (sampled) {
+                record_stages(*stats);
+            }
+        }
+        return results;
+    }
+
+    void DistributedIndexIVF::train_quantizer(const float *train_vectors, int64_t n_train) {
+        quantizer_ = make_quantizer(dimension_, quantization_);
+        if (quantizer_ && metric_ != DistanceType::L2) {
+            LOG_ERRORF("%s: quantization supports the L2 metric only, keeping raw postings", name_.c_str());
+            quantizer_.reset();
+        }
+        if (quantizer_) {
+            // only residual quantizers need their own copy of the sample
+            std::vector<float> train_input;
+            if (quantizer_->by_residual()) {
+                train_input.assign(train_vectors, train_vectors + n_train * dimension_);
+                std::vector<float> distances(n_train);
+                std::vector<faiss::idx_t> labels(n_train);
+                knn_centroids(train_vectors, n_train, global_centroids_.data(), global_centroid_ids_.size(),
+                              dimension_, DistanceType::L2, 1, distances.data(), labels.data(), gpu_);
+                for (int64_t i = 0; i < n_train; ++i) {
+                    const float *c = global_centroids_.data() + labels[i] * dimension_;
+                    for (int j = 0; j < dimension_; ++j) {
+                        train_input[i * dimension_ + j] -= c[j];
+                    }
+                }
+            }
+            const float *input = train_input.empty() ? train_vectors : train_input.data();
+            if (!quantizer_->train(input, static_cast<size_t>(n_train))) {
+                LOG_ERRORF("%s: quantizer training failed, keeping raw postings", name_.c_str());
+                quantizer_.reset();
+            }
+        }
+
+        auto centroids = quantizer_ ? std::make_shared<const std::vector<float>>(global_centroids_) : nullptr;
+        for (auto &[shard_id, shard]: shards_) {
+            shard->set_quantizer(quantizer_, centroids, quantization_.refine_factor);
+        }
+    }
+
+    std::vector<int64_t> DistributedIndexIVF::sample_training_rows(int64_t total_vectors, int64_t n_train) const {
+        if (n_train >= total_vectors) {
+            return {};
+        }
+        // Reservoir sampling algorithm - O(N) time, O(K) space, seeded so rebuilds
+        // of the same input train the same centroids
+        std::mt19937_64 gen(static_cast<uint64_t>(clustering_params_.seed));
+        std::vector<int64_t> reservoir(n_train);
+        std::iota(reservoir.begin(), reservoir.end(), 0);
+        for (int64_t i = n_train; i < total_vectors; ++i) {
+            std::uniform_int_distribution<int64_t> dist(0, i);
+            int64_t j = dist(gen);
+            if (j < n_train) {
+                reservoir[j] = i;
+            }
+        }
+        // gathered in storage order
+        std::sort(reservoir.begin(), reservoir.end());
+        return reservoir;
+    }
+
+    std::vector<int64_t> DistributedIndexIVF::assign_vectors(const CentroidTable &table, const float *x, int64_t n,
+                                                             std::vector<float> *errors) const {
+        // streamed through fixed-size blocks so the distance scratch stays bounded;
+        // each block is one GEMM-backed knn call that faiss spreads over the OpenMP threads
+        std::vector<int64_t> assignments(n, 0);
+        if (errors) {
+            errors->assign(n, 0.0f);
+        }
+        if (table.nlist == 0) {
+            return assignments;
+        }
+        std::vector<float> distances(std::min(n, kAssignBlockRows));
+        std::vector<faiss::idx_t> labels(distances.size());
+        for (int64_t begin = 0; begin < n; begin += kAssignBlockRows) {
+            const int64_t rows = std::min(kAssignBlockRows, n - begin);
+            const float *block = x + begin * dimension_;
+            nearest_centroids(table, block, rows, 1, distances.data(), labels.data(), true);
+            for (int64_t i = 0; i < rows; ++i) {
+                assignments[begin + i] = labels[i] < 0 ? 0 : labels[i];
+            }
+        }
+        if (errors) {
+            get_compute_executor().parallel_for(0, static_cast<size_t>(n), 1024, [&](size_t lo, size_t hi) {
+                for (size_t i = lo; i < hi; ++i) {
+                    (*errors)[i] = l2_sqr(x + i * dimension_, table.centroids.data() + assignments[i] * dimension_,
+                                          dimension_);
+                }
+            });
+        }
+        return assignments;
+    }
+
+    void DistributedIndexIVF::split_oversized_lists(const float *x, std::vector<int64_t> *assignments) {
+        const int64_t n = static_cast<int64_t>(assignments->size());
+        int64_t num_centroids = static_cast<int64_t>(global_centroid_ids_.size());
+        const int64_t cap = std::max<int64_t>(
+            1, static_cast<int64_t>(std::ceil(max_list_factor_ * static_cast<double>(n) / num_centroids)));
+
+        std::vector<std::vector<int64_t>> members(num_centroids);
+        for (int64_t i = 0; i < n; ++i) {
+            members[(*assignments)[i]].push_back(i);
+        }
+        // largest list first; a split part that is still over the cap goes back in
+        std::priority_queue<std::pair<size_t, int64_t>> oversized;
+        for (int64_t c = 0; c < num_centroids; ++c) {
+            if (static_cast<int64_t>(members[c].size()) > cap) {
+                oversized.emplace(members[c].size(), c);
+            }
+        }
+
+        ClusteringParameters cp = clustering_params_;
+        cp.metric = metric_;
+        if (gpu_.enabled) {
+            cp.gpu = gpu_;
+        }
+        cp.niter = 10;
+        cp.nredo = 1;
+        cp.batch_size = 0;
+        cp.min_points_per_centroids = 1;
+        int64_t nsplit = 0;
+        std::vector<float> points;
+        while (!oversized.empty()) {
+            const int64_t c = oversized.top().second;
+            oversized.pop();
+            std::vector<int64_t> rows = std::move(members[c]);
+            const int parts = static_cast<int>((static_cast<int64_t>(rows.size()) + cap - 1) / cap);
+            points.resize(rows.size() * dimension_);
+            for (size_t i = 0; i < rows.size(); ++i) {
+                std::copy(x + rows[i] * dimension_, x + (rows[i] + 1) * dimension_, points.begin() + i * dimension_);
+            }
+            Clustering clustering(dimension_, parts, cp);
+            clustering.train(points.data(), rows.size());
+
+            std::vector<float> distances(rows.size());
+            std::vector<faiss::idx_t> labels(rows.size());
+            knn_centroids(points.data(), rows.size(), clustering.centroids.data(), parts, dimension_, metric_, 1,
+                          distances.data(), labels.data(), gpu_);
+            std::vector<std::vector<int64_t>> split(parts);
+            for (size_t i = 0; i < rows.size(); ++i) {
+                split[std::max<faiss::idx_t>(labels[i], 0)].push_back(rows[i]);
+            }
+            const size_t largest = std::max_element(split.begin(), split.end(), [](const auto &a, const auto &b) {
+                return a.size() < b.size();
+            })->size();
+            if (largest == rows.size()) {
+                // duplicates k-means cannot separate; the list stays as it is
+                members[c] = std::move(rows);
+                continue;
+            }
+
+            // the first non-empty part keeps centroid c, the others become new
+            // centroids at the end; an empty part 0 must not leave c with no list
+            bool reseated = false;
+            for (int p = 0; p < parts; ++p) {
+                if (split[p].empty()) {
+                    continue;
+                }
+                int64_t target = c;
+                if (reseated) {
+                    target = num_centroids++;
+                    global_centroids_.resize(num_centroids * dimension_);
+                    global_centroid_ids_.push_back(static_cast<int>(target));
+                    members.emplace_back();
+                }
+                reseated = true;
+                std::copy(clustering.centroids.begin() + p * dimension_,
+                          clustering.centroids.begin() + (p + 1) * dimension_,
+                          global_centroids_.begin() + target * dimension_);
+                for (int64_t row: split[p]) {
+                    (*assignments)[row] = target;
+                }
+                members[target] = std::move(split[p]);
+                if (static_cast<int64_t>(members[target].size()) > cap) {
+                    oversized.emplace(members[target].size(), target);
+                }
+            }
+            ++nsplit;
+        }
+        if (nsplit > 0) {
+            LOG_INFOF("%s: split %ld lists over %ld rows, nlist is now %ld", name_.c_str(), nsplit, cap,
+                      num_centroids);
+        }
+    }
+
+    std::vector<InvertedList> DistributedIndexIVF::scatter_postings(const float *x, const int64_t *ids,
+                                                                    const std::vector<int64_t> &assignments,
+                                                                    int64_t num_centroids,
+                                                                    std::vector<int64_t> *counts) const {
+        const int64_t n = static_cast<int64_t>(assignments.size());
+        // rows are cut into contiguous chunks; chunk t writes after chunks < t in every
+        // list, so postings keep input order exactly as a serial pass would
+        ComputeExecutor &executor = get_compute_executor();
+        const int nchunks = static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(executor.size(), n)));
+        auto chunk_begin = [n, nchunks](size_t t) { return n * static_cast<int64_t>(t) / nchunks; };
+        const size_t centroid_grain = 1024;
+
+        // per-chunk histograms, turned in place into per-chunk write offsets
+        std::vector<int64_t> offsets(static_cast<size_t>(nchunks) * num_centroids, 0);
+        executor.parallel_for(0, nchunks, 1, [&](size_t lo, size_t hi) {
+            for (size_t t = lo; t < hi; ++t) {
+                int64_t *hist = offsets.data() + t * num_centroids;
+                for (int64_t i = chunk_begin(t); i < chunk_begin(t + 1); ++i) {
+                    ++hist[assignments[i]];
+                }
+            }
+        });
+        counts->assign(num_centroids, 0);
+        executor.parallel_for(0, num_centroids, centroid_grain, [&](size_t lo, size_t hi) {
+            for (size_t c = lo; c < hi; ++c) {
+                int64_t total = 0;
+                for (int t = 0; t < nchunks; ++t) {
+                    int64_t &slot = offsets[static_cast<size_t>(t) * num_centroids + c];
+                    const int64_t rows = slot;
+                    slot = total;
+                    total += rows;
+                }
+                (*counts)[c] = total;
+            }
+        });
+
+        std::vector<InvertedList> postings(num_centroids);
+        executor.parallel_for(0, num_centroids, centroid_grain, [&](size_t lo, size_t hi) {
+            for (size_t c = lo; c < hi; ++c) {
+                postings[c].vectors.resize(static_cast<size_t>((*counts)[c]) * dimension_);
+                postings[c].vector_ids.resize(static_cast<size_t>((*counts)[c]));
+            }
+        });
+
+        executor.parallel_for(0, nchunks, 1, [&](size_t lo, size_t hi) {
+            for (size_t t = lo; t < hi; ++t) {
+                int64_t *cursor = offsets.data() + t * num_centroids;
+                for (int64_t i = chunk_begin(t); i < chunk_begin(t + 1); ++i) {
+                    const int64_t centroid = assignments[i];
+                    const int64_t pos = cursor[centroid]++;
+                    const float *src = x + i * dimension_;
+                    std::copy(src, src + dimension_, postings[centroid].vectors.data() + pos * dimension_);
+                    postings[centroid].vector_ids[pos] = ids[i];
+                }
+            }
+        });
+        return postings;
     }
 }
@@ -0,0 +1,143 @@
+//
+// Epoch-based reclamation.
+//
+
+#include "dann/epoch.h"
+
+#include <thread>
+
+namespace dann {
+
+// epoch is 0 while the thread is outside any guard
+struct EpochDomain::ReaderRecord {
+    alignas(64) std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> in_use{false};
+    uint32_t depth{0};
+    ReaderRecord* next{nullptr};
+};
+
+namespace {
+// hands the record back when its thread exits
+struct RecordHolder {
+    EpochDomain::ReaderRecord* record{nullptr};
+    ~RecordHolder();
+};
+thread_local RecordHolder tls_record;
+}
+
+RecordHolder::~RecordHolder() {
+    if (record) {
+        record->in_use.store(false, std::memory_order_release);
+    }
+}
+
+EpochDomain::~EpochDomain() {
+    for (auto& r: retired_) {
+        r.deleter(r.ptr);
+    }
+    ReaderRecord* record = records_.load();
+    while (record) {
+        ReaderRecord* next = record->next;
+        delete record;
+        record = next;
+    }
+}
+
+EpochDomain::ReaderRecord* EpochDomain::acquire_record() {
+    for (ReaderRecord* r = records_.load(std::memory_order_acquire); r; r = r->next) {
+        bool expected = false;
+        if (!r->in_use.load(std::memory_order_relaxed) &&
+            r->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+            return r;
+        }
+    }
+    auto* record = new ReaderRecord();
+    record->in_use.store(true, std::memory_order_relaxed);
+    ReaderRecord* head = records_.load(std::memory_order_relaxed);
+    do {
+        record->next = head;
+    } while (!records_.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+    return record;
+}
+
+EpochDomain::Guard EpochDomain::pin() {
+    ReaderRecord* record = tls_record.record;
+    if (!record) {
+        record = acquire_record();
+        tls_record.record = record;
+    }
+    if (record->depth++ == 0) {
+        // seq_cst store then loads: a writer that unpublished before our store is seen as
+        // such, and one that scans records after it finds us pinned
+        record->epoch.store(epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+    return Guard(record);
+}
+
+EpochDomain::Guard::~Guard() {
+    if (record_ && --record_->depth == 0) {
+        record_->epoch.store(0, std::memory_order_release);
+    }
+}
+
+void EpochDomain::retire(void* p, void (*deleter)(void*)) {
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex_);
+        // readers pinned at this epoch or earlier may hold p
+        retired_.push_back({p, deleter, epoch_.fetch_add(1, std::memory_order_seq_cst)});
+    }
+    reclaim();
+}
+
+size_t EpochDomain::reclaim() {
+    uint64_t oldest = epoch_.load(std::memory_order_seq_cst);
+    for (ReaderRecord* r = records_.load(std::memory_order_acquire); r; r = r->next) {
+        const uint64_t e = r->epoch.load(std::memory_order_seq_cst);
+        if (e != 0 && e < oldest) {
+            oldest = e;
+        }
+    }
+    std::vector<Retired> ready;
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex_);
+        auto it = retired_.begin();
+        while (it != retired_.end()) {
+            if (it->epoch < oldest) {
+                ready.push_back(*it);
+                *it = retired_.back();
+                retired_.pop_back();
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto& r: ready) {
+        r.deleter(r.ptr);
+    }
+    return ready.size();
+}
+
+void EpochDomain::synchronize() {
+    // readers that pin from here on record a later epoch than target
+    const uint64_t target = epoch_.fetch_add(1, std::memory_order_seq_cst);
+    for (ReaderRecord* r = records_.load(std::memory_order_acquire); r; r = r->next) {
+        uint64_t e = r->epoch.load(std::memory_order_seq_cst);
+        while (e != 0 && e <= target) {
+            std::this_thread::yield();
+            e = r->epoch.load(std::memory_order_seq_cst);
+        }
+    }
+}
+
+size_t EpochDomain::pending() const {
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    return retired_.size();
+}
+
+// Global epoch domain (lazy initialization)
+EpochDomain& get_epoch_domain() {
+    static EpochDomain domain;
+    return domain;
+}
+
+}
@@ -0,0 +1,120 @@
+//
+// Exact nearest-centroid search on a faiss GPU when one is available, on the
+// CPU faiss kernels otherwise.
+//
+#include "dann/gpu_knn.h"
+
+#include "dann/logger.h"
+
+#include <faiss/utils/distances.h>
+
+#ifdef DANN_GPU
+#include <faiss/gpu/GpuDistance.h>
+#include <faiss/gpu/StandardGpuResources.h>
+#include <faiss/gpu/utils/DeviceUtils.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#endif
+
+namespace dann {
+
+namespace {
+
+void cpu_knn(const float* x, size_t n, const float* centroids, size_t nc, int d, DistanceType metric, int k,
+             float* distances, faiss::idx_t* labels) {
+    if (metric == DistanceType::L2) {
+        faiss::knn_L2sqr(x, centroids, d, n, nc, k, distances, labels);
+    } else {
+        faiss::knn_inner_product(x, centroids, d, n, nc, k, distances, labels);
+    }
+}
+
+#ifdef DANN_GPU
+// block-select limit of the faiss GPU kernels (GPU_MAX_SELECTION_K)
+constexpr int kGpuMaxK = 2048;
+
+// one resource set (streams, cuBLAS handle, scratch) per device; faiss resources
+// are not safe to share between threads, so each is used under its mutex
+struct GpuDevice {
+    std::mutex mutex;
+    faiss::gpu::StandardGpuResources resources;
+};
+
+GpuDevice* gpu_device(int device) {
+    static std::mutex mutex;
+    static std::map<int, std::unique_ptr<GpuDevice>> devices;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& slot = devices[device];
+    if (!slot) {
+        slot = std::make_unique<GpuDevice>();
+    }
+    return slot.get();
+}
+
+bool gpu_knn(const float* x, size_t n, const float* centroids, size_t nc, int d, DistanceType metric, int k,
+             float* distances, faiss::idx_t* labels, int device) {
+    faiss::gpu::GpuDistanceParams args;
+    args.metric = metric == DistanceType::L2 ? faiss::METRIC_L2 : faiss::METRIC_INNER_PRODUCT;
+    args.k = k;
+    args.dims = d;
+    args.vectors = centroids;
+    args.vectorsRowMajor = true;
+    args.numVectors = static_cast<faiss::idx_t>(nc);
+    args.queries = x;
+    args.queriesRowMajor = true;
+    args.numQueries = static_cast<faiss::idx_t>(n);
+    args.outDistances = distances;
+    args.outIndices = labels;
+    args.outIndicesType = faiss::gpu::IndicesDataType::I64;
+    args.device = device;
+    try {
+        GpuDevice* gpu = gpu_device(device);
+        std::lock_guard<std::mutex> lock(gpu->mutex);
+        // host pointers in and out: bfKnn pages the inputs through device memory in tiles
+        faiss::gpu::bfKnn(&gpu->resources, args);
+        return true;
+    } catch (const std::exception& e) {
+        LOG_WARNF("gpu knn on device %d failed (%s), falling back to the cpu", device, e.what());
+        return false;
+    }
+}
+#endif
+
+}
+
+int gpu_device_count() {
+#ifdef DANN_GPU
+    static const int count = [] {
+        try {
+            return faiss::gpu::getNumDevices();
+        } catch (const std::exception&) {
+            return 0;
+        }
+    }();
+    return count;
+#else
+    return 0;
+#endif
+}
+
+bool gpu_available() {
+    return gpu_device_count() > 0;
+}
+
+void knn_centroids(const float* x, size_t n, const float* centroids, size_t nc, int d, DistanceType metric, int k,
+                   float* distances, faiss::idx_t* labels, const GpuOptions& gpu) {
+#ifdef DANN_GPU
+    if (gpu.enabled && n >= gpu.min_rows && k <= kGpuMaxK && gpu.device >= 0 && gpu.device < gpu_device_count()) {
+        if (gpu_knn(x, n, centroids, nc, d, metric, k, distances, labels, gpu.device)) {
+            return;
+        }
+    }
+#else
+    (void) gpu;
+#endif
+    cpu_knn(x, n, centroids, nc, d, metric, k, distances, labels);
+}
+
+}
@@ -0,0 +1,222 @@
+//
+// Hedged, replica-aware shard requests.
+//
+
+#include "dann/hedged_shard_client.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "dann/metrics.h"
+
+namespace dann {
+
+struct HedgedShardClient::HedgedRequest {
+    std::mutex mutex;
+    InternalShardSearchRequest request;
+    std::chrono::steady_clock::time_point deadline;
+    ShardSearchCallback done;
+    // primary first, then the replicas in hedge / failover order
+    std::vector<std::string> endpoints;
+    size_t next{0};
+    size_t outstanding{0};
+    int hedges{0};
+    bool finished{false};
+    InternalShardSearchResponse last_failure;
+};
+
+HedgedShardClient::HedgedShardClient(std::shared_ptr<ShardClient> inner, HedgingOptions options)
+    : inner_(std::move(inner)), options_(std::move(options)) {
+    options_.window = std::max<size_t>(1, options_.window);
+    timer_thread_ = std::thread([this] { timer_loop(); });
+}
+
+HedgedShardClient::~HedgedShardClient() {
+    {
+        std::lock_guard<std::mutex> lock(timer_mutex_);
+        stop_ = true;
+    }
+    timer_cv_.notify_all();
+    timer_thread_.join();
+    // pending hedges are dropped; the attempts already sent still call back into this
+    std::unique_lock<std::mutex> lock(inflight_mutex_);
+    inflight_cv_.wait(lock, [this] { return inflight_ == 0; });
+}
+
+void HedgedShardClient::set_replicas(const std::string& node, std::vector<std::string> endpoints) {
+    replicas_[node] = std::move(endpoints);
+}
+
+void HedgedShardClient::search_shard(const std::string& node, const InternalShardSearchRequest& request,
+                                     std::chrono::steady_clock::time_point deadline, ShardSearchCallback done) {
+    auto hedged = std::make_shared<HedgedRequest>();
+    hedged->request = request;
+    hedged->deadline = deadline;
+    hedged->done = std::move(done);
+    auto replicas = replicas_.find(node);
+    if (replicas == replicas_.end() || replicas->second.empty()) {
+        hedged->endpoints.push_back(node);
+    } else {
+        // round robin spreads the primaries; the rest keep their order as fallbacks
+        const auto& endpoints = replicas->second;
+        const size_t first = round_robin_.fetch_add(1, std::memory_order_relaxed) % endpoints.size();
+        hedged->endpoints.reserve(endpoints.size());
+        for (size_t i = 0; i < endpoints.size(); ++i) {
+            hedged->endpoints.push_back(endpoints[(first + i) % endpoints.size()]);
+        }
+    }
+    send(hedged);
+    schedule_hedge(hedged);
+}
+
+void HedgedShardClient::send(const std::shared_ptr<HedgedRequest>& hedged) {
+    size_t attempt;
+    {
+        std::lock_guard<std::mutex> lock(hedged->mutex);
+        if (hedged->finished || hedged->next >= hedged->endpoints.size()) {
+            return;
+        }
+        attempt = hedged->next++;
+        ++hedged->outstanding;
+    }
+    {
+        std::lock_guard<std::mutex> lock(inflight_mutex_);
+        ++inflight_;
+    }
+    const std::string& endpoint = hedged->endpoints[attempt];
+    const auto start = std::chrono::steady_clock::now();
+    inner_->search_shard(endpoint, hedged->request, hedged->deadline,
+                         [this, hedged, attempt, start](InternalShardSearchResponse reply) {
+                             on_reply(hedged, attempt, hedged->endpoints[attempt], start, std::move(reply));
+                             std::lock_guard<std::mutex> lock(inflight_mutex_);
+                             if (--inflight_ == 0) {
+                                 inflight_cv_.notify_all();
+                             }
+                         });
+}
+
+void HedgedShardClient::on_reply(const std::shared_ptr<HedgedRequest>& hedged, size_t attempt,
+                                 const std::string& endpoint, std::chrono::steady_clock::time_point start,
+                                 InternalShardSearchResponse reply) {
+    if (reply.success) {
+        record_latency(endpoint, std::chrono::steady_clock::now() - start);
+    }
+    std::unique_lock<std::mutex> lock(hedged->mutex);
+    --hedged->outstanding;
+    if (hedged->finished) {
+        return;
+    }
+    if (reply.success) {
+        hedged->finished = true;
+        lock.unlock();
+        if (attempt > 0) {
+            METRIC_COUNTER_INC("shard_hedge_wins");
+        }
+        hedged->done(std::move(reply));
+        return;
+    }
+    hedged->last_failure = std::move(reply);
+    if (hedged->next < hedged->endpoints.size() && std::chrono::steady_clock::now() < hedged->deadline) {
+        // a replica that failed outright is replaced at once, not after the hedge delay
+        lock.unlock();
+        METRIC_COUNTER_INC("shard_failovers");
+        send(hedged);
+        return;
+    }
+    if (hedged->outstanding > 0) {
+        return;
+    }
+    hedged->finished = true;
+    InternalShardSearchResponse failure = std::move(hedged->last_failure);
+    lock.unlock();
+    hedged->done(std::move(failure));
+}
+
+void HedgedShardClient::schedule_hedge(const std::shared_ptr<HedgedRequest>& hedged) {
+    if (options_.max_hedges <= 0 || hedged->endpoints.size() < 2) {
+        return;
+    }
+    const auto when = std::chrono::steady_clock::now() + hedge_delay(hedged->endpoints[0]);
+    if (when >= hedged->deadline) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(timer_mutex_);
+        timers_.push(Timer{when, [this, hedged] { hedge(hedged); }});
+    }
+    timer_cv_.notify_one();
+}
+
+void HedgedShardClient::hedge(const std::shared_ptr<HedgedRequest>& hedged) {
+    {
+        std::lock_guard<std::mutex> lock(hedged->mutex);
+        if (hedged->finished || hedged->hedges >= options_.max_hedges ||
+            hedged->next >= hedged->endpoints.size()) {
+            return;
+        }
+        ++hedged->hedges;
+    }
+    METRIC_COUNTER_INC("shard_hedges_sent");
+    send(hedged);
+    schedule_hedge(hedged);
+}
+
+std::chrono::microseconds HedgedShardClient::hedge_delay(const std::string& endpoint) {
+    EndpointStats& s = stats(endpoint);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.count < options_.min_samples || s.count == 0) {
+        return std::max(options_.initial_delay, options_.min_delay);
+    }
+    if (s.dirty) {
+        std::vector<int64_t> sorted(s.latencies_us.begin(), s.latencies_us.begin() + std::min(s.count, options_.window));
+        const size_t rank = std::min(sorted.size() - 1,
+                                     static_cast<size_t>(std::ceil(options_.quantile * sorted.size())) - 1);
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        s.quantile_us = sorted[rank];
+        s.dirty = false;
+    }
+    return std::max(std::chrono::microseconds(s.quantile_us), options_.min_delay);
+}
+
+void HedgedShardClient::record_latency(const std::string& endpoint, std::chrono::steady_clock::duration latency) {
+    EndpointStats& s = stats(endpoint);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.latencies_us.empty()) {
+        s.latencies_us.resize(options_.window);
+    }
+    s.latencies_us[s.next] = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    s.next = (s.next + 1) % options_.window;
+    ++s.count;
+    s.dirty = true;
+}
+
+HedgedShardClient::EndpointStats& HedgedShardClient::stats(const std::string& endpoint) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    auto& s = stats_[endpoint];
+    if (!s) {
+        s = std::make_unique<EndpointStats>();
+    }
+    return *s;
+}
+
+void HedgedShardClient::timer_loop() {
+    std::unique_lock<std::mutex> lock(timer_mutex_);
+    while (!stop_) {
+        if (timers_.empty()) {
+            timer_cv_.wait(lock);
+            continue;
+        }
+        const auto when = timers_.top().when;
+        if (std::chrono::steady_clock::now() < when) {
+            timer_cv_.wait_until(lock, when);
+            continue;
+        }
+        Timer timer = timers_.top();
+        timers_.pop();
+        lock.unlock();
+        timer.fire();
+        lock.lock();
+    }
+}
+
+}
@@ -1,5 +1,7 @@
 #include "dann/index.h"
+#include "dann/compute_executor.h"
 #include "dann/index_factory.h"
+#include "dann/utils.h"
 
 #include <algorithm>
 #include <stdexcept>
@@ -12,7 +14,8 @@ Index::Index(std::string name,
              const std::string& index_type,
              int hnsw_m,
              int hnsw_ef_construction,
-             std::vector<std::string> nodes)
+             std::vector<std::string> nodes,
+             DistanceType metric)
     : name_(std::move(name)), dimension_(dimension) {
     if (dimension_ <= 0) {
         throw std::invalid_argument("Dimension must be greater than 0");
@@ -26,13 +29,16 @@ Index::Index(std::string name,
     IndexShardFactory* global_shard_factory = get_global_index_factory();
 
     if (index_type == "IVF") {
-        shards_.push_back(global_shard_factory->create(name, index_type, dimension, shard_count, hnsw_m, hnsw_ef_construction, faiss::METRIC_L2, nodes));
+        shards_.push_back(global_shard_factory->create(name, index_type, dimension, shard_count, hnsw_m, hnsw_ef_construction, metric, nodes));
         return;
     }
+    if (metric != DistanceType::L2) {
+        throw std::invalid_argument("Only IVF indexes support the COSINE and DOT metrics");
+    }
     for (int i = 0; i < shard_count; ++i) {
         shards_.push_back(global_shard_factory->create(name,
             index_type, dimension, shard_count,
-            hnsw_m, hnsw_ef_construction, faiss::METRIC_L2, nodes));
+            hnsw_m, hnsw_ef_construction, metric, nodes));
     }
 }
 
@@ -63,53 +69,264 @@ bool Index::add_vectors(const std::vector<float>& vectors, const std::vector<int
         return shards_[0]->add_vectors(vectors, ids);
     }
 
-    std::vector<std::vector<float>> shard_vectors(shards_.size());
-    std::vector<std::vector<int64_t>> shard_ids(shards_.size());
+    std::vector<std::vector<float>> shard_vectors;
+    std::vector<std::vector<int64_t>> shard_ids;
+    partition_rows(vectors.data(), ids.data(), ids.size(), &shard_vectors, &shard_ids);
 
-    for (size_t i = 0; i < ids.size(); ++i) {
-        const int shard_id = shard_id_for_document(ids[i]);
-        shard_ids[static_cast<size_t>(shard_id)].push_back(ids[i]);
+    // shards are independent: insert into all of them at once
+    std::vector<char> shard_ok(shards_.size(), 1);
+    get_compute_executor().parallel_for(0, shards_.size(), 1, [&](size_t lo, size_t hi) {
+        for (size_t shard = lo; shard < hi; ++shard) {
+            if (!shard_ids[shard].empty()) {
+                shard_ok[shard] = shards_[shard]->add_vectors(shard_vectors[shard], shard_ids[shard]);
+            }
+        }
+    });
+    return std::all_of(shard_ok.begin(), shard_ok.end(), [](char ok) { return ok != 0; });
+}
 
-        auto& vecs = shard_vectors[static_cast<size_t>(shard_id)];
-        const size_t base = i * static_cast<size_t>(dimension_);
-        vecs.insert(vecs.end(),
-                    vectors.begin() + static_cast<long>(base),
-                    vectors.begin() + static_cast<long>(base + static_cast<size_t>(dimension_)));
-    }
+void Index::partition_rows(const float* vectors, const int64_t* ids, size_t n,
+                           std::vector<std::vector<float>>* shard_vectors,
+                           std::vector<std::vector<int64_t>>* shard_ids) const {
+    const size_t nshards = shards_.size();
+    const size_t d = static_cast<size_t>(dimension_);
+    constexpr size_t kChunk = 4096;
+    const size_t nchunks = (n + kChunk - 1) / kChunk;
+    ComputeExecutor& executor = get_compute_executor();
 
-    bool ok = true;
-    for (size_t shard = 0; shard < shards_.size(); ++shard) {
-        if (shard_ids[shard].empty()) {
-            continue;
+    // 1) route and count per chunk, 2) prefix sums give every (chunk, shard) pair its
+    // slice of the presized shard buffers, 3) scatter the chunks in parallel
+    std::vector<uint32_t> route(n);
+    std::vector<size_t> offsets(nchunks * nshards, 0);
+    executor.parallel_for(0, nchunks, 1, [&](size_t lo, size_t hi) {
+        for (size_t c = lo; c < hi; ++c) {
+            size_t* counts = offsets.data() + c * nshards;
+            for (size_t i = c * kChunk; i < std::min(n, (c + 1) * kChunk); ++i) {
+                route[i] = static_cast<uint32_t>(shard_id_for_document(ids[i]));
+                ++counts[route[i]];
+            }
+        }
+    });
+    std::vector<size_t> totals(nshards, 0);
+    for (size_t c = 0; c < nchunks; ++c) {
+        for (size_t s = 0; s < nshards; ++s) {
+            const size_t count = offsets[c * nshards + s];
+            offsets[c * nshards + s] = totals[s];
+            totals[s] += count;
         }
-        ok = ok && shards_[shard]->add_vectors(shard_vectors[shard], shard_ids[shard]);
     }
-
-    return ok;
+    shard_vectors->assign(nshards, {});
+    shard_ids->assign(nshards, {});
+    for (size_t s = 0; s < nshards; ++s) {
+        (*shard_vectors)[s].resize(totals[s] * d);
+        (*shard_ids)[s].resize(totals[s]);
+    }
+    executor.parallel_for(0, nchunks, 1, [&](size_t lo, size_t hi) {
+        for (size_t c = lo; c < hi; ++c) {
+            size_t* next = offsets.data() + c * nshards;
+            for (size_t i = c * kChunk; i < std::min(n, (c + 1) * kChunk); ++i) {
+                const size_t s = route[i];
+                const size_t row = next[s]++;
+                (*shard_ids)[s][row] = ids[i];
+                std::copy(vectors + i * d, vectors + (i + 1) * d, (*shard_vectors)[s].begin() + row * d);
+            }
+        }
+    });
 }
 
 std::vector<InternalSearchResult> Index::search(const std::vector<float>& query, int k) {
-    std::vector<InternalSearchResult> merged;
-    if (k <= 0) {
-        return merged;
-    }
+    return search(query, k, InternalSearchParameters{});
+}
 
+void Index::enable_result_cache(const ResultCacheOptions& options) {
+    cache_ = std::make_unique<ResultCache>(dimension_, options);
+}
+
+uint64_t Index::version() const {
+    uint64_t version = 0;
     for (const auto& shard : shards_) {
-        auto shard_results = shard->search(query, k);
-        merged.insert(merged.end(), shard_results.begin(), shard_results.end());
+        version += shard->version();
     }
+    return version;
+}
 
-    std::sort(merged.begin(), merged.end(), [](const InternalSearchResult& a, const InternalSearchResult& b) {
-        return a.distance < b.distance;
+std::vector<InternalSearchResult> Index::search(const std::vector<float>& query, int k,
+                                                const InternalSearchParameters& params) {
+    if (!cache_ || k <= 0 || query.size() != static_cast<size_t>(dimension_)) {
+        return search_shards(query, k, params);
+    }
+    // read before searching: a write landing meanwhile makes the entry stale at once
+    const uint64_t version = this->version();
+    std::vector<InternalSearchResult> results;
+    if (cache_->lookup(query.data(), k, params, version, &results)) {
+        return results;
+    }
+    results = search_shards(query, k, params);
+    // a partial answer could be missing shards, it is not kept for later queries
+    if (!params.allow_partial) {
+        cache_->insert(query.data(), k, params, version, results);
+    }
+    return results;
+}
+
+std::vector<InternalSearchResult> Index::search_shards(const std::vector<float>& query, int k,
+                                                       const InternalSearchParameters& params) {
+    if (k <= 0 || shards_.empty()) {
+        return {};
+    }
+    // shards are searched concurrently, the caller taking one of them itself
+    std::vector<std::vector<InternalSearchResult>> shard_results(shards_.size());
+    get_compute_executor().parallel_for(0, shards_.size(), 1, [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) {
+            shard_results[i] = shards_[i]->search(query, k, params);
+        }
     });
+    return merge_top_k(shard_results, k);
+}
 
-    if (merged.size() > static_cast<size_t>(k)) {
-        merged.resize(static_cast<size_t>(k));
+std::vector<std::vector<InternalSearchResult>> Index::search_batch(const float* queries, size_t nq, int k,
+                                                                  const InternalSearchParameters& params) {
+    if (!cache_ || k <= 0 || nq == 0) {
+        return search_batch_shards(queries, nq, k, params);
+    }
+    const uint64_t version = this->version();
+    const size_t d = static_cast<size_t>(dimension_);
+    std::vector<std::vector<InternalSearchResult>> results(nq);
+    // only the misses are searched, packed into one batch
+    std::vector<size_t> misses;
+    std::vector<float> miss_queries;
+    for (size_t i = 0; i < nq; ++i) {
+        if (!cache_->lookup(queries + i * d, k, params, version, &results[i])) {
+            misses.push_back(i);
+            miss_queries.insert(miss_queries.end(), queries + i * d, queries + (i + 1) * d);
+        }
+    }
+    if (misses.empty()) {
+        return results;
     }
+    auto searched = search_batch_shards(miss_queries.data(), misses.size(), k, params);
+    for (size_t m = 0; m < misses.size(); ++m) {
+        if (!params.allow_partial) {
+            cache_->insert(miss_queries.data() + m * d, k, params, version, searched[m]);
+        }
+        results[misses[m]] = std::move(searched[m]);
+    }
+    return results;
+}
 
+std::vector<std::vector<InternalSearchResult>> Index::search_batch_shards(const float* queries, size_t nq, int k,
+                                                                         const InternalSearchParameters& params) {
+    if (k <= 0 || nq == 0 || shards_.empty()) {
+        return std::vector<std::vector<InternalSearchResult>>(nq);
+    }
+    if (shards_.size() == 1) {
+        return shards_[0]->search_batch(queries, nq, k, params);
+    }
+    ComputeExecutor& executor = get_compute_executor();
+    std::vector<std::vector<std::vector<InternalSearchResult>>> shard_results(shards_.size());
+    executor.parallel_for(0, shards_.size(), 1, [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) {
+            shard_results[i] = shards_[i]->search_batch(queries, nq, k, params);
+        }
+    });
+    std::vector<std::vector<InternalSearchResult>> merged(nq);
+    executor.parallel_for(0, nq, 64, [&](size_t lo, size_t hi) {
+        std::vector<std::vector<InternalSearchResult>> lists(shards_.size());
+        for (size_t q = lo; q < hi; ++q) {
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                if (q < shard_results[i].size()) {
+                    lists[i] = std::move(shard_results[i][q]);
+                } else {
+                    lists[i].clear();
+                }
+            }
+            merged[q] = merge_top_k(lists, k);
+        }
+    });
     return merged;
 }
 
+bool Index::accepts_prepared_ingest() const {
+    for (const auto& shard : shards_) {
+        if (!shard->accepts_prepared_insert()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<Index::PreparedIngest> Index::prepare_ingest(std::vector<float> vectors, std::vector<int64_t> ids) {
+    if (ids.empty() || vectors.size() != ids.size() * static_cast<size_t>(dimension_)) {
+        return nullptr;
+    }
+    auto prepared = std::make_unique<PreparedIngest>();
+    prepared->shards.resize(shards_.size());
+    if (shards_.size() == 1) {
+        prepared->shards[0] = shards_[0]->prepare_insert(std::move(vectors), std::move(ids));
+        return prepared;
+    }
+
+    std::vector<std::vector<float>> shard_vectors;
+    std::vector<std::vector<int64_t>> shard_ids;
+    partition_rows(vectors.data(), ids.data(), ids.size(), &shard_vectors, &shard_ids);
+    get_compute_executor().parallel_for(0, shards_.size(), 1, [&](size_t lo, size_t hi) {
+        for (size_t shard = lo; shard < hi; ++shard) {
+            if (!shard_ids[shard].empty()) {
+                prepared->shards[shard] = shards_[shard]->prepare_insert(std::move(shard_vectors[shard]),
+                                                                         std::move(shard_ids[shard]));
+            }
+        }
+    });
+    return prepared;
+}
+
+bool Index::commit_ingest(PreparedIngest& prepared) {
+    const size_t nshards = std::min(shards_.size(), prepared.shards.size());
+    std::vector<char> shard_ok(nshards, 1);
+    get_compute_executor().parallel_for(0, nshards, 1, [&](size_t lo, size_t hi) {
+        for (size_t shard = lo; shard < hi; ++shard) {
+            if (prepared.shards[shard]) {
+                shard_ok[shard] = shards_[shard]->commit_insert(*prepared.shards[shard]);
+            }
+        }
+    });
+    return std::all_of(shard_ok.begin(), shard_ok.end(), [](char ok) { return ok != 0; });
+}
+
+bool Index::remove_vector(int64_t id) {
+    if (shards_.empty()) {
+        return false;
+    }
+    return shards_[static_cast<size_t>(shard_id_for_document(id))]->remove_vector(id);
+}
+
+bool Index::update_vector(int64_t id, const std::vector<float>& vector) {
+    if (shards_.empty() || vector.size() != static_cast<size_t>(dimension_)) {
+        return false;
+    }
+    return shards_[static_cast<size_t>(shard_id_for_document(id))]->update_vector(id, vector);
+}
+
+bool Index::set_attributes(const std::vector<int64_t>& ids, const std::vector<Attributes>& attributes) {
+    if (shards_.empty() || ids.size() != attributes.size()) {
+        return false;
+    }
+    std::vector<std::vector<int64_t>> shard_ids(shards_.size());
+    std::vector<std::vector<Attributes>> shard_attributes(shards_.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        const auto shard = static_cast<size_t>(shard_id_for_document(ids[i]));
+        shard_ids[shard].push_back(ids[i]);
+        shard_attributes[shard].push_back(attributes[i]);
+    }
+    bool ok = true;
+    for (size_t shard = 0; shard < shards_.size(); ++shard) {
+        if (!shard_ids[shard].empty()) {
+            ok = shards_[shard]->set_attributes(shard_ids[shard], shard_attributes[shard]) && ok;
+        }
+    }
+    return ok;
+}
+
 size_t Index::size() const {
     size_t total = 0;
     for (const auto& shard : shards_) {
@@ -8,11 +8,12 @@
 namespace dann {
 
 std::shared_ptr<IndexShard> IndexShardFactory::create(std::string name, std::string index_type, int dim,  int shards,
-  int ef, int ef_construction, faiss::MetricType metric, std::vector<std::string> nodes) {
-  (void)metric;
+  int ef, int ef_construction, DistanceType metric, std::vector<std::string> nodes) {
   if (index_type == "IVF") {
-    return std::make_shared<DistributedIndexIVF>(name, dim, shards, nodes);
-  } else if (index_type == "HNSW") {
+    auto index = std::make_shared<DistributedIndexIVF>(name, dim, shards, nodes);
+    index->set_metric(metric);
+    return index;
+  } else if (index_type == "HNSW" && metric == DistanceType::L2) {
     return std::make_shared<VectorIndex>(dim, index_type, ef, ef_construction);
   }
   return nullptr;
@@ -0,0 +1,83 @@
+//
+// Atomic publish of rebuilt indexes and background reclamation of the old ones.
+//
+
+#include "dann/index_handle.h"
+
+#include "dann/logger.h"
+
+#include <chrono>
+#include <stdexcept>
+
+namespace dann {
+
+namespace {
+// how often the reload thread checks whether the replaced index is still in use
+constexpr auto kReclaimPollInterval = std::chrono::milliseconds(10);
+}
+
+IndexHandle::IndexHandle(std::shared_ptr<Index> index) {
+    if (!index) {
+        throw std::invalid_argument("Index cannot be null");
+    }
+    dimension_ = index->dimension();
+    index_.store(std::move(index), std::memory_order_release);
+}
+
+IndexHandle::~IndexHandle() {
+    wait_reload();
+}
+
+std::shared_ptr<Index> IndexHandle::publish(std::shared_ptr<Index> index) {
+    if (!index || index->dimension() != dimension_) {
+        LOG_ERRORF("cannot publish an index of dimension %d into a handle of dimension %d",
+                   index ? index->dimension() : 0, dimension_);
+        return nullptr;
+    }
+    std::shared_ptr<Index> previous = index_.exchange(std::move(index), std::memory_order_acq_rel);
+    generation_.fetch_add(1, std::memory_order_release);
+    return previous;
+}
+
+bool IndexHandle::reload_async(std::function<std::shared_ptr<Index>()> build) {
+    std::lock_guard<std::mutex> lock(reload_mutex_);
+    if (reloading_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+    reloading_.store(true, std::memory_order_release);
+    reload_published_ = false;
+    reload_thread_ = std::thread([this, build = std::move(build)] {
+        std::shared_ptr<Index> next;
+        try {
+            next = build();
+        } catch (const std::exception& e) {
+            LOG_ERRORF("index reload failed: %s", e.what());
+        }
+        std::shared_ptr<Index> previous = next ? publish(std::move(next)) : nullptr;
+        reload_published_ = previous != nullptr;
+        if (reload_published_) {
+            LOG_INFOF("published index generation %llu", static_cast<unsigned long long>(generation()));
+            // nobody can take a new reference to it any more, so once this one is the
+            // last the count cannot rise again
+            while (previous.use_count() > 1) {
+                std::this_thread::sleep_for(kReclaimPollInterval);
+            }
+            previous.reset();
+        }
+        reloading_.store(false, std::memory_order_release);
+    });
+    return true;
+}
+
+bool IndexHandle::wait_reload() {
+    std::lock_guard<std::mutex> lock(reload_mutex_);
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+    return reload_published_;
+}
+
+} // namespace dann
@@ -0,0 +1,116 @@
+//
+// Pipelined bulk ingest.
+//
+
+#include "dann/ingest_pipeline.h"
+
+#include "dann/compute_executor.h"
+#include "dann/logger.h"
+
+#include <algorithm>
+
+namespace dann {
+
+IngestPipeline::IngestPipeline(std::shared_ptr<Index> index, size_t max_inflight)
+    : index_(std::move(index)), max_inflight_(std::max<size_t>(max_inflight, 1)) {
+    committer_ = std::thread([this] { commit_loop(); });
+}
+
+IngestPipeline::~IngestPipeline() {
+    finish();
+}
+
+bool IngestPipeline::add(std::vector<float> vectors, std::vector<int64_t> ids) {
+    const size_t rows = ids.size();
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!pipelined_) {
+        // an index that still trains on its first chunk cannot assign concurrently:
+        // commit in order on this thread until it can
+        cv_.wait(lock, [this] { return inflight_ == 0; });
+        if (failed_ || finished_) {
+            return false;
+        }
+        pipelined_ = index_->accepts_prepared_ingest();
+        if (!pipelined_) {
+            auto prepared = index_->prepare_ingest(std::move(vectors), std::move(ids));
+            if (!prepared || !index_->commit_ingest(*prepared)) {
+                failed_ = true;
+                error_message_ = "failed to add a chunk of " + std::to_string(rows) + " vectors";
+                return false;
+            }
+            added_ += rows;
+            return true;
+        }
+    }
+    cv_.wait(lock, [this] { return failed_ || finished_ || inflight_ < max_inflight_; });
+    if (failed_ || finished_) {
+        return false;
+    }
+    ++inflight_;
+    Index* index = index_.get();
+    auto prepared = get_compute_executor().submit(
+            [index, vectors = std::move(vectors), ids = std::move(ids)]() mutable {
+                return index->prepare_ingest(std::move(vectors), std::move(ids));
+            });
+    chunks_.push_back(Chunk{std::move(prepared), rows});
+    lock.unlock();
+    cv_.notify_all();
+    return true;
+}
+
+void IngestPipeline::commit_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] { return finished_ || !chunks_.empty(); });
+        if (chunks_.empty()) {
+            return;
+        }
+        Chunk chunk = std::move(chunks_.front());
+        chunks_.pop_front();
+        const bool skip = failed_;
+        lock.unlock();
+
+        // chunks are committed in arrival order, each while later ones are still assigned
+        bool ok = true;
+        std::string error;
+        try {
+            auto prepared = chunk.prepared.get();
+            if (!skip) {
+                ok = prepared && index_->commit_ingest(*prepared);
+                if (!ok) {
+                    error = "failed to add a chunk of " + std::to_string(chunk.rows) + " vectors";
+                }
+            }
+        } catch (const std::exception& e) {
+            ok = false;
+            error = e.what();
+        }
+
+        lock.lock();
+        --inflight_;
+        if (!skip && ok) {
+            added_ += chunk.rows;
+        } else if (!skip) {
+            failed_ = true;
+            error_message_ = error;
+            LOG_ERRORF("ingest stopped: %s", error.c_str());
+        }
+        cv_.notify_all();
+    }
+}
+
+IngestPipeline::Result IngestPipeline::finish() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return inflight_ == 0; });
+        finished_ = true;
+    }
+    cv_.notify_all();
+    if (committer_.joinable()) {
+        committer_.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Result{!failed_, added_, error_message_};
+}
+
+}
@@ -22,7 +22,7 @@ IOThreadPool::IOThreadPool(size_t threads) : stop_(false) {
     for (size_t i = 0; i < threads; ++i) {
         workers_.emplace_back([this] {
             while (true) {
-                std::function<void()> task;
+                SmallTask task;
                 {
                     std::unique_lock<std::mutex> lock(queue_mutex_);
                     condition_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
@@ -54,6 +54,33 @@ IOThreadPool::~IOThreadPool() {
     }
 }
 
+void IOThreadPool::push(SmallTask task) {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        if (stop_) {
+            throw std::runtime_error("enqueue on stopped thread pool");
+        }
+        tasks_.push(std::move(task));
+        pending_count_++;
+    }
+    condition_.notify_one();
+}
+
+bool IOThreadPool::run_pending_task() {
+    SmallTask task;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        if (tasks_.empty()) {
+            return false;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop();
+        pending_count_--;
+    }
+    task();
+    return true;
+}
+
 size_t IOThreadPool::pending_tasks() const {
     return pending_count_.load();
 }
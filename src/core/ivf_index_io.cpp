@@ -0,0 +1,645 @@
+//
+// On-disk layout of a DistributedIndexIVF
+//
+#include "dann/ivf_index_io.h"
+
+#include "dann/logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dann {
+
+namespace {
+
+std::string join_path(const std::string& dir, const char* file) {
+    return (std::filesystem::path(dir) / file).string();
+}
+
+template <typename T>
+void write_pod(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool read_pod(std::istream& in, T* value) {
+    in.read(reinterpret_cast<char*>(value), sizeof(T));
+    return static_cast<bool>(in);
+}
+
+// FNV-1a, used as the index.idx footer checksum
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 1469598103934665603ULL) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// version 1 left the shard id out of the checksum
+uint64_t checksum_partition(const PartitionDescriptor& desc, uint32_t version, uint64_t hash) {
+    hash = fnv1a(&desc.partition_id, sizeof(desc.partition_id), hash);
+    if (version >= 2) {
+        hash = fnv1a(&desc.shard_id, sizeof(desc.shard_id), hash);
+    }
+    hash = fnv1a(&desc.aux_row_offset, sizeof(desc.aux_row_offset), hash);
+    return fnv1a(&desc.length, sizeof(desc.length), hash);
+}
+
+// minimal lookup for the flat manifest written by save_manifest
+bool find_json_value(const std::string& json, const std::string& key, std::string* value) {
+    const std::string needle = "\"" + key + "\"";
+    size_t pos = json.find(needle);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    pos = json.find(':', pos + needle.size());
+    if (pos == std::string::npos) {
+        return false;
+    }
+    pos = json.find_first_not_of(" \t\r\n", pos + 1);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    if (json[pos] == '"') {
+        const size_t end = json.find('"', pos + 1);
+        if (end == std::string::npos) {
+            return false;
+        }
+        *value = json.substr(pos + 1, end - pos - 1);
+        return true;
+    }
+    const size_t end = json.find_first_of(",}\r\n", pos);
+    *value = json.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+    while (!value->empty() && (value->back() == ' ' || value->back() == '\t')) {
+        value->pop_back();
+    }
+    return true;
+}
+
+}
+
+bool save_manifest(const std::string& dir, const IvfIndexManifest& m) {
+    std::ofstream out(join_path(dir, kManifestFileName), std::ios::trunc);
+    if (!out) {
+        LOG_ERRORF("failed to open manifest in %s", dir.c_str());
+        return false;
+    }
+    out << "{\n"
+        << "  \"format_version\": " << m.format_version << ",\n"
+        << "  \"index_name\": \"" << m.index_name << "\",\n"
+        << "  \"dimension\": " << m.dimension << ",\n"
+        << "  \"nlist\": " << m.nlist << ",\n"
+        << "  \"nprobe_default\": " << m.nprobe_default << ",\n"
+        << "  \"distance_type\": " << static_cast<int>(m.distance_type) << ",\n"
+        << "  \"shard_count\": " << m.shard_count << ",\n"
+        << "  \"ntotal\": " << m.ntotal << ",\n"
+        << "  \"trained\": " << (m.trained ? "true" : "false") << "\n"
+        << "}\n";
+    return static_cast<bool>(out);
+}
+
+bool load_manifest(const std::string& dir, IvfIndexManifest* m) {
+    std::ifstream in(join_path(dir, kManifestFileName));
+    if (!in) {
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    const std::string json = buffer.str();
+
+    std::string value;
+    try {
+        if (!find_json_value(json, "format_version", &value)) return false;
+        m->format_version = static_cast<uint32_t>(std::stoul(value));
+        if (find_json_value(json, "index_name", &value)) m->index_name = value;
+        if (!find_json_value(json, "dimension", &value)) return false;
+        m->dimension = std::stoi(value);
+        if (!find_json_value(json, "nlist", &value)) return false;
+        m->nlist = std::stoi(value);
+        if (find_json_value(json, "nprobe_default", &value)) m->nprobe_default = std::stoi(value);
+        if (find_json_value(json, "distance_type", &value)) m->distance_type = static_cast<DistanceType>(std::stoi(value));
+        if (find_json_value(json, "shard_count", &value)) m->shard_count = std::stoi(value);
+        if (find_json_value(json, "ntotal", &value)) m->ntotal = std::stoll(value);
+        if (find_json_value(json, "trained", &value)) m->trained = value == "true";
+    } catch (const std::exception& e) {
+        LOG_ERRORF("invalid manifest in %s: %s", dir.c_str(), e.what());
+        return false;
+    }
+    return true;
+}
+
+bool save_index_structure(const std::string& dir, const IvfIndexManifest& m, const IvfRuntimeLayout& layout) {
+    if (layout.centroids.size() != static_cast<size_t>(m.nlist) * m.dimension ||
+        layout.partitions.size() != static_cast<size_t>(m.nlist)) {
+        LOG_ERRORF("index layout does not match nlist=%d dimension=%d", m.nlist, m.dimension);
+        return false;
+    }
+    std::ofstream out(join_path(dir, kIndexFileName), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        LOG_ERRORF("failed to open index.idx in %s", dir.c_str());
+        return false;
+    }
+
+    // header, 40 bytes
+    out.write(kIvfIndexMagic, sizeof(kIvfIndexMagic));
+    write_pod(out, m.format_version);
+    write_pod(out, static_cast<uint32_t>(m.dimension));
+    write_pod(out, static_cast<uint32_t>(m.nlist));
+    write_pod(out, static_cast<uint32_t>(m.shard_count));
+    write_pod(out, static_cast<uint64_t>(m.ntotal));
+    write_pod(out, static_cast<uint8_t>(m.distance_type));
+    const char reserved[7] = {};
+    out.write(reserved, sizeof(reserved));
+
+    // body
+    const size_t centroid_bytes = layout.centroids.size() * sizeof(float);
+    out.write(reinterpret_cast<const char*>(layout.centroids.data()), static_cast<std::streamsize>(centroid_bytes));
+    uint64_t checksum = fnv1a(layout.centroids.data(), centroid_bytes);
+    for (const auto& desc: layout.partitions) {
+        const uint32_t padding = 0;
+        write_pod(out, desc.partition_id);
+        write_pod(out, desc.shard_id);
+        write_pod(out, desc.aux_row_offset);
+        write_pod(out, desc.length);
+        write_pod(out, padding);
+        checksum = checksum_partition(desc, kIvfFormatVersion, checksum);
+    }
+
+    // footer
+    write_pod(out, checksum);
+    return static_cast<bool>(out);
+}
+
+bool load_index_structure(const std::string& dir, IvfIndexManifest* m, IvfRuntimeLayout* layout) {
+    std::ifstream in(join_path(dir, kIndexFileName), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    char magic[8];
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, kIvfIndexMagic, sizeof(magic)) != 0) {
+        LOG_ERRORF("bad index.idx magic in %s", dir.c_str());
+        return false;
+    }
+    uint32_t version, dimension, nlist, shard_count;
+    uint64_t ntotal;
+    uint8_t distance_type;
+    char reserved[7];
+    if (!read_pod(in, &version) || !read_pod(in, &dimension) || !read_pod(in, &nlist) ||
+        !read_pod(in, &shard_count) || !read_pod(in, &ntotal) || !read_pod(in, &distance_type) ||
+        !in.read(reserved, sizeof(reserved))) {
+        LOG_ERRORF("truncated index.idx header in %s", dir.c_str());
+        return false;
+    }
+    if (version > kIvfFormatVersion) {
+        LOG_ERRORF("unsupported index.idx version %u", version);
+        return false;
+    }
+    m->format_version = version;
+    m->dimension = static_cast<int32_t>(dimension);
+    m->nlist = static_cast<int32_t>(nlist);
+    m->shard_count = static_cast<int32_t>(shard_count);
+    m->ntotal = static_cast<int64_t>(ntotal);
+    m->distance_type = static_cast<DistanceType>(distance_type);
+
+    layout->centroids.resize(static_cast<size_t>(nlist) * dimension);
+    const size_t centroid_bytes = layout->centroids.size() * sizeof(float);
+    in.read(reinterpret_cast<char*>(layout->centroids.data()), static_cast<std::streamsize>(centroid_bytes));
+    if (!in) {
+        LOG_ERRORF("truncated centroids block in %s", dir.c_str());
+        return false;
+    }
+    uint64_t checksum = fnv1a(layout->centroids.data(), centroid_bytes);
+
+    layout->partitions.resize(nlist);
+    std::vector<char> seen(nlist, 0);
+    for (auto& desc: layout->partitions) {
+        uint32_t padding;
+        if (!read_pod(in, &desc.partition_id) || !read_pod(in, &desc.shard_id) ||
+            !read_pod(in, &desc.aux_row_offset) || !read_pod(in, &desc.length) || !read_pod(in, &padding)) {
+            LOG_ERRORF("truncated partition block in %s", dir.c_str());
+            return false;
+        }
+        // loaders index per-centroid tables by these, so each must name a distinct
+        // centroid and a row range inside auxiliary.idx
+        if (desc.partition_id < 0 || static_cast<uint32_t>(desc.partition_id) >= nlist ||
+            seen[desc.partition_id]++ != 0) {
+            LOG_ERRORF("invalid or duplicate partition id %d in %s", desc.partition_id, dir.c_str());
+            return false;
+        }
+        if (desc.aux_row_offset > ntotal || desc.length > ntotal - desc.aux_row_offset) {
+            LOG_ERRORF("partition %d lies outside the %llu rows of %s", desc.partition_id,
+                       static_cast<unsigned long long>(ntotal), dir.c_str());
+            return false;
+        }
+        checksum = checksum_partition(desc, version, checksum);
+    }
+
+    uint64_t stored_checksum;
+    if (!read_pod(in, &stored_checksum) || stored_checksum != checksum) {
+        LOG_ERRORF("index.idx checksum mismatch in %s", dir.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool save_probe_heat(const std::string& dir, const std::vector<uint64_t>& heat) {
+    std::ofstream out(join_path(dir, kHeatFileName), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        LOG_ERRORF("failed to open heat.idx in %s", dir.c_str());
+        return false;
+    }
+    out.write(kIvfHeatMagic, sizeof(kIvfHeatMagic));
+    write_pod(out, kIvfFormatVersion);
+    write_pod(out, static_cast<uint32_t>(heat.size()));
+    const size_t heat_bytes = heat.size() * sizeof(uint64_t);
+    out.write(reinterpret_cast<const char*>(heat.data()), static_cast<std::streamsize>(heat_bytes));
+    write_pod(out, fnv1a(heat.data(), heat_bytes));
+    return static_cast<bool>(out);
+}
+
+bool load_probe_heat(const std::string& dir, std::vector<uint64_t>* heat) {
+    std::ifstream in(join_path(dir, kHeatFileName), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    char magic[8];
+    uint32_t version, count;
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, kIvfHeatMagic, sizeof(magic)) != 0 || !read_pod(in, &version) ||
+        version > kIvfFormatVersion || !read_pod(in, &count)) {
+        LOG_WARNF("ignoring unreadable heat.idx in %s", dir.c_str());
+        return false;
+    }
+    heat->resize(count);
+    in.read(reinterpret_cast<char*>(heat->data()), static_cast<std::streamsize>(heat->size() * sizeof(uint64_t)));
+    const uint64_t checksum = fnv1a(heat->data(), heat->size() * sizeof(uint64_t));
+    uint64_t stored_checksum;
+    if (!in || !read_pod(in, &stored_checksum) || stored_checksum != checksum) {
+        LOG_WARNF("ignoring damaged heat.idx in %s", dir.c_str());
+        heat->clear();
+        return false;
+    }
+    return true;
+}
+
+bool AuxiliaryFileWriter::open(const std::string& path, int dimension, uint64_t total_rows) {
+    out_.open(path, std::ios::binary | std::ios::trunc);
+    if (!out_) {
+        LOG_ERRORF("failed to open %s", path.c_str());
+        return false;
+    }
+    dimension_ = dimension;
+    expected_rows_ = total_rows;
+    written_rows_ = 0;
+    out_.write(kIvfAuxMagic, sizeof(kIvfAuxMagic));
+    write_pod(out_, kIvfFormatVersion);
+    write_pod(out_, static_cast<uint32_t>(dimension));
+    write_pod(out_, total_rows);
+    return static_cast<bool>(out_);
+}
+
+bool AuxiliaryFileWriter::write_partition(const int64_t* ids, const float* vectors, size_t n) {
+    if (n == 0) {
+        return true;
+    }
+    out_.write(reinterpret_cast<const char*>(ids), static_cast<std::streamsize>(n * sizeof(int64_t)));
+    out_.write(reinterpret_cast<const char*>(vectors),
+               static_cast<std::streamsize>(n * dimension_ * sizeof(float)));
+    written_rows_ += n;
+    return static_cast<bool>(out_);
+}
+
+bool AuxiliaryFileWriter::close() {
+    if (!out_.is_open()) {
+        return false;
+    }
+    out_.close();
+    if (written_rows_ != expected_rows_) {
+        LOG_ERRORF("auxiliary.idx wrote %lu rows, expected %lu", written_rows_, expected_rows_);
+        return false;
+    }
+    return !out_.fail();
+}
+
+bool AuxiliaryFileReader::open(const std::string& path, int dimension) {
+    in_.open(path, std::ios::binary);
+    if (!in_) {
+        return false;
+    }
+    char magic[8];
+    uint32_t version, file_dimension;
+    in_.read(magic, sizeof(magic));
+    if (!in_ || std::memcmp(magic, kIvfAuxMagic, sizeof(magic)) != 0 ||
+        !read_pod(in_, &version) || !read_pod(in_, &file_dimension) || !read_pod(in_, &total_rows_)) {
+        LOG_ERRORF("bad auxiliary.idx header in %s", path.c_str());
+        return false;
+    }
+    if (version > kIvfFormatVersion || static_cast<int>(file_dimension) != dimension) {
+        LOG_ERRORF("auxiliary.idx version=%u dimension=%u does not match dimension=%d", version, file_dimension,
+                   dimension);
+        return false;
+    }
+    dimension_ = dimension;
+    return true;
+}
+
+bool AuxiliaryFileReader::read_partition(const PartitionDescriptor& desc, std::vector<int64_t>* ids,
+                                         std::vector<float>* vectors) {
+    ids->resize(desc.length);
+    vectors->resize(static_cast<size_t>(desc.length) * dimension_);
+    if (desc.length == 0) {
+        return true;
+    }
+    if (desc.aux_row_offset + desc.length > total_rows_) {
+        LOG_ERRORF("partition %d exceeds auxiliary.idx rows", desc.partition_id);
+        return false;
+    }
+    in_.seekg(static_cast<std::streamoff>(aux_partition_offset(desc, dimension_)));
+    in_.read(reinterpret_cast<char*>(ids->data()), static_cast<std::streamsize>(ids->size() * sizeof(int64_t)));
+    in_.read(reinterpret_cast<char*>(vectors->data()),
+             static_cast<std::streamsize>(vectors->size() * sizeof(float)));
+    return static_cast<bool>(in_);
+}
+
+PartitionSpill::~PartitionSpill() {
+    remove_buckets();
+}
+
+void PartitionSpill::remove_buckets() {
+    for (auto& bucket: buckets_) {
+        bucket.close();
+    }
+    std::error_code ec;
+    for (const auto& path: paths_) {
+        std::filesystem::remove(path, ec);
+    }
+    buckets_.clear();
+    paths_.clear();
+}
+
+bool PartitionSpill::open(const std::string& dir, int dimension, int nlist, size_t buckets) {
+    remove_buckets();
+    if (nlist <= 0) {
+        return false;
+    }
+    dimension_ = dimension;
+    nlist_ = nlist;
+    rows_ = 0;
+    partition_rows_.assign(nlist, 0);
+    const size_t count = std::max<size_t>(1, std::min<size_t>(buckets, static_cast<size_t>(nlist)));
+    bounds_.resize(count + 1);
+    for (size_t b = 0; b <= count; ++b) {
+        bounds_[b] = static_cast<int32_t>(static_cast<int64_t>(nlist) * b / count);
+    }
+    buckets_.resize(count);
+    for (size_t b = 0; b < count; ++b) {
+        paths_.push_back(join_path(dir, ("spill." + std::to_string(b)).c_str()));
+        buckets_[b].open(paths_.back(), std::ios::binary | std::ios::trunc);
+        if (!buckets_[b]) {
+            LOG_ERRORF("failed to create %s", paths_.back().c_str());
+            remove_buckets();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PartitionSpill::append(const int64_t* ids, const float* vectors, const int64_t* partitions, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        const int32_t partition = static_cast<int32_t>(partitions[i]);
+        const size_t b = std::upper_bound(bounds_.begin(), bounds_.end(), partition) - bounds_.begin() - 1;
+        auto& out = buckets_[b];
+        write_pod(out, ids[i]);
+        write_pod(out, partition);
+        out.write(reinterpret_cast<const char*>(vectors + i * dimension_),
+                  static_cast<std::streamsize>(dimension_ * sizeof(float)));
+        ++partition_rows_[partition];
+    }
+    rows_ += n;
+    for (const auto& out: buckets_) {
+        if (!out) {
+            LOG_ERROR("writing partition spill failed");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PartitionSpill::finish(const std::string& aux_path, int shard_count,
+                            std::vector<PartitionDescriptor>* partitions) {
+    for (auto& bucket: buckets_) {
+        bucket.close();
+        if (bucket.fail()) {
+            remove_buckets();
+            return false;
+        }
+    }
+    partitions->resize(nlist_);
+    uint64_t offset = 0;
+    for (int32_t p = 0; p < nlist_; ++p) {
+        auto& desc = (*partitions)[p];
+        desc.partition_id = p;
+        desc.shard_id = p % shard_count;
+        desc.aux_row_offset = offset;
+        desc.length = static_cast<uint32_t>(partition_rows_[p]);
+        offset += partition_rows_[p];
+    }
+
+    AuxiliaryFileWriter aux;
+    if (!aux.open(aux_path, dimension_, rows_)) {
+        remove_buckets();
+        return false;
+    }
+    const size_t record_bytes = sizeof(int64_t) + sizeof(int32_t) + dimension_ * sizeof(float);
+    std::vector<char> records;
+    std::vector<int64_t> ids;
+    std::vector<float> vectors;
+    for (size_t b = 0; b < paths_.size(); ++b) {
+        const int32_t first = bounds_[b];
+        const int32_t last = bounds_[b + 1];
+        const uint64_t rows = (*partitions)[last - 1].aux_row_offset + (*partitions)[last - 1].length -
+                              (*partitions)[first].aux_row_offset;
+        std::ifstream in(paths_[b], std::ios::binary);
+        records.resize(rows * record_bytes);
+        if (!in.read(records.data(), static_cast<std::streamsize>(records.size()))) {
+            LOG_ERRORF("failed to read back %s", paths_[b].c_str());
+            remove_buckets();
+            return false;
+        }
+        // counting sort of the bucket's rows into partition order, arrival order within one
+        std::vector<uint64_t> cursor(last - first);
+        for (int32_t p = first; p < last; ++p) {
+            cursor[p - first] = (*partitions)[p].aux_row_offset - (*partitions)[first].aux_row_offset;
+        }
+        ids.resize(rows);
+        vectors.resize(rows * dimension_);
+        for (uint64_t r = 0; r < rows; ++r) {
+            const char* record = records.data() + r * record_bytes;
+            int32_t partition;
+            std::memcpy(&partition, record + sizeof(int64_t), sizeof(partition));
+            const uint64_t slot = cursor[partition - first]++;
+            std::memcpy(&ids[slot], record, sizeof(int64_t));
+            std::memcpy(&vectors[slot * dimension_], record + sizeof(int64_t) + sizeof(int32_t),
+                        dimension_ * sizeof(float));
+        }
+        // auxiliary.idx holds one [ids][vectors] block per partition, not per bucket
+        for (int32_t p = first; p < last; ++p) {
+            const uint64_t start = (*partitions)[p].aux_row_offset - (*partitions)[first].aux_row_offset;
+            if (!aux.write_partition(ids.data() + start, vectors.data() + start * dimension_,
+                                     (*partitions)[p].length)) {
+                remove_buckets();
+                return false;
+            }
+        }
+        // the bucket is in auxiliary.idx now; give its disk space back early
+        std::error_code ec;
+        std::filesystem::remove(paths_[b], ec);
+    }
+    remove_buckets();
+    return aux.close();
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_ERRORF("failed to open %s: %s", path.c_str(), std::strerror(errno));
+        return false;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        LOG_ERRORF("mmap %s failed: %s", path.c_str(), std::strerror(errno));
+        return false;
+    }
+    // partitions are read as a whole when probed, not streamed front to back
+    ::madvise(data, static_cast<size_t>(st.st_size), MADV_RANDOM);
+    data_ = data;
+    size_ = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_ != nullptr) {
+        ::munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+void MappedFile::prefetch(uint64_t offset, uint64_t length) const {
+    if (data_ == nullptr || length == 0 || offset >= size_) {
+        return;
+    }
+    static const uint64_t page_size = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    const uint64_t begin = offset / page_size * page_size;
+    const uint64_t end = std::min<uint64_t>(offset + length, size_);
+    ::madvise(static_cast<char*>(data_) + begin, end - begin, MADV_WILLNEED);
+}
+
+PartitionPreloader::~PartitionPreloader() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+bool PartitionPreloader::open(const std::string& path, int dimension) {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        LOG_ERRORF("failed to open %s: %s", path.c_str(), std::strerror(errno));
+        return false;
+    }
+    dimension_ = dimension;
+    return true;
+}
+
+uint64_t PartitionPreloader::load(const PartitionDescriptor& desc) const {
+    // read in bounded pieces: the data only has to pass through to fill the cache
+    constexpr uint64_t kPieceBytes = uint64_t{1} << 20;
+    const uint64_t bytes = aux_partition_bytes(desc, dimension_);
+    if (fd_ < 0 || bytes == 0) {
+        return 0;
+    }
+    std::vector<char> buffer(std::min(bytes, kPieceBytes));
+    const uint64_t offset = aux_partition_offset(desc, dimension_);
+    uint64_t done = 0;
+    while (done < bytes) {
+        const size_t want = static_cast<size_t>(std::min<uint64_t>(bytes - done, buffer.size()));
+        const ssize_t got = ::pread(fd_, buffer.data(), want, static_cast<off_t>(offset + done));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            LOG_WARNF("preloading partition %d failed: %s", desc.partition_id,
+                      got < 0 ? std::strerror(errno) : "unexpected end of file");
+            return 0;
+        }
+        done += static_cast<uint64_t>(got);
+    }
+    return done;
+}
+
+bool AuxiliaryVectorSource::open(const std::string& dir) {
+    rows_.clear();
+    IvfIndexManifest manifest;
+    IvfRuntimeLayout layout;
+    if (!load_manifest(dir, &manifest) || !load_index_structure(dir, &manifest, &layout) ||
+        !file_.open((std::filesystem::path(dir) / kAuxiliaryFileName).string())) {
+        LOG_ERRORF("failed to open the auxiliary vectors of %s", dir.c_str());
+        return false;
+    }
+    dimension_ = manifest.dimension;
+    const uint64_t row_bytes = sizeof(int64_t) + sizeof(float) * static_cast<uint64_t>(dimension_);
+    rows_.reserve(static_cast<size_t>(std::max<int64_t>(0, manifest.ntotal)));
+    for (const auto& desc: layout.partitions) {
+        if (desc.length == 0) {
+            continue;
+        }
+        const uint64_t offset = aux_partition_offset(desc, dimension_);
+        if (offset + desc.length * row_bytes > file_.size()) {
+            LOG_ERRORF("partition %d lies past the end of %s", desc.partition_id, dir.c_str());
+            rows_.clear();
+            file_.close();
+            return false;
+        }
+        // id blocks are only 4-byte aligned for odd dimensions
+        const char* ids = file_.data() + offset;
+        const auto* vectors = reinterpret_cast<const float*>(ids + desc.length * sizeof(int64_t));
+        for (uint32_t row = 0; row < desc.length; ++row) {
+            int64_t id;
+            std::memcpy(&id, ids + row * sizeof(int64_t), sizeof(id));
+            rows_[id] = vectors + static_cast<size_t>(row) * dimension_;
+        }
+    }
+    return true;
+}
+
+const float* AuxiliaryVectorSource::vector_data(int64_t id) const {
+    auto it = rows_.find(id);
+    return it == rows_.end() ? nullptr : it->second;
+}
+
+} // namespace dann
@@ -3,61 +3,1290 @@
 //
 #include "dann/ivf_shard.h"
 
+#include "dann/compute_executor.h"
+#include "dann/distance_kernels.h"
+#include "dann/epoch.h"
+#include "dann/fast_scan.h"
 #include "dann/logger.h"
+#include "dann/trace.h"
 #include "dann/utils.h"
 #include <algorithm>
+#include <cmath>
 
 namespace dann {
-IndexIVFShard::IndexIVFShard(int d, int shard_id, std::string node_id):
-  dimension_(d), shard_id_(shard_id), node_id_(std::move(node_id)) {}
+namespace {
+// rows scored per block in batch mode, sized so a block stays in L1/L2 across queries
+constexpr size_t kBatchBlockBytes = 32 * 1024;
+// appends beyond this many segments in one list merge them, bounding the runs per probe
+constexpr size_t kMaxSegmentsPerList = 8;
+
+struct Candidate {
+  float distance;
+  int64_t id;
+  const float* vector;
+  // ties broken by id so results do not depend on scan order
+  bool operator<(const Candidate& other) const {
+    return distance < other.distance || (distance == other.distance && id < other.id);
+  }
+};
+using CandidateQueue = TopKBuffer<Candidate>;
+
+// rows [begin, end) of a run that pass its filter: runs of consecutive admitted
+// live rows are scored together, rejected rows never reach the kernel
+void scan_filtered(DistanceBatchKernel kernel, const ScanRun& run, const float* query, int d, size_t begin,
+                   size_t end, CandidateQueue& queue) {
+  constexpr size_t kBlock = 64;
+  float distances[kBlock];
+  const float* vectors = run.rows.vectors + begin * d;
+  const int64_t* ids = run.rows.vector_ids + begin;
+  const TombstoneBitmap* deleted = run.deleted && run.deleted->count() > 0 ? run.deleted : nullptr;
+  auto admitted = [&](size_t row) {
+    return run.filter->contains(ids[row]) && !(deleted && deleted->test(begin + row));
+  };
+  const size_t n = end - begin;
+  size_t row = 0;
+  while (row < n) {
+    if (!admitted(row)) {
+      ++row;
+      continue;
+    }
+    size_t stop = row + 1;
+    while (stop < n && stop - row < kBlock && admitted(stop)) {
+      ++stop;
+    }
+    kernel(vectors + row * d, query, d, stop - row, distances);
+    for (size_t i = 0; i < stop - row; ++i) {
+      if (queue.accepts(distances[i])) {
+        queue.push(Candidate{distances[i], ids[row + i], vectors + (row + i) * d});
+      }
+    }
+    // a run shorter than a block ended on a rejected row
+    row = stop - row < kBlock ? stop + 1 : stop;
+  }
+}
+
+// rows [begin, end) of a run against one query into the bounded top-k; tombstones
+// are only tested for rows that would enter the top-k
+void scan_posting(DistanceBatchKernel kernel, const ScanRun& run, const float* query, int d, size_t begin,
+                  size_t end, CandidateQueue& queue) {
+  if (run.filter) {
+    scan_filtered(kernel, run, query, d, begin, end, queue);
+    return;
+  }
+  const float* vectors = run.rows.vectors + begin * d;
+  const int64_t* ids = run.rows.vector_ids + begin;
+  if (!run.deleted || run.deleted->count() == 0) {
+    distance_scan(kernel, vectors, query, d, end - begin, queue, [vectors, ids, d](float dis, size_t row) {
+      return Candidate{dis, ids[row], vectors + row * d};
+    });
+    return;
+  }
+  constexpr size_t kBlock = 64;
+  float distances[kBlock];
+  for (size_t block = 0; block < end - begin; block += kBlock) {
+    const size_t count = std::min(kBlock, end - begin - block);
+    kernel(vectors + block * d, query, d, count, distances);
+    for (size_t i = 0; i < count; ++i) {
+      const size_t row = block + i;
+      if (queue.accepts(distances[i]) && !run.deleted->test(begin + row)) {
+        queue.push(Candidate{distances[i], ids[row], vectors + row * d});
+      }
+    }
+  }
+}
+
+// rows [begin, end) of the probed lists taken end to end, each list entered
+// from its row offset in the concatenation (starts[i] = rows before list i)
+void scan_rows(DistanceBatchKernel kernel, const std::vector<ScanRun>& lists, const std::vector<size_t>& starts,
+               const float* query, int d, size_t begin, size_t end, CandidateQueue& queue) {
+  size_t i = std::upper_bound(starts.begin(), starts.end(), begin) - starts.begin() - 1;
+  for (; i < lists.size() && starts[i] < end; ++i) {
+    const size_t lo = std::max(begin, starts[i]) - starts[i];
+    const size_t hi = std::min(end, starts[i] + lists[i].rows.length) - starts[i];
+    if (lo < hi) {
+      scan_posting(kernel, lists[i], query, d, lo, hi, queue);
+    }
+  }
+}
+
+// offset turns the kernel score into the reported distance (1 for cosine: -cos -> 1 - cos)
+std::vector<InternalSearchResult> drain_queue(CandidateQueue& queue, int d, bool include_vectors, float offset) {
+  const auto& top = queue.entries();
+  std::vector<InternalSearchResult> result(top.size());
+  for (size_t i = 0; i < top.size(); ++i) {
+    auto& item = result[i];
+    item.id = top[i].id;
+    item.distance = top[i].distance + offset;
+    if (include_vectors) {
+      item.vector.assign(top[i].vector, top[i].vector + d);
+    }
+  }
+  queue.reset(queue.capacity());
+  return result;
+}
+}
+
+IndexIVFShard::IndexIVFShard(int d, int shard_id, std::string node_id, PostingStorageMode mode):
+  dimension_(d), shard_id_(shard_id), node_id_(std::move(node_id)), storage_mode_(mode), arena_(d),
+  distance_batch_(distance_batch_kernel(DistanceType::L2, d)) {}
+
+TombstoneBitmap::TombstoneBitmap(size_t rows): rows_(rows), words_(new std::atomic<uint64_t>[(rows + 63) / 64]) {
+  for (size_t i = 0; i < (rows + 63) / 64; ++i) {
+    words_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+bool TombstoneBitmap::set(size_t row) {
+  if (row >= rows_) {
+    return false;
+  }
+  const uint64_t bit = uint64_t{1} << (row & 63);
+  if (words_[row >> 6].fetch_or(bit, std::memory_order_relaxed) & bit) {
+    return false;
+  }
+  count_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+using SegmentList = std::vector<std::shared_ptr<const PostingSegment>>;
+
+// everything changed online since the last rebuild: appended segments, tombstones
+// of built rows, and built lists that compaction replaced by a segment
+struct IndexIVFShard::SegmentSnapshot {
+  std::unordered_map<int64_t, SegmentList> lists;
+  std::unordered_map<int64_t, std::shared_ptr<TombstoneBitmap>> base_deleted;
+  std::unordered_set<int64_t> base_hidden;
+  size_t rows{0};        // rows held by segments, live or not
+  size_t hidden_rows{0}; // built rows of hidden lists
+  size_t bytes{0};
+
+  const SegmentList* find(int64_t centroid) const {
+    auto it = lists.find(centroid);
+    return it == lists.end() ? nullptr : &it->second;
+  }
+  const TombstoneBitmap* find_base_deleted(int64_t centroid) const {
+    auto it = base_deleted.find(centroid);
+    return it == base_deleted.end() ? nullptr : it->second.get();
+  }
+  bool base_visible(int64_t centroid) const { return base_hidden.count(centroid) == 0; }
+};
+
+namespace {
+size_t segment_bytes(const PostingSegment& segment) {
+  return segment.vector_ids.capacity() * sizeof(int64_t) + segment.vectors.capacity() * sizeof(float) +
+         segment.codes.capacity() + segment.packed.capacity() + segment.deleted->rows() / 8;
+}
+}
+
+IndexIVFShard::~IndexIVFShard() {
+  delete segments_.load();
+}
+
+void IndexIVFShard::set_metric(DistanceType metric) {
+  metric_ = metric;
+  distance_batch_ = distance_batch_kernel(metric, dimension_);
+}
+
+struct IndexIVFShard::CodeCandidate {
+  float distance;
+  int64_t id;
+  int64_t centroid;
+  const uint8_t* code;
+  const float* raw;
+  bool operator<(const CodeCandidate& other) const {
+    return distance < other.distance || (distance == other.distance && id < other.id);
+  }
+};
 
 void IndexIVFShard::add_posting(int64_t centroid, const InvertedList &posting) {
+  locations_valid_ = false;
+  if (quantizer_) {
+    encode_posting(centroid, posting.vector_ids.data(), posting.vectors.data(), posting.vector_ids.size());
+    if (refine_factor_ <= 0) {
+      return;
+    }
+  }
+  if (storage_mode_ == PostingStorageMode::ARENA) {
+    arena_.append(centroid, posting.vector_ids.data(), posting.vectors.data(), posting.vector_ids.size());
+    return;
+  }
   auto it = postings_.find(centroid);
   if (it == postings_.end()) {
     postings_[centroid] = InvertedList();
     it = postings_.find(centroid);
+    PostingView mapped;
+    if (storage_mode_ == PostingStorageMode::MMAP && find_mapped_posting(centroid, &mapped)) {
+      // copy-on-write: the overlay list replaces the mapped one from now on
+      it->second.vector_ids.assign(mapped.vector_ids, mapped.vector_ids + mapped.length);
+      it->second.vectors.assign(mapped.vectors, mapped.vectors + mapped.length * dimension_);
+      mapped_rows_ -= mapped.length;
+      mapped_partitions_[centroid].length = 0;
+    }
   }
   it->second.vector_ids.insert(it->second.vector_ids.end(), posting.vector_ids.begin(), posting.vector_ids.end());
   it->second.vectors.insert(it->second.vectors.end(), posting.vectors.begin(), posting.vectors.end());
 }
 
-std::vector<InternalSearchResult> IndexIVFShard::search(const std::vector<int64_t>& centroid_ids, const std::vector<float>& query, int k) {
-  std::vector<InternalSearchResult> result;
-  result.reserve(k);
-  std::vector<float> temp_vectors;
-  std::vector<int64_t> temp_ids;
-  InternalSearchResultQueue result_queue;
+void IndexIVFShard::reserve(size_t rows) {
+  if (storage_mode_ == PostingStorageMode::ARENA) {
+    arena_.reserve(rows);
+  }
+}
+
+void IndexIVFShard::clear() {
+  take_segments();
+  code_lists_.clear();
+  postings_.clear();
+  arena_.clear();
+  release_mapped_partitions();
+}
+
+bool IndexIVFShard::attach_mapped_partitions(std::shared_ptr<const MappedFile> file,
+                                             const std::vector<PartitionDescriptor>& partitions) {
+  if (!file || !file->is_open()) {
+    return false;
+  }
+  const uint64_t row_bytes = sizeof(int64_t) + sizeof(float) * dimension_;
+  size_t max_centroid = 0;
+  for (const auto& desc: partitions) {
+    const uint64_t offset = aux_partition_offset(desc, dimension_);
+    if (desc.partition_id < 0 || offset + desc.length * row_bytes > file->size()) {
+      LOG_ERRORF("partition %d lies outside the mapped auxiliary file", desc.partition_id);
+      return false;
+    }
+    if (desc.length > 0 && reinterpret_cast<uintptr_t>(file->data() + offset) % alignof(int64_t) != 0) {
+      // odd dimensions leave row id blocks misaligned; the caller should read into memory instead
+      LOG_ERRORF("partition %d is not aligned for mapped access (d=%d)", desc.partition_id, dimension_);
+      return false;
+    }
+    max_centroid = std::max(max_centroid, static_cast<size_t>(desc.partition_id) + 1);
+  }
+
+  set_storage_mode(PostingStorageMode::MMAP);
+  release_mapped_partitions();
+  locations_valid_ = false;
+  mapped_partitions_.resize(max_centroid);
+  for (const auto& desc: partitions) {
+    if (postings_.count(desc.partition_id) != 0) {
+      continue;
+    }
+    mapped_partitions_[desc.partition_id] = desc;
+    mapped_rows_ += desc.length;
+  }
+  mapped_file_ = std::move(file);
+  return true;
+}
+
+void IndexIVFShard::release_mapped_partitions() {
+  mapped_file_.reset();
+  mapped_partitions_.clear();
+  mapped_rows_ = 0;
+}
+
+bool IndexIVFShard::find_mapped_posting(int64_t centroid, PostingView *view) const {
+  if (centroid < 0 || static_cast<size_t>(centroid) >= mapped_partitions_.size()) {
+    return false;
+  }
+  const auto& desc = mapped_partitions_[centroid];
+  if (desc.length == 0) {
+    return false;
+  }
+  const char* base = mapped_file_->data() + aux_partition_offset(desc, dimension_);
+  view->vector_ids = reinterpret_cast<const int64_t*>(base);
+  view->vectors = reinterpret_cast<const float*>(base + desc.length * sizeof(int64_t));
+  view->length = desc.length;
+  return true;
+}
+
+void IndexIVFShard::prefetch_postings(const std::vector<int64_t>& centroid_ids) const {
+  if (storage_mode_ != PostingStorageMode::MMAP || !prefetch_ || !mapped_file_) {
+    return;
+  }
+  const uint64_t row_bytes = sizeof(int64_t) + sizeof(float) * dimension_;
+  for (auto c: centroid_ids) {
+    if (c < 0 || static_cast<size_t>(c) >= mapped_partitions_.size() || mapped_partitions_[c].length == 0) {
+      continue;
+    }
+    const auto& desc = mapped_partitions_[c];
+    mapped_file_->prefetch(aux_partition_offset(desc, dimension_), desc.length * row_bytes);
+  }
+}
+
+void IndexIVFShard::append_postings(const std::unordered_map<int64_t, InvertedList>& postings) {
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  const SegmentSnapshot* current = segments_.load(std::memory_order_acquire);
+  auto next = current ? std::make_unique<SegmentSnapshot>(*current) : std::make_unique<SegmentSnapshot>();
+  for (const auto& [centroid, inv]: postings) {
+    const size_t n = inv.vector_ids.size();
+    if (n == 0) {
+      continue;
+    }
+    auto segment = std::make_shared<PostingSegment>();
+    segment->vector_ids = inv.vector_ids;
+    if (!quantizer_ || refine_factor_ > 0) {
+      segment->vectors = inv.vectors;
+    }
+    if (quantizer_) {
+      segment->codes.resize(n * quantizer_->code_size());
+      encode_rows(centroid, inv.vectors.data(), n, segment->codes.data());
+      pack_codes(segment->codes.data(), n, 0, &segment->packed);
+    }
+    segment->deleted = std::make_shared<TombstoneBitmap>(n);
+    next->rows += n;
+    next->bytes += segment_bytes(*segment);
+    if (locations_valid_) {
+      index_segment(centroid, *segment);
+    }
+    auto& segments = next->lists[centroid];
+    segments.push_back(std::move(segment));
+    if (segments.size() > kMaxSegmentsPerList) {
+      size_t dropped = 0;
+      replace_list(next.get(), centroid, live_rows(centroid, *next, false, &dropped), false);
+      deleted_rows_.fetch_sub(dropped, std::memory_order_relaxed);
+    }
+  }
+  publish(std::move(next), current);
+}
+
+void IndexIVFShard::publish(std::unique_ptr<SegmentSnapshot> next, const SegmentSnapshot* current) {
+  // readers pinned before the swap may still walk current; it is freed after they unpin
+  segments_.store(next.release(), std::memory_order_seq_cst);
+  if (current) {
+    get_epoch_domain().retire(current);
+  }
+}
+
+std::shared_ptr<PostingSegment> IndexIVFShard::live_rows(int64_t centroid, const SegmentSnapshot& snapshot,
+                                                         bool with_base, size_t* dropped) const {
+  auto merged = std::make_shared<PostingSegment>();
+  const size_t code_size = quantizer_ ? quantizer_->code_size() : 0;
+  auto take = [&](const int64_t* ids, const float* vectors, const uint8_t* codes, size_t n,
+                  const TombstoneBitmap* deleted) {
+    for (size_t row = 0; row < n; ++row) {
+      if (deleted && deleted->test(row)) {
+        ++*dropped;
+        continue;
+      }
+      merged->vector_ids.push_back(ids[row]);
+      if (vectors) {
+        merged->vectors.insert(merged->vectors.end(), vectors + row * dimension_, vectors + (row + 1) * dimension_);
+      }
+      if (codes) {
+        merged->codes.insert(merged->codes.end(), codes + row * code_size, codes + (row + 1) * code_size);
+      }
+    }
+  };
+  if (with_base) {
+    PostingView posting;
+    const float* raw = find_posting(centroid, &posting) ? posting.vectors : nullptr;
+    const uint8_t* codes = nullptr;
+    if (quantizer_) {
+      auto it = code_lists_.find(centroid);
+      codes = it == code_lists_.end() ? nullptr : it->second.codes.data();
+    }
+    const int64_t* ids = nullptr;
+    const size_t n = base_ids(centroid, &ids);
+    take(ids, raw && n <= posting.length ? raw : nullptr, codes, n, snapshot.find_base_deleted(centroid));
+  }
+  if (const SegmentList* segments = snapshot.find(centroid)) {
+    for (const auto& segment: *segments) {
+      take(segment->vector_ids.data(), segment->vectors.empty() ? nullptr : segment->vectors.data(),
+           segment->codes.empty() ? nullptr : segment->codes.data(), segment->vector_ids.size(),
+           segment->deleted.get());
+    }
+  }
+  if (!merged->codes.empty()) {
+    pack_codes(merged->codes.data(), merged->vector_ids.size(), 0, &merged->packed);
+  }
+  merged->deleted = std::make_shared<TombstoneBitmap>(merged->vector_ids.size());
+  return merged;
+}
+
+void IndexIVFShard::replace_list(SegmentSnapshot* next, int64_t centroid, std::shared_ptr<PostingSegment> rows,
+                                 bool with_base) {
+  if (const SegmentList* old = next->find(centroid)) {
+    for (const auto& segment: *old) {
+      next->rows -= segment->vector_ids.size();
+      next->bytes -= segment_bytes(*segment);
+    }
+  }
+  if (with_base) {
+    auto bitmap = next->base_deleted.find(centroid);
+    if (bitmap != next->base_deleted.end()) {
+      next->bytes -= bitmap->second->rows() / 8;
+      next->base_deleted.erase(bitmap);
+    }
+    next->base_hidden.insert(centroid);
+    next->hidden_rows += base_ids(centroid, nullptr);
+  }
+  if (locations_valid_) {
+    index_segment(centroid, *rows);
+  }
+  if (rows->vector_ids.empty()) {
+    next->lists.erase(centroid);
+    return;
+  }
+  next->rows += rows->vector_ids.size();
+  next->bytes += segment_bytes(*rows);
+  next->lists[centroid].assign(1, std::move(rows));
+}
+
+std::vector<int64_t> IndexIVFShard::base_centroids() const {
+  if (!quantizer_) {
+    return posting_centroids();
+  }
+  std::vector<int64_t> centroids;
+  centroids.reserve(code_lists_.size());
+  for (const auto& [c, list]: code_lists_) {
+    centroids.push_back(c);
+  }
+  return centroids;
+}
+
+size_t IndexIVFShard::base_ids(int64_t centroid, const int64_t** ids) const {
+  const int64_t* found = nullptr;
+  size_t n = 0;
+  if (quantizer_) {
+    auto it = code_lists_.find(centroid);
+    if (it != code_lists_.end()) {
+      found = it->second.vector_ids.data();
+      n = it->second.vector_ids.size();
+    }
+  } else {
+    PostingView posting;
+    if (find_posting(centroid, &posting)) {
+      found = posting.vector_ids;
+      n = posting.length;
+    }
+  }
+  if (ids) {
+    *ids = found;
+  }
+  return n;
+}
+
+void IndexIVFShard::index_segment(int64_t centroid, const PostingSegment& segment) {
+  for (size_t row = 0; row < segment.vector_ids.size(); ++row) {
+    if (!segment.deleted->test(row)) {
+      locations_[segment.vector_ids[row]] = RowLocation{centroid, &segment, row};
+    }
+  }
+}
+
+void IndexIVFShard::build_locations(const SegmentSnapshot* snapshot) {
+  locations_.clear();
+  for (auto c: base_centroids()) {
+    if (snapshot && !snapshot->base_visible(c)) {
+      continue;
+    }
+    const TombstoneBitmap* deleted = snapshot ? snapshot->find_base_deleted(c) : nullptr;
+    const int64_t* ids = nullptr;
+    const size_t n = base_ids(c, &ids);
+    for (size_t row = 0; row < n; ++row) {
+      if (!deleted || !deleted->test(row)) {
+        locations_[ids[row]] = RowLocation{c, nullptr, row};
+      }
+    }
+  }
+  if (snapshot) {
+    for (const auto& [c, segments]: snapshot->lists) {
+      for (const auto& segment: segments) {
+        index_segment(c, *segment);
+      }
+    }
+  }
+  locations_valid_ = true;
+}
+
+bool IndexIVFShard::remove_id(int64_t id) {
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  const SegmentSnapshot* current = segments_.load(std::memory_order_acquire);
+  if (!locations_valid_) {
+    build_locations(current);
+  }
+  auto it = locations_.find(id);
+  if (it == locations_.end()) {
+    return false;
+  }
+  const RowLocation loc = it->second;
+  locations_.erase(it);
+  if (loc.segment) {
+    loc.segment->deleted->set(loc.row);
+  } else {
+    TombstoneBitmap* existing = nullptr;
+    if (current) {
+      auto it = current->base_deleted.find(loc.centroid);
+      existing = it == current->base_deleted.end() ? nullptr : it->second.get();
+    }
+    if (existing) {
+      existing->set(loc.row);
+    } else {
+      // first delete in this built list: publish a bitmap for it
+      auto next = current ? std::make_unique<SegmentSnapshot>(*current) : std::make_unique<SegmentSnapshot>();
+      auto bitmap = std::make_shared<TombstoneBitmap>(base_ids(loc.centroid, nullptr));
+      bitmap->set(loc.row);
+      next->bytes += bitmap->rows() / 8;
+      next->base_deleted[loc.centroid] = std::move(bitmap);
+      publish(std::move(next), current);
+    }
+  }
+  deleted_rows_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+size_t IndexIVFShard::compact(float max_deleted_ratio) {
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  const SegmentSnapshot* current = segments_.load(std::memory_order_acquire);
+  if (!current || deleted_rows_.load(std::memory_order_relaxed) == 0) {
+    return 0;
+  }
+  std::vector<int64_t> targets;
+  std::unordered_set<int64_t> seen;
+  auto consider = [&](int64_t c) {
+    if (!seen.insert(c).second) {
+      return;
+    }
+    size_t rows = 0;
+    size_t dead = 0;
+    if (current->base_visible(c)) {
+      rows += base_ids(c, nullptr);
+      if (const TombstoneBitmap* deleted = current->find_base_deleted(c)) {
+        dead += deleted->count();
+      }
+    }
+    if (const SegmentList* segments = current->find(c)) {
+      for (const auto& segment: *segments) {
+        rows += segment->vector_ids.size();
+        dead += segment->deleted->count();
+      }
+    }
+    if (dead > 0 && static_cast<double>(dead) > max_deleted_ratio * static_cast<double>(rows)) {
+      targets.push_back(c);
+    }
+  };
+  for (const auto& [c, bitmap]: current->base_deleted) {
+    consider(c);
+  }
+  for (const auto& [c, segments]: current->lists) {
+    consider(c);
+  }
+  if (targets.empty()) {
+    return 0;
+  }
+
+  auto next = std::make_unique<SegmentSnapshot>(*current);
+  for (auto c: targets) {
+    size_t dropped = 0;
+    const bool with_base = next->base_visible(c);
+    replace_list(next.get(), c, live_rows(c, *next, with_base, &dropped), with_base);
+    deleted_rows_.fetch_sub(dropped, std::memory_order_relaxed);
+  }
+  publish(std::move(next), current);
+  return targets.size();
+}
+
+std::unique_ptr<const IndexIVFShard::SegmentSnapshot> IndexIVFShard::take_segments() {
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  locations_valid_ = false;
+  locations_.clear();
+  deleted_rows_.store(0, std::memory_order_relaxed);
+  const SegmentSnapshot* current = segments_.exchange(nullptr, std::memory_order_seq_cst);
+  if (!current) {
+    return nullptr;
+  }
+  // a copy for the caller, the original waits out any pinned reader
+  auto copy = std::make_unique<const SegmentSnapshot>(*current);
+  get_epoch_domain().retire(current);
+  return copy;
+}
+
+void IndexIVFShard::fold_segments() {
+  auto appended = take_segments();
+  if (!appended) {
+    return;
+  }
+  const bool rebuild = !appended->base_deleted.empty() || !appended->base_hidden.empty();
+  // built rows were deleted or hidden: every list is rebuilt from its live rows
+  std::vector<int64_t> centroids = rebuild ? base_centroids() : std::vector<int64_t>();
+  for (const auto& [c, segments]: appended->lists) {
+    centroids.push_back(c);
+  }
+  std::unordered_map<int64_t, InvertedList> live;
+  for (auto c: centroids) {
+    if (live.count(c) != 0) {
+      continue;
+    }
+    size_t dropped = 0;
+    auto rows = live_rows(c, *appended, rebuild && appended->base_visible(c), &dropped);
+    if (!rows->vectors.empty()) {
+      live[c] = InvertedList{std::move(rows->vector_ids), std::move(rows->vectors)};
+    }
+  }
+  if (rebuild) {
+    postings_.clear();
+    arena_.clear();
+    release_mapped_partitions();
+  }
+  // the rows are kept raw, the caller encodes them with its quantizer
+  code_lists_.clear();
+  quantizer_.reset();
+  add_postings(live);
+}
+
+size_t IndexIVFShard::appended_rows() const {
+  auto guard = get_epoch_domain().pin();
+  const SegmentSnapshot* appended = segments_.load(std::memory_order_seq_cst);
+  return appended ? appended->rows : 0;
+}
+
+bool IndexIVFShard::read_posting(int64_t centroid, InvertedList* scratch, PostingView* view) const {
+  auto guard = get_epoch_domain().pin();
+  const SegmentSnapshot* appended = segments_.load(std::memory_order_seq_cst);
+  const bool changed = appended && (appended->find(centroid) || appended->find_base_deleted(centroid) ||
+                                    !appended->base_visible(centroid));
+  if (!changed) {
+    return find_posting(centroid, view);
+  }
+  size_t dropped = 0;
+  auto rows = live_rows(centroid, *appended, appended->base_visible(centroid), &dropped);
+  scratch->vector_ids.swap(rows->vector_ids);
+  scratch->vectors.swap(rows->vectors);
+  if (scratch->vectors.size() != scratch->vector_ids.size() * dimension_) {
+    // quantized without raw rows: nothing to hand out
+    return false;
+  }
+  view->vector_ids = scratch->vector_ids.data();
+  view->vectors = scratch->vectors.data();
+  view->length = scratch->vector_ids.size();
+  return view->length > 0;
+}
+
+void IndexIVFShard::collect_lists(int64_t centroid, const SegmentSnapshot* appended,
+                                  std::vector<ScanRun>* lists) const {
+  PostingView posting;
+  if ((!appended || appended->base_visible(centroid)) && find_posting(centroid, &posting) && posting.length > 0) {
+    lists->push_back(ScanRun{posting, appended ? appended->find_base_deleted(centroid) : nullptr});
+  }
+  const SegmentList* segments = appended ? appended->find(centroid) : nullptr;
+  if (!segments) {
+    return;
+  }
+  for (const auto& segment: *segments) {
+    lists->push_back(ScanRun{PostingView{segment->vector_ids.data(), segment->vectors.data(),
+                                         segment->vector_ids.size()},
+                             segment->deleted.get()});
+  }
+}
+
+void IndexIVFShard::collect_code_lists(int64_t centroid, const SegmentSnapshot* appended,
+                                       std::vector<CodeRows>* lists) const {
+  auto it = code_lists_.find(centroid);
+  if ((!appended || appended->base_visible(centroid)) && it != code_lists_.end() &&
+      !it->second.vector_ids.empty()) {
+    // kept raw rows share the code list's row order
+    PostingView posting;
+    const float* raw = refine_factor_ > 0 && find_posting(centroid, &posting) ? posting.vectors : nullptr;
+    lists->push_back(CodeRows{it->second.vector_ids.data(), it->second.codes.data(), raw,
+                              it->second.vector_ids.size(),
+                              appended ? appended->find_base_deleted(centroid) : nullptr});
+    lists->back().packed = it->second.packed.empty() ? nullptr : it->second.packed.data();
+  }
+  const SegmentList* segments = appended ? appended->find(centroid) : nullptr;
+  if (!segments) {
+    return;
+  }
+  for (const auto& segment: *segments) {
+    if (segment->codes.empty()) {
+      continue;
+    }
+    const float* raw = refine_factor_ > 0 && !segment->vectors.empty() ? segment->vectors.data() : nullptr;
+    lists->push_back(CodeRows{segment->vector_ids.data(), segment->codes.data(), raw, segment->vector_ids.size(),
+                              segment->deleted.get()});
+    lists->back().packed = segment->packed.empty() ? nullptr : segment->packed.data();
+  }
+}
+
+bool IndexIVFShard::find_posting(int64_t centroid, PostingView *view) const {
+  if (storage_mode_ == PostingStorageMode::ARENA) {
+    return arena_.find(centroid, view);
+  }
+  auto it = postings_.find(centroid);
+  if (it == postings_.end()) {
+    return storage_mode_ == PostingStorageMode::MMAP && find_mapped_posting(centroid, view);
+  }
+  view->vector_ids = it->second.vector_ids.data();
+  view->vectors = it->second.vectors.data();
+  view->length = it->second.vector_ids.size();
+  return true;
+}
+
+std::vector<InternalSearchResult> IndexIVFShard::search(const std::vector<int64_t>& centroid_ids, const std::vector<float>& query, int k,
+                                                      bool include_vectors, ScanStats* stats,
+                                                      const RoaringBitmap* filter) {
+  if (k <= 0) {
+    return {};
+  }
+  DANN_TRACE_SPAN("search", "shard.scan");
+  // appended segments stay alive until the guard is released
+  auto guard = get_epoch_domain().pin();
+  const SegmentSnapshot* appended = segments_.load(std::memory_order_seq_cst);
+  if (quantizer_) {
+    const size_t depth = static_cast<size_t>(k) * std::max(1, refine_factor_);
+    auto computer = quantizer_->distance_computer();
+    TopKBuffer<CodeCandidate> codes_queue(depth);
+    std::vector<float> residual(dimension_);
+    std::vector<CodeRows> code_lists;
+    for (const auto& centroid_id : centroid_ids) {
+      code_lists.clear();
+      collect_code_lists(centroid_id, appended, &code_lists);
+      if (code_lists.empty()) {
+        continue;
+      }
+      computer->set_query(quantized_query(query.data(), centroid_id, residual.data()));
+      for (auto& rows: code_lists) {
+        rows.filter = filter;
+        scan_codes(rows, *computer, centroid_id, codes_queue);
+        if (stats) {
+          stats->vectors_scanned += rows.length;
+        }
+      }
+    }
+    if (stats) {
+      stats->lists_probed += centroid_ids.size();
+    }
+    std::vector<CodeCandidate> candidates = codes_queue.take();
+    return finish_quantized(candidates, query.data(), k, include_vectors);
+  }
+  // start readahead for every probed list, then fault them in while scanning in order
+  prefetch_postings(centroid_ids);
+  std::vector<ScanRun> lists;
+  lists.reserve(centroid_ids.size());
   for (const auto& centroid_id : centroid_ids) {
-    auto it = postings_.find(centroid_id);
-    if (it == postings_.end()) {
-      continue;
-    }
-    auto result_with_distance = find_closest_k_with_distance(it->second.vectors,query,dimension_, it->second.vector_ids.size(), k);
-    for (const auto &item: result_with_distance) {
-      // LOG_INFOF("index=%d, distance=%f", item.index, item.distance);
-      if (result_queue.size() < k || item.distance < result_queue.top().distance) {
-        std::vector<float> vector(it->second.vectors.begin() + item.index * dimension_, 
-                                  it->second.vectors.begin() + (item.index + 1) * dimension_);
-        if (result_queue.size() == k) {
-          result_queue.pop();
+    collect_lists(centroid_id, appended, &lists);
+  }
+  std::vector<size_t> starts;
+  starts.reserve(lists.size());
+  size_t total_rows = 0;
+  for (auto& list: lists) {
+    list.filter = filter;
+    starts.push_back(total_rows);
+    total_rows += list.rows.length;
+  }
+  if (stats) {
+    stats->lists_probed += centroid_ids.size();
+    stats->vectors_scanned += total_rows;
+  }
+
+  const float offset = metric_ == DistanceType::COSINE ? 1.0f : 0.0f;
+  CandidateQueue queue(static_cast<size_t>(k));
+  ComputeExecutor& executor = numa_executor_ ? *numa_executor_ : get_compute_executor();
+  if (parallel_scan_rows_ == 0 || total_rows < 2 * parallel_scan_rows_) {
+    scan_rows(distance_batch_, lists, starts, query.data(), dimension_, 0, total_rows, queue);
+    return drain_queue(queue, dimension_, include_vectors, offset);
+  }
+  // about two chunks per worker so stealing can even out uneven lists; chunks may
+  // span list boundaries. Idle workers pick them up, a busy pool leaves them to us
+  const size_t target = (total_rows + 2 * executor.size() - 1) / (2 * executor.size());
+  const size_t chunk_rows = std::max(parallel_scan_rows_, target);
+  const size_t nchunks = (total_rows + chunk_rows - 1) / chunk_rows;
+  std::vector<CandidateQueue> partial(nchunks, CandidateQueue(static_cast<size_t>(k)));
+  executor.parallel_for(0, total_rows, chunk_rows, [&](size_t lo, size_t hi) {
+    scan_rows(distance_batch_, lists, starts, query.data(), dimension_, lo, hi, partial[lo / chunk_rows]);
+  });
+  for (const auto& part: partial) {
+    for (const auto& cand: part.entries()) {
+      queue.push(cand);
+    }
+  }
+  return drain_queue(queue, dimension_, include_vectors, offset);
+}
+
+std::vector<std::vector<InternalSearchResult>> IndexIVFShard::search_batch(
+    const std::unordered_map<int64_t, std::vector<int64_t>>& centroid_queries,
+    const float* queries, size_t nq, int k, bool include_vectors, ScanStats* stats,
+    const RoaringBitmap* filter) {
+  std::vector<std::vector<InternalSearchResult>> results(nq);
+  if (k <= 0) {
+    return results;
+  }
+  DANN_TRACE_SPAN("search", "shard.scan_batch");
+  auto guard = get_epoch_domain().pin();
+  const SegmentSnapshot* appended = segments_.load(std::memory_order_seq_cst);
+  if (quantizer_) {
+    const size_t depth = static_cast<size_t>(k) * std::max(1, refine_factor_);
+    auto computer = quantizer_->distance_computer();
+    std::vector<TopKBuffer<CodeCandidate>> codes_queues(nq, TopKBuffer<CodeCandidate>(depth));
+    std::vector<float> residual(dimension_);
+    std::vector<CodeRows> code_lists;
+    for (const auto& [centroid, query_ids]: centroid_queries) {
+      code_lists.clear();
+      collect_code_lists(centroid, appended, &code_lists);
+      if (code_lists.empty()) {
+        continue;
+      }
+      for (auto& rows: code_lists) {
+        rows.filter = filter;
+      }
+      for (auto qi: query_ids) {
+        computer->set_query(quantized_query(queries + qi * dimension_, centroid, residual.data()));
+        for (const auto& rows: code_lists) {
+          scan_codes(rows, *computer, centroid, codes_queues[qi]);
+        }
+      }
+      if (stats) {
+        for (const auto& rows: code_lists) {
+          stats->vectors_scanned += rows.length * query_ids.size();
         }
-        result_queue.emplace(it->second.vector_ids[item.index], item.distance, vector);
       }
     }
+    if (stats) {
+      for (const auto& [centroid, query_ids]: centroid_queries) {
+        stats->lists_probed += query_ids.size();
+      }
+    }
+    for (size_t qi = 0; qi < nq; ++qi) {
+      std::vector<CodeCandidate> candidates = codes_queues[qi].take();
+      results[qi] = finish_quantized(candidates, queries + qi * dimension_, k, include_vectors);
+    }
+    return results;
   }
-  while (!result_queue.empty())
-  {
-    result.push_back(result_queue.top());
-    result_queue.pop();
+  std::vector<CandidateQueue> queues(nq, CandidateQueue(static_cast<size_t>(k)));
+
+  // walk lists in centroid order, which is storage order for the arena
+  std::vector<int64_t> centroids;
+  centroids.reserve(centroid_queries.size());
+  for (const auto& [c, qs]: centroid_queries) {
+    centroids.push_back(c);
   }
-  std::reverse(result.begin(), result.end());
-  return result;
+  std::sort(centroids.begin(), centroids.end());
+  prefetch_postings(centroids);
+
+  const size_t d = static_cast<size_t>(dimension_);
+  const size_t block_rows = std::max<size_t>(1, kBatchBlockBytes / (d * sizeof(float)));
+  std::vector<ScanRun> lists;
+  for (auto centroid: centroids) {
+    lists.clear();
+    collect_lists(centroid, appended, &lists);
+    for (auto& run: lists) {
+      run.filter = filter;
+    }
+    const auto& query_ids = centroid_queries.at(centroid);
+    if (stats) {
+      stats->lists_probed += query_ids.size();
+      for (const auto& run: lists) {
+        stats->vectors_scanned += run.rows.length * query_ids.size();
+      }
+    }
+    for (const auto& run: lists) {
+      for (size_t begin = 0; begin < run.rows.length; begin += block_rows) {
+        const size_t end = std::min(run.rows.length, begin + block_rows);
+        for (auto qi: query_ids) {
+          scan_posting(distance_batch_, run, queries + qi * d, dimension_, begin, end, queues[qi]);
+        }
+      }
+    }
+  }
+
+  const float offset = metric_ == DistanceType::COSINE ? 1.0f : 0.0f;
+  for (size_t qi = 0; qi < nq; ++qi) {
+    results[qi] = drain_queue(queues[qi], dimension_, include_vectors, offset);
+  }
+  return results;
 }
 
 void IndexIVFShard::add_postings( const std::unordered_map<int64_t, InvertedList> &postings) {
+  if (storage_mode_ == PostingStorageMode::ARENA) {
+    // append in centroid order so every list lands at the arena tail exactly once
+    std::vector<int64_t> centroids;
+    size_t rows = 0;
+    centroids.reserve(postings.size());
+    for (const auto& [c, inv]: postings) {
+      centroids.push_back(c);
+      rows += inv.vector_ids.size();
+    }
+    std::sort(centroids.begin(), centroids.end());
+    arena_.reserve(rows);
+    for (auto c: centroids) {
+      add_posting(c, postings.at(c));
+    }
+    return;
+  }
   for (const auto& [c, inv]: postings) {
     add_posting(c, inv);
   }
 }
 
+const float* IndexIVFShard::quantized_query(const float* query, int64_t centroid, float* residual) const {
+  if (!quantizer_->by_residual()) {
+    return query;
+  }
+  const float* c = coarse_centroids_->data() + centroid * dimension_;
+  for (int j = 0; j < dimension_; ++j) {
+    residual[j] = query[j] - c[j];
+  }
+  return residual;
+}
+
+void IndexIVFShard::scan_codes(const CodeRows& rows, const QuantizedDistanceComputer& computer, int64_t centroid,
+                               TopKBuffer<CodeCandidate>& queue) const {
+  const size_t code_size = quantizer_->code_size();
+  auto score = [&](size_t row) {
+    if (rows.filter && !rows.filter->contains(rows.vector_ids[row])) {
+      return;
+    }
+    const uint8_t* code = rows.codes + row * code_size;
+    const float dis = computer.distance(code);
+    if (queue.accepts(dis) && !(rows.deleted && rows.deleted->test(row))) {
+      queue.push({dis, rows.vector_ids[row], centroid, code, rows.raw ? rows.raw + row * dimension_ : nullptr});
+    }
+  };
+  const FastScanTable* table = rows.packed ? computer.fast_scan_table() : nullptr;
+  if (!table) {
+    for (size_t row = 0; row < rows.length; ++row) {
+      score(row);
+    }
+    return;
+  }
+  // the byte table gives every row a lower bound on its distance, 32 rows per
+  // shuffle pass; rows whose bound cannot enter the queue are never scored, so
+  // the result is the same as scoring every row
+  constexpr size_t kBlocks = 8;
+  uint16_t sums[kBlocks * kFastScanBlockRows];
+  const size_t block_bytes = fast_scan_block_bytes(static_cast<int>(code_size));
+  const size_t nblocks = (rows.length + kFastScanBlockRows - 1) / kFastScanBlockRows;
+  for (size_t b = 0; b < nblocks; b += kBlocks) {
+    const size_t count = std::min(kBlocks, nblocks - b);
+    fast_scan_accumulate(rows.packed + b * block_bytes, count, *table, sums);
+    const size_t begin = b * kFastScanBlockRows;
+    const size_t end = std::min(rows.length, begin + count * kFastScanBlockRows);
+    for (size_t row = begin; row < end; ++row) {
+      if (queue.accepts(table->estimate(sums[row - begin]) - table->error)) {
+        score(row);
+      }
+    }
+  }
+}
+
+std::vector<InternalSearchResult> IndexIVFShard::finish_quantized(std::vector<CodeCandidate>& candidates,
+                                                                  const float* query, int k,
+                                                                  bool include_vectors) const {
+  // exact rescoring against the raw rows
+  if (refine_factor_ > 0) {
+    for (auto& cand: candidates) {
+      if (cand.raw) {
+        cand.distance = L2_distance(cand.raw, query, dimension_);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+  }
+  if (candidates.size() > static_cast<size_t>(k)) {
+    candidates.resize(k);
+  }
+
+  std::vector<InternalSearchResult> result(candidates.size());
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const auto& cand = candidates[i];
+    result[i].id = cand.id;
+    result[i].distance = cand.distance;
+    if (!include_vectors) {
+      continue;
+    }
+    if (cand.raw) {
+      result[i].vector.assign(cand.raw, cand.raw + dimension_);
+      continue;
+    }
+    // lossy reconstruction when the raw rows were dropped
+    auto& vector = result[i].vector;
+    vector.resize(dimension_);
+    quantizer_->decode(cand.code, vector.data(), 1);
+    if (quantizer_->by_residual()) {
+      const float* c = coarse_centroids_->data() + cand.centroid * dimension_;
+      for (int j = 0; j < dimension_; ++j) {
+        vector[j] += c[j];
+      }
+    }
+  }
+  return result;
+}
+
+void IndexIVFShard::encode_posting(int64_t centroid, const int64_t* ids, const float* vectors, size_t n) {
+  if (n == 0) {
+    return;
+  }
+  auto& list = code_lists_[centroid];
+  const size_t code_size = quantizer_->code_size();
+  const size_t offset = list.codes.size();
+  const size_t first_row = list.vector_ids.size();
+  list.vector_ids.insert(list.vector_ids.end(), ids, ids + n);
+  list.codes.resize(offset + n * code_size);
+  encode_rows(centroid, vectors, n, list.codes.data() + offset);
+  pack_codes(list.codes.data() + offset, n, first_row, &list.packed);
+}
+
+void IndexIVFShard::pack_codes(const uint8_t* codes, size_t n, size_t first_row, std::vector<uint8_t>* packed) const {
+  if (quantizer_->fast_scan()) {
+    pack_fast_scan_codes(codes, n, static_cast<int>(quantizer_->code_size()), first_row, packed);
+  }
+}
+
+void IndexIVFShard::encode_rows(int64_t centroid, const float* vectors, size_t n, uint8_t* codes) const {
+  if (!quantizer_->by_residual()) {
+    quantizer_->encode(vectors, codes, n);
+    return;
+  }
+  std::vector<float> residuals(vectors, vectors + n * dimension_);
+  const float* c = coarse_centroids_->data() + centroid * dimension_;
+  for (size_t i = 0; i < n; ++i) {
+    for (int j = 0; j < dimension_; ++j) {
+      residuals[i * dimension_ + j] -= c[j];
+    }
+  }
+  quantizer_->encode(residuals.data(), codes, n);
+}
+
+std::vector<int64_t> IndexIVFShard::posting_centroids() const {
+  if (storage_mode_ == PostingStorageMode::ARENA) {
+    return arena_.centroids();
+  }
+  std::vector<int64_t> centroids;
+  centroids.reserve(postings_.size());
+  for (const auto& [c, inv]: postings_) {
+    centroids.push_back(c);
+  }
+  for (size_t c = 0; c < mapped_partitions_.size(); ++c) {
+    if (mapped_partitions_[c].length > 0) {
+      centroids.push_back(static_cast<int64_t>(c));
+    }
+  }
+  return centroids;
+}
+
+void IndexIVFShard::set_quantizer(std::shared_ptr<const Quantizer> quantizer,
+                                  std::shared_ptr<const std::vector<float>> coarse_centroids, int refine_factor) {
+  // appended rows join the built postings so they are encoded with the rest
+  fold_segments();
+  code_lists_.clear();
+  quantizer_ = std::move(quantizer);
+  coarse_centroids_ = std::move(coarse_centroids);
+  refine_factor_ = refine_factor;
+  if (!quantizer_) {
+    return;
+  }
+  PostingView view;
+  for (auto c: posting_centroids()) {
+    if (find_posting(c, &view)) {
+      encode_posting(c, view.vector_ids, view.vectors, view.length);
+    }
+  }
+  if (refine_factor_ <= 0) {
+    postings_.clear();
+    arena_.clear();
+    release_mapped_partitions();
+  }
+}
+
+void IndexIVFShard::set_numa_node(int node) {
+  numa_node_ = node;
+  numa_executor_ = node >= 0 ? &get_numa_executor(node) : nullptr;
+  arena_.set_numa_node(node);
+}
+
+const CodeList* IndexIVFShard::find_code_list(int64_t centroid) const {
+  auto it = code_lists_.find(centroid);
+  return it == code_lists_.end() ? nullptr : &it->second;
+}
+
+void IndexIVFShard::set_storage_mode(PostingStorageMode mode) {
+  if (mode == storage_mode_) {
+    return;
+  }
+  if (storage_mode_ == PostingStorageMode::MMAP) {
+    // materialize the mapped lists before the mapping is dropped
+    PostingView view;
+    for (size_t c = 0; c < mapped_partitions_.size(); ++c) {
+      if (find_mapped_posting(static_cast<int64_t>(c), &view)) {
+        auto& inv = postings_[static_cast<int64_t>(c)];
+        inv.vector_ids.assign(view.vector_ids, view.vector_ids + view.length);
+        inv.vectors.assign(view.vectors, view.vectors + view.length * dimension_);
+      }
+    }
+    release_mapped_partitions();
+    storage_mode_ = PostingStorageMode::HASH_MAP;
+    if (mode == storage_mode_) {
+      return;
+    }
+  }
+  if (mode == PostingStorageMode::ARENA) {
+    std::unordered_map<int64_t, InvertedList> postings;
+    postings.swap(postings_);
+    storage_mode_ = mode;
+    add_postings(postings);
+    return;
+  }
+  if (storage_mode_ == PostingStorageMode::HASH_MAP) {
+    // HASH_MAP -> MMAP: existing lists become the overlay until partitions are attached
+    storage_mode_ = mode;
+    return;
+  }
+  PostingView view;
+  for (auto c: arena_.centroids()) {
+    arena_.find(c, &view);
+    auto& inv = postings_[c];
+    inv.vector_ids.assign(view.vector_ids, view.vector_ids + view.length);
+    inv.vectors.assign(view.vectors, view.vectors + view.length * dimension_);
+  }
+  arena_.clear();
+  storage_mode_ = mode;
+}
+
+size_t IndexIVFShard::size() const {
+  size_t appended = 0;
+  size_t removed = deleted_rows();
+  {
+    auto guard = get_epoch_domain().pin();
+    if (const SegmentSnapshot* snapshot = segments_.load(std::memory_order_seq_cst)) {
+      appended = snapshot->rows;
+      removed += snapshot->hidden_rows;
+    }
+  }
+  size_t total = appended;
+  if (quantizer_) {
+    for (const auto& [c, list]: code_lists_) {
+      total += list.vector_ids.size();
+    }
+  } else if (storage_mode_ == PostingStorageMode::ARENA) {
+    total += arena_.size();
+  } else {
+    total += mapped_rows_;
+    for (const auto& [c, inv]: postings_) {
+      total += inv.vector_ids.size();
+    }
+  }
+  // deleted rows and built lists hidden by compaction stay stored until the next rebuild
+  return total - std::min(total, removed);
+}
+
+std::vector<size_t> IndexIVFShard::list_lengths() const {
+  std::vector<size_t> result;
+  for (const auto& [c, n]: list_rows()) {
+    result.push_back(n);
+  }
+  return result;
+}
+
+std::unordered_map<int64_t, size_t> IndexIVFShard::list_rows() const {
+  auto guard = get_epoch_domain().pin();
+  const SegmentSnapshot* appended = segments_.load(std::memory_order_seq_cst);
+  std::unordered_map<int64_t, size_t> lengths;
+  for (auto c: base_centroids()) {
+    if (appended && !appended->base_visible(c)) {
+      continue;
+    }
+    const TombstoneBitmap* deleted = appended ? appended->find_base_deleted(c) : nullptr;
+    lengths[c] += base_ids(c, nullptr) - (deleted ? deleted->count() : 0);
+  }
+  if (appended) {
+    for (const auto& [c, segments]: appended->lists) {
+      for (const auto& segment: segments) {
+        lengths[c] += segment->vector_ids.size() - segment->deleted->count();
+      }
+    }
+  }
+  for (auto it = lengths.begin(); it != lengths.end();) {
+    it = it->second == 0 ? lengths.erase(it) : std::next(it);
+  }
+  return lengths;
+}
+
+size_t IndexIVFShard::remove_list(int64_t centroid) {
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  const SegmentSnapshot* current = segments_.load(std::memory_order_acquire);
+  auto next = current ? std::make_unique<SegmentSnapshot>(*current) : std::make_unique<SegmentSnapshot>();
+  const bool with_base = next->base_visible(centroid);
+  size_t dropped = 0;
+  auto live = live_rows(centroid, *next, with_base, &dropped);
+  if (locations_valid_) {
+    for (auto id: live->vector_ids) {
+      locations_.erase(id);
+    }
+  }
+  auto empty = std::make_shared<PostingSegment>();
+  empty->deleted = std::make_shared<TombstoneBitmap>(0);
+  replace_list(next.get(), centroid, std::move(empty), with_base);
+  deleted_rows_.fetch_sub(dropped, std::memory_order_relaxed);
+  publish(std::move(next), current);
+  return live->vector_ids.size();
+}
+
+void IndexIVFShard::replace_lists(const std::unordered_map<int64_t, InvertedList>& lists) {
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  const SegmentSnapshot* current = segments_.load(std::memory_order_acquire);
+  auto next = current ? std::make_unique<SegmentSnapshot>(*current) : std::make_unique<SegmentSnapshot>();
+  for (const auto& [centroid, inv]: lists) {
+    const bool with_base = next->base_visible(centroid);
+    size_t dropped = 0;
+    if (with_base) {
+      if (const TombstoneBitmap* deleted = next->find_base_deleted(centroid)) {
+        dropped += deleted->count();
+      }
+    }
+    if (locations_valid_) {
+      size_t ignored = 0;
+      for (auto id: live_rows(centroid, *next, with_base, &ignored)->vector_ids) {
+        locations_.erase(id);
+      }
+    }
+    if (const SegmentList* segments = next->find(centroid)) {
+      for (const auto& segment: *segments) {
+        dropped += segment->deleted->count();
+      }
+    }
+    deleted_rows_.fetch_sub(dropped, std::memory_order_relaxed);
+  }
+  // indexed only once every old row is forgotten, as a row may move between the lists
+  for (const auto& [centroid, inv]: lists) {
+    const bool with_base = next->base_visible(centroid);
+    const size_t n = inv.vector_ids.size();
+    auto segment = std::make_shared<PostingSegment>();
+    segment->vector_ids = inv.vector_ids;
+    if (!quantizer_ || refine_factor_ > 0) {
+      segment->vectors = inv.vectors;
+    }
+    if (quantizer_ && n > 0) {
+      segment->codes.resize(n * quantizer_->code_size());
+      encode_rows(centroid, inv.vectors.data(), n, segment->codes.data());
+      pack_codes(segment->codes.data(), n, 0, &segment->packed);
+    }
+    segment->deleted = std::make_shared<TombstoneBitmap>(n);
+    replace_list(next.get(), centroid, std::move(segment), with_base);
+  }
+  publish(std::move(next), current);
+}
+
+size_t IndexIVFShard::memory_bytes() const {
+  size_t codes = 0;
+  {
+    // appended segments are counted with the codes, both exist in every storage mode
+    auto guard = get_epoch_domain().pin();
+    const SegmentSnapshot* appended = segments_.load(std::memory_order_seq_cst);
+    codes += appended ? appended->bytes : 0;
+  }
+  for (const auto& [c, list]: code_lists_) {
+    codes += sizeof(std::pair<const int64_t, CodeList>) + sizeof(void*);
+    codes += list.vector_ids.capacity() * sizeof(int64_t) + list.codes.capacity() + list.packed.capacity();
+  }
+  if (storage_mode_ == PostingStorageMode::ARENA) {
+    return codes + arena_.memory_bytes();
+  }
+  // rough per-node overhead of unordered_map: key/value node, next pointer and bucket slot;
+  // mapped partitions live in the page cache and only their descriptors count here
+  size_t total = postings_.bucket_count() * sizeof(void*);
+  total += mapped_partitions_.capacity() * sizeof(PartitionDescriptor) + codes;
+  for (const auto& [c, inv]: postings_) {
+    total += sizeof(std::pair<const int64_t, InvertedList>) + sizeof(void*);
+    total += inv.vector_ids.capacity() * sizeof(int64_t) + inv.vectors.capacity() * sizeof(float);
+  }
+  return total;
+}
+
 } // namespace dann
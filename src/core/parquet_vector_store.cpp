@@ -0,0 +1,359 @@
+//
+// Parquet-backed vector store: Arrow column chunks exposed as contiguous blocks.
+//
+
+#include "dann/parquet_vector_store.h"
+
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <parquet/arrow/reader.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/file_reader.h>
+#include <parquet/metadata.h>
+
+#include <algorithm>
+
+#include "dann/distance_kernels.h"
+#include "dann/distributed_index_ivf.h"
+#include "dann/logger.h"
+
+namespace dann {
+
+namespace {
+// the rows of one vector chunk as a single run of rows * d floats, nullptr when
+// the chunk has nulls, is not float32 or its rows are not all d long
+const float* contiguous_vectors(const std::shared_ptr<arrow::Array>& chunk, int* d) {
+    if (chunk->null_count() != 0) {
+        return nullptr;
+    }
+    std::shared_ptr<arrow::Array> values;
+    int64_t first = 0;
+    if (chunk->type_id() == arrow::Type::FIXED_SIZE_LIST) {
+        auto list = std::static_pointer_cast<arrow::FixedSizeListArray>(chunk);
+        const int size = list->list_type()->list_size();
+        if (*d > 0 && size != *d) {
+            return nullptr;
+        }
+        *d = size;
+        values = list->values();
+        first = list->length() > 0 ? list->value_offset(0) : 0;
+    } else if (chunk->type_id() == arrow::Type::LIST) {
+        // equal lengths make the offsets consecutive, so the rows are back to back
+        auto list = std::static_pointer_cast<arrow::ListArray>(chunk);
+        for (int64_t i = 0; i < list->length(); ++i) {
+            if (*d <= 0) {
+                *d = list->value_length(i);
+            }
+            if (list->value_length(i) != *d) {
+                return nullptr;
+            }
+        }
+        values = list->values();
+        first = list->length() > 0 ? list->value_offset(0) : 0;
+    } else {
+        return nullptr;
+    }
+    if (values->type_id() != arrow::Type::FLOAT || values->null_count() != 0) {
+        return nullptr;
+    }
+    return std::static_pointer_cast<arrow::FloatArray>(values)->raw_values() + first;
+}
+}
+
+float VectorView::dot_product(const VectorView& other) const {
+    return inner_product(data_, other.data_, static_cast<int>(size_));
+}
+
+float VectorView::l2_distance_square(const VectorView& other) const {
+    return l2_sqr(data_, other.data_, static_cast<int>(size_));
+}
+
+VectorView ParquetVectorStore::Iterator::operator*() const {
+    const Block& block = store_->blocks_[block_];
+    const size_t d = static_cast<size_t>(store_->dimension_);
+    return VectorView(block.vectors + row_ * d, d, block.ids[row_]);
+}
+
+ParquetVectorStore::Iterator& ParquetVectorStore::Iterator::operator++() {
+    if (++row_ == store_->blocks_[block_].rows) {
+        ++block_;
+        row_ = 0;
+    }
+    return *this;
+}
+
+ParquetVectorStore::~ParquetVectorStore() = default;
+
+void ParquetVectorStore::clear() {
+    table_.reset();
+    blocks_.clear();
+    rows_by_id_.clear();
+    size_ = 0;
+    dimension_ = 0;
+}
+
+bool ParquetVectorStore::load(const std::string& path, const std::string& id_column,
+                              const std::string& vector_column) {
+    clear();
+    auto file = arrow::io::MemoryMappedFile::Open(path, arrow::io::FileMode::READ);
+    if (!file.ok()) {
+        LOG_ERRORF("failed to open %s: %s", path.c_str(), file.status().ToString().c_str());
+        return false;
+    }
+    auto reader = parquet::arrow::OpenFile(*file, arrow::default_memory_pool());
+    if (!reader.ok()) {
+        LOG_ERRORF("failed to read parquet footer of %s: %s", path.c_str(), reader.status().ToString().c_str());
+        return false;
+    }
+    std::shared_ptr<arrow::Table> table;
+    auto status = (*reader)->ReadTable(&table);
+    if (!status.ok()) {
+        LOG_ERRORF("failed to decode %s: %s", path.c_str(), status.ToString().c_str());
+        return false;
+    }
+    auto ids = table->GetColumnByName(id_column);
+    auto vectors = table->GetColumnByName(vector_column);
+    if (!ids || !vectors) {
+        LOG_ERRORF("%s has no '%s' or '%s' column", path.c_str(), id_column.c_str(), vector_column.c_str());
+        return false;
+    }
+    // both columns come chunked per row group; only a layout that differs needs a copy
+    bool aligned = ids->num_chunks() == vectors->num_chunks();
+    for (int c = 0; aligned && c < ids->num_chunks(); ++c) {
+        aligned = ids->chunk(c)->length() == vectors->chunk(c)->length();
+    }
+    if (!aligned) {
+        auto combined = table->CombineChunks();
+        if (!combined.ok()) {
+            LOG_ERRORF("failed to align the columns of %s: %s", path.c_str(), combined.status().ToString().c_str());
+            return false;
+        }
+        table = *combined;
+        ids = table->GetColumnByName(id_column);
+        vectors = table->GetColumnByName(vector_column);
+    }
+
+    int d = 0;
+    for (int c = 0; c < ids->num_chunks(); ++c) {
+        const auto& id_chunk = ids->chunk(c);
+        if (id_chunk->type_id() != arrow::Type::INT64 || id_chunk->null_count() != 0) {
+            LOG_ERRORF("%s: column '%s' must be non-null int64", path.c_str(), id_column.c_str());
+            clear();
+            return false;
+        }
+        const float* rows = contiguous_vectors(vectors->chunk(c), &d);
+        if (!rows) {
+            LOG_ERRORF("%s: column '%s' must hold non-null float32 lists of one length", path.c_str(),
+                       vector_column.c_str());
+            clear();
+            return false;
+        }
+        if (id_chunk->length() == 0) {
+            continue;
+        }
+        blocks_.push_back(Block{std::static_pointer_cast<arrow::Int64Array>(id_chunk)->raw_values(), rows,
+                                static_cast<size_t>(id_chunk->length())});
+        size_ += blocks_.back().rows;
+    }
+    dimension_ = d;
+    table_ = std::move(table);
+
+    rows_by_id_.reserve(size_);
+    for (const auto& block: blocks_) {
+        for (size_t i = 0; i < block.rows; ++i) {
+            rows_by_id_[block.ids[i]] = block.vectors + i * static_cast<size_t>(dimension_);
+        }
+    }
+    return true;
+}
+
+const float* ParquetVectorStore::vector_data(int64_t id) const {
+    auto it = rows_by_id_.find(id);
+    return it == rows_by_id_.end() ? nullptr : it->second;
+}
+
+const float* ParquetVectorStore::get_vector_data(int64_t id, size_t* dimension) const {
+    const float* data = vector_data(id);
+    if (dimension) {
+        *dimension = data ? static_cast<size_t>(dimension_) : 0;
+    }
+    return data;
+}
+
+VectorView ParquetVectorStore::operator[](int64_t id) const {
+    const float* data = vector_data(id);
+    return data ? VectorView(data, static_cast<size_t>(dimension_), id) : VectorView();
+}
+
+VectorView ParquetVectorStore::at(int64_t id) const {
+    const float* data = vector_data(id);
+    if (!data) {
+        throw std::out_of_range("no vector with id " + std::to_string(id));
+    }
+    return VectorView(data, static_cast<size_t>(dimension_), id);
+}
+
+std::vector<VectorView> ParquetVectorStore::batch_get(const std::vector<int64_t>& ids) const {
+    std::vector<VectorView> views;
+    views.reserve(ids.size());
+    for (int64_t id: ids) {
+        views.push_back((*this)[id]);
+    }
+    return views;
+}
+
+ParquetChunkReader::ParquetChunkReader() = default;
+
+ParquetChunkReader::~ParquetChunkReader() = default;
+
+bool ParquetChunkReader::open(const std::string& path, const std::string& id_column,
+                              const std::string& vector_column) {
+    reader_.reset();
+    row_group_.reset();
+    failed_ = false;
+    next_group_ = 0;
+    auto file = arrow::io::ReadableFile::Open(path);
+    if (!file.ok()) {
+        LOG_ERRORF("failed to open %s: %s", path.c_str(), file.status().ToString().c_str());
+        return false;
+    }
+    auto reader = parquet::arrow::OpenFile(*file, arrow::default_memory_pool());
+    if (!reader.ok()) {
+        LOG_ERRORF("failed to read parquet footer of %s: %s", path.c_str(), reader.status().ToString().c_str());
+        return false;
+    }
+    reader_ = std::move(*reader);
+    std::shared_ptr<arrow::Schema> schema;
+    if (!reader_->GetSchema(&schema).ok()) {
+        reader_.reset();
+        return false;
+    }
+    const int id_index = schema->GetFieldIndex(id_column);
+    const int vector_index = schema->GetFieldIndex(vector_column);
+    if (id_index < 0 || vector_index < 0) {
+        LOG_ERRORF("%s has no '%s' or '%s' column", path.c_str(), id_column.c_str(), vector_column.c_str());
+        reader_.reset();
+        return false;
+    }
+    columns_ = {id_index, vector_index};
+    row_groups_ = reader_->num_row_groups();
+    rows_ = reader_->parquet_reader()->metadata()->num_rows();
+
+    // a List column only tells its length from the data: peek at the first row group
+    const auto& type = schema->field(vector_index)->type();
+    dimension_ = type->id() == arrow::Type::FIXED_SIZE_LIST
+                     ? std::static_pointer_cast<arrow::FixedSizeListType>(type)->list_size()
+                     : 0;
+    if (dimension_ == 0 && row_groups_ > 0) {
+        VectorChunk first;
+        if (!next(0, &first)) {
+            reader_.reset();
+            return false;
+        }
+        rewind();
+    }
+    return true;
+}
+
+bool ParquetChunkReader::rewind() {
+    next_group_ = 0;
+    failed_ = false;
+    row_group_.reset();
+    return reader_ != nullptr;
+}
+
+bool ParquetChunkReader::next(size_t max_rows, VectorChunk* chunk) {
+    (void)max_rows;
+    while (reader_ && !failed_ && next_group_ < row_groups_) {
+        std::shared_ptr<arrow::Table> table;
+        auto status = reader_->ReadRowGroup(next_group_++, columns_, &table);
+        if (status.ok()) {
+            auto combined = table->CombineChunks();
+            status = combined.status();
+            if (status.ok()) {
+                table = *combined;
+            }
+        }
+        if (!status.ok()) {
+            LOG_ERRORF("failed to decode row group %d: %s", next_group_ - 1, status.ToString().c_str());
+            failed_ = true;
+            return false;
+        }
+        if (table->num_rows() == 0) {
+            continue;
+        }
+        const auto ids = table->column(0)->chunk(0);
+        const float* rows = contiguous_vectors(table->column(1)->chunk(0), &dimension_);
+        if (ids->type_id() != arrow::Type::INT64 || ids->null_count() != 0 || !rows) {
+            LOG_ERRORF("row group %d is not non-null int64 ids and float32 lists of one length", next_group_ - 1);
+            failed_ = true;
+            return false;
+        }
+        row_group_ = std::move(table);
+        chunk->ids = std::static_pointer_cast<arrow::Int64Array>(ids)->raw_values();
+        chunk->vectors = rows;
+        chunk->rows = static_cast<size_t>(row_group_->num_rows());
+        return true;
+    }
+    return false;
+}
+
+bool write_vectors_to_parquet(const std::string& path, const float* vectors, const int64_t* ids, size_t n, int d,
+                              size_t row_group_rows) {
+    arrow::Int64Builder id_builder;
+    arrow::FloatBuilder value_builder;
+    std::shared_ptr<arrow::Array> id_array;
+    std::shared_ptr<arrow::Array> values;
+    if (!id_builder.AppendValues(ids, static_cast<int64_t>(n)).ok() || !id_builder.Finish(&id_array).ok() ||
+        !value_builder.AppendValues(vectors, static_cast<int64_t>(n * d)).ok() ||
+        !value_builder.Finish(&values).ok()) {
+        return false;
+    }
+    auto vector_array = arrow::FixedSizeListArray::FromArrays(values, d);
+    if (!vector_array.ok()) {
+        return false;
+    }
+    auto schema = arrow::schema({arrow::field("id", arrow::int64()),
+                                 arrow::field("vector", arrow::fixed_size_list(arrow::float32(), d))});
+    auto table = arrow::Table::Make(schema, {id_array, *vector_array}, static_cast<int64_t>(n));
+
+    auto out = arrow::io::FileOutputStream::Open(path);
+    if (!out.ok()) {
+        LOG_ERRORF("failed to create %s: %s", path.c_str(), out.status().ToString().c_str());
+        return false;
+    }
+    // the stored Arrow schema brings the column back as FixedSizeList rather than List
+    auto arrow_props = parquet::ArrowWriterProperties::Builder().store_schema()->build();
+    auto status = parquet::arrow::WriteTable(*table, arrow::default_memory_pool(), *out,
+                                             static_cast<int64_t>(std::max<size_t>(1, row_group_rows)),
+                                             parquet::default_writer_properties(), arrow_props);
+    if (!status.ok()) {
+        LOG_ERRORF("failed to write %s: %s", path.c_str(), status.ToString().c_str());
+        return false;
+    }
+    return (*out)->Close().ok();
+}
+
+void build_index_from_store(DistributedIndexIVF& index, const ParquetVectorStore& store) {
+    if (!store.empty() && store.dimension() != index.dimension()) {
+        LOG_ERRORF("store dimension %d does not match the index (d=%d)", store.dimension(), index.dimension());
+        return;
+    }
+    const auto& blocks = store.blocks();
+    if (blocks.size() == 1) {
+        index.build_index(blocks[0].vectors, blocks[0].ids, static_cast<int64_t>(blocks[0].rows));
+        return;
+    }
+    const size_t d = static_cast<size_t>(store.dimension());
+    std::vector<float> vectors;
+    std::vector<int64_t> ids;
+    vectors.reserve(store.size() * d);
+    ids.reserve(store.size());
+    for (const auto& block: blocks) {
+        vectors.insert(vectors.end(), block.vectors, block.vectors + block.rows * d);
+        ids.insert(ids.end(), block.ids, block.ids + block.rows);
+    }
+    index.build_index(vectors.data(), ids.data(), static_cast<int64_t>(ids.size()));
+}
+
+} // namespace dann
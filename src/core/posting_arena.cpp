@@ -0,0 +1,152 @@
+//
+// Contiguous storage for IVF posting lists.
+//
+#include "dann/posting_arena.h"
+
+#include <algorithm>
+
+namespace dann {
+
+namespace {
+constexpr size_t kFloatsPerCacheLine = kCacheLineSize / sizeof(float);
+}
+
+PostingArena::PostingArena(int d): dimension_(d) {}
+
+void PostingArena::reserve(size_t rows) {
+  ids_.reserve(ids_.size() + rows);
+  vectors_.reserve(vectors_.size() + rows * dimension_ + kFloatsPerCacheLine);
+}
+
+size_t PostingArena::aligned_vector_tail() {
+  const size_t tail = (vectors_.size() + kFloatsPerCacheLine - 1) / kFloatsPerCacheLine * kFloatsPerCacheLine;
+  vectors_.resize(tail, 0.0f);
+  return tail;
+}
+
+void PostingArena::append(int64_t centroid, const int64_t *ids, const float *vectors, size_t n) {
+  if (n == 0 || centroid < 0) {
+    return;
+  }
+  if (static_cast<size_t>(centroid) >= slices_.size()) {
+    slices_.resize(static_cast<size_t>(centroid) + 1);
+  }
+  const size_t d = static_cast<size_t>(dimension_);
+  PostingSlice &slice = slices_[centroid];
+
+  const bool at_tail = slice.length > 0 &&
+                       slice.id_offset + slice.length == ids_.size() &&
+                       slice.vector_offset + slice.length * d == vectors_.size();
+  if (at_tail) {
+    ids_.insert(ids_.end(), ids, ids + n);
+    vectors_.insert(vectors_.end(), vectors, vectors + n * d);
+    slice.length += n;
+    live_rows_ += n;
+    return;
+  }
+
+  // new list or a list in the middle of the arena: (re)write it at the tail
+  const size_t old_length = slice.length;
+  const size_t vector_offset = aligned_vector_tail();
+  const size_t id_offset = ids_.size();
+  ids_.resize(id_offset + old_length + n);
+  vectors_.resize(vector_offset + (old_length + n) * d);
+  if (old_length > 0) {
+    std::copy(ids_.begin() + slice.id_offset, ids_.begin() + slice.id_offset + old_length,
+              ids_.begin() + id_offset);
+    std::copy(vectors_.begin() + slice.vector_offset, vectors_.begin() + slice.vector_offset + old_length * d,
+              vectors_.begin() + vector_offset);
+    dead_rows_ += old_length;
+  }
+  std::copy(ids, ids + n, ids_.begin() + id_offset + old_length);
+  std::copy(vectors, vectors + n * d, vectors_.begin() + vector_offset + old_length * d);
+
+  slice.id_offset = id_offset;
+  slice.vector_offset = vector_offset;
+  slice.length = old_length + n;
+  live_rows_ += n;
+
+  if (dead_rows_ > live_rows_) {
+    compact();
+  }
+}
+
+bool PostingArena::find(int64_t centroid, PostingView *view) const {
+  if (centroid < 0 || static_cast<size_t>(centroid) >= slices_.size()) {
+    return false;
+  }
+  const PostingSlice &slice = slices_[centroid];
+  if (slice.length == 0) {
+    return false;
+  }
+  view->vector_ids = ids_.data() + slice.id_offset;
+  view->vectors = vectors_.data() + slice.vector_offset;
+  view->length = slice.length;
+  return true;
+}
+
+void PostingArena::compact() {
+  const size_t d = static_cast<size_t>(dimension_);
+  NumaVector<int64_t> ids(ids_.get_allocator());
+  NumaVector<float> vectors(vectors_.get_allocator());
+  ids.reserve(live_rows_);
+  vectors.reserve(live_rows_ * d + slices_.size() * kFloatsPerCacheLine);
+
+  for (auto &slice: slices_) {
+    if (slice.length == 0) {
+      continue;
+    }
+    const size_t vector_offset = (vectors.size() + kFloatsPerCacheLine - 1) / kFloatsPerCacheLine * kFloatsPerCacheLine;
+    vectors.resize(vector_offset, 0.0f);
+    const size_t id_offset = ids.size();
+    ids.insert(ids.end(), ids_.begin() + slice.id_offset, ids_.begin() + slice.id_offset + slice.length);
+    vectors.insert(vectors.end(), vectors_.begin() + slice.vector_offset,
+                   vectors_.begin() + slice.vector_offset + slice.length * d);
+    slice.id_offset = id_offset;
+    slice.vector_offset = vector_offset;
+  }
+  ids_.swap(ids);
+  vectors_.swap(vectors);
+  dead_rows_ = 0;
+}
+
+void PostingArena::set_numa_node(int node) {
+  if (node == numa_node()) {
+    return;
+  }
+  NumaVector<int64_t> ids(ids_.begin(), ids_.end(), NumaAllocator<int64_t>(node));
+  NumaVector<float> vectors{NumaAllocator<float>(node)};
+  vectors.reserve(vectors_.capacity());
+  vectors.assign(vectors_.begin(), vectors_.end());
+  ids_.swap(ids);
+  vectors_.swap(vectors);
+}
+
+void PostingArena::clear() {
+  ids_.clear();
+  ids_.shrink_to_fit();
+  vectors_.clear();
+  vectors_.shrink_to_fit();
+  slices_.clear();
+  slices_.shrink_to_fit();
+  live_rows_ = 0;
+  dead_rows_ = 0;
+}
+
+std::vector<int64_t> PostingArena::centroids() const {
+  std::vector<int64_t> result;
+  for (size_t c = 0; c < slices_.size(); ++c) {
+    if (slices_[c].length > 0) {
+      result.push_back(static_cast<int64_t>(c));
+    }
+  }
+  return result;
+}
+
+size_t PostingArena::memory_bytes() const {
+  return ids_.capacity() * sizeof(int64_t) +
+         vectors_.capacity() * sizeof(float) +
+         slices_.capacity() * sizeof(PostingSlice);
+}
+
+} // namespace dann
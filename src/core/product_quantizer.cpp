@@ -0,0 +1,127 @@
+//
+// Product quantizer: d is split into m sub-vectors, each replaced by the id
+// of its nearest sub-centroid (one byte per sub-vector).
+//
+#include "dann/product_quantizer.h"
+
+#include "dann/clustering.h"
+#include "dann/fast_scan.h"
+#include "dann/logger.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <faiss/utils/distances.h>
+
+namespace dann {
+
+namespace {
+
+// ADC: the per-list table is built once in set_query, each code costs m lookups
+class PQDistanceComputer: public QuantizedDistanceComputer {
+public:
+    explicit PQDistanceComputer(const ProductQuantizer& pq)
+        : pq_(pq), table_(static_cast<size_t>(pq.m()) * pq.ksub()) {}
+
+    void set_query(const float* x) override {
+        pq_.compute_distance_table(x, table_.data());
+        if (pq_.fast_scan()) {
+            build_fast_scan_table(table_.data(), pq_.m(), &fast_scan_table_);
+        }
+    }
+
+    float distance(const uint8_t* code) const override {
+        const int m = pq_.m();
+        const int ksub = pq_.ksub();
+        const float* table = table_.data();
+        float dis = 0.0f;
+        for (int i = 0; i < m; ++i) {
+            dis += table[code[i]];
+            table += ksub;
+        }
+        return dis;
+    }
+
+    const FastScanTable* fast_scan_table() const override {
+        return pq_.fast_scan() ? &fast_scan_table_ : nullptr;
+    }
+
+private:
+    const ProductQuantizer& pq_;
+    std::vector<float> table_;
+    FastScanTable fast_scan_table_;
+};
+
+}
+
+ProductQuantizer::ProductQuantizer(int d, int m, int nbits, bool fast_scan)
+    : Quantizer(d), m_(m), dsub_(m > 0 ? d / m : 0), ksub_(1 << nbits), fast_scan_(fast_scan && nbits == 4) {}
+
+bool ProductQuantizer::train(const float* x, size_t n) {
+    if (n < static_cast<size_t>(ksub_)) {
+        LOG_ERRORF("pq training needs at least %d vectors, got %zu", ksub_, n);
+        return false;
+    }
+    centroids_.resize(static_cast<size_t>(m_) * ksub_ * dsub_);
+    std::vector<float> sub_vectors(n * dsub_);
+    ClusteringParameters cp;
+    cp.niter = 10;
+    for (int m = 0; m < m_; ++m) {
+        for (size_t i = 0; i < n; ++i) {
+            const float* src = x + i * d_ + static_cast<size_t>(m) * dsub_;
+            std::copy(src, src + dsub_, sub_vectors.begin() + i * dsub_);
+        }
+        Clustering clustering(dsub_, ksub_, cp);
+        clustering.train(sub_vectors, n);
+        std::copy(clustering.centroids.begin(), clustering.centroids.end(),
+                  centroids_.begin() + static_cast<size_t>(m) * ksub_ * dsub_);
+    }
+    trained_ = true;
+    return true;
+}
+
+void ProductQuantizer::encode(const float* x, uint8_t* codes, size_t n) const {
+    for (size_t i = 0; i < n; ++i) {
+        const float* vector = x + i * d_;
+        uint8_t* code = codes + i * m_;
+        for (int m = 0; m < m_; ++m) {
+            const float* sub = vector + static_cast<size_t>(m) * dsub_;
+            float best = std::numeric_limits<float>::max();
+            int best_code = 0;
+            for (int c = 0; c < ksub_; ++c) {
+                const float dis = faiss::fvec_L2sqr(sub, sub_centroid(m, c), dsub_);
+                if (dis < best) {
+                    best = dis;
+                    best_code = c;
+                }
+            }
+            code[m] = static_cast<uint8_t>(best_code);
+        }
+    }
+}
+
+void ProductQuantizer::decode(const uint8_t* codes, float* x, size_t n) const {
+    for (size_t i = 0; i < n; ++i) {
+        const uint8_t* code = codes + i * m_;
+        float* vector = x + i * d_;
+        for (int m = 0; m < m_; ++m) {
+            const float* sub = sub_centroid(m, code[m]);
+            std::copy(sub, sub + dsub_, vector + static_cast<size_t>(m) * dsub_);
+        }
+    }
+}
+
+void ProductQuantizer::compute_distance_table(const float* x, float* table) const {
+    for (int m = 0; m < m_; ++m) {
+        const float* sub = x + static_cast<size_t>(m) * dsub_;
+        for (int c = 0; c < ksub_; ++c) {
+            table[static_cast<size_t>(m) * ksub_ + c] = faiss::fvec_L2sqr(sub, sub_centroid(m, c), dsub_);
+        }
+    }
+}
+
+std::unique_ptr<QuantizedDistanceComputer> ProductQuantizer::distance_computer() const {
+    return std::make_unique<PQDistanceComputer>(*this);
+}
+
+}
@@ -0,0 +1,36 @@
+//
+// Compressed posting codecs for IndexIVFShard.
+//
+#include "dann/quantizer.h"
+
+#include "dann/fast_scan.h"
+#include "dann/logger.h"
+#include "dann/product_quantizer.h"
+#include "dann/scalar_quantizer.h"
+
+namespace dann {
+
+std::unique_ptr<Quantizer> make_quantizer(int d, const QuantizationParameters& params) {
+    switch (params.type) {
+        case QuantizerType::PQ:
+            if (params.pq_m <= 0 || d % params.pq_m != 0 || params.pq_nbits <= 0 || params.pq_nbits > 8) {
+                LOG_ERRORF("invalid pq parameters m=%d nbits=%d for d=%d", params.pq_m, params.pq_nbits, d);
+                return nullptr;
+            }
+            return std::make_unique<ProductQuantizer>(d, params.pq_m, params.pq_nbits);
+        case QuantizerType::PQ_FASTSCAN:
+            if (params.pq_m <= 0 || d % params.pq_m != 0 || params.pq_m > kFastScanMaxSubQuantizers) {
+                LOG_ERRORF("invalid fast-scan pq parameters m=%d for d=%d", params.pq_m, d);
+                return nullptr;
+            }
+            return std::make_unique<ProductQuantizer>(d, params.pq_m, 4, true);
+        case QuantizerType::SQ8:
+        case QuantizerType::FP16:
+            return std::make_unique<ScalarQuantizer>(d, params.type);
+        case QuantizerType::NONE:
+        default:
+            return nullptr;
+    }
+}
+
+}
@@ -0,0 +1,183 @@
+//
+// Sharded LRU result cache with a doorkeeper admission filter.
+//
+
+#include "dann/result_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace dann {
+
+namespace {
+constexpr uint64_t kFnvOffset = 1469598103934665603ull;
+constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+uint64_t mix(uint64_t h, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        h = (h ^ ((value >> (i * 8)) & 0xff)) * kFnvPrime;
+    }
+    return h;
+}
+
+uint64_t mix(uint64_t h, const std::string& text) {
+    for (unsigned char c: text) {
+        h = (h ^ c) * kFnvPrime;
+    }
+    return mix(h, text.size());
+}
+}
+
+ResultCache::ResultCache(int dimension, ResultCacheOptions options)
+    : dimension_(dimension), options_(std::move(options)) {
+    options_.shards = std::max<size_t>(1, options_.shards);
+    shard_capacity_ = std::max<size_t>(1, (options_.capacity + options_.shards - 1) / options_.shards);
+    // 8 doorkeeper bits per entry keeps false admissions rare
+    size_t bits = 64;
+    while (bits < shard_capacity_ * 8) {
+        bits <<= 1;
+    }
+    shards_.reserve(options_.shards);
+    for (size_t i = 0; i < options_.shards; ++i) {
+        auto shard = std::make_unique<Shard>();
+        if (options_.admit_on_second_miss) {
+            shard->doorkeeper.assign(bits / 64, 0);
+        }
+        shards_.push_back(std::move(shard));
+    }
+}
+
+ResultCache::Key ResultCache::make_key(const float* query, int k, const InternalSearchParameters& params) const {
+    Key key;
+    key.query.assign(query, query + dimension_);
+    if (options_.quantization_step > 0.0f) {
+        const double step = options_.quantization_step;
+        for (float& x: key.query) {
+            x = static_cast<float>(std::nearbyint(static_cast<double>(x) / step) * step);
+        }
+    }
+    key.k = k;
+    key.params = params;
+    uint64_t h = kFnvOffset;
+    for (float x: key.query) {
+        uint32_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        h = mix(h, bits);
+    }
+    h = mix(h, static_cast<uint64_t>(k));
+    h = mix(h, params.include_vectors ? 1 : 0);
+    h = mix(h, static_cast<uint64_t>(params.nprobe));
+    for (const auto& [name, value]: params.filter) {
+        h = mix(mix(h, name), value);
+    }
+    key.hash = mix(h, static_cast<uint64_t>(params.ef_search));
+    return key;
+}
+
+bool ResultCache::same_key(const Key& a, const Key& b) {
+    // only the parameters that change the results are part of the key
+    return a.k == b.k && a.params.include_vectors == b.params.include_vectors &&
+           a.params.nprobe == b.params.nprobe && a.params.ef_search == b.params.ef_search &&
+           a.params.filter == b.params.filter &&
+           std::memcmp(a.query.data(), b.query.data(), a.query.size() * sizeof(float)) == 0;
+}
+
+ResultCache::Shard& ResultCache::shard_for(uint64_t hash) {
+    return *shards_[(hash >> 40) % shards_.size()];
+}
+
+bool ResultCache::lookup(const float* query, int k, const InternalSearchParameters& params, uint64_t version,
+                         std::vector<InternalSearchResult>* results) {
+    Key key = make_key(query, k, params);
+    Shard& shard = shard_for(key.hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key.hash);
+    if (it == shard.entries.end() || !same_key(it->second->key, key)) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (it->second->version != version) {
+        // computed before a later write
+        shard.lru.erase(it->second);
+        shard.entries.erase(it);
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    *results = it->second->results;
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ResultCache::admit(Shard& shard, uint64_t hash) {
+    if (shard.doorkeeper.empty()) {
+        return true;
+    }
+    const size_t slot = hash & (shard.doorkeeper.size() * 64 - 1);
+    uint64_t& word = shard.doorkeeper[slot / 64];
+    const uint64_t bit = uint64_t(1) << (slot % 64);
+    if (word & bit) {
+        return true;
+    }
+    word |= bit;
+    // aging: the filter only remembers the recent misses
+    if (++shard.doorkeeper_inserts >= shard_capacity_ * 4) {
+        std::fill(shard.doorkeeper.begin(), shard.doorkeeper.end(), 0);
+        shard.doorkeeper_inserts = 0;
+    }
+    return false;
+}
+
+void ResultCache::insert(const float* query, int k, const InternalSearchParameters& params, uint64_t version,
+                         const std::vector<InternalSearchResult>& results) {
+    Key key = make_key(query, k, params);
+    Shard& shard = shard_for(key.hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key.hash);
+    if (it != shard.entries.end()) {
+        // a newer result for the key, or a hash collision: the latest one wins
+        it->second->key = std::move(key);
+        it->second->version = version;
+        it->second->results = results;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    if (!admit(shard, key.hash)) {
+        return;
+    }
+    const uint64_t hash = key.hash;
+    shard.lru.push_front(Entry{std::move(key), version, results});
+    shard.entries[hash] = shard.lru.begin();
+    insertions_.fetch_add(1, std::memory_order_relaxed);
+    if (shard.lru.size() > shard_capacity_) {
+        shard.entries.erase(shard.lru.back().key.hash);
+        shard.lru.pop_back();
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ResultCache::clear() {
+    for (auto& shard: shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->lru.clear();
+        shard->entries.clear();
+        std::fill(shard->doorkeeper.begin(), shard->doorkeeper.end(), 0);
+        shard->doorkeeper_inserts = 0;
+    }
+}
+
+size_t ResultCache::size() const {
+    size_t total = 0;
+    for (const auto& shard: shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->lru.size();
+    }
+    return total;
+}
+
+ResultCache::Stats ResultCache::stats() const {
+    return Stats{hits_.load(), misses_.load(), insertions_.load(), evictions_.load()};
+}
+
+}
@@ -0,0 +1,172 @@
+//
+// Roaring id sets: array and bitset containers keyed by the high 48 bits.
+//
+
+#include "dann/roaring_bitmap.h"
+
+#include <iterator>
+
+namespace dann {
+
+bool RoaringBitmap::Container::add(uint16_t low) {
+    if (!bits.empty()) {
+        const uint64_t bit = uint64_t{1} << (low & 63);
+        if (bits[low >> 6] & bit) {
+            return false;
+        }
+        bits[low >> 6] |= bit;
+        ++cardinality;
+        return true;
+    }
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it != array.end() && *it == low) {
+        return false;
+    }
+    array.insert(it, low);
+    ++cardinality;
+    if (array.size() > kArrayMax) {
+        to_bitset();
+    }
+    return true;
+}
+
+bool RoaringBitmap::Container::remove(uint16_t low) {
+    if (!bits.empty()) {
+        const uint64_t bit = uint64_t{1} << (low & 63);
+        if (!(bits[low >> 6] & bit)) {
+            return false;
+        }
+        bits[low >> 6] &= ~bit;
+        --cardinality;
+        // some slack, so a set hovering at the limit does not convert back and forth
+        if (cardinality <= kArrayMax / 2) {
+            to_array();
+        }
+        return true;
+    }
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it == array.end() || *it != low) {
+        return false;
+    }
+    array.erase(it);
+    --cardinality;
+    return true;
+}
+
+void RoaringBitmap::Container::to_bitset() {
+    bits.assign(kBitsetWords, 0);
+    for (uint16_t low: array) {
+        bits[low >> 6] |= uint64_t{1} << (low & 63);
+    }
+    std::vector<uint16_t>().swap(array);
+}
+
+void RoaringBitmap::Container::to_array() {
+    array.clear();
+    array.reserve(cardinality);
+    for (size_t w = 0; w < bits.size(); ++w) {
+        for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+            array.push_back(static_cast<uint16_t>(w * 64 + static_cast<size_t>(__builtin_ctzll(word))));
+        }
+    }
+    std::vector<uint64_t>().swap(bits);
+}
+
+size_t RoaringBitmap::find_or_insert(uint64_t key) {
+    auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                               [](const Container& c, uint64_t k) { return c.key < k; });
+    if (it == containers_.end() || it->key != key) {
+        it = containers_.insert(it, Container{});
+        it->key = key;
+    }
+    return static_cast<size_t>(it - containers_.begin());
+}
+
+bool RoaringBitmap::add(int64_t id) {
+    const size_t index = find_or_insert(static_cast<uint64_t>(id) >> 16);
+    if (!containers_[index].add(static_cast<uint16_t>(id))) {
+        return false;
+    }
+    ++cardinality_;
+    return true;
+}
+
+bool RoaringBitmap::remove(int64_t id) {
+    const uint64_t key = static_cast<uint64_t>(id) >> 16;
+    auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                               [](const Container& c, uint64_t k) { return c.key < k; });
+    if (it == containers_.end() || it->key != key || !it->remove(static_cast<uint16_t>(id))) {
+        return false;
+    }
+    --cardinality_;
+    if (it->cardinality == 0) {
+        containers_.erase(it);
+    }
+    return true;
+}
+
+void RoaringBitmap::clear() {
+    containers_.clear();
+    cardinality_ = 0;
+}
+
+void RoaringBitmap::intersect(const RoaringBitmap& other) {
+    std::vector<Container> kept;
+    size_t cardinality = 0;
+    auto theirs = other.containers_.begin();
+    for (auto& mine: containers_) {
+        while (theirs != other.containers_.end() && theirs->key < mine.key) {
+            ++theirs;
+        }
+        if (theirs == other.containers_.end()) {
+            break;
+        }
+        if (theirs->key != mine.key) {
+            continue;
+        }
+        Container out;
+        out.key = mine.key;
+        if (!mine.bits.empty() && !theirs->bits.empty()) {
+            out.bits.resize(kBitsetWords);
+            uint32_t count = 0;
+            for (size_t w = 0; w < kBitsetWords; ++w) {
+                out.bits[w] = mine.bits[w] & theirs->bits[w];
+                count += static_cast<uint32_t>(__builtin_popcountll(out.bits[w]));
+            }
+            out.cardinality = count;
+            if (count <= kArrayMax) {
+                out.to_array();
+            }
+        } else if (mine.bits.empty() && theirs->bits.empty()) {
+            std::set_intersection(mine.array.begin(), mine.array.end(), theirs->array.begin(), theirs->array.end(),
+                                  std::back_inserter(out.array));
+            out.cardinality = static_cast<uint32_t>(out.array.size());
+        } else {
+            // an array against a bitset: probe the bitset with every array entry
+            const Container& array = mine.bits.empty() ? mine : *theirs;
+            const Container& bitset = mine.bits.empty() ? *theirs : mine;
+            for (uint16_t low: array.array) {
+                if (bitset.contains(low)) {
+                    out.array.push_back(low);
+                }
+            }
+            out.cardinality = static_cast<uint32_t>(out.array.size());
+        }
+        if (out.cardinality > 0) {
+            cardinality += out.cardinality;
+            kept.push_back(std::move(out));
+        }
+    }
+    containers_ = std::move(kept);
+    cardinality_ = cardinality;
+}
+
+size_t RoaringBitmap::memory_bytes() const {
+    size_t bytes = containers_.capacity() * sizeof(Container);
+    for (const auto& c: containers_) {
+        bytes += c.array.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+} // namespace dann
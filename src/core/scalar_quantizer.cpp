@@ -0,0 +1,272 @@
+//
+// Scalar quantizers: every component stored on its own as int8 (per-dimension
+// min/max range) or fp16. Distances are computed on the codes directly.
+//
+#include "dann/scalar_quantizer.h"
+
+#include "dann/logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DANN_SQ_X86 1
+#endif
+
+namespace dann {
+
+uint16_t float_to_half(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t float_exp = (x >> 23) & 0xff;
+    uint32_t mant = x & 0x7fffff;
+    if (float_exp == 0xff) {
+        return static_cast<uint16_t>(sign | 0x7c00 | (mant ? 0x200 : 0));
+    }
+    const int32_t exp = static_cast<int32_t>(float_exp) - 127 + 15;
+    if (exp >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+    if (exp <= 0) {
+        // subnormal half, round to nearest even
+        if (exp < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+        mant |= 0x800000;
+        const uint32_t shift = static_cast<uint32_t>(14 - exp);
+        uint32_t half = mant >> shift;
+        const uint32_t rem = mant & ((1u << shift) - 1);
+        const uint32_t mid = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1))) {
+            ++half;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+    uint32_t half = sign | (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+    const uint32_t rem = mant & 0x1fff;
+    // a carry out of the mantissa bumps the exponent, which is the right rounding
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+        ++half;
+    }
+    return static_cast<uint16_t>(half);
+}
+
+float half_to_float(uint16_t h) {
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    const uint32_t exp = (h >> 10) & 0x1f;
+    const uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0) {
+        const float value = std::ldexp(static_cast<float>(mant), -24);
+        return sign ? -value : value;
+    } else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+namespace {
+
+// q is the query shifted by vmin, so component j contributes (q[j] - code[j] * scale[j])^2
+float sq8_l2_scalar(const float* q, const float* scale, const uint8_t* code, int d) {
+    float dis = 0.0f;
+    for (int j = 0; j < d; ++j) {
+        const float diff = q[j] - static_cast<float>(code[j]) * scale[j];
+        dis += diff * diff;
+    }
+    return dis;
+}
+
+float fp16_l2_scalar(const float* q, const uint16_t* code, int d) {
+    float dis = 0.0f;
+    for (int j = 0; j < d; ++j) {
+        const float diff = q[j] - half_to_float(code[j]);
+        dis += diff * diff;
+    }
+    return dis;
+}
+
+#ifdef DANN_SQ_X86
+__attribute__((target("avx2,fma")))
+float sq8_l2_avx2(const float* q, const float* scale, const uint8_t* code, int d) {
+    __m256 acc = _mm256_setzero_ps();
+    int j = 0;
+    for (; j + 8 <= d; j += 8) {
+        // widen 8 x u8 -> 8 x i32 -> 8 x f32
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(code + j));
+        const __m256 c = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+        const __m256 diff = _mm256_fnmadd_ps(c, _mm256_loadu_ps(scale + j), _mm256_loadu_ps(q + j));
+        acc = _mm256_fmadd_ps(diff, diff, acc);
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    float dis = _mm_cvtss_f32(sum);
+    return dis + sq8_l2_scalar(q + j, scale + j, code + j, d - j);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+float fp16_l2_avx2(const float* q, const uint16_t* code, int d) {
+    __m256 acc = _mm256_setzero_ps();
+    int j = 0;
+    for (; j + 8 <= d; j += 8) {
+        const __m256 c = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(code + j)));
+        const __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(q + j), c);
+        acc = _mm256_fmadd_ps(diff, diff, acc);
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    float dis = _mm_cvtss_f32(sum);
+    return dis + fp16_l2_scalar(q + j, code + j, d - j);
+}
+#endif
+
+using Sq8Kernel = float (*)(const float*, const float*, const uint8_t*, int);
+using Fp16Kernel = float (*)(const float*, const uint16_t*, int);
+
+// resolved once; the widening kernels need AVX2/FMA (and F16C for fp16)
+Sq8Kernel sq8_kernel() {
+    static const Sq8Kernel kernel = [] {
+#ifdef DANN_SQ_X86
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return &sq8_l2_avx2;
+        }
+#endif
+        return &sq8_l2_scalar;
+    }();
+    return kernel;
+}
+
+Fp16Kernel fp16_kernel() {
+    static const Fp16Kernel kernel = [] {
+#ifdef DANN_SQ_X86
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) {
+            return &fp16_l2_avx2;
+        }
+#endif
+        return &fp16_l2_scalar;
+    }();
+    return kernel;
+}
+
+class SQ8DistanceComputer: public QuantizedDistanceComputer {
+public:
+    explicit SQ8DistanceComputer(const ScalarQuantizer& sq)
+        : sq_(sq), query_(sq.dimension()), kernel_(sq8_kernel()) {}
+
+    void set_query(const float* x) override {
+        for (int j = 0; j < sq_.dimension(); ++j) {
+            query_[j] = x[j] - sq_.vmin()[j];
+        }
+    }
+
+    float distance(const uint8_t* code) const override {
+        return kernel_(query_.data(), sq_.vscale().data(), code, sq_.dimension());
+    }
+
+private:
+    const ScalarQuantizer& sq_;
+    std::vector<float> query_;
+    Sq8Kernel kernel_;
+};
+
+class FP16DistanceComputer: public QuantizedDistanceComputer {
+public:
+    explicit FP16DistanceComputer(int d): d_(d), kernel_(fp16_kernel()) {}
+
+    void set_query(const float* x) override {
+        query_ = x;
+    }
+
+    float distance(const uint8_t* code) const override {
+        return kernel_(query_, reinterpret_cast<const uint16_t*>(code), d_);
+    }
+
+private:
+    int d_;
+    const float* query_{nullptr};
+    Fp16Kernel kernel_;
+};
+
+}
+
+ScalarQuantizer::ScalarQuantizer(int d, QuantizerType type)
+    : Quantizer(d), type_(type), trained_(type == QuantizerType::FP16) {}
+
+size_t ScalarQuantizer::code_size() const {
+    return type_ == QuantizerType::FP16 ? sizeof(uint16_t) * d_ : static_cast<size_t>(d_);
+}
+
+bool ScalarQuantizer::train(const float* x, size_t n) {
+    if (type_ == QuantizerType::FP16) {
+        return true;
+    }
+    if (n == 0) {
+        LOG_ERRORF("sq8 training needs at least one vector, got %zu", n);
+        return false;
+    }
+    vmin_.assign(d_, std::numeric_limits<float>::max());
+    std::vector<float> vmax(d_, std::numeric_limits<float>::lowest());
+    for (size_t i = 0; i < n; ++i) {
+        for (int j = 0; j < d_; ++j) {
+            vmin_[j] = std::min(vmin_[j], x[i * d_ + j]);
+            vmax[j] = std::max(vmax[j], x[i * d_ + j]);
+        }
+    }
+    vscale_.resize(d_);
+    for (int j = 0; j < d_; ++j) {
+        vscale_[j] = (vmax[j] - vmin_[j]) / 255.0f;
+    }
+    trained_ = true;
+    return true;
+}
+
+void ScalarQuantizer::encode(const float* x, uint8_t* codes, size_t n) const {
+    if (type_ == QuantizerType::FP16) {
+        auto* out = reinterpret_cast<uint16_t*>(codes);
+        for (size_t i = 0; i < n * d_; ++i) {
+            out[i] = float_to_half(x[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        for (int j = 0; j < d_; ++j) {
+            // values outside the trained range are clamped
+            const float v = vscale_[j] > 0 ? (x[i * d_ + j] - vmin_[j]) / vscale_[j] : 0.0f;
+            codes[i * d_ + j] = static_cast<uint8_t>(std::clamp(std::lround(v), 0L, 255L));
+        }
+    }
+}
+
+void ScalarQuantizer::decode(const uint8_t* codes, float* x, size_t n) const {
+    if (type_ == QuantizerType::FP16) {
+        const auto* in = reinterpret_cast<const uint16_t*>(codes);
+        for (size_t i = 0; i < n * d_; ++i) {
+            x[i] = half_to_float(in[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        for (int j = 0; j < d_; ++j) {
+            x[i * d_ + j] = vmin_[j] + static_cast<float>(codes[i * d_ + j]) * vscale_[j];
+        }
+    }
+}
+
+std::unique_ptr<QuantizedDistanceComputer> ScalarQuantizer::distance_computer() const {
+    if (type_ == QuantizerType::FP16) {
+        return std::make_unique<FP16DistanceComputer>(d_);
+    }
+    return std::make_unique<SQ8DistanceComputer>(*this);
+}
+
+}
@@ -0,0 +1,129 @@
+//
+// Micro-batching of concurrent single-query searches.
+//
+
+#include "dann/search_batcher.h"
+
+#include "dann/metrics.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace dann {
+
+namespace {
+// queries that may share one batched call; a traced query runs alone
+bool same_batch(int k, const InternalSearchParameters& a, int other_k, const InternalSearchParameters& b) {
+    return k == other_k && a.include_vectors == b.include_vectors && a.timeout_ms == b.timeout_ms &&
+           a.allow_partial == b.allow_partial && a.nprobe == b.nprobe && a.ef_search == b.ef_search &&
+           a.stats == b.stats && a.filter == b.filter;
+}
+}
+
+SearchBatcher::SearchBatcher(int dimension, BatchSearch search, SearchBatcherOptions options)
+    : dimension_(dimension), search_(std::move(search)), options_(std::move(options)),
+      batch_size_metric_(options_.metrics_prefix + "_batch_size"),
+      queue_depth_metric_(options_.metrics_prefix + "_queue_depth") {
+    options_.max_batch = std::max<size_t>(options_.max_batch, 1);
+    dispatcher_ = std::thread([this] { dispatch_loop(); });
+}
+
+SearchBatcher::~SearchBatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    dispatcher_.join();
+}
+
+std::future<std::vector<InternalSearchResult>> SearchBatcher::submit(const float* query, int k,
+                                                                     const InternalSearchParameters& params) {
+    Pending pending{query, k, params, std::chrono::steady_clock::now(), {}};
+    auto future = pending.result.get_future();
+    size_t depth;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_) {
+            pending.result.set_value({});
+            return future;
+        }
+        pending_.push_back(std::move(pending));
+        depth = pending_.size();
+    }
+    // the dispatcher only needs waking for the first query of a window or a full batch
+    if (depth == 1 || depth >= options_.max_batch) {
+        cv_.notify_one();
+    }
+    return future;
+}
+
+std::vector<InternalSearchResult> SearchBatcher::search(const float* query, int k,
+                                                        const InternalSearchParameters& params) {
+    return submit(query, k, params).get();
+}
+
+size_t SearchBatcher::queue_depth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+void SearchBatcher::dispatch_loop() {
+    std::vector<Pending> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+        if (pending_.empty()) {
+            return; // stopping with nothing queued
+        }
+        const auto deadline = pending_.front().arrival + options_.window;
+        cv_.wait_until(lock, deadline, [this] { return stop_ || pending_.size() >= options_.max_batch; });
+
+        const size_t depth = pending_.size();
+        const size_t n = std::min(depth, options_.max_batch);
+        batch.clear();
+        for (size_t i = 0; i < n; ++i) {
+            batch.push_back(std::move(pending_.front()));
+            pending_.pop_front();
+        }
+        lock.unlock();
+        Metrics::instance().record_histogram(queue_depth_metric_, static_cast<double>(depth));
+        run_batch(batch);
+        lock.lock();
+    }
+}
+
+void SearchBatcher::run_batch(std::vector<Pending>& batch) {
+    const size_t d = static_cast<size_t>(dimension_);
+    std::vector<float> queries;
+    std::vector<size_t> group;
+    std::vector<bool> done(batch.size(), false);
+    for (size_t first = 0; first < batch.size(); ++first) {
+        if (done[first]) {
+            continue;
+        }
+        group.clear();
+        queries.clear();
+        for (size_t i = first; i < batch.size(); ++i) {
+            if (!done[i] && same_batch(batch[first].k, batch[first].params, batch[i].k, batch[i].params)) {
+                group.push_back(i);
+                done[i] = true;
+                queries.insert(queries.end(), batch[i].query, batch[i].query + d);
+            }
+        }
+        Metrics::instance().record_histogram(batch_size_metric_, static_cast<double>(group.size()));
+        try {
+            auto results = search_(queries.data(), group.size(), batch[first].k, batch[first].params);
+            for (size_t j = 0; j < group.size(); ++j) {
+                batch[group[j]].result.set_value(j < results.size() ? std::move(results[j])
+                                                                    : std::vector<InternalSearchResult>());
+            }
+        } catch (...) {
+            for (auto i: group) {
+                batch[i].result.set_exception(std::current_exception());
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,98 @@
+//
+// Array and HDF5 hyperslab chunk readers.
+//
+
+#include "dann/vector_chunk_reader.h"
+
+#include <H5Cpp.h>
+
+#include <algorithm>
+#include <numeric>
+
+#include "dann/logger.h"
+
+namespace dann {
+
+bool ArrayChunkReader::next(size_t max_rows, VectorChunk* chunk) {
+    if (position_ >= rows_) {
+        return false;
+    }
+    const size_t n = std::min(std::max<size_t>(1, max_rows), rows_ - position_);
+    chunk->vectors = vectors_ + position_ * static_cast<size_t>(dimension_);
+    chunk->ids = ids_ + position_;
+    chunk->rows = n;
+    position_ += n;
+    return true;
+}
+
+struct Hdf5ChunkReader::Handle {
+    H5::H5File file;
+    H5::DataSet dataset;
+};
+
+Hdf5ChunkReader::Hdf5ChunkReader() = default;
+
+Hdf5ChunkReader::~Hdf5ChunkReader() = default;
+
+bool Hdf5ChunkReader::open(const std::string& path, const std::string& dataset, int64_t first_id) {
+    handle_.reset();
+    failed_ = false;
+    position_ = 0;
+    try {
+        H5::Exception::dontPrint();
+        auto handle = std::make_unique<Handle>();
+        handle->file = H5::H5File(path, H5F_ACC_RDONLY);
+        handle->dataset = handle->file.openDataSet(dataset);
+        H5::DataSpace space = handle->dataset.getSpace();
+        if (space.getSimpleExtentNdims() != 2) {
+            LOG_ERRORF("%s:%s is not a 2-D dataset", path.c_str(), dataset.c_str());
+            return false;
+        }
+        hsize_t dims[2];
+        space.getSimpleExtentDims(dims);
+        rows_ = static_cast<int64_t>(dims[0]);
+        dimension_ = static_cast<int>(dims[1]);
+        first_id_ = first_id;
+        handle_ = std::move(handle);
+    } catch (const H5::Exception& e) {
+        LOG_ERRORF("failed to open %s:%s: %s", path.c_str(), dataset.c_str(), e.getDetailMsg().c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Hdf5ChunkReader::rewind() {
+    position_ = 0;
+    failed_ = false;
+    return handle_ != nullptr;
+}
+
+bool Hdf5ChunkReader::next(size_t max_rows, VectorChunk* chunk) {
+    if (!handle_ || failed_ || position_ >= rows_) {
+        return false;
+    }
+    const int64_t n = std::min<int64_t>(static_cast<int64_t>(std::max<size_t>(1, max_rows)), rows_ - position_);
+    // the buffers are sized once for the largest chunk and reused
+    vectors_.resize(static_cast<size_t>(n) * dimension_);
+    ids_.resize(static_cast<size_t>(n));
+    try {
+        H5::DataSpace file_space = handle_->dataset.getSpace();
+        const hsize_t offset[2] = {static_cast<hsize_t>(position_), 0};
+        const hsize_t count[2] = {static_cast<hsize_t>(n), static_cast<hsize_t>(dimension_)};
+        file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+        H5::DataSpace memory_space(2, count);
+        handle_->dataset.read(vectors_.data(), H5::PredType::NATIVE_FLOAT, memory_space, file_space);
+    } catch (const H5::Exception& e) {
+        LOG_ERRORF("hdf5 read of rows [%ld, %ld) failed: %s", position_, position_ + n, e.getDetailMsg().c_str());
+        failed_ = true;
+        return false;
+    }
+    std::iota(ids_.begin(), ids_.end(), first_id_ + position_);
+    chunk->vectors = vectors_.data();
+    chunk->ids = ids_.data();
+    chunk->rows = static_cast<size_t>(n);
+    position_ += n;
+    return true;
+}
+
+} // namespace dann
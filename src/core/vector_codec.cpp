@@ -0,0 +1,60 @@
+//
+// Packed vector payloads.
+//
+
+#include "dann/vector_codec.h"
+
+#include "dann/scalar_quantizer.h"
+
+#include <cstring>
+
+namespace dann {
+
+size_t packed_bytes_per_component(PackedEncoding encoding) {
+    return encoding == PackedEncoding::FLOAT16 ? sizeof(uint16_t) : sizeof(float);
+}
+
+const float* unpack_vectors(const void* bytes, size_t size, PackedEncoding encoding, int d, size_t* rows,
+                            std::vector<float>* scratch) {
+    const size_t row_bytes = packed_bytes_per_component(encoding) * static_cast<size_t>(d);
+    if (d <= 0 || size % row_bytes != 0) {
+        return nullptr;
+    }
+    *rows = size / row_bytes;
+    const size_t n = *rows * static_cast<size_t>(d);
+    if (encoding == PackedEncoding::FLOAT32) {
+        // protobuf keeps bytes fields in heap strings, which are aligned in practice;
+        // the copy only covers payloads sliced at an odd offset
+        if (reinterpret_cast<uintptr_t>(bytes) % alignof(float) == 0) {
+            return static_cast<const float*>(bytes);
+        }
+        scratch->resize(n);
+        std::memcpy(scratch->data(), bytes, size);
+        return scratch->data();
+    }
+    scratch->resize(n);
+    const auto* src = static_cast<const unsigned char*>(bytes);
+    for (size_t i = 0; i < n; ++i) {
+        uint16_t h;
+        std::memcpy(&h, src + i * sizeof(uint16_t), sizeof(h));
+        (*scratch)[i] = half_to_float(h);
+    }
+    return scratch->data();
+}
+
+void pack_vectors(const float* x, size_t n, int d, PackedEncoding encoding, std::string* out) {
+    const size_t count = n * static_cast<size_t>(d);
+    const size_t offset = out->size();
+    out->resize(offset + count * packed_bytes_per_component(encoding));
+    char* dst = &(*out)[offset];
+    if (encoding == PackedEncoding::FLOAT32) {
+        std::memcpy(dst, x, count * sizeof(float));
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const uint16_t h = float_to_half(x[i]);
+        std::memcpy(dst + i * sizeof(uint16_t), &h, sizeof(h));
+    }
+}
+
+}
@@ -1,12 +1,25 @@
 #include "dann/vector_index.h"
+#include "dann/distance_kernels.h"
+#include "dann/utils.h"
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexHNSW.h>
 #include <faiss/IndexIDMap.h>
+#include <faiss/impl/IDSelector.h>
 #include <chrono>
+#include <iterator>
 #include <stdexcept>
 
 namespace dann {
 
+namespace {
+// admits the ids of an attribute filter; IndexIDMap2 passes the external ids
+struct BitmapIDSelector: faiss::IDSelector {
+    explicit BitmapIDSelector(const RoaringBitmap* ids): ids(ids) {}
+    bool is_member(faiss::idx_t id) const override { return ids->contains(id); }
+    const RoaringBitmap* ids;
+};
+}
+
 VectorIndex::VectorIndex(int dimension,
                          const std::string& index_type,
                          int hnsw_m,
@@ -25,7 +38,7 @@ VectorIndex::VectorIndex(int dimension,
 VectorIndex::~VectorIndex() = default;
 
 bool VectorIndex::add_vectors(const std::vector<float>& vectors, const std::vector<int64_t>& ids) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    auto lock = write_lock();
     if (!validate_vectors(vectors) || vectors.size() / dimension_ != ids.size()) {
         return false;
     }
@@ -36,7 +49,15 @@ bool VectorIndex::add_vectors(const std::vector<float>& vectors, const std::vect
     }
 
     const size_t num_vectors = ids.size();
-    id_index->add_with_ids(static_cast<faiss::idx_t>(num_vectors), vectors.data(), ids.data());
+    if (write_batch_ > 0) {
+        buffered_vectors_.insert(buffered_vectors_.end(), vectors.begin(), vectors.end());
+        buffered_ids_.insert(buffered_ids_.end(), ids.begin(), ids.end());
+        if (buffered_ids_.size() >= write_batch_) {
+            flush_locked();
+        }
+    } else {
+        id_index->add_with_ids(static_cast<faiss::idx_t>(num_vectors), vectors.data(), ids.data());
+    }
 
     const auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
                             std::chrono::system_clock::now().time_since_epoch())
@@ -90,15 +111,29 @@ bool VectorIndex::add_vectors_bulk(const std::vector<float>& vectors,
  * @return
  */
 std::vector<InternalSearchResult> VectorIndex::search(const std::vector<float>& query, int k) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    return search(query, k, InternalSearchParameters{});
+}
+
+std::vector<InternalSearchResult> VectorIndex::search(const std::vector<float>& query, int k,
+                                                      const InternalSearchParameters& params) {
+    auto lock = read_lock();
     std::vector<InternalSearchResult> results;
-    if (!validate_vectors(query) || k <= 0 || size() == 0) {
+    if (!validate_vectors(query) || k <= 0 || size_locked() == 0) {
         return results;
     }
 
+    std::shared_ptr<const RoaringBitmap> filter;
+    if (!params.filter.empty()) {
+        filter = attributes_.match(params.filter);
+        if (filter->empty()) {
+            return results;
+        }
+    }
+    BitmapIDSelector selector(filter.get());
     std::vector<faiss::idx_t> labels(static_cast<size_t>(k));
     std::vector<float> distances(static_cast<size_t>(k));
-    index_->search(1, query.data(), k, distances.data(), labels.data());
+    auto faiss_params = search_parameters(params, filter ? &selector : nullptr);
+    index_->search(1, query.data(), k, distances.data(), labels.data(), faiss_params.get());
 
     for (int i = 0; i < k; ++i) {
         if (labels[static_cast<size_t>(i)] < 0) {
@@ -106,39 +141,86 @@ std::vector<InternalSearchResult> VectorIndex::search(const std::vector<float>&
         }
         results.push_back(create_search_result(labels[static_cast<size_t>(i)], distances[static_cast<size_t>(i)]));
     }
+    if (!buffered_ids_.empty()) {
+        std::vector<std::vector<InternalSearchResult>> merged(1);
+        merged[0] = std::move(results);
+        search_buffered(query.data(), 1, k, filter.get(), &merged);
+        results = std::move(merged[0]);
+    }
     return results;
 }
 
 std::vector<InternalSearchResult> VectorIndex::search_batch(const std::vector<float>& queries, int k) {
-    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<InternalSearchResult> results;
-    if (!validate_vectors(queries) || k <= 0 || size() == 0) {
+    if (!validate_vectors(queries) || k <= 0) {
         return results;
     }
-
     const size_t num_queries = queries.size() / static_cast<size_t>(dimension_);
-    std::vector<faiss::idx_t> labels(num_queries * static_cast<size_t>(k));
-    std::vector<float> distances(num_queries * static_cast<size_t>(k));
-    index_->search(static_cast<faiss::idx_t>(num_queries), queries.data(), k, distances.data(), labels.data());
+    for (auto& query_results: search_batch(queries.data(), num_queries, k, InternalSearchParameters{})) {
+        std::move(query_results.begin(), query_results.end(), std::back_inserter(results));
+    }
+    return results;
+}
 
-    results.reserve(num_queries * static_cast<size_t>(k));
-    for (size_t qi = 0; qi < num_queries; ++qi) {
+std::vector<std::vector<InternalSearchResult>> VectorIndex::search_batch(const float* queries, size_t nq, int k,
+                                                                         const InternalSearchParameters& params) {
+    auto lock = read_lock();
+    std::vector<std::vector<InternalSearchResult>> results(nq);
+    if (k <= 0 || nq == 0 || size_locked() == 0) {
+        return results;
+    }
+
+    std::shared_ptr<const RoaringBitmap> filter;
+    if (!params.filter.empty()) {
+        filter = attributes_.match(params.filter);
+        if (filter->empty()) {
+            return results;
+        }
+    }
+    BitmapIDSelector selector(filter.get());
+    std::vector<faiss::idx_t> labels(nq * static_cast<size_t>(k));
+    std::vector<float> distances(nq * static_cast<size_t>(k));
+    auto faiss_params = search_parameters(params, filter ? &selector : nullptr);
+    index_->search(static_cast<faiss::idx_t>(nq), queries, k, distances.data(), labels.data(), faiss_params.get());
+
+    for (size_t qi = 0; qi < nq; ++qi) {
         for (int ki = 0; ki < k; ++ki) {
             const size_t idx = qi * static_cast<size_t>(k) + static_cast<size_t>(ki);
             if (labels[idx] < 0) {
                 continue;
             }
-            results.push_back(create_search_result(labels[idx], distances[idx]));
+            results[qi].push_back(create_search_result(labels[idx], distances[idx]));
         }
     }
-
+    if (!buffered_ids_.empty()) {
+        search_buffered(queries, nq, k, filter.get(), &results);
+    }
     return results;
 }
 
 bool VectorIndex::remove_vector(int64_t id) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    faiss::IDSelectorArray selector(1, &id);
-    const faiss::idx_t removed = index_->remove_ids(selector);
+    auto lock = write_lock();
+    if (!remove_locked(id)) {
+        return false;
+    }
+    attributes_.remove(id);
+    return true;
+}
+
+bool VectorIndex::remove_locked(int64_t id) {
+    faiss::idx_t removed = 0;
+    for (size_t i = buffered_ids_.size(); i-- > 0;) {
+        if (buffered_ids_[i] == id) {
+            buffered_ids_.erase(buffered_ids_.begin() + static_cast<long>(i));
+            buffered_vectors_.erase(buffered_vectors_.begin() + static_cast<long>(i * dimension_),
+                                    buffered_vectors_.begin() + static_cast<long>((i + 1) * dimension_));
+            ++removed;
+        }
+    }
+    if (index_->ntotal > 0) {
+        faiss::IDSelectorArray selector(1, &id);
+        removed += index_->remove_ids(selector);
+    }
     if (removed > 0) {
         const auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
                                 std::chrono::system_clock::now().time_since_epoch())
@@ -154,43 +236,141 @@ bool VectorIndex::update_vector(int64_t id, const std::vector<float>& new_vector
     if (new_vector.size() != static_cast<size_t>(dimension_)) {
         return false;
     }
-    if (!remove_vector(id)) {
-        return false;
+    {
+        // the id keeps its attributes
+        auto lock = write_lock();
+        if (!remove_locked(id)) {
+            return false;
+        }
     }
     return add_vectors(new_vector, std::vector<int64_t>{id});
 }
 
+bool VectorIndex::set_attributes(const std::vector<int64_t>& ids, const std::vector<Attributes>& attributes) {
+    if (ids.size() != attributes.size()) {
+        return false;
+    }
+    auto lock = write_lock();
+    for (size_t i = 0; i < ids.size(); ++i) {
+        attributes_.set(ids[i], attributes[i]);
+    }
+    ++version_;
+    return true;
+}
+
 bool VectorIndex::save_index(const std::string& file_path) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    auto lock = write_lock();
     try {
+        flush_locked();
         faiss::write_index(index_.get(), file_path.c_str());
-        return true;
+        return attributes_.save(file_path + ".attributes");
     } catch (const std::exception&) {
         return false;
     }
 }
 
 bool VectorIndex::load_index(const std::string& file_path) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    // the file is read before taking the lock, so searches keep running on the old
+    // index until the swap; the old one is freed once the lock is released
+    std::unique_ptr<faiss::Index> loaded;
     try {
-        index_.reset(faiss::read_index(file_path.c_str()));
-        ++version_;
-        pending_operations_.clear();
-        return true;
+        loaded.reset(faiss::read_index(file_path.c_str()));
     } catch (const std::exception&) {
         return false;
     }
+    auto lock = write_lock();
+    if (!attributes_.load(file_path + ".attributes")) {
+        return false;
+    }
+    index_.swap(loaded);
+    buffered_vectors_.clear();
+    buffered_ids_.clear();
+    ++version_;
+    pending_operations_.clear();
+    return true;
 }
 
 void VectorIndex::reset_index() {
-    std::lock_guard<std::mutex> lock(mutex_);
+    auto lock = write_lock();
     create_index();
+    buffered_vectors_.clear();
+    buffered_ids_.clear();
     pending_operations_.clear();
     ++version_;
 }
 
 size_t VectorIndex::size() {
-    return index_ ? static_cast<size_t>(index_->ntotal) : 0;
+    auto lock = read_lock();
+    return size_locked();
+}
+
+std::shared_lock<std::shared_mutex> VectorIndex::read_lock() const {
+    // waits while a writer is queued, see write_lock
+    { std::lock_guard<std::mutex> gate(write_gate_); }
+    return std::shared_lock<std::shared_mutex>(mutex_);
+}
+
+std::unique_lock<std::shared_mutex> VectorIndex::write_lock() const {
+    // the shared_mutex lets new readers pass a waiting writer; holding the gate until
+    // the writer is in keeps a steady stream of searches from starving it
+    std::lock_guard<std::mutex> gate(write_gate_);
+    return std::unique_lock<std::shared_mutex>(mutex_);
+}
+
+size_t VectorIndex::size_locked() const {
+    return (index_ ? static_cast<size_t>(index_->ntotal) : 0) + buffered_ids_.size();
+}
+
+void VectorIndex::set_write_batch(size_t rows) {
+    auto lock = write_lock();
+    write_batch_ = rows;
+    if (buffered_ids_.size() >= write_batch_) {
+        flush_locked();
+    }
+}
+
+void VectorIndex::flush() {
+    auto lock = write_lock();
+    flush_locked();
+}
+
+void VectorIndex::flush_locked() {
+    if (buffered_ids_.empty()) {
+        return;
+    }
+    auto* id_index = dynamic_cast<faiss::IndexIDMap2*>(index_.get());
+    if (id_index) {
+        id_index->add_with_ids(static_cast<faiss::idx_t>(buffered_ids_.size()), buffered_vectors_.data(),
+                               buffered_ids_.data());
+    }
+    buffered_vectors_.clear();
+    buffered_ids_.clear();
+}
+
+void VectorIndex::search_buffered(const float* queries, size_t nq, int k, const RoaringBitmap* filter,
+                                  std::vector<std::vector<InternalSearchResult>>* results) const {
+    const size_t n = buffered_ids_.size();
+    TopKBuffer<InternalSearchResult> topk(static_cast<size_t>(k));
+    std::vector<std::vector<InternalSearchResult>> lists(2);
+    for (size_t q = 0; q < nq; ++q) {
+        const float* query = queries + q * dimension_;
+        if (filter) {
+            for (size_t i = 0; i < n; ++i) {
+                if (filter->contains(buffered_ids_[i])) {
+                    topk.push(create_search_result(buffered_ids_[i],
+                                                   l2_sqr(buffered_vectors_.data() + i * dimension_, query,
+                                                          dimension_)));
+                }
+            }
+        } else {
+            l2_sqr_scan(buffered_vectors_.data(), query, dimension_, n, topk, [this](float distance, size_t row) {
+                return create_search_result(buffered_ids_[row], distance);
+            });
+        }
+        lists[0] = std::move((*results)[q]);
+        lists[1] = topk.take();
+        (*results)[q] = merge_top_k(lists, k);
+    }
 }
 
 int VectorIndex::dimension() const {
@@ -229,4 +409,21 @@ InternalSearchResult VectorIndex::create_search_result(int64_t id, float distanc
     return InternalSearchResult(id, distance, {});
 }
 
+std::unique_ptr<faiss::SearchParameters> VectorIndex::search_parameters(const InternalSearchParameters& params,
+                                                                        faiss::IDSelector* filter) const {
+    if (params.ef_search <= 0 || (index_type_ != "HNSW" && index_type_ != "hnsw")) {
+        if (!filter) {
+            return nullptr;
+        }
+        auto plain = std::make_unique<faiss::SearchParameters>();
+        plain->sel = filter;
+        return plain;
+    }
+    // IndexIDMap2 hands the parameters to the wrapped HNSW index
+    auto hnsw = std::make_unique<faiss::SearchParametersHNSW>();
+    hnsw->efSearch = params.ef_search;
+    hnsw->sel = filter;
+    return hnsw;
+}
+
 } // namespace dann
@@ -1,7 +1,11 @@
 #include "dann/vector_index.h"
+#include "dann/distributed_index_ivf.h"
 #include "dann/index.h"
+#include "dann/index_handle.h"
 #include <iostream>
+#include <algorithm>
 #include <memory>
+#include <string>
 #include <vector>
 #include <chrono>
 #include <random>
@@ -11,6 +15,8 @@
 #ifdef HAVE_GRPC
 #include "dann/rpc_server.h"
 #include "network/vector_search_service_impl.h"
+#include "dann/remote_shard_client.h"
+#include "dann/hedged_shard_client.h"
 #endif
 
 using namespace dann;
@@ -25,11 +31,22 @@ void print_usage() {
     std::cout << "  --port <port>         Listen port (default: 8080)\n";
 #ifdef HAVE_GRPC
     std::cout << "  --grpc-port <port>    gRPC server port (default: 50051)\n";
+    std::cout << "  --grpc-threads <n>    Sync gRPC polling threads (default: 8)\n";
+    std::cout << "  --grpc-async <n>      Async gRPC server with n completion queues, 0 = one per core\n";
+    std::cout << "  --batch-window-us <n> Coalesce concurrent searches arriving within n us (default: off)\n";
+    std::cout << "  --max-batch <n>       Queries per coalesced search batch (default: 32)\n";
+    std::cout << "  --shard-timeout-ms <n> Deadline of shard requests to other seed nodes (default: 100)\n";
+    std::cout << "  --shard-replicas <node>=<host:port>,...  Replicas of a seed node's shards; requests\n";
+    std::cout << "                        to it are hedged after its p95 latency (repeatable)\n";
 #endif
     std::cout << "  --dimension <dim>     Vector dimension (default: 128)\n";
     std::cout << "  --index-type <type>   Index type: Flat, IVF, HNSW (default: IVF)\n";
+    std::cout << "  --metric <metric>     IVF distance: L2, COSINE, DOT (default: L2)\n";
     std::cout << "  --shards <shards>     Number of shards (default: 1)\n";
+    std::cout << "  --result-cache <n>    Cache the results of up to n repeated queries (default: off)\n";
     std::cout << "  --index <index>       faiss index file\n";
+    std::cout << "  --warm-start          IVF: serve once the centroids are loaded and read the partitions\n";
+    std::cout << "                        in the background, most probed first (default: off)\n";
     std::cout << "  --seed-nodes <nodes>  Comma-separated list of seed nodes\n";
     std::cout << "  --help                Show this help message\n";
 }
@@ -40,11 +57,21 @@ struct Config {
     int port = 8080;
 #ifdef HAVE_GRPC
     int grpc_port = 50051;
+    int grpc_threads = 8;
+    bool grpc_async = false;
+    int grpc_completion_queues = 0;
+    int batch_window_us = 0;
+    int max_batch = 32;
+    int shard_timeout_ms = 100;
+    std::vector<std::pair<std::string, std::vector<std::string>>> shard_replicas;
 #endif
     int dimension = 128;
     std::string index_type = "IVF";
+    DistanceType metric = DistanceType::L2;
     std::string index_path = "";
+    bool warm_start = false;
     int shard_count = 1;
+    int result_cache_entries = 0;
     std::vector<std::string> seed_nodes;
 };
 
@@ -83,15 +110,56 @@ Config parse_arguments(int argc, char* argv[]) {
 #ifdef HAVE_GRPC
         } else if (arg == "--grpc-port" && i + 1 < argc) {
             config.grpc_port = std::stoi(argv[++i]);
+        } else if (arg == "--grpc-threads" && i + 1 < argc) {
+            config.grpc_threads = std::stoi(argv[++i]);
+        } else if (arg == "--grpc-async" && i + 1 < argc) {
+            config.grpc_async = true;
+            config.grpc_completion_queues = std::stoi(argv[++i]);
+        } else if (arg == "--batch-window-us" && i + 1 < argc) {
+            config.batch_window_us = std::stoi(argv[++i]);
+        } else if (arg == "--max-batch" && i + 1 < argc) {
+            config.max_batch = std::stoi(argv[++i]);
+        } else if (arg == "--shard-timeout-ms" && i + 1 < argc) {
+            config.shard_timeout_ms = std::stoi(argv[++i]);
+        } else if (arg == "--shard-replicas" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            const size_t eq = spec.find('=');
+            if (eq != std::string::npos) {
+                std::vector<std::string> endpoints;
+                std::string list = spec.substr(eq + 1);
+                size_t pos = 0;
+                while ((pos = list.find(',')) != std::string::npos) {
+                    endpoints.push_back(list.substr(0, pos));
+                    list.erase(0, pos + 1);
+                }
+                if (!list.empty()) {
+                    endpoints.push_back(list);
+                }
+                config.shard_replicas.emplace_back(spec.substr(0, eq), std::move(endpoints));
+            }
 #endif
         } else if (arg == "--dimension" && i + 1 < argc) {
             config.dimension = std::stoi(argv[++i]);
         } else if (arg == "--index-type" && i + 1 < argc) {
             config.index_type = argv[++i];
+        } else if (arg == "--metric" && i + 1 < argc) {
+            const std::string metric = argv[++i];
+            if (metric == "COSINE") {
+                config.metric = DistanceType::COSINE;
+            } else if (metric == "DOT") {
+                config.metric = DistanceType::DOT;
+            } else if (metric != "L2") {
+                std::cerr << "Unknown metric " << metric << "\n";
+                exit(1);
+            }
         } else if (arg == "--shards" && i + 1 < argc) {
             config.shard_count = std::stoi(argv[++i]);
+        } else if (arg == "--result-cache" && i + 1 < argc) {
+            config.result_cache_entries = std::stoi(argv[++i]);
         } else if (arg == "--index") {
             config.index_path = to_absolute_path(argv[++i]);
+        } else if (arg == "--warm-start") {
+            config.warm_start = true;
         } else if (arg == "--seed-nodes" && i + 1 < argc) {
             std::string seeds = argv[++i];
             size_t pos = 0;
@@ -131,17 +199,56 @@ void run_demo(const Config& config) {
     std::cout << "  Shards: " << config.shard_count << "\n";
     std::cout << "\n";
     
-    // Create components
-    auto index = std::make_shared<Index>("default", 
-        config.dimension, config.shard_count, config.index_type, 
-        config.hnsw_m, config.hnsw_ef_construction, config.seed_nodes);
+    // Create components. A reload builds a fresh index the same way, next to the
+    // one serving, and publishes it through the handle
+    const auto make_index = [&config](bool reload) -> std::shared_ptr<Index> {
+        auto index = std::make_shared<Index>("default",
+            config.dimension, config.shard_count, config.index_type,
+            config.hnsw_m, config.hnsw_ef_construction, config.seed_nodes, config.metric);
 
-    if (!config.index_path.empty()) {
-        // Currently only supported for single-shard setups.
-        if (index->shard_count() == 1) {
-            index->shard(0)->load_index(config.index_path);
+#ifdef HAVE_GRPC
+        // IVF shards are spread over the seed nodes ("host:port"); this node serves the
+        // ones placed on --node-id and asks the other nodes for the rest
+        if (config.index_type == "IVF" && !config.seed_nodes.empty()) {
+            if (auto ivf = std::dynamic_pointer_cast<DistributedIndexIVF>(index->shard(0))) {
+                std::shared_ptr<ShardClient> shard_client = std::make_shared<RemoteShardClient>();
+                if (!config.shard_replicas.empty()) {
+                    auto hedged = std::make_shared<HedgedShardClient>(shard_client);
+                    for (const auto& [node, endpoints] : config.shard_replicas) {
+                        hedged->set_replicas(node, endpoints);
+                    }
+                    shard_client = hedged;
+                }
+                ivf->set_remote_shards(config.node_id, shard_client,
+                                       std::chrono::milliseconds(config.shard_timeout_ms));
+            }
         }
-    }
+#endif
+
+        if (config.warm_start) {
+            if (auto ivf = std::dynamic_pointer_cast<DistributedIndexIVF>(index->shard(0))) {
+                ivf->set_warm_start(true);
+                // the heat map the next warm start reads the partitions by
+                ivf->set_probe_tracking(true);
+            }
+        }
+        if (!config.index_path.empty() && index->shard_count() == 1) {
+            // Currently only supported for single-shard setups.
+            if (!index->shard(0)->load_index(config.index_path) && reload) {
+                return nullptr;
+            }
+        } else if (reload) {
+            return nullptr;
+        }
+        if (config.result_cache_entries > 0) {
+            ResultCacheOptions cache_options;
+            cache_options.capacity = config.result_cache_entries;
+            index->enable_result_cache(cache_options);
+        }
+        return index;
+    };
+    auto handle = std::make_shared<IndexHandle>(make_index(false));
+
     // auto node_manager = std::make_shared<NodeManager>(config.node_id, config.address, config.port);
     // auto consistency_manager = std::make_shared<ConsistencyManager>(config.node_id);
     // auto query_router = std::make_shared<QueryRouter>(node_manager);
@@ -150,9 +257,19 @@ void run_demo(const Config& config) {
 #ifdef HAVE_GRPC
     // Create and start gRPC server
     auto rpc_server = std::make_shared<RPCServer>(config.address, config.grpc_port);
-    auto search_service = std::make_unique<VectorSearchServiceImpl>(index);
+    auto search_service = std::make_unique<VectorSearchServiceImpl>(handle);
+    if (config.batch_window_us > 0) {
+        SearchBatcherOptions batching;
+        batching.window = std::chrono::microseconds(config.batch_window_us);
+        batching.max_batch = static_cast<size_t>(std::max(1, config.max_batch));
+        search_service->enable_batching(batching);
+    }
     rpc_server->register_service(std::move(search_service));
-    rpc_server->set_max_threads(8);
+    rpc_server->set_max_threads(config.grpc_threads);
+    if (config.grpc_async) {
+        rpc_server->set_mode(RPCServerMode::ASYNC);
+        rpc_server->set_completion_queues(config.grpc_completion_queues);
+    }
     
     if (!rpc_server->start()) {
         std::cerr << "Failed to start gRPC server\n";
@@ -218,17 +335,31 @@ void run_demo(const Config& config) {
     // std::cout << "\nBulk load " << (load_result ? "succeeded" : "failed")
     //           << " in " << load_time.count() << " ms\n";
 
-    // Index information
-    std::cout << "\n=== Index Information ===\n";
-    std::cout << "Index name: " << index->name() << "\n";
-    std::cout << "Index type: " << index->index_type() << "\n";
-    std::cout << "Index dimension: " << index->dimension() << "\n";
-    std::cout << "Index size: " << index->size() << " vectors\n";
-    std::cout << "Shard count: " << index->shard_count() << "\n";
-    
-    // Keep server running
-    std::cout << "\nServer running. Press Enter to stop...\n";
-    std::cin.get();
+    // Index information; the reference is dropped again so a reload can free this version
+    {
+        const auto index = handle->current();
+        std::cout << "\n=== Index Information ===\n";
+        std::cout << "Index name: " << index->name() << "\n";
+        std::cout << "Index type: " << index->index_type() << "\n";
+        std::cout << "Index dimension: " << index->dimension() << "\n";
+        std::cout << "Index size: " << index->size() << " vectors\n";
+        std::cout << "Shard count: " << index->shard_count() << "\n";
+    }
+    
+    // Keep server running; "reload" swaps in the index file again without stopping
+    std::cout << "\nServer running. Type reload to reload the --index file, press Enter to stop...\n";
+    std::string command;
+    while (std::getline(std::cin, command) && command == "reload") {
+        if (!handle->reload_async([&make_index] { return make_index(true); })) {
+            std::cout << "A reload is already running\n";
+        }
+    }
+    handle->wait_reload();
+    if (config.warm_start && !config.index_path.empty()) {
+        if (auto ivf = std::dynamic_pointer_cast<DistributedIndexIVF>(handle->current()->shard(0))) {
+            ivf->save_probe_heat(config.index_path);
+        }
+    }
     
     // Cleanup
     // consistency_manager->stop_anti_entropy();
@@ -0,0 +1,52 @@
+#include "dann/remote_shard_client.h"
+#include "dann/logger.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace dann {
+
+RemoteShardClient::RemoteShardClient(int channels_per_node)
+    : channels_per_node_(std::max(1, channels_per_node)) {}
+
+void RemoteShardClient::search_shard(const std::string& node, const InternalShardSearchRequest& request,
+                                     std::chrono::steady_clock::time_point deadline, ShardSearchCallback done) {
+    NodeChannels* pool = channels(node);
+    if (!pool) {
+        InternalShardSearchResponse failed;
+        failed.error_message = "cannot connect to node " + node;
+        done(std::move(failed));
+        return;
+    }
+    const size_t slot = pool->next.fetch_add(1, std::memory_order_relaxed) % pool->clients.size();
+    pool->clients[slot]->search_shard_async(request, deadline, std::move(done));
+}
+
+RemoteShardClient::NodeChannels* RemoteShardClient::channels(const std::string& node) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = nodes_.find(node);
+    if (it != nodes_.end()) {
+        return it->second.get();
+    }
+    const size_t colon = node.rfind(':');
+    if (colon == std::string::npos || colon + 1 == node.size()) {
+        LOG_ERRORF("shard node %s is not host:port", node.c_str());
+        return nullptr;
+    }
+    const std::string host = node.substr(0, colon);
+    const int port = std::atoi(node.c_str() + colon + 1);
+
+    // channels connect lazily, so creating them does not wait for the node
+    auto pool = std::make_unique<NodeChannels>();
+    for (int i = 0; i < channels_per_node_; ++i) {
+        auto client = std::make_unique<RPCClient>(host, port);
+        if (!client->connect()) {
+            LOG_ERRORF("failed to open a channel to %s", node.c_str());
+            return nullptr;
+        }
+        pool->clients.push_back(std::move(client));
+    }
+    return (nodes_[node] = std::move(pool)).get();
+}
+
+} // namespace dann
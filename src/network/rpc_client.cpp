@@ -1,16 +1,86 @@
 #include "dann/rpc_client.h"
-#include <grpc++/channel.h>
-#include <grpc++/client_context.h>
-#include <grpc++/create_channel.h>
+#include "dann/vector_codec.h"
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <thread>
 
 namespace dann {
 
+namespace {
+
+void fill_search_request(const InternalQueryRequest& request, SearchRequest* out) {
+    pack_vectors(request.query_vector.data(), 1, static_cast<int>(request.query_vector.size()),
+                 PackedEncoding::FLOAT32, out->mutable_packed_query());
+    out->set_encoding(FLOAT32);
+    out->set_k(request.k);
+    out->set_consistency_level(request.consistency_level);
+    out->set_timeout_ms(static_cast<int64_t>(request.timeout_ms));
+    out->set_allow_partial(request.allow_partial);
+    out->set_nprobe(request.nprobe);
+    out->set_ef_search(request.ef_search);
+}
+
+InternalQueryResponse to_query_response(const grpc::Status& status, const SearchResponse& response) {
+    if (!status.ok()) {
+        return InternalQueryResponse(false, status.error_message());
+    }
+    InternalQueryResponse out(response.success(), response.error_message());
+    out.query_time_ms = static_cast<uint64_t>(response.query_time_ms());
+    out.results.reserve(response.results_size());
+    for (const auto& result : response.results()) {
+        out.results.emplace_back(result.id(), result.distance(),
+                                 std::vector<float>(result.vector().begin(), result.vector().end()));
+    }
+    return out;
+}
+
+void fill_add_request(const InternalBulkLoadRequest& request, AddVectorsRequest* out) {
+    const size_t n = request.ids.size();
+    const int d = n == 0 ? 0 : static_cast<int>(request.vectors.size() / n);
+    out->mutable_vectors()->Reserve(static_cast<int>(n));
+    for (size_t i = 0; i < n; ++i) {
+        auto* vector = out->add_vectors();
+        vector->set_id(request.ids[i]);
+        pack_vectors(request.vectors.data() + i * d, 1, d, PackedEncoding::FLOAT32, vector->mutable_packed_data());
+    }
+    out->set_overwrite_existing(request.overwrite_existing);
+    out->set_batch_size(request.batch_size);
+}
+
+void fill_update_request(int64_t id, const std::vector<float>& vector, UpdateVectorRequest* out) {
+    out->set_id(id);
+    out->mutable_vector()->Add(vector.begin(), vector.end());
+}
+
+InternalShardSearchResponse to_shard_response(const grpc::Status& status, const ShardSearchResponse& response,
+                                              int d) {
+    InternalShardSearchResponse out;
+    if (!status.ok() || !response.success()) {
+        out.error_message = status.ok() ? response.error_message() : status.error_message();
+        return out;
+    }
+    const int n = std::min(response.ids_size(), response.distances_size());
+    const bool with_vectors = response.vectors().size() == static_cast<size_t>(n) * d * sizeof(float);
+    out.results.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        out.results.emplace_back(response.ids(i), response.distances(i));
+        if (with_vectors && d > 0) {
+            out.results.back().vector.resize(d);
+            std::memcpy(out.results.back().vector.data(), response.vectors().data() + i * d * sizeof(float),
+                        d * sizeof(float));
+        }
+    }
+    out.success = true;
+    return out;
+}
+
+}
+
 RPCClient::RPCClient(const std::string& address, int port)
-    : address_(address), port_(port), connected_(false), 
+    : address_(address), port_(port), connected_(false),
       timeout_ms_(5000), max_retries_(3), compression_enabled_(false) {
-    
+
     metrics_ = ClientMetrics{};
     metrics_.total_requests = 0;
     metrics_.successful_requests = 0;
@@ -23,13 +93,16 @@ RPCClient::RPCClient(const std::string& address, int port)
 
 RPCClient::~RPCClient() {
     disconnect();
+    // callbacks of async calls reference this client
+    std::unique_lock<std::mutex> lock(inflight_mutex_);
+    inflight_cv_.wait(lock, [this] { return inflight_ == 0; });
 }
 
 bool RPCClient::connect() {
     if (connected_.load()) {
         return true;
     }
-    
+
     try {
         if (create_channel()) {
             connected_ = true;
@@ -38,7 +111,7 @@ bool RPCClient::connect() {
     } catch (const std::exception& e) {
         // Log error
     }
-    
+
     return false;
 }
 
@@ -46,10 +119,10 @@ bool RPCClient::disconnect() {
     if (!connected_.load()) {
         return true;
     }
-    
+
     connected_ = false;
     close_channel();
-    
+
     return true;
 }
 
@@ -57,42 +130,125 @@ bool RPCClient::is_connected() const {
     return connected_.load();
 }
 
-std::future<QueryResponse> RPCClient::search_async(const QueryRequest& request) {
-    return send_request_async<QueryRequest, QueryResponse>("Search", request);
-}
-
-QueryResponse RPCClient::search_sync(const QueryRequest& request) {
-    return send_request_sync<QueryRequest, QueryResponse>("Search", request);
+std::future<InternalQueryResponse> RPCClient::search_async(const InternalQueryRequest& request) {
+    auto promise = std::make_shared<std::promise<InternalQueryResponse>>();
+    auto future = promise->get_future();
+    SearchRequest proto_request;
+    fill_search_request(request, &proto_request);
+    start_async<SearchRequest, SearchResponse>(
+        std::move(proto_request), std::chrono::steady_clock::now() + std::chrono::milliseconds(request.timeout_ms),
+        [](VectorSearchService::Stub* stub, grpc::ClientContext* context, const SearchRequest* req,
+           SearchResponse* resp, std::function<void(grpc::Status)> on_done) {
+            stub->async()->Search(context, req, resp, std::move(on_done));
+        },
+        [promise](const grpc::Status& status, const SearchResponse& response) {
+            promise->set_value(to_query_response(status, response));
+        });
+    return future;
 }
 
-std::future<bool> RPCClient::add_vectors_async(const BulkLoadRequest& request) {
-    return send_request_async<BulkLoadRequest, bool>("AddVectors", request);
+InternalQueryResponse RPCClient::search_sync(const InternalQueryRequest& request) {
+    SearchRequest proto_request;
+    fill_search_request(request, &proto_request);
+    SearchResponse response;
+    grpc::Status status = call_with_retry(&VectorSearchService::Stub::Search, proto_request, &response);
+    return to_query_response(status, response);
+}
+
+void RPCClient::search_shard_async(const InternalShardSearchRequest& request,
+                                   std::chrono::steady_clock::time_point deadline, ShardSearchCallback done) {
+    ShardSearchRequest proto_request;
+    proto_request.set_shard_id(request.shard_id);
+    proto_request.mutable_centroid_ids()->Add(request.centroid_ids.begin(), request.centroid_ids.end());
+    const int d = static_cast<int>(request.query.size());
+    pack_vectors(request.query.data(), 1, d, PackedEncoding::FLOAT32, proto_request.mutable_query());
+    proto_request.set_k(request.k);
+    proto_request.set_include_vectors(request.include_vectors);
+    proto_request.mutable_filters()->insert(request.filter.begin(), request.filter.end());
+    start_async<ShardSearchRequest, ShardSearchResponse>(
+        std::move(proto_request), deadline,
+        [](VectorSearchService::Stub* stub, grpc::ClientContext* context, const ShardSearchRequest* req,
+           ShardSearchResponse* resp, std::function<void(grpc::Status)> on_done) {
+            stub->async()->SearchShard(context, req, resp, std::move(on_done));
+        },
+        [done = std::move(done), d](const grpc::Status& status, const ShardSearchResponse& response) {
+            done(to_shard_response(status, response, d));
+        });
+}
+
+std::future<bool> RPCClient::add_vectors_async(const InternalBulkLoadRequest& request) {
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto future = promise->get_future();
+    AddVectorsRequest proto_request;
+    fill_add_request(request, &proto_request);
+    start_async<AddVectorsRequest, AddVectorsResponse>(
+        std::move(proto_request), default_deadline(),
+        [](VectorSearchService::Stub* stub, grpc::ClientContext* context, const AddVectorsRequest* req,
+           AddVectorsResponse* resp, std::function<void(grpc::Status)> on_done) {
+            stub->async()->AddVectors(context, req, resp, std::move(on_done));
+        },
+        [promise](const grpc::Status& status, const AddVectorsResponse& response) {
+            promise->set_value(status.ok() && response.success());
+        });
+    return future;
 }
 
-bool RPCClient::add_vectors_sync(const BulkLoadRequest& request) {
-    return send_request_sync<BulkLoadRequest, bool>("AddVectors", request);
+bool RPCClient::add_vectors_sync(const InternalBulkLoadRequest& request) {
+    AddVectorsRequest proto_request;
+    fill_add_request(request, &proto_request);
+    AddVectorsResponse response;
+    grpc::Status status = call_with_retry(&VectorSearchService::Stub::AddVectors, proto_request, &response);
+    return status.ok() && response.success();
 }
 
 std::future<bool> RPCClient::remove_vector_async(int64_t id) {
-    // Create request with just the ID
-    std::string request_data = std::to_string(id);
-    return send_request_async<std::string, bool>("RemoveVector", request_data);
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto future = promise->get_future();
+    RemoveVectorRequest proto_request;
+    proto_request.set_id(id);
+    start_async<RemoveVectorRequest, RemoveVectorResponse>(
+        std::move(proto_request), default_deadline(),
+        [](VectorSearchService::Stub* stub, grpc::ClientContext* context, const RemoveVectorRequest* req,
+           RemoveVectorResponse* resp, std::function<void(grpc::Status)> on_done) {
+            stub->async()->RemoveVector(context, req, resp, std::move(on_done));
+        },
+        [promise](const grpc::Status& status, const RemoveVectorResponse& response) {
+            promise->set_value(status.ok() && response.success());
+        });
+    return future;
 }
 
 bool RPCClient::remove_vector_sync(int64_t id) {
-    std::string request_data = std::to_string(id);
-    return send_request_sync<std::string, bool>("RemoveVector", request_data);
+    RemoveVectorRequest proto_request;
+    proto_request.set_id(id);
+    RemoveVectorResponse response;
+    grpc::Status status = call_with_retry(&VectorSearchService::Stub::RemoveVector, proto_request, &response);
+    return status.ok() && response.success();
 }
 
 std::future<bool> RPCClient::update_vector_async(int64_t id, const std::vector<float>& vector) {
-    // Create request with ID and vector
-    std::string request_data = std::to_string(id) + ":" + serialize_vector(vector);
-    return send_request_async<std::string, bool>("UpdateVector", request_data);
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto future = promise->get_future();
+    UpdateVectorRequest proto_request;
+    fill_update_request(id, vector, &proto_request);
+    start_async<UpdateVectorRequest, UpdateVectorResponse>(
+        std::move(proto_request), default_deadline(),
+        [](VectorSearchService::Stub* stub, grpc::ClientContext* context, const UpdateVectorRequest* req,
+           UpdateVectorResponse* resp, std::function<void(grpc::Status)> on_done) {
+            stub->async()->UpdateVector(context, req, resp, std::move(on_done));
+        },
+        [promise](const grpc::Status& status, const UpdateVectorResponse& response) {
+            promise->set_value(status.ok() && response.success());
+        });
+    return future;
 }
 
 bool RPCClient::update_vector_sync(int64_t id, const std::vector<float>& vector) {
-    std::string request_data = std::to_string(id) + ":" + serialize_vector(vector);
-    return send_request_sync<std::string, bool>("UpdateVector", request_data);
+    UpdateVectorRequest proto_request;
+    fill_update_request(id, vector, &proto_request);
+    UpdateVectorResponse response;
+    grpc::Status status = call_with_retry(&VectorSearchService::Stub::UpdateVector, proto_request, &response);
+    return status.ok() && response.success();
 }
 
 void RPCClient::set_timeout_ms(int timeout_ms) {
@@ -108,32 +264,32 @@ void RPCClient::enable_compression(bool enable) {
 }
 
 bool RPCClient::health_check() {
-    try {
-        auto start_time = std::chrono::high_resolution_clock::now();
-        
-        // Send ping request
-        std::string request_data = "ping";
-        std::string response_data = execute_command_with_reply("HealthCheck");
-        
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto response_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-        
-        bool success = (response_data == "pong");
-        update_metrics(success, response_time.count(), request_data.size(), response_data.size());
-        
-        return success;
-    } catch (const std::exception& e) {
-        update_metrics(false, 0, 0, 0);
-        return false;
-    }
+    HealthCheckRequest request;
+    HealthCheckResponse response;
+    grpc::Status status = call_with_retry(&VectorSearchService::Stub::HealthCheck, request, &response);
+    return status.ok() && response.healthy();
 }
 
 std::string RPCClient::get_server_info() {
-    try {
-        return execute_command_with_reply("GetServerInfo");
-    } catch (const std::exception& e) {
+    HealthCheckRequest request;
+    HealthCheckResponse response;
+    grpc::Status status = call_with_retry(&VectorSearchService::Stub::HealthCheck, request, &response);
+    return status.ok() ? response.version() : "";
+}
+
+std::string RPCClient::capture_trace(int64_t duration_ms) {
+    auto stub_ptr = stub();
+    if (!stub_ptr) {
         return "";
     }
+    CaptureTraceRequest request;
+    request.set_duration_ms(duration_ms);
+    CaptureTraceResponse response;
+    // the server answers once the capture ends, not within the usual timeout
+    grpc::ClientContext context;
+    prepare_context(&context, default_deadline() + std::chrono::milliseconds(duration_ms));
+    grpc::Status status = stub_ptr->CaptureTrace(&context, request, &response);
+    return status.ok() ? response.trace_json() : "";
 }
 
 RPCClient::ClientMetrics RPCClient::get_metrics() const {
@@ -156,23 +312,26 @@ void RPCClient::reset_metrics() {
 bool RPCClient::create_channel() {
     try {
         std::string server_address = address_ + ":" + std::to_string(port_);
-        
+
         grpc::ChannelArguments args;
         args.SetMaxReceiveMessageSize(100 * 1024 * 1024); // 100MB
         args.SetMaxSendMessageSize(100 * 1024 * 1024);    // 100MB
-        
+        // a private subchannel pool gives every client its own connection, so pooled
+        // clients to one node do not end up multiplexed on a single socket
+        args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+
         if (compression_enabled_) {
             args.SetCompressionAlgorithm(GRPC_COMPRESS_GZIP);
         }
-        
-        channel_ = grpc::CreateCustomChannel(server_address, grpc::InsecureChannelCredentials(), args);
-        
-        if (!channel_) {
+
+        auto channel = grpc::CreateCustomChannel(server_address, grpc::InsecureChannelCredentials(), args);
+        if (!channel) {
             return false;
         }
-        
-        // Test connection
-        context_ = std::make_unique<grpc::ClientContext>();
+
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        channel_ = std::move(channel);
+        stub_ = VectorSearchService::NewStub(channel_);
         return true;
     } catch (const std::exception& e) {
         return false;
@@ -180,139 +339,119 @@ bool RPCClient::create_channel() {
 }
 
 void RPCClient::close_channel() {
-    context_.reset();
+    // calls in flight keep their own reference to the stub and channel
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    stub_.reset();
     channel_.reset();
 }
 
-bool RPCClient::execute_command(const std::string& command) {
-    // Simplified implementation - in real would use gRPC
-    return true;
+std::shared_ptr<VectorSearchService::Stub> RPCClient::stub() const {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    return stub_;
 }
 
-std::string RPCClient::execute_command_with_reply(const std::string& command) {
-    // Simplified implementation - in real would use gRPC
-    if (command == "HealthCheck") {
-        return "pong";
-    } else if (command == "GetServerInfo") {
-        return "DANN Server v1.0.0";
+void RPCClient::prepare_context(grpc::ClientContext* context, std::chrono::steady_clock::time_point deadline) const {
+    // ClientContext takes system_clock deadlines
+    context->set_deadline(std::chrono::system_clock::now() + (deadline - std::chrono::steady_clock::now()));
+    if (compression_enabled_) {
+        context->set_compression_algorithm(GRPC_COMPRESS_GZIP);
     }
-    return "";
+}
+
+std::chrono::steady_clock::time_point RPCClient::default_deadline() const {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms_);
 }
 
 void RPCClient::update_metrics(bool success, double response_time, size_t bytes_sent, size_t bytes_received) {
     std::lock_guard<std::mutex> lock(metrics_mutex_);
-    
+
     metrics_.total_requests++;
-    
+
     if (success) {
         metrics_.successful_requests++;
     } else {
         metrics_.failed_requests++;
     }
-    
+
     metrics_.bytes_sent += bytes_sent;
     metrics_.bytes_received += bytes_received;
-    
+
     // Update average response time
     double total_time = metrics_.avg_response_time_ms * (metrics_.total_requests - 1);
     metrics_.avg_response_time_ms = (total_time + response_time) / metrics_.total_requests;
 }
 
-std::string RPCClient::serialize_vector(const std::vector<float>& vector) {
-    std::string result;
-    result.reserve(vector.size() * sizeof(float));
-    
-    for (float value : vector) {
-        const char* bytes = reinterpret_cast<const char*>(&value);
-        result.append(bytes, sizeof(float));
-    }
-    
-    return result;
-}
-
-template<typename Request, typename Response>
-std::future<Response> RPCClient::send_request_async(const std::string& method, const Request& request) {
-    auto promise = std::make_shared<std::promise<Response>>();
-    auto future = promise->get_future();
-    
-    std::thread([this, method, request, promise]() {
-        try {
-            Response response = send_with_retry<Request, Response>(method, request);
-            promise->set_value(response);
-        } catch (const std::exception& e) {
-            promise->set_exception(std::current_exception());
+template<typename Request, typename Response, typename Method>
+grpc::Status RPCClient::call_with_retry(Method method, const Request& request, Response* response) {
+    grpc::Status status(grpc::StatusCode::UNAVAILABLE, "not connected");
+    for (int attempt = 0; attempt <= max_retries_; ++attempt) {
+        auto stub_ptr = stub();
+        if (!stub_ptr) {
+            break;
         }
-    }).detach();
-    
-    return future;
-}
-
-template<typename Request, typename Response>
-Response RPCClient::send_request_sync(const std::string& method, const Request& request) {
-    return send_with_retry<Request, Response>(method, request);
-}
-
-template<typename Request, typename Response>
-Response RPCClient::send_with_retry(const std::string& method, const Request& request) {
-    int attempts = 0;
-    
-    while (attempts <= max_retries_) {
-        try {
-            auto start_time = std::chrono::high_resolution_clock::now();
-            
-            // Serialize request
-            std::string request_data = serialize_request(request);
-            
-            // Send request and get response
-            std::string response_data = execute_command_with_reply(method);
-            
-            // Deserialize response
-            Response response = deserialize_response<Response>(response_data);
-            
-            auto end_time = std::chrono::high_resolution_clock::now();
-            auto response_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-            
-            update_metrics(true, response_time.count(), request_data.size(), response_data.size());
-            
-            return response;
-            
-        } catch (const std::exception& e) {
-            attempts++;
-            
-            if (attempts > max_retries_) {
-                update_metrics(false, 0, 0, 0);
-                throw;
+        if (attempt > 0) {
+            {
+                std::lock_guard<std::mutex> lock(metrics_mutex_);
+                metrics_.retries++;
             }
-            
             // Exponential backoff
-            std::this_thread::sleep_for(std::chrono::milliseconds(100 * (1 << (attempts - 1))));
+            std::this_thread::sleep_for(std::chrono::milliseconds(100 * (1 << (attempt - 1))));
         }
-    }
-    
-    // Should not reach here
-    throw std::runtime_error("Max retries exceeded");
-}
 
-std::string RPCClient::serialize_request(const QueryRequest& request) {
-    // Simplified serialization - in real would use protobuf
-    return "query_request_serialized";
-}
-
-std::string RPCClient::serialize_request(const BulkLoadRequest& request) {
-    // Simplified serialization - in real would use protobuf
-    return "bulk_load_request_serialized";
+        grpc::ClientContext context;
+        prepare_context(&context, default_deadline());
+        const auto start_time = std::chrono::steady_clock::now();
+        status = ((*stub_ptr).*method)(&context, request, response);
+        const auto response_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start_time);
+        update_metrics(status.ok(), response_time.count(), request.ByteSizeLong(),
+                       status.ok() ? response->ByteSizeLong() : 0);
+
+        // only a node that could not be reached is worth another attempt
+        if (status.error_code() != grpc::StatusCode::UNAVAILABLE) {
+            break;
+        }
+    }
+    return status;
 }
 
-QueryResponse RPCClient::deserialize_query_response(const std::string& response_data) {
-    // Simplified deserialization - in real would use protobuf
-    QueryResponse response;
-    response.success = true;
-    return response;
-}
+template<typename Request, typename Response, typename Invoke, typename Done>
+void RPCClient::start_async(Request request, std::chrono::steady_clock::time_point deadline, Invoke invoke,
+                            Done done) {
+    auto stub_ptr = stub();
+    if (!stub_ptr) {
+        update_metrics(false, 0, 0, 0);
+        done(grpc::Status(grpc::StatusCode::UNAVAILABLE, "not connected"), Response());
+        return;
+    }
 
-bool RPCClient::deserialize_bool_response(const std::string& response_data) {
-    // Simplified deserialization - in real would use protobuf
-    return response_data == "true";
+    // the context and messages must outlive the call: owned by the completion callback
+    struct Call {
+        grpc::ClientContext context;
+        Request request;
+        Response response;
+        std::chrono::steady_clock::time_point start_time;
+    };
+    auto call = std::make_shared<Call>();
+    call->request = std::move(request);
+    prepare_context(&call->context, deadline);
+    call->start_time = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(inflight_mutex_);
+        ++inflight_;
+    }
+    invoke(stub_ptr.get(), &call->context, &call->request, &call->response,
+           [this, call, stub_ptr, done](grpc::Status status) {
+               const auto response_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - call->start_time);
+               update_metrics(status.ok(), response_time.count(), call->request.ByteSizeLong(),
+                              status.ok() ? call->response.ByteSizeLong() : 0);
+               done(status, call->response);
+               std::lock_guard<std::mutex> lock(inflight_mutex_);
+               if (--inflight_ == 0) {
+                   inflight_cv_.notify_all();
+               }
+           });
 }
 
 } // namespace dann
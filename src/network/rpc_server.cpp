@@ -2,6 +2,10 @@
 #include "vector_search_service_impl.h"
 #include "vector_service.grpc.pb.h"
 #include "vector_service.pb.h"
+#include "dann/compute_executor.h"
+#include "dann/ingest_pipeline.h"
+#include "dann/io_thread_pool.h"
+#include "dann/logger.h"
 #include <grpc++/server_builder.h>
 #include <grpc++/server_context.h>
 #include <chrono>
@@ -9,6 +13,96 @@
 
 namespace dann {
 
+namespace {
+// where an async handler runs once its request has arrived
+enum class Dispatch {
+    INLINE,  // cheap reads, answered on the completion-queue thread
+    COMPUTE, // searches: CPU bound, their shard fan-out joins on the same executor
+    IO       // writes that may wait on the index write lock
+};
+}
+
+// one outstanding RPC of the async server, tagged on its completion queue
+class RPCServer::AsyncCallBase {
+public:
+    virtual ~AsyncCallBase() = default;
+    // ok is the completion-queue status of the last operation tagged with this call
+    virtual void proceed(bool ok) = 0;
+};
+
+// waits for one request of a method, runs the handler off the completion-queue
+// thread and finishes the RPC from whichever thread completed it; the queue
+// thread is free for other requests meanwhile
+template<typename Request, typename Response>
+class RPCServer::AsyncCall final: public RPCServer::AsyncCallBase {
+public:
+    using RequestMethod = void (VectorSearchService::AsyncService::*)(
+            grpc::ServerContext*, Request*, grpc::ServerAsyncResponseWriter<Response>*, grpc::CompletionQueue*,
+            grpc::ServerCompletionQueue*, void*);
+    using Handler = grpc::Status (VectorSearchServiceImpl::*)(grpc::ServerContext*, const Request*, Response*);
+
+    AsyncCall(RPCServer* server, grpc::ServerCompletionQueue* cq, RequestMethod request, Handler handler,
+              Dispatch dispatch)
+        : server_(server), cq_(cq), request_method_(request), handler_(handler), dispatch_(dispatch),
+          responder_(&context_) {
+        (server_->async_service_.get()->*request_method_)(&context_, &request_, &responder_, cq_, cq_, this);
+    }
+
+    void proceed(bool ok) override {
+        if (finishing_ || !ok) {
+            // the response went out, or the server shut down before a request arrived
+            delete this;
+            return;
+        }
+        if (server_->accepting_.load()) {
+            // keep a call waiting for the next request of this method
+            new AsyncCall(server_, cq_, request_method_, handler_, dispatch_);
+        }
+        start_time_ = std::chrono::steady_clock::now();
+        server_->begin_call();
+        switch (dispatch_) {
+            case Dispatch::INLINE:
+                run();
+                break;
+            case Dispatch::COMPUTE:
+                get_compute_executor().submit([this] { run(); });
+                break;
+            case Dispatch::IO:
+                get_io_thread_pool().enqueue([this] { run(); });
+                break;
+        }
+    }
+
+private:
+    void run() {
+        grpc::Status status;
+        try {
+            status = (server_->search_service_.get()->*handler_)(&context_, &request_, &response_);
+        } catch (const std::exception& e) {
+            status = grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start_time_;
+        RPCServer* server = server_;
+        server->update_metrics(status.ok(), std::chrono::duration<double, std::milli>(elapsed).count());
+        finishing_ = true;
+        // the queue thread may delete this as soon as Finish is posted
+        responder_.Finish(response_, status, this);
+        server->end_call();
+    }
+
+    RPCServer* server_;
+    grpc::ServerCompletionQueue* cq_;
+    RequestMethod request_method_;
+    Handler handler_;
+    Dispatch dispatch_;
+    grpc::ServerContext context_;
+    Request request_;
+    Response response_;
+    grpc::ServerAsyncResponseWriter<Response> responder_;
+    std::chrono::steady_clock::time_point start_time_;
+    bool finishing_{false};
+};
+
 RPCServer::RPCServer(const std::string& address, int port)
     : address_(address), port_(port), running_(false), 
       max_threads_(4), timeout_ms_(5000) {
@@ -32,11 +126,20 @@ bool RPCServer::start() {
     
     try {
         setup_grpc_server();
-        start_worker_threads();
+        if (mode_ == RPCServerMode::ASYNC) {
+            accepting_ = true;
+            for (auto& cq: completion_queues_) {
+                request_async_calls(cq.get());
+                queue_threads_.emplace_back(&RPCServer::poll_queue, this, cq.get());
+            }
+        } else {
+            start_worker_threads();
+        }
         
         running_ = true;
         return true;
     } catch (const std::exception& e) {
+        LOG_ERRORF("failed to start rpc server: %s", e.what());
         return false;
     }
 }
@@ -48,10 +151,12 @@ bool RPCServer::stop() {
     
     running_ = false;
     
+    accepting_ = false;
     if (server_) {
         server_->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(5));
     }
     
+    stop_async();
     stop_worker_threads();
     
     return true;
@@ -99,11 +204,23 @@ void RPCServer::setup_grpc_server() {
     builder.SetMaxReceiveMessageSize(100 * 1024 * 1024); // 100MB
     builder.SetMaxSendMessageSize(100 * 1024 * 1024);    // 100MB
     
-    // Set max threads
-    builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MAX_POLLERS, max_threads_);
-    
-    // Register the service if available
-    if (search_service_) {
+    if (mode_ == RPCServerMode::ASYNC) {
+        if (!search_service_) {
+            throw std::runtime_error("async mode needs a registered service to run the handlers");
+        }
+        async_service_ = std::make_unique<VectorSearchService::AsyncService>();
+        builder.RegisterService(async_service_.get());
+        int queues = completion_queue_count_;
+        if (queues == 0) {
+            queues = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+        for (int i = 0; i < queues; ++i) {
+            completion_queues_.push_back(builder.AddCompletionQueue());
+        }
+    } else if (search_service_) {
+        // Set max threads
+        builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MAX_POLLERS, max_threads_);
+        
         // Cast to the actual implementation and register
         auto* service_impl = static_cast<VectorSearchServiceImpl*>(search_service_.get());
         builder.RegisterService(service_impl);
@@ -151,6 +268,158 @@ void RPCServer::handle_request(const std::string& method, const std::string& req
     update_metrics(success, response_time.count());
 }
 
+// a client-streamed load: each received chunk is handed to the ingest pipeline on
+// the IO pool (where a full pipeline may block), which then asks for the next one
+class RPCServer::AsyncIngestCall final: public RPCServer::AsyncCallBase {
+public:
+    AsyncIngestCall(RPCServer* server, grpc::ServerCompletionQueue* cq)
+        : server_(server), cq_(cq), reader_(&context_) {
+        server_->async_service_->RequestAddVectorsStream(&context_, &reader_, cq_, cq_, this);
+    }
+
+    void proceed(bool ok) override {
+        switch (state_) {
+            case State::WAITING:
+                if (!ok) {
+                    delete this;
+                    return;
+                }
+                if (server_->accepting_.load()) {
+                    new AsyncIngestCall(server_, cq_);
+                }
+                server_->begin_call();
+                start_time_ = std::chrono::steady_clock::now();
+                pipeline_ = std::make_unique<IngestPipeline>(server_->search_service_->index());
+                state_ = State::READING;
+                reader_.Read(&chunk_, this);
+                return;
+            case State::READING:
+                // ok is false once the client half-closed the stream
+                get_io_thread_pool().enqueue([this, ok] { ok ? add_chunk() : finish(); });
+                return;
+            case State::FINISHING:
+                delete this;
+                return;
+        }
+    }
+
+private:
+    enum class State { WAITING, READING, FINISHING };
+
+    void add_chunk() {
+        std::vector<float> vectors;
+        std::vector<int64_t> ids;
+        if (!server_->search_service_->decode_chunk(chunk_, &vectors, &ids)) {
+            response_.add_failed_ids(chunk_.ids_size() > 0 ? chunk_.ids(0) : -1);
+            rejected_ = true;
+        } else if (!rejected_ && !pipeline_->add(std::move(vectors), std::move(ids))) {
+            rejected_ = true;
+        }
+        // keep draining the stream after an error so the client sees the response
+        reader_.Read(&chunk_, this);
+    }
+
+    void finish() {
+        auto result = pipeline_->finish();
+        response_.set_success(!rejected_ && result.success);
+        response_.set_added_count(static_cast<int64_t>(result.added));
+        const auto elapsed = std::chrono::steady_clock::now() - start_time_;
+        response_.set_load_time_ms(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+        if (!response_.success()) {
+            response_.set_error_message(result.error_message.empty() ? "malformed chunk" : result.error_message);
+        }
+        RPCServer* server = server_;
+        server->update_metrics(response_.success(), std::chrono::duration<double, std::milli>(elapsed).count());
+        state_ = State::FINISHING;
+        reader_.Finish(response_, grpc::Status::OK, this);
+        server->end_call();
+    }
+
+    RPCServer* server_;
+    grpc::ServerCompletionQueue* cq_;
+    grpc::ServerContext context_;
+    grpc::ServerAsyncReader<AddVectorsResponse, AddVectorsChunk> reader_;
+    AddVectorsChunk chunk_;
+    AddVectorsResponse response_;
+    std::unique_ptr<IngestPipeline> pipeline_;
+    std::chrono::steady_clock::time_point start_time_;
+    State state_{State::WAITING};
+    bool rejected_{false};
+};
+
+void RPCServer::request_async_calls(grpc::ServerCompletionQueue* cq) {
+    using Service = VectorSearchService::AsyncService;
+    using Impl = VectorSearchServiceImpl;
+    // one waiting call per method and queue; each arrival arms the next one
+    // a batched Search blocks until its batch ran: it waits on an IO thread, not a compute worker
+    new AsyncCall<SearchRequest, SearchResponse>(this, cq, &Service::RequestSearch, &Impl::Search,
+                                                 search_service_->batching_enabled() ? Dispatch::IO
+                                                                                     : Dispatch::COMPUTE);
+    new AsyncCall<BatchSearchRequest, BatchSearchResponse>(this, cq, &Service::RequestBatchSearch,
+                                                           &Impl::BatchSearch, Dispatch::COMPUTE);
+    new AsyncCall<ShardSearchRequest, ShardSearchResponse>(this, cq, &Service::RequestSearchShard,
+                                                           &Impl::SearchShard, Dispatch::COMPUTE);
+    new AsyncCall<AddVectorsRequest, AddVectorsResponse>(this, cq, &Service::RequestAddVectors, &Impl::AddVectors,
+                                                         Dispatch::IO);
+    new AsyncIngestCall(this, cq);
+    new AsyncCall<RemoveVectorRequest, RemoveVectorResponse>(this, cq, &Service::RequestRemoveVector,
+                                                             &Impl::RemoveVector, Dispatch::IO);
+    new AsyncCall<UpdateVectorRequest, UpdateVectorResponse>(this, cq, &Service::RequestUpdateVector,
+                                                             &Impl::UpdateVector, Dispatch::IO);
+    new AsyncCall<GetVectorRequest, GetVectorResponse>(this, cq, &Service::RequestGetVector, &Impl::GetVector,
+                                                       Dispatch::IO);
+    new AsyncCall<StatsRequest, StatsResponse>(this, cq, &Service::RequestGetStats, &Impl::GetStats,
+                                               Dispatch::INLINE);
+    new AsyncCall<HealthCheckRequest, HealthCheckResponse>(this, cq, &Service::RequestHealthCheck,
+                                                           &Impl::HealthCheck, Dispatch::INLINE);
+    // sleeps for the whole capture, so it holds an IO thread rather than the queue
+    new AsyncCall<CaptureTraceRequest, CaptureTraceResponse>(this, cq, &Service::RequestCaptureTrace,
+                                                             &Impl::CaptureTrace, Dispatch::IO);
+}
+
+void RPCServer::poll_queue(grpc::ServerCompletionQueue* cq) {
+    void* tag = nullptr;
+    bool ok = false;
+    while (cq->Next(&tag, &ok)) {
+        static_cast<AsyncCallBase*>(tag)->proceed(ok);
+    }
+}
+
+void RPCServer::begin_call() {
+    std::lock_guard<std::mutex> lock(inflight_mutex_);
+    ++inflight_;
+}
+
+void RPCServer::end_call() {
+    std::lock_guard<std::mutex> lock(inflight_mutex_);
+    if (--inflight_ == 0) {
+        inflight_cv_.notify_all();
+    }
+}
+
+void RPCServer::stop_async() {
+    if (completion_queues_.empty()) {
+        return;
+    }
+    {
+        // handlers still running will call Finish, which needs the queues open
+        std::unique_lock<std::mutex> lock(inflight_mutex_);
+        inflight_cv_.wait(lock, [this] { return inflight_ == 0; });
+    }
+    for (auto& cq: completion_queues_) {
+        cq->Shutdown();
+    }
+    for (auto& thread: queue_threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    queue_threads_.clear();
+    server_.reset();
+    completion_queues_.clear();
+    async_service_.reset();
+}
+
 void RPCServer::update_metrics(bool success, double response_time) {
     std::lock_guard<std::mutex> lock(metrics_mutex_);
     
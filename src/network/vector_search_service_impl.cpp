@@ -1,46 +1,122 @@
 #include "vector_search_service_impl.h"
+#include "dann/ingest_pipeline.h"
 #include "dann/logger.h"
+#include "dann/metrics.h"
+#include "dann/query_stats.h"
+#include "dann/trace.h"
+#include "dann/vector_codec.h"
+#include <algorithm>
 #include <chrono>
+#include <limits>
+#include <thread>
 
 namespace dann {
 
 VectorSearchServiceImpl::VectorSearchServiceImpl(std::shared_ptr<Index> index)
-    : index_(std::move(index)) {
-    if (!index_) {
-        throw std::invalid_argument("Index cannot be null");
+    : VectorSearchServiceImpl(std::make_shared<IndexHandle>(std::move(index))) {}
+
+VectorSearchServiceImpl::VectorSearchServiceImpl(std::shared_ptr<IndexHandle> handle)
+    : handle_(std::move(handle)),
+      search_latency_(Metrics::instance().histogram("search_latency_ms")),
+      searched_queries_(Metrics::instance().counter("searched_queries_total")),
+      window_start_(std::chrono::steady_clock::now()), window_queries_(0.0), window_qps_(-1.0),
+      start_time_(window_start_) {
+    if (!handle_) {
+        throw std::invalid_argument("Index handle cannot be null");
     }
 }
 
+void VectorSearchServiceImpl::enable_batching(const SearchBatcherOptions& options) {
+    // each batch runs on the index published when it is dispatched
+    IndexHandle* handle = handle_.get();
+    batcher_ = std::make_unique<SearchBatcher>(handle->dimension(),
+        [handle](const float* queries, size_t nq, int k, const InternalSearchParameters& params) {
+            return handle->current()->search_batch(queries, nq, k, params);
+        }, options);
+}
+
 grpc::Status VectorSearchServiceImpl::Search(grpc::ServerContext* context,
                                            const SearchRequest* request,
                                            SearchResponse* response) {
     try {
         auto start_time = std::chrono::high_resolution_clock::now();
-        std::vector<float> query_vector(request->query_vector().begin(),
-                                       request->query_vector().end());
+        const float* query = request->query_vector().data();
+        size_t rows = request->query_vector_size() == handle_->dimension() ? 1 : 0;
+        std::vector<float> scratch;
+        if (!request->packed_query().empty()) {
+            query = unpack_rows(request->packed_query(), request->encoding(), &rows, &scratch);
+        }
+        if (!query || rows != 1) {
+            response->set_success(false);
+            response->set_error_message("query must hold exactly one vector of the index dimension");
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, response->error_message());
+        }
 
-        auto search_result = index_->search(query_vector, request->k());
+        InternalSearchParameters params;
+        params.include_vectors = request->include_vectors();
+        params.timeout_ms = static_cast<uint64_t>(std::max<int64_t>(0, request->timeout_ms()));
+        params.allow_partial = request->allow_partial();
+        params.nprobe = std::max(0, request->nprobe());
+        params.ef_search = std::max(0, request->ef_search());
+        params.filter.insert(request->filters().begin(), request->filters().end());
+        QueryStats stats;
+        if (request->trace()) {
+            params.stats = &stats;
+        }
+        // both query forms are scored where they lie, without a copy into a std::vector
+        std::vector<std::vector<InternalSearchResult>> batch;
+        if (batcher_) {
+            batch.push_back(batcher_->search(query, request->k(), params));
+        } else {
+            batch = handle_->current()->search_batch(query, 1, request->k(), params);
+        }
+        const auto& search_result = batch[0];
         response->set_success(true);
 
         // Calculate query time
         auto end_time = std::chrono::high_resolution_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
         response->set_query_time_ms(duration.count());
+        search_latency_->record(std::chrono::duration<double, std::milli>(end_time - start_time).count());
+        searched_queries_->add(1.0);
 
         // Convert search results to protobuf format
+        response->mutable_results()->Reserve(static_cast<int>(search_result.size()));
         for (const auto& result : search_result) {
             auto* proto_result = response->add_results();
             proto_result->set_id(result.id);
             proto_result->set_distance(result.distance);
             
-            // Add vector data if needed
-            for (float val : result.vector) {
-                proto_result->add_vector(val);
-            }
+            // Add vector data if needed, in one block copy
+            proto_result->mutable_vector()->Add(result.vector.begin(), result.vector.end());
+        }
+
+        if (request->trace()) {
+            stats.serialize_ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::high_resolution_clock::now() - end_time).count();
+            Metrics::instance().record_histogram("search_stage_ms{stage=\"serialize\"}", stats.serialize_ms);
+            auto* proto_stats = response->mutable_stats();
+            proto_stats->set_centroid_ms(stats.centroid_ms);
+            proto_stats->set_routing_ms(stats.routing_ms);
+            proto_stats->set_queue_wait_ms(stats.queue_wait_ms);
+            proto_stats->set_scan_ms(stats.scan_ms);
+            proto_stats->set_remote_ms(stats.remote_ms);
+            proto_stats->set_merge_ms(stats.merge_ms);
+            proto_stats->set_rerank_ms(stats.rerank_ms);
+            proto_stats->set_serialize_ms(stats.serialize_ms);
+            proto_stats->set_total_ms(stats.total_ms);
+            proto_stats->set_lists_probed(static_cast<int64_t>(stats.lists_probed));
+            proto_stats->set_vectors_scanned(static_cast<int64_t>(stats.vectors_scanned));
+            proto_stats->set_vectors_reranked(static_cast<int64_t>(stats.vectors_reranked));
         }
 
         return grpc::Status::OK;
         
+    } catch (const ShardUnavailableError& e) {
+        // the shards that answered are dropped unless the request allowed partial results
+        response->set_success(false);
+        response->set_error_message(e.what());
+        return grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED, e.what());
     } catch (const std::exception& e) {
         Logger::instance().errorf("Search failed: {}", e.what());
         response->set_success(false);
@@ -49,26 +125,184 @@ grpc::Status VectorSearchServiceImpl::Search(grpc::ServerContext* context,
     }
 }
 
+grpc::Status VectorSearchServiceImpl::BatchSearch(grpc::ServerContext* context,
+                                                  const dann::BatchSearchRequest* request,
+                                                  dann::BatchSearchResponse* response) {
+    try {
+        // the request runs on the version published when it arrived, even across a swap
+        const std::shared_ptr<Index> index = handle_->current();
+        auto start_time = std::chrono::high_resolution_clock::now();
+        const int k = request->k();
+        size_t nq = 0;
+        std::vector<float> scratch;
+        const float* queries = unpack_rows(request->queries(), request->encoding(), &nq, &scratch);
+        if (!queries || k <= 0) {
+            response->set_success(false);
+            response->set_error_message("queries must be whole vectors of the index dimension and k positive");
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, response->error_message());
+        }
+        // checked by division so nq * k cannot overflow first
+        if (nq > kMaxBatchResults / static_cast<size_t>(k)) {
+            response->set_success(false);
+            response->set_error_message("queries * k must not exceed " + std::to_string(kMaxBatchResults));
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, response->error_message());
+        }
+
+        InternalSearchParameters params;
+        params.timeout_ms = static_cast<uint64_t>(std::max<int64_t>(0, request->timeout_ms()));
+        params.allow_partial = request->allow_partial();
+        params.nprobe = std::max(0, request->nprobe());
+        params.ef_search = std::max(0, request->ef_search());
+        params.filter.insert(request->filters().begin(), request->filters().end());
+        auto search_results = index->search_batch(queries, nq, k, params);
+
+        // flat layout: fixed-width fields resized once and filled in place
+        const size_t total = nq * static_cast<size_t>(k);
+        response->mutable_ids()->Resize(static_cast<int>(total), -1);
+        response->mutable_distances()->Resize(static_cast<int>(total), std::numeric_limits<float>::infinity());
+        int64_t* ids = response->mutable_ids()->mutable_data();
+        float* distances = response->mutable_distances()->mutable_data();
+        for (size_t qi = 0; qi < nq; ++qi) {
+            const auto& results = search_results[qi];
+            const size_t n = std::min(results.size(), static_cast<size_t>(k));
+            for (size_t j = 0; j < n; ++j) {
+                ids[qi * k + j] = results[j].id;
+                distances[qi * k + j] = results[j].distance;
+            }
+        }
+        response->set_success(true);
+        response->set_num_queries(static_cast<int32_t>(nq));
+        response->set_k(k);
+
+        auto end_time = std::chrono::high_resolution_clock::now();
+        response->set_query_time_ms(
+                std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count());
+        search_latency_->record(std::chrono::duration<double, std::milli>(end_time - start_time).count());
+        searched_queries_->add(static_cast<double>(nq));
+        return grpc::Status::OK;
+
+    } catch (const ShardUnavailableError& e) {
+        response->set_success(false);
+        response->set_error_message(e.what());
+        return grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED, e.what());
+    } catch (const std::exception& e) {
+        Logger::instance().errorf("BatchSearch failed: {}", e.what());
+        response->set_success(false);
+        response->set_error_message(e.what());
+        return grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+    }
+}
+
+grpc::Status VectorSearchServiceImpl::SearchShard(grpc::ServerContext* context,
+                                                  const dann::ShardSearchRequest* request,
+                                                  dann::ShardSearchResponse* response) {
+    try {
+        const std::shared_ptr<Index> index = handle_->current();
+        auto ivf = std::dynamic_pointer_cast<DistributedIndexIVF>(index->shard(0));
+        if (!ivf) {
+            response->set_success(false);
+            response->set_error_message("shard searches need an IVF index");
+            return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, response->error_message());
+        }
+        size_t rows = 0;
+        std::vector<float> scratch;
+        const float* query = unpack_rows(request->query(), dann::FLOAT32, &rows, &scratch);
+        if (!query || rows != 1) {
+            response->set_success(false);
+            response->set_error_message("query must hold exactly one vector of the index dimension");
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, response->error_message());
+        }
+
+        InternalShardSearchRequest shard_request;
+        shard_request.shard_id = request->shard_id();
+        shard_request.centroid_ids.assign(request->centroid_ids().begin(), request->centroid_ids().end());
+        shard_request.query.assign(query, query + handle_->dimension());
+        shard_request.k = request->k();
+        shard_request.include_vectors = request->include_vectors();
+        shard_request.filter.insert(request->filters().begin(), request->filters().end());
+        InternalShardSearchResponse shard_response;
+        if (!ivf->search_shard(shard_request, &shard_response)) {
+            response->set_success(false);
+            response->set_error_message(shard_response.error_message);
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, response->error_message());
+        }
+
+        const auto& results = shard_response.results;
+        const int n = static_cast<int>(results.size());
+        response->mutable_ids()->Resize(n, -1);
+        response->mutable_distances()->Resize(n, 0.0f);
+        int64_t* ids = response->mutable_ids()->mutable_data();
+        float* distances = response->mutable_distances()->mutable_data();
+        for (int i = 0; i < n; ++i) {
+            ids[i] = results[i].id;
+            distances[i] = results[i].distance;
+        }
+        if (shard_request.include_vectors) {
+            std::vector<float> rows_out;
+            rows_out.reserve(results.size() * handle_->dimension());
+            for (const auto& result : results) {
+                rows_out.insert(rows_out.end(), result.vector.begin(), result.vector.end());
+            }
+            pack_vectors(rows_out.data(), results.size(), handle_->dimension(), PackedEncoding::FLOAT32,
+                         response->mutable_vectors());
+        }
+        response->set_success(true);
+        return grpc::Status::OK;
+
+    } catch (const std::exception& e) {
+        Logger::instance().errorf("SearchShard failed: {}", e.what());
+        response->set_success(false);
+        response->set_error_message(e.what());
+        return grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+    }
+}
+
 grpc::Status VectorSearchServiceImpl::AddVectors(grpc::ServerContext* context,
                                                const dann::AddVectorsRequest* request,
                                                dann::AddVectorsResponse* response) {
     try {
+        const std::shared_ptr<Index> index = handle_->current();
         auto start_time = std::chrono::high_resolution_clock::now();
         
         // Extract vectors and IDs from request
         std::vector<float> vectors;
         std::vector<int64_t> ids;
         
+        const size_t d = static_cast<size_t>(handle_->dimension());
+        vectors.reserve(request->vectors_size() * d);
+        ids.reserve(request->vectors_size());
+        std::vector<float> scratch;
         for (const auto& vector : request->vectors()) {
             ids.push_back(vector.id());
-            vectors.insert(vectors.end(), vector.data().begin(), vector.data().end());
+            if (vector.packed_data().empty()) {
+                vectors.insert(vectors.end(), vector.data().begin(), vector.data().end());
+                continue;
+            }
+            size_t rows = 0;
+            const float* row = unpack_rows(vector.packed_data(), vector.encoding(), &rows, &scratch);
+            if (!row || rows != 1) {
+                response->set_success(false);
+                response->set_error_message("vector " + std::to_string(vector.id()) + " is not one row of the index dimension");
+                return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, response->error_message());
+            }
+            vectors.insert(vectors.end(), row, row + d);
         }
         
-        // Use batch size from request or default
-        int batch_size = request->batch_size() > 0 ? request->batch_size() : 1000;
-        
-        // Add vectors to index
-        bool success = index_->add_vectors_bulk(vectors, ids, batch_size);
+        // Add vectors to index (Index routes the rows itself; batch_size only applies to streams)
+        bool success = index->add_vectors(vectors, ids);
+        // metadata becomes the attributes searches filter on
+        std::vector<int64_t> attribute_ids;
+        std::vector<Attributes> attributes;
+        for (const auto& vector : request->vectors()) {
+            if (!vector.metadata().empty()) {
+                attribute_ids.push_back(vector.id());
+                attributes.emplace_back(vector.metadata().begin(), vector.metadata().end());
+            }
+        }
+        if (success && !attribute_ids.empty() && !index->set_attributes(attribute_ids, attributes)) {
+            Logger::instance().warnf("AddVectors: index {} does not store metadata, filters will not match",
+                                     index->name());
+        }
         
         auto end_time = std::chrono::high_resolution_clock::now();
         auto load_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
@@ -94,11 +328,72 @@ grpc::Status VectorSearchServiceImpl::AddVectors(grpc::ServerContext* context,
     }
 }
 
+bool VectorSearchServiceImpl::decode_chunk(const dann::AddVectorsChunk& chunk, std::vector<float>* vectors,
+                                           std::vector<int64_t>* ids) const {
+    std::vector<float> scratch;
+    size_t rows = 0;
+    const float* data = unpack_rows(chunk.vectors(), chunk.encoding(), &rows, &scratch);
+    if (!data || rows != static_cast<size_t>(chunk.ids_size())) {
+        return false;
+    }
+    if (data == scratch.data()) {
+        vectors->swap(scratch);
+    } else {
+        // the pipeline owns its chunks: one block copy out of the message
+        vectors->assign(data, data + rows * static_cast<size_t>(handle_->dimension()));
+    }
+    ids->assign(chunk.ids().begin(), chunk.ids().end());
+    return true;
+}
+
+grpc::Status VectorSearchServiceImpl::AddVectorsStream(grpc::ServerContext* context,
+                                                       grpc::ServerReader<dann::AddVectorsChunk>* reader,
+                                                       dann::AddVectorsResponse* response) {
+    try {
+        const std::shared_ptr<Index> index = handle_->current();
+        auto start_time = std::chrono::high_resolution_clock::now();
+        // receiving the next chunk overlaps with assigning and appending the earlier ones
+        IngestPipeline pipeline(index);
+        dann::AddVectorsChunk chunk;
+        bool accepted = true;
+        while (accepted && reader->Read(&chunk)) {
+            std::vector<float> vectors;
+            std::vector<int64_t> ids;
+            if (!decode_chunk(chunk, &vectors, &ids)) {
+                response->add_failed_ids(chunk.ids_size() > 0 ? chunk.ids(0) : -1);
+                accepted = false;
+                break;
+            }
+            accepted = pipeline.add(std::move(vectors), std::move(ids));
+        }
+        auto result = pipeline.finish();
+
+        auto end_time = std::chrono::high_resolution_clock::now();
+        response->set_success(accepted && result.success);
+        response->set_added_count(static_cast<int64_t>(result.added));
+        response->set_load_time_ms(
+                std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count());
+        if (!response->success()) {
+            response->set_error_message(result.error_message.empty() ? "malformed chunk" : result.error_message);
+        }
+        Logger::instance().infof("AddVectorsStream completed: count={}, success={}, time_ms={}",
+                result.added, response->success(), response->load_time_ms());
+        return grpc::Status::OK;
+
+    } catch (const std::exception& e) {
+        Logger::instance().errorf("AddVectorsStream failed: {}", e.what());
+        response->set_success(false);
+        response->set_error_message(e.what());
+        return grpc::Status(grpc::StatusCode::INTERNAL, e.what());
+    }
+}
+
 grpc::Status VectorSearchServiceImpl::RemoveVector(grpc::ServerContext* context,
                                                   const dann::RemoveVectorRequest* request,
                                                   dann::RemoveVectorResponse* response) {
     try {
-        bool success = index_->remove_vector(request->id());
+        const std::shared_ptr<Index> index = handle_->current();
+        bool success = index->remove_vector(request->id());
         
         response->set_success(success);
         if (!success) {
@@ -121,8 +416,13 @@ grpc::Status VectorSearchServiceImpl::UpdateVector(grpc::ServerContext* context,
                                                   const dann::UpdateVectorRequest* request,
                                                   dann::UpdateVectorResponse* response) {
     try {
+        const std::shared_ptr<Index> index = handle_->current();
         std::vector<float> vector_data(request->vector().begin(), request->vector().end());
-        bool success = index_->update_vector(request->id(), vector_data);
+        bool success = index->update_vector(request->id(), vector_data);
+        if (success && !request->metadata().empty()) {
+            success = index->set_attributes({request->id()},
+                                             {Attributes(request->metadata().begin(), request->metadata().end())});
+        }
         
         response->set_success(success);
         if (!success) {
@@ -166,23 +466,90 @@ grpc::Status VectorSearchServiceImpl::GetStats(grpc::ServerContext* context,
                                              const dann::StatsRequest* request,
                                              dann::StatsResponse* response) {
     try {
+        const std::shared_ptr<Index> index = handle_->current();
         response->set_success(true);
-        response->set_total_vectors(index_->size());
-        response->set_index_type(index_->index_type());
-        response->set_dimension(index_->dimension());
-        
-        // Get query router metrics
-        // auto query_metrics = query_router_->get_metrics();
-        // response->set_avg_query_time_ms(query_metrics.avg_response_time_ms);
-        // response->set_total_queries(query_metrics.total_queries);
-        //
-        // // Add custom metrics
-        // auto& custom_metrics = *response->mutable_custom_metrics();
-        // custom_metrics["index_version"] = static_cast<double>(index_->get_version());
-        //
-        // Logger::instance().infof("GetStats completed: vectors={}, type={}, dimension={}",
-        //         response->total_vectors(), response->index_type(), response->dimension());
-        
+        response->set_total_vectors(index->size());
+        response->set_index_type(index->index_type());
+        response->set_dimension(handle_->dimension());
+
+        // latency of the calls so far; qps over the last closed window, so callers
+        // polling at any rate all see the same figure
+        const HistogramSnapshot latency = search_latency_->snapshot();
+        const double queries = searched_queries_->value();
+        response->set_avg_query_time_ms(latency.mean());
+        response->set_total_queries(static_cast<int64_t>(queries));
+        response->set_latency_p50_ms(latency.percentile(50));
+        response->set_latency_p95_ms(latency.percentile(95));
+        response->set_latency_p99_ms(latency.percentile(99));
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            const auto now = std::chrono::steady_clock::now();
+            const double seconds = std::chrono::duration<double>(now - window_start_).count();
+            const double rate = seconds > 0.0 ? (queries - window_queries_) / seconds : 0.0;
+            if (now - window_start_ >= kQpsWindow) {
+                window_qps_ = rate;
+                window_start_ = now;
+                window_queries_ = queries;
+            }
+            // until the first window closes, the rate since the start
+            response->set_qps(window_qps_ >= 0.0 ? window_qps_ : rate);
+        }
+
+        if (const ResultCache* cache = index->result_cache()) {
+            const auto cache_stats = cache->stats();
+            const uint64_t lookups = cache_stats.hits + cache_stats.misses;
+            response->set_cache_hit_rate(lookups > 0 ? static_cast<double>(cache_stats.hits) / lookups : 0.0);
+        }
+
+        auto set_lists = [](const IvfShardStats& stats, dann::ListStats* lists) {
+            lists->set_count(static_cast<int64_t>(stats.lists));
+            lists->set_min_length(static_cast<int64_t>(stats.min_list));
+            lists->set_median_length(static_cast<int64_t>(stats.median_list));
+            lists->set_max_length(static_cast<int64_t>(stats.max_list));
+            lists->set_imbalance(stats.imbalance);
+        };
+        // every index shard holds an IVF index of its own; the list figures are
+        // taken over the lists of all of them
+        IvfShardStats total;
+        std::vector<size_t> list_lengths;
+        uint64_t warm_bytes = 0;
+        uint64_t warm_loaded_bytes = 0;
+        bool ivf_found = false;
+        for (int s = 0; s < index->shard_count(); ++s) {
+            auto ivf = std::dynamic_pointer_cast<DistributedIndexIVF>(index->shard(s));
+            if (!ivf) {
+                continue;
+            }
+            ivf_found = true;
+            for (const auto& shard : ivf->shard_stats(nullptr, &list_lengths)) {
+                auto* proto_shard = response->add_shards();
+                proto_shard->set_index_shard(s);
+                proto_shard->set_shard_id(shard.shard_id);
+                proto_shard->set_node_id(shard.node);
+                proto_shard->set_remote(shard.remote);
+                proto_shard->set_vectors(static_cast<int64_t>(shard.vectors));
+                proto_shard->set_memory_bytes(static_cast<int64_t>(shard.memory_bytes));
+                set_lists(shard, proto_shard->mutable_lists());
+                total.vectors += shard.vectors;
+                total.memory_bytes += shard.memory_bytes;
+            }
+            const WarmStartProgress warm = ivf->warm_progress();
+            warm_bytes += warm.bytes;
+            warm_loaded_bytes += warm.loaded_bytes;
+        }
+        if (ivf_found) {
+            summarize_list_lengths(&list_lengths, &total);
+            set_lists(total, response->mutable_lists());
+            response->set_index_size_bytes(static_cast<int64_t>(total.memory_bytes));
+            (*response->mutable_custom_metrics())["warm_loaded_fraction"] =
+                    warm_bytes > 0 ? static_cast<double>(warm_loaded_bytes) / static_cast<double>(warm_bytes) : 1.0;
+        }
+
+        auto& custom_metrics = *response->mutable_custom_metrics();
+        custom_metrics["index_version"] = static_cast<double>(index->version());
+        custom_metrics["shard_count"] = static_cast<double>(index->shard_count());
+        custom_metrics["latency_max_ms"] = latency.max;
+
         return grpc::Status::OK;
         
     } catch (const std::exception& e) {
@@ -197,16 +564,28 @@ grpc::Status VectorSearchServiceImpl::HealthCheck(grpc::ServerContext* context,
                                                   const dann::HealthCheckRequest* request,
                                                   dann::HealthCheckResponse* response) {
     try {
+        const std::shared_ptr<Index> index = handle_->current();
         response->set_healthy(true);
         response->set_status("healthy");
         response->set_version("1.0.0");
-        response->set_uptime_seconds(0); // TODO: implement uptime tracking
+        response->set_uptime_seconds(std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now() - start_time_).count());
         
         auto& details = *response->mutable_details();
-        details["index_size"] = std::to_string(index_->size());
-        details["index_type"] = index_->index_type();
-        details["index_name"] = index_->name();
-        details["shard_count"] = std::to_string(index_->shard_count());
+        details["index_size"] = std::to_string(index->size());
+        details["index_type"] = index->index_type();
+        details["index_name"] = index->name();
+        details["shard_count"] = std::to_string(index->shard_count());
+        // a warm-starting node routes and answers already, only slower until its
+        // partitions are read
+        if (auto ivf = std::dynamic_pointer_cast<DistributedIndexIVF>(index->shard(0))) {
+            const WarmStartProgress warm = ivf->warm_progress();
+            if (!warm.done) {
+                response->set_status("warming");
+            }
+            details["warm_partitions"] = std::to_string(warm.loaded_partitions) + "/" +
+                                         std::to_string(warm.partitions);
+        }
         
         return grpc::Status::OK;
         
@@ -219,8 +598,60 @@ grpc::Status VectorSearchServiceImpl::HealthCheck(grpc::ServerContext* context,
     }
 }
 
+grpc::Status VectorSearchServiceImpl::CaptureTrace(grpc::ServerContext* context,
+                                                   const dann::CaptureTraceRequest* request,
+                                                   dann::CaptureTraceResponse* response) {
+    const int64_t duration_ms = request->duration_ms();
+    if (duration_ms <= 0 || duration_ms > kMaxTraceCaptureMs || request->max_events_per_thread() < 0) {
+        response->set_success(false);
+        response->set_error_message("duration_ms must be in (0, " + std::to_string(kMaxTraceCaptureMs) +
+                                    "] and max_events_per_thread non-negative");
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, response->error_message());
+    }
+    Tracer& tracer = Tracer::instance();
+    const bool started = request->max_events_per_thread() > 0
+            ? tracer.start(static_cast<size_t>(request->max_events_per_thread()))
+            : tracer.start();
+    if (!started) {
+        response->set_success(false);
+        response->set_error_message("a trace capture is already running");
+        return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, response->error_message());
+    }
+    Logger::instance().infof("CaptureTrace: tracing for {} ms", duration_ms);
+
+    // sleeps in slices so a cancelled call ends its capture early
+    const auto begin = std::chrono::steady_clock::now();
+    const auto deadline = begin + std::chrono::milliseconds(duration_ms);
+    while (!context->IsCancelled()) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now,
+                                                                                  std::chrono::milliseconds(100)));
+    }
+    TraceCaptureStats stats;
+    std::string json = tracer.stop(&stats);
+    if (context->IsCancelled()) {
+        return grpc::Status(grpc::StatusCode::CANCELLED, "trace capture cancelled");
+    }
+    response->set_success(true);
+    response->set_trace_json(std::move(json));
+    response->set_events(static_cast<int64_t>(stats.events));
+    response->set_dropped_events(static_cast<int64_t>(stats.dropped));
+    response->set_duration_ms(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - begin).count());
+    return grpc::Status::OK;
+}
+
 // Helper methods implementation
 
+const float* VectorSearchServiceImpl::unpack_rows(const std::string& bytes, dann::VectorEncoding encoding,
+                                                  size_t* rows, std::vector<float>* scratch) const {
+    const PackedEncoding packed = encoding == dann::FLOAT16 ? PackedEncoding::FLOAT16 : PackedEncoding::FLOAT32;
+    return unpack_vectors(bytes.data(), bytes.size(), packed, handle_->dimension(), rows, scratch);
+}
+
 // SearchResult VectorSearchServiceImpl::convert_to_search_result(const ::dann::SearchResult& proto_result) const {
 //     std::vector<float> vector_data(proto_result.vector().begin(), proto_result.vector().end());
 //     return SearchResult(proto_result.id(), proto_result.distance(), vector_data);
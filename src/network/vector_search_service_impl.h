@@ -5,24 +5,56 @@
 #include "vector_service.pb.h"
 #include "vector_service.grpc.pb.h"
 #include "dann/index.h"
+#include "dann/index_handle.h"
 #include "dann/distributed_index_ivf.h"
+#include "dann/metrics.h"
+#include "dann/search_batcher.h"
 
+#include <chrono>
 #include <memory>
+#include <mutex>
 namespace dann {
 
 class VectorSearchServiceImpl final : public dann::VectorSearchService::Service {
 public:
     VectorSearchServiceImpl(std::shared_ptr<Index> index);
+    // serves whatever index the handle publishes; a swap does not interrupt requests
+    explicit VectorSearchServiceImpl(std::shared_ptr<IndexHandle> handle);
+
+    // coalesces concurrent Search calls into batched index searches; call before serving
+    void enable_batching(const SearchBatcherOptions& options);
+    // Search then waits for its batch, so it should not occupy a compute worker
+    bool batching_enabled() const { return batcher_ != nullptr; }
     
     // gRPC service implementations
     grpc::Status Search(grpc::ServerContext* context,
                        const dann::SearchRequest* request,
                        dann::SearchResponse* response) override;
+
+    grpc::Status BatchSearch(grpc::ServerContext* context,
+                            const dann::BatchSearchRequest* request,
+                            dann::BatchSearchResponse* response) override;
+    
+    // the serving half of a distributed IVF search; needs an IVF index
+    grpc::Status SearchShard(grpc::ServerContext* context,
+                            const dann::ShardSearchRequest* request,
+                            dann::ShardSearchResponse* response) override;
     
     grpc::Status AddVectors(grpc::ServerContext* context,
                            const dann::AddVectorsRequest* request,
                            dann::AddVectorsResponse* response) override;
     
+    grpc::Status AddVectorsStream(grpc::ServerContext* context,
+                                 grpc::ServerReader<dann::AddVectorsChunk>* reader,
+                                 dann::AddVectorsResponse* response) override;
+
+    // chunk decoding shared by the sync and async stream handlers; false when the
+    // payload is not ids_size() whole rows
+    bool decode_chunk(const dann::AddVectorsChunk& chunk, std::vector<float>* vectors,
+                      std::vector<int64_t>* ids) const;
+    std::shared_ptr<Index> index() const { return handle_->current(); }
+    IndexHandle& handle() const { return *handle_; }
+
     grpc::Status RemoveVector(grpc::ServerContext* context,
                              const dann::RemoveVectorRequest* request,
                              dann::RemoveVectorResponse* response) override;
@@ -43,8 +75,37 @@ public:
                             const dann::HealthCheckRequest* request,
                             dann::HealthCheckResponse* response) override;
 
+    // Admin: traces live traffic for up to kMaxTraceCaptureMs; one capture at a time
+    grpc::Status CaptureTrace(grpc::ServerContext* context,
+                             const dann::CaptureTraceRequest* request,
+                             dann::CaptureTraceResponse* response) override;
+
+    static constexpr int64_t kMaxTraceCaptureMs = 60000;
+    // BatchSearch answers nq * k slots in flat repeated fields, whose sizes are int;
+    // larger requests are rejected before searching
+    static constexpr size_t kMaxBatchResults = size_t{1} << 24;
+    // GetStats reports qps over the last window of at least this length to close
+    static constexpr std::chrono::seconds kQpsWindow{10};
+
 private:
-    std::shared_ptr<Index> index_;
+    std::shared_ptr<IndexHandle> handle_;
+    std::unique_ptr<SearchBatcher> batcher_;
+
+    // end-to-end latency of Search and BatchSearch calls and the queries they carried
+    std::shared_ptr<LatencyHistogram> search_latency_;
+    std::shared_ptr<ShardedCounter> searched_queries_;
+    // the current qps window opened at window_start_ with window_queries_ counted;
+    // window_qps_ is the rate over the last closed one, negative before the first
+    std::mutex stats_mutex_;
+    std::chrono::steady_clock::time_point window_start_;
+    double window_queries_;
+    double window_qps_;
+    std::chrono::steady_clock::time_point start_time_;
+
+    // packed bytes as rows of the index dimension, in place when possible; nullptr
+    // when the size is not a whole number of rows
+    const float* unpack_rows(const std::string& bytes, dann::VectorEncoding encoding, size_t* rows,
+                             std::vector<float>* scratch) const;
 
     // Helper methods
     // SearchResult convert_to_search_result(const ::dann::SearchResult& proto_result) const;
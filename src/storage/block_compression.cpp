@@ -0,0 +1,235 @@
+//
+// LZ4 / Zstd block frames, see block_compression.h for the layout.
+//
+
+#include "dann/block_compression.h"
+
+#include <lz4.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace dann {
+
+namespace {
+constexpr char kFrameMagic[8] = {'D', 'A', 'N', 'N', 'B', 'L', 'K', '\0'};
+constexpr char kFrameEndMagic[8] = {'D', 'A', 'N', 'N', 'B', 'L', 'K', 'E'};
+constexpr size_t kFrameHeaderBytes = 8 + 4 + 4 + 8;
+constexpr size_t kBlockHeaderBytes = 4 + 4 + 4 + 4;
+constexpr size_t kFrameFooterBytes = 4 + 8; // block count, end magic
+
+template <typename T>
+void append_pod(std::string* out, const T& value) {
+    out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T read_pod(const char* p) {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+// FNV-1a over the stored payload, checked before it reaches a decoder
+uint32_t checksum(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// compressed bytes of one block appended to out; false when the codec did not shrink it
+bool compress_block(const char* data, size_t size, const BlockCompressionOptions& options, std::string* out) {
+    const size_t start = out->size();
+    if (options.codec == CompressionCodec::LZ4) {
+        const int bound = LZ4_compressBound(static_cast<int>(size));
+        out->resize(start + static_cast<size_t>(bound));
+        const int n = LZ4_compress_default(data, out->data() + start, static_cast<int>(size), bound);
+        out->resize(n > 0 ? start + static_cast<size_t>(n) : start);
+    } else if (options.codec == CompressionCodec::ZSTD) {
+        const size_t bound = ZSTD_compressBound(size);
+        out->resize(start + bound);
+        const size_t n = ZSTD_compress(out->data() + start, bound, data, size, options.level);
+        out->resize(ZSTD_isError(n) ? start : start + n);
+    }
+    if (out->size() == start || out->size() - start >= size) {
+        out->resize(start);
+        return false;
+    }
+    return true;
+}
+
+bool decompress_block(CompressionCodec codec, const char* payload, size_t stored, char* out, size_t raw) {
+    switch (codec) {
+        case CompressionCodec::NONE:
+            if (stored != raw) {
+                return false;
+            }
+            std::memcpy(out, payload, raw);
+            return true;
+        case CompressionCodec::LZ4:
+            return LZ4_decompress_safe(payload, out, static_cast<int>(stored), static_cast<int>(raw)) ==
+                   static_cast<int>(raw);
+        case CompressionCodec::ZSTD: {
+            const size_t n = ZSTD_decompress(out, raw, payload, stored);
+            return !ZSTD_isError(n) && n == raw;
+        }
+    }
+    return false;
+}
+}
+
+bool parse_compression_codec(const std::string& name, CompressionCodec* codec) {
+    if (name == "lz4") {
+        *codec = CompressionCodec::LZ4;
+    } else if (name == "zstd") {
+        *codec = CompressionCodec::ZSTD;
+    } else if (name == "none") {
+        *codec = CompressionCodec::NONE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* compression_codec_name(CompressionCodec codec) {
+    switch (codec) {
+        case CompressionCodec::LZ4:
+            return "lz4";
+        case CompressionCodec::ZSTD:
+            return "zstd";
+        case CompressionCodec::NONE:
+            break;
+    }
+    return "none";
+}
+
+bool is_compressed_frame(const char* data, size_t size) {
+    return size >= kFrameHeaderBytes + kFrameFooterBytes &&
+           std::memcmp(data, kFrameMagic, sizeof(kFrameMagic)) == 0;
+}
+
+std::string compress_blocks(const char* data, size_t size, const BlockCompressionOptions& options) {
+    const size_t block_size = std::max<size_t>(1, options.block_size);
+    std::string frame;
+    frame.reserve(kFrameHeaderBytes + size / 2);
+    frame.append(kFrameMagic, sizeof(kFrameMagic));
+    append_pod(&frame, static_cast<uint8_t>(options.codec));
+    frame.append(3, '\0');
+    append_pod(&frame, static_cast<uint32_t>(block_size));
+    append_pod(&frame, static_cast<uint64_t>(size));
+
+    std::vector<uint64_t> offsets;
+    offsets.reserve((size + block_size - 1) / block_size);
+    for (size_t begin = 0; begin < size; begin += block_size) {
+        const size_t raw = std::min(block_size, size - begin);
+        const size_t header = frame.size();
+        offsets.push_back(header);
+        frame.append(kBlockHeaderBytes, '\0');
+        CompressionCodec codec = options.codec;
+        if (codec == CompressionCodec::NONE || !compress_block(data + begin, raw, options, &frame)) {
+            codec = CompressionCodec::NONE;
+            frame.append(data + begin, raw);
+        }
+        const size_t stored = frame.size() - header - kBlockHeaderBytes;
+        const uint32_t fields[2] = {static_cast<uint32_t>(raw), static_cast<uint32_t>(stored)};
+        std::memcpy(&frame[header], fields, sizeof(fields));
+        frame[header + 8] = static_cast<char>(codec);
+        const uint32_t sum = checksum(frame.data() + header + kBlockHeaderBytes, stored);
+        std::memcpy(&frame[header + 12], &sum, sizeof(sum));
+    }
+    for (uint64_t offset: offsets) {
+        append_pod(&frame, offset);
+    }
+    append_pod(&frame, static_cast<uint32_t>(offsets.size()));
+    frame.append(kFrameEndMagic, sizeof(kFrameEndMagic));
+    return frame;
+}
+
+bool decompress_blocks(const char* frame, size_t size, std::string* out) {
+    BlockReader reader;
+    if (!reader.open(frame, size)) {
+        return false;
+    }
+    out->clear();
+    out->reserve(reader.raw_size());
+    for (size_t i = 0; i < reader.block_count(); ++i) {
+        if (!reader.read_block(i, out)) {
+            return false;
+        }
+    }
+    return out->size() == reader.raw_size();
+}
+
+bool BlockReader::open(const char* frame, size_t size) {
+    offsets_.clear();
+    if (!is_compressed_frame(frame, size) ||
+        std::memcmp(frame + size - sizeof(kFrameEndMagic), kFrameEndMagic, sizeof(kFrameEndMagic)) != 0) {
+        return false;
+    }
+    block_size_ = read_pod<uint32_t>(frame + 12);
+    raw_size_ = read_pod<uint64_t>(frame + 16);
+    const size_t footer = size - sizeof(kFrameEndMagic) - 4;
+    const uint32_t count = read_pod<uint32_t>(frame + footer);
+    if (block_size_ == 0 || static_cast<uint64_t>(count) * 8 > footer - kFrameHeaderBytes ||
+        count != (raw_size_ + block_size_ - 1) / block_size_) {
+        return false;
+    }
+    const char* table = frame + footer - static_cast<size_t>(count) * 8;
+    offsets_.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        offsets_[i] = read_pod<uint64_t>(table + i * 8);
+        if (offsets_[i] + kBlockHeaderBytes > static_cast<uint64_t>(table - frame)) {
+            offsets_.clear();
+            return false;
+        }
+    }
+    frame_ = frame;
+    size_ = size;
+    return true;
+}
+
+bool BlockReader::read_block(size_t i, std::string* out) const {
+    if (i >= offsets_.size()) {
+        return false;
+    }
+    const char* header = frame_ + offsets_[i];
+    const uint32_t raw = read_pod<uint32_t>(header);
+    const uint32_t stored = read_pod<uint32_t>(header + 4);
+    const auto codec = static_cast<CompressionCodec>(static_cast<uint8_t>(header[8]));
+    const char* payload = header + kBlockHeaderBytes;
+    if (raw > block_size_ || payload + stored > frame_ + size_ || checksum(payload, stored) != read_pod<uint32_t>(header + 12)) {
+        return false;
+    }
+    const size_t start = out->size();
+    out->resize(start + raw);
+    if (!decompress_block(codec, payload, stored, out->data() + start, raw)) {
+        out->resize(start);
+        return false;
+    }
+    return true;
+}
+
+bool BlockReader::read_range(uint64_t offset, size_t length, std::string* out) const {
+    out->clear();
+    if (offset + length > raw_size_) {
+        return false;
+    }
+    if (length == 0) {
+        return true;
+    }
+    const size_t first = static_cast<size_t>(offset / block_size_);
+    const size_t last = static_cast<size_t>((offset + length - 1) / block_size_);
+    std::string blocks;
+    for (size_t i = first; i <= last; ++i) {
+        if (!read_block(i, &blocks)) {
+            return false;
+        }
+    }
+    out->assign(blocks, static_cast<size_t>(offset - static_cast<uint64_t>(first) * block_size_), length);
+    return true;
+}
+
+} // namespace dann
@@ -4,13 +4,97 @@
 #include <filesystem>
 #include <algorithm>
 #include <cstring>
-#include <openssl/md5.h>
+#include <unordered_set>
+#include <fcntl.h>
+#include <unistd.h>
+#include "dann/logger.h"
 
 namespace dann {
 
+namespace {
+constexpr uint32_t kTombstone = 0xFFFFFFFFu;
+constexpr size_t kRecordHeaderBytes = 12; // checksum, key_len, value_len
+constexpr char kIndexMagic[8] = {'D', 'A', 'N', 'N', 'L', 'I', 'D', 'X'};
+constexpr const char* kSegmentPrefix = "segment.";
+
+uint32_t fnv1a(const char* data, size_t size, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// covers everything in a record after the checksum
+uint32_t record_checksum(const char* lengths, const char* key, size_t key_len, const char* value, size_t value_len) {
+    return fnv1a(value, value_len, fnv1a(key, key_len, fnv1a(lengths, 8)));
+}
+
+uint64_t record_bytes(size_t key_len, size_t value_len) {
+    return kRecordHeaderBytes + key_len + value_len;
+}
+
+// fills the header of the record starting at data[pos]; false for a torn or corrupt one
+bool parse_record(const std::string& data, uint64_t pos, uint32_t* key_len, uint32_t* value_len) {
+    if (pos + kRecordHeaderBytes > data.size()) {
+        return false;
+    }
+    uint32_t header[3];
+    std::memcpy(header, data.data() + pos, sizeof(header));
+    const uint64_t stored = header[2] == kTombstone ? 0 : header[2];
+    if (pos + record_bytes(header[1], stored) > data.size()) {
+        return false;
+    }
+    const char* key = data.data() + pos + kRecordHeaderBytes;
+    if (record_checksum(data.data() + pos + 4, key, header[1], key + header[1], stored) != header[0]) {
+        return false;
+    }
+    *key_len = header[1];
+    *value_len = header[2];
+    return true;
+}
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool pread_all(int fd, char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        const ssize_t n = ::pread(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+}
+
+LocalStorage::Segment::~Segment() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
 LocalStorage::LocalStorage(const std::string& data_dir)
     : data_dir_(data_dir), cache_size_(1000), compression_enabled_(false),
-      encryption_enabled_(false) {
+      encryption_enabled_(false), segment_size_(64 << 20), sync_bytes_(1 << 20),
+      unsynced_bytes_(0), compaction_stop_(false) {
     
     stats_ = StorageStats{};
     stats_.total_keys = 0;
@@ -23,33 +107,45 @@ LocalStorage::LocalStorage(const std::string& data_dir)
     stats_.disk_writes = 0;
 }
 
+LocalStorage::LocalStorage(const Config::StorageConfig& config): LocalStorage(config.local_storage_path) {
+    cache_size_ = config.local_cache_size;
+    CompressionCodec codec = CompressionCodec::LZ4;
+    if (!parse_compression_codec(config.compression_codec, &codec)) {
+        LOG_WARNF("unknown compression codec '%s', using lz4", config.compression_codec.c_str());
+    }
+    set_compression_codec(codec, config.compression_level);
+    set_compression_enabled(config.compression_enabled);
+    set_encryption_enabled(config.encryption_enabled, config.encryption_key);
+}
+
 LocalStorage::~LocalStorage() {
+    stop_compaction();
     cleanup();
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    close_log();
 }
 
 bool LocalStorage::initialize() {
     try {
         // Create data directory if it doesn't exist
-        if (!create_directory(data_dir_)) {
+        create_directory(data_dir_);
+        if (!std::filesystem::is_directory(data_dir_)) {
             return false;
         }
         
         // Create subdirectories
-        create_directory(data_dir_ + "/vectors");
+        create_directory(log_dir());
         create_directory(data_dir_ + "/indices");
-        create_directory(data_dir_ + "/metadata");
-        
-        // Load existing data from disk
-        load_from_disk();
         
-        return true;
+        // Rebuild the key index from the log
+        return load_from_disk();
     } catch (const std::exception& e) {
         return false;
     }
 }
 
 bool LocalStorage::cleanup() {
-    // Flush cache to disk
+    // Sync the log and snapshot its index
     flush_to_disk();
     
     // Clear memory
@@ -63,6 +159,10 @@ bool LocalStorage::cleanup() {
 }
 
 bool LocalStorage::set(const std::string& key, const std::string& value) {
+    return write_value(key, value, nullptr);
+}
+
+bool LocalStorage::write_value(const std::string& key, const std::string& value, const std::vector<float>* vector) {
     if (!validate_key(key)) {
         return false;
     }
@@ -79,71 +179,81 @@ bool LocalStorage::set(const std::string& key, const std::string& value) {
         processed_value = encrypt_data(processed_value);
     }
     
-    // Add to cache
-    {
-        std::lock_guard<std::mutex> lock(storage_mutex_);
-        add_to_cache(key, processed_value);
+    // Append to the log; both caches are updated under the same lock, so of two
+    // writers of one key the later one's value is what stays cached
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    if (!append_record(key, &processed_value)) {
+        return false;
+    }
+    add_to_cache(key, value);
+    if (vector) {
+        vector_cache_[key] = *vector;
+    } else {
+        vector_cache_.erase(key);
     }
-    
-    update_stats(true, false); // Cache hit, no disk operation
     
     return true;
 }
 
 std::string LocalStorage::get(const std::string& key) {
+    std::string value;
+    RecordLocation location{};
+    read_current(key, &value, &location);
+    return value;
+}
+
+bool LocalStorage::read_current(const std::string& key, std::string* value, RecordLocation* location) {
     if (!validate_key(key)) {
-        return "";
+        return false;
     }
     
-    // Check cache first
+    // Check cache first, then find the record in the log
+    std::shared_ptr<Segment> segment;
     {
         std::lock_guard<std::mutex> lock(storage_mutex_);
+        auto entry = index_.find(key);
+        if (entry == index_.end()) {
+            update_stats(false, false);
+            return false;
+        }
+        *location = entry->second;
         auto it = memory_cache_.find(key);
         if (it != memory_cache_.end()) {
             update_stats(true, false); // Cache hit
-            std::string value = it->second;
-            
-            // Apply decryption if enabled
-            if (encryption_enabled_) {
-                value = decrypt_data(value);
-            }
-            
-            // Apply decompression if enabled
-            if (compression_enabled_) {
-                value = decompress_data(value);
-            }
-            
-            return value;
+            *value = it->second;
+            return true;
         }
+        segment = segments_.at(location->segment);
     }
     
     update_stats(false, true); // Cache miss, disk read
     
-    // Read from disk
-    std::string file_path = get_file_path(key);
-    std::string value = read_file(file_path);
-    
-    if (value.empty()) {
-        return "";
+    if (!read_value(*segment, *location, value)) {
+        return false;
     }
     
     // Apply decryption if enabled
     if (encryption_enabled_) {
-        value = decrypt_data(value);
+        *value = decrypt_data(*value);
     }
     
-    // Apply decompression if enabled
-    if (compression_enabled_) {
-        value = decompress_data(value);
-    }
+    // Apply decompression (a no-op for values stored uncompressed)
+    *value = decompress_data(*value);
     
-    // Add to cache
+    // Cache it unless a write, delete or compaction got to the key since the read
     {
         std::lock_guard<std::mutex> lock(storage_mutex_);
-        add_to_cache(key, value);
+        if (is_current(key, *location)) {
+            add_to_cache(key, *value);
+        }
     }
     
-    return value;
+    return true;
+}
+
+bool LocalStorage::is_current(const std::string& key, const RecordLocation& location) const {
+    auto it = index_.find(key);
+    return it != index_.end() && it->second.segment == location.segment && it->second.offset == location.offset;
 }
 
 bool LocalStorage::del(const std::string& key) {
@@ -151,20 +261,16 @@ bool LocalStorage::del(const std::string& key) {
         return false;
     }
     
-    // Remove from cache
-    {
-        std::lock_guard<std::mutex> lock(storage_mutex_);
-        memory_cache_.erase(key);
-        vector_cache_.erase(key);
-    }
-    
-    // Delete from disk
-    std::string file_path = get_file_path(key);
-    bool deleted = delete_file(file_path);
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    memory_cache_.erase(key);
+    vector_cache_.erase(key);
     
-    update_stats(false, false); // No cache hit, disk write
+    if (index_.find(key) == index_.end()) {
+        return false;
+    }
     
-    return deleted;
+    // A tombstone record shadows the older value until compaction drops both
+    return append_record(key, nullptr);
 }
 
 bool LocalStorage::exists(const std::string& key) {
@@ -172,18 +278,8 @@ bool LocalStorage::exists(const std::string& key) {
         return false;
     }
     
-    // Check cache first
-    {
-        std::lock_guard<std::mutex> lock(storage_mutex_);
-        if (memory_cache_.find(key) != memory_cache_.end()) {
-            return true;
-        }
-    }
-    
-    // Check disk
-    std::string file_path = get_file_path(key);
-    std::ifstream file(file_path);
-    return file.good();
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    return memory_cache_.find(key) != memory_cache_.end() || index_.find(key) != index_.end();
 }
 
 bool LocalStorage::set_vector(const std::string& key, const std::vector<float>& vector) {
@@ -194,14 +290,10 @@ bool LocalStorage::set_vector(const std::string& key, const std::vector<float>&
     // Serialize vector
     std::string serialized = serialize_vector(vector);
     
-    // Store as regular key-value
-    bool success = set(key, serialized);
+    // Store as regular key-value, caching the vector along with it
+    bool success = write_value(key, serialized, &vector);
     
     if (success) {
-        // Also store in vector cache for fast access
-        std::lock_guard<std::mutex> lock(storage_mutex_);
-        vector_cache_[key] = vector;
-        
         // Update stats
         std::lock_guard<std::mutex> stats_lock(stats_mutex_);
         stats_.total_vectors++;
@@ -226,8 +318,9 @@ std::vector<float> LocalStorage::get_vector(const std::string& key) {
     }
     
     // Get serialized data
-    std::string serialized = get(key);
-    if (serialized.empty()) {
+    std::string serialized;
+    RecordLocation location{};
+    if (!read_current(key, &serialized, &location) || serialized.empty()) {
         return {};
     }
     
@@ -235,9 +328,11 @@ std::vector<float> LocalStorage::get_vector(const std::string& key) {
     std::vector<float> vector = deserialize_vector(serialized);
     
     if (!vector.empty()) {
-        // Add to vector cache
+        // Add to vector cache unless the key changed since it was read
         std::lock_guard<std::mutex> lock(storage_mutex_);
-        vector_cache_[key] = vector;
+        if (is_current(key, location)) {
+            vector_cache_[key] = vector;
+        }
     }
     
     return vector;
@@ -274,11 +369,46 @@ bool LocalStorage::set_batch(const std::vector<std::pair<std::string, std::strin
 }
 
 std::vector<std::string> LocalStorage::get_batch(const std::vector<std::string>& keys) {
-    std::vector<std::string> values;
-    values.reserve(keys.size());
+    std::vector<std::string> values(keys.size());
+    
+    // Serve what the cache has and collect the log locations of the rest
+    struct PendingRead {
+        size_t slot;
+        std::shared_ptr<Segment> segment;
+        RecordLocation location;
+    };
+    std::vector<PendingRead> reads;
+    {
+        std::lock_guard<std::mutex> lock(storage_mutex_);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto it = memory_cache_.find(keys[i]);
+            if (it != memory_cache_.end()) {
+                values[i] = it->second;
+                update_stats(true, false);
+                continue;
+            }
+            auto entry = index_.find(keys[i]);
+            if (entry != index_.end()) {
+                reads.push_back({i, segments_.at(entry->second.segment), entry->second});
+            }
+        }
+    }
     
-    for (const auto& key : keys) {
-        values.push_back(get(key));
+    // One pass over the log in file order
+    std::sort(reads.begin(), reads.end(), [](const PendingRead& a, const PendingRead& b) {
+        return a.location.segment != b.location.segment ? a.location.segment < b.location.segment
+                                                        : a.location.offset < b.location.offset;
+    });
+    for (const auto& read : reads) {
+        update_stats(false, true);
+        std::string value;
+        if (!read_value(*read.segment, read.location, &value)) {
+            continue;
+        }
+        if (encryption_enabled_) {
+            value = decrypt_data(value);
+        }
+        values[read.slot] = decompress_data(value);
     }
     
     return values;
@@ -292,7 +422,13 @@ bool LocalStorage::save_index(const std::string& index_name, const std::vector<u
         return false;
     }
     
-    file.write(reinterpret_cast<const char*>(index_data.data()), index_data.size());
+    if (compression_enabled_) {
+        std::string frame = compress_blocks(reinterpret_cast<const char*>(index_data.data()), index_data.size(),
+                                            compression_options_);
+        file.write(frame.data(), frame.size());
+    } else {
+        file.write(reinterpret_cast<const char*>(index_data.data()), index_data.size());
+    }
     
     update_stats(false, false); // No cache hit, disk write
     
@@ -317,7 +453,21 @@ std::vector<uint8_t> LocalStorage::load_index(const std::string& index_name) {
     
     update_stats(false, true); // No cache hit, disk read
     
-    return file.good() ? index_data : std::vector<uint8_t>{};
+    if (!file.good()) {
+        return {};
+    }
+    
+    // Indices saved before compression was enabled have no frame header
+    const char* raw = reinterpret_cast<const char*>(index_data.data());
+    if (is_compressed_frame(raw, index_data.size())) {
+        std::string decompressed;
+        if (!decompress_blocks(raw, index_data.size(), &decompressed)) {
+            return {};
+        }
+        return std::vector<uint8_t>(decompressed.begin(), decompressed.end());
+    }
+    
+    return index_data;
 }
 
 bool LocalStorage::delete_index(const std::string& index_name) {
@@ -355,31 +505,40 @@ std::string LocalStorage::get_metadata(const std::string& key) {
 bool LocalStorage::flush_to_disk() {
     std::lock_guard<std::mutex> lock(storage_mutex_);
     
-    bool all_success = true;
+    if (!active_segment_) {
+        return true;
+    }
     
-    // Write all cached data to disk
-    for (const auto& kv : memory_cache_) {
-        std::string file_path = get_file_path(kv.first);
-        if (!write_file(file_path, kv.second)) {
-            all_success = false;
-        }
+    // Everything appended so far becomes durable, then the index snapshot
+    // lets the next start replay only what comes after it
+    if (::fdatasync(active_segment_->fd) != 0) {
+        return false;
     }
+    unsynced_bytes_ = 0;
     
-    return all_success;
+    return write_index_snapshot();
 }
 
 bool LocalStorage::load_from_disk() {
-    // Load all files from data directory into cache
-    // This is a simplified implementation
-    return true;
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    close_log();
+    memory_cache_.clear();
+    vector_cache_.clear();
+    return open_log();
 }
 
 bool LocalStorage::backup(const std::string& backup_path) {
     try {
+        // Make the log and its index snapshot consistent on disk
+        if (!flush_to_disk()) {
+            return false;
+        }
+        
         // Create backup directory
         create_directory(backup_path);
         
-        // Copy all files
+        // Copy all files; appends stay blocked so no segment grows mid-copy
+        std::lock_guard<std::mutex> lock(storage_mutex_);
         std::filesystem::copy(data_dir_, backup_path, 
                              std::filesystem::copy_options::recursive);
         
@@ -393,10 +552,16 @@ bool LocalStorage::restore(const std::string& backup_path) {
     try {
         // Clear current data
         cleanup();
+        {
+            std::lock_guard<std::mutex> lock(storage_mutex_);
+            close_log();
+            std::filesystem::remove_all(log_dir());
+        }
         
         // Copy backup files
         std::filesystem::copy(backup_path, data_dir_,
-                             std::filesystem::copy_options::recursive);
+                             std::filesystem::copy_options::recursive |
+                             std::filesystem::copy_options::overwrite_existing);
         
         // Reload data
         return load_from_disk();
@@ -412,10 +577,25 @@ void LocalStorage::set_cache_size(size_t cache_size) {
     evict_from_cache();
 }
 
+void LocalStorage::set_segment_size(size_t bytes) {
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    segment_size_ = std::max<size_t>(4096, bytes);
+}
+
+void LocalStorage::set_sync_bytes(size_t bytes) {
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    sync_bytes_ = bytes;
+}
+
 void LocalStorage::set_compression_enabled(bool enabled) {
     compression_enabled_ = enabled;
 }
 
+void LocalStorage::set_compression_codec(CompressionCodec codec, int level) {
+    compression_options_.codec = codec;
+    compression_options_.level = level;
+}
+
 void LocalStorage::set_encryption_enabled(bool enabled, const std::string& key) {
     encryption_enabled_ = enabled;
     if (!key.empty()) {
@@ -424,8 +604,21 @@ void LocalStorage::set_encryption_enabled(bool enabled, const std::string& key)
 }
 
 LocalStorage::StorageStats LocalStorage::get_stats() const {
+    uint64_t total_keys = 0;
+    uint64_t total_size_bytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(storage_mutex_);
+        total_keys = index_.size();
+        for (const auto& [id, segment] : segments_) {
+            total_size_bytes += segment->size;
+        }
+    }
+    
     std::lock_guard<std::mutex> lock(stats_mutex_);
-    return stats_;
+    StorageStats stats = stats_;
+    stats.total_keys = total_keys;
+    stats.total_size_bytes = total_size_bytes;
+    return stats;
 }
 
 void LocalStorage::reset_stats() {
@@ -442,12 +635,209 @@ void LocalStorage::reset_stats() {
 }
 
 bool LocalStorage::compact() {
-    // Remove expired entries and optimize storage
-    return flush_to_disk();
+    std::lock_guard<std::mutex> compaction_lock(compaction_mutex_);
+    
+    // Seal the active segment if it holds garbage so that it is merged too,
+    // and drop the index snapshot: the offsets it records are about to move
+    std::vector<std::shared_ptr<Segment>> sealed;
+    {
+        std::lock_guard<std::mutex> lock(storage_mutex_);
+        if (!active_segment_) {
+            return false;
+        }
+        if (active_segment_->live_bytes < active_segment_->size && !roll_segment()) {
+            return false;
+        }
+        for (const auto& [id, segment] : segments_) {
+            if (id != active_segment_->id) {
+                sealed.push_back(segment);
+            }
+        }
+        std::error_code ec;
+        std::filesystem::remove(log_dir() + "/index", ec);
+    }
+    if (sealed.empty()) {
+        return true;
+    }
+    
+    // The live records are copied into a file that takes the newest sealed
+    // segment's id, so replay order is unchanged. A crash after the rename but
+    // before the older segments are unlinked replays their dead values ahead of
+    // the output, so a delete still in effect keeps its tombstone whenever an
+    // older value of the key was merged; the next compaction drops it once no
+    // such value is left
+    const uint32_t output_id = sealed.back()->id;
+    const std::string tmp_path = segment_path(output_id) + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        LOG_ERRORF("compaction cannot create %s", tmp_path.c_str());
+        return false;
+    }
+    
+    struct MovedRecord {
+        std::string key;
+        RecordLocation from;
+        uint64_t offset;
+    };
+    std::vector<MovedRecord> moved;
+    // keys with a value record among the inputs that is no longer current
+    std::unordered_set<std::string> dead_values;
+    std::string buffer;
+    uint64_t written = 0;
+    bool ok = true;
+    for (const auto& segment : sealed) {
+        std::string data;
+        if (!read_segment(*segment, segment->size, &data)) {
+            ok = false;
+            break;
+        }
+        uint64_t pos = 0;
+        uint32_t key_len = 0;
+        uint32_t value_len = 0;
+        while (parse_record(data, pos, &key_len, &value_len)) {
+            const uint64_t bytes = record_bytes(key_len, value_len == kTombstone ? 0 : value_len);
+            std::string key(data, pos + kRecordHeaderBytes, key_len);
+            if (value_len != kTombstone) {
+                const uint64_t value_offset = pos + kRecordHeaderBytes + key_len;
+                bool live;
+                {
+                    std::lock_guard<std::mutex> lock(storage_mutex_);
+                    live = is_current(key, {segment->id, value_offset, value_len});
+                }
+                if (live) {
+                    moved.push_back({std::move(key), {segment->id, value_offset, value_len},
+                                     written + buffer.size() + kRecordHeaderBytes + key_len});
+                    buffer.append(data, pos, bytes);
+                } else {
+                    dead_values.insert(std::move(key));
+                }
+            } else if (dead_values.count(key) > 0) {
+                bool deleted;
+                {
+                    std::lock_guard<std::mutex> lock(storage_mutex_);
+                    deleted = index_.find(key) == index_.end();
+                }
+                if (deleted) {
+                    buffer.append(data, pos, bytes);
+                }
+            }
+            pos += bytes;
+            if (buffer.size() >= (4u << 20)) {
+                ok = ok && write_all(fd, buffer.data(), buffer.size());
+                written += buffer.size();
+                buffer.clear();
+            }
+        }
+    }
+    ok = ok && write_all(fd, buffer.data(), buffer.size()) && ::fdatasync(fd) == 0;
+    ::close(fd);
+    if (!ok) {
+        std::error_code ec;
+        std::filesystem::remove(tmp_path, ec);
+        LOG_ERROR("compaction failed to rewrite the sealed segments");
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    if (::rename(tmp_path.c_str(), segment_path(output_id).c_str()) != 0) {
+        std::error_code ec;
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    auto output = open_segment(output_id, false);
+    if (!output) {
+        return false;
+    }
+    // Records overwritten or deleted during the copy are garbage in the output
+    for (const auto& record : moved) {
+        auto it = index_.find(record.key);
+        if (it != index_.end() && it->second.segment == record.from.segment &&
+            it->second.offset == record.from.offset) {
+            it->second = {output_id, record.offset, record.from.length};
+            output->live_bytes += record_bytes(record.key.size(), record.from.length);
+        }
+    }
+    for (const auto& segment : sealed) {
+        if (segment->id != output_id) {
+            ::unlink(segment_path(segment->id).c_str());
+            segments_.erase(segment->id);
+        }
+    }
+    segments_[output_id] = output;
+    
+    return write_index_snapshot();
+}
+
+double LocalStorage::garbage_ratio() const {
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    uint64_t size = 0;
+    uint64_t live = 0;
+    for (const auto& [id, segment] : segments_) {
+        if (segment != active_segment_) {
+            size += segment->size;
+            live += segment->live_bytes;
+        }
+    }
+    return size == 0 ? 0.0 : static_cast<double>(size - live) / static_cast<double>(size);
+}
+
+void LocalStorage::start_compaction(double min_garbage_ratio, std::chrono::milliseconds interval) {
+    stop_compaction();
+    compaction_stop_ = false;
+    compaction_thread_ = std::thread([this, min_garbage_ratio, interval] {
+        std::unique_lock<std::mutex> lock(compaction_thread_mutex_);
+        while (!compaction_stop_) {
+            compaction_cv_.wait_for(lock, interval, [this] { return compaction_stop_; });
+            if (compaction_stop_) {
+                break;
+            }
+            lock.unlock();
+            if (garbage_ratio() >= min_garbage_ratio) {
+                compact();
+            }
+            lock.lock();
+        }
+    });
+}
+
+void LocalStorage::stop_compaction() {
+    if (!compaction_thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(compaction_thread_mutex_);
+        compaction_stop_ = true;
+    }
+    compaction_cv_.notify_one();
+    compaction_thread_.join();
 }
 
 bool LocalStorage::verify_integrity() {
-    // Check data integrity
+    // Every record of every segment must pass its checksum
+    std::vector<std::pair<std::shared_ptr<Segment>, uint64_t>> segments;
+    {
+        std::lock_guard<std::mutex> lock(storage_mutex_);
+        for (const auto& [id, segment] : segments_) {
+            segments.emplace_back(segment, segment->size);
+        }
+    }
+    
+    for (const auto& [segment, size] : segments) {
+        std::string data;
+        if (!read_segment(*segment, size, &data)) {
+            return false;
+        }
+        uint64_t pos = 0;
+        uint32_t key_len = 0;
+        uint32_t value_len = 0;
+        while (pos < data.size() && parse_record(data, pos, &key_len, &value_len)) {
+            pos += record_bytes(key_len, value_len == kTombstone ? 0 : value_len);
+        }
+        if (pos != data.size()) {
+            LOG_ERRORF("segment %u is corrupt at offset %lu", segment->id, pos);
+            return false;
+        }
+    }
     return true;
 }
 
@@ -456,12 +846,6 @@ bool LocalStorage::cleanup_expired() {
     return true;
 }
 
-std::string LocalStorage::get_file_path(const std::string& key) {
-    std::string hash = generate_hash(key);
-    std::string sub_dir = hash.substr(0, 2);
-    return data_dir_ + "/vectors/" + sub_dir + "/" + hash + ".dat";
-}
-
 bool LocalStorage::write_file(const std::string& path, const std::string& data) {
     try {
         // Create subdirectory if needed
@@ -553,8 +937,7 @@ bool LocalStorage::is_in_cache(const std::string& key) {
 }
 
 void LocalStorage::add_to_cache(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(storage_mutex_);
-    
+    // storage_mutex_ is held by the caller
     memory_cache_[key] = value;
     
     // Evict if cache is full
@@ -564,13 +947,19 @@ void LocalStorage::add_to_cache(const std::string& key, const std::string& value
 }
 
 std::string LocalStorage::compress_data(const std::string& data) {
-    // Simplified compression - in real implementation would use zlib or similar
-    return data;
+    return compress_blocks(data.data(), data.size(), compression_options_);
 }
 
 std::string LocalStorage::decompress_data(const std::string& compressed_data) {
-    // Simplified decompression
-    return compressed_data;
+    if (!is_compressed_frame(compressed_data.data(), compressed_data.size())) {
+        return compressed_data;
+    }
+    
+    std::string data;
+    if (!decompress_blocks(compressed_data.data(), compressed_data.size(), &data)) {
+        return "";
+    }
+    return data;
 }
 
 std::string LocalStorage::encrypt_data(const std::string& data) {
@@ -635,17 +1024,296 @@ void LocalStorage::update_stats(bool cache_hit, bool disk_operation) {
     }
 }
 
-std::string LocalStorage::generate_hash(const std::string& key) {
-    unsigned char hash[MD5_DIGEST_LENGTH];
-    MD5(reinterpret_cast<const unsigned char*>(key.c_str()), key.size(), hash);
+std::string LocalStorage::log_dir() const {
+    return data_dir_ + "/log";
+}
+
+std::string LocalStorage::segment_path(uint32_t id) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%s%08u", kSegmentPrefix, id);
+    return log_dir() + "/" + name;
+}
+
+std::shared_ptr<LocalStorage::Segment> LocalStorage::open_segment(uint32_t id, bool create) {
+    const std::string path = segment_path(id);
+    int fd = ::open(path.c_str(), create ? (O_CREAT | O_RDWR | O_APPEND) : (O_RDWR | O_APPEND), 0644);
+    if (fd < 0) {
+        LOG_ERRORF("cannot open log segment %s", path.c_str());
+        return nullptr;
+    }
+    auto segment = std::make_shared<Segment>();
+    segment->id = id;
+    segment->fd = fd;
+    const off_t size = ::lseek(fd, 0, SEEK_END);
+    segment->size = size > 0 ? static_cast<uint64_t>(size) : 0;
+    return segment;
+}
+
+bool LocalStorage::open_log() {
+    // Segments on disk, oldest first; leftovers of an interrupted compaction go
+    std::vector<uint32_t> ids;
+    for (const auto& entry : std::filesystem::directory_iterator(log_dir())) {
+        const std::string name = entry.path().filename().string();
+        if (name.rfind(kSegmentPrefix, 0) != 0) {
+            continue;
+        }
+        const std::string suffix = name.substr(std::strlen(kSegmentPrefix));
+        if (suffix.find_first_not_of("0123456789") != std::string::npos) {
+            std::filesystem::remove(entry.path());
+            continue;
+        }
+        ids.push_back(static_cast<uint32_t>(std::stoul(suffix)));
+    }
+    std::sort(ids.begin(), ids.end());
+    for (uint32_t id : ids) {
+        auto segment = open_segment(id, false);
+        if (!segment) {
+            close_log();
+            return false;
+        }
+        segments_[id] = segment;
+    }
+    
+    // Start from the snapshot when there is a usable one, else from the first record
+    uint32_t replay_from = 0;
+    uint64_t replay_offset = 0;
+    if (!load_index_snapshot(&replay_from, &replay_offset)) {
+        index_.clear();
+        for (auto& [id, segment] : segments_) {
+            segment->live_bytes = 0;
+        }
+        replay_from = 0;
+        replay_offset = 0;
+    }
+    
+    for (auto it = segments_.lower_bound(replay_from); it != segments_.end(); ++it) {
+        Segment& segment = *it->second;
+        std::string data;
+        if (!read_segment(segment, segment.size, &data)) {
+            close_log();
+            return false;
+        }
+        const uint64_t end = replay_segment(segment, data, it->first == replay_from ? replay_offset : 0);
+        if (end == data.size()) {
+            continue;
+        }
+        // A torn append at the tail of the newest segment is cut off; anywhere
+        // else the records after the damage cannot be trusted
+        if (std::next(it) != segments_.end()) {
+            LOG_ERRORF("log segment %u is corrupt at offset %lu", it->first, end);
+            close_log();
+            return false;
+        }
+        if (::ftruncate(segment.fd, static_cast<off_t>(end)) != 0) {
+            close_log();
+            return false;
+        }
+        segment.size = end;
+    }
+    
+    if (segments_.empty()) {
+        auto segment = open_segment(1, true);
+        if (!segment) {
+            return false;
+        }
+        segments_[1] = segment;
+    }
+    active_segment_ = segments_.rbegin()->second;
+    if (active_segment_->size >= segment_size_) {
+        return roll_segment();
+    }
+    return true;
+}
+
+void LocalStorage::close_log() {
+    active_segment_.reset();
+    segments_.clear();
+    index_.clear();
+    unsynced_bytes_ = 0;
+}
+
+bool LocalStorage::roll_segment() {
+    if (::fdatasync(active_segment_->fd) != 0) {
+        return false;
+    }
+    unsynced_bytes_ = 0;
+    const uint32_t id = active_segment_->id + 1;
+    auto segment = open_segment(id, true);
+    if (!segment) {
+        return false;
+    }
+    segments_[id] = segment;
+    active_segment_ = segment;
+    return true;
+}
+
+bool LocalStorage::append_record(const std::string& key, const std::string* value) {
+    if (!active_segment_) {
+        return false;
+    }
+    if (active_segment_->size >= segment_size_ && !roll_segment()) {
+        return false;
+    }
+    
+    const size_t value_len = value ? value->size() : 0;
+    std::string record;
+    record.reserve(record_bytes(key.size(), value_len));
+    const uint32_t lengths[2] = {static_cast<uint32_t>(key.size()), value ? static_cast<uint32_t>(value_len) : kTombstone};
+    const uint32_t checksum = record_checksum(reinterpret_cast<const char*>(lengths), key.data(), key.size(),
+                                              value ? value->data() : nullptr, value_len);
+    record.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+    record.append(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+    record.append(key);
+    if (value) {
+        record.append(*value);
+    }
+    
+    if (!write_all(active_segment_->fd, record.data(), record.size())) {
+        // Cut off whatever part of the record made it out
+        if (::ftruncate(active_segment_->fd, static_cast<off_t>(active_segment_->size)) != 0) {
+            LOG_ERRORF("log segment %u has a torn record at offset %lu", active_segment_->id, active_segment_->size);
+        }
+        return false;
+    }
+    
+    Segment& segment = *active_segment_;
+    const RecordLocation location{segment.id, segment.size + kRecordHeaderBytes + key.size(),
+                                  static_cast<uint32_t>(value_len)};
+    segment.size += record.size();
+    apply_record(key, value ? &location : nullptr, record.size());
+    
+    // Group commit: one fsync covers every append since the last one
+    unsynced_bytes_ += record.size();
+    if (unsynced_bytes_ >= sync_bytes_) {
+        ::fdatasync(segment.fd);
+        unsynced_bytes_ = 0;
+    }
+    
+    std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+    stats_.disk_writes++;
+    return true;
+}
+
+void LocalStorage::apply_record(const std::string& key, const RecordLocation* location, uint64_t bytes) {
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        auto segment = segments_.find(it->second.segment);
+        if (segment != segments_.end()) {
+            segment->second->live_bytes -= record_bytes(key.size(), it->second.length);
+        }
+        if (!location) {
+            index_.erase(it);
+        }
+    }
+    if (location) {
+        index_[key] = *location;
+        segments_.at(location->segment)->live_bytes += bytes;
+    }
+}
+
+uint64_t LocalStorage::replay_segment(Segment& segment, const std::string& data, uint64_t offset) {
+    uint32_t key_len = 0;
+    uint32_t value_len = 0;
+    while (offset < data.size() && parse_record(data, offset, &key_len, &value_len)) {
+        const bool tombstone = value_len == kTombstone;
+        const uint64_t bytes = record_bytes(key_len, tombstone ? 0 : value_len);
+        const std::string key(data, offset + kRecordHeaderBytes, key_len);
+        const RecordLocation location{segment.id, offset + kRecordHeaderBytes + key_len, tombstone ? 0 : value_len};
+        apply_record(key, tombstone ? nullptr : &location, bytes);
+        offset += bytes;
+    }
+    return offset;
+}
+
+bool LocalStorage::write_index_snapshot() {
+    if (!active_segment_) {
+        return false;
+    }
+    
+    // magic | u32 replay segment | u64 replay offset | u64 entries |
+    // (u32 key_len | key | u32 segment | u64 offset | u32 length)... | u32 checksum
+    std::string snapshot(kIndexMagic, sizeof(kIndexMagic));
+    auto append = [&snapshot](const auto& value) {
+        snapshot.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    append(active_segment_->id);
+    append(active_segment_->size);
+    append(static_cast<uint64_t>(index_.size()));
+    for (const auto& [key, location] : index_) {
+        append(static_cast<uint32_t>(key.size()));
+        snapshot.append(key);
+        append(location.segment);
+        append(location.offset);
+        append(location.length);
+    }
+    append(fnv1a(snapshot.data(), snapshot.size()));
+    
+    const std::string path = log_dir() + "/index";
+    if (!write_file(path + ".tmp", snapshot)) {
+        return false;
+    }
+    return ::rename((path + ".tmp").c_str(), path.c_str()) == 0;
+}
+
+bool LocalStorage::load_index_snapshot(uint32_t* replay_from, uint64_t* replay_offset) {
+    const std::string snapshot = read_file(log_dir() + "/index");
+    const size_t fixed = sizeof(kIndexMagic) + 4 + 8 + 8;
+    if (snapshot.size() < fixed + 4 || std::memcmp(snapshot.data(), kIndexMagic, sizeof(kIndexMagic)) != 0) {
+        return false;
+    }
+    uint32_t checksum;
+    std::memcpy(&checksum, snapshot.data() + snapshot.size() - 4, 4);
+    if (fnv1a(snapshot.data(), snapshot.size() - 4) != checksum) {
+        return false;
+    }
     
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0');
-    for (int i = 0; i < MD5_DIGEST_LENGTH; ++i) {
-        ss << std::setw(2) << static_cast<int>(hash[i]);
+    size_t pos = sizeof(kIndexMagic);
+    auto read = [&snapshot, &pos](auto* value) {
+        if (pos + sizeof(*value) > snapshot.size() - 4) {
+            return false;
+        }
+        std::memcpy(value, snapshot.data() + pos, sizeof(*value));
+        pos += sizeof(*value);
+        return true;
+    };
+    uint64_t entries = 0;
+    read(replay_from);
+    read(replay_offset);
+    read(&entries);
+    auto replay_segment = segments_.find(*replay_from);
+    if (replay_segment == segments_.end() || replay_segment->second->size < *replay_offset) {
+        return false;
     }
     
-    return ss.str();
+    for (uint64_t i = 0; i < entries; ++i) {
+        uint32_t key_len = 0;
+        RecordLocation location{};
+        if (!read(&key_len) || pos + key_len > snapshot.size() - 4) {
+            return false;
+        }
+        std::string key(snapshot, pos, key_len);
+        pos += key_len;
+        if (!read(&location.segment) || !read(&location.offset) || !read(&location.length)) {
+            return false;
+        }
+        auto segment = segments_.find(location.segment);
+        if (segment == segments_.end() || location.offset + location.length > segment->second->size) {
+            return false;
+        }
+        segment->second->live_bytes += record_bytes(key.size(), location.length);
+        index_.emplace(std::move(key), location);
+    }
+    return true;
+}
+
+bool LocalStorage::read_segment(const Segment& segment, uint64_t size, std::string* data) {
+    data->resize(size);
+    return pread_all(segment.fd, data->data(), size, 0);
+}
+
+bool LocalStorage::read_value(const Segment& segment, const RecordLocation& location, std::string* value) {
+    value->resize(location.length);
+    return pread_all(segment.fd, value->data(), location.length, location.offset);
 }
 
 bool LocalStorage::validate_key(const std::string& key) {
@@ -664,3 +1332,4 @@ bool LocalStorage::validate_key(const std::string& key) {
 }
 
 } // namespace dann
+
@@ -1,17 +1,35 @@
 #include "dann/redis_client.h"
 #include <hiredis/hiredis.h>
+#include <algorithm>
 #include <chrono>
+#include <sstream>
 #include <thread>
 #include <cstring>
+#include <cerrno>
 
 namespace dann {
 
+namespace {
+// commands that leave the same state when the server runs them twice, so a
+// pipeline of nothing else may be resent after a failure part way through
+bool is_idempotent(const RedisClient::Command& command) {
+    static const char* const kIdempotent[] = {
+        "GET", "MGET", "EXISTS", "HGET", "HMGET", "HKEYS", "HVALS", "SMEMBERS", "SISMEMBER", "LRANGE",
+        "LLEN", "TTL", "PING", "INFO", "CLUSTER", "SET", "MSET", "DEL", "HSET", "HDEL", "SADD", "SREM",
+        "EXPIRE", "PERSIST"};
+    if (command.empty()) {
+        return false;
+    }
+    std::string name = command.front();
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    return std::any_of(std::begin(kIdempotent), std::end(kIdempotent),
+                       [&name](const char* idempotent) { return name == idempotent; });
+}
+}
+
 RedisClient::RedisClient(const std::string& host, int port, int db)
     : host_(host), port_(port), db_(db), connected_(false),
-      timeout_ms_(5000), max_retries_(3), pool_size_(10) {
-    
-    redis_context_ = nullptr;
-    redis_reply_ = nullptr;
+      timeout_ms_(5000), max_retries_(3), pool_size_(10), open_connections_(0) {
     
     metrics_ = RedisMetrics{};
     metrics_.commands_sent = 0;
@@ -33,16 +51,25 @@ bool RedisClient::connect() {
         return true;
     }
     
-    return create_connection();
+    // Open one connection up front so a bad address shows here
+    redisContext* context = acquire_connection();
+    if (!context) {
+        return false;
+    }
+    release_connection(context, false);
+    connected_ = true;
+    return true;
 }
 
 bool RedisClient::disconnect() {
-    if (!connected_.load()) {
-        return true;
-    }
-    
     connected_ = false;
-    close_connection();
+    
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    for (redisContext* context : idle_connections_) {
+        close_connection(context);
+    }
+    open_connections_ -= idle_connections_.size();
+    idle_connections_.clear();
     
     return true;
 }
@@ -52,23 +79,19 @@ bool RedisClient::is_connected() const {
 }
 
 bool RedisClient::set(const std::string& key, const std::string& value) {
-    std::string command = "SET " + key + " " + value;
-    return execute_command(command);
+    return execute_command({"SET", key, value});
 }
 
 std::string RedisClient::get(const std::string& key) {
-    std::string command = "GET " + key;
-    return execute_command_with_reply(command);
+    return execute_command_with_reply({"GET", key});
 }
 
 bool RedisClient::del(const std::string& key) {
-    std::string command = "DEL " + key;
-    return execute_command(command);
+    return execute_command({"DEL", key});
 }
 
 bool RedisClient::exists(const std::string& key) {
-    std::string command = "EXISTS " + key;
-    std::string reply = execute_command_with_reply(command);
+    std::string reply = execute_command_with_reply({"EXISTS", key});
     return reply == "1";
 }
 
@@ -91,112 +114,195 @@ bool RedisClient::del_vector(const std::string& key) {
 }
 
 bool RedisClient::mset(const std::vector<std::pair<std::string, std::string>>& key_values) {
-    std::string command = "MSET";
+    if (key_values.empty()) {
+        return true;
+    }
+    
+    Command command;
+    command.reserve(1 + 2 * key_values.size());
+    command.push_back("MSET");
     for (const auto& kv : key_values) {
-        command += " " + kv.first + " " + kv.second;
+        command.push_back(kv.first);
+        command.push_back(kv.second);
     }
     return execute_command(command);
 }
 
 std::vector<std::string> RedisClient::mget(const std::vector<std::string>& keys) {
-    std::string command = "MGET";
+    if (keys.empty()) {
+        return {};
+    }
+    
+    Command command;
+    command.reserve(1 + keys.size());
+    command.push_back("MGET");
+    command.insert(command.end(), keys.begin(), keys.end());
+    
+    Reply reply = execute(command);
+    if (!reply.ok || reply.elements.size() != keys.size()) {
+        return std::vector<std::string>(keys.size());
+    }
+    return std::move(reply.elements);
+}
+
+bool RedisClient::mset_vectors(const std::vector<std::pair<std::string, std::vector<float>>>& key_vectors) {
+    std::vector<std::pair<std::string, std::string>> key_values;
+    key_values.reserve(key_vectors.size());
+    for (const auto& kv : key_vectors) {
+        key_values.emplace_back(kv.first, serialize_vector(kv.second));
+    }
+    return mset(key_values);
+}
+
+std::vector<std::vector<float>> RedisClient::mget_vectors(const std::vector<std::string>& keys) {
+    std::vector<std::string> values = mget(keys);
+    std::vector<std::vector<float>> vectors(values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        vectors[i] = deserialize_vector(values[i]);
+    }
+    return vectors;
+}
+
+std::vector<std::vector<std::string>> RedisClient::hmget_batch(const std::vector<std::string>& keys,
+                                                               const std::vector<std::string>& fields) {
+    std::vector<Command> commands;
+    commands.reserve(keys.size());
     for (const auto& key : keys) {
-        command += " " + key;
+        Command command;
+        command.reserve(2 + fields.size());
+        command.push_back("HMGET");
+        command.push_back(key);
+        command.insert(command.end(), fields.begin(), fields.end());
+        commands.push_back(std::move(command));
     }
     
-    std::string reply = execute_command_with_reply(command);
-    // Parse array response - simplified
-    return {reply};
+    std::vector<Reply> replies = pipeline(commands);
+    std::vector<std::vector<std::string>> values(keys.size());
+    for (size_t i = 0; i < replies.size(); ++i) {
+        if (replies[i].ok && replies[i].elements.size() == fields.size()) {
+            values[i] = std::move(replies[i].elements);
+        } else {
+            values[i].resize(fields.size());
+        }
+    }
+    return values;
+}
+
+std::vector<RedisClient::Reply> RedisClient::pipeline(const std::vector<Command>& commands) {
+    std::vector<Reply> replies;
+    if (commands.empty()) {
+        return replies;
+    }
+    
+    size_t bytes_sent = 0;
+    for (const auto& command : commands) {
+        bytes_sent += command_bytes(command);
+    }
+    
+    // Once the commands may have reached the server a retry could run them twice,
+    // so it is only made when all of them are idempotent. Inside multi()/exec() a
+    // broken connection fails the transaction and acquire_connection gives no other
+    const bool idempotent = std::all_of(commands.begin(), commands.end(), is_idempotent);
+    auto start_time = std::chrono::high_resolution_clock::now();
+    bool success = false;
+    for (int attempt = 0; attempt <= max_retries_ && !success; ++attempt) {
+        redisContext* context = acquire_connection();
+        if (!context) {
+            break;
+        }
+        bool sent = false;
+        success = run_pipeline(context, commands, &replies, &sent);
+        release_connection(context, !success);
+        if (!success && sent && !idempotent) {
+            break;
+        }
+    }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto response_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+    
+    size_t bytes_received = 0;
+    for (const auto& reply : replies) {
+        bytes_received += reply.str.size();
+        for (const auto& element : reply.elements) {
+            bytes_received += element.size();
+        }
+    }
+    update_metrics(success, response_time.count(), bytes_sent, bytes_received);
+    
+    if (!success) {
+        replies.assign(commands.size(), Reply{});
+    }
+    return replies;
 }
 
 bool RedisClient::lpush(const std::string& key, const std::string& value) {
-    std::string command = "LPUSH " + key + " " + value;
-    return execute_command(command);
+    return execute_command({"LPUSH", key, value});
 }
 
 bool RedisClient::rpush(const std::string& key, const std::string& value) {
-    std::string command = "RPUSH " + key + " " + value;
-    return execute_command(command);
+    return execute_command({"RPUSH", key, value});
 }
 
 std::string RedisClient::lpop(const std::string& key) {
-    std::string command = "LPOP " + key;
-    return execute_command_with_reply(command);
+    return execute_command_with_reply({"LPOP", key});
 }
 
 std::string RedisClient::rpop(const std::string& key) {
-    std::string command = "RPOP " + key;
-    return execute_command_with_reply(command);
+    return execute_command_with_reply({"RPOP", key});
 }
 
 std::vector<std::string> RedisClient::lrange(const std::string& key, int start, int stop) {
-    std::string command = "LRANGE " + key + " " + std::to_string(start) + " " + std::to_string(stop);
-    std::string reply = execute_command_with_reply(command);
-    // Parse array response - simplified
-    return {reply};
+    return execute({"LRANGE", key, std::to_string(start), std::to_string(stop)}).elements;
 }
 
 size_t RedisClient::llen(const std::string& key) {
-    std::string command = "LLEN " + key;
-    std::string reply = execute_command_with_reply(command);
-    return std::stoull(reply);
+    Reply reply = execute({"LLEN", key});
+    return reply.ok ? static_cast<size_t>(reply.integer) : 0;
 }
 
 bool RedisClient::hset(const std::string& key, const std::string& field, const std::string& value) {
-    std::string command = "HSET " + key + " " + field + " " + value;
-    return execute_command(command);
+    return execute_command({"HSET", key, field, value});
 }
 
 std::string RedisClient::hget(const std::string& key, const std::string& field) {
-    std::string command = "HGET " + key + " " + field;
-    return execute_command_with_reply(command);
+    return execute_command_with_reply({"HGET", key, field});
+}
+
+std::vector<std::string> RedisClient::hmget(const std::string& key, const std::vector<std::string>& fields) {
+    return hmget_batch({key}, fields).front();
 }
 
 bool RedisClient::hdel(const std::string& key, const std::string& field) {
-    std::string command = "HDEL " + key + " " + field;
-    return execute_command(command);
+    return execute_command({"HDEL", key, field});
 }
 
 std::vector<std::string> RedisClient::hkeys(const std::string& key) {
-    std::string command = "HKEYS " + key;
-    std::string reply = execute_command_with_reply(command);
-    // Parse array response - simplified
-    return {reply};
+    return execute({"HKEYS", key}).elements;
 }
 
 std::vector<std::string> RedisClient::hvals(const std::string& key) {
-    std::string command = "HVALS " + key;
-    std::string reply = execute_command_with_reply(command);
-    // Parse array response - simplified
-    return {reply};
+    return execute({"HVALS", key}).elements;
 }
 
 bool RedisClient::sadd(const std::string& key, const std::string& member) {
-    std::string command = "SADD " + key + " " + member;
-    return execute_command(command);
+    return execute_command({"SADD", key, member});
 }
 
 bool RedisClient::srem(const std::string& key, const std::string& member) {
-    std::string command = "SREM " + key + " " + member;
-    return execute_command(command);
+    return execute_command({"SREM", key, member});
 }
 
 std::vector<std::string> RedisClient::smembers(const std::string& key) {
-    std::string command = "SMEMBERS " + key;
-    std::string reply = execute_command_with_reply(command);
-    // Parse array response - simplified
-    return {reply};
+    return execute({"SMEMBERS", key}).elements;
 }
 
 bool RedisClient::sismember(const std::string& key, const std::string& member) {
-    std::string command = "SISMEMBER " + key + " " + member;
-    std::string reply = execute_command_with_reply(command);
+    std::string reply = execute_command_with_reply({"SISMEMBER", key, member});
     return reply == "1";
 }
 
 bool RedisClient::publish(const std::string& channel, const std::string& message) {
-    std::string command = "PUBLISH " + channel + " " + message;
-    return execute_command(command);
+    return execute_command({"PUBLISH", channel, message});
 }
 
 bool RedisClient::subscribe(const std::string& channel, std::function<void(const std::string&, const std::string&)> callback) {
@@ -206,52 +312,89 @@ bool RedisClient::subscribe(const std::string& channel, std::function<void(const
 }
 
 bool RedisClient::unsubscribe(const std::string& channel) {
-    std::string command = "UNSUBSCRIBE " + channel;
-    return execute_command(command);
+    return execute_command({"UNSUBSCRIBE", channel});
 }
 
 void RedisClient::multi() {
-    execute_command("MULTI");
+    // without a connection the transaction is failed from the start
+    redisContext* context = acquire_connection();
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        pinned_connections_[std::this_thread::get_id()] = context;
+    }
+    if (context) {
+        execute_command({"MULTI"});
+    }
 }
 
 bool RedisClient::exec() {
-    std::string reply = execute_command_with_reply("EXEC");
-    return !reply.empty();
+    Reply reply = execute({"EXEC"});
+    redisContext* context = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        auto it = pinned_connections_.find(std::this_thread::get_id());
+        if (it != pinned_connections_.end()) {
+            context = it->second;
+            pinned_connections_.erase(it);
+        }
+    }
+    // a connection that broke was closed by the failed command already
+    if (context) {
+        release_connection(context, false);
+    }
+    return reply.ok && !reply.nil;
 }
 
 void RedisClient::discard() {
-    execute_command("DISCARD");
+    execute_command({"DISCARD"});
+    redisContext* context = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        auto it = pinned_connections_.find(std::this_thread::get_id());
+        if (it != pinned_connections_.end()) {
+            context = it->second;
+            pinned_connections_.erase(it);
+        }
+    }
+    if (context) {
+        release_connection(context, false);
+    }
 }
 
 bool RedisClient::expire(const std::string& key, int seconds) {
-    std::string command = "EXPIRE " + key + " " + std::to_string(seconds);
-    return execute_command(command);
+    return execute_command({"EXPIRE", key, std::to_string(seconds)});
 }
 
 bool RedisClient::persist(const std::string& key) {
-    std::string command = "PERSIST " + key;
-    return execute_command(command);
+    return execute_command({"PERSIST", key});
 }
 
 int RedisClient::ttl(const std::string& key) {
-    std::string command = "TTL " + key;
-    std::string reply = execute_command_with_reply(command);
-    return std::stoi(reply);
+    Reply reply = execute({"TTL", key});
+    return reply.ok ? static_cast<int>(reply.integer) : -2;
 }
 
 std::vector<std::string> RedisClient::cluster_nodes() {
-    std::string command = "CLUSTER NODES";
-    std::string reply = execute_command_with_reply(command);
-    // Parse response - simplified
-    return {reply};
+    std::string reply = execute_command_with_reply({"CLUSTER", "NODES"});
+    
+    // One node per line
+    std::vector<std::string> nodes;
+    std::istringstream lines(reply);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (!line.empty()) {
+            nodes.push_back(line);
+        }
+    }
+    return nodes;
 }
 
 std::string RedisClient::cluster_info() {
-    return execute_command_with_reply("CLUSTER INFO");
+    return execute_command_with_reply({"CLUSTER", "INFO"});
 }
 
 bool RedisClient::cluster_save() {
-    return execute_command("CLUSTER SAVE");
+    return execute_command({"CLUSTER", "SAVE"});
 }
 
 void RedisClient::set_timeout_ms(int timeout_ms) {
@@ -263,16 +406,18 @@ void RedisClient::set_max_retries(int max_retries) {
 }
 
 void RedisClient::set_pool_size(size_t pool_size) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
     pool_size_ = std::max(size_t(1), pool_size);
+    pool_cv_.notify_all();
 }
 
 bool RedisClient::ping() {
-    std::string reply = execute_command_with_reply("PING");
+    std::string reply = execute_command_with_reply({"PING"});
     return reply == "PONG";
 }
 
 std::string RedisClient::info() {
-    return execute_command_with_reply("INFO");
+    return execute_command_with_reply({"INFO"});
 }
 
 RedisClient::RedisMetrics RedisClient::get_metrics() const {
@@ -293,118 +438,181 @@ void RedisClient::reset_metrics() {
     metrics_.bytes_received = 0;
 }
 
-bool RedisClient::create_connection() {
-    try {
-        redis_context_ = redisConnect(host_.c_str(), port_);
-        
-        if (!redis_context_ || redis_context_->err) {
-            if (redis_context_) {
-                redisFree(redis_context_);
-                redis_context_ = nullptr;
-            }
-            return false;
+redisContext* RedisClient::create_connection() {
+    timeval timeout{timeout_ms_ / 1000, (timeout_ms_ % 1000) * 1000};
+    redisContext* context = redisConnectWithTimeout(host_.c_str(), port_, timeout);
+    
+    if (!context || context->err) {
+        if (context) {
+            redisFree(context);
         }
-        
-        // Select database
-        if (db_ > 0) {
-            redisReply* reply = static_cast<redisReply*>(redisCommand(redis_context_, "SELECT %d", db_));
-            if (reply) {
-                freeReplyObject(reply);
-            }
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        metrics_.connection_errors++;
+        return nullptr;
+    }
+    redisSetTimeout(context, timeout);
+    
+    // Select database
+    if (db_ > 0) {
+        redisReply* reply = static_cast<redisReply*>(redisCommand(context, "SELECT %d", db_));
+        const bool selected = reply && reply->type != REDIS_REPLY_ERROR;
+        if (reply) {
+            freeReplyObject(reply);
+        }
+        if (!selected) {
+            redisFree(context);
+            return nullptr;
         }
-        
-        connected_ = true;
-        return true;
-    } catch (const std::exception& e) {
-        return false;
     }
+    
+    return context;
 }
 
-void RedisClient::close_connection() {
-    if (redis_context_) {
-        redisFree(redis_context_);
-        redis_context_ = nullptr;
+void RedisClient::close_connection(redisContext* context) {
+    if (context) {
+        redisFree(context);
     }
 }
 
-bool RedisClient::reconnect() {
-    close_connection();
-    return create_connection();
-}
-
-bool RedisClient::execute_command(const std::string& command) {
-    auto start_time = std::chrono::high_resolution_clock::now();
-    bool success = false;
+redisContext* RedisClient::acquire_connection() {
+    std::unique_lock<std::mutex> lock(pool_mutex_);
     
-    try {
-        if (!connected_.load() && !reconnect()) {
-            update_metrics(false, 0, command.size(), 0);
-            return false;
-        }
-        
-        redisReply* reply = static_cast<redisReply*>(redisCommand(redis_context_, command.c_str()));
-        
-        if (reply) {
-            success = (reply->type != REDIS_REPLY_ERROR);
-            freeReplyObject(reply);
-        } else {
-            success = false;
-            // Connection might be lost
-            connected_ = false;
-        }
-        
-    } catch (const std::exception& e) {
-        success = false;
-        connected_ = false;
+    // Inside multi()/exec() the thread keeps its own connection
+    auto pinned = pinned_connections_.find(std::this_thread::get_id());
+    if (pinned != pinned_connections_.end()) {
+        return pinned->second;
     }
     
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto response_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-    
-    update_metrics(success, response_time.count(), command.size(), 0);
+    pool_cv_.wait(lock, [this] { return !idle_connections_.empty() || open_connections_ < pool_size_; });
+    if (!idle_connections_.empty()) {
+        redisContext* context = idle_connections_.back();
+        idle_connections_.pop_back();
+        return context;
+    }
     
-    return success;
+    // Connect outside the lock; the slot is taken meanwhile
+    open_connections_++;
+    lock.unlock();
+    redisContext* context = create_connection();
+    if (!context) {
+        lock.lock();
+        open_connections_--;
+        pool_cv_.notify_one();
+    }
+    return context;
 }
 
-std::string RedisClient::execute_command_with_reply(const std::string& command) {
-    auto start_time = std::chrono::high_resolution_clock::now();
-    std::string reply_str;
-    bool success = false;
+void RedisClient::release_connection(redisContext* context, bool broken) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
     
-    try {
-        if (!connected_.load() && !reconnect()) {
-            update_metrics(false, 0, command.size(), 0);
-            return "";
-        }
-        
-        redisReply* reply = static_cast<redisReply*>(redisCommand(redis_context_, command.c_str()));
-        
-        if (reply) {
-            success = (reply->type != REDIS_REPLY_ERROR);
-            
-            if (success && reply->type == REDIS_REPLY_STRING) {
-                reply_str = std::string(reply->str, reply->len);
-            } else if (success && reply->type == REDIS_REPLY_INTEGER) {
-                reply_str = std::to_string(reply->integer);
+    for (auto& [thread, pinned] : pinned_connections_) {
+        if (pinned == context) {
+            if (!broken) {
+                return;
             }
-            
-            freeReplyObject(reply);
-        } else {
-            success = false;
-            connected_ = false;
+            // A broken pinned connection fails the rest of the transaction
+            pinned = nullptr;
+            break;
         }
-        
-    } catch (const std::exception& e) {
-        success = false;
-        connected_ = false;
     }
     
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto response_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-    
-    update_metrics(success, response_time.count(), command.size(), reply_str.size());
+    if (broken || open_connections_ > pool_size_) {
+        close_connection(context);
+        open_connections_--;
+    } else {
+        idle_connections_.push_back(context);
+    }
+    pool_cv_.notify_one();
+}
+
+bool RedisClient::execute_command(const Command& args) {
+    return execute(args).ok;
+}
+
+std::string RedisClient::execute_command_with_reply(const Command& args) {
+    Reply reply = execute(args);
+    return reply.ok ? reply.str : "";
+}
+
+RedisClient::Reply RedisClient::execute(const Command& args) {
+    std::vector<Reply> replies = pipeline({args});
+    return std::move(replies.front());
+}
+
+bool RedisClient::run_pipeline(redisContext* context, const std::vector<Command>& commands, std::vector<Reply>* replies,
+                               bool* sent) {
+    *sent = false;
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+    for (const auto& command : commands) {
+        argv.clear();
+        argvlen.clear();
+        for (const auto& arg : command) {
+            argv.push_back(arg.data());
+            argvlen.push_back(arg.size());
+        }
+        if (redisAppendCommandArgv(context, static_cast<int>(argv.size()), argv.data(), argvlen.data()) != REDIS_OK) {
+            return false;
+        }
+    }
     
-    return success ? reply_str : "";
+    // the appends only buffered the commands; the first read writes them out
+    *sent = true;
+    replies->clear();
+    replies->reserve(commands.size());
+    for (size_t i = 0; i < commands.size(); ++i) {
+        void* raw = nullptr;
+        if (redisGetReply(context, &raw) != REDIS_OK || !raw) {
+            if (context->err == REDIS_ERR_IO && (errno == EAGAIN || errno == ETIMEDOUT)) {
+                std::lock_guard<std::mutex> lock(metrics_mutex_);
+                metrics_.timeout_errors++;
+            }
+            return false;
+        }
+        redisReply* reply = static_cast<redisReply*>(raw);
+        replies->push_back(to_reply(reply));
+        freeReplyObject(reply);
+    }
+    return true;
+}
+
+RedisClient::Reply RedisClient::to_reply(const redisReply* reply) {
+    Reply result;
+    switch (reply->type) {
+        case REDIS_REPLY_STRING:
+        case REDIS_REPLY_STATUS:
+            result.ok = true;
+            result.str.assign(reply->str, reply->len);
+            break;
+        case REDIS_REPLY_INTEGER:
+            result.ok = true;
+            result.integer = reply->integer;
+            result.str = std::to_string(reply->integer);
+            break;
+        case REDIS_REPLY_ARRAY:
+            result.ok = true;
+            result.elements.reserve(reply->elements);
+            for (size_t i = 0; i < reply->elements; ++i) {
+                const redisReply* element = reply->element[i];
+                if (element->type == REDIS_REPLY_INTEGER) {
+                    result.elements.push_back(std::to_string(element->integer));
+                } else if (element->type == REDIS_REPLY_STRING || element->type == REDIS_REPLY_STATUS) {
+                    result.elements.emplace_back(element->str, element->len);
+                } else {
+                    result.elements.emplace_back();
+                }
+            }
+            break;
+        case REDIS_REPLY_NIL:
+            // a missing key: the command itself went through
+            result.ok = true;
+            result.nil = true;
+            break;
+        default:
+            result.str.assign(reply->str ? reply->str : "", reply->str ? reply->len : 0);
+            break;
+    }
+    return result;
 }
 
 void RedisClient::update_metrics(bool success, double response_time, size_t bytes_sent, size_t bytes_received) {
@@ -456,15 +664,12 @@ std::vector<float> RedisClient::deserialize_vector(const std::string& data) {
     return vector;
 }
 
-std::string RedisClient::build_command(const std::vector<std::string>& args) {
-    std::string command;
+size_t RedisClient::command_bytes(const Command& args) {
+    size_t bytes = 0;
     for (const auto& arg : args) {
-        if (!command.empty()) {
-            command += " ";
-        }
-        command += arg;
+        bytes += arg.size();
     }
-    return command;
+    return bytes;
 }
 
 } // namespace dann
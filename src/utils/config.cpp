@@ -94,7 +94,7 @@ Config::NodeConfig Config::get_node_config() const {
     NodeConfig config;
     config.id = get_nested_value({"node", "id"}, get_default_node_config().id);
     config.address = get_nested_value({"node", "address"}, get_default_node_config().address);
-    config.port = get_int(get_nested_value({"node", "port"}, std::to_string(get_default_node_config().port)));
+    config.port = parse_int(get_nested_value({"node", "port"}, std::to_string(get_default_node_config().port)));
     
     // Parse seed nodes
     std::string seeds_str = get_nested_value({"node", "seed_nodes"}, "");
@@ -116,7 +116,7 @@ Config::NodeConfig Config::get_node_config() const {
         }
     }
     
-    config.replication_factor = get_int(get_nested_value({"node", "replication_factor"}, 
+    config.replication_factor = parse_int(get_nested_value({"node", "replication_factor"}, 
                                                        std::to_string(get_default_node_config().replication_factor)));
     
     return config;
@@ -126,13 +126,13 @@ Config::IndexConfig Config::get_index_config() const {
     std::lock_guard<std::mutex> lock(config_mutex_);
     
     IndexConfig config;
-    config.dimension = get_int(get_nested_value({"index", "dimension"}, 
+    config.dimension = parse_int(get_nested_value({"index", "dimension"}, 
                                              std::to_string(get_default_index_config().dimension)));
     config.type = get_nested_value({"index", "type"}, get_default_index_config().type);
     config.storage_path = get_nested_value({"index", "storage_path"}, get_default_index_config().storage_path);
-    config.auto_save = get_bool(get_nested_value({"index", "auto_save"}, 
+    config.auto_save = parse_bool(get_nested_value({"index", "auto_save"}, 
                                                get_default_index_config().auto_save ? "true" : "false"));
-    config.save_interval_seconds = get_int(get_nested_value({"index", "save_interval_seconds"}, 
+    config.save_interval_seconds = parse_int(get_nested_value({"index", "save_interval_seconds"}, 
                                                           std::to_string(get_default_index_config().save_interval_seconds)));
     
     return config;
@@ -142,19 +142,19 @@ Config::PerformanceConfig Config::get_performance_config() const {
     std::lock_guard<std::mutex> lock(config_mutex_);
     
     PerformanceConfig config;
-    config.batch_size = get_int(get_nested_value({"performance", "batch_size"}, 
+    config.batch_size = parse_int(get_nested_value({"performance", "batch_size"}, 
                                                std::to_string(get_default_performance_config().batch_size)));
-    config.max_concurrent_loads = get_int(get_nested_value({"performance", "max_concurrent_loads"}, 
+    config.max_concurrent_loads = parse_int(get_nested_value({"performance", "max_concurrent_loads"}, 
                                                           std::to_string(get_default_performance_config().max_concurrent_loads)));
-    config.max_concurrent_queries = get_int(get_nested_value({"performance", "max_concurrent_queries"}, 
+    config.max_concurrent_queries = parse_int(get_nested_value({"performance", "max_concurrent_queries"}, 
                                                            std::to_string(get_default_performance_config().max_concurrent_queries)));
-    config.cache_enabled = get_bool(get_nested_value({"performance", "cache_enabled"}, 
+    config.cache_enabled = parse_bool(get_nested_value({"performance", "cache_enabled"}, 
                                                     get_default_performance_config().cache_enabled ? "true" : "false"));
-    config.cache_size = get_int(get_nested_value({"performance", "cache_size"}, 
+    config.cache_size = parse_int(get_nested_value({"performance", "cache_size"}, 
                                                 std::to_string(get_default_performance_config().cache_size)));
-    config.query_timeout_ms = get_int(get_nested_value({"performance", "query_timeout_ms"}, 
+    config.query_timeout_ms = parse_int(get_nested_value({"performance", "query_timeout_ms"}, 
                                                       std::to_string(get_default_performance_config().query_timeout_ms)));
-    config.load_timeout_ms = get_int(get_nested_value({"performance", "load_timeout_ms"}, 
+    config.load_timeout_ms = parse_int(get_nested_value({"performance", "load_timeout_ms"}, 
                                                      std::to_string(get_default_performance_config().load_timeout_ms)));
     
     return config;
@@ -164,17 +164,17 @@ Config::NetworkConfig Config::get_network_config() const {
     std::lock_guard<std::mutex> lock(config_mutex_);
     
     NetworkConfig config;
-    config.max_connections = get_int(get_nested_value({"network", "max_connections"}, 
+    config.max_connections = parse_int(get_nested_value({"network", "max_connections"}, 
                                                     std::to_string(get_default_network_config().max_connections)));
-    config.connection_timeout_ms = get_int(get_nested_value({"network", "connection_timeout_ms"}, 
+    config.connection_timeout_ms = parse_int(get_nested_value({"network", "connection_timeout_ms"}, 
                                                            std::to_string(get_default_network_config().connection_timeout_ms)));
-    config.read_timeout_ms = get_int(get_nested_value({"network", "read_timeout_ms"}, 
+    config.read_timeout_ms = parse_int(get_nested_value({"network", "read_timeout_ms"}, 
                                                      std::to_string(get_default_network_config().read_timeout_ms)));
-    config.write_timeout_ms = get_int(get_nested_value({"network", "write_timeout_ms"}, 
+    config.write_timeout_ms = parse_int(get_nested_value({"network", "write_timeout_ms"}, 
                                                       std::to_string(get_default_network_config().write_timeout_ms)));
-    config.compression_enabled = get_bool(get_nested_value({"network", "compression_enabled"}, 
+    config.compression_enabled = parse_bool(get_nested_value({"network", "compression_enabled"}, 
                                                          get_default_network_config().compression_enabled ? "true" : "false"));
-    config.max_retries = get_int(get_nested_value({"network", "max_retries"}, 
+    config.max_retries = parse_int(get_nested_value({"network", "max_retries"}, 
                                                  std::to_string(get_default_network_config().max_retries)));
     config.load_balance_strategy = get_nested_value({"network", "load_balance_strategy"}, 
                                                   get_default_network_config().load_balance_strategy);
@@ -188,17 +188,21 @@ Config::StorageConfig Config::get_storage_config() const {
     StorageConfig config;
     config.type = get_nested_value({"storage", "type"}, get_default_storage_config().type);
     config.redis_host = get_nested_value({"storage", "redis_host"}, get_default_storage_config().redis_host);
-    config.redis_port = get_int(get_nested_value({"storage", "redis_port"}, 
+    config.redis_port = parse_int(get_nested_value({"storage", "redis_port"}, 
                                                 std::to_string(get_default_storage_config().redis_port)));
-    config.redis_db = get_int(get_nested_value({"storage", "redis_db"}, 
+    config.redis_db = parse_int(get_nested_value({"storage", "redis_db"}, 
                                              std::to_string(get_default_storage_config().redis_db)));
     config.local_storage_path = get_nested_value({"storage", "local_storage_path"}, 
                                                get_default_storage_config().local_storage_path);
-    config.local_cache_size = get_int(get_nested_value({"storage", "local_cache_size"}, 
+    config.local_cache_size = parse_int(get_nested_value({"storage", "local_cache_size"}, 
                                                      std::to_string(get_default_storage_config().local_cache_size)));
-    config.compression_enabled = get_bool(get_nested_value({"storage", "compression_enabled"}, 
+    config.compression_enabled = parse_bool(get_nested_value({"storage", "compression_enabled"}, 
                                                          get_default_storage_config().compression_enabled ? "true" : "false"));
-    config.encryption_enabled = get_bool(get_nested_value({"storage", "encryption_enabled"}, 
+    config.compression_codec = get_nested_value({"storage", "compression_codec"},
+                                                get_default_storage_config().compression_codec);
+    config.compression_level = parse_int(get_nested_value({"storage", "compression_level"},
+                                                        std::to_string(get_default_storage_config().compression_level)));
+    config.encryption_enabled = parse_bool(get_nested_value({"storage", "encryption_enabled"}, 
                                                         get_default_storage_config().encryption_enabled ? "true" : "false"));
     config.encryption_key = get_nested_value({"storage", "encryption_key"}, get_default_storage_config().encryption_key);
     
@@ -211,11 +215,11 @@ Config::LoggingConfig Config::get_logging_config() const {
     LoggingConfig config;
     config.level = get_nested_value({"logging", "level"}, get_default_logging_config().level);
     config.output_file = get_nested_value({"logging", "output_file"}, get_default_logging_config().output_file);
-    config.console_output = get_bool(get_nested_value({"logging", "console_output"}, 
+    config.console_output = parse_bool(get_nested_value({"logging", "console_output"}, 
                                                      get_default_logging_config().console_output ? "true" : "false"));
-    config.max_file_size_mb = get_int(get_nested_value({"logging", "max_file_size_mb"}, 
+    config.max_file_size_mb = parse_int(get_nested_value({"logging", "max_file_size_mb"}, 
                                                       std::to_string(get_default_logging_config().max_file_size_mb)));
-    config.max_files = get_int(get_nested_value({"logging", "max_files"}, 
+    config.max_files = parse_int(get_nested_value({"logging", "max_files"}, 
                                                std::to_string(get_default_logging_config().max_files)));
     config.pattern = get_nested_value({"logging", "pattern"}, get_default_logging_config().pattern);
     
@@ -292,6 +296,8 @@ void Config::set_storage_config(const StorageConfig& config) {
     config_data_["storage"]["local_storage_path"] = config.local_storage_path;
     config_data_["storage"]["local_cache_size"] = std::to_string(config.local_cache_size);
     config_data_["storage"]["compression_enabled"] = config.compression_enabled ? "true" : "false";
+    config_data_["storage"]["compression_codec"] = config.compression_codec;
+    config_data_["storage"]["compression_level"] = std::to_string(config.compression_level);
     config_data_["storage"]["encryption_enabled"] = config.encryption_enabled ? "true" : "false";
     config_data_["storage"]["encryption_key"] = config.encryption_key;
 }
@@ -327,6 +333,19 @@ std::string Config::get_string(const std::string& key, const std::string& defaul
     return default_value;
 }
 
+int Config::parse_int(const std::string& value, int default_value) {
+    try {
+        return std::stoi(value);
+    } catch (const std::exception&) {
+        return default_value;
+    }
+}
+
+bool Config::parse_bool(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value == "true" || value == "1" || value == "yes" || value == "on";
+}
+
 int Config::get_int(const std::string& key, int default_value) const {
     std::string value = get_string(key, std::to_string(default_value));
     try {
@@ -616,7 +635,8 @@ bool Config::validate_network_config(const NetworkConfig& config) const {
 }
 
 bool Config::validate_storage_config(const StorageConfig& config) const {
-    return !config.type.empty();
+    return !config.type.empty() &&
+           (!config.compression_enabled || config.compression_codec == "lz4" || config.compression_codec == "zstd");
 }
 
 bool Config::validate_logging_config(const LoggingConfig& config) const {
@@ -696,6 +716,8 @@ Config::StorageConfig Config::get_default_storage_config() const {
     config.local_storage_path = "./data";
     config.local_cache_size = 1000;
     config.compression_enabled = false;
+    config.compression_codec = "lz4";
+    config.compression_level = 3;
     config.encryption_enabled = false;
     return config;
 }
@@ -0,0 +1,402 @@
+//
+// SIMD distance kernels, picked once at startup from what the CPU supports.
+//
+#include "dann/distance_kernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DANN_KERNELS_X86 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define DANN_KERNELS_NEON 1
+#endif
+
+namespace dann {
+
+namespace {
+
+using DistanceFn = float (*)(const float*, const float*, int);
+using BatchFn = DistanceBatchKernel;
+
+struct KernelTable {
+    SimdLevel level;
+    DistanceFn l2;
+    DistanceFn ip;
+    BatchFn l2_batch;
+    BatchFn neg_ip_batch;
+    // indexed like kSpecializedDimensions
+    BatchFn l2_batch_fixed[4];
+    BatchFn neg_ip_batch_fixed[4];
+};
+
+// production dimensions with compile-time kernels
+constexpr int kSpecializedDimensions[4] = {128, 256, 768, 1024};
+
+// IP selects <x, y> instead of ||x - y||^2. D > 0 fixes the dimension at compile
+// time so the loop fully unrolls; D == 0 reads d at runtime
+template <bool IP, int D>
+inline float distance_scalar(const float* x, const float* y, int d_runtime) {
+    const int d = D > 0 ? D : d_runtime;
+    float dis = 0.0f;
+    for (int j = 0; j < d; ++j) {
+        if constexpr (IP) {
+            dis += x[j] * y[j];
+        } else {
+            const float diff = x[j] - y[j];
+            dis += diff * diff;
+        }
+    }
+    return dis;
+}
+
+template <bool IP>
+inline float tail_scalar(const float* x, const float* y, int d) {
+    return distance_scalar<IP, 0>(x, y, d);
+}
+
+// batch kernels: IP selects -<x, y> instead of ||x - y||^2 so that smaller is
+// closer for every metric. D is passed on to the per-row kernel
+template <bool IP, int D>
+void batch_scalar(const float* x, const float* y, int d_runtime, size_t n, float* out) {
+    const int d = D > 0 ? D : d_runtime;
+    const float sign = IP ? -1.0f : 1.0f;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = sign * distance_scalar<IP, D>(x + i * d, y, d);
+    }
+}
+
+#ifdef DANN_KERNELS_X86
+__attribute__((target("avx2,fma")))
+inline float hsum_avx2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+template <bool IP>
+__attribute__((target("avx2,fma")))
+inline __m256 accumulate_avx2(__m256 acc, __m256 x, __m256 q) {
+    if constexpr (IP) {
+        return _mm256_fmadd_ps(x, q, acc);
+    } else {
+        const __m256 t = _mm256_sub_ps(x, q);
+        return _mm256_fmadd_ps(t, t, acc);
+    }
+}
+
+template <bool IP>
+__attribute__((target("avx2,fma")))
+float distance_avx2(const float* x, const float* y, int d) {
+    __m256 acc = _mm256_setzero_ps();
+    int j = 0;
+    for (; j + 8 <= d; j += 8) {
+        acc = accumulate_avx2<IP>(acc, _mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j));
+    }
+    return hsum_avx2(acc) + tail_scalar<IP>(x + j, y + j, d - j);
+}
+
+template <bool IP, int D>
+__attribute__((target("avx2,fma")))
+void batch_avx2(const float* x, const float* y, int d_runtime, size_t n, float* out) {
+    const int d = D > 0 ? D : d_runtime;
+    const float sign = IP ? -1.0f : 1.0f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float* x0 = x + i * d;
+        const float* x1 = x0 + d;
+        const float* x2 = x1 + d;
+        const float* x3 = x2 + d;
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+        __m256 a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        int j = 0;
+        for (; j + 8 <= d; j += 8) {
+            const __m256 q = _mm256_loadu_ps(y + j);
+            a0 = accumulate_avx2<IP>(a0, _mm256_loadu_ps(x0 + j), q);
+            a1 = accumulate_avx2<IP>(a1, _mm256_loadu_ps(x1 + j), q);
+            a2 = accumulate_avx2<IP>(a2, _mm256_loadu_ps(x2 + j), q);
+            a3 = accumulate_avx2<IP>(a3, _mm256_loadu_ps(x3 + j), q);
+        }
+        out[i] = sign * (hsum_avx2(a0) + tail_scalar<IP>(x0 + j, y + j, d - j));
+        out[i + 1] = sign * (hsum_avx2(a1) + tail_scalar<IP>(x1 + j, y + j, d - j));
+        out[i + 2] = sign * (hsum_avx2(a2) + tail_scalar<IP>(x2 + j, y + j, d - j));
+        out[i + 3] = sign * (hsum_avx2(a3) + tail_scalar<IP>(x3 + j, y + j, d - j));
+    }
+    for (; i < n; ++i) {
+        out[i] = sign * distance_avx2<IP>(x + i * d, y, d);
+    }
+}
+
+template <bool IP>
+__attribute__((target("avx512f")))
+inline __m512 accumulate_avx512(__m512 acc, __m512 x, __m512 q) {
+    if constexpr (IP) {
+        return _mm512_fmadd_ps(x, q, acc);
+    } else {
+        const __m512 t = _mm512_sub_ps(x, q);
+        return _mm512_fmadd_ps(t, t, acc);
+    }
+}
+
+template <bool IP>
+__attribute__((target("avx512f")))
+float distance_avx512(const float* x, const float* y, int d) {
+    __m512 acc = _mm512_setzero_ps();
+    int j = 0;
+    for (; j + 16 <= d; j += 16) {
+        acc = accumulate_avx512<IP>(acc, _mm512_loadu_ps(x + j), _mm512_loadu_ps(y + j));
+    }
+    if (j < d) {
+        // masked tail instead of a scalar loop; masked-off lanes are zero in both operands
+        const __mmask16 mask = static_cast<__mmask16>((1u << (d - j)) - 1);
+        acc = accumulate_avx512<IP>(acc, _mm512_maskz_loadu_ps(mask, x + j), _mm512_maskz_loadu_ps(mask, y + j));
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+template <bool IP, int D>
+__attribute__((target("avx512f")))
+void batch_avx512(const float* x, const float* y, int d_runtime, size_t n, float* out) {
+    const int d = D > 0 ? D : d_runtime;
+    const float sign = IP ? -1.0f : 1.0f;
+    const int tail = d % 16;
+    const int body = d - tail;
+    const __mmask16 mask = static_cast<__mmask16>((1u << tail) - 1);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float* x0 = x + i * d;
+        const float* x1 = x0 + d;
+        const float* x2 = x1 + d;
+        const float* x3 = x2 + d;
+        __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+        __m512 a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+        for (int j = 0; j < body; j += 16) {
+            const __m512 q = _mm512_loadu_ps(y + j);
+            a0 = accumulate_avx512<IP>(a0, _mm512_loadu_ps(x0 + j), q);
+            a1 = accumulate_avx512<IP>(a1, _mm512_loadu_ps(x1 + j), q);
+            a2 = accumulate_avx512<IP>(a2, _mm512_loadu_ps(x2 + j), q);
+            a3 = accumulate_avx512<IP>(a3, _mm512_loadu_ps(x3 + j), q);
+        }
+        if (tail) {
+            const __m512 q = _mm512_maskz_loadu_ps(mask, y + body);
+            a0 = accumulate_avx512<IP>(a0, _mm512_maskz_loadu_ps(mask, x0 + body), q);
+            a1 = accumulate_avx512<IP>(a1, _mm512_maskz_loadu_ps(mask, x1 + body), q);
+            a2 = accumulate_avx512<IP>(a2, _mm512_maskz_loadu_ps(mask, x2 + body), q);
+            a3 = accumulate_avx512<IP>(a3, _mm512_maskz_loadu_ps(mask, x3 + body), q);
+        }
+        out[i] = sign * _mm512_reduce_add_ps(a0);
+        out[i + 1] = sign * _mm512_reduce_add_ps(a1);
+        out[i + 2] = sign * _mm512_reduce_add_ps(a2);
+        out[i + 3] = sign * _mm512_reduce_add_ps(a3);
+    }
+    for (; i < n; ++i) {
+        out[i] = sign * distance_avx512<IP>(x + i * d, y, d);
+    }
+}
+#endif
+
+#ifdef DANN_KERNELS_NEON
+template <bool IP>
+inline float32x4_t accumulate_neon(float32x4_t acc, float32x4_t x, float32x4_t q) {
+    if constexpr (IP) {
+        return vfmaq_f32(acc, x, q);
+    } else {
+        const float32x4_t t = vsubq_f32(x, q);
+        return vfmaq_f32(acc, t, t);
+    }
+}
+
+template <bool IP>
+float distance_neon(const float* x, const float* y, int d) {
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    int j = 0;
+    for (; j + 4 <= d; j += 4) {
+        acc = accumulate_neon<IP>(acc, vld1q_f32(x + j), vld1q_f32(y + j));
+    }
+    return vaddvq_f32(acc) + tail_scalar<IP>(x + j, y + j, d - j);
+}
+
+template <bool IP, int D>
+void batch_neon(const float* x, const float* y, int d_runtime, size_t n, float* out) {
+    const int d = D > 0 ? D : d_runtime;
+    const float sign = IP ? -1.0f : 1.0f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float* x0 = x + i * d;
+        const float* x1 = x0 + d;
+        const float* x2 = x1 + d;
+        const float* x3 = x2 + d;
+        float32x4_t a0 = vdupq_n_f32(0.0f), a1 = vdupq_n_f32(0.0f);
+        float32x4_t a2 = vdupq_n_f32(0.0f), a3 = vdupq_n_f32(0.0f);
+        int j = 0;
+        for (; j + 4 <= d; j += 4) {
+            const float32x4_t q = vld1q_f32(y + j);
+            a0 = accumulate_neon<IP>(a0, vld1q_f32(x0 + j), q);
+            a1 = accumulate_neon<IP>(a1, vld1q_f32(x1 + j), q);
+            a2 = accumulate_neon<IP>(a2, vld1q_f32(x2 + j), q);
+            a3 = accumulate_neon<IP>(a3, vld1q_f32(x3 + j), q);
+        }
+        out[i] = sign * (vaddvq_f32(a0) + tail_scalar<IP>(x0 + j, y + j, d - j));
+        out[i + 1] = sign * (vaddvq_f32(a1) + tail_scalar<IP>(x1 + j, y + j, d - j));
+        out[i + 2] = sign * (vaddvq_f32(a2) + tail_scalar<IP>(x2 + j, y + j, d - j));
+        out[i + 3] = sign * (vaddvq_f32(a3) + tail_scalar<IP>(x3 + j, y + j, d - j));
+    }
+    for (; i < n; ++i) {
+        out[i] = sign * distance_neon<IP>(x + i * d, y, d);
+    }
+}
+#endif
+
+#define DANN_KERNEL_TABLE(level, distance, batch)                                                   \
+    KernelTable{level, &distance<false>, &distance<true>, &batch<false, 0>, &batch<true, 0>,         \
+                {&batch<false, 128>, &batch<false, 256>, &batch<false, 768>, &batch<false, 1024>}, \
+                {&batch<true, 128>, &batch<true, 256>, &batch<true, 768>, &batch<true, 1024>}}
+
+template <bool IP>
+float distance_scalar(const float* x, const float* y, int d) {
+    return tail_scalar<IP>(x, y, d);
+}
+
+const KernelTable kScalarKernels = DANN_KERNEL_TABLE(SimdLevel::SCALAR, distance_scalar, batch_scalar);
+#ifdef DANN_KERNELS_X86
+const KernelTable kAvx2Kernels = DANN_KERNEL_TABLE(SimdLevel::AVX2, distance_avx2, batch_avx2);
+const KernelTable kAvx512Kernels = DANN_KERNEL_TABLE(SimdLevel::AVX512, distance_avx512, batch_avx512);
+#endif
+#ifdef DANN_KERNELS_NEON
+const KernelTable kNeonKernels = DANN_KERNEL_TABLE(SimdLevel::NEON, distance_neon, batch_neon);
+#endif
+#undef DANN_KERNEL_TABLE
+
+const KernelTable* table_for(SimdLevel level) {
+    switch (level) {
+#ifdef DANN_KERNELS_X86
+        case SimdLevel::AVX512:
+            return &kAvx512Kernels;
+        case SimdLevel::AVX2:
+            return &kAvx2Kernels;
+#endif
+#ifdef DANN_KERNELS_NEON
+        case SimdLevel::NEON:
+            return &kNeonKernels;
+#endif
+        default:
+            return &kScalarKernels;
+    }
+}
+
+std::atomic<const KernelTable*>& active_table() {
+    static std::atomic<const KernelTable*> table{table_for(detected_simd_level())};
+    return table;
+}
+
+inline const KernelTable& kernels() {
+    return *active_table().load(std::memory_order_relaxed);
+}
+
+}
+
+SimdLevel detected_simd_level() {
+    static const SimdLevel level = [] {
+#ifdef DANN_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return SimdLevel::AVX512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return SimdLevel::AVX2;
+        }
+#elif defined(DANN_KERNELS_NEON)
+        return SimdLevel::NEON;
+#endif
+        return SimdLevel::SCALAR;
+    }();
+    return level;
+}
+
+SimdLevel simd_level() {
+    return kernels().level;
+}
+
+const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX2:
+            return "avx2";
+        case SimdLevel::AVX512:
+            return "avx512";
+        case SimdLevel::NEON:
+            return "neon";
+        case SimdLevel::SCALAR:
+        default:
+            return "scalar";
+    }
+}
+
+void set_simd_level(SimdLevel level) {
+    const SimdLevel detected = detected_simd_level();
+    const bool supported = level == SimdLevel::SCALAR || level == detected ||
+                           (level == SimdLevel::AVX2 && detected == SimdLevel::AVX512);
+    active_table().store(table_for(supported ? level : detected), std::memory_order_relaxed);
+}
+
+float l2_sqr(const float* x, const float* y, int d) {
+    return kernels().l2(x, y, d);
+}
+
+float inner_product(const float* x, const float* y, int d) {
+    return kernels().ip(x, y, d);
+}
+
+void l2_sqr_batch(const float* x, const float* y, int d, size_t n, float* out) {
+    kernels().l2_batch(x, y, d, n, out);
+}
+
+void neg_inner_product_batch(const float* x, const float* y, int d, size_t n, float* out) {
+    kernels().neg_ip_batch(x, y, d, n, out);
+}
+
+namespace {
+int specialized_slot(int d) {
+    for (int i = 0; i < 4; ++i) {
+        if (kSpecializedDimensions[i] == d) {
+            return i;
+        }
+    }
+    return -1;
+}
+}
+
+DistanceBatchKernel l2_sqr_batch_kernel(int d) {
+    return distance_batch_kernel(DistanceType::L2, d);
+}
+
+DistanceBatchKernel distance_batch_kernel(DistanceType metric, int d) {
+    const KernelTable& table = kernels();
+    const int slot = specialized_slot(d);
+    if (metric == DistanceType::L2) {
+        return slot >= 0 ? table.l2_batch_fixed[slot] : table.l2_batch;
+    }
+    return slot >= 0 ? table.neg_ip_batch_fixed[slot] : table.neg_ip_batch;
+}
+
+bool has_specialized_kernel(int d) {
+    return specialized_slot(d) >= 0;
+}
+
+void normalize_vectors(float* x, size_t n, int d) {
+    for (size_t i = 0; i < n; ++i) {
+        float* row = x + i * d;
+        const float norm = std::sqrt(inner_product(row, row, d));
+        if (norm > 0.0f) {
+            const float inv = 1.0f / norm;
+            for (int j = 0; j < d; ++j) {
+                row[j] *= inv;
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,160 @@
+//
+// Fast-scan kernels for 4-bit PQ codes: rows are packed in blocks of 32 and
+// scored with byte shuffles against a lookup table quantized to 8 bits.
+//
+#include "dann/fast_scan.h"
+
+#include "dann/distance_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DANN_FAST_SCAN_X86 1
+#elif defined(__aarch64__)
+// vqtbl1q_u8 is A64 only
+#include <arm_neon.h>
+#define DANN_FAST_SCAN_NEON 1
+#endif
+
+namespace dann {
+
+namespace {
+
+void accumulate_scalar(const uint8_t* blocks, size_t nblocks, const uint8_t* lut, int m, uint16_t* out) {
+    const size_t block_bytes = static_cast<size_t>(m) * 16;
+    for (size_t b = 0; b < nblocks; ++b) {
+        const uint8_t* block = blocks + b * block_bytes;
+        uint16_t* sums = out + b * kFastScanBlockRows;
+        std::fill(sums, sums + kFastScanBlockRows, 0);
+        for (int j = 0; j < m; ++j) {
+            const uint8_t* codes = block + j * 16;
+            const uint8_t* row = lut + j * 16;
+            for (int i = 0; i < 16; ++i) {
+                sums[i] += row[codes[i] & 0x0f];
+                sums[i + 16] += row[codes[i] >> 4];
+            }
+        }
+    }
+}
+
+#ifdef DANN_FAST_SCAN_X86
+// one 256-bit shuffle looks up two sub-quantizers at once: the low lane holds
+// sub-quantizer j's codes and table, the high lane j + 1's
+__attribute__((target("avx2")))
+void accumulate_avx2(const uint8_t* blocks, size_t nblocks, const uint8_t* lut, int m, uint16_t* out) {
+    const size_t block_bytes = static_cast<size_t>(m) * 16;
+    const __m256i low_bits = _mm256_set1_epi8(0x0f);
+    for (size_t b = 0; b < nblocks; ++b) {
+        const uint8_t* block = blocks + b * block_bytes;
+        __m256i lo_rows = _mm256_setzero_si256(); // rows 0..15
+        __m256i hi_rows = _mm256_setzero_si256(); // rows 16..31
+        for (int j = 0; j < m; j += 2) {
+            const __m256i codes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + j * 16));
+            const __m256i table = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lut + j * 16));
+            const __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(codes, low_bits));
+            const __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(codes, 4), low_bits));
+            lo_rows = _mm256_add_epi16(lo_rows, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(lo)));
+            lo_rows = _mm256_add_epi16(lo_rows, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(lo, 1)));
+            hi_rows = _mm256_add_epi16(hi_rows, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(hi)));
+            hi_rows = _mm256_add_epi16(hi_rows, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(hi, 1)));
+        }
+        uint16_t* sums = out + b * kFastScanBlockRows;
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), lo_rows);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + 16), hi_rows);
+    }
+}
+#endif
+
+#ifdef DANN_FAST_SCAN_NEON
+void accumulate_neon(const uint8_t* blocks, size_t nblocks, const uint8_t* lut, int m, uint16_t* out) {
+    const size_t block_bytes = static_cast<size_t>(m) * 16;
+    const uint8x16_t low_bits = vdupq_n_u8(0x0f);
+    for (size_t b = 0; b < nblocks; ++b) {
+        const uint8_t* block = blocks + b * block_bytes;
+        uint16x8_t acc0 = vdupq_n_u16(0);
+        uint16x8_t acc1 = vdupq_n_u16(0);
+        uint16x8_t acc2 = vdupq_n_u16(0);
+        uint16x8_t acc3 = vdupq_n_u16(0);
+        for (int j = 0; j < m; ++j) {
+            const uint8x16_t codes = vld1q_u8(block + j * 16);
+            const uint8x16_t table = vld1q_u8(lut + j * 16);
+            const uint8x16_t lo = vqtbl1q_u8(table, vandq_u8(codes, low_bits));
+            const uint8x16_t hi = vqtbl1q_u8(table, vshrq_n_u8(codes, 4));
+            acc0 = vaddw_u8(acc0, vget_low_u8(lo));
+            acc1 = vaddw_u8(acc1, vget_high_u8(lo));
+            acc2 = vaddw_u8(acc2, vget_low_u8(hi));
+            acc3 = vaddw_u8(acc3, vget_high_u8(hi));
+        }
+        uint16_t* sums = out + b * kFastScanBlockRows;
+        vst1q_u16(sums, acc0);
+        vst1q_u16(sums + 8, acc1);
+        vst1q_u16(sums + 16, acc2);
+        vst1q_u16(sums + 24, acc3);
+    }
+}
+#endif
+
+}
+
+void pack_fast_scan_codes(const uint8_t* codes, size_t n, int m, size_t first_row, std::vector<uint8_t>* packed) {
+    const size_t block_bytes = fast_scan_block_bytes(m);
+    const size_t blocks = (first_row + n + kFastScanBlockRows - 1) / kFastScanBlockRows;
+    packed->resize(blocks * block_bytes, 0);
+    for (size_t i = 0; i < n; ++i) {
+        const size_t row = first_row + i;
+        uint8_t* block = packed->data() + row / kFastScanBlockRows * block_bytes;
+        const size_t slot = row % kFastScanBlockRows;
+        const int shift = slot < 16 ? 0 : 4;
+        for (int j = 0; j < m; ++j) {
+            uint8_t& byte = block[j * 16 + slot % 16];
+            byte = static_cast<uint8_t>((byte & ~(0x0f << shift)) | ((codes[i * m + j] & 0x0f) << shift));
+        }
+    }
+}
+
+void build_fast_scan_table(const float* table, int m, FastScanTable* out) {
+    out->m = fast_scan_padded_m(m);
+    out->lut.assign(static_cast<size_t>(out->m) * 16, 0);
+    out->bias = 0.0f;
+    float max_range = 0.0f;
+    for (int j = 0; j < m; ++j) {
+        const float* row = table + j * 16;
+        const auto [lo, hi] = std::minmax_element(row, row + 16);
+        out->bias += *lo;
+        max_range = std::max(max_range, *hi - *lo);
+    }
+    // the widest sub-quantizer spans the full byte range
+    out->scale = max_range > 0.0f ? 255.0f / max_range : 1.0f;
+    for (int j = 0; j < m; ++j) {
+        const float* row = table + j * 16;
+        const float lo = *std::min_element(row, row + 16);
+        for (int c = 0; c < 16; ++c) {
+            const float q = std::round((row[c] - lo) * out->scale);
+            out->lut[j * 16 + c] = static_cast<uint8_t>(std::clamp(q, 0.0f, 255.0f));
+        }
+    }
+    // half a step of rounding per sub-quantizer, plus slack for float summation
+    out->error = max_range > 0.0f ? (0.5f * m + 1.0f) / out->scale : 0.0f;
+}
+
+void fast_scan_accumulate(const uint8_t* blocks, size_t nblocks, const FastScanTable& table, uint16_t* out) {
+    switch (simd_level()) {
+#ifdef DANN_FAST_SCAN_X86
+        case SimdLevel::AVX2:
+        case SimdLevel::AVX512:
+            accumulate_avx2(blocks, nblocks, table.lut.data(), table.m, out);
+            return;
+#endif
+#ifdef DANN_FAST_SCAN_NEON
+        case SimdLevel::NEON:
+            accumulate_neon(blocks, nblocks, table.lut.data(), table.m, out);
+            return;
+#endif
+        default:
+            accumulate_scalar(blocks, nblocks, table.lut.data(), table.m, out);
+    }
+}
+
+}
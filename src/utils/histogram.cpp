@@ -0,0 +1,177 @@
+//
+// Sharded counters and log-linear histograms.
+//
+
+#include "dann/histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace dann {
+
+size_t metric_shard_index() {
+    static std::atomic<size_t> next_shard{0};
+    thread_local const size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % kMetricShards;
+    return shard;
+}
+
+double ShardedCounter::value() const {
+    double total = 0.0;
+    for (const auto& shard: shards_) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void ShardedCounter::reset(double value) {
+    shards_[0].value.store(value, std::memory_order_relaxed);
+    for (size_t i = 1; i < kMetricShards; ++i) {
+        shards_[i].value.store(0.0, std::memory_order_relaxed);
+    }
+}
+
+namespace {
+void atomic_min(std::atomic<double>& target, double value) {
+    double current = target.load(std::memory_order_relaxed);
+    while (value < current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void atomic_max(std::atomic<double>& target, double value) {
+    double current = target.load(std::memory_order_relaxed);
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+}
+
+LatencyHistogram::LatencyHistogram(): shards_(new Shard[kMetricShards]) {
+    reset();
+}
+
+size_t LatencyHistogram::bucket_index(double value) {
+    if (!(value >= std::ldexp(1.0, kMinExponent))) {
+        return 0;
+    }
+    int exponent = 0;
+    const double mantissa = std::frexp(value, &exponent); // value = mantissa * 2^exponent, mantissa in [0.5, 1)
+    const int octave = exponent - 1;
+    if (octave >= kMaxExponent) {
+        return kBuckets - 1;
+    }
+    const int sub = std::min(kSubBuckets - 1, static_cast<int>((mantissa * 2.0 - 1.0) * kSubBuckets));
+    return 1 + static_cast<size_t>(octave - kMinExponent) * kSubBuckets + static_cast<size_t>(sub);
+}
+
+double LatencyHistogram::bucket_lower_bound(size_t index) {
+    if (index == 0) {
+        return 0.0;
+    }
+    if (index == kBuckets - 1) {
+        return std::ldexp(1.0, kMaxExponent);
+    }
+    const int octave = static_cast<int>((index - 1) / kSubBuckets) + kMinExponent;
+    const int sub = static_cast<int>((index - 1) % kSubBuckets);
+    return std::ldexp(1.0 + static_cast<double>(sub) / kSubBuckets, octave);
+}
+
+double LatencyHistogram::bucket_upper_bound(size_t index) {
+    if (index == 0) {
+        return std::ldexp(1.0, kMinExponent);
+    }
+    if (index == kBuckets - 1) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return bucket_lower_bound(index + 1);
+}
+
+void LatencyHistogram::record(double value) {
+    Shard& shard = shards_[metric_shard_index()];
+    shard.counts[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+    atomic_min(shard.min, value);
+    atomic_max(shard.max, value);
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const {
+    HistogramSnapshot snapshot;
+    snapshot.counts.assign(kBuckets, 0);
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    for (size_t s = 0; s < kMetricShards; ++s) {
+        const Shard& shard = shards_[s];
+        for (size_t i = 0; i < kBuckets; ++i) {
+            snapshot.counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+        }
+        snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+        min = std::min(min, shard.min.load(std::memory_order_relaxed));
+        max = std::max(max, shard.max.load(std::memory_order_relaxed));
+    }
+    // the bucket counts, not the per-shard totals, so that the two always agree
+    for (uint64_t count: snapshot.counts) {
+        snapshot.count += count;
+    }
+    if (snapshot.count > 0) {
+        snapshot.min = min;
+        snapshot.max = max;
+    }
+    return snapshot;
+}
+
+void LatencyHistogram::reset() {
+    for (size_t s = 0; s < kMetricShards; ++s) {
+        Shard& shard = shards_[s];
+        for (auto& count: shard.counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+        shard.count.store(0, std::memory_order_relaxed);
+        shard.sum.store(0.0, std::memory_order_relaxed);
+        shard.min.store(std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+        shard.max.store(-std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+    }
+}
+
+double HistogramSnapshot::percentile(double p) const {
+    if (count == 0) {
+        return 0.0;
+    }
+    const double clamped = std::clamp(p, 0.0, 100.0);
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(clamped / 100.0 * count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            const double lower = LatencyHistogram::bucket_lower_bound(i);
+            const double upper = LatencyHistogram::bucket_upper_bound(i);
+            const double mid = std::isinf(upper) ? lower : (lower + upper) / 2.0;
+            return std::clamp(mid, min, max);
+        }
+    }
+    return max;
+}
+
+uint64_t HistogramSnapshot::count_at_most(double bound) const {
+    if (count == 0) {
+        return 0;
+    }
+    if (bound >= max) {
+        return count;
+    }
+    uint64_t total = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        const double lower = LatencyHistogram::bucket_lower_bound(i);
+        const double upper = LatencyHistogram::bucket_upper_bound(i);
+        if (upper <= bound) {
+            total += counts[i];
+        } else {
+            if (lower < bound && counts[i] > 0) {
+                total += static_cast<uint64_t>(counts[i] * (bound - lower) / (upper - lower));
+            }
+            break;
+        }
+    }
+    return total;
+}
+
+} // namespace dann
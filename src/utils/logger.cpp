@@ -6,6 +6,7 @@
 #include <filesystem>
 #include <algorithm>
 #include <thread>
+#include <cstring>
 
 namespace dann {
 
@@ -25,12 +26,26 @@ Logger::Logger()
     }
     stats_.bytes_written = 0;
     stats_.file_rotations = 0;
+    stats_.dropped_messages = 0;
 }
 
 Logger::~Logger() {
     close();
 }
 
+Logger::ThreadRing::ThreadRing(size_t capacity)
+    : records(capacity), mask(capacity - 1) {
+    std::stringstream ss;
+    ss << std::this_thread::get_id();
+    thread_id = ss.str();
+}
+
+Logger::RingOwner::~RingOwner() {
+    if (ring) {
+        ring->retired.store(true, std::memory_order_release);
+    }
+}
+
 void Logger::set_level(LogLevel level) {
     level_ = level;
 }
@@ -60,6 +75,23 @@ void Logger::set_pattern(const std::string& pattern) {
     pattern_ = pattern;
 }
 
+void Logger::set_async(bool enabled, size_t ring_capacity) {
+    if (!enabled) {
+        async_ = false;
+        stop_writer();
+        return;
+    }
+    
+    // Slots are indexed with a mask
+    size_t capacity = 1;
+    while (capacity < std::max<size_t>(2, ring_capacity)) {
+        capacity <<= 1;
+    }
+    ring_capacity_ = capacity;
+    start_writer();
+    async_ = true;
+}
+
 void Logger::trace(const std::string& message) {
     if (level_ <= LogLevel::TRACE) {
         log(LogLevel::TRACE, message);
@@ -97,6 +129,11 @@ void Logger::fatal(const std::string& message) {
 }
 
 void Logger::flush() {
+    if (async_.load()) {
+        drain();
+    }
+    
+    std::lock_guard<std::mutex> lock(log_mutex_);
     if (file_stream_ && file_stream_->is_open()) {
         file_stream_->flush();
     }
@@ -106,6 +143,9 @@ void Logger::flush() {
 }
 
 void Logger::close() {
+    async_ = false;
+    stop_writer();
+    std::lock_guard<std::mutex> lock(log_mutex_);
     close_file();
     initialized_ = false;
 }
@@ -124,9 +164,20 @@ void Logger::reset_stats() {
     }
     stats_.bytes_written = 0;
     stats_.file_rotations = 0;
+    stats_.dropped_messages = 0;
 }
 
 void Logger::log(LogLevel level, const std::string& message) {
+    if (async_.load(std::memory_order_relaxed)) {
+        AsyncRecord* record = reserve_record(level);
+        if (record) {
+            const size_t length = std::min(message.size(), kAsyncRecordText - 1);
+            std::memcpy(record->text, message.data(), length);
+            commit_record(record, static_cast<int>(length));
+        }
+        return;
+    }
+    
     if (!initialized_.load()) {
         // Auto-initialize
         open_file();
@@ -145,6 +196,158 @@ void Logger::log(LogLevel level, const std::string& message) {
     update_stats(level, formatted_message.size());
 }
 
+Logger::ThreadRing& Logger::thread_ring() {
+    static thread_local RingOwner owner;
+    if (!owner.ring) {
+        owner.ring = std::make_shared<ThreadRing>(ring_capacity_.load());
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(owner.ring);
+    }
+    return *owner.ring;
+}
+
+Logger::AsyncRecord* Logger::reserve_record(LogLevel level) {
+    ThreadRing& ring = thread_ring();
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= ring.records.size()) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    
+    AsyncRecord* record = &ring.records[head & ring.mask];
+    record->level = level;
+    record->time = std::chrono::system_clock::now();
+    return record;
+}
+
+void Logger::commit_record(AsyncRecord* record, int length) {
+    // snprintf reports the untruncated length
+    record->length = static_cast<uint32_t>(std::clamp<int>(length, 0, kAsyncRecordText - 1));
+    
+    ThreadRing& ring = thread_ring();
+    ring.head.store(ring.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    
+    if (record->level == LogLevel::FATAL) {
+        flush();
+    }
+}
+
+size_t Logger::drain() {
+    std::lock_guard<std::mutex> drain_lock(drain_mutex_);
+    
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings = rings_;
+    }
+    
+    struct Pending {
+        std::chrono::system_clock::time_point time;
+        LogLevel level;
+        std::string line;
+    };
+    std::vector<Pending> pending;
+    uint64_t dropped = 0;
+    for (const auto& ring : rings) {
+        const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (uint64_t i = tail; i < head; ++i) {
+            const AsyncRecord& record = ring->records[i & ring->mask];
+            pending.push_back({record.time, record.level,
+                               format_message(record.level, std::string(record.text, record.length),
+                                              record.time, ring->thread_id)});
+        }
+        ring->tail.store(head, std::memory_order_release);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+    
+    // Forget the rings of exited threads once they are empty
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const std::shared_ptr<ThreadRing>& ring) {
+            return ring->retired.load(std::memory_order_acquire) &&
+                   ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+        }), rings_.end());
+    }
+    
+    if (pending.empty() && dropped == 0) {
+        return 0;
+    }
+    
+    // Threads drain in turn; put the batch back in time order
+    std::stable_sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) {
+        return a.time < b.time;
+    });
+    
+    std::string file_batch;
+    std::string out_batch;
+    std::string err_batch;
+    for (const auto& record : pending) {
+        file_batch.append(record.line).push_back('\n');
+        if (console_output_) {
+            std::string& console = record.level <= LogLevel::INFO ? out_batch : err_batch;
+            console.append(record.line).push_back('\n');
+        }
+    }
+    
+    if (!output_file_.empty() && !pending.empty()) {
+        std::lock_guard<std::mutex> lock(log_mutex_);
+        if (!file_stream_ || !file_stream_->is_open()) {
+            open_file();
+        }
+        if (file_stream_ && file_stream_->is_open()) {
+            file_stream_->write(file_batch.data(), file_batch.size());
+            file_stream_->flush();
+            rotate_file_if_needed();
+        }
+    }
+    if (!out_batch.empty()) {
+        std::cout << out_batch << std::flush;
+    }
+    if (!err_batch.empty()) {
+        std::cerr << err_batch << std::flush;
+    }
+    
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    for (const auto& record : pending) {
+        stats_.total_messages++;
+        stats_.messages_by_level[static_cast<int>(record.level)]++;
+        stats_.bytes_written += record.line.size();
+    }
+    stats_.dropped_messages += dropped;
+    return pending.size();
+}
+
+void Logger::start_writer() {
+    if (writer_thread_.joinable()) {
+        return;
+    }
+    writer_stop_ = false;
+    writer_thread_ = std::thread([this] {
+        std::unique_lock<std::mutex> lock(writer_mutex_);
+        while (!writer_stop_) {
+            // producers never signal; a short poll keeps them wait-free
+            writer_cv_.wait_for(lock, std::chrono::milliseconds(2), [this] { return writer_stop_; });
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    });
+}
+
+void Logger::stop_writer() {
+    if (!writer_thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        writer_stop_ = true;
+    }
+    writer_cv_.notify_one();
+    writer_thread_.join();
+    drain();
+}
+
 void Logger::write_to_file(LogLevel level, const std::string& formatted_message) {
     if (!output_file_.empty()) {
         std::lock_guard<std::mutex> lock(log_mutex_);
@@ -183,15 +386,19 @@ void Logger::rotate_file_if_needed() {
 }
 
 std::string Logger::format_message(LogLevel level, const std::string& message) {
+    return format_message(level, message, std::chrono::system_clock::now(), get_thread_id());
+}
+
+std::string Logger::format_message(LogLevel level, const std::string& message,
+                                   std::chrono::system_clock::time_point time, const std::string& thread_id) {
     std::string formatted = pattern_;
+    auto time_t = std::chrono::system_clock::to_time_t(time);
+    std::tm tm{};
+    localtime_r(&time_t, &tm);
     
     // Replace placeholders
     size_t pos = formatted.find("%Y");
     if (pos != std::string::npos) {
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        std::tm tm = *std::localtime(&time_t);
-        
         char buffer[256];
         std::strftime(buffer, sizeof(buffer), "%Y", &tm);
         formatted.replace(pos, 2, buffer);
@@ -199,10 +406,6 @@ std::string Logger::format_message(LogLevel level, const std::string& message) {
     
     pos = formatted.find("%m");
     if (pos != std::string::npos) {
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        std::tm tm = *std::localtime(&time_t);
-        
         char buffer[256];
         std::strftime(buffer, sizeof(buffer), "%m", &tm);
         formatted.replace(pos, 2, buffer);
@@ -210,10 +413,6 @@ std::string Logger::format_message(LogLevel level, const std::string& message) {
     
     pos = formatted.find("%d");
     if (pos != std::string::npos) {
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        std::tm tm = *std::localtime(&time_t);
-        
         char buffer[256];
         std::strftime(buffer, sizeof(buffer), "%d", &tm);
         formatted.replace(pos, 2, buffer);
@@ -221,10 +420,6 @@ std::string Logger::format_message(LogLevel level, const std::string& message) {
     
     pos = formatted.find("%H");
     if (pos != std::string::npos) {
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        std::tm tm = *std::localtime(&time_t);
-        
         char buffer[256];
         std::strftime(buffer, sizeof(buffer), "%H", &tm);
         formatted.replace(pos, 2, buffer);
@@ -232,10 +427,6 @@ std::string Logger::format_message(LogLevel level, const std::string& message) {
     
     pos = formatted.find("%M");
     if (pos != std::string::npos) {
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        std::tm tm = *std::localtime(&time_t);
-        
         char buffer[256];
         std::strftime(buffer, sizeof(buffer), "%M", &tm);
         formatted.replace(pos, 2, buffer);
@@ -243,10 +434,6 @@ std::string Logger::format_message(LogLevel level, const std::string& message) {
     
     pos = formatted.find("%S");
     if (pos != std::string::npos) {
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        std::tm tm = *std::localtime(&time_t);
-        
         char buffer[256];
         std::strftime(buffer, sizeof(buffer), "%S", &tm);
         formatted.replace(pos, 2, buffer);
@@ -264,7 +451,7 @@ std::string Logger::format_message(LogLevel level, const std::string& message) {
     
     pos = formatted.find("%t");
     if (pos != std::string::npos) {
-        formatted.replace(pos, 2, get_thread_id());
+        formatted.replace(pos, 2, thread_id);
     }
     
     return formatted;
@@ -4,15 +4,45 @@
 #include <chrono>
 #include <sstream>
 #include <iomanip>
+#include <set>
 
 namespace dann {
 
+namespace {
+// per-thread name -> handle caches, so recording takes no lock once a name is known
+struct RegistryCache {
+    uint64_t generation = 0;
+    std::unordered_map<std::string, std::shared_ptr<ShardedCounter>> counters;
+    std::unordered_map<std::string, std::shared_ptr<LatencyHistogram>> histograms;
+};
+
+thread_local RegistryCache registry_cache;
+
+// "name{a=\"b\"}" -> ("name", "a=\"b\"")
+std::pair<std::string, std::string> split_labeled_name(const std::string& name) {
+    const size_t brace = name.find('{');
+    if (brace == std::string::npos || name.back() != '}') {
+        return {name, ""};
+    }
+    return {name.substr(0, brace), name.substr(brace + 1, name.size() - brace - 2)};
+}
+
+std::string with_label(const std::string& base, const std::string& suffix, const std::string& labels,
+                       const std::string& extra = "") {
+    std::string all = labels;
+    if (!extra.empty()) {
+        all += all.empty() ? extra : "," + extra;
+    }
+    return base + suffix + (all.empty() ? "" : "{" + all + "}");
+}
+}
+
 Metrics& Metrics::instance() {
     static Metrics instance;
     return instance;
 }
 
-Metrics::Metrics() : max_histogram_samples_(10000) {
+Metrics::Metrics() : max_histogram_samples_(10000), registry_generation_(1), has_alerts_(false) {
     // Initialize with default histogram buckets
     histogram_buckets_ = {0.1, 0.5, 1.0, 2.5, 5.0, 10.0, 25.0, 50.0, 100.0, 250.0, 500.0, 1000.0, 2500.0, 5000.0, 10000.0};
     
@@ -26,26 +56,24 @@ Metrics::Metrics() : max_histogram_samples_(10000) {
 Metrics::~Metrics() = default;
 
 void Metrics::increment_counter(const std::string& name, double value) {
-    update_metric(name, MetricType::COUNTER, value);
+    ShardedCounter& counter = cached_counter(name);
+    counter.add(value);
+    if (has_alerts_.load(std::memory_order_relaxed)) {
+        check_alerts(name, counter.value());
+    }
 }
 
 void Metrics::decrement_counter(const std::string& name, double value) {
-    update_metric(name, MetricType::COUNTER, -value);
+    increment_counter(name, -value);
 }
 
 void Metrics::set_counter(const std::string& name, double value) {
-    update_metric(name, MetricType::COUNTER, value);
+    cached_counter(name).reset(value);
 }
 
 double Metrics::get_counter(const std::string& name) const {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
-    
-    auto it = metrics_.find(name);
-    if (it != metrics_.end() && it->second.type == MetricType::COUNTER) {
-        return it->second.value;
-    }
-    
-    return 0.0;
+    auto counter = find_counter(name);
+    return counter ? counter->value() : 0.0;
 }
 
 void Metrics::set_gauge(const std::string& name, double value) {
@@ -64,78 +92,71 @@ double Metrics::get_gauge(const std::string& name) const {
 }
 
 void Metrics::record_histogram(const std::string& name, double value) {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
-    
-    auto it = metrics_.find(name);
-    if (it == metrics_.end()) {
-        metrics_[name] = MetricData(MetricType::HISTOGRAM);
-        it = metrics_.find(name);
-    }
-    
-    if (it->second.type == MetricType::HISTOGRAM) {
-        add_histogram_sample(it->second, value);
-    }
+    cached_histogram(name).record(value);
 }
 
 std::vector<double> Metrics::get_histogram_values(const std::string& name) const {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    HistogramSnapshot snapshot = get_histogram_snapshot(name);
     
-    auto it = metrics_.find(name);
-    if (it != metrics_.end() && it->second.type == MetricType::HISTOGRAM) {
-        return it->second.histogram_values;
+    std::vector<double> values;
+    values.reserve(std::min<uint64_t>(snapshot.count, max_histogram_samples_));
+    for (size_t i = 0; i < snapshot.counts.size() && values.size() < max_histogram_samples_; ++i) {
+        if (snapshot.counts[i] == 0) {
+            continue;
+        }
+        const double lower = LatencyHistogram::bucket_lower_bound(i);
+        const double upper = LatencyHistogram::bucket_upper_bound(i);
+        const double mid = std::clamp(std::isinf(upper) ? lower : (lower + upper) / 2.0, snapshot.min, snapshot.max);
+        const uint64_t n = std::min<uint64_t>(snapshot.counts[i], max_histogram_samples_ - values.size());
+        values.insert(values.end(), n, mid);
     }
     
-    return {};
+    return values;
 }
 
 double Metrics::get_histogram_percentile(const std::string& name, double percentile) const {
-    auto values = get_histogram_values(name);
-    if (values.empty()) {
-        return 0.0;
-    }
-    
-    std::sort(values.begin(), values.end());
-    
-    size_t index = static_cast<size_t>(percentile / 100.0 * values.size());
-    if (index >= values.size()) {
-        index = values.size() - 1;
-    }
-    
-    return values[index];
+    return get_histogram_snapshot(name).percentile(percentile);
 }
 
 double Metrics::get_histogram_mean(const std::string& name) const {
-    auto values = get_histogram_values(name);
-    if (values.empty()) {
-        return 0.0;
-    }
-    
-    double sum = 0.0;
-    for (double value : values) {
-        sum += value;
-    }
-    
-    return sum / values.size();
+    return get_histogram_snapshot(name).mean();
 }
 
 double Metrics::get_histogram_sum(const std::string& name) const {
-    auto values = get_histogram_values(name);
-    double sum = 0.0;
-    for (double value : values) {
-        sum += value;
-    }
-    return sum;
+    return get_histogram_snapshot(name).sum;
 }
 
 uint64_t Metrics::get_histogram_count(const std::string& name) const {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
-    
-    auto it = metrics_.find(name);
-    if (it != metrics_.end() && it->second.type == MetricType::HISTOGRAM) {
-        return it->second.histogram_values.size();
+    return get_histogram_snapshot(name).count;
+}
+
+HistogramSnapshot Metrics::get_histogram_snapshot(const std::string& name) const {
+    auto histogram = find_histogram(name);
+    return histogram ? histogram->snapshot() : HistogramSnapshot{};
+}
+
+std::shared_ptr<ShardedCounter> Metrics::counter(const std::string& name) {
+    if (auto existing = find_counter(name)) {
+        return existing;
     }
-    
-    return 0;
+    std::unique_lock<std::shared_mutex> lock(registry_mutex_);
+    auto& slot = counters_[name];
+    if (!slot) {
+        slot = std::make_shared<ShardedCounter>();
+    }
+    return slot;
+}
+
+std::shared_ptr<LatencyHistogram> Metrics::histogram(const std::string& name) {
+    if (auto existing = find_histogram(name)) {
+        return existing;
+    }
+    std::unique_lock<std::shared_mutex> lock(registry_mutex_);
+    auto& slot = histograms_[name];
+    if (!slot) {
+        slot = std::make_shared<LatencyHistogram>();
+    }
+    return slot;
 }
 
 std::unique_ptr<Metrics::Timer> Metrics::start_timer(const std::string& name) {
@@ -146,7 +167,7 @@ void Metrics::increment_counter_with_labels(const std::string& name,
                                          const std::unordered_map<std::string, std::string>& labels,
                                          double value) {
     std::string labeled_name = name + format_labels(labels);
-    update_metric(labeled_name, MetricType::COUNTER, value);
+    increment_counter(labeled_name, value);
 }
 
 void Metrics::set_gauge_with_labels(const std::string& name,
@@ -164,20 +185,41 @@ void Metrics::record_histogram_with_labels(const std::string& name,
 }
 
 void Metrics::remove_metric(const std::string& name) {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
-    metrics_.erase(name);
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        metrics_.erase(name);
+    }
+    std::unique_lock<std::shared_mutex> lock(registry_mutex_);
+    counters_.erase(name);
+    histograms_.erase(name);
+    registry_generation_.fetch_add(1);
 }
 
 void Metrics::clear_all_metrics() {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
-    metrics_.clear();
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        metrics_.clear();
+    }
+    std::unique_lock<std::shared_mutex> lock(registry_mutex_);
+    counters_.clear();
+    histograms_.clear();
+    registry_generation_.fetch_add(1);
 }
 
 std::vector<std::string> Metrics::get_metric_names() const {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
-    
     std::vector<std::string> names;
-    for (const auto& pair : metrics_) {
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        for (const auto& pair : metrics_) {
+            names.push_back(pair.first);
+        }
+    }
+    
+    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    for (const auto& pair : counters_) {
+        names.push_back(pair.first);
+    }
+    for (const auto& pair : histograms_) {
         names.push_back(pair.first);
     }
     
@@ -185,56 +227,54 @@ std::vector<std::string> Metrics::get_metric_names() const {
 }
 
 std::string Metrics::export_prometheus() const {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
-    
     std::stringstream ss;
+    std::set<std::string> typed;
+    auto type_line = [&ss, &typed](const std::string& base, const char* type) {
+        if (typed.insert(base).second) {
+            ss << "# TYPE " << base << " " << type << "\n";
+        }
+    };
     
-    for (const auto& pair : metrics_) {
-        const std::string& name = pair.first;
-        const MetricData& data = pair.second;
-        
-        // Add metric type
-        switch (data.type) {
-            case MetricType::COUNTER:
-                ss << "# TYPE " << name << " counter\n";
-                ss << name << " " << data.value << "\n";
-                break;
-                
-            case MetricType::GAUGE:
-                ss << "# TYPE " << name << " gauge\n";
-                ss << name << " " << data.value << "\n";
-                break;
-                
-            case MetricType::HISTOGRAM:
-                ss << "# TYPE " << name << " histogram\n";
-                
-                // Add bucket counts
-                std::vector<double> sorted_values = data.histogram_values;
-                std::sort(sorted_values.begin(), sorted_values.end());
-                
-                for (double bucket : histogram_buckets_) {
-                    uint64_t count = 0;
-                    for (double value : sorted_values) {
-                        if (value <= bucket) {
-                            count++;
-                        }
-                    }
-                    ss << name << "_bucket{le=\"" << bucket << "\"} " << count << "\n";
-                }
-                
-                // Add +Inf bucket (total count)
-                ss << name << "_bucket{le=\"+Inf\"} " << sorted_values.size() << "\n";
-                
-                // Add sum and count
-                double sum = 0.0;
-                for (double value : sorted_values) {
-                    sum += value;
-                }
-                ss << name << "_sum " << sum << "\n";
-                ss << name << "_count " << sorted_values.size() << "\n";
-                break;
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        for (const auto& pair : metrics_) {
+            type_line(split_labeled_name(pair.first).first, "gauge");
+            ss << pair.first << " " << pair.second.value << "\n\n";
         }
+    }
+    
+    // Copy the handles out so that merging never holds up registration
+    std::vector<std::pair<std::string, std::shared_ptr<ShardedCounter>>> counters;
+    std::vector<std::pair<std::string, std::shared_ptr<LatencyHistogram>>> histograms;
+    std::vector<double> buckets;
+    {
+        std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+        counters.assign(counters_.begin(), counters_.end());
+        histograms.assign(histograms_.begin(), histograms_.end());
+    }
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        buckets = histogram_buckets_;
+    }
+    
+    for (const auto& [name, counter] : counters) {
+        type_line(split_labeled_name(name).first, "counter");
+        ss << name << " " << counter->value() << "\n\n";
+    }
+    
+    for (const auto& [name, histogram] : histograms) {
+        const auto [base, labels] = split_labeled_name(name);
+        type_line(base, "histogram");
         
+        const HistogramSnapshot snapshot = histogram->snapshot();
+        for (double bucket : buckets) {
+            std::ostringstream le;
+            le << "le=\"" << bucket << "\"";
+            ss << with_label(base, "_bucket", labels, le.str()) << " " << snapshot.count_at_most(bucket) << "\n";
+        }
+        ss << with_label(base, "_bucket", labels, "le=\"+Inf\"") << " " << snapshot.count << "\n";
+        ss << with_label(base, "_sum", labels) << " " << snapshot.sum << "\n";
+        ss << with_label(base, "_count", labels) << " " << snapshot.count << "\n";
         ss << "\n";
     }
     
@@ -242,46 +282,48 @@ std::string Metrics::export_prometheus() const {
 }
 
 std::string Metrics::export_json() const {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    const uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
     
     std::stringstream ss;
     ss << "{\n";
     ss << "  \"metrics\": {\n";
     
     bool first = true;
-    for (const auto& pair : metrics_) {
+    auto open_entry = [&](const std::string& name, const char* type) {
         if (!first) {
             ss << ",\n";
         }
         first = false;
-        
-        const std::string& name = pair.first;
-        const MetricData& data = pair.second;
-        
         ss << "    \"" << name << "\": {\n";
-        ss << "      \"type\": ";
-        
-        switch (data.type) {
-            case MetricType::COUNTER:
-                ss << "\"counter\"";
-                break;
-            case MetricType::GAUGE:
-                ss << "\"gauge\"";
-                break;
-            case MetricType::HISTOGRAM:
-                ss << "\"histogram\"";
-                break;
+        ss << "      \"type\": \"" << type << "\",\n";
+    };
+    
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        for (const auto& pair : metrics_) {
+            open_entry(pair.first, "gauge");
+            ss << "      \"value\": " << pair.second.value << ",\n";
+            ss << "      \"timestamp\": " << pair.second.last_updated;
+            ss << "\n    }";
         }
-        
-        ss << ",\n";
-        ss << "      \"value\": " << data.value << ",\n";
-        ss << "      \"timestamp\": " << data.last_updated;
-        
-        if (data.type == MetricType::HISTOGRAM) {
-            ss << ",\n";
-            ss << "      \"samples\": " << data.histogram_values.size();
-        }
-        
+    }
+    
+    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    for (const auto& [name, counter] : counters_) {
+        open_entry(name, "counter");
+        ss << "      \"value\": " << counter->value() << ",\n";
+        ss << "      \"timestamp\": " << now_ms;
+        ss << "\n    }";
+    }
+    for (const auto& [name, histogram] : histograms_) {
+        const HistogramSnapshot snapshot = histogram->snapshot();
+        open_entry(name, "histogram");
+        ss << "      \"value\": " << snapshot.mean() << ",\n";
+        ss << "      \"timestamp\": " << now_ms << ",\n";
+        ss << "      \"samples\": " << snapshot.count << ",\n";
+        ss << "      \"p50\": " << snapshot.percentile(50) << ",\n";
+        ss << "      \"p99\": " << snapshot.percentile(99);
         ss << "\n    }";
     }
     
@@ -293,15 +335,26 @@ std::string Metrics::export_json() const {
 
 std::string Metrics::export_influxdb() const {
     // InfluxDB line protocol format
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    const uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
     
     std::stringstream ss;
     
-    for (const auto& pair : metrics_) {
-        const std::string& name = pair.first;
-        const MetricData& data = pair.second;
-        
-        ss << name << " value=" << data.value << " " << data.last_updated << "\n";
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        for (const auto& pair : metrics_) {
+            ss << pair.first << " value=" << pair.second.value << " " << pair.second.last_updated << "\n";
+        }
+    }
+    
+    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    for (const auto& [name, counter] : counters_) {
+        ss << name << " value=" << counter->value() << " " << now_ms << "\n";
+    }
+    for (const auto& [name, histogram] : histograms_) {
+        const HistogramSnapshot snapshot = histogram->snapshot();
+        ss << name << " count=" << snapshot.count << ",sum=" << snapshot.sum
+           << ",p50=" << snapshot.percentile(50) << ",p99=" << snapshot.percentile(99) << " " << now_ms << "\n";
     }
     
     return ss.str();
@@ -321,42 +374,44 @@ void Metrics::set_max_histogram_samples(size_t max_samples) {
 }
 
 std::vector<Metrics::MetricSnapshot> Metrics::get_snapshot() const {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    const uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
     
     std::vector<MetricSnapshot> snapshot;
     
-    for (const auto& pair : metrics_) {
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        for (const auto& pair : metrics_) {
+            MetricSnapshot snap;
+            snap.name = pair.first;
+            snap.type = "gauge";
+            snap.labels = pair.second.labels;
+            snap.timestamp_ms = pair.second.last_updated;
+            snap.values["value"] = pair.second.value;
+            snapshot.push_back(snap);
+        }
+    }
+    
+    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    for (const auto& [name, counter] : counters_) {
         MetricSnapshot snap;
-        snap.name = pair.first;
-        snap.labels = pair.second.labels;
-        snap.timestamp_ms = pair.second.last_updated;
-        
-        switch (pair.second.type) {
-            case MetricType::COUNTER:
-                snap.type = "counter";
-                snap.values["value"] = pair.second.value;
-                break;
-                
-            case MetricType::GAUGE:
-                snap.type = "gauge";
-                snap.values["value"] = pair.second.value;
-                break;
-                
-            case MetricType::HISTOGRAM:
-                snap.type = "histogram";
-                snap.values["count"] = static_cast<double>(pair.second.histogram_values.size());
-                
-                if (!pair.second.histogram_values.empty()) {
-                    double sum = 0.0;
-                    for (double value : pair.second.histogram_values) {
-                        sum += value;
-                    }
-                    snap.values["sum"] = sum;
-                    snap.values["mean"] = sum / pair.second.histogram_values.size();
-                }
-                break;
+        snap.name = name;
+        snap.type = "counter";
+        snap.timestamp_ms = now_ms;
+        snap.values["value"] = counter->value();
+        snapshot.push_back(snap);
+    }
+    for (const auto& [name, histogram] : histograms_) {
+        const HistogramSnapshot merged = histogram->snapshot();
+        MetricSnapshot snap;
+        snap.name = name;
+        snap.type = "histogram";
+        snap.timestamp_ms = now_ms;
+        snap.values["count"] = static_cast<double>(merged.count);
+        if (merged.count > 0) {
+            snap.values["sum"] = merged.sum;
+            snap.values["mean"] = merged.mean();
         }
-        
         snapshot.push_back(snap);
     }
     
@@ -364,51 +419,60 @@ std::vector<Metrics::MetricSnapshot> Metrics::get_snapshot() const {
 }
 
 void Metrics::restore_snapshot(const std::vector<MetricSnapshot>& snapshot) {
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
-    
     for (const auto& snap : snapshot) {
-        MetricType type;
+        auto value_it = snap.values.find("value");
+        const double value = value_it != snap.values.end() ? value_it->second : 0.0;
+        
         if (snap.type == "counter") {
-            type = MetricType::COUNTER;
+            counter(snap.name)->reset(value);
         } else if (snap.type == "gauge") {
-            type = MetricType::GAUGE;
+            std::lock_guard<std::mutex> lock(metrics_mutex_);
+            MetricData data(MetricType::GAUGE);
+            data.labels = snap.labels;
+            data.timestamp_ms = snap.timestamp_ms;
+            data.value = value;
+            metrics_[snap.name] = data;
         } else if (snap.type == "histogram") {
-            type = MetricType::HISTOGRAM;
-        } else {
-            continue;
-        }
-        
-        MetricData data(type);
-        data.labels = snap.labels;
-        data.timestamp_ms = snap.timestamp_ms;
-        
-        auto value_it = snap.values.find("value");
-        if (value_it != snap.values.end()) {
-            data.value = value_it->second;
-        }
-        
-        if (type == MetricType::HISTOGRAM) {
-            // Histogram samples are not fully restored in this simplified version
-            // In a real implementation, you might store and restore full sample data
+            // Bucket counts are not part of a snapshot; the histogram starts empty
+            histogram(snap.name);
         }
-        
-        metrics_[snap.name] = data;
     }
 }
 
 void Metrics::set_alert_threshold(const std::string& metric_name, double threshold, AlertCallback callback) {
     std::lock_guard<std::mutex> lock(alerts_mutex_);
     alert_thresholds_[metric_name] = std::make_pair(threshold, callback);
+    has_alerts_ = true;
 }
 
 void Metrics::remove_alert_threshold(const std::string& metric_name) {
     std::lock_guard<std::mutex> lock(alerts_mutex_);
     alert_thresholds_.erase(metric_name);
+    has_alerts_ = !alert_thresholds_.empty();
 }
 
 Metrics::MetricsStats Metrics::get_stats() const {
-    std::lock_guard<std::mutex> lock(stats_mutex_);
-    return stats_;
+    MetricsStats stats;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats = stats_;
+    }
+    
+    // Counters and histograms keep no per-update bookkeeping; count them here
+    uint64_t histogram_samples = 0;
+    uint64_t registry_metrics = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+        registry_metrics = counters_.size() + histograms_.size();
+        for (const auto& pair : histograms_) {
+            histogram_samples += pair.second->snapshot().count;
+        }
+    }
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    stats.total_metrics = metrics_.size() + registry_metrics;
+    stats.total_samples += histogram_samples;
+    stats.memory_usage_bytes = estimate_memory_usage();
+    return stats;
 }
 
 void Metrics::reset_stats() {
@@ -424,41 +488,72 @@ void Metrics::update_metric(const std::string& name, MetricType type, double val
                           const std::unordered_map<std::string, std::string>& labels) {
     auto start_time = std::chrono::high_resolution_clock::now();
     
-    std::lock_guard<std::mutex> lock(metrics_mutex_);
-    
-    auto it = metrics_.find(name);
-    if (it == metrics_.end()) {
-        metrics_[name] = MetricData(type);
-        it = metrics_.find(name);
-    }
-    
-    if (it->second.type != type) {
-        // Type mismatch, replace with new type
-        metrics_[name] = MetricData(type);
-        it = metrics_.find(name);
-    }
-    
-    it->second.labels = labels;
-    it->second.last_updated = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
-    
-    switch (type) {
-        case MetricType::COUNTER:
-            it->second.value += value;
-            break;
-        case MetricType::GAUGE:
-            it->second.value = value;
-            break;
-        case MetricType::HISTOGRAM:
-            add_histogram_sample(it->second, value);
-            break;
+    double current;
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        
+        auto it = metrics_.find(name);
+        if (it == metrics_.end() || it->second.type != type) {
+            metrics_[name] = MetricData(type);
+            it = metrics_.find(name);
+        }
+        
+        it->second.labels = labels;
+        it->second.last_updated = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        it->second.value = value;
+        current = it->second.value;
     }
     
     auto end_time = std::chrono::high_resolution_clock::now();
     auto update_time = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
     
     update_stats(update_time.count());
-    check_alerts(name, it->second.value);
+    if (has_alerts_.load(std::memory_order_relaxed)) {
+        check_alerts(name, current);
+    }
+}
+
+ShardedCounter& Metrics::cached_counter(const std::string& name) {
+    RegistryCache& cache = registry_cache;
+    const uint64_t generation = registry_generation_.load(std::memory_order_acquire);
+    if (cache.generation != generation) {
+        cache.counters.clear();
+        cache.histograms.clear();
+        cache.generation = generation;
+    }
+    auto it = cache.counters.find(name);
+    if (it == cache.counters.end()) {
+        it = cache.counters.emplace(name, counter(name)).first;
+    }
+    return *it->second;
+}
+
+LatencyHistogram& Metrics::cached_histogram(const std::string& name) {
+    RegistryCache& cache = registry_cache;
+    const uint64_t generation = registry_generation_.load(std::memory_order_acquire);
+    if (cache.generation != generation) {
+        cache.counters.clear();
+        cache.histograms.clear();
+        cache.generation = generation;
+    }
+    auto it = cache.histograms.find(name);
+    if (it == cache.histograms.end()) {
+        it = cache.histograms.emplace(name, histogram(name)).first;
+    }
+    return *it->second;
+}
+
+std::shared_ptr<ShardedCounter> Metrics::find_counter(const std::string& name) const {
+    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    auto it = counters_.find(name);
+    return it != counters_.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<LatencyHistogram> Metrics::find_histogram(const std::string& name) const {
+    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    auto it = histograms_.find(name);
+    return it != histograms_.end() ? it->second : nullptr;
 }
 
 void Metrics::check_alerts(const std::string& name, double value) {
@@ -509,29 +604,14 @@ std::string Metrics::escape_prometheus_label(const std::string& label) const {
     return escaped;
 }
 
-void Metrics::add_histogram_sample(MetricData& data, double value) {
-    data.histogram_values.push_back(value);
-    
-    // Limit the number of samples to prevent memory growth
-    if (data.histogram_values.size() > max_histogram_samples_) {
-        // Remove oldest samples (simple FIFO)
-        data.histogram_values.erase(data.histogram_values.begin(), 
-                                 data.histogram_values.begin() + (data.histogram_values.size() - max_histogram_samples_));
-    }
-}
-
 void Metrics::update_stats(double update_time_us) {
     std::lock_guard<std::mutex> lock(stats_mutex_);
     
-    stats_.total_metrics = metrics_.size();
     stats_.total_samples++;
     
     // Update average update time
     double total_time = stats_.avg_update_time_us * (stats_.total_samples - 1);
     stats_.avg_update_time_us = (total_time + update_time_us) / stats_.total_samples;
-    
-    // Estimate memory usage (simplified)
-    stats_.memory_usage_bytes = estimate_memory_usage();
 }
 
 uint64_t Metrics::estimate_memory_usage() const {
@@ -541,15 +621,17 @@ uint64_t Metrics::estimate_memory_usage() const {
         // Base metric data
         usage += sizeof(MetricData);
         
-        // Histogram samples
-        usage += pair.second.histogram_values.size() * sizeof(double);
-        
         // Labels
         for (const auto& label : pair.second.labels) {
             usage += label.first.size() + label.second.size();
         }
     }
     
+    // Counters and histograms; the caller holds metrics_mutex_, not registry_mutex_
+    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    usage += counters_.size() * sizeof(ShardedCounter);
+    usage += histograms_.size() * kMetricShards * sizeof(std::atomic<uint64_t>) * LatencyHistogram::kBuckets;
+    
     return usage;
 }
 
@@ -571,7 +653,7 @@ void Metrics::Timer::stop() {
     }
     
     auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time_);
+    std::chrono::duration<double, std::milli> duration = end_time - start_time_;
     
     Metrics::instance().record_histogram(name_ + "_duration_ms", duration.count());
     stopped_ = true;
@@ -579,7 +661,7 @@ void Metrics::Timer::stop() {
 
 double Metrics::Timer::elapsed_ms() const {
     auto current_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time_);
+    std::chrono::duration<double, std::milli> duration = current_time - start_time_;
     return duration.count();
 }
 
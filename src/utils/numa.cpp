@@ -0,0 +1,186 @@
+//
+// NUMA topology, memory placement and thread pinning.
+//
+#include "dann/numa.h"
+
+#include "dann/logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace dann {
+
+namespace {
+// below this an allocation is not worth its own mapping
+constexpr size_t kNumaMinBytes = 64 * 1024;
+#ifdef __linux__
+constexpr int kMpolPreferred = 1;
+#endif
+
+// "0-3,8,10-11" as written in sysfs cpulist files
+std::vector<int> parse_cpu_list(const std::string& text) {
+    std::vector<int> cpus;
+    std::stringstream in(text);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        try {
+            const int lo = std::stoi(range.substr(0, dash));
+            const int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+            for (int cpu = lo; cpu <= hi; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception&) {
+            return {};
+        }
+    }
+    return cpus;
+}
+
+std::string read_line(const std::filesystem::path& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+struct Topology {
+    std::vector<int> nodes;
+    std::map<int, std::vector<int>> cpus;
+    std::vector<int> all_cpus;
+};
+
+const Topology& topology() {
+    static const Topology topo = [] {
+        Topology t;
+        t.all_cpus = parse_cpu_list(read_line("/sys/devices/system/cpu/online"));
+        if (t.all_cpus.empty()) {
+            const unsigned n = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned cpu = 0; cpu < n; ++cpu) {
+                t.all_cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+        std::error_code ec;
+        for (const auto& entry: std::filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+            const std::string name = entry.path().filename().string();
+            if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+                !std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+                continue;
+            }
+            std::vector<int> cpus = parse_cpu_list(read_line(entry.path() / "cpulist"));
+            if (cpus.empty()) {
+                continue; // memory-only node
+            }
+            const int node = std::stoi(name.substr(4));
+            t.nodes.push_back(node);
+            t.cpus[node] = std::move(cpus);
+        }
+        if (t.nodes.empty()) {
+            t.nodes.push_back(0);
+            t.cpus[0] = t.all_cpus;
+        }
+        std::sort(t.nodes.begin(), t.nodes.end());
+        return t;
+    }();
+    return topo;
+}
+}
+
+const std::vector<int>& numa_nodes() {
+    return topology().nodes;
+}
+
+const std::vector<int>& numa_node_cpus(int node) {
+    const Topology& t = topology();
+    auto it = t.cpus.find(node);
+    return it == t.cpus.end() ? t.all_cpus : it->second;
+}
+
+int current_numa_node() {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 && topology().cpus.count(static_cast<int>(node)) != 0) {
+        return static_cast<int>(node);
+    }
+#endif
+    return numa_nodes().front();
+}
+
+bool pin_thread_to_numa_node(int node) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu: numa_node_cpus(node)) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void) node;
+    return false;
+#endif
+}
+
+void* numa_allocate(size_t bytes, size_t alignment, int node) {
+#ifdef __linux__
+    if (node >= 0 && bytes >= kNumaMinBytes) {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t length = (bytes + page - 1) / page * page;
+        void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        // the pages are not touched yet, so the policy decides where they fault in
+        std::vector<unsigned long> mask(static_cast<size_t>(node) / (8 * sizeof(unsigned long)) + 1, 0);
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        const unsigned long max_node = mask.size() * 8 * sizeof(unsigned long) + 1;
+        if (syscall(SYS_mbind, p, length, kMpolPreferred, mask.data(), max_node, 0) != 0) {
+            static std::atomic<bool> warned{false};
+            if (!warned.exchange(true)) {
+                LOG_WARNF("mbind to numa node %d failed, memory stays where first touched", node);
+            }
+        }
+        return p;
+    }
+#else
+    (void) node;
+#endif
+    return ::operator new(bytes, std::align_val_t(alignment));
+}
+
+void numa_free(void* p, size_t bytes, size_t alignment, int node) {
+    if (!p) {
+        return;
+    }
+#ifdef __linux__
+    if (node >= 0 && bytes >= kNumaMinBytes) {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        munmap(p, (bytes + page - 1) / page * page);
+        return;
+    }
+#else
+    (void) node;
+#endif
+    ::operator delete(p, std::align_val_t(alignment));
+}
+
+}
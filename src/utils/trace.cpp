@@ -0,0 +1,162 @@
+//
+// Trace span capture and Chrome trace export.
+//
+
+#include "dann/trace.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <unistd.h>
+
+namespace dann {
+
+namespace {
+
+void append_json_string(std::string& out, const char* s) {
+    out += '"';
+    for (; *s != '\0'; ++s) {
+        const char c = *s;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// nanoseconds as the microseconds Chrome trace expects, keeping ns precision
+void append_us(std::string& out, uint64_t ns) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%llu.%03llu", static_cast<unsigned long long>(ns / 1000),
+                  static_cast<unsigned long long>(ns % 1000));
+    out += text;
+}
+
+} // namespace
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::BufferOwner::~BufferOwner() {
+    if (buffer) {
+        buffer->retired.store(true, std::memory_order_release);
+    }
+}
+
+Tracer::ThreadBuffer& Tracer::thread_buffer() {
+    static thread_local BufferOwner owner;
+    if (!owner.buffer) {
+        owner.buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        owner.buffer->tid = next_tid_++;
+        buffers_.push_back(owner.buffer);
+    }
+    return *owner.buffer;
+}
+
+bool Tracer::start(size_t max_events_per_thread) {
+    std::lock_guard<std::mutex> capture_lock(capture_mutex_);
+    if (active_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    {
+        // buffers of exited threads were read by the last stop()
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(), [](const std::shared_ptr<ThreadBuffer>& buffer) {
+            return buffer->retired.load(std::memory_order_acquire);
+        }), buffers_.end());
+    }
+    capacity_.store(std::max<size_t>(max_events_per_thread, 1), std::memory_order_relaxed);
+    capture_start_ns_.store(now_ns(), std::memory_order_relaxed);
+    generation_.fetch_add(1, std::memory_order_release);
+    active_.store(true, std::memory_order_release);
+    return true;
+}
+
+void Tracer::record(const char* name, const char* category, uint64_t start_ns, uint64_t end_ns) {
+    const uint64_t generation = generation_.load(std::memory_order_acquire);
+    // began before this capture, under an earlier one
+    if (start_ns < capture_start_ns_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    ThreadBuffer& buffer = thread_buffer();
+    if (buffer.generation.load(std::memory_order_relaxed) != generation) {
+        // the last stop() is done with this buffer: start() ran after it
+        buffer.events.resize(capacity_.load(std::memory_order_relaxed));
+        buffer.count.store(0, std::memory_order_relaxed);
+        buffer.dropped.store(0, std::memory_order_relaxed);
+        buffer.generation.store(generation, std::memory_order_release);
+    }
+    const size_t n = buffer.count.load(std::memory_order_relaxed);
+    if (n >= buffer.events.size()) {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer.events[n] = Event{name, category, start_ns, end_ns};
+    buffer.count.store(n + 1, std::memory_order_release);
+}
+
+std::string Tracer::stop(TraceCaptureStats* stats) {
+    std::lock_guard<std::mutex> capture_lock(capture_mutex_);
+    TraceCaptureStats totals;
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    if (!active_.load(std::memory_order_relaxed)) {
+        json += "]}";
+        if (stats) {
+            *stats = totals;
+        }
+        return json;
+    }
+    active_.store(false, std::memory_order_release);
+
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        buffers = buffers_;
+    }
+    const uint64_t generation = generation_.load(std::memory_order_relaxed);
+    const uint64_t origin = capture_start_ns_.load(std::memory_order_relaxed);
+    const std::string pid = std::to_string(::getpid());
+    bool first = true;
+    for (const auto& buffer: buffers) {
+        if (buffer->generation.load(std::memory_order_acquire) != generation) {
+            continue;
+        }
+        // spans still being recorded land past count and are left out
+        const size_t count = buffer->count.load(std::memory_order_acquire);
+        totals.events += count;
+        totals.dropped += buffer->dropped.load(std::memory_order_relaxed);
+        ++totals.threads;
+        const std::string tid = std::to_string(buffer->tid);
+        for (size_t i = 0; i < count; ++i) {
+            const Event& event = buffer->events[i];
+            json += first ? "\n" : ",\n";
+            first = false;
+            json += "{\"name\":";
+            append_json_string(json, event.name);
+            json += ",\"cat\":";
+            append_json_string(json, event.category);
+            json += ",\"ph\":\"X\",\"ts\":";
+            append_us(json, event.start_ns - origin);
+            json += ",\"dur\":";
+            append_us(json, event.end_ns - event.start_ns);
+            json += ",\"pid\":" + pid + ",\"tid\":" + tid + "}";
+        }
+    }
+    json += "\n]}";
+    if (stats) {
+        *stats = totals;
+    }
+    return json;
+}
+
+} // namespace dann
@@ -3,86 +3,45 @@
 //
 #include "dann/utils.h"
 
+#include "dann/distance_kernels.h"
+
 #include <algorithm>
-#include <queue>
-#include <faiss/utils/distances.h>
 
 namespace dann
 {
 
 float L2_distance(const float* x, const float* y, int d) {
-    return faiss::fvec_L2sqr(x, y, d);
+    return l2_sqr(x, y, d);
 }
 
 int64_t find_closest(const float *x, const float* y, int d, int n) {
-    float min_dis = std::numeric_limits<float>::max();
-    int r = 0;
-    for (int i = 0; i < n; i++) {
-        float dis = L2_distance(x + i * d, y, d);
-        if (dis < min_dis) {
-            min_dis = dis;
-            r = i;
-        }
-    }
-    return r;
+    TopKBuffer<DistanceWithIndex> topk(1);
+    l2_sqr_scan(x, y, d, static_cast<size_t>(n), topk,
+                [](float dis, size_t i) { return DistanceWithIndex(dis, static_cast<int64_t>(i)); });
+    return topk.empty() ? 0 : topk.entries()[0].index;
 }
 
 std::vector<int64_t> find_closest_k(const float *x, const float *y, int d, int n, int k) {
-    DistanceWithIndexQueue queue;
-    for (int i = 0; i < n; i++) {
-        float dis = L2_distance(x + i * d, y, d);
-        if (queue.size() < k) {
-            // 队列未满，直接添加元素
-            queue.emplace(dis, i);
-        } else {
-            // 队列已满，比较当前距离与队列中最大距离
-            if (dis < queue.top().distance) {
-                // 当前距离更小，替换最大的元素
-                queue.pop();
-                queue.emplace(dis, i);
-            }
-        }
-    }
-    
-    // 提取结果并按距离排序
+    std::vector<DistanceWithIndex> closest = find_closest_k_with_distance(x, y, d, n, k);
     std::vector<int64_t> result;
-    result.reserve(queue.size());
-    while (!queue.empty()) {
-        result.push_back(queue.top().index);
-        queue.pop();
+    result.reserve(closest.size());
+    for (const auto& c: closest) {
+        result.push_back(c.index);
     }
-    
-    // 由于是最大堆，需要反转结果以得到按距离从近到远的顺序
-    std::reverse(result.begin(), result.end());
     return result;
 }
 
 std::vector<DistanceWithIndex> find_closest_k_with_distance(const float *x, const float *y, int d, int n, int k) {
-    DistanceWithIndexQueue queue;
-    for (int i = 0; i < n; i++) {
-        float dis = L2_distance(x + i * d, y, d);
-        if (queue.size() < k) {
-            // 队列未满，直接添加元素
-            queue.emplace(dis, i);
-        } else {
-            // 队列已满，比较当前距离与队列中最大距离
-            if (dis < queue.top().distance) {
-                // 当前距离更小，替换最大的元素
-                queue.pop();
-                queue.emplace(dis, i);
-            }
-        }
-    }
+    return find_closest_k_with_distance(x, y, d, n, k, DistanceType::L2);
+}
 
-    // 提取结果并按距离排序
-    std::vector<DistanceWithIndex> result;
-    result.reserve(queue.size());
-    while (!queue.empty()) {
-        result.push_back(queue.top());
-        queue.pop();
-    }
-    std::reverse(result.begin(), result.end());
-    return std::move(result);
+std::vector<DistanceWithIndex> find_closest_k_with_distance(const float *x, const float *y, int d, int n, int k,
+                                                            DistanceType metric) {
+    // block distances + flat top-k, results come out ordered from near to far
+    TopKBuffer<DistanceWithIndex> topk(static_cast<size_t>(std::max(k, 0)));
+    distance_scan(distance_batch_kernel(metric, d), x, y, d, static_cast<size_t>(n), topk,
+                  [](float dis, size_t i) { return DistanceWithIndex(dis, static_cast<int64_t>(i)); });
+    return topk.take();
 }
 
 std::vector<DistanceWithIndex> find_closest_k_with_distance(const std::vector<float>& x, const std::vector<float>& y, int d, int n, int k) {
@@ -92,4 +51,47 @@ std::vector<DistanceWithIndex> find_closest_k_with_distance(const std::vector<fl
 std::vector<int64_t> find_closest_k(const std::vector<float>& x, const std::vector<float> &y, int d, int n, int k) {
     return find_closest_k(x.data(), y.data(), d, n, k);
 }
-}
\ No newline at end of file
+
+std::vector<InternalSearchResult> merge_top_k(std::vector<std::vector<InternalSearchResult>>& lists, int k) {
+    std::vector<InternalSearchResult> merged;
+    if (k <= 0) {
+        return merged;
+    }
+    const size_t limit = static_cast<size_t>(k);
+    // (list, position) of every list head; ties go to the earlier list
+    std::vector<std::pair<size_t, size_t>> heap;
+    heap.reserve(lists.size());
+    size_t total = 0;
+    for (size_t i = 0; i < lists.size(); ++i) {
+        if (!lists[i].empty()) {
+            heap.emplace_back(i, 0);
+            total += lists[i].size();
+        }
+    }
+    if (heap.size() == 1) {
+        merged = std::move(lists[heap[0].first]);
+        if (merged.size() > limit) {
+            merged.resize(limit);
+        }
+        return merged;
+    }
+    auto farther = [&lists](const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b) {
+        const float da = lists[a.first][a.second].distance;
+        const float db = lists[b.first][b.second].distance;
+        return da > db || (da == db && a.first > b.first);
+    };
+    std::make_heap(heap.begin(), heap.end(), farther);
+    merged.reserve(std::min(limit, total));
+    while (!heap.empty() && merged.size() < limit) {
+        std::pop_heap(heap.begin(), heap.end(), farther);
+        auto& head = heap.back();
+        merged.push_back(std::move(lists[head.first][head.second]));
+        if (++head.second < lists[head.first].size()) {
+            std::push_heap(heap.begin(), heap.end(), farther);
+        } else {
+            heap.pop_back();
+        }
+    }
+    return merged;
+}
+}
@@ -0,0 +1,151 @@
+//
+// Roaring id sets and the columnar attribute store behind filtered search.
+//
+#include <gtest/gtest.h>
+#include "dann/attribute_store.h"
+#include "dann/roaring_bitmap.h"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<int64_t> ids_of(const dann::RoaringBitmap& bitmap) {
+  std::vector<int64_t> ids;
+  bitmap.for_each([&](int64_t id) { ids.push_back(id); });
+  return ids;
+}
+
+TEST(RoaringBitmapTest, MatchesASetAcrossContainerKinds) {
+  dann::RoaringBitmap bitmap;
+  std::set<int64_t> expected;
+  std::mt19937_64 rng(7);
+  // one dense group that turns into a bitset, and sparse ids far apart
+  for (int i = 0; i < 10000; ++i) {
+    const int64_t id = static_cast<int64_t>(rng() % 20000);
+    EXPECT_EQ(bitmap.add(id), expected.insert(id).second);
+  }
+  for (int64_t id: {int64_t{1} << 40, (int64_t{1} << 40) + 3, int64_t{123456789}}) {
+    EXPECT_TRUE(bitmap.add(id));
+    expected.insert(id);
+  }
+  EXPECT_EQ(bitmap.cardinality(), expected.size());
+  EXPECT_EQ(ids_of(bitmap), std::vector<int64_t>(expected.begin(), expected.end()));
+  for (int64_t id = 0; id < 20000; ++id) {
+    EXPECT_EQ(bitmap.contains(id), expected.count(id) == 1);
+  }
+
+  // removing most of the dense group turns it back into an array
+  for (int64_t id = 0; id < 18000; ++id) {
+    EXPECT_EQ(bitmap.remove(id), expected.erase(id) == 1);
+  }
+  EXPECT_EQ(bitmap.cardinality(), expected.size());
+  EXPECT_EQ(ids_of(bitmap), std::vector<int64_t>(expected.begin(), expected.end()));
+  EXPECT_FALSE(bitmap.contains(5));
+  EXPECT_TRUE(bitmap.contains(int64_t{1} << 40));
+  EXPECT_LT(bitmap.memory_bytes(), 8 * 1024u);
+
+  bitmap.clear();
+  EXPECT_TRUE(bitmap.empty());
+  EXPECT_FALSE(bitmap.contains(int64_t{1} << 40));
+}
+
+TEST(RoaringBitmapTest, IntersectsArraysAndBitsets) {
+  dann::RoaringBitmap evens;
+  dann::RoaringBitmap thirds;
+  dann::RoaringBitmap sparse;
+  for (int64_t id = 0; id < 60000; id += 2) {
+    evens.add(id);
+  }
+  for (int64_t id = 0; id < 60000; id += 3) {
+    thirds.add(id);
+  }
+  for (int64_t id = 0; id < 60000; id += 1000) {
+    sparse.add(id);
+  }
+
+  dann::RoaringBitmap both = evens;
+  both.intersect(thirds);
+  EXPECT_EQ(both.cardinality(), 10000u);
+  for (int64_t id = 0; id < 60000; ++id) {
+    EXPECT_EQ(both.contains(id), id % 6 == 0);
+  }
+
+  dann::RoaringBitmap sparse_thirds = sparse;
+  sparse_thirds.intersect(thirds);
+  EXPECT_EQ(ids_of(sparse_thirds), (std::vector<int64_t>{0, 3000, 6000, 9000, 12000, 15000, 18000, 21000, 24000,
+                                                         27000, 30000, 33000, 36000, 39000, 42000, 45000, 48000,
+                                                         51000, 54000, 57000}));
+
+  dann::RoaringBitmap none = evens;
+  none.intersect(dann::RoaringBitmap());
+  EXPECT_TRUE(none.empty());
+}
+
+TEST(AttributeStoreTest, MatchesEveryTermOfAFilter) {
+  dann::AttributeStore store;
+  for (int64_t id = 0; id < 100; ++id) {
+    store.set(id, {{"color", id % 2 == 0 ? "red" : "blue"}, {"size", std::to_string(id % 5)}});
+  }
+  EXPECT_EQ(store.size(), 100u);
+
+  auto red = store.match({{"color", "red"}});
+  EXPECT_EQ(red->cardinality(), 50u);
+  // a single term hands out the cached set until its value is written
+  EXPECT_EQ(store.match({{"color", "red"}}).get(), red.get());
+
+  auto red_zero = store.match({{"color", "red"}, {"size", "0"}});
+  EXPECT_EQ(ids_of(*red_zero), (std::vector<int64_t>{0, 10, 20, 30, 40, 50, 60, 70, 80, 90}));
+  EXPECT_TRUE(store.match({{"color", "green"}})->empty());
+  EXPECT_TRUE(store.match({{"shape", "round"}})->empty());
+
+  // replacing attributes moves the id between values; the set held before stays as it was
+  store.set(0, {{"color", "blue"}});
+  EXPECT_FALSE(store.match({{"color", "red"}})->contains(0));
+  EXPECT_TRUE(red->contains(0));
+  EXPECT_TRUE(store.match({{"color", "blue"}})->contains(0));
+  EXPECT_FALSE(store.match({{"size", "0"}})->contains(0));
+
+  EXPECT_TRUE(store.remove(2));
+  EXPECT_FALSE(store.remove(2));
+  EXPECT_FALSE(store.match({{"color", "red"}})->contains(2));
+  store.set(4, {});
+  EXPECT_EQ(store.size(), 98u);
+  EXPECT_GT(store.memory_bytes(), 0u);
+}
+
+TEST(AttributeStoreTest, SavesAndLoads) {
+  const auto dir = std::filesystem::temp_directory_path() / "dann_attribute_store_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  const std::string path = (dir / dann::kAttributesFileName).string();
+
+  dann::AttributeStore store;
+  for (int64_t id = 0; id < 1000; ++id) {
+    store.set(id * 7, {{"tenant", "t" + std::to_string(id % 3)}, {"lang", id % 2 ? "en" : "de"}});
+  }
+  store.remove(7);
+  ASSERT_TRUE(store.save(path));
+
+  dann::AttributeStore loaded;
+  loaded.set(1, {{"tenant", "stale"}});
+  ASSERT_TRUE(loaded.load(path));
+  EXPECT_EQ(loaded.size(), store.size());
+  EXPECT_TRUE(loaded.match({{"tenant", "stale"}})->empty());
+  const dann::AttributeFilter filter{{"tenant", "t1"}, {"lang", "en"}};
+  EXPECT_EQ(ids_of(*loaded.match(filter)), ids_of(*store.match(filter)));
+
+  // a missing file is an index saved before attributes existed
+  ASSERT_TRUE(loaded.load((dir / "missing.bin").string()));
+  EXPECT_EQ(loaded.size(), 0u);
+
+  std::ofstream((dir / "garbage.bin").string()) << "not an attribute file";
+  EXPECT_FALSE(loaded.load((dir / "garbage.bin").string()));
+  std::filesystem::remove_all(dir);
+}
+
+} // namespace
@@ -0,0 +1,98 @@
+//
+// Block-compressed frames: round trips per codec and random access into blocks.
+//
+#include <gtest/gtest.h>
+#include "dann/block_compression.h"
+
+#include <random>
+#include <string>
+
+namespace {
+
+// repetitive text, so every codec actually shrinks it
+std::string compressible(size_t size) {
+  std::string data;
+  for (size_t i = 0; data.size() < size; ++i) {
+    data += "vector " + std::to_string(i % 97) + " of shard " + std::to_string(i % 5) + "; ";
+  }
+  data.resize(size);
+  return data;
+}
+
+std::string random_bytes(size_t size, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::string data(size, '\0');
+  for (auto& c: data) {
+    c = static_cast<char>(rng());
+  }
+  return data;
+}
+
+}
+
+TEST(BlockCompressionTest, EveryCodecRoundTrips) {
+  const std::string data = compressible(300 * 1024 + 17);
+  for (auto codec: {dann::CompressionCodec::LZ4, dann::CompressionCodec::ZSTD, dann::CompressionCodec::NONE}) {
+    dann::BlockCompressionOptions options;
+    options.codec = codec;
+    const std::string frame = dann::compress_blocks(data.data(), data.size(), options);
+    EXPECT_TRUE(dann::is_compressed_frame(frame.data(), frame.size()));
+    if (codec != dann::CompressionCodec::NONE) {
+      EXPECT_LT(frame.size(), data.size()) << dann::compression_codec_name(codec);
+    }
+    std::string out;
+    ASSERT_TRUE(dann::decompress_blocks(frame.data(), frame.size(), &out)) << dann::compression_codec_name(codec);
+    EXPECT_EQ(out, data);
+  }
+}
+
+TEST(BlockCompressionTest, EmptyAndIncompressibleInputRoundTrip) {
+  std::string out = "stale";
+  const std::string empty = dann::compress_blocks("", 0);
+  ASSERT_TRUE(dann::decompress_blocks(empty.data(), empty.size(), &out));
+  EXPECT_TRUE(out.empty());
+
+  // random bytes do not shrink, so the blocks are stored raw
+  const std::string data = random_bytes(100 * 1024, 5);
+  dann::BlockCompressionOptions options;
+  options.codec = dann::CompressionCodec::ZSTD;
+  const std::string frame = dann::compress_blocks(data.data(), data.size(), options);
+  ASSERT_TRUE(dann::decompress_blocks(frame.data(), frame.size(), &out));
+  EXPECT_EQ(out, data);
+  EXPECT_FALSE(dann::is_compressed_frame(data.data(), data.size()));
+}
+
+TEST(BlockCompressionTest, ReaderDecodesSingleBlocksAndRanges) {
+  const std::string data = compressible(10 * 4096 + 100);
+  dann::BlockCompressionOptions options;
+  options.block_size = 4096;
+  const std::string frame = dann::compress_blocks(data.data(), data.size(), options);
+
+  dann::BlockReader reader;
+  ASSERT_TRUE(reader.open(frame.data(), frame.size()));
+  EXPECT_EQ(reader.block_count(), 11u);
+  EXPECT_EQ(reader.raw_size(), data.size());
+  std::string block;
+  ASSERT_TRUE(reader.read_block(10, &block));
+  EXPECT_EQ(block, data.substr(10 * 4096));
+
+  // a range straddling three blocks
+  std::string range;
+  ASSERT_TRUE(reader.read_range(4000, 5000, &range));
+  EXPECT_EQ(range, data.substr(4000, 5000));
+}
+
+TEST(BlockCompressionTest, CorruptBlockIsRejected) {
+  const std::string data = compressible(64 * 1024);
+  std::string frame = dann::compress_blocks(data.data(), data.size());
+  // a byte inside the first block's payload
+  frame[40] = static_cast<char>(frame[40] ^ 0x5A);
+  std::string out;
+  EXPECT_FALSE(dann::decompress_blocks(frame.data(), frame.size(), &out));
+  EXPECT_FALSE(dann::decompress_blocks(frame.data(), frame.size() / 2, &out));
+
+  dann::CompressionCodec codec;
+  EXPECT_TRUE(dann::parse_compression_codec("zstd", &codec));
+  EXPECT_EQ(codec, dann::CompressionCodec::ZSTD);
+  EXPECT_FALSE(dann::parse_compression_codec("snappy", &codec));
+}
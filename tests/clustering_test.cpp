@@ -6,6 +6,9 @@
 #include "dann/clustering.h"
 #include "dann/utils.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <random>
 
 class ClusteringTest: public ::testing::Test {
@@ -68,6 +71,97 @@ TEST_F(ClusteringTest, SimpleDataset) {
   EXPECT_NEAR(clustering.centroids[3], 10.0f, 0.5f);
 }
 
+namespace {
+// n points around `groups` centers spaced 10 apart on the diagonal
+std::vector<float> blobs(size_t n, int d, int groups, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> x(n * d);
+  for (size_t i = 0; i < n; ++i) {
+    const float center = static_cast<float>(i % groups) * 10.0f;
+    for (int j = 0; j < d; ++j) {
+      x[i * d + j] = center + noise(gen);
+    }
+  }
+  return x;
+}
+
+// every center has a centroid within tolerance of it
+void expect_centers_found(const std::vector<float>& centroids, int d, int groups, float tolerance) {
+  const int k = static_cast<int>(centroids.size() / d);
+  for (int g = 0; g < groups; ++g) {
+    std::vector<float> center(d, static_cast<float>(g) * 10.0f);
+    float best = std::numeric_limits<float>::max();
+    for (int c = 0; c < k; ++c) {
+      best = std::min(best, dann::L2_distance(centroids.data() + c * d, center.data(), d));
+    }
+    EXPECT_LT(best, tolerance) << "center " << g;
+  }
+}
+}
+
+TEST(ClusteringTrainTest, LloydFindsSeparatedCenters) {
+  const int d = 4;
+  auto x = blobs(4000, d, 4, 1);
+  dann::ClusteringParameters cp;
+  cp.nredo = 3;
+  dann::Clustering clustering(d, 4, cp);
+  clustering.train(x, 4000);
+  ASSERT_EQ(clustering.centroids.size(), 4u * d);
+  expect_centers_found(clustering.centroids, d, 4, 1.0f);
+}
+
+TEST(ClusteringTrainTest, MiniBatchFindsSeparatedCenters) {
+  const int d = 4;
+  auto x = blobs(20000, d, 4, 2);
+  dann::ClusteringParameters cp;
+  cp.batch_size = 512;
+  cp.niter = 40;
+  cp.nredo = 3;
+  dann::Clustering clustering(d, 4, cp);
+  clustering.train(x, 20000);
+  ASSERT_EQ(clustering.centroids.size(), 4u * d);
+  expect_centers_found(clustering.centroids, d, 4, 1.0f);
+}
+
+TEST(ClusteringTrainTest, EmptyClustersAreSplit) {
+  // two distinct points and four centroids: seeds collide, leaving empty clusters to split
+  const int d = 2;
+  std::vector<float> x;
+  for (int i = 0; i < 100; ++i) {
+    const float v = i % 2 == 0 ? 0.0f : 10.0f;
+    x.push_back(v);
+    x.push_back(v);
+  }
+  dann::Clustering clustering(d, 4);
+  clustering.train(x, 100);
+  ASSERT_EQ(clustering.centroids.size(), 4u * d);
+  for (float v: clustering.centroids) {
+    EXPECT_TRUE(std::isfinite(v));
+  }
+  expect_centers_found(clustering.centroids, d, 2, 1e-3f);
+}
+
+TEST(ClusteringTrainTest, KMeansParallelInitIsSeededAndSeparates) {
+  const int d = 4;
+  auto x = blobs(8000, d, 8, 3);
+  dann::ClusteringParameters cp;
+  cp.init = dann::ClusteringInit::KMEANS_PARALLEL;
+  cp.niter = 5;
+  dann::Clustering first(d, 8, cp);
+  first.train(x.data(), 8000);
+  dann::Clustering second(d, 8, cp);
+  second.train(x.data(), 8000);
+  ASSERT_EQ(first.centroids.size(), 8u * d);
+  EXPECT_EQ(first.centroids, second.centroids);
+  expect_centers_found(first.centroids, d, 8, 1.0f);
+
+  cp.seed = 4321;
+  dann::Clustering other(d, 8, cp);
+  other.train(x.data(), 8000);
+  expect_centers_found(other.centroids, d, 8, 1.0f);
+}
+
 TEST(ClusteringUtilsTest, L2Distance) {
   const float a[] = {1.0f, 2.0f};
   const float b[] = {4.0f, 6.0f};
@@ -290,4 +384,41 @@ TEST(ClusteringUtilsTest, FindClosestKNegativeValues) {
   std::vector<int64_t> result = dann::find_closest_k(vectors.data(), query, d, n, k);
   EXPECT_EQ(result.size(), 2);
   EXPECT_THAT(result, testing::Contains(2));
-}
\ No newline at end of file
+}
+// with a GPU the device path must agree with the CPU one; without, enabled
+// options fall back and give the CPU result exactly
+TEST(ClusteringUtilsTest, KnnCentroidsGpuMatchesCpu) {
+  const int d = 16;
+  const size_t n = 2048;
+  const size_t nc = 64;
+  std::mt19937 rng(11);
+  std::normal_distribution<float> noise(0.0f, 1.0f);
+  std::vector<float> x(n * d);
+  std::vector<float> centroids(nc * d);
+  for (auto& v: x) {
+    v = noise(rng);
+  }
+  for (auto& v: centroids) {
+    v = noise(rng);
+  }
+  dann::GpuOptions gpu;
+  gpu.enabled = true;
+  gpu.min_rows = 0;
+  for (auto metric: {dann::DistanceType::L2, dann::DistanceType::DOT}) {
+    const int k = 4;
+    std::vector<float> cpu_dis(n * k), gpu_dis(n * k);
+    std::vector<faiss::idx_t> cpu_ids(n * k), gpu_ids(n * k);
+    dann::knn_centroids(x.data(), n, centroids.data(), nc, d, metric, k, cpu_dis.data(), cpu_ids.data());
+    dann::knn_centroids(x.data(), n, centroids.data(), nc, d, metric, k, gpu_dis.data(), gpu_ids.data(), gpu);
+    size_t same = 0;
+    for (size_t i = 0; i < n * k; ++i) {
+      same += cpu_ids[i] == gpu_ids[i] ? 1 : 0;
+      EXPECT_NEAR(cpu_dis[i], gpu_dis[i], 1e-3f * (1.0f + std::abs(cpu_dis[i])));
+    }
+    // device GEMMs round differently, so near ties may swap
+    EXPECT_GE(same, n * k * 99 / 100);
+    if (!dann::gpu_available()) {
+      EXPECT_EQ(same, n * k);
+    }
+  }
+}
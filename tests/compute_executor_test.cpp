@@ -0,0 +1,72 @@
+//
+// Work-stealing compute executor.
+//
+#include <gtest/gtest.h>
+#include "dann/compute_executor.h"
+
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+TEST(ComputeExecutorTest, ParallelForCoversRangeOnce) {
+  dann::ComputeExecutor executor(4);
+  std::vector<std::atomic<int>> hits(10007);
+  for (size_t grain: {1, 7, 64, 20000}) {
+    for (auto& h: hits) {
+      h.store(0);
+    }
+    executor.parallel_for(0, hits.size(), grain, [&](size_t lo, size_t hi) {
+      ASSERT_LE(hi - lo, grain);
+      for (size_t i = lo; i < hi; ++i) {
+        hits[i].fetch_add(1);
+      }
+    });
+    for (size_t i = 0; i < hits.size(); ++i) {
+      ASSERT_EQ(hits[i].load(), 1) << "grain " << grain << " row " << i;
+    }
+  }
+}
+
+TEST(ComputeExecutorTest, NestedParallelForCompletes) {
+  dann::ComputeExecutor executor(3);
+  std::vector<std::atomic<int64_t>> sums(64);
+  executor.parallel_for(0, sums.size(), 1, [&](size_t lo, size_t hi) {
+    for (size_t outer = lo; outer < hi; ++outer) {
+      executor.parallel_for(0, 1000, 10, [&](size_t ilo, size_t ihi) {
+        int64_t local = 0;
+        for (size_t i = ilo; i < ihi; ++i) {
+          local += static_cast<int64_t>(i);
+        }
+        sums[outer].fetch_add(local);
+      });
+    }
+  });
+  for (auto& s: sums) {
+    EXPECT_EQ(s.load(), 999 * 1000 / 2);
+  }
+}
+
+TEST(ComputeExecutorTest, SubmitReturnsValue) {
+  dann::ComputeExecutor executor(2);
+  std::vector<std::future<int>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(executor.submit([i] { return i * i; }));
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(futures[i].get(), i * i);
+  }
+}
+
+TEST(ComputeExecutorTest, ParallelForRethrows) {
+  dann::ComputeExecutor executor(4);
+  std::atomic<int> ran{0};
+  EXPECT_THROW(executor.parallel_for(0, 100, 1, [&](size_t lo, size_t) {
+    ran.fetch_add(1);
+    if (lo == 57) {
+      throw std::runtime_error("chunk failed");
+    }
+  }), std::runtime_error);
+  // every chunk still ran before parallel_for returned
+  EXPECT_EQ(ran.load(), 100);
+}
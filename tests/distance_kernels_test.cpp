@@ -0,0 +1,198 @@
+//
+// SIMD distance kernels and the flat top-k buffer.
+//
+#include <gtest/gtest.h>
+#include "dann/distance_kernels.h"
+#include "dann/types.h"
+#include "dann/utils.h"
+
+#include <algorithm>
+#include <random>
+
+class DistanceKernelsTest: public ::testing::Test {
+protected:
+  void TearDown() override {
+    dann::set_simd_level(dann::detected_simd_level());
+  }
+
+  static std::vector<float> random_vectors(size_t n, int d, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> v(n * d);
+    for (auto& x: v) {
+      x = dist(rng);
+    }
+    return v;
+  }
+};
+
+TEST_F(DistanceKernelsTest, EveryLevelMatchesScalar) {
+  // dimensions cover full SIMD widths, tails and sub-register sizes
+  for (int d: {1, 3, 8, 15, 16, 33, 128, 257}) {
+    const size_t n = 37;
+    auto x = random_vectors(n, d, 1);
+    auto y = random_vectors(1, d, 2);
+
+    dann::set_simd_level(dann::SimdLevel::SCALAR);
+    ASSERT_EQ(dann::simd_level(), dann::SimdLevel::SCALAR);
+    std::vector<float> expected(n);
+    dann::l2_sqr_batch(x.data(), y.data(), d, n, expected.data());
+
+    for (auto level: {dann::SimdLevel::AVX2, dann::SimdLevel::AVX512, dann::SimdLevel::NEON}) {
+      dann::set_simd_level(level);
+      std::vector<float> actual(n);
+      dann::l2_sqr_batch(x.data(), y.data(), d, n, actual.data());
+      for (size_t i = 0; i < n; ++i) {
+        EXPECT_NEAR(actual[i], expected[i], 1e-4f * (1.0f + expected[i])) << "d=" << d << " level="
+                                                                         << dann::simd_level_name(dann::simd_level());
+        EXPECT_NEAR(dann::l2_sqr(x.data() + i * d, y.data(), d), expected[i], 1e-4f * (1.0f + expected[i]));
+      }
+    }
+  }
+}
+
+TEST_F(DistanceKernelsTest, UnsupportedLevelFallsBackToDetected) {
+  const auto detected = dann::detected_simd_level();
+  dann::set_simd_level(detected == dann::SimdLevel::NEON ? dann::SimdLevel::AVX2 : dann::SimdLevel::NEON);
+  EXPECT_EQ(dann::simd_level(), detected);
+}
+
+TEST_F(DistanceKernelsTest, TopKBufferKeepsSmallestSorted) {
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> dist(0.0f, 100.0f);
+  std::vector<dann::DistanceWithIndex> all;
+  dann::TopKBuffer<dann::DistanceWithIndex> topk(10);
+  for (int i = 0; i < 1000; ++i) {
+    all.emplace_back(dist(rng), i);
+    topk.push(all.back());
+  }
+  std::sort(all.begin(), all.end());
+  ASSERT_EQ(topk.size(), 10u);
+  for (size_t i = 0; i < 10; ++i) {
+    EXPECT_EQ(topk.entries()[i].index, all[i].index);
+  }
+  EXPECT_FALSE(topk.accepts(all[10].distance));
+
+  dann::TopKBuffer<dann::DistanceWithIndex> empty(0);
+  empty.push({1.0f, 1});
+  EXPECT_TRUE(empty.empty());
+}
+
+TEST_F(DistanceKernelsTest, FindClosestKMatchesBruteForce) {
+  const int d = 24;
+  const int n = 500;
+  auto x = random_vectors(n, d, 4);
+  auto y = random_vectors(1, d, 5);
+  std::vector<dann::DistanceWithIndex> expected;
+  for (int i = 0; i < n; ++i) {
+    float dis = 0.0f;
+    for (int j = 0; j < d; ++j) {
+      dis += (x[i * d + j] - y[j]) * (x[i * d + j] - y[j]);
+    }
+    expected.emplace_back(dis, i);
+  }
+  std::sort(expected.begin(), expected.end());
+
+  auto closest = dann::find_closest_k_with_distance(x.data(), y.data(), d, n, 7);
+  ASSERT_EQ(closest.size(), 7u);
+  for (size_t i = 0; i < closest.size(); ++i) {
+    EXPECT_EQ(closest[i].index, expected[i].index);
+    EXPECT_NEAR(closest[i].distance, expected[i].distance, 1e-4f);
+  }
+  EXPECT_EQ(dann::find_closest(x.data(), y.data(), d, n), expected[0].index);
+  EXPECT_EQ(dann::find_closest_k(x.data(), y.data(), d, n, 3).size(), 3u);
+}
+
+TEST_F(DistanceKernelsTest, SpecializedDimensionsMatchGenericKernel) {
+  for (int d: {128, 256, 768, 1024}) {
+    EXPECT_TRUE(dann::has_specialized_kernel(d));
+    const size_t n = 13;
+    auto x = random_vectors(n, d, 6);
+    auto y = random_vectors(1, d, 7);
+
+    dann::set_simd_level(dann::SimdLevel::SCALAR);
+    std::vector<float> expected(n);
+    dann::l2_sqr_batch(x.data(), y.data(), d, n, expected.data());
+
+    for (auto level: {dann::SimdLevel::SCALAR, dann::SimdLevel::AVX2, dann::SimdLevel::AVX512}) {
+      dann::set_simd_level(level);
+      auto kernel = dann::l2_sqr_batch_kernel(d);
+      std::vector<float> actual(n);
+      kernel(x.data(), y.data(), d, n, actual.data());
+      for (size_t i = 0; i < n; ++i) {
+        EXPECT_NEAR(actual[i], expected[i], 1e-4f * expected[i]) << "d=" << d;
+      }
+    }
+  }
+  EXPECT_FALSE(dann::has_specialized_kernel(100));
+}
+
+TEST_F(DistanceKernelsTest, InnerProductKernelsMatchScalar) {
+  for (int d: {3, 16, 33, 128, 256}) {
+    const size_t n = 21;
+    auto x = random_vectors(n, d, 8);
+    auto y = random_vectors(1, d, 9);
+    std::vector<float> expected(n);
+    for (size_t i = 0; i < n; ++i) {
+      for (int j = 0; j < d; ++j) {
+        expected[i] -= x[i * d + j] * y[j];
+      }
+    }
+
+    for (auto level: {dann::SimdLevel::SCALAR, dann::SimdLevel::AVX2, dann::SimdLevel::AVX512,
+                      dann::SimdLevel::NEON}) {
+      dann::set_simd_level(level);
+      std::vector<float> batch(n);
+      std::vector<float> fixed(n);
+      dann::neg_inner_product_batch(x.data(), y.data(), d, n, batch.data());
+      dann::distance_batch_kernel(dann::DistanceType::DOT, d)(x.data(), y.data(), d, n, fixed.data());
+      for (size_t i = 0; i < n; ++i) {
+        EXPECT_NEAR(batch[i], expected[i], 1e-4f * d) << "d=" << d;
+        EXPECT_NEAR(fixed[i], expected[i], 1e-4f * d) << "d=" << d;
+        EXPECT_NEAR(dann::inner_product(x.data() + i * d, y.data(), d), -expected[i], 1e-4f * d);
+      }
+    }
+  }
+}
+
+TEST_F(DistanceKernelsTest, NormalizeVectorsMakesUnitRows) {
+  const int d = 10;
+  auto x = random_vectors(5, d, 10);
+  std::fill(x.begin() + 2 * d, x.begin() + 3 * d, 0.0f);
+  dann::normalize_vectors(x.data(), 5, d);
+  for (size_t i = 0; i < 5; ++i) {
+    const float norm = dann::inner_product(x.data() + i * d, x.data() + i * d, d);
+    EXPECT_NEAR(norm, i == 2 ? 0.0f : 1.0f, 1e-5f);
+  }
+}
+
+TEST_F(DistanceKernelsTest, MergeTopKInterleavesSortedLists) {
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<float> dist(0.0f, 10.0f);
+  std::vector<std::vector<dann::InternalSearchResult>> lists(4);
+  std::vector<float> all;
+  int64_t id = 0;
+  for (size_t l = 0; l < lists.size(); ++l) {
+    // one list stays empty
+    const int n = l == 2 ? 0 : 7;
+    for (int i = 0; i < n; ++i) {
+      lists[l].emplace_back(id++, dist(rng), std::vector<float>{static_cast<float>(l)});
+      all.push_back(lists[l].back().distance);
+    }
+    std::sort(lists[l].begin(), lists[l].end());
+  }
+  std::sort(all.begin(), all.end());
+
+  auto copy = lists;
+  auto merged = dann::merge_top_k(copy, 10);
+  ASSERT_EQ(merged.size(), 10u);
+  for (size_t i = 0; i < merged.size(); ++i) {
+    EXPECT_EQ(merged[i].distance, all[i]);
+    EXPECT_EQ(merged[i].vector.size(), 1u);
+  }
+  // fewer candidates than k: everything, nothing padded
+  copy = lists;
+  EXPECT_EQ(dann::merge_top_k(copy, 100).size(), all.size());
+  copy = lists;
+  EXPECT_TRUE(dann::merge_top_k(copy, 0).empty());
+}
@@ -2,11 +2,24 @@
 // Created by skyitachi on 2026/3/8.
 //
 #include <gtest/gtest.h>
+#include "dann/coarse_quantizer.h"
 #include "dann/distributed_index_ivf.h"
+#include "dann/fast_scan.h"
+#include "dann/index.h"
+#include "dann/metrics.h"
 #include "dann/ivf_shard.h"
+#include "dann/product_quantizer.h"
 #include "dann/types.h"
+#include "dann/utils.h"
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
 #include <random>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include "dann/logger.h"
 
@@ -243,6 +256,97 @@ TEST_F(IndexIVFShardTest, SearchWithKGreaterThanDataSize) {
   EXPECT_EQ(results.size(), 3);  // Should return all 3, not 10
 }
 
+TEST_F(IndexIVFShardTest, SearchWithoutVectorsReturnsIdsAndDistancesOnly) {
+  dann::IndexIVFShard shard(d_, shard_id_, node_id_);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_test_data(30, vectors, ids);
+  dann::InvertedList posting;
+  posting.vectors = vectors;
+  posting.vector_ids = ids;
+  shard.add_posting(0, posting);
+
+  std::vector<float> query(vectors.begin() + 3 * d_, vectors.begin() + 4 * d_);
+  auto with_vectors = shard.search({0}, query, 5);
+  auto without_vectors = shard.search({0}, query, 5, false);
+  ASSERT_EQ(without_vectors.size(), with_vectors.size());
+  for (size_t i = 0; i < without_vectors.size(); ++i) {
+    EXPECT_EQ(without_vectors[i].id, with_vectors[i].id);
+    EXPECT_FLOAT_EQ(without_vectors[i].distance, with_vectors[i].distance);
+    EXPECT_TRUE(without_vectors[i].vector.empty());
+  }
+  EXPECT_EQ(with_vectors[0].id, 3);
+  EXPECT_EQ(with_vectors[0].vector, query);
+}
+
+TEST_F(IndexIVFShardTest, ArenaModeMatchesHashMapMode) {
+  dann::IndexIVFShard map_shard(d_, shard_id_, node_id_);
+  dann::IndexIVFShard arena_shard(d_, shard_id_, node_id_, dann::PostingStorageMode::ARENA);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_test_data(60, vectors, ids);
+  for (int64_t c = 0; c < 3; ++c) {
+    dann::InvertedList posting;
+    posting.vectors.assign(vectors.begin() + c * 20 * d_, vectors.begin() + (c + 1) * 20 * d_);
+    posting.vector_ids.assign(ids.begin() + c * 20, ids.begin() + (c + 1) * 20);
+    map_shard.add_posting(c, posting);
+    arena_shard.add_posting(c, posting);
+  }
+  EXPECT_EQ(arena_shard.size(), 60u);
+
+  dann::PostingView view;
+  ASSERT_TRUE(arena_shard.find_posting(1, &view));
+  EXPECT_EQ(view.length, 20u);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(view.vectors) % dann::kCacheLineSize, 0u);
+
+  std::vector<float> query(vectors.begin() + 25 * d_, vectors.begin() + 26 * d_);
+  auto expected = map_shard.search({0, 1, 2}, query, 10);
+  auto actual = arena_shard.search({0, 1, 2}, query, 10);
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t i = 0; i < actual.size(); ++i) {
+    EXPECT_EQ(actual[i].id, expected[i].id);
+    EXPECT_FLOAT_EQ(actual[i].distance, expected[i].distance);
+    EXPECT_EQ(actual[i].vector, expected[i].vector);
+  }
+}
+
+TEST_F(IndexIVFShardTest, ArenaAppendToEarlierListKeepsAllRows) {
+  dann::IndexIVFShard shard(2, shard_id_, node_id_, dann::PostingStorageMode::ARENA);
+
+  dann::InvertedList first;
+  first.vectors = {0.0f, 0.0f, 1.0f, 1.0f};
+  first.vector_ids = {0, 1};
+  dann::InvertedList second;
+  second.vectors = {10.0f, 10.0f};
+  second.vector_ids = {10};
+  dann::InvertedList more;
+  more.vectors = {2.0f, 2.0f};
+  more.vector_ids = {2};
+
+  shard.add_posting(0, first);
+  shard.add_posting(1, second);
+  shard.add_posting(0, more);
+
+  dann::PostingView view;
+  ASSERT_TRUE(shard.find_posting(0, &view));
+  ASSERT_EQ(view.length, 3u);
+  EXPECT_EQ(view.vector_ids[0], 0);
+  EXPECT_EQ(view.vector_ids[2], 2);
+  EXPECT_FLOAT_EQ(view.vectors[4], 2.0f);
+  EXPECT_EQ(shard.size(), 4u);
+
+  auto results = shard.search({0, 1}, {2.0f, 2.0f}, 1);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_EQ(results[0].id, 2);
+
+  shard.set_storage_mode(dann::PostingStorageMode::HASH_MAP);
+  ASSERT_TRUE(shard.find_posting(0, &view));
+  EXPECT_EQ(view.length, 3u);
+  EXPECT_EQ(shard.size(), 4u);
+}
+
 class DistributedIndexIVFTest : public ::testing::Test {
 protected:
   void SetUp() override {
@@ -303,3 +407,1900 @@ TEST_F(DistributedIndexIVFTest, LoadIndexReturnsFalse) {
   dann::DistributedIndexIVF index("distributed_ivf_load", d_, shards_, nodes_);
   EXPECT_FALSE(index.load_index("/tmp/not_implemented.ivf"));
 }
+
+TEST_F(DistributedIndexIVFTest, ArenaStorageBuildAndSearch) {
+  dann::DistributedIndexIVF index("distributed_ivf_arena", d_, shards_, nodes_);
+  index.set_posting_storage_mode(dann::PostingStorageMode::ARENA);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(200, vectors, ids);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  std::vector<float> query(vectors.begin() + 50 * d_, vectors.begin() + 51 * d_);
+  auto results = index.search(query, 5);
+  ASSERT_EQ(results.size(), 5u);
+  EXPECT_EQ(results[0].distance, 0.0f);
+  EXPECT_GE(results[0].id, 50);
+  EXPECT_LE(results[0].id, 59);
+}
+
+TEST_F(DistributedIndexIVFTest, TracedSearchFillsStageBreakdown) {
+  dann::DistributedIndexIVF index("distributed_ivf_trace", d_, shards_, 20, 4, nodes_);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(200, vectors, ids);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  dann::QueryStats stats;
+  dann::InternalSearchParameters params;
+  params.stats = &stats;
+  std::vector<float> query(vectors.begin(), vectors.begin() + d_);
+  auto results = index.search(query, 5, params);
+  ASSERT_EQ(results.size(), 5u);
+  EXPECT_EQ(stats.queries, 1u);
+  EXPECT_EQ(stats.lists_probed, 4u);
+  EXPECT_GE(stats.vectors_scanned, 5u);
+  EXPECT_GT(stats.total_ms, 0.0);
+  EXPECT_LE(stats.centroid_ms + stats.routing_ms + stats.merge_ms, stats.total_ms);
+
+  dann::QueryStats batch_stats;
+  params.stats = &batch_stats;
+  index.search_batch(vectors.data(), 3, 5, params);
+  EXPECT_EQ(batch_stats.queries, 3u);
+  EXPECT_EQ(batch_stats.lists_probed, 12u);
+
+  // sampled searches land in the stage histograms without a stats argument
+  auto& metrics = dann::Metrics::instance();
+  const uint64_t before = metrics.get_histogram_count("search_stage_ms{stage=\"scan\"}");
+  index.set_stage_sampling(1);
+  index.search(query, 5);
+  index.set_stage_sampling(0);
+  index.search(query, 5);
+  EXPECT_EQ(metrics.get_histogram_count("search_stage_ms{stage=\"scan\"}"), before + 1);
+}
+
+TEST_F(DistributedIndexIVFTest, ShardStatsCountEveryLiveVector) {
+  dann::DistributedIndexIVF index("distributed_ivf_stats", d_, shards_, 20, 4, nodes_);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(200, vectors, ids);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  ASSERT_TRUE(index.remove_vector(7));
+  EXPECT_EQ(index.size(), 199u);
+
+  dann::IvfShardStats total;
+  auto stats = index.shard_stats(&total);
+  ASSERT_EQ(stats.size(), static_cast<size_t>(shards_));
+  size_t vectors_sum = 0;
+  for (size_t i = 0; i < stats.size(); ++i) {
+    EXPECT_EQ(stats[i].shard_id, static_cast<int>(i));
+    EXPECT_FALSE(stats[i].remote);
+    EXPECT_LE(stats[i].min_list, stats[i].median_list);
+    EXPECT_LE(stats[i].median_list, stats[i].max_list);
+    vectors_sum += stats[i].vectors;
+  }
+  EXPECT_EQ(vectors_sum, 199u);
+  EXPECT_EQ(total.vectors, 199u);
+  EXPECT_GT(total.memory_bytes, 0u);
+  EXPECT_GE(total.imbalance, 1.0);
+}
+
+TEST_F(DistributedIndexIVFTest, SearchBatchMatchesSingleQuerySearch) {
+  dann::DistributedIndexIVF index("distributed_ivf_batch", d_, shards_, nodes_);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(200, vectors, ids);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  const size_t nq = 7;
+  std::vector<float> queries;
+  for (size_t q = 0; q < nq; ++q) {
+    queries.insert(queries.end(), vectors.begin() + q * 25 * d_, vectors.begin() + (q * 25 + 1) * d_);
+  }
+
+  const int k = 5;
+  auto batch_results = index.search_batch(queries.data(), nq, k);
+  ASSERT_EQ(batch_results.size(), nq);
+  for (size_t q = 0; q < nq; ++q) {
+    std::vector<float> query(queries.begin() + q * d_, queries.begin() + (q + 1) * d_);
+    auto expected = index.search(query, k);
+    ASSERT_EQ(batch_results[q].size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_FLOAT_EQ(batch_results[q][i].distance, expected[i].distance);
+    }
+    EXPECT_EQ(batch_results[q][0].distance, 0.0f);
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, KBeyondProbedRowsIsNotPadded) {
+  dann::DistributedIndexIVF index("distributed_ivf_short", d_, shards_, nodes_);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(200, vectors, ids);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  std::vector<float> query(vectors.begin(), vectors.begin() + d_);
+  const int k = 500;
+  auto check = [&](const std::vector<dann::InternalSearchResult>& results) {
+    EXPECT_LE(results.size(), ids.size());
+    ASSERT_FALSE(results.empty());
+    for (size_t i = 0; i < results.size(); ++i) {
+      EXPECT_GE(results[i].id, 0);
+      if (i > 0) {
+        EXPECT_LE(results[i - 1].distance, results[i].distance);
+      }
+    }
+  };
+  check(index.search(query, k));
+  auto batch = index.search_batch(query.data(), 1, k);
+  ASSERT_EQ(batch.size(), 1u);
+  check(batch[0]);
+}
+
+TEST_F(DistributedIndexIVFTest, PerRequestNprobeOverridesIndexDefault) {
+  std::mt19937 rng(30);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  const int n = 2000;
+  std::vector<float> vectors(n * d_);
+  std::vector<int64_t> ids(n);
+  for (auto& x: vectors) {
+    x = dist(rng);
+  }
+  std::iota(ids.begin(), ids.end(), 0);
+
+  // the constructor's nprobe is kept through the build
+  dann::DistributedIndexIVF index("distributed_ivf_nprobe", d_, shards_, 32, 1, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  EXPECT_EQ(index.nprobe(), 1);
+
+  std::vector<float> query(d_, 0.05f);
+  auto exact = dann::find_closest_k_with_distance(vectors.data(), query.data(), d_, n, 10);
+  dann::InternalSearchParameters full;
+  full.nprobe = 1000;
+  auto thorough = index.search(query, 10, full);
+  ASSERT_EQ(thorough.size(), exact.size());
+  for (size_t i = 0; i < exact.size(); ++i) {
+    EXPECT_EQ(thorough[i].id, exact[i].index);
+  }
+  auto batch = index.search_batch(query.data(), 1, 10, full);
+  ASSERT_EQ(batch.size(), 1u);
+  ASSERT_EQ(batch[0].size(), exact.size());
+  EXPECT_EQ(batch[0][0].id, exact[0].index);
+  // over many queries a single probed list has to miss some true neighbours
+  size_t cheap_hits = 0;
+  size_t full_hits = 0;
+  for (int q = 0; q < 50; ++q) {
+    std::vector<float> probe(d_);
+    for (auto& x: probe) {
+      x = dist(rng);
+    }
+    auto truth = dann::find_closest_k_with_distance(vectors.data(), probe.data(), d_, n, 10);
+    std::set<int64_t> expected;
+    for (const auto& e: truth) {
+      expected.insert(e.index);
+    }
+    for (const auto& r: index.search(probe, 10)) {
+      cheap_hits += expected.count(r.id);
+    }
+    for (const auto& r: index.search(probe, 10, full)) {
+      full_hits += expected.count(r.id);
+    }
+  }
+  EXPECT_EQ(full_hits, 500u);
+  EXPECT_LT(cheap_hits, full_hits);
+}
+
+TEST_F(DistributedIndexIVFTest, SaveAndLoadRoundTrip) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_roundtrip").string();
+  std::filesystem::remove_all(dir);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(200, vectors, ids);
+
+  dann::DistributedIndexIVF built("distributed_ivf_save", d_, shards_, nodes_);
+  built.set_index_path(dir);
+  ASSERT_TRUE(built.add_vectors(vectors, ids));
+  ASSERT_TRUE(std::filesystem::exists(std::filesystem::path(dir) / dann::kIndexFileName));
+  ASSERT_TRUE(std::filesystem::exists(std::filesystem::path(dir) / dann::kAuxiliaryFileName));
+  ASSERT_TRUE(std::filesystem::exists(std::filesystem::path(dir) / dann::kManifestFileName));
+
+  // a different shard count re-homes partitions by centroid % shard_count
+  dann::DistributedIndexIVF loaded("distributed_ivf_load", d_, 3, {"node_0"});
+  ASSERT_TRUE(loaded.load_index(dir));
+
+  for (int q = 0; q < 200; q += 37) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    auto expected = built.search(query, 10);
+    auto actual = loaded.search(query, 10);
+    ASSERT_EQ(actual.size(), expected.size());
+    std::vector<int64_t> expected_ids, actual_ids;
+    for (size_t i = 0; i < actual.size(); ++i) {
+      EXPECT_FLOAT_EQ(actual[i].distance, expected[i].distance);
+      expected_ids.push_back(expected[i].id);
+      actual_ids.push_back(actual[i].id);
+    }
+    std::sort(expected_ids.begin(), expected_ids.end());
+    std::sort(actual_ids.begin(), actual_ids.end());
+    EXPECT_EQ(actual_ids, expected_ids);
+  }
+
+  dann::DistributedIndexIVF wrong_dim("distributed_ivf_dim", d_ + 1, shards_, nodes_);
+  EXPECT_FALSE(wrong_dim.load_index(dir));
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, StreamingBuildMatchesExactSearchWithAllListsProbed) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_streaming").string();
+  std::filesystem::remove_all(dir);
+  std::mt19937 rng(32);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  const int n = 3000;
+  std::vector<float> vectors(static_cast<size_t>(n) * d_);
+  std::vector<int64_t> ids(n);
+  for (auto& x: vectors) {
+    x = dist(rng);
+  }
+  std::iota(ids.begin(), ids.end(), 500);
+
+  dann::DistributedIndexIVF index("distributed_ivf_streaming", d_, shards_, 24, 0, nodes_);
+  index.set_posting_storage_mode(dann::PostingStorageMode::MMAP);
+  dann::ArrayChunkReader reader(vectors.data(), ids.data(), ids.size(), d_);
+  dann::StreamingBuildOptions options;
+  options.chunk_rows = 256;
+  // far below the input size, so rows are regrouped through several spill buckets
+  options.memory_budget_bytes = 16 * 1024;
+  ASSERT_TRUE(index.build_index_streaming(reader, dir, options));
+  ASSERT_TRUE(std::filesystem::exists(std::filesystem::path(dir) / dann::kAuxiliaryFileName));
+  for (const auto& entry: std::filesystem::directory_iterator(dir)) {
+    EXPECT_EQ(entry.path().filename().string().rfind("spill.", 0), std::string::npos);
+  }
+
+  dann::InternalSearchParameters all_lists;
+  all_lists.nprobe = 24;
+  for (int q = 0; q < n; q += 301) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    auto exact = dann::find_closest_k_with_distance(vectors.data(), query.data(), d_, n, 5);
+    auto results = index.search(query, 5, all_lists);
+    ASSERT_EQ(results.size(), exact.size());
+    for (size_t i = 0; i < exact.size(); ++i) {
+      EXPECT_EQ(results[i].id, ids[exact[i].index]);
+    }
+  }
+
+  // a reader that does not match the index is refused before anything is written
+  dann::DistributedIndexIVF wrong_dim("distributed_ivf_streaming_dim", d_ + 1, shards_, nodes_);
+  EXPECT_FALSE(wrong_dim.build_index_streaming(reader, dir + "_wrong"));
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, StreamingBuildKeepsPartitionsOfOneBucketApart) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_streaming_one_bucket").string();
+  std::filesystem::remove_all(dir);
+  std::mt19937 rng(33);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  const int n = 3000;
+  std::vector<float> vectors(static_cast<size_t>(n) * d_);
+  std::vector<int64_t> ids(n);
+  for (auto& x: vectors) {
+    x = dist(rng);
+  }
+  std::iota(ids.begin(), ids.end(), 500);
+
+  // the default budget regroups every partition through a single spill bucket
+  dann::DistributedIndexIVF index("distributed_ivf_streaming_one_bucket", d_, shards_, 24, 0, nodes_);
+  index.set_posting_storage_mode(dann::PostingStorageMode::MMAP);
+  dann::ArrayChunkReader reader(vectors.data(), ids.data(), ids.size(), d_);
+  dann::StreamingBuildOptions options;
+  options.chunk_rows = 256;
+  ASSERT_TRUE(index.build_index_streaming(reader, dir, options));
+
+  dann::InternalSearchParameters all_lists;
+  all_lists.nprobe = 24;
+  for (int q = 0; q < n; q += 149) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    auto exact = dann::find_closest_k_with_distance(vectors.data(), query.data(), d_, n, 5);
+    auto results = index.search(query, 5, all_lists);
+    ASSERT_EQ(results.size(), exact.size());
+    for (size_t i = 0; i < exact.size(); ++i) {
+      EXPECT_EQ(results[i].id, ids[exact[i].index]);
+    }
+  }
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, LoadRejectsCorruptedIndexFile) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_corrupt").string();
+  std::filesystem::remove_all(dir);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(100, vectors, ids);
+  dann::DistributedIndexIVF index("distributed_ivf_corrupt", d_, shards_, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  ASSERT_TRUE(index.save_index(dir));
+
+  {
+    std::fstream file(std::filesystem::path(dir) / dann::kIndexFileName,
+                      std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(48);
+    const char garbage[4] = {'x', 'x', 'x', 'x'};
+    file.write(garbage, sizeof(garbage));
+  }
+  dann::DistributedIndexIVF loaded("distributed_ivf_corrupt", d_, shards_, nodes_);
+  EXPECT_FALSE(loaded.load_index(dir));
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, LoadValidatesPartitionTable) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_partition_table").string();
+  std::filesystem::remove_all(dir);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(100, vectors, ids);
+  dann::DistributedIndexIVF index("distributed_ivf_table", d_, shards_, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  ASSERT_TRUE(index.save_index(dir));
+  dann::IvfIndexManifest manifest;
+  dann::IvfRuntimeLayout layout;
+  ASSERT_TRUE(dann::load_index_structure(dir, &manifest, &layout));
+  ASSERT_GE(layout.partitions.size(), 2u);
+
+  // the shard id is covered by the checksum
+  {
+    std::fstream file(std::filesystem::path(dir) / dann::kIndexFileName,
+                      std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(40 + static_cast<std::streamoff>(layout.centroids.size() * sizeof(float)) + 4);
+    const int32_t shard = shards_ + 7;
+    file.write(reinterpret_cast<const char*>(&shard), sizeof(shard));
+  }
+  dann::IvfIndexManifest reloaded_manifest;
+  dann::IvfRuntimeLayout reloaded;
+  EXPECT_FALSE(dann::load_index_structure(dir, &reloaded_manifest, &reloaded));
+
+  // well-formed files with a duplicate partition id or rows past the end are refused
+  auto duplicate = layout;
+  duplicate.partitions[1].partition_id = duplicate.partitions[0].partition_id;
+  ASSERT_TRUE(dann::save_index_structure(dir, manifest, duplicate));
+  EXPECT_FALSE(dann::load_index_structure(dir, &reloaded_manifest, &reloaded));
+  auto out_of_range = layout;
+  out_of_range.partitions[1].partition_id = manifest.nlist;
+  ASSERT_TRUE(dann::save_index_structure(dir, manifest, out_of_range));
+  EXPECT_FALSE(dann::load_index_structure(dir, &reloaded_manifest, &reloaded));
+  auto past_end = layout;
+  past_end.partitions.back().length = static_cast<uint32_t>(manifest.ntotal) + 1;
+  ASSERT_TRUE(dann::save_index_structure(dir, manifest, past_end));
+  EXPECT_FALSE(dann::load_index_structure(dir, &reloaded_manifest, &reloaded));
+
+  ASSERT_TRUE(dann::save_index_structure(dir, manifest, layout));
+  EXPECT_TRUE(dann::load_index_structure(dir, &reloaded_manifest, &reloaded));
+  dann::DistributedIndexIVF loaded("distributed_ivf_table", d_, shards_, nodes_);
+  EXPECT_TRUE(loaded.load_index(dir));
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, MmapLoadServesPartitionsFromFile) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_mmap").string();
+  std::filesystem::remove_all(dir);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(200, vectors, ids);
+  dann::DistributedIndexIVF built("distributed_ivf_mmap", d_, shards_, nodes_);
+  ASSERT_TRUE(built.add_vectors(vectors, ids));
+  ASSERT_TRUE(built.save_index(dir));
+
+  dann::DistributedIndexIVF mapped("distributed_ivf_mmap", d_, shards_, nodes_);
+  mapped.set_posting_storage_mode(dann::PostingStorageMode::MMAP);
+  ASSERT_TRUE(mapped.load_index(dir));
+
+  for (int q = 0; q < 200; q += 41) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    auto expected = built.search(query, 10);
+    auto actual = mapped.search(query, 10);
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      EXPECT_FLOAT_EQ(actual[i].distance, expected[i].distance);
+    }
+  }
+
+  // saving over the mapped directory replaces auxiliary.idx without touching the live mapping
+  ASSERT_TRUE(mapped.save_index(dir));
+  std::vector<float> query(vectors.begin(), vectors.begin() + d_);
+  auto results = mapped.search(query, 1);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_EQ(results[0].distance, 0.0f);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, WarmStartServesAtOnceAndLoadsPartitionsInBackground) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_warm").string();
+  std::filesystem::remove_all(dir);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(200, vectors, ids);
+  dann::DistributedIndexIVF built("distributed_ivf_warm", d_, shards_, nodes_);
+  ASSERT_TRUE(built.add_vectors(vectors, ids));
+  built.set_probe_tracking(true);
+  const std::vector<float> hot_query(vectors.begin(), vectors.begin() + d_);
+  for (int i = 0; i < 20; ++i) {
+    built.search(hot_query, 5);
+  }
+  // a rebalance restarts the probe load but not the heat map
+  built.rebalance();
+  const std::vector<uint64_t> heat = built.probe_heat();
+  ASSERT_FALSE(heat.empty());
+  EXPECT_GE(*std::max_element(heat.begin(), heat.end()), 20u);
+  ASSERT_TRUE(built.save_index(dir));
+
+  dann::DistributedIndexIVF warm("distributed_ivf_warm", d_, shards_, nodes_);
+  warm.set_warm_start(true, 2);
+  ASSERT_TRUE(warm.load_index(dir));
+  EXPECT_EQ(warm.probe_heat(), heat);
+  // answers while the partitions are still being read
+  for (int q = 0; q < 200; q += 37) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    auto expected = built.search(query, 10);
+    auto actual = warm.search(query, 10);
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      EXPECT_FLOAT_EQ(actual[i].distance, expected[i].distance);
+    }
+  }
+  EXPECT_TRUE(warm.wait_warm());
+  const dann::WarmStartProgress progress = warm.warm_progress();
+  EXPECT_TRUE(progress.done);
+  EXPECT_GT(progress.partitions, 0u);
+  EXPECT_EQ(progress.loaded_partitions, progress.partitions);
+  EXPECT_EQ(progress.loaded_bytes, progress.bytes);
+  EXPECT_EQ(progress.bytes, 200u * (sizeof(int64_t) + sizeof(float) * d_));
+
+  // indexes saved without a heat map load in centroid order
+  std::filesystem::remove(std::filesystem::path(dir) / dann::kHeatFileName);
+  dann::DistributedIndexIVF cold("distributed_ivf_warm", d_, shards_, nodes_);
+  cold.set_warm_start(true);
+  ASSERT_TRUE(cold.load_index(dir));
+  EXPECT_TRUE(cold.wait_warm());
+  const std::vector<uint64_t> cold_heat = cold.probe_heat();
+  EXPECT_EQ(cold_heat.size(), heat.size());
+  EXPECT_TRUE(std::all_of(cold_heat.begin(), cold_heat.end(), [](uint64_t h) { return h == 0; }));
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, MmapShardCopiesListOnWrite) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_mmap_cow").string();
+  std::filesystem::remove_all(dir);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(100, vectors, ids);
+  dann::DistributedIndexIVF built("distributed_ivf_cow", d_, 1, {"node_0"});
+  ASSERT_TRUE(built.add_vectors(vectors, ids));
+  ASSERT_TRUE(built.save_index(dir));
+
+  dann::IvfIndexManifest manifest;
+  dann::IvfRuntimeLayout layout;
+  ASSERT_TRUE(dann::load_manifest(dir, &manifest));
+  ASSERT_TRUE(dann::load_index_structure(dir, &manifest, &layout));
+  auto file = std::make_shared<dann::MappedFile>();
+  ASSERT_TRUE(file->open((std::filesystem::path(dir) / dann::kAuxiliaryFileName).string()));
+
+  dann::IndexIVFShard shard(d_, 0, "node_0");
+  ASSERT_TRUE(shard.attach_mapped_partitions(file, layout.partitions));
+  EXPECT_EQ(shard.storage_mode(), dann::PostingStorageMode::MMAP);
+  EXPECT_EQ(shard.size(), ids.size());
+
+  auto it = std::find_if(layout.partitions.begin(), layout.partitions.end(),
+                         [](const dann::PartitionDescriptor& p) { return p.length > 0; });
+  ASSERT_NE(it, layout.partitions.end());
+  const auto desc = *it;
+  dann::PostingView view;
+  ASSERT_TRUE(shard.find_posting(desc.partition_id, &view));
+  EXPECT_EQ(reinterpret_cast<const char*>(view.vector_ids), file->data() + dann::aux_partition_offset(desc, d_));
+
+  dann::InvertedList extra;
+  extra.vector_ids = {100000};
+  extra.vectors.assign(d_, 0.5f);
+  shard.add_posting(desc.partition_id, extra);
+  ASSERT_TRUE(shard.find_posting(desc.partition_id, &view));
+  EXPECT_EQ(view.length, desc.length + 1);
+  EXPECT_EQ(view.vector_ids[view.length - 1], 100000);
+  EXPECT_EQ(shard.size(), ids.size() + 1);
+
+  // leaving MMAP mode copies the remaining mapped lists out
+  shard.set_storage_mode(dann::PostingStorageMode::ARENA);
+  file.reset();
+  EXPECT_EQ(shard.size(), ids.size() + 1);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, ProductQuantizedSearchWithRefine) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(1000, vectors, ids);
+
+  dann::DistributedIndexIVF raw("distributed_ivf_raw", d_, shards_, nodes_);
+  ASSERT_TRUE(raw.add_vectors(vectors, ids));
+
+  dann::QuantizationParameters params;
+  params.type = dann::QuantizerType::PQ;
+  params.pq_m = 4;
+  params.pq_nbits = 6;
+  params.refine_factor = 4;
+  dann::DistributedIndexIVF pq("distributed_ivf_pq", d_, shards_, nodes_);
+  pq.set_quantization(params);
+  ASSERT_TRUE(pq.add_vectors(vectors, ids));
+
+  for (int q = 0; q < 1000; q += 97) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    auto expected = raw.search(query, 5);
+    auto actual = pq.search(query, 5);
+    ASSERT_EQ(actual.size(), expected.size());
+    // refined distances are exact
+    EXPECT_FLOAT_EQ(actual[0].distance, 0.0f);
+    EXPECT_FLOAT_EQ(actual[0].distance, expected[0].distance);
+  }
+
+  std::vector<float> query(vectors.begin(), vectors.begin() + d_);
+  dann::InternalSearchParameters search_params;
+  search_params.include_vectors = true;
+  auto with_vectors = pq.search(query, 1, search_params);
+  ASSERT_EQ(with_vectors.size(), 1u);
+  EXPECT_EQ(with_vectors[0].vector, query);
+}
+
+TEST_F(DistributedIndexIVFTest, ProductQuantizedSearchRerankedFromAuxiliaryFile) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(1000, vectors, ids);
+  const auto dir = std::filesystem::temp_directory_path() / "dann_ivf_rerank_test";
+  std::filesystem::remove_all(dir);
+
+  dann::DistributedIndexIVF raw("distributed_ivf_raw", d_, shards_, nodes_);
+  ASSERT_TRUE(raw.add_vectors(vectors, ids));
+  ASSERT_TRUE(raw.save_index(dir.string()));
+  auto source = std::make_shared<dann::AuxiliaryVectorSource>();
+  ASSERT_TRUE(source->open(dir.string()));
+  EXPECT_EQ(source->size(), ids.size());
+  EXPECT_EQ(source->dimension(), d_);
+  ASSERT_NE(source->vector_data(ids[123]), nullptr);
+  EXPECT_TRUE(std::equal(vectors.begin() + 123 * d_, vectors.begin() + 124 * d_, source->vector_data(ids[123])));
+  EXPECT_EQ(source->vector_data(-1), nullptr);
+
+  // the shards keep codes only; the exact distances come from the mapped file
+  dann::QuantizationParameters params;
+  params.type = dann::QuantizerType::PQ;
+  params.pq_m = 4;
+  params.pq_nbits = 6;
+  dann::DistributedIndexIVF pq("distributed_ivf_pq_rerank", d_, shards_, nodes_);
+  pq.set_quantization(params);
+  pq.set_vector_source(source);
+  pq.set_rerank(8);
+  ASSERT_TRUE(pq.add_vectors(vectors, ids));
+
+  std::vector<float> queries;
+  for (int q = 0; q < 1000; q += 97) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    queries.insert(queries.end(), query.begin(), query.end());
+    auto expected = raw.search(query, 5);
+    dann::QueryStats stats;
+    dann::InternalSearchParameters search_params;
+    search_params.stats = &stats;
+    auto actual = pq.search(query, 5, search_params);
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      EXPECT_FLOAT_EQ(actual[i].distance, expected[i].distance);
+    }
+    EXPECT_EQ(stats.vectors_reranked, 40u);
+  }
+  const size_t nq = queries.size() / d_;
+  auto batch = pq.search_batch(queries.data(), nq, 5);
+  ASSERT_EQ(batch.size(), nq);
+  for (size_t qi = 0; qi < nq; ++qi) {
+    ASSERT_EQ(batch[qi].size(), 5u);
+    EXPECT_FLOAT_EQ(batch[qi][0].distance, 0.0f);
+  }
+
+  pq.set_rerank(0);
+  dann::QueryStats stats;
+  dann::InternalSearchParameters search_params;
+  search_params.stats = &stats;
+  EXPECT_EQ(pq.search(std::vector<float>(queries.begin(), queries.begin() + d_), 5, search_params).size(), 5u);
+  EXPECT_EQ(stats.vectors_reranked, 0u);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, RerankRanksRowsTheSourceLacksLast) {
+  // holds the rows of every 20th id only
+  class SparseSource: public dann::VectorSource {
+  public:
+    SparseSource(const std::vector<float>& vectors, int d): vectors_(vectors), d_(d) {}
+    int dimension() const override { return d_; }
+    const float* vector_data(int64_t id) const override {
+      return id >= 0 && id % 20 == 0 && static_cast<size_t>(id) * d_ < vectors_.size() ? vectors_.data() + id * d_
+                                                                                       : nullptr;
+    }
+
+  private:
+    const std::vector<float>& vectors_;
+    int d_;
+  };
+
+  std::mt19937 rng(11);
+  std::normal_distribution<float> noise(0.0f, 1.0f);
+  const int n = 2000;
+  std::vector<float> vectors(static_cast<size_t>(n) * d_);
+  for (auto& v: vectors) {
+    v = noise(rng);
+  }
+  std::vector<int64_t> ids(n);
+  std::iota(ids.begin(), ids.end(), 0);
+
+  dann::QuantizationParameters params;
+  params.type = dann::QuantizerType::PQ;
+  params.pq_m = 4;
+  params.pq_nbits = 6;
+  dann::DistributedIndexIVF pq("distributed_ivf_sparse_rerank", d_, shards_, nodes_);
+  pq.set_quantization(params);
+  pq.set_vector_source(std::make_shared<SparseSource>(vectors, d_));
+  pq.set_rerank(8);
+  ASSERT_TRUE(pq.add_vectors(vectors, ids));
+
+  const std::vector<float> query(vectors.begin() + 7 * d_, vectors.begin() + 8 * d_);
+  auto results = pq.search(query, 10);
+  ASSERT_EQ(results.size(), 10u);
+  size_t rescored = 0;
+  while (rescored < results.size() && results[rescored].id % 20 == 0) {
+    EXPECT_FLOAT_EQ(results[rescored].distance,
+                    dann::L2_distance(vectors.data() + results[rescored].id * d_, query.data(), d_));
+    if (rescored > 0) {
+      EXPECT_LE(results[rescored - 1].distance, results[rescored].distance);
+    }
+    ++rescored;
+  }
+  EXPECT_GT(rescored, 0u);
+  EXPECT_LT(rescored, results.size());
+  for (size_t i = rescored; i < results.size(); ++i) {
+    EXPECT_NE(results[i].id % 20, 0) << i;
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, ProductQuantizedShardDropsRawRows) {
+  const int d = 8;
+  dann::IndexIVFShard shard(d, 0, "node_0");
+  std::mt19937 rng(7);
+  std::normal_distribution<float> noise(0.0f, 1.0f);
+  dann::InvertedList list;
+  for (int i = 0; i < 400; ++i) {
+    list.vector_ids.push_back(i);
+    for (int j = 0; j < d; ++j) {
+      list.vectors.push_back(noise(rng));
+    }
+  }
+  shard.add_posting(0, list);
+  const size_t raw_bytes = shard.memory_bytes();
+
+  auto pq = std::make_shared<dann::ProductQuantizer>(d, 4, 6);
+  ASSERT_TRUE(pq->train(list.vectors.data(), list.vector_ids.size()));
+  auto centroids = std::make_shared<const std::vector<float>>(d, 0.0f);
+  shard.set_quantizer(pq, centroids, 0);
+  EXPECT_TRUE(shard.is_quantized());
+  EXPECT_EQ(shard.size(), 400u);
+  dann::PostingView view;
+  EXPECT_FALSE(shard.find_posting(0, &view));
+  ASSERT_NE(shard.find_code_list(0), nullptr);
+  EXPECT_EQ(shard.find_code_list(0)->codes.size(), 400u * 4);
+  EXPECT_LT(shard.memory_bytes() * 2, raw_bytes);
+
+  // approximate search still finds the query among its nearest codes
+  std::vector<float> query(list.vectors.begin() + 10 * d, list.vectors.begin() + 11 * d);
+  auto results = shard.search({0}, query, 10, true);
+  ASSERT_EQ(results.size(), 10u);
+  EXPECT_EQ(results[0].vector.size(), static_cast<size_t>(d));
+  bool found = false;
+  for (const auto& r: results) {
+    found |= r.id == 10;
+  }
+  EXPECT_TRUE(found);
+}
+
+TEST_F(DistributedIndexIVFTest, FastScanShardMatchesFloatTableScan) {
+  const int d = 8;
+  dann::IndexIVFShard shard(d, 0, "node_0");
+  std::mt19937 rng(9);
+  std::normal_distribution<float> noise(0.0f, 1.0f);
+  dann::InvertedList list;
+  for (int i = 0; i < 500; ++i) {
+    list.vector_ids.push_back(i);
+    for (int j = 0; j < d; ++j) {
+      list.vectors.push_back(noise(rng));
+    }
+  }
+  dann::InvertedList built;
+  built.vector_ids.assign(list.vector_ids.begin(), list.vector_ids.begin() + 430);
+  built.vectors.assign(list.vectors.begin(), list.vectors.begin() + 430 * d);
+  shard.add_posting(0, built);
+
+  auto pq = std::make_shared<dann::ProductQuantizer>(d, 4, 4, true);
+  ASSERT_TRUE(pq->train(list.vectors.data(), list.vector_ids.size()));
+  auto centroids = std::make_shared<const std::vector<float>>(d, 0.0f);
+  shard.set_quantizer(pq, centroids, 0);
+  ASSERT_NE(shard.find_code_list(0), nullptr);
+  EXPECT_EQ(shard.find_code_list(0)->packed.size(), 14u * dann::fast_scan_block_bytes(4));
+  // the rest arrives online as a segment of its own, and a few rows are deleted
+  dann::InvertedList appended;
+  appended.vector_ids.assign(list.vector_ids.begin() + 430, list.vector_ids.end());
+  appended.vectors.assign(list.vectors.begin() + 430 * d, list.vectors.end());
+  shard.append_postings({{0, appended}});
+  for (int64_t id: {3, 77, 450}) {
+    ASSERT_TRUE(shard.remove_id(id));
+  }
+
+  // reference: every live row scored with the float table
+  std::vector<uint8_t> codes(list.vector_ids.size() * pq->code_size());
+  pq->encode(list.vectors.data(), codes.data(), list.vector_ids.size());
+  auto computer = pq->distance_computer();
+  for (int q = 0; q < 500; q += 61) {
+    std::vector<float> query(list.vectors.begin() + q * d, list.vectors.begin() + (q + 1) * d);
+    computer->set_query(query.data());
+    std::vector<std::pair<float, int64_t>> expected;
+    for (size_t i = 0; i < list.vector_ids.size(); ++i) {
+      if (i != 3 && i != 77 && i != 450) {
+        expected.emplace_back(computer->distance(codes.data() + i * pq->code_size()), list.vector_ids[i]);
+      }
+    }
+    std::sort(expected.begin(), expected.end());
+    for (auto level: {dann::SimdLevel::SCALAR, dann::detected_simd_level()}) {
+      dann::set_simd_level(level);
+      auto results = shard.search({0}, query, 10, false);
+      ASSERT_EQ(results.size(), 10u);
+      for (size_t i = 0; i < results.size(); ++i) {
+        EXPECT_EQ(results[i].id, expected[i].second) << "q=" << q << " level=" << dann::simd_level_name(level);
+        EXPECT_FLOAT_EQ(results[i].distance, expected[i].first);
+      }
+    }
+  }
+  dann::set_simd_level(dann::detected_simd_level());
+}
+
+TEST_F(DistributedIndexIVFTest, ScalarQuantizedSearch) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(500, vectors, ids);
+
+  for (auto type: {dann::QuantizerType::SQ8, dann::QuantizerType::FP16}) {
+    dann::QuantizationParameters params;
+    params.type = type;
+    dann::DistributedIndexIVF index("distributed_ivf_sq", d_, shards_, nodes_);
+    index.set_quantization(params);
+    ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+    for (int q = 0; q < 500; q += 53) {
+      std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+      auto results = index.search(query, 10);
+      ASSERT_EQ(results.size(), 10u);
+      // all ten vectors of the query's group are identical to it; groups are
+      // 20 apart per component, far above the sq8 step over the data range
+      for (const auto& r: results) {
+        EXPECT_EQ(r.id / 10, q / 10);
+        EXPECT_LT(r.distance, 100.0f);
+      }
+    }
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, CosineMetricFindsScaledQuery) {
+  std::mt19937 rng(11);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vectors(200 * d_);
+  std::vector<int64_t> ids(200);
+  for (auto& x: vectors) {
+    x = dist(rng);
+  }
+  std::iota(ids.begin(), ids.end(), 0);
+
+  dann::DistributedIndexIVF index("distributed_ivf_cosine", d_, shards_, nodes_);
+  index.set_metric(dann::DistanceType::COSINE);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  for (int q = 0; q < 200; q += 23) {
+    // cosine ignores magnitude, so a scaled copy is still an exact match
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    for (auto& x: query) {
+      x *= 3.0f;
+    }
+    auto results = index.search(query, 5);
+    ASSERT_FALSE(results.empty());
+    EXPECT_EQ(results[0].id, q);
+    EXPECT_NEAR(results[0].distance, 0.0f, 1e-5f);
+    for (const auto& r: results) {
+      EXPECT_GE(r.distance, -1e-5f);
+      EXPECT_LE(r.distance, 2.0f + 1e-5f);
+    }
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, IndexFactorySelectsMetric) {
+  dann::Index index("index_cosine", d_, 1, "IVF", 16, 100, {"node_0"}, dann::DistanceType::COSINE);
+  auto ivf = std::dynamic_pointer_cast<dann::DistributedIndexIVF>(index.shard(0));
+  ASSERT_NE(ivf, nullptr);
+  EXPECT_EQ(ivf->metric(), dann::DistanceType::COSINE);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(100, vectors, ids);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  std::vector<float> query(vectors.begin() + 50 * d_, vectors.begin() + 51 * d_);
+  auto results = index.search(query, 1);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_NEAR(results[0].distance, 0.0f, 1e-5f);
+  // the stored row comes back, scaled to unit length
+  ASSERT_EQ(results[0].vector.size(), static_cast<size_t>(d_));
+  float norm = 0.0f;
+  for (float x: results[0].vector) {
+    norm += x * x;
+  }
+  EXPECT_NEAR(norm, 1.0f, 1e-4f);
+
+  EXPECT_THROW(dann::Index("hnsw_cosine", d_, 1, "HNSW", 16, 100, {}, dann::DistanceType::COSINE),
+               std::invalid_argument);
+}
+
+TEST_F(DistributedIndexIVFTest, DotMetricReportsNegatedInnerProduct) {
+  std::mt19937 rng(12);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vectors(200 * d_);
+  std::vector<int64_t> ids(200);
+  for (auto& x: vectors) {
+    x = dist(rng);
+  }
+  std::iota(ids.begin(), ids.end(), 0);
+
+  dann::DistributedIndexIVF index("distributed_ivf_dot", d_, shards_, nodes_);
+  index.set_metric(dann::DistanceType::DOT);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  std::vector<float> queries(vectors.begin(), vectors.begin() + 3 * d_);
+  auto batch = index.search_batch(queries.data(), 3, 5);
+  for (int q = 0; q < 3; ++q) {
+    std::vector<float> query(queries.begin() + q * d_, queries.begin() + (q + 1) * d_);
+    auto results = index.search(query, 5);
+    ASSERT_FALSE(results.empty());
+    ASSERT_EQ(batch[q].size(), results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+      float dot = 0.0f;
+      for (int j = 0; j < d_; ++j) {
+        dot += query[j] * vectors[results[i].id * d_ + j];
+      }
+      EXPECT_NEAR(results[i].distance, -dot, 1e-4f);
+      EXPECT_EQ(batch[q][i].id, results[i].id);
+      if (i > 0) {
+        EXPECT_LE(results[i - 1].distance, results[i].distance);
+      }
+    }
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, SaveAndLoadKeepsMetric) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_metric").string();
+  std::filesystem::remove_all(dir);
+
+  std::mt19937 rng(13);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> vectors(200 * d_);
+  std::vector<int64_t> ids(200);
+  for (auto& x: vectors) {
+    x = dist(rng);
+  }
+  std::iota(ids.begin(), ids.end(), 0);
+
+  dann::DistributedIndexIVF built("distributed_ivf_metric", d_, shards_, nodes_);
+  built.set_metric(dann::DistanceType::COSINE);
+  ASSERT_TRUE(built.add_vectors(vectors, ids));
+  ASSERT_TRUE(built.save_index(dir));
+
+  dann::DistributedIndexIVF loaded("distributed_ivf_metric", d_, shards_, nodes_);
+  ASSERT_TRUE(loaded.load_index(dir));
+  EXPECT_EQ(loaded.metric(), dann::DistanceType::COSINE);
+
+  std::vector<float> query(vectors.begin() + 7 * d_, vectors.begin() + 8 * d_);
+  auto expected = built.search(query, 5);
+  auto actual = loaded.search(query, 5);
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t i = 0; i < actual.size(); ++i) {
+    EXPECT_EQ(actual[i].id, expected[i].id);
+    EXPECT_FLOAT_EQ(actual[i].distance, expected[i].distance);
+  }
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, ParallelAssignmentKeepsEveryVector) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_assign").string();
+  std::filesystem::remove_all(dir);
+
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(3000, vectors, ids);
+  dann::DistributedIndexIVF index("distributed_ivf_assign", d_, shards_, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  ASSERT_TRUE(index.save_index(dir));
+
+  // partition lengths written out sum to the input size: no row lost or duplicated
+  dann::IvfIndexManifest manifest;
+  ASSERT_TRUE(dann::load_manifest(dir, &manifest));
+  EXPECT_EQ(manifest.ntotal, 3000);
+
+  for (int q = 0; q < 3000; q += 271) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    auto results = index.search(query, 1);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].distance, 0.0f);
+    EXPECT_EQ(results[0].id / 10, q / 10);
+  }
+  std::filesystem::remove_all(dir);
+}
+
+TEST(CoarseQuantizerTest, ProbingAllGroupsMatchesBruteForce) {
+  const int d = 8;
+  const int64_t nlist = 400;
+  std::mt19937 rng(14);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> centroids(nlist * d);
+  for (auto& x: centroids) {
+    x = dist(rng);
+  }
+
+  dann::CoarseQuantizerParameters params;
+  params.enabled = true;
+  params.ngroups = 20;
+  params.group_probe = 20;
+  dann::CoarseQuantizer coarse(d, dann::DistanceType::L2, params);
+  ASSERT_TRUE(coarse.train(centroids.data(), nlist));
+  EXPECT_EQ(coarse.ngroups(), 20);
+
+  for (int q = 0; q < 10; ++q) {
+    std::vector<float> query(d);
+    for (auto& x: query) {
+      x = dist(rng);
+    }
+    auto expected = dann::find_closest_k_with_distance(centroids.data(), query.data(), d, nlist, 10);
+    auto actual = coarse.search(query.data(), 10);
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      EXPECT_EQ(actual[i].index, expected[i].index);
+      EXPECT_NEAR(actual[i].distance, expected[i].distance, 1e-4f);
+    }
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, CoarseQuantizerSearchFindsExactMatches) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(2000, vectors, ids);
+
+  dann::CoarseQuantizerParameters params;
+  params.enabled = true;
+  dann::DistributedIndexIVF index("distributed_ivf_coarse", d_, shards_, nodes_);
+  index.set_coarse_quantizer(params);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  std::vector<float> queries;
+  for (int q = 0; q < 2000; q += 97) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    queries.insert(queries.end(), query.begin(), query.end());
+    auto results = index.search(query, 1);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].distance, 0.0f);
+  }
+  auto batch = index.search_batch(queries.data(), queries.size() / d_, 1);
+  for (const auto& results: batch) {
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].distance, 0.0f);
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, SeededBuildIsReproducible) {
+  const std::string dir_a = (std::filesystem::temp_directory_path() / "dann_ivf_seed_a").string();
+  const std::string dir_b = (std::filesystem::temp_directory_path() / "dann_ivf_seed_b").string();
+  std::mt19937 rng(15);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  // more vectors than the 64-per-centroid training sample, so sampling is exercised
+  std::vector<float> vectors(20000 * d_);
+  std::vector<int64_t> ids(20000);
+  for (auto& x: vectors) {
+    x = dist(rng);
+  }
+  std::iota(ids.begin(), ids.end(), 0);
+
+  dann::ClusteringParameters cp;
+  cp.init = dann::ClusteringInit::KMEANS_PARALLEL;
+  cp.niter = 5;
+  std::vector<std::string> dirs = {dir_a, dir_b};
+  for (const auto& dir: dirs) {
+    dann::DistributedIndexIVF index("distributed_ivf_seed", d_, shards_, 16, 4, nodes_);
+    index.set_clustering_parameters(cp);
+    ASSERT_TRUE(index.add_vectors(vectors, ids));
+    ASSERT_TRUE(index.save_index(dir));
+  }
+  auto read = [](const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  };
+  EXPECT_EQ(read(dir_a + "/index.idx"), read(dir_b + "/index.idx"));
+  EXPECT_EQ(read(dir_a + "/auxiliary.idx"), read(dir_b + "/auxiliary.idx"));
+  std::filesystem::remove_all(dir_a);
+  std::filesystem::remove_all(dir_b);
+}
+
+TEST_F(DistributedIndexIVFTest, PartitionBalanceCapsListLength) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_balance").string();
+  std::filesystem::remove_all(dir);
+
+  // 90% of the rows in one tight blob, the rest spread wide
+  std::mt19937 rng(16);
+  std::normal_distribution<float> tight(0.0f, 0.1f);
+  std::normal_distribution<float> wide(0.0f, 50.0f);
+  const int n = 2000;
+  std::vector<float> vectors(n * d_);
+  std::vector<int64_t> ids(n);
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < d_; ++j) {
+      vectors[i * d_ + j] = i % 10 == 0 ? wide(rng) : tight(rng);
+    }
+  }
+  std::iota(ids.begin(), ids.end(), 0);
+
+  dann::DistributedIndexIVF index("distributed_ivf_balance", d_, shards_, 8, 8, nodes_);
+  index.set_partition_balance(2.0f);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  ASSERT_TRUE(index.save_index(dir));
+
+  dann::IvfIndexManifest manifest;
+  dann::IvfRuntimeLayout layout;
+  ASSERT_TRUE(dann::load_manifest(dir, &manifest));
+  ASSERT_TRUE(dann::load_index_structure(dir, &manifest, &layout));
+  EXPECT_GT(manifest.nlist, 8);
+  EXPECT_EQ(manifest.ntotal, n);
+  for (const auto& desc: layout.partitions) {
+    EXPECT_LE(desc.length, 2u * n / 8) << "partition " << desc.partition_id;
+  }
+  // every split part that keeps or takes a centroid holds rows
+  for (const auto& list: index.list_health()) {
+    EXPECT_GT(list.rows, 0u) << "centroid " << list.centroid;
+  }
+
+  std::vector<float> query(vectors.begin() + d_, vectors.begin() + 2 * d_);
+  EXPECT_FALSE(index.search(query, 5).empty());
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, ParallelPostingScanMatchesSerialScan) {
+  std::mt19937 rng(18);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  dann::IndexIVFShard shard(d_, 0, "node_0");
+  int64_t next_id = 0;
+  // uneven lists so chunks start and end inside lists and span several of them
+  for (int64_t c: {0, 1, 2, 3}) {
+    dann::InvertedList list;
+    const int rows = 5 + 97 * static_cast<int>(c);
+    for (int i = 0; i < rows; ++i) {
+      list.vector_ids.push_back(next_id++);
+      for (int j = 0; j < d_; ++j) {
+        list.vectors.push_back(dist(rng));
+      }
+    }
+    shard.add_posting(c, list);
+  }
+  std::vector<float> query(d_);
+  for (auto& v: query) {
+    v = dist(rng);
+  }
+  const std::vector<int64_t> probes = {3, 0, 2, 1};
+
+  shard.set_parallel_scan(0);
+  auto serial = shard.search(probes, query, 10);
+  shard.set_parallel_scan(7);
+  auto parallel = shard.search(probes, query, 10);
+  ASSERT_EQ(serial.size(), 10u);
+  ASSERT_EQ(parallel.size(), serial.size());
+  for (size_t i = 0; i < serial.size(); ++i) {
+    EXPECT_EQ(parallel[i].id, serial[i].id);
+    EXPECT_EQ(parallel[i].distance, serial[i].distance);
+    EXPECT_EQ(parallel[i].vector, serial[i].vector);
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, OnlineInsertAppendsToExistingLists) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(500, vectors, ids);
+  dann::DistributedIndexIVF index("distributed_ivf_online", d_, shards_, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  // second batch: copies shifted by a distinct offset per row, with new ids
+  std::vector<float> extra(vectors.begin(), vectors.begin() + 50 * d_);
+  std::vector<int64_t> extra_ids(50);
+  for (size_t i = 0; i < extra.size(); ++i) {
+    extra[i] += 0.01f * static_cast<float>(i / d_ + 1);
+  }
+  std::iota(extra_ids.begin(), extra_ids.end(), 100000);
+  ASSERT_TRUE(index.add_vectors(extra, extra_ids));
+  EXPECT_FALSE(index.add_vectors(std::vector<float>(d_ + 1), {1}));
+
+  for (int i = 0; i < 50; i += 7) {
+    std::vector<float> query(extra.begin() + i * d_, extra.begin() + (i + 1) * d_);
+    auto results = index.search(query, 1);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].id, extra_ids[i]);
+    EXPECT_EQ(results[0].distance, 0.0f);
+  }
+
+  // the appended rows are persisted with the built ones
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_online").string();
+  std::filesystem::remove_all(dir);
+  ASSERT_TRUE(index.save_index(dir));
+  dann::IvfIndexManifest manifest;
+  ASSERT_TRUE(dann::load_manifest(dir, &manifest));
+  EXPECT_EQ(manifest.ntotal, 550);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, ConcurrentFirstAddsTrainOnce) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(400, vectors, ids);
+  const size_t half = ids.size() / 2;
+  std::vector<float> first(vectors.begin(), vectors.begin() + half * d_);
+  std::vector<float> second(vectors.begin() + half * d_, vectors.end());
+  std::vector<int64_t> first_ids(ids.begin(), ids.begin() + half);
+  std::vector<int64_t> second_ids(ids.begin() + half, ids.end());
+
+  // both calls find the index untrained; one trains, the other must insert
+  // rather than rebuild over it
+  dann::DistributedIndexIVF index("distributed_ivf_first_add", d_, shards_, nodes_);
+  std::thread other([&] { EXPECT_TRUE(index.add_vectors(second, second_ids)); });
+  EXPECT_TRUE(index.add_vectors(first, first_ids));
+  other.join();
+  EXPECT_EQ(index.size(), ids.size());
+  for (size_t i = 0; i < ids.size(); i += 37) {
+    std::vector<float> query(vectors.begin() + i * d_, vectors.begin() + (i + 1) * d_);
+    auto results = index.search(query, 1);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].distance, 0.0f);
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, ShardSearchesWhileAppending) {
+  std::mt19937 rng(19);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  dann::IndexIVFShard shard(d_, 0, "node_0");
+  const int batches = 40;
+  const int rows_per_batch = 20;
+  std::vector<float> query(d_, 0.0f);
+
+  std::atomic<bool> done{false};
+  std::atomic<size_t> max_seen{0};
+  std::thread reader([&] {
+    while (!done.load()) {
+      auto results = shard.search({0, 1}, query, 1000, false);
+      // whole batches appear at once
+      EXPECT_EQ(results.size() % rows_per_batch, 0u);
+      max_seen = std::max(max_seen.load(), results.size());
+    }
+  });
+  int64_t next_id = 0;
+  for (int b = 0; b < batches; ++b) {
+    std::unordered_map<int64_t, dann::InvertedList> postings;
+    for (int i = 0; i < rows_per_batch; ++i) {
+      auto& inv = postings[i % 2];
+      inv.vector_ids.push_back(next_id++);
+      for (int j = 0; j < d_; ++j) {
+        inv.vectors.push_back(dist(rng));
+      }
+    }
+    shard.append_postings(postings);
+  }
+  done = true;
+  reader.join();
+  EXPECT_EQ(shard.size(), static_cast<size_t>(batches * rows_per_batch));
+  EXPECT_EQ(shard.search({0, 1}, query, 1000, false).size(), static_cast<size_t>(batches * rows_per_batch));
+}
+
+TEST_F(DistributedIndexIVFTest, ShardTombstonesHideRemovedRows) {
+  std::mt19937 rng(20);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  dann::IndexIVFShard shard(d_, 0, "node_0");
+  auto make_list = [&](int64_t first_id, int rows) {
+    dann::InvertedList inv;
+    for (int i = 0; i < rows; ++i) {
+      inv.vector_ids.push_back(first_id + i);
+      for (int j = 0; j < d_; ++j) {
+        inv.vectors.push_back(dist(rng));
+      }
+    }
+    return inv;
+  };
+  shard.add_posting(0, make_list(0, 40));
+  shard.append_postings({{0, make_list(100, 20)}, {1, make_list(200, 20)}});
+  std::vector<float> query(d_, 0.0f);
+
+  // every third id, from the built list and both segments
+  std::set<int64_t> removed;
+  for (int64_t id: {0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 100, 103, 106, 200}) {
+    EXPECT_TRUE(shard.remove_id(id));
+    removed.insert(id);
+  }
+  EXPECT_FALSE(shard.remove_id(3));
+  EXPECT_FALSE(shard.remove_id(999));
+  EXPECT_EQ(shard.deleted_rows(), removed.size());
+  EXPECT_EQ(shard.size(), 80u - removed.size());
+
+  auto live = shard.search({0, 1}, query, 1000, true);
+  ASSERT_EQ(live.size(), 80u - removed.size());
+  for (const auto& r: live) {
+    EXPECT_EQ(removed.count(r.id), 0u) << r.id;
+  }
+
+  // list 0 is over the ratio and rewritten, list 1 (1 of 20) is left alone
+  EXPECT_EQ(shard.compact(0.1f), 1u);
+  EXPECT_EQ(shard.deleted_rows(), 1u);
+  EXPECT_EQ(shard.size(), 80u - removed.size());
+  auto compacted = shard.search({0, 1}, query, 1000, true);
+  ASSERT_EQ(compacted.size(), live.size());
+  for (size_t i = 0; i < live.size(); ++i) {
+    EXPECT_EQ(compacted[i].id, live[i].id);
+    EXPECT_EQ(compacted[i].vector, live[i].vector);
+  }
+  dann::InvertedList scratch;
+  dann::PostingView view;
+  ASSERT_TRUE(shard.read_posting(0, &scratch, &view));
+  EXPECT_EQ(view.length, 60u - 14u);
+  // ids in rewritten lists can still be deleted
+  EXPECT_TRUE(shard.remove_id(1));
+  EXPECT_EQ(shard.search({0}, query, 1000, false).size(), 60u - 15u);
+
+  // a rebuild folds everything back into plain postings
+  shard.set_quantizer(nullptr, nullptr, 0);
+  EXPECT_EQ(shard.appended_rows(), 0u);
+  EXPECT_EQ(shard.deleted_rows(), 0u);
+  EXPECT_EQ(shard.size(), 80u - removed.size() - 1);
+  EXPECT_EQ(shard.search({0, 1}, query, 1000, false).size(), shard.size());
+}
+
+TEST_F(DistributedIndexIVFTest, RemoveAndUpdateVectors) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(500, vectors, ids);
+  dann::DistributedIndexIVF index("distributed_ivf_delete", d_, shards_, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  index.start_compaction(0.05f, std::chrono::milliseconds(5));
+
+  // each group of 10 rows shares one vector: removing a whole group leaves no exact match
+  std::vector<float> query(vectors.begin(), vectors.begin() + d_);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(index.remove_vector(ids[i]));
+  }
+  EXPECT_FALSE(index.remove_vector(ids[0]));
+  for (const auto& r: index.search(query, 20)) {
+    EXPECT_GE(r.id, ids[10]);
+  }
+
+  std::vector<float> moved(d_, 25.0f);
+  EXPECT_TRUE(index.update_vector(ids[20], moved));
+  EXPECT_FALSE(index.update_vector(ids[0], moved));
+  EXPECT_FALSE(index.update_vector(ids[21], std::vector<float>(d_ + 1)));
+  auto results = index.search(moved, 1);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_EQ(results[0].id, ids[20]);
+  EXPECT_EQ(results[0].distance, 0.0f);
+
+  index.stop_compaction();
+  index.compact(0.0f);
+  for (const auto& r: index.search(query, 20)) {
+    EXPECT_GE(r.id, ids[10]);
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, FilteredSearchReturnsOnlyMatches) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(1000, vectors, ids);
+  dann::DistributedIndexIVF index("distributed_ivf_filter", d_, shards_, 32, 2, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  // one row in fifty is "rare"; every row has a parity
+  std::vector<dann::Attributes> attributes;
+  for (int64_t id: ids) {
+    attributes.push_back({{"parity", id % 2 == 0 ? "even" : "odd"}});
+    if (id % 50 == 0) {
+      attributes.back()["tier"] = "rare";
+    }
+  }
+  ASSERT_TRUE(index.set_attributes(ids, attributes));
+  EXPECT_FALSE(index.set_attributes({ids[0]}, {}));
+
+  std::vector<float> query(vectors.begin() + 500 * d_, vectors.begin() + 501 * d_);
+  dann::InternalSearchParameters params;
+  params.filter = {{"parity", "odd"}};
+  // rows 500-509 share the query vector; five of them are odd
+  auto results = index.search(query, 5, params);
+  ASSERT_EQ(results.size(), 5u);
+  for (const auto& r: results) {
+    EXPECT_EQ(r.id % 2, 1);
+    EXPECT_EQ(r.distance, 0.0f);
+  }
+
+  // a selective filter widens nprobe, so the matches are still found
+  params.filter = {{"tier", "rare"}, {"parity", "even"}};
+  dann::QueryStats stats;
+  params.stats = &stats;
+  results = index.search(query, 5, params);
+  params.stats = nullptr;
+  ASSERT_EQ(results.size(), 5u);
+  EXPECT_GT(stats.lists_probed, 2u);
+  for (const auto& r: results) {
+    EXPECT_EQ(r.id % 50, 0);
+  }
+  auto batch = index.search_batch(vectors.data(), 3, 5, params);
+  ASSERT_EQ(batch.size(), 3u);
+  for (const auto& list: batch) {
+    ASSERT_FALSE(list.empty());
+    for (const auto& r: list) {
+      EXPECT_EQ(r.id % 50, 0);
+    }
+  }
+
+  params.filter = {{"tier", "common"}};
+  EXPECT_TRUE(index.search(query, 5, params).empty());
+  EXPECT_TRUE(index.search_batch(query.data(), 1, 5, params)[0].empty());
+
+  // removed rows lose their attributes; the filter survives a save and load
+  EXPECT_TRUE(index.remove_vector(500));
+  params.filter = {{"tier", "rare"}};
+  for (const auto& r: index.search(query, 20, params)) {
+    EXPECT_NE(r.id, 500);
+  }
+  const auto dir = std::filesystem::temp_directory_path() / "dann_ivf_filter_test";
+  std::filesystem::remove_all(dir);
+  ASSERT_TRUE(index.save_index(dir.string()));
+  EXPECT_TRUE(std::filesystem::exists(dir / dann::kAttributesFileName));
+  dann::DistributedIndexIVF loaded("distributed_ivf_filter", d_, shards_, nodes_);
+  ASSERT_TRUE(loaded.load_index(dir.string()));
+  results = loaded.search(query, 20, params);
+  EXPECT_EQ(results.size(), 19u);
+  for (const auto& r: results) {
+    EXPECT_EQ(r.id % 50, 0);
+  }
+  std::filesystem::remove_all(dir);
+}
+
+TEST(IndexIVFShardFilterTest, ScansOnlyAdmittedRows) {
+  const int d = 8;
+  dann::IndexIVFShard shard(d, 0, "node_0");
+  dann::InvertedList list;
+  for (int64_t id = 0; id < 300; ++id) {
+    list.vector_ids.push_back(id);
+    for (int j = 0; j < d; ++j) {
+      list.vectors.push_back(static_cast<float>(id));
+    }
+  }
+  shard.add_posting(0, list);
+  shard.remove_id(101);
+
+  // admits runs of rows shorter and longer than a scoring block, and a deleted row
+  dann::RoaringBitmap filter;
+  for (int64_t id: {3, 4, 5, 99, 100, 101, 102}) {
+    filter.add(id);
+  }
+  for (int64_t id = 150; id < 250; ++id) {
+    filter.add(id);
+  }
+  std::vector<float> query(d, 50.0f);
+  auto results = shard.search({0}, query, 6, false, nullptr, &filter);
+  std::vector<int64_t> got;
+  for (const auto& r: results) {
+    got.push_back(r.id);
+  }
+  EXPECT_EQ(got, (std::vector<int64_t>{5, 4, 3, 99, 100, 102}));
+
+  std::vector<float> far(d, 260.0f);
+  results = shard.search({0}, far, 3, false, nullptr, &filter);
+  ASSERT_EQ(results.size(), 3u);
+  EXPECT_EQ(results[0].id, 249);
+  EXPECT_EQ(results[2].id, 247);
+
+  std::unordered_map<int64_t, std::vector<int64_t>> centroid_queries{{0, {0, 1}}};
+  std::vector<float> queries = query;
+  queries.insert(queries.end(), far.begin(), far.end());
+  auto batch = shard.search_batch(centroid_queries, queries.data(), 2, 1, false, nullptr, &filter);
+  ASSERT_EQ(batch.size(), 2u);
+  ASSERT_EQ(batch[0].size(), 1u);
+  EXPECT_EQ(batch[0][0].id, 5);
+  EXPECT_EQ(batch[1][0].id, 249);
+}
+
+TEST_F(DistributedIndexIVFTest, MovedListsKeepSearchResults) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(400, vectors, ids);
+  dann::DistributedIndexIVF index("distributed_ivf_rebalance", d_, shards_, 16, 16, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  ASSERT_TRUE(index.remove_vector(ids[3]));
+  index.set_probe_tracking(true);
+
+  std::vector<std::vector<float>> queries;
+  std::vector<std::vector<dann::InternalSearchResult>> before;
+  for (size_t q = 0; q < 8; ++q) {
+    queries.emplace_back(vectors.begin() + q * 50 * d_, vectors.begin() + (q * 50 + 1) * d_);
+    before.push_back(index.search(queries.back(), 10));
+  }
+
+  // every list onto shard 0, with a row appended after the move
+  for (int64_t c = 0; c < 16; ++c) {
+    const int from = index.shard_of(c);
+    EXPECT_EQ(index.move_list(c, 0), from != 0);
+    EXPECT_EQ(index.shard_of(c), 0);
+  }
+  EXPECT_FALSE(index.move_list(0, shards_));
+  EXPECT_EQ(index.size(), 399u);
+  auto stats = index.shard_stats();
+  EXPECT_EQ(stats[0].vectors, 399u);
+  for (size_t q = 0; q < queries.size(); ++q) {
+    auto after = index.search(queries[q], 10);
+    ASSERT_EQ(after.size(), before[q].size());
+    for (size_t i = 0; i < after.size(); ++i) {
+      EXPECT_EQ(after[i].id, before[q][i].id);
+    }
+  }
+  ASSERT_TRUE(index.add_vectors(std::vector<float>(d_, 30.0f), {100000}));
+  EXPECT_EQ(index.shard_stats()[0].vectors, 400u);
+
+  // rebalancing spreads them out again without losing or duplicating a row
+  EXPECT_GT(index.rebalance({1.5, 64, false}), 0u);
+  stats = index.shard_stats();
+  size_t total = 0;
+  for (const auto& entry: stats) {
+    EXPECT_GT(entry.vectors, 0u);
+    total += entry.vectors;
+  }
+  EXPECT_EQ(total, 400u);
+  EXPECT_TRUE(index.plan_rebalance({1.5, 64, false}).empty());
+  for (size_t q = 0; q < queries.size(); ++q) {
+    auto after = index.search(queries[q], 10);
+    ASSERT_EQ(after.size(), before[q].size());
+    for (size_t i = 0; i < after.size(); ++i) {
+      EXPECT_EQ(after[i].id, before[q][i].id);
+    }
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, SizeCountsMovingListsOnce) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(400, vectors, ids);
+  dann::DistributedIndexIVF index("distributed_ivf_move_size", d_, shards_, 16, 16, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  std::atomic<bool> done{false};
+  std::atomic<size_t> wrong{0};
+  std::thread reader([&] {
+    while (!done.load()) {
+      if (index.size() != 400u) {
+        wrong.fetch_add(1);
+      }
+    }
+  });
+  for (int round = 0; round < 200; ++round) {
+    for (int64_t c = 0; c < 16; ++c) {
+      EXPECT_TRUE(index.move_list(c, (index.shard_of(c) + 1) % shards_));
+    }
+  }
+  done.store(true);
+  reader.join();
+  EXPECT_EQ(wrong.load(), 0u);
+  EXPECT_EQ(index.size(), 400u);
+}
+
+TEST_F(DistributedIndexIVFTest, ShardSearchesWhileDeleting) {
+  std::mt19937 rng(21);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  dann::IndexIVFShard shard(d_, 0, "node_0");
+  const int rows = 400;
+  dann::InvertedList built;
+  std::unordered_map<int64_t, dann::InvertedList> appended;
+  for (int i = 0; i < rows; ++i) {
+    auto& inv = i < rows / 2 ? built : appended[0];
+    inv.vector_ids.push_back(i);
+    for (int j = 0; j < d_; ++j) {
+      inv.vectors.push_back(dist(rng));
+    }
+  }
+  shard.add_posting(0, built);
+  shard.append_postings(appended);
+  std::vector<float> query(d_, 0.0f);
+
+  std::atomic<bool> done{false};
+  std::thread reader([&] {
+    size_t last = rows;
+    while (!done.load()) {
+      // deletes are never undone, so a later scan never sees more rows
+      const size_t seen = shard.search({0}, query, rows, false).size();
+      EXPECT_LE(seen, last);
+      last = seen;
+    }
+  });
+  for (int i = 0; i < rows; i += 2) {
+    ASSERT_TRUE(shard.remove_id(i));
+    if (i % 50 == 0) {
+      shard.compact(0.2f);
+    }
+  }
+  done = true;
+  reader.join();
+  EXPECT_EQ(shard.size(), static_cast<size_t>(rows / 2));
+  auto results = shard.search({0}, query, rows, false);
+  ASSERT_EQ(results.size(), static_cast<size_t>(rows / 2));
+  for (const auto& r: results) {
+    EXPECT_EQ(r.id % 2, 1);
+  }
+}
+
+// answers remote shard requests from another in-process index; one node can be
+// made to fail at once or to answer long after any deadline
+class LoopbackShardClient: public dann::ShardClient {
+public:
+  explicit LoopbackShardClient(dann::DistributedIndexIVF* server): server_(server) {}
+  ~LoopbackShardClient() override {
+    for (auto& t: late_) {
+      t.join();
+    }
+  }
+
+  void search_shard(const std::string& node, const dann::InternalShardSearchRequest& request,
+                    std::chrono::steady_clock::time_point, dann::ShardSearchCallback done) override {
+    calls_.fetch_add(1);
+    if (node == failing_node_) {
+      done({});
+      return;
+    }
+    if (node == slow_node_) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      late_.emplace_back([this, request, done] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        dann::InternalShardSearchResponse reply;
+        server_->search_shard(request, &reply);
+        done(std::move(reply));
+      });
+      return;
+    }
+    dann::InternalShardSearchResponse reply;
+    server_->search_shard(request, &reply);
+    done(std::move(reply));
+  }
+
+  std::atomic<int> calls_{0};
+  std::string failing_node_;
+  std::string slow_node_;
+
+private:
+  dann::DistributedIndexIVF* server_;
+  std::mutex mutex_;
+  std::vector<std::thread> late_;
+};
+
+TEST_F(DistributedIndexIVFTest, RemoteShardsAnswerThroughClient) {
+  const std::string dir = (std::filesystem::temp_directory_path() / "dann_ivf_remote").string();
+  std::filesystem::remove_all(dir);
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(300, vectors, ids);
+  {
+    dann::DistributedIndexIVF built("distributed_ivf_remote", d_, shards_, nodes_);
+    ASSERT_TRUE(built.add_vectors(vectors, ids));
+    ASSERT_TRUE(built.save_index(dir));
+  }
+
+  // server holds every shard; the coordinator serves node_0 and asks for node_1's
+  dann::DistributedIndexIVF server("distributed_ivf_remote", d_, shards_, nodes_);
+  ASSERT_TRUE(server.load_index(dir));
+  auto client = std::make_shared<LoopbackShardClient>(&server);
+  dann::DistributedIndexIVF coordinator("distributed_ivf_remote", d_, shards_, nodes_);
+  coordinator.set_remote_shards("node_0", client);
+  ASSERT_TRUE(coordinator.load_index(dir));
+
+  std::vector<float> queries;
+  for (int q = 0; q < 300; q += 37) {
+    std::vector<float> query(vectors.begin() + q * d_, vectors.begin() + (q + 1) * d_);
+    queries.insert(queries.end(), query.begin(), query.end());
+    auto expected = server.search(query, 10);
+    auto actual = coordinator.search(query, 10);
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      EXPECT_FLOAT_EQ(actual[i].distance, expected[i].distance);
+    }
+  }
+  EXPECT_GT(client->calls_.load(), 0);
+
+  const size_t nq = queries.size() / d_;
+  auto expected = server.search_batch(queries.data(), nq, 10);
+  auto actual = coordinator.search_batch(queries.data(), nq, 10);
+  ASSERT_EQ(actual.size(), nq);
+  for (size_t qi = 0; qi < nq; ++qi) {
+    ASSERT_EQ(actual[qi].size(), expected[qi].size());
+    for (size_t i = 0; i < actual[qi].size(); ++i) {
+      EXPECT_FLOAT_EQ(actual[qi][i].distance, expected[qi][i].distance);
+    }
+  }
+
+  // the coordinator does not serve the shards it forwards
+  dann::InternalShardSearchRequest request;
+  request.shard_id = 1;
+  request.centroid_ids = {1};
+  request.query.assign(queries.begin(), queries.begin() + d_);
+  request.k = 10;
+  dann::InternalShardSearchResponse response;
+  EXPECT_FALSE(coordinator.search_shard(request, &response));
+  EXPECT_FALSE(response.success);
+  EXPECT_TRUE(server.search_shard(request, &response));
+
+  // writes are not forwarded: a batch touching node_1's lists is rejected whole,
+  // single rows go in only where node_0 holds their list, and nothing is rebuilt
+  const size_t before = coordinator.size();
+  std::vector<int64_t> new_ids(ids.size());
+  std::iota(new_ids.begin(), new_ids.end(), 10000);
+  EXPECT_FALSE(coordinator.add_vectors(vectors, new_ids));
+  EXPECT_EQ(coordinator.size(), before);
+  size_t accepted = 0;
+  size_t rejected = 0;
+  for (int i = 0; i < 300; i += 10) {
+    std::vector<float> row(vectors.begin() + i * d_, vectors.begin() + (i + 1) * d_);
+    (coordinator.add_vectors(row, {20000 + i}) ? accepted : rejected) += 1;
+  }
+  EXPECT_GT(accepted, 0u);
+  EXPECT_GT(rejected, 0u);
+  EXPECT_EQ(coordinator.size(), before + accepted);
+  coordinator.build_index(vectors, new_ids);
+  EXPECT_EQ(coordinator.size(), before + accepted);
+
+  // nor is the quantizer maintained: node_1's coordinator would route by stale centroids
+  const size_t lists = coordinator.list_health().size();
+  dann::MaintenanceOptions merge_everything;
+  merge_everything.merge_factor = 2.0;
+  const dann::MaintenanceReport report = coordinator.maintain(merge_everything);
+  EXPECT_EQ(report.split + report.merged + report.recentred, 0u);
+  EXPECT_EQ(coordinator.list_health().size(), lists);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DistributedIndexIVFTest, SlowNodeIsCutOffAtDeadline) {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  generate_clustered_data(300, vectors, ids);
+  dann::DistributedIndexIVF server("distributed_ivf_deadline", d_, shards_, nodes_);
+  ASSERT_TRUE(server.add_vectors(vectors, ids));
+  auto client = std::make_shared<LoopbackShardClient>(&server);
+  dann::DistributedIndexIVF coordinator("distributed_ivf_deadline", d_, shards_, nodes_);
+  ASSERT_TRUE(coordinator.add_vectors(vectors, ids));
+  coordinator.set_remote_shards("node_0", client, std::chrono::milliseconds(1000));
+  coordinator.set_node_timeout("node_1", std::chrono::milliseconds(20));
+
+  std::vector<float> query(d_, 100.0f);
+  dann::InternalSearchParameters partial;
+  partial.allow_partial = true;
+  client->failing_node_ = "node_1";
+  const double failures = dann::Metrics::instance().get_counter("ivf_remote_shard_failures");
+  EXPECT_THROW(coordinator.search(query, 50, {}), dann::ShardUnavailableError);
+  auto local_only = coordinator.search(query, 50, partial);
+  EXPECT_GT(dann::Metrics::instance().get_counter("ivf_remote_shard_failures"), failures);
+
+  client->failing_node_.clear();
+  client->slow_node_ = "node_1";
+  const auto start = std::chrono::steady_clock::now();
+  auto results = coordinator.search(query, 50, partial);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_LT(elapsed, std::chrono::milliseconds(150));
+  // the query's own deadline overrides the per-node one
+  partial.timeout_ms = 500;
+  EXPECT_EQ(coordinator.search(query, 50, partial).size(), server.search(query, 50).size());
+  ASSERT_EQ(results.size(), local_only.size());
+  for (size_t i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i].id, local_only[i].id);
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, MaintenanceMergesShortListAndReusesItsId) {
+  std::mt19937 rng(13);
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  for (int i = 0; i < 800; ++i) {
+    for (int j = 0; j < d_; ++j) {
+      vectors.push_back(static_cast<float>(i % 8) * 20.0f + noise(rng));
+    }
+    ids.push_back(i);
+  }
+  dann::DistributedIndexIVF index("distributed_ivf_merge", d_, shards_, 8, 8, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  // one cluster comes out split over two lists; the shorter one is merged away
+  const auto before = index.list_health();
+  ASSERT_EQ(before.size(), 8u);
+  size_t shortest = 800;
+  for (const auto& list: before) {
+    shortest = std::min(shortest, list.rows);
+  }
+  ASSERT_LT(shortest, 50u);
+  dann::MaintenanceOptions options;
+  options.split_factor = 10.0;
+  options.merge_factor = 0.5;
+  const dann::MaintenanceReport report = index.maintain(options);
+  EXPECT_EQ(report.merged, 1u);
+  EXPECT_EQ(report.split + report.recentred, 0u);
+  EXPECT_EQ(report.rows_moved, shortest);
+  EXPECT_EQ(index.size(), 800u);
+  const auto merged = index.list_health();
+  ASSERT_EQ(merged.size(), 7u);
+  size_t rows = 0;
+  for (const auto& list: merged) {
+    rows += list.rows;
+  }
+  EXPECT_EQ(rows, 800u);
+  dann::InternalSearchParameters params;
+  params.nprobe = 8;
+  auto all = index.search(std::vector<float>(d_, 0.0f), 800, params);
+  ASSERT_EQ(all.size(), 800u);
+  std::set<int64_t> seen;
+  for (const auto& result: all) {
+    EXPECT_TRUE(seen.insert(result.id).second) << result.id;
+  }
+
+  // a list grown later splits into the merged id rather than a fresh one
+  std::vector<float> added;
+  std::vector<int64_t> added_ids;
+  for (int i = 0; i < 600; ++i) {
+    for (int j = 0; j < d_; ++j) {
+      added.push_back((j % 2 == 0 ? 4.0f : -4.0f) + noise(rng));
+    }
+    added_ids.push_back(800 + i);
+  }
+  ASSERT_TRUE(index.add_vectors(added, added_ids));
+  EXPECT_GE(index.maintain().split, 1u);
+  const auto split = index.list_health();
+  EXPECT_EQ(split.size(), 8u);
+  rows = 0;
+  for (const auto& list: split) {
+    EXPECT_LT(list.centroid, 8) << "a fresh id while a merged one was free";
+    rows += list.rows;
+  }
+  EXPECT_EQ(rows, 1400u);
+}
+
+TEST_F(DistributedIndexIVFTest, MaintenanceRecentresDriftedList) {
+  std::mt19937 rng(17);
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  for (int i = 0; i < 800; ++i) {
+    for (int j = 0; j < d_; ++j) {
+      vectors.push_back(static_cast<float>(i % 8) * 20.0f + noise(rng));
+    }
+    ids.push_back(i);
+  }
+  dann::DistributedIndexIVF index("distributed_ivf_recentre", d_, shards_, 8, 8, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+
+  // the cluster at 0 drifts towards 3: still its list, but far from its centroid
+  std::vector<float> added;
+  std::vector<int64_t> added_ids;
+  for (int i = 0; i < 80; ++i) {
+    for (int j = 0; j < d_; ++j) {
+      added.push_back(3.0f + noise(rng));
+    }
+    added_ids.push_back(800 + i);
+  }
+  ASSERT_TRUE(index.add_vectors(added, added_ids));
+  vectors.insert(vectors.end(), added.begin(), added.end());
+  int64_t drifted = -1;
+  for (const auto& list: index.list_health()) {
+    if (list.added_rows == 80u) {
+      drifted = list.centroid;
+      EXPECT_GT(list.added_error, 0.0);
+    }
+  }
+  ASSERT_GE(drifted, 0);
+
+  const dann::MaintenanceReport report = index.maintain();
+  EXPECT_EQ(report.recentred, 1u);
+  EXPECT_EQ(report.split + report.merged, 0u);
+  EXPECT_EQ(index.size(), 880u);
+  for (const auto& list: index.list_health()) {
+    if (list.centroid == drifted) {
+      EXPECT_EQ(list.rows, 180u);
+      EXPECT_EQ(list.added_rows, 0u);
+    }
+  }
+  EXPECT_EQ(index.maintain().recentred, 0u);
+  for (int64_t id: {0, 8, 800, 879}) {
+    auto hit = index.search(std::vector<float>(vectors.begin() + id * d_, vectors.begin() + (id + 1) * d_), 1);
+    ASSERT_EQ(hit.size(), 1u);
+    EXPECT_EQ(hit[0].id, id);
+  }
+}
+
+TEST_F(DistributedIndexIVFTest, MaintenanceSplitsGrownListWithoutLosingRows) {
+  std::mt19937 rng(11);
+  std::normal_distribution<float> noise(0.0f, 0.5f);
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  for (int i = 0; i < 800; ++i) {
+    for (int j = 0; j < d_; ++j) {
+      vectors.push_back(static_cast<float>(i % 8) * 20.0f + noise(rng));
+    }
+    ids.push_back(i);
+  }
+  dann::DistributedIndexIVF index("distributed_ivf_maintain", d_, shards_, 8, 8, nodes_);
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  EXPECT_EQ(index.maintain().split, 0u);
+
+  // a new mode grows next to the first cluster, so its list holds far more than the rest
+  std::vector<float> added;
+  std::vector<int64_t> added_ids;
+  for (int i = 0; i < 600; ++i) {
+    for (int j = 0; j < d_; ++j) {
+      added.push_back((j % 2 == 0 ? 4.0f : -4.0f) + noise(rng));
+    }
+    added_ids.push_back(800 + i);
+  }
+  ASSERT_TRUE(index.add_vectors(added, added_ids));
+  vectors.insert(vectors.end(), added.begin(), added.end());
+  ids.insert(ids.end(), added_ids.begin(), added_ids.end());
+
+  size_t largest = 0;
+  for (const auto& list: index.list_health()) {
+    largest = std::max(largest, list.rows);
+  }
+  EXPECT_GE(largest, 700u);
+
+  const dann::MaintenanceReport report = index.maintain();
+  EXPECT_GE(report.split, 1u);
+  EXPECT_GT(report.rows_moved, 0u);
+  EXPECT_EQ(index.size(), 1400u);
+  // further passes split whatever is still oversized, then settle
+  for (int pass = 0; pass < 4 && index.maintain().split > 0; ++pass) {
+  }
+  EXPECT_EQ(index.maintain().split, 0u);
+
+  size_t rows = 0;
+  largest = 0;
+  const auto health = index.list_health();
+  EXPECT_GT(health.size(), 8u);
+  for (const auto& list: health) {
+    rows += list.rows;
+    largest = std::max(largest, list.rows);
+    EXPECT_EQ(list.added_rows, 0u);
+  }
+  EXPECT_EQ(rows, 1400u);
+  EXPECT_LT(largest, 700u);
+
+  // every row is still found, once, through the new lists
+  dann::InternalSearchParameters params;
+  params.nprobe = 64;
+  auto all = index.search(std::vector<float>(d_, 0.0f), 1400, params);
+  ASSERT_EQ(all.size(), 1400u);
+  std::set<int64_t> seen;
+  for (const auto& result: all) {
+    EXPECT_TRUE(seen.insert(result.id).second) << result.id;
+  }
+  for (int64_t id: {0, 7, 801, 1399}) {
+    auto hit = index.search(std::vector<float>(vectors.begin() + id * d_, vectors.begin() + (id + 1) * d_), 1);
+    ASSERT_EQ(hit.size(), 1u);
+    EXPECT_EQ(hit[0].id, id);
+  }
+}
@@ -0,0 +1,89 @@
+//
+// Epoch-based reclamation.
+//
+#include <gtest/gtest.h>
+#include "dann/epoch.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Tracked {
+  std::atomic<int>* freed;
+  ~Tracked() { freed->fetch_add(1); }
+};
+}
+
+TEST(EpochDomainTest, RetiredObjectOutlivesPinnedReader) {
+  auto& domain = dann::get_epoch_domain();
+  std::atomic<int> freed{0};
+  {
+    auto guard = domain.pin();
+    domain.retire(new Tracked{&freed});
+    domain.reclaim();
+    EXPECT_EQ(freed.load(), 0);
+    {
+      // nested pins keep the outer epoch
+      auto inner = domain.pin();
+    }
+    domain.reclaim();
+    EXPECT_EQ(freed.load(), 0);
+  }
+  domain.reclaim();
+  EXPECT_EQ(freed.load(), 1);
+}
+
+TEST(EpochDomainTest, ReaderOnAnotherThreadBlocksReclaim) {
+  auto& domain = dann::get_epoch_domain();
+  std::atomic<int> freed{0};
+  std::atomic<bool> pinned{false};
+  std::atomic<bool> release{false};
+  std::thread reader([&] {
+    auto guard = domain.pin();
+    pinned = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+  });
+  while (!pinned) {
+    std::this_thread::yield();
+  }
+  domain.retire(new Tracked{&freed});
+  EXPECT_EQ(freed.load(), 0);
+  release = true;
+  reader.join();
+  domain.reclaim();
+  EXPECT_EQ(freed.load(), 1);
+}
+
+TEST(EpochDomainTest, ReadersPinnedAfterRetireDoNotBlockIt) {
+  auto& domain = dann::get_epoch_domain();
+  std::atomic<int> freed{0};
+  domain.retire(new Tracked{&freed});
+  auto guard = domain.pin();
+  domain.reclaim();
+  EXPECT_EQ(freed.load(), 1);
+}
+
+TEST(EpochDomainTest, SynchronizeWaitsForEarlierReadersOnly) {
+  auto& domain = dann::get_epoch_domain();
+  std::atomic<bool> pinned{false};
+  std::atomic<bool> released{false};
+  std::thread reader([&] {
+    auto guard = domain.pin();
+    pinned = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    released = true;
+  });
+  while (!pinned) {
+    std::this_thread::yield();
+  }
+  domain.synchronize();
+  EXPECT_TRUE(released.load());
+  reader.join();
+
+  // nothing pinned: returns at once
+  domain.synchronize();
+}
@@ -0,0 +1,138 @@
+//
+// Hedged, replica-aware shard requests.
+//
+#include <gtest/gtest.h>
+#include "dann/hedged_shard_client.h"
+#include "dann/metrics.h"
+
+#include <atomic>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// endpoints answer after a fixed delay on their own thread; "down" fails at once
+class DelayedShardClient: public dann::ShardClient {
+public:
+  ~DelayedShardClient() override {
+    for (auto& t: threads_) {
+      t.join();
+    }
+  }
+
+  void search_shard(const std::string& endpoint, const dann::InternalShardSearchRequest& request,
+                    std::chrono::steady_clock::time_point, dann::ShardSearchCallback done) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    sent_.push_back(endpoint);
+    if (endpoint == "down") {
+      // the failure may fail over into another call right away
+      lock.unlock();
+      done({});
+      return;
+    }
+    const auto delay = delays_.count(endpoint) ? delays_[endpoint] : std::chrono::milliseconds(0);
+    threads_.emplace_back([endpoint, delay, done] {
+      std::this_thread::sleep_for(delay);
+      dann::InternalShardSearchResponse reply;
+      reply.success = true;
+      reply.error_message = endpoint;
+      done(std::move(reply));
+    });
+  }
+
+  std::vector<std::string> sent() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sent_;
+  }
+
+  std::map<std::string, std::chrono::milliseconds> delays_;
+
+private:
+  std::mutex mutex_;
+  std::vector<std::string> sent_;
+  std::vector<std::thread> threads_;
+};
+
+dann::InternalShardSearchResponse search(dann::HedgedShardClient& client, const std::string& node,
+                                         std::chrono::milliseconds timeout = std::chrono::milliseconds(1000)) {
+  auto promise = std::make_shared<std::promise<dann::InternalShardSearchResponse>>();
+  auto future = promise->get_future();
+  dann::InternalShardSearchRequest request;
+  client.search_shard(node, request, std::chrono::steady_clock::now() + timeout,
+                      [promise](dann::InternalShardSearchResponse reply) { promise->set_value(std::move(reply)); });
+  return future.get();
+}
+
+}
+
+TEST(HedgedShardClientTest, SlowReplicaIsHedged) {
+  auto inner = std::make_shared<DelayedShardClient>();
+  inner->delays_["slow"] = std::chrono::milliseconds(300);
+  dann::HedgingOptions options;
+  options.initial_delay = std::chrono::milliseconds(5);
+  dann::HedgedShardClient client(inner, options);
+  client.set_replicas("node_1", {"slow", "fast"});
+
+  const double hedges = dann::Metrics::instance().get_counter("shard_hedges_sent");
+  for (int i = 0; i < 4; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    auto reply = search(client, "node_1");
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+    ASSERT_TRUE(reply.success);
+    EXPECT_EQ(reply.error_message, "fast");
+  }
+  // round robin made "slow" the primary of half the requests, each of them hedged
+  EXPECT_GE(dann::Metrics::instance().get_counter("shard_hedges_sent"), hedges + 2);
+}
+
+TEST(HedgedShardClientTest, HedgeDelayFollowsObservedQuantile) {
+  auto inner = std::make_shared<DelayedShardClient>();
+  dann::HedgingOptions options;
+  options.min_samples = 5;
+  options.initial_delay = std::chrono::milliseconds(50);
+  options.min_delay = std::chrono::microseconds(100);
+  dann::HedgedShardClient client(inner, options);
+  EXPECT_EQ(client.hedge_delay("solo"), std::chrono::milliseconds(50));
+
+  inner->delays_["solo"] = std::chrono::milliseconds(2);
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(search(client, "solo").success);
+  }
+  const auto delay = client.hedge_delay("solo");
+  EXPECT_GE(delay, std::chrono::milliseconds(2));
+  EXPECT_LT(delay, std::chrono::milliseconds(50));
+  // a node without replicas is never duplicated
+  for (const auto& endpoint: inner->sent()) {
+    EXPECT_EQ(endpoint, "solo");
+  }
+}
+
+TEST(HedgedShardClientTest, FailedReplicaFailsOverAndLastFailureIsReported) {
+  auto inner = std::make_shared<DelayedShardClient>();
+  dann::HedgingOptions options;
+  options.initial_delay = std::chrono::milliseconds(500);
+  dann::HedgedShardClient client(inner, options);
+  client.set_replicas("node_1", {"down", "up"});
+  client.set_replicas("node_2", {"down", "down"});
+
+  for (int i = 0; i < 2; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    auto reply = search(client, "node_1");
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+    ASSERT_TRUE(reply.success);
+    EXPECT_EQ(reply.error_message, "up");
+  }
+  std::atomic<int> calls{0};
+  std::promise<bool> finished;
+  dann::InternalShardSearchRequest request;
+  client.search_shard("node_2", request, std::chrono::steady_clock::now() + std::chrono::milliseconds(1000),
+                      [&](dann::InternalShardSearchResponse reply) {
+                        calls.fetch_add(1);
+                        finished.set_value(reply.success);
+                      });
+  EXPECT_FALSE(finished.get_future().get());
+  EXPECT_EQ(calls.load(), 1);
+}
@@ -0,0 +1,104 @@
+//
+// Sharded counters and log-linear histograms, and their use in Metrics.
+//
+#include <gtest/gtest.h>
+#include "dann/histogram.h"
+#include "dann/metrics.h"
+
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+TEST(LatencyHistogramTest, BucketBoundsContainTheirValues) {
+  for (double v : {0.001, 0.37, 1.0, 1.5, 3.9999, 42.0, 1234.5, 9.9e6}) {
+    const size_t index = dann::LatencyHistogram::bucket_index(v);
+    EXPECT_LE(dann::LatencyHistogram::bucket_lower_bound(index), v) << v;
+    EXPECT_GT(dann::LatencyHistogram::bucket_upper_bound(index), v) << v;
+  }
+  EXPECT_EQ(dann::LatencyHistogram::bucket_index(0.0), 0u);
+  EXPECT_EQ(dann::LatencyHistogram::bucket_index(-5.0), 0u);
+  EXPECT_EQ(dann::LatencyHistogram::bucket_index(1e300), dann::LatencyHistogram::kBuckets - 1);
+}
+
+TEST(LatencyHistogramTest, BucketsAreNarrow) {
+  for (size_t i = 1; i + 1 < dann::LatencyHistogram::kBuckets; ++i) {
+    const double lower = dann::LatencyHistogram::bucket_lower_bound(i);
+    const double upper = dann::LatencyHistogram::bucket_upper_bound(i);
+    EXPECT_LE((upper - lower) / lower, 1.0 / dann::LatencyHistogram::kSubBuckets + 1e-12);
+  }
+}
+
+TEST(LatencyHistogramTest, PercentilesWithinBucketError) {
+  dann::LatencyHistogram histogram;
+  for (int i = 1; i <= 1000; ++i) {
+    histogram.record(static_cast<double>(i));
+  }
+  const auto snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.count, 1000u);
+  EXPECT_DOUBLE_EQ(snapshot.sum, 500500.0);
+  EXPECT_DOUBLE_EQ(snapshot.min, 1.0);
+  EXPECT_DOUBLE_EQ(snapshot.max, 1000.0);
+  EXPECT_NEAR(snapshot.percentile(50), 500.0, 500.0 / 16);
+  EXPECT_NEAR(snapshot.percentile(99), 990.0, 990.0 / 16);
+  EXPECT_DOUBLE_EQ(snapshot.percentile(100), 1000.0);
+  EXPECT_EQ(snapshot.count_at_most(1000.0), 1000u);
+  EXPECT_NEAR(static_cast<double>(snapshot.count_at_most(100.0)), 100.0, 100.0 / 16);
+}
+
+TEST(LatencyHistogramTest, ConcurrentRecordsAreAllCounted) {
+  dann::LatencyHistogram histogram;
+  dann::ShardedCounter counter;
+  constexpr int kThreads = 8;
+  constexpr int kPerThread = 20000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&histogram, &counter] {
+      for (int i = 0; i < kPerThread; ++i) {
+        histogram.record(2.0);
+        counter.add(1.0);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const auto snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.count, static_cast<uint64_t>(kThreads) * kPerThread);
+  EXPECT_DOUBLE_EQ(snapshot.sum, 2.0 * kThreads * kPerThread);
+  EXPECT_DOUBLE_EQ(counter.value(), static_cast<double>(kThreads) * kPerThread);
+}
+
+TEST(MetricsHistogramTest, RecordsAndExports) {
+  auto& metrics = dann::Metrics::instance();
+  metrics.clear_all_metrics();
+
+  for (int i = 1; i <= 100; ++i) {
+    metrics.record_histogram("search_latency_ms", static_cast<double>(i));
+  }
+  metrics.increment_counter("searches_total", 3.0);
+  metrics.record_histogram_with_labels("shard_latency_ms", {{"shard", "a"}}, 4.0);
+
+  EXPECT_EQ(metrics.get_histogram_count("search_latency_ms"), 100u);
+  EXPECT_DOUBLE_EQ(metrics.get_histogram_sum("search_latency_ms"), 5050.0);
+  EXPECT_NEAR(metrics.get_histogram_percentile("search_latency_ms", 50), 50.0, 50.0 / 16);
+  EXPECT_EQ(metrics.get_histogram_values("search_latency_ms").size(), 100u);
+  EXPECT_DOUBLE_EQ(metrics.get_counter("searches_total"), 3.0);
+
+  const std::string text = metrics.export_prometheus();
+  EXPECT_NE(text.find("# TYPE search_latency_ms histogram"), std::string::npos);
+  EXPECT_NE(text.find("search_latency_ms_bucket{le=\"+Inf\"} 100"), std::string::npos);
+  EXPECT_NE(text.find("search_latency_ms_count 100"), std::string::npos);
+  EXPECT_NE(text.find("shard_latency_ms_bucket{shard=\"a\",le=\"5\"} 1"), std::string::npos);
+  EXPECT_NE(text.find("searches_total 3"), std::string::npos);
+
+  metrics.remove_metric("search_latency_ms");
+  EXPECT_EQ(metrics.get_histogram_count("search_latency_ms"), 0u);
+  metrics.record_histogram("search_latency_ms", 1.0);
+  EXPECT_EQ(metrics.get_histogram_count("search_latency_ms"), 1u);
+  metrics.clear_all_metrics();
+}
+
+} // namespace
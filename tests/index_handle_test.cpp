@@ -0,0 +1,112 @@
+//
+// Hot swap of the serving index through IndexHandle.
+//
+#include <gtest/gtest.h>
+#include "dann/index.h"
+#include "dann/index_handle.h"
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kDim = 8;
+
+std::shared_ptr<dann::Index> empty_index(int d) {
+  return std::make_shared<dann::Index>("handle_test", d, 1, "IVF", 16, 100, std::vector<std::string>{"node_0"});
+}
+
+// n rows around value, ids from first_id
+std::shared_ptr<dann::Index> make_index(float value, int64_t first_id, int n = 200) {
+  auto index = empty_index(kDim);
+  std::mt19937 rng(static_cast<unsigned>(first_id + 1));
+  std::normal_distribution<float> noise(0.0f, 0.1f);
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < kDim; ++j) {
+      vectors.push_back(value + noise(rng));
+    }
+    ids.push_back(first_id + i);
+  }
+  EXPECT_TRUE(index->add_vectors(vectors, ids));
+  return index;
+}
+
+}
+
+TEST(IndexHandleTest, PublishKeepsPinnedVersionAlive) {
+  dann::IndexHandle handle(make_index(0.0f, 0));
+  EXPECT_EQ(handle.generation(), 0u);
+  EXPECT_EQ(handle.dimension(), kDim);
+
+  std::shared_ptr<dann::Index> pinned = handle.current();
+  std::weak_ptr<dann::Index> old = pinned;
+  auto previous = handle.publish(make_index(5.0f, 1000));
+  EXPECT_EQ(previous, pinned);
+  previous.reset();
+  EXPECT_EQ(handle.generation(), 1u);
+
+  // the request that pinned the old version still finishes on it
+  const std::vector<float> query(kDim, 0.0f);
+  auto results = pinned->search(query, 1);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_LT(results[0].id, 1000);
+  results = handle.current()->search(query, 1);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_GE(results[0].id, 1000);
+
+  pinned.reset();
+  EXPECT_TRUE(old.expired());
+
+  EXPECT_EQ(handle.publish(nullptr), nullptr);
+  EXPECT_EQ(handle.publish(empty_index(kDim * 2)), nullptr);
+  EXPECT_EQ(handle.generation(), 1u);
+}
+
+TEST(IndexHandleTest, ReloadSwapsUnderConcurrentSearches) {
+  dann::IndexHandle handle(make_index(0.0f, 0));
+  std::weak_ptr<dann::Index> old = handle.current();
+
+  std::atomic<bool> stop{false};
+  std::atomic<int> empty{0};
+  std::atomic<int> searches{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&] {
+      const std::vector<float> query(kDim, 0.0f);
+      while (!stop.load()) {
+        if (handle.current()->search(query, 5).size() != 5u) {
+          ++empty;
+        }
+        ++searches;
+      }
+    });
+  }
+
+  ASSERT_TRUE(handle.reload_async([] { return make_index(5.0f, 1000); }));
+  EXPECT_TRUE(handle.wait_reload());
+  while (searches.load() < 100) {
+    std::this_thread::yield();
+  }
+  stop = true;
+  for (auto& reader: readers) {
+    reader.join();
+  }
+  EXPECT_EQ(empty.load(), 0);
+  EXPECT_EQ(handle.generation(), 1u);
+  // reclaimed on the reload thread once the readers let go of it
+  EXPECT_TRUE(old.expired());
+  auto results = handle.current()->search(std::vector<float>(kDim, 0.0f), 1);
+  ASSERT_EQ(results.size(), 1u);
+  EXPECT_GE(results[0].id, 1000);
+
+  // a failed build keeps the index that is serving
+  ASSERT_TRUE(handle.reload_async([] { return std::shared_ptr<dann::Index>(); }));
+  EXPECT_FALSE(handle.wait_reload());
+  EXPECT_EQ(handle.generation(), 1u);
+}
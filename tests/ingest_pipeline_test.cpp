@@ -0,0 +1,71 @@
+//
+// Pipelined bulk ingest.
+//
+#include <gtest/gtest.h>
+#include "dann/index.h"
+#include "dann/ingest_pipeline.h"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+std::vector<float> random_rows(size_t n, int d, std::mt19937& rng) {
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<float> rows(n * d);
+  for (auto& v: rows) {
+    v = dist(rng);
+  }
+  return rows;
+}
+}
+
+TEST(IngestPipelineTest, StreamedChunksAreAllSearchable) {
+  const int d = 16;
+  const size_t chunk_rows = 500;
+  const int chunks = 6;
+  auto index = std::make_shared<dann::Index>("ingest", d, 1, "IVF", 16, 100, std::vector<std::string>{"node_0"});
+  std::mt19937 rng(24);
+  std::vector<float> all;
+  {
+    // the first chunk trains the index, the rest are assigned while earlier ones append
+    dann::IngestPipeline pipeline(index, 2);
+    for (int c = 0; c < chunks; ++c) {
+      auto rows = random_rows(chunk_rows, d, rng);
+      all.insert(all.end(), rows.begin(), rows.end());
+      std::vector<int64_t> ids(chunk_rows);
+      for (size_t i = 0; i < chunk_rows; ++i) {
+        ids[i] = static_cast<int64_t>(c * chunk_rows + i);
+      }
+      ASSERT_TRUE(pipeline.add(std::move(rows), std::move(ids)));
+    }
+    auto result = pipeline.finish();
+    EXPECT_TRUE(result.success);
+    EXPECT_EQ(result.added, chunk_rows * chunks);
+    EXPECT_FALSE(pipeline.add(std::vector<float>(d), {1}));
+  }
+  for (size_t row = 0; row < chunk_rows * chunks; row += 97) {
+    std::vector<float> query(all.begin() + row * d, all.begin() + (row + 1) * d);
+    auto results = index->search(query, 1);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].id, static_cast<int64_t>(row));
+  }
+}
+
+TEST(IngestPipelineTest, MalformedChunkStopsTheStream) {
+  const int d = 8;
+  auto index = std::make_shared<dann::Index>("ingest_bad", d, 1, "IVF", 16, 100, std::vector<std::string>{"node_0"});
+  std::mt19937 rng(25);
+  dann::IngestPipeline pipeline(index);
+  std::vector<int64_t> ids(400);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    ids[i] = static_cast<int64_t>(i);
+  }
+  ASSERT_TRUE(pipeline.add(random_rows(400, d, rng), ids));
+  // one float short of two rows
+  pipeline.add(std::vector<float>(2 * d - 1), {1000, 1001});
+  auto result = pipeline.finish();
+  EXPECT_FALSE(result.success);
+  EXPECT_EQ(result.added, 400u);
+  EXPECT_FALSE(result.error_message.empty());
+}
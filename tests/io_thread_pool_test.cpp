@@ -0,0 +1,76 @@
+//
+// IO thread pool: futures, fork-join helpers and the pending gauge.
+//
+#include <gtest/gtest.h>
+#include "dann/io_thread_pool.h"
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+TEST(IOThreadPoolTest, EnqueueForwardsArguments) {
+  dann::IOThreadPool pool(2);
+  auto sum = pool.enqueue([](int a, int b) { return a + b; }, 2, 40);
+  EXPECT_EQ(sum.get(), 42);
+}
+
+TEST(IOThreadPoolTest, SmallTaskStoresLargeCallables) {
+  int calls = 0;
+  dann::SmallTask small([&calls] { ++calls; });
+  std::array<char, 256> big{};
+  big[0] = 1;
+  dann::SmallTask large([&calls, big] { calls += big[0]; });
+  dann::SmallTask moved(std::move(large));
+  EXPECT_FALSE(static_cast<bool>(large));
+  small();
+  moved();
+  EXPECT_EQ(calls, 2);
+}
+
+TEST(IOThreadPoolTest, RunAllVisitsEveryIndexOnce) {
+  dann::IOThreadPool pool(4);
+  std::vector<std::atomic<int>> hits(257);
+  pool.run_all(hits.size(), [&](size_t i) { hits[i].fetch_add(1); });
+  for (auto& h: hits) {
+    EXPECT_EQ(h.load(), 1);
+  }
+}
+
+TEST(IOThreadPoolTest, NestedParallelForCompletes) {
+  // one worker: the nested call must make progress through the caller helping
+  dann::IOThreadPool pool(1);
+  std::atomic<int> total{0};
+  pool.run_all(8, [&](size_t) {
+    pool.parallel_for(0, 100, 10, [&](size_t lo, size_t hi) { total += static_cast<int>(hi - lo); });
+  });
+  EXPECT_EQ(total.load(), 800);
+}
+
+TEST(IOThreadPoolTest, ParallelForRethrows) {
+  dann::IOThreadPool pool(2);
+  EXPECT_THROW(pool.run_all(16, [](size_t i) {
+    if (i == 9) {
+      throw std::runtime_error("shard failed");
+    }
+  }), std::runtime_error);
+}
+
+TEST(IOThreadPoolTest, PendingTasksCountsQueuedWork) {
+  dann::IOThreadPool pool(1);
+  std::promise<void> gate;
+  auto blocked = gate.get_future().share();
+  auto first = pool.enqueue([blocked] { blocked.wait(); });
+  std::vector<std::future<void>> queued;
+  for (int i = 0; i < 3; ++i) {
+    queued.push_back(pool.enqueue([] {}));
+  }
+  // the worker may not have dequeued the first task yet
+  EXPECT_GE(pool.pending_tasks(), 3u);
+  EXPECT_LE(pool.pending_tasks(), 4u);
+  gate.set_value();
+  first.get();
+  for (auto& f: queued) {
+    f.get();
+  }
+  EXPECT_EQ(pool.pending_tasks(), 0u);
+}
@@ -0,0 +1,225 @@
+//
+// LocalStorage: the append-only log, its replay on startup and compression.
+//
+#include <gtest/gtest.h>
+#include "dann/config.h"
+#include "dann/local_storage.h"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::string fresh_dir(const std::string& name) {
+  const std::string dir = (std::filesystem::temp_directory_path() / name).string();
+  std::filesystem::remove_all(dir);
+  return dir;
+}
+
+std::map<std::string, std::string> read_segments(const std::string& dir) {
+  std::map<std::string, std::string> segments;
+  for (const auto& entry: std::filesystem::directory_iterator(dir + "/log")) {
+    const std::string name = entry.path().filename().string();
+    if (name.rfind("segment.", 0) == 0) {
+      std::ifstream in(entry.path(), std::ios::binary);
+      segments[name].assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+  }
+  return segments;
+}
+
+uint64_t log_bytes(const std::string& dir) {
+  uint64_t bytes = 0;
+  for (const auto& entry: std::filesystem::directory_iterator(dir + "/log")) {
+    if (entry.path().filename().string().rfind("segment.", 0) == 0) {
+      bytes += entry.file_size();
+    }
+  }
+  return bytes;
+}
+
+}
+
+TEST(LocalStorageTest, KeysAndVectorsRoundTripAcrossReopen) {
+  const std::string dir = fresh_dir("dann_local_storage_roundtrip");
+  const std::vector<float> vector = {0.5f, -1.25f, 3.0f, 1e-3f};
+  {
+    dann::LocalStorage storage(dir);
+    ASSERT_TRUE(storage.initialize());
+    ASSERT_TRUE(storage.set("a", "alpha"));
+    ASSERT_TRUE(storage.set("b", std::string("bin\0ary", 7)));
+    ASSERT_TRUE(storage.set("c", "gone soon"));
+    ASSERT_TRUE(storage.set_vector("v", vector));
+    ASSERT_TRUE(storage.del("c"));
+    EXPECT_EQ(storage.get("a"), "alpha");
+    EXPECT_EQ(storage.get_vector("v"), vector);
+    EXPECT_FALSE(storage.exists("c"));
+  }
+
+  // the log is replayed on startup
+  dann::LocalStorage storage(dir);
+  ASSERT_TRUE(storage.initialize());
+  EXPECT_EQ(storage.get("a"), "alpha");
+  EXPECT_EQ(storage.get("b"), std::string("bin\0ary", 7));
+  EXPECT_EQ(storage.get("c"), "");
+  EXPECT_FALSE(storage.exists("c"));
+  EXPECT_EQ(storage.get_vector("v"), vector);
+  std::filesystem::remove_all(dir);
+}
+
+TEST(LocalStorageTest, CompressedValuesRoundTripWithEitherCodec) {
+  std::string value;
+  for (int i = 0; value.size() < 256 * 1024; ++i) {
+    value += "posting list " + std::to_string(i % 50) + " ";
+  }
+  for (const std::string codec: {"lz4", "zstd"}) {
+    dann::Config::StorageConfig config = dann::Config::instance().get_storage_config();
+    config.local_storage_path = fresh_dir("dann_local_storage_" + codec);
+    config.compression_enabled = true;
+    config.compression_codec = codec;
+    {
+      dann::LocalStorage storage(config);
+      ASSERT_TRUE(storage.initialize());
+      ASSERT_TRUE(storage.set("big", value));
+      ASSERT_TRUE(storage.flush_to_disk());
+    }
+    EXPECT_LT(log_bytes(config.local_storage_path), value.size() / 2) << codec;
+
+    // read back by a reader with compression off: frames are recognised by their header
+    dann::LocalStorage storage(config.local_storage_path);
+    ASSERT_TRUE(storage.initialize());
+    EXPECT_EQ(storage.get("big"), value) << codec;
+    std::filesystem::remove_all(config.local_storage_path);
+  }
+}
+
+TEST(LocalStorageTest, CompactionKeepsLiveValuesAndDropsGarbage) {
+  const std::string dir = fresh_dir("dann_local_storage_compact");
+  const std::string padding(1000, 'p');
+  {
+    dann::LocalStorage storage(dir);
+    ASSERT_TRUE(storage.initialize());
+    storage.set_segment_size(4096);
+    for (int round = 0; round < 5; ++round) {
+      for (int k = 0; k < 20; ++k) {
+        ASSERT_TRUE(storage.set("k" + std::to_string(k), std::to_string(round) + padding));
+      }
+    }
+    for (int k = 0; k < 20; k += 4) {
+      ASSERT_TRUE(storage.del("k" + std::to_string(k)));
+    }
+    EXPECT_GT(storage.garbage_ratio(), 0.5);
+    const uint64_t before = log_bytes(dir);
+    ASSERT_TRUE(storage.compact());
+    EXPECT_LT(log_bytes(dir), before / 2);
+    for (int k = 0; k < 20; ++k) {
+      EXPECT_EQ(storage.get("k" + std::to_string(k)), k % 4 == 0 ? "" : "4" + padding) << k;
+    }
+  }
+
+  dann::LocalStorage storage(dir);
+  ASSERT_TRUE(storage.initialize());
+  for (int k = 0; k < 20; ++k) {
+    EXPECT_EQ(storage.exists("k" + std::to_string(k)), k % 4 != 0) << k;
+    EXPECT_EQ(storage.get("k" + std::to_string(k)), k % 4 == 0 ? "" : "4" + padding) << k;
+  }
+  std::filesystem::remove_all(dir);
+}
+
+TEST(LocalStorageTest, DeletesSurviveCrashBeforeCompactionUnlinks) {
+  const std::string dir = fresh_dir("dann_local_storage_crash");
+  const std::string padding(1000, 'p');
+  std::map<std::string, std::string> inputs;
+  {
+    dann::LocalStorage storage(dir);
+    ASSERT_TRUE(storage.initialize());
+    storage.set_segment_size(4096);
+    for (int k = 0; k < 12; ++k) {
+      ASSERT_TRUE(storage.set("k" + std::to_string(k), "old" + padding));
+    }
+    ASSERT_TRUE(storage.set("k1", "new" + padding));
+    ASSERT_TRUE(storage.del("k2"));
+    ASSERT_TRUE(storage.del("k5"));
+    ASSERT_TRUE(storage.set("k5", "again" + padding));
+    ASSERT_TRUE(storage.flush_to_disk());
+    inputs = read_segments(dir);
+    ASSERT_GT(inputs.size(), 2u);
+    ASSERT_TRUE(storage.compact());
+  }
+
+  // the process died after the merged segment was renamed into place but before
+  // any input was unlinked: every input is back and no index snapshot was written
+  const auto merged = read_segments(dir);
+  for (const auto& [name, bytes]: inputs) {
+    if (merged.count(name) == 0) {
+      std::ofstream(dir + "/log/" + name, std::ios::binary) << bytes;
+    }
+  }
+  std::filesystem::remove(dir + "/log/index");
+
+  dann::LocalStorage storage(dir);
+  ASSERT_TRUE(storage.initialize());
+  EXPECT_FALSE(storage.exists("k2"));
+  EXPECT_EQ(storage.get("k1"), "new" + padding);
+  EXPECT_EQ(storage.get("k5"), "again" + padding);
+  EXPECT_EQ(storage.get("k7"), "old" + padding);
+
+  // once the inputs are gone for good, the next compaction drops the tombstones
+  ASSERT_TRUE(storage.compact());
+  ASSERT_TRUE(storage.compact());
+  EXPECT_FALSE(storage.exists("k2"));
+  EXPECT_EQ(storage.get("k11"), "old" + padding);
+  std::filesystem::remove_all(dir);
+}
+
+TEST(LocalStorageTest, ReadersNeverCacheAValueOverwrittenSinceTheirRead) {
+  const std::string dir = fresh_dir("dann_local_storage_race");
+  dann::LocalStorage storage(dir);
+  ASSERT_TRUE(storage.initialize());
+  storage.set_segment_size(4096);
+  // a one-entry cache: the writes to other keys keep evicting "k", so readers miss
+  storage.set_cache_size(1);
+  const int writes = 2000;
+  std::atomic<bool> done{false};
+
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; ++t) {
+    readers.emplace_back([&] {
+      while (!done.load()) {
+        const std::vector<float> vector = storage.get_vector("k");
+        if (!vector.empty()) {
+          EXPECT_EQ(vector.size(), 2u);
+          EXPECT_EQ(vector[0], vector[1]);
+        }
+        storage.get("k");
+      }
+    });
+  }
+  std::thread compactor([&] {
+    while (!done.load()) {
+      storage.compact();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  for (int i = 0; i < writes; ++i) {
+    const float v = static_cast<float>(i);
+    ASSERT_TRUE(storage.set_vector("k", {v, v}));
+    ASSERT_TRUE(storage.set("other" + std::to_string(i % 7), std::to_string(i)));
+  }
+  done.store(true);
+  for (auto& reader: readers) {
+    reader.join();
+  }
+  compactor.join();
+
+  const float last = static_cast<float>(writes - 1);
+  EXPECT_EQ(storage.get_vector("k"), (std::vector<float>{last, last}));
+  storage.set_cache_size(1000);
+  EXPECT_EQ(storage.get_vector("k"), (std::vector<float>{last, last}));
+  std::filesystem::remove_all(dir);
+}
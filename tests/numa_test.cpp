@@ -0,0 +1,120 @@
+//
+// NUMA topology, node-placed arenas, pinned executors and NUMA-mode search.
+//
+#include <gtest/gtest.h>
+#include "dann/compute_executor.h"
+#include "dann/distributed_index_ivf.h"
+#include "dann/numa.h"
+#include "dann/posting_arena.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+TEST(NumaTest, TopologyListsNodesWithCpus) {
+  const auto& nodes = dann::numa_nodes();
+  ASSERT_FALSE(nodes.empty());
+  EXPECT_TRUE(std::is_sorted(nodes.begin(), nodes.end()));
+  for (int node: nodes) {
+    EXPECT_FALSE(dann::numa_node_cpus(node).empty()) << "node " << node;
+  }
+  EXPECT_NE(std::find(nodes.begin(), nodes.end(), dann::current_numa_node()), nodes.end());
+}
+
+TEST(NumaTest, ArenaKeepsRowsAcrossNodes) {
+  const int d = 16;
+  dann::PostingArena arena(d);
+  std::vector<int64_t> ids(5000);
+  std::iota(ids.begin(), ids.end(), 0);
+  std::vector<float> vectors(ids.size() * d);
+  std::iota(vectors.begin(), vectors.end(), 0.0f);
+  arena.append(3, ids.data(), vectors.data(), 3000);
+
+  const int node = dann::numa_nodes().back();
+  arena.set_numa_node(node);
+  EXPECT_EQ(arena.numa_node(), node);
+  // later appends and compaction stay on the node
+  arena.append(1, ids.data() + 3000, vectors.data() + 3000 * d, 2000);
+  arena.compact();
+  EXPECT_EQ(arena.numa_node(), node);
+
+  dann::PostingView view;
+  ASSERT_TRUE(arena.find(3, &view));
+  ASSERT_EQ(view.length, 3000u);
+  EXPECT_TRUE(std::equal(vectors.begin(), vectors.begin() + 3000 * d, view.vectors));
+  ASSERT_TRUE(arena.find(1, &view));
+  ASSERT_EQ(view.length, 2000u);
+  EXPECT_EQ(view.vector_ids[0], 3000);
+  EXPECT_TRUE(std::equal(vectors.begin() + 3000 * d, vectors.end(), view.vectors));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(view.vectors) % dann::kCacheLineSize, 0u);
+
+  arena.set_numa_node(-1);
+  ASSERT_TRUE(arena.find(3, &view));
+  EXPECT_EQ(view.vector_ids[2999], 2999);
+}
+
+#ifdef __linux__
+TEST(NumaTest, PinnedExecutorRunsOnItsNode) {
+  const int node = dann::numa_nodes().front();
+  const auto& cpus = dann::numa_node_cpus(node);
+  dann::ComputeExecutor& executor = dann::get_numa_executor(node);
+  EXPECT_EQ(&executor, &dann::get_numa_executor(node));
+  EXPECT_EQ(executor.numa_node(), node);
+  EXPECT_EQ(executor.size(), cpus.size());
+
+  std::vector<std::future<int>> seen;
+  for (int i = 0; i < 32; ++i) {
+    seen.push_back(executor.submit([] { return sched_getcpu(); }));
+  }
+  for (auto& cpu: seen) {
+    EXPECT_NE(std::find(cpus.begin(), cpus.end(), cpu.get()), cpus.end());
+  }
+}
+#endif
+
+TEST(NumaTest, NumaModeSearchMatchesDefault) {
+  const int d = 8;
+  std::mt19937 rng(3);
+  std::normal_distribution<float> noise(0.0f, 1.0f);
+  std::vector<float> vectors(2000 * d);
+  for (auto& x: vectors) {
+    x = noise(rng);
+  }
+  std::vector<int64_t> ids(2000);
+  std::iota(ids.begin(), ids.end(), 0);
+
+  dann::DistributedIndexIVF plain("numa_plain", d, 4, {"node_0"});
+  ASSERT_TRUE(plain.add_vectors(vectors, ids));
+  dann::DistributedIndexIVF numa("numa_mode", d, 4, {"node_0"});
+  numa.set_posting_storage_mode(dann::PostingStorageMode::ARENA);
+  numa.set_numa(true);
+  EXPECT_TRUE(numa.numa());
+  const auto& nodes = dann::numa_nodes();
+  for (int shard = 0; shard < 4; ++shard) {
+    EXPECT_EQ(numa.numa_node_of(shard), nodes[shard % nodes.size()]);
+  }
+  ASSERT_TRUE(numa.add_vectors(vectors, ids));
+
+  std::vector<float> queries(vectors.begin(), vectors.begin() + 20 * d);
+  auto batch = numa.search_batch(queries.data(), 20, 5);
+  ASSERT_EQ(batch.size(), 20u);
+  for (int q = 0; q < 20; ++q) {
+    std::vector<float> query(queries.begin() + q * d, queries.begin() + (q + 1) * d);
+    auto expected = plain.search(query, 5);
+    auto actual = numa.search(query, 5);
+    ASSERT_EQ(actual.size(), expected.size());
+    ASSERT_EQ(batch[q].size(), expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      EXPECT_EQ(actual[i].id, expected[i].id);
+      EXPECT_EQ(batch[q][i].id, expected[i].id);
+    }
+  }
+
+  numa.set_numa(false);
+  EXPECT_EQ(numa.search(std::vector<float>(queries.begin(), queries.begin() + d), 1)[0].id, 0);
+}
@@ -0,0 +1,109 @@
+//
+// Parquet vector store: zero-copy views and index builds straight from the file.
+//
+#include <gtest/gtest.h>
+
+#ifdef HAVE_ARROW_PARQUET
+
+#include "dann/distributed_index_ivf.h"
+#include "dann/parquet_vector_store.h"
+
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct ParquetFixture {
+  std::vector<float> vectors;
+  std::vector<int64_t> ids;
+};
+
+ParquetFixture random_rows(size_t n, int d, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  ParquetFixture f;
+  f.vectors.resize(n * d);
+  for (auto& x: f.vectors) {
+    x = dist(rng);
+  }
+  f.ids.resize(n);
+  std::iota(f.ids.begin(), f.ids.end(), 1000);
+  return f;
+}
+
+std::string temp_file(const char* name) {
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
+}
+
+TEST(ParquetVectorStoreTest, ViewsMatchWrittenRowsAcrossRowGroups) {
+  const int d = 16;
+  const size_t n = 1000;
+  auto rows = random_rows(n, d, 31);
+  const std::string path = temp_file("dann_parquet_store.parquet");
+  // several row groups, so several blocks
+  ASSERT_TRUE(dann::write_vectors_to_parquet(path, rows.vectors.data(), rows.ids.data(), n, d, 300));
+
+  dann::ParquetVectorStore store;
+  ASSERT_TRUE(store.load(path));
+  EXPECT_EQ(store.size(), n);
+  EXPECT_EQ(store.dimension(), d);
+  EXPECT_GT(store.blocks().size(), 1u);
+
+  for (size_t i = 0; i < n; i += 97) {
+    auto view = store[rows.ids[i]];
+    ASSERT_EQ(view.size(), static_cast<size_t>(d));
+    EXPECT_EQ(view.id(), rows.ids[i]);
+    EXPECT_TRUE(std::equal(view.begin(), view.end(), rows.vectors.begin() + i * d));
+  }
+  EXPECT_TRUE(store[-5].empty());
+  EXPECT_EQ(store.vector_data(-5), nullptr);
+  EXPECT_THROW(store.at(-5), std::out_of_range);
+
+  // views point into the Arrow buffers: a row's block holds the same address
+  const auto& block = store.blocks()[0];
+  EXPECT_EQ(store.vector_data(block.ids[3]), block.vectors + 3 * d);
+
+  size_t seen = 0;
+  for (auto it = store.begin(); it != store.end(); ++it) {
+    EXPECT_EQ((*it).id(), rows.ids[seen]);
+    ++seen;
+  }
+  EXPECT_EQ(seen, n);
+
+  auto batch = store.batch_get({rows.ids[1], -1, rows.ids[2]});
+  ASSERT_EQ(batch.size(), 3u);
+  EXPECT_EQ(batch[0].id(), rows.ids[1]);
+  EXPECT_TRUE(batch[1].empty());
+  EXPECT_FLOAT_EQ(batch[0].l2_distance_square(batch[0]), 0.0f);
+  std::filesystem::remove(path);
+}
+
+TEST(ParquetVectorStoreTest, BuildsIndexAndFillsResultVectors) {
+  const int d = 16;
+  const size_t n = 2000;
+  auto rows = random_rows(n, d, 32);
+  const std::string path = temp_file("dann_parquet_build.parquet");
+  ASSERT_TRUE(dann::write_vectors_to_parquet(path, rows.vectors.data(), rows.ids.data(), n, d));
+  auto store = std::make_shared<dann::ParquetVectorStore>();
+  ASSERT_TRUE(store->load(path));
+  ASSERT_EQ(store->blocks().size(), 1u);
+
+  dann::DistributedIndexIVF index("parquet_ivf", d, 2, 16, 16, {"node1"});
+  dann::build_index_from_store(index, *store);
+  index.set_vector_source(store);
+
+  dann::InternalSearchParameters params;
+  params.include_vectors = true;
+  std::vector<float> query(rows.vectors.begin() + 5 * d, rows.vectors.begin() + 6 * d);
+  auto results = index.search(query, 5, params);
+  ASSERT_FALSE(results.empty());
+  EXPECT_EQ(results[0].id, rows.ids[5]);
+  EXPECT_EQ(results[0].vector, query);
+  std::filesystem::remove(path);
+}
+
+#endif // HAVE_ARROW_PARQUET
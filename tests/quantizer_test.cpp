@@ -0,0 +1,179 @@
+//
+// Posting codecs used by IndexIVFShard.
+//
+#include <gtest/gtest.h>
+#include "dann/distance_kernels.h"
+#include "dann/fast_scan.h"
+#include "dann/product_quantizer.h"
+#include "dann/quantizer.h"
+#include "dann/scalar_quantizer.h"
+#include "dann/utils.h"
+
+#include <random>
+
+class QuantizerTest: public ::testing::Test {
+protected:
+  void SetUp() override {
+    d_ = 16;
+    n_ = 1000;
+    std::mt19937 rng(42);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    data_.resize(static_cast<size_t>(n_) * d_);
+    for (auto& x: data_) {
+      x = noise(rng);
+    }
+  }
+
+  float mean_reconstruction_error(const dann::Quantizer& q) const {
+    std::vector<uint8_t> codes(q.code_size() * n_);
+    std::vector<float> decoded(data_.size());
+    q.encode(data_.data(), codes.data(), n_);
+    q.decode(codes.data(), decoded.data(), n_);
+    float error = 0.0f;
+    for (int i = 0; i < n_; ++i) {
+      error += dann::L2_distance(data_.data() + i * d_, decoded.data() + i * d_, d_);
+    }
+    return error / n_;
+  }
+
+  int d_;
+  int n_;
+  std::vector<float> data_;
+};
+
+TEST_F(QuantizerTest, FactoryValidatesParameters) {
+  dann::QuantizationParameters params;
+  EXPECT_EQ(dann::make_quantizer(d_, params), nullptr);
+
+  params.type = dann::QuantizerType::PQ;
+  params.pq_m = 5;
+  EXPECT_EQ(dann::make_quantizer(d_, params), nullptr);
+  params.pq_m = 4;
+  params.pq_nbits = 9;
+  EXPECT_EQ(dann::make_quantizer(d_, params), nullptr);
+  params.pq_nbits = 6;
+  auto q = dann::make_quantizer(d_, params);
+  ASSERT_NE(q, nullptr);
+  EXPECT_EQ(q->code_size(), 4u);
+  EXPECT_TRUE(q->by_residual());
+  EXPECT_FALSE(q->fast_scan());
+
+  // fast scan ignores pq_nbits and always uses 4-bit codes
+  params.type = dann::QuantizerType::PQ_FASTSCAN;
+  params.pq_m = 3;
+  EXPECT_EQ(dann::make_quantizer(d_, params), nullptr);
+  params.pq_m = 8;
+  q = dann::make_quantizer(d_, params);
+  ASSERT_NE(q, nullptr);
+  EXPECT_EQ(q->code_size(), 8u);
+  EXPECT_TRUE(q->fast_scan());
+}
+
+TEST_F(QuantizerTest, ProductQuantizerReconstructsAndMatchesTable) {
+  dann::ProductQuantizer pq(d_, 8, 6);
+  EXPECT_FALSE(pq.train(data_.data(), 10));
+  ASSERT_TRUE(pq.train(data_.data(), n_));
+  EXPECT_EQ(pq.code_size(), 8u);
+
+  // data has unit variance per dimension, so a useful codebook stays well below d
+  const float error = mean_reconstruction_error(pq);
+  EXPECT_LT(error, 0.5f * d_);
+
+  // ADC distance equals the exact distance to the decoded vector
+  std::vector<uint8_t> code(pq.code_size());
+  std::vector<float> decoded(d_);
+  pq.encode(data_.data() + d_, code.data(), 1);
+  pq.decode(code.data(), decoded.data(), 1);
+  auto computer = pq.distance_computer();
+  computer->set_query(data_.data());
+  EXPECT_NEAR(computer->distance(code.data()), dann::L2_distance(data_.data(), decoded.data(), d_), 1e-3f);
+}
+
+TEST_F(QuantizerTest, HalfConversionRoundsToNearest) {
+  for (float v: {0.0f, 1.0f, -2.5f, 65504.0f, 0.000061035156f, 5.9604645e-8f}) {
+    EXPECT_EQ(dann::half_to_float(dann::float_to_half(v)), v);
+  }
+  EXPECT_EQ(dann::float_to_half(1e6f), 0x7c00);
+  EXPECT_EQ(dann::float_to_half(-0.0f), 0x8000);
+  // 1 + 2^-11 sits halfway between two halves and rounds to the even one
+  EXPECT_EQ(dann::half_to_float(dann::float_to_half(1.0f + 1.0f / 2048)), 1.0f);
+  EXPECT_NEAR(dann::half_to_float(dann::float_to_half(0.1f)), 0.1f, 1e-4f);
+}
+
+TEST_F(QuantizerTest, ScalarQuantizersReconstructAndScoreCodes) {
+  for (auto type: {dann::QuantizerType::SQ8, dann::QuantizerType::FP16}) {
+    dann::ScalarQuantizer sq(d_, type);
+    ASSERT_TRUE(sq.train(data_.data(), n_));
+    EXPECT_EQ(sq.code_size(), type == dann::QuantizerType::SQ8 ? 16u : 32u);
+    EXPECT_FALSE(sq.by_residual());
+    EXPECT_LT(mean_reconstruction_error(sq), type == dann::QuantizerType::SQ8 ? 0.01f * d_ : 1e-5f * d_);
+
+    // the distance on codes matches the distance to the decoded vector
+    std::vector<uint8_t> codes(sq.code_size() * 3);
+    std::vector<float> decoded(3 * d_);
+    sq.encode(data_.data() + d_, codes.data(), 3);
+    sq.decode(codes.data(), decoded.data(), 3);
+    auto computer = sq.distance_computer();
+    computer->set_query(data_.data());
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_NEAR(computer->distance(codes.data() + i * sq.code_size()),
+                  dann::L2_distance(data_.data(), decoded.data() + i * d_, d_), 1e-3f);
+    }
+  }
+}
+
+TEST_F(QuantizerTest, Sq8ClampsValuesOutsideTrainingRange) {
+  dann::ScalarQuantizer sq(d_, dann::QuantizerType::SQ8);
+  ASSERT_TRUE(sq.train(data_.data(), n_));
+  std::vector<float> outlier(d_, 100.0f);
+  std::vector<uint8_t> code(sq.code_size());
+  sq.encode(outlier.data(), code.data(), 1);
+  for (auto c: code) {
+    EXPECT_EQ(c, 255);
+  }
+}
+
+TEST_F(QuantizerTest, FastScanBoundsTheFloatTableAtEveryLevel) {
+  std::mt19937 rng(5);
+  std::uniform_int_distribution<int> nibble(0, 15);
+  std::uniform_real_distribution<float> entry(0.0f, 4.0f);
+  // odd m exercises the padded sub-quantizer, 70 rows a partial last block
+  for (int m: {5, 8}) {
+    const size_t n = 70;
+    std::vector<uint8_t> codes(n * m);
+    for (auto& c: codes) {
+      c = static_cast<uint8_t>(nibble(rng));
+    }
+    std::vector<float> table(static_cast<size_t>(m) * 16);
+    for (auto& t: table) {
+      t = entry(rng);
+    }
+    // packed in two appends, as lists grow
+    std::vector<uint8_t> packed;
+    dann::pack_fast_scan_codes(codes.data(), 40, m, 0, &packed);
+    dann::pack_fast_scan_codes(codes.data() + 40 * m, n - 40, m, 40, &packed);
+    const size_t nblocks = (n + dann::kFastScanBlockRows - 1) / dann::kFastScanBlockRows;
+    ASSERT_EQ(packed.size(), nblocks * dann::fast_scan_block_bytes(m));
+
+    dann::FastScanTable fast;
+    dann::build_fast_scan_table(table.data(), m, &fast);
+    EXPECT_EQ(fast.m % 2, 0);
+
+    for (auto level: {dann::SimdLevel::SCALAR, dann::detected_simd_level()}) {
+      dann::set_simd_level(level);
+      std::vector<uint16_t> sums(nblocks * dann::kFastScanBlockRows);
+      dann::fast_scan_accumulate(packed.data(), nblocks, fast, sums.data());
+      for (size_t i = 0; i < n; ++i) {
+        uint16_t expected_sum = 0;
+        float exact = 0.0f;
+        for (int j = 0; j < m; ++j) {
+          expected_sum += fast.lut[j * 16 + codes[i * m + j]];
+          exact += table[j * 16 + codes[i * m + j]];
+        }
+        EXPECT_EQ(sums[i], expected_sum) << "m=" << m << " row=" << i << " level=" << dann::simd_level_name(level);
+        EXPECT_NEAR(fast.estimate(sums[i]), exact, fast.error);
+      }
+    }
+    dann::set_simd_level(dann::detected_simd_level());
+  }
+}
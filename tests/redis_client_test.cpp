@@ -0,0 +1,64 @@
+//
+// RedisClient against a live server named by DANN_TEST_REDIS ("host:port");
+// skipped when it is not set. Keys are prefixed so a shared server is not disturbed.
+//
+#include <gtest/gtest.h>
+#include "dann/redis_client.h"
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::unique_ptr<dann::RedisClient> connect_test_server() {
+  const char* server = std::getenv("DANN_TEST_REDIS");
+  if (!server) {
+    return nullptr;
+  }
+  const std::string address(server);
+  const size_t colon = address.rfind(':');
+  const std::string host = colon == std::string::npos ? address : address.substr(0, colon);
+  const int port = colon == std::string::npos ? 6379 : std::stoi(address.substr(colon + 1));
+  auto client = std::make_unique<dann::RedisClient>(host, port);
+  return client->connect() ? std::move(client) : nullptr;
+}
+
+}
+
+#define REQUIRE_REDIS(client)                                          \
+  auto client = connect_test_server();                                 \
+  if (!client) {                                                       \
+    GTEST_SKIP() << "set DANN_TEST_REDIS=host:port to run";            \
+  }
+
+TEST(RedisClientTest, ValuesAndVectorsRoundTrip) {
+  REQUIRE_REDIS(client);
+  const std::string binary("bin\0ary", 7);
+  ASSERT_TRUE(client->set("dann_test:a", binary));
+  EXPECT_EQ(client->get("dann_test:a"), binary);
+  EXPECT_TRUE(client->exists("dann_test:a"));
+  EXPECT_TRUE(client->del("dann_test:a"));
+  EXPECT_FALSE(client->exists("dann_test:a"));
+
+  const std::vector<float> vector = {0.5f, -1.25f, 3.0f, 1e-3f};
+  ASSERT_TRUE(client->set_vector("dann_test:v", vector));
+  EXPECT_EQ(client->get_vector("dann_test:v"), vector);
+  EXPECT_TRUE(client->del_vector("dann_test:v"));
+}
+
+TEST(RedisClientTest, BatchesRoundTripInOneCall) {
+  REQUIRE_REDIS(client);
+  ASSERT_TRUE(client->mset({{"dann_test:b1", "one"}, {"dann_test:b2", "two"}}));
+  EXPECT_EQ(client->mget({"dann_test:b1", "dann_test:missing", "dann_test:b2"}),
+            (std::vector<std::string>{"one", "", "two"}));
+
+  auto replies = client->pipeline({{"INCRBY", "dann_test:n", "5"}, {"GET", "dann_test:b1"}, {"DEL", "dann_test:n"}});
+  ASSERT_EQ(replies.size(), 3u);
+  EXPECT_TRUE(replies[0].ok);
+  EXPECT_EQ(replies[0].integer, 5);
+  EXPECT_EQ(replies[1].str, "one");
+  EXPECT_EQ(replies[2].integer, 1);
+  client->pipeline({{"DEL", "dann_test:b1", "dann_test:b2"}});
+}
@@ -0,0 +1,138 @@
+//
+// Result cache keyed by the quantized query.
+//
+#include <gtest/gtest.h>
+#include "dann/index.h"
+#include "dann/result_cache.h"
+
+#include <random>
+#include <vector>
+
+namespace {
+
+dann::ResultCacheOptions plain_lru(size_t capacity) {
+  dann::ResultCacheOptions options;
+  options.capacity = capacity;
+  options.shards = 1;
+  options.admit_on_second_miss = false;
+  return options;
+}
+
+std::vector<dann::InternalSearchResult> results_for(int64_t id) {
+  return {dann::InternalSearchResult(id, 0.5f)};
+}
+
+}
+
+TEST(ResultCacheTest, KeysOnQuantizedQueryKAndVersion) {
+  const int d = 4;
+  dann::ResultCache cache(d, plain_lru(16));
+  dann::InternalSearchParameters params;
+  std::vector<float> query = {0.1f, 0.2f, 0.3f, 0.4f};
+  std::vector<dann::InternalSearchResult> out;
+  EXPECT_FALSE(cache.lookup(query.data(), 5, params, 1, &out));
+  cache.insert(query.data(), 5, params, 1, results_for(7));
+
+  ASSERT_TRUE(cache.lookup(query.data(), 5, params, 1, &out));
+  ASSERT_EQ(out.size(), 1u);
+  EXPECT_EQ(out[0].id, 7);
+  // a re-encoded copy of the same embedding lands on the same grid point
+  std::vector<float> jittered = query;
+  jittered[2] += 1e-8f;
+  EXPECT_TRUE(cache.lookup(jittered.data(), 5, params, 1, &out));
+
+  EXPECT_FALSE(cache.lookup(query.data(), 6, params, 1, &out));
+  dann::InternalSearchParameters without_vectors;
+  without_vectors.include_vectors = false;
+  EXPECT_FALSE(cache.lookup(query.data(), 5, without_vectors, 1, &out));
+  dann::InternalSearchParameters deeper;
+  deeper.nprobe = 32;
+  EXPECT_FALSE(cache.lookup(query.data(), 5, deeper, 1, &out));
+
+  // a write bumped the version: the entry is dropped, not served
+  EXPECT_FALSE(cache.lookup(query.data(), 5, params, 2, &out));
+  EXPECT_EQ(cache.size(), 0u);
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 2u);
+  EXPECT_EQ(stats.misses, 5u);
+}
+
+TEST(ResultCacheTest, EvictsLeastRecentlyUsed) {
+  const int d = 2;
+  dann::ResultCache cache(d, plain_lru(3));
+  dann::InternalSearchParameters params;
+  std::vector<std::vector<float>> queries = {{1, 0}, {2, 0}, {3, 0}, {4, 0}};
+  std::vector<dann::InternalSearchResult> out;
+  for (int i = 0; i < 3; ++i) {
+    cache.insert(queries[i].data(), 1, params, 0, results_for(i));
+  }
+  // touching the oldest entry makes {2, 0} the next victim
+  EXPECT_TRUE(cache.lookup(queries[0].data(), 1, params, 0, &out));
+  cache.insert(queries[3].data(), 1, params, 0, results_for(3));
+  EXPECT_EQ(cache.size(), 3u);
+  EXPECT_TRUE(cache.lookup(queries[0].data(), 1, params, 0, &out));
+  EXPECT_FALSE(cache.lookup(queries[1].data(), 1, params, 0, &out));
+  EXPECT_TRUE(cache.lookup(queries[3].data(), 1, params, 0, &out));
+  EXPECT_EQ(cache.stats().evictions, 1u);
+}
+
+TEST(ResultCacheTest, DoorkeeperAdmitsOnSecondMiss) {
+  const int d = 2;
+  dann::ResultCacheOptions options;
+  options.capacity = 64;
+  dann::ResultCache cache(d, options);
+  dann::InternalSearchParameters params;
+  std::vector<float> query = {5, 6};
+  std::vector<dann::InternalSearchResult> out;
+  cache.insert(query.data(), 1, params, 0, results_for(1));
+  EXPECT_FALSE(cache.lookup(query.data(), 1, params, 0, &out));
+  cache.insert(query.data(), 1, params, 0, results_for(1));
+  EXPECT_TRUE(cache.lookup(query.data(), 1, params, 0, &out));
+}
+
+TEST(ResultCacheTest, IndexServesRepeatsUntilTheNextWrite) {
+  const int d = 8;
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<float> vectors(500 * d);
+  std::vector<int64_t> ids(500);
+  for (size_t i = 0; i < vectors.size(); ++i) {
+    vectors[i] = dist(rng);
+  }
+  for (int i = 0; i < 500; ++i) {
+    ids[i] = i;
+  }
+  dann::Index index("cached", d, 1, "IVF", 16, 100, std::vector<std::string>{"node_0"});
+  ASSERT_TRUE(index.add_vectors(vectors, ids));
+  dann::ResultCacheOptions options = plain_lru(128);
+  index.enable_result_cache(options);
+
+  std::vector<float> query(vectors.begin() + 10 * d, vectors.begin() + 11 * d);
+  auto first = index.search(query, 5);
+  auto second = index.search(query, 5);
+  ASSERT_EQ(first.size(), second.size());
+  for (size_t i = 0; i < first.size(); ++i) {
+    EXPECT_EQ(first[i].id, second[i].id);
+  }
+  EXPECT_EQ(index.result_cache()->stats().hits, 1u);
+
+  // an exact copy of the query added under a new id must show up right away
+  const uint64_t version = index.version();
+  ASSERT_TRUE(index.add_vectors(query, {1000}));
+  EXPECT_NE(index.version(), version);
+  bool found = false;
+  for (const auto& r: index.search(query, 5)) {
+    found = found || r.id == 1000;
+  }
+  EXPECT_TRUE(found);
+
+  // batches consult the cache per query and search only the misses
+  std::vector<float> batch(query);
+  batch.insert(batch.end(), vectors.begin() + 20 * d, vectors.begin() + 21 * d);
+  auto batched = index.search_batch(batch.data(), 2, 5);
+  ASSERT_EQ(batched.size(), 2u);
+  EXPECT_EQ(index.result_cache()->stats().hits, 2u);
+  auto again = index.search_batch(batch.data(), 2, 5);
+  EXPECT_EQ(index.result_cache()->stats().hits, 4u);
+  EXPECT_EQ(again[1].size(), batched[1].size());
+}
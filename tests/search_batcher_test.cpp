@@ -0,0 +1,109 @@
+//
+// Micro-batching of concurrent single-query searches.
+//
+#include <gtest/gtest.h>
+#include "dann/metrics.h"
+#include "dann/search_batcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+// answers each query with one result whose id is the query's first component
+std::vector<std::vector<dann::InternalSearchResult>> echo_batch(const float* queries, size_t nq, int d, int k) {
+  std::vector<std::vector<dann::InternalSearchResult>> results(nq);
+  for (size_t i = 0; i < nq; ++i) {
+    dann::InternalSearchResult r;
+    r.id = static_cast<int64_t>(queries[i * d]);
+    r.distance = static_cast<float>(k);
+    results[i].push_back(r);
+  }
+  return results;
+}
+}
+
+TEST(SearchBatcherTest, ConcurrentQueriesShareBatches) {
+  const int d = 4;
+  std::mutex mutex;
+  std::vector<size_t> batch_sizes;
+  dann::SearchBatcherOptions options;
+  options.window = std::chrono::milliseconds(50);
+  options.max_batch = 8;
+  options.metrics_prefix = "test_batcher_share";
+  dann::SearchBatcher batcher(d, [&](const float* q, size_t nq, int k, const dann::InternalSearchParameters&) {
+    std::lock_guard<std::mutex> lock(mutex);
+    batch_sizes.push_back(nq);
+    return echo_batch(q, nq, d, k);
+  }, options);
+
+  const int threads = 8;
+  std::vector<std::thread> callers;
+  std::atomic<int> correct{0};
+  for (int t = 0; t < threads; ++t) {
+    callers.emplace_back([&, t] {
+      std::vector<float> query(d, static_cast<float>(t));
+      auto results = batcher.search(query.data(), 3);
+      if (results.size() == 1 && results[0].id == t && results[0].distance == 3.0f) {
+        correct.fetch_add(1);
+      }
+    });
+  }
+  for (auto& c: callers) {
+    c.join();
+  }
+  EXPECT_EQ(correct.load(), threads);
+  size_t total = 0;
+  size_t largest = 0;
+  for (auto n: batch_sizes) {
+    total += n;
+    largest = std::max(largest, n);
+  }
+  EXPECT_EQ(total, static_cast<size_t>(threads));
+  EXPECT_GT(largest, 1u);
+  EXPECT_EQ(dann::Metrics::instance().get_histogram_count("test_batcher_share_batch_size"), batch_sizes.size());
+  EXPECT_GT(dann::Metrics::instance().get_histogram_count("test_batcher_share_queue_depth"), 0u);
+}
+
+TEST(SearchBatcherTest, DifferentKAreBatchedSeparately) {
+  const int d = 2;
+  std::vector<int> ks;
+  dann::SearchBatcherOptions options;
+  options.window = std::chrono::milliseconds(20);
+  options.metrics_prefix = "test_batcher_k";
+  dann::SearchBatcher batcher(d, [&](const float* q, size_t nq, int k, const dann::InternalSearchParameters&) {
+    ks.push_back(k);
+    return echo_batch(q, nq, d, k);
+  }, options);
+  std::vector<float> a(d, 1.0f);
+  std::vector<float> b(d, 2.0f);
+  auto fa = batcher.submit(a.data(), 5);
+  auto fb = batcher.submit(b.data(), 7);
+  auto ra = fa.get();
+  auto rb = fb.get();
+  ASSERT_EQ(ra.size(), 1u);
+  ASSERT_EQ(rb.size(), 1u);
+  EXPECT_EQ(ra[0].id, 1);
+  EXPECT_EQ(ra[0].distance, 5.0f);
+  EXPECT_EQ(rb[0].id, 2);
+  EXPECT_EQ(rb[0].distance, 7.0f);
+  EXPECT_EQ(ks.size(), 2u);
+}
+
+TEST(SearchBatcherTest, SearchErrorsReachEveryCaller) {
+  dann::SearchBatcherOptions options;
+  options.window = std::chrono::milliseconds(20);
+  options.metrics_prefix = "test_batcher_error";
+  dann::SearchBatcher batcher(2, [](const float*, size_t, int, const dann::InternalSearchParameters&)
+      -> std::vector<std::vector<dann::InternalSearchResult>> {
+    throw std::runtime_error("shard down");
+  }, options);
+  std::vector<float> q(2, 0.0f);
+  auto f1 = batcher.submit(q.data(), 1);
+  auto f2 = batcher.submit(q.data(), 1);
+  EXPECT_THROW(f1.get(), std::runtime_error);
+  EXPECT_THROW(f2.get(), std::runtime_error);
+}
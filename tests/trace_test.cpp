@@ -0,0 +1,94 @@
+//
+// Trace span capture and its Chrome trace JSON.
+//
+#include <gtest/gtest.h>
+#include "dann/trace.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+size_t count_of(const std::string& text, const std::string& needle) {
+  size_t count = 0;
+  for (size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(TraceTest, SpansOutsideACaptureAreNotRecorded) {
+  { DANN_TRACE_SPAN("test", "before"); }
+  ASSERT_TRUE(dann::Tracer::instance().start());
+  dann::TraceCaptureStats stats;
+  const std::string json = dann::Tracer::instance().stop(&stats);
+  EXPECT_EQ(stats.events, 0u);
+  EXPECT_EQ(json.find("before"), std::string::npos);
+}
+
+TEST(TraceTest, CapturesFinishedSpansAsCompleteEvents) {
+  ASSERT_TRUE(dann::Tracer::instance().start());
+  EXPECT_FALSE(dann::Tracer::instance().start());
+  {
+    DANN_TRACE_SPAN("test", "outer");
+    dann::TraceSpan inner("test", "inner \"quoted\"");
+    inner.end();
+  }
+  dann::TraceCaptureStats stats;
+  const std::string json = dann::Tracer::instance().stop(&stats);
+  EXPECT_EQ(stats.events, 2u);
+  EXPECT_EQ(stats.dropped, 0u);
+  EXPECT_EQ(stats.threads, 1u);
+  EXPECT_NE(json.find("\"traceEvents\":["), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"outer\",\"cat\":\"test\",\"ph\":\"X\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"inner \\\"quoted\\\"\""), std::string::npos);
+  EXPECT_FALSE(dann::Tracer::active());
+
+  // stopping again yields an empty trace
+  const std::string empty = dann::Tracer::instance().stop(&stats);
+  EXPECT_EQ(stats.events, 0u);
+  EXPECT_EQ(count_of(empty, "\"ph\""), 0u);
+}
+
+TEST(TraceTest, FullBuffersDropAndCount) {
+  ASSERT_TRUE(dann::Tracer::instance().start(4));
+  for (int i = 0; i < 10; ++i) {
+    DANN_TRACE_SPAN("test", "span");
+  }
+  dann::TraceCaptureStats stats;
+  const std::string json = dann::Tracer::instance().stop(&stats);
+  EXPECT_EQ(stats.events, 4u);
+  EXPECT_EQ(stats.dropped, 6u);
+  EXPECT_EQ(count_of(json, "\"ph\":\"X\""), 4u);
+}
+
+TEST(TraceTest, ThreadsRecordIntoTheirOwnBuffers) {
+  constexpr int kThreads = 4;
+  constexpr int kSpans = 100;
+  ASSERT_TRUE(dann::Tracer::instance().start());
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([] {
+      for (int i = 0; i < kSpans; ++i) {
+        DANN_TRACE_SPAN("test", "worker");
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  dann::TraceCaptureStats stats;
+  const std::string json = dann::Tracer::instance().stop(&stats);
+  EXPECT_EQ(stats.events, static_cast<uint64_t>(kThreads * kSpans));
+  EXPECT_EQ(stats.threads, static_cast<uint32_t>(kThreads));
+  EXPECT_EQ(count_of(json, "\"name\":\"worker\""), static_cast<size_t>(kThreads * kSpans));
+
+  // a later capture starts from empty buffers
+  ASSERT_TRUE(dann::Tracer::instance().start());
+  { DANN_TRACE_SPAN("test", "again"); }
+  dann::Tracer::instance().stop(&stats);
+  EXPECT_EQ(stats.events, 1u);
+}
+
+} // namespace
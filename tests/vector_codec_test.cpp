@@ -0,0 +1,70 @@
+//
+// Packed vector payloads.
+//
+#include <gtest/gtest.h>
+#include "dann/vector_codec.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+TEST(VectorCodecTest, Float32RoundTripsInPlace) {
+  const int d = 7;
+  std::vector<float> x(3 * d);
+  for (size_t i = 0; i < x.size(); ++i) {
+    x[i] = 0.25f * static_cast<float>(i) - 2.0f;
+  }
+  std::string packed;
+  dann::pack_vectors(x.data(), 3, d, dann::PackedEncoding::FLOAT32, &packed);
+  ASSERT_EQ(packed.size(), x.size() * sizeof(float));
+
+  std::vector<float> scratch;
+  size_t rows = 0;
+  const float* out = dann::unpack_vectors(packed.data(), packed.size(), dann::PackedEncoding::FLOAT32, d, &rows,
+                                          &scratch);
+  ASSERT_NE(out, nullptr);
+  EXPECT_EQ(rows, 3u);
+  // aligned payloads are read where they lie
+  EXPECT_EQ(static_cast<const void*>(out), static_cast<const void*>(packed.data()));
+  EXPECT_TRUE(scratch.empty());
+  EXPECT_EQ(std::vector<float>(out, out + x.size()), x);
+
+  // an odd offset forces the copy
+  std::string shifted = " " + packed;
+  out = dann::unpack_vectors(shifted.data() + 1, packed.size(), dann::PackedEncoding::FLOAT32, d, &rows, &scratch);
+  ASSERT_NE(out, nullptr);
+  EXPECT_EQ(std::vector<float>(out, out + x.size()), x);
+}
+
+TEST(VectorCodecTest, Float16RoundTripsWithinHalfPrecision) {
+  const int d = 16;
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> dist(-4.0f, 4.0f);
+  std::vector<float> x(5 * d);
+  for (auto& v: x) {
+    v = dist(rng);
+  }
+  std::string packed;
+  dann::pack_vectors(x.data(), 5, d, dann::PackedEncoding::FLOAT16, &packed);
+  ASSERT_EQ(packed.size(), x.size() * 2);
+
+  std::vector<float> scratch;
+  size_t rows = 0;
+  const float* out = dann::unpack_vectors(packed.data(), packed.size(), dann::PackedEncoding::FLOAT16, d, &rows,
+                                          &scratch);
+  ASSERT_NE(out, nullptr);
+  EXPECT_EQ(rows, 5u);
+  for (size_t i = 0; i < x.size(); ++i) {
+    EXPECT_NEAR(out[i], x[i], 4.0f / 1024.0f);
+  }
+}
+
+TEST(VectorCodecTest, RejectsPartialRows) {
+  std::string packed(4 * sizeof(float) + 2, '\0');
+  std::vector<float> scratch;
+  size_t rows = 0;
+  EXPECT_EQ(dann::unpack_vectors(packed.data(), packed.size(), dann::PackedEncoding::FLOAT32, 4, &rows, &scratch),
+            nullptr);
+  EXPECT_EQ(dann::unpack_vectors(packed.data(), packed.size(), dann::PackedEncoding::FLOAT16, 0, &rows, &scratch),
+            nullptr);
+}
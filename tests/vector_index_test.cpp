@@ -9,6 +9,9 @@
 #include <chrono>
 #include <fstream>
 #include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 using namespace dann;
 
@@ -124,6 +127,37 @@ TEST(IndexTest, SearchMergeTopK) {
     EXPECT_LE(results.size(), static_cast<size_t>(k));
 }
 
+TEST(IndexTest, ParallelRoutingKeepsEveryRowOnItsShard) {
+    const int dimension = 4;
+    const int shards = 5;
+    Index index("routed", dimension, shards, "HNSW", 16, 40);
+
+    // more rows than one routing chunk, so several chunks scatter concurrently
+    std::vector<float> vectors;
+    std::vector<int64_t> ids;
+    for (int64_t i = 0; i < 10000; ++i) {
+        ids.push_back(i * 7 + 3);
+        for (int d = 0; d < dimension; ++d) {
+            vectors.push_back(static_cast<float>(i) + 0.25f * d);
+        }
+    }
+    ASSERT_TRUE(index.add_vectors(vectors, ids));
+    EXPECT_EQ(index.size(), ids.size());
+
+    std::vector<size_t> expected(shards, 0);
+    for (int64_t id : ids) {
+        ++expected[std::hash<int64_t>{}(id) % shards];
+    }
+    for (int s = 0; s < shards; ++s) {
+        EXPECT_EQ(index.shard(s)->size(), expected[s]) << "shard " << s;
+    }
+    // every row kept its own vector
+    std::vector<float> query(vectors.begin() + 1234 * dimension, vectors.begin() + 1235 * dimension);
+    auto results = index.search(query, 1);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].id, ids[1234]);
+}
+
 // Constructor Tests
 TEST_F(VectorIndexTest, ConstructorWithDefaultParameters) {
     VectorIndex index(dimension_);
@@ -585,6 +619,92 @@ TEST_F(VectorIndexTest, ConcurrentOperations) {
     EXPECT_GT(results.size(), 0);
 }
 
+TEST_F(VectorIndexTest, ConcurrentSearchesDuringInserts) {
+    VectorIndex index(dimension_, "HNSW", hnsw_m_, hnsw_ef_construction_);
+    ASSERT_TRUE(index.add_vectors(test_vectors_, test_ids_));
+
+    std::atomic<bool> stop{false};
+    std::atomic<int> short_results{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&] {
+            const std::vector<float> query(test_vectors_.begin(), test_vectors_.begin() + dimension_);
+            while (!stop.load()) {
+                if (index.search(query, 5).size() != 5u ||
+                    index.search_batch(test_vectors_.data(), 4, 5, InternalSearchParameters{})[3].size() != 5u) {
+                    ++short_results;
+                }
+            }
+        });
+    }
+    for (int batch = 0; batch < 20; ++batch) {
+        std::vector<float> vectors(10 * dimension_);
+        std::vector<int64_t> ids(10);
+        for (int i = 0; i < 10; ++i) {
+            const auto row = generate_random_vector();
+            std::copy(row.begin(), row.end(), vectors.begin() + i * dimension_);
+            ids[i] = 1000 + batch * 10 + i;
+        }
+        ASSERT_TRUE(index.add_vectors(vectors, ids));
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(short_results.load(), 0);
+    EXPECT_EQ(index.size(), test_ids_.size() + 200);
+}
+
+TEST_F(VectorIndexTest, WriteBatchKeepsBufferedRowsSearchable) {
+    VectorIndex index(dimension_);
+    index.set_write_batch(50);
+    ASSERT_TRUE(index.add_vectors(std::vector<float>(test_vectors_.begin(), test_vectors_.begin() + 10 * dimension_),
+                                  std::vector<int64_t>(test_ids_.begin(), test_ids_.begin() + 10)));
+    EXPECT_EQ(index.size(), 10u);
+
+    // buffered rows are found exactly, filtered and removed like indexed ones
+    const std::vector<float> query(test_vectors_.begin() + 3 * dimension_, test_vectors_.begin() + 4 * dimension_);
+    auto results = index.search(query, 1);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].id, 3);
+    EXPECT_FLOAT_EQ(results[0].distance, 0.0f);
+    ASSERT_TRUE(index.set_attributes({4}, {{{"color", "red"}}}));
+    InternalSearchParameters red;
+    red.filter = {{"color", "red"}};
+    results = index.search(query, 5, red);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].id, 4);
+    ASSERT_TRUE(index.remove_vector(3));
+    EXPECT_EQ(index.size(), 9u);
+    results = index.search(query, 1);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_NE(results[0].id, 3);
+
+    // crossing the batch size adds the buffer; indexed and buffered rows merge by distance
+    ASSERT_TRUE(index.add_vectors(std::vector<float>(test_vectors_.begin() + 10 * dimension_,
+                                                     test_vectors_.begin() + 60 * dimension_),
+                                  std::vector<int64_t>(test_ids_.begin() + 10, test_ids_.begin() + 60)));
+    ASSERT_TRUE(index.add_vectors(std::vector<float>(test_vectors_.begin() + 60 * dimension_,
+                                                     test_vectors_.begin() + 61 * dimension_),
+                                  {60}));
+    EXPECT_EQ(index.size(), 60u);
+    const std::vector<float> indexed(test_vectors_.begin() + 20 * dimension_, test_vectors_.begin() + 21 * dimension_);
+    const std::vector<float> buffered(test_vectors_.begin() + 60 * dimension_, test_vectors_.begin() + 61 * dimension_);
+    EXPECT_EQ(index.search(indexed, 1)[0].id, 20);
+    EXPECT_EQ(index.search(buffered, 1)[0].id, 60);
+    auto batch = index.search_batch(test_vectors_.data() + 58 * dimension_, 3, 10, InternalSearchParameters{});
+    ASSERT_EQ(batch.size(), 3u);
+    for (size_t q = 0; q < batch.size(); ++q) {
+        ASSERT_EQ(batch[q].size(), 10u);
+        EXPECT_EQ(batch[q][0].id, static_cast<int64_t>(58 + q));
+        EXPECT_TRUE(std::is_sorted(batch[q].begin(), batch[q].end()));
+    }
+
+    index.flush();
+    EXPECT_EQ(index.size(), 60u);
+    EXPECT_EQ(index.search(buffered, 1)[0].id, 60);
+}
+
 TEST_F(VectorIndexTest, Playground)
 {
     std::vector<int> v1;